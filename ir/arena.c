@@ -0,0 +1,68 @@
+#include <ir/arena.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN(n) (n)
+#else
+#define ARENA_CHUNK_SIZE (256 * 1024)
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#endif
+
+Arena* arena_new(void) {
+  return calloc(1, sizeof(Arena));
+}
+
+static ArenaChunk* arena_add_chunk(Arena* arena, size_t size) {
+  ArenaChunk* chunk = malloc(sizeof(ArenaChunk));
+  chunk->buf = calloc(1, size);
+  chunk->used = 0;
+  chunk->size = size;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  return chunk;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  ArenaChunk* chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size) {
+    if (size > ARENA_CHUNK_SIZE / 4) {
+      // Give big objects their own chunk and keep filling the current one.
+      ArenaChunk* big = arena_add_chunk(arena, size);
+      if (chunk) {
+        arena->chunks = chunk;
+        big->next = chunk->next;
+        chunk->next = big;
+      }
+      big->used = size;
+      return big->buf;
+    }
+    chunk = arena_add_chunk(arena, ARENA_CHUNK_SIZE);
+  }
+  void* r = chunk->buf + chunk->used;
+  chunk->used += size;
+  return r;
+}
+
+char* arena_strdup(Arena* arena, const char* s) {
+  size_t n = strlen(s) + 1;
+  char* r = arena_alloc(arena, n);
+  memcpy(r, s, n);
+  return r;
+}
+
+void arena_free(Arena* arena) {
+  if (!arena)
+    return;
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk* next = chunk->next;
+    free(chunk->buf);
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
@@ -0,0 +1,27 @@
+#ifndef ELVM_ARENA_H_
+#define ELVM_ARENA_H_
+
+#include <stddef.h>
+
+// A chunked bump allocator. Memory returned by arena_alloc is zeroed and
+// stays valid until the whole arena is released by arena_free.
+typedef struct ArenaChunk_ {
+  struct ArenaChunk_* next;
+  char* buf;
+  size_t used;
+  size_t size;
+} ArenaChunk;
+
+typedef struct Arena_ {
+  ArenaChunk* chunks;
+} Arena;
+
+Arena* arena_new(void);
+
+void* arena_alloc(Arena* arena, size_t size);
+
+char* arena_strdup(Arena* arena, const char* s);
+
+void arena_free(Arena* arena);
+
+#endif  // ELVM_ARENA_H_
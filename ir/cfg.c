@@ -0,0 +1,356 @@
+#include <ir/cfg.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+static bool cfg_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+bool cfg_has_reg_jump(Module* m) {
+  for (int i = 0; i < m->num_insts; i++) {
+    if (cfg_is_jump(m->insts[i].op) && m->insts[i].jmp.type == REG)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_pc_value(Module* m, LabelType label, int v, bool plain) {
+  if (label == DATA_LABEL || (label == NOT_LABEL && !plain))
+    return -1;
+  return v >= 0 && v < m->num_pcs ? v : -1;
+}
+
+int cfg_code_address(Module* m, Inst* inst, Value* v, bool plain) {
+  if (v->type != IMM)
+    return -1;
+  if (v->label == NOT_LABEL) {
+    Op op = inst->op;
+    if (v != &inst->src ||
+        (op != MOV && op != ADD && op != SUB && (op < MUL || op > SHR)))
+      return -1;
+  }
+  return cfg_pc_value(m, v->label, v->imm, plain);
+}
+
+int cfg_data_code_address(Module* m, Data* data, bool plain) {
+  return cfg_pc_value(m, data->label, data->v, plain);
+}
+
+static void cfg_mark_address(CFG* cfg, int pc, LabelType label) {
+  if (pc < 0)
+    return;
+  cfg->blocks[pc].address_taken = true;
+  if (label == NOT_LABEL && pc > cfg->max_plain_pc)
+    cfg->max_plain_pc = pc;
+}
+
+static void cfg_mark_value(CFG* cfg, Inst* inst, Value* v, bool plain) {
+  cfg_mark_address(cfg, cfg_code_address(cfg->module, inst, v, plain),
+                   v->label);
+}
+
+static void cfg_add_succ(BasicBlock* bb, int to) {
+  for (int i = 0; i < bb->num_succs; i++) {
+    if (bb->succs[i] == to)
+      return;
+  }
+  bb->succs[bb->num_succs++] = to;
+}
+
+static void cfg_add_succs(CFG* cfg, BasicBlock* bb) {
+  int num_pcs = cfg->module->num_pcs;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return;
+    if (!cfg_is_jump(inst->op))
+      continue;
+    if (inst->jmp.type == REG)
+      cfg_add_succ(bb, cfg->indirect);
+    else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs)
+      cfg_add_succ(bb, inst->jmp.imm);
+    if (inst->op == JMP)
+      return;
+  }
+  if (bb->pc + 1 < num_pcs)
+    cfg_add_succ(bb, bb->pc + 1);
+}
+
+static void cfg_build_edges(CFG* cfg) {
+  Module* m = cfg->module;
+  bool plain = cfg_has_reg_jump(m);
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    cfg_mark_value(cfg, inst, &inst->dst, plain);
+    cfg_mark_value(cfg, inst, &inst->src, plain);
+    if (!cfg_is_jump(inst->op))
+      cfg_mark_value(cfg, inst, &inst->jmp, plain);
+  }
+  for (Data* data = m->data; data; data = data->next)
+    cfg_mark_address(cfg, cfg_data_code_address(m, data, plain), data->label);
+
+  int num_address_taken = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    if (bb->address_taken)
+      num_address_taken++;
+    int max_succs = 1;
+    for (int i = 0; i < bb->num_insts; i++) {
+      if (cfg_is_jump(bb->insts[i].op))
+        max_succs++;
+    }
+    bb->succs = arena_alloc(cfg->arena, sizeof(int) * max_succs);
+    cfg_add_succs(cfg, bb);
+  }
+
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  indirect->succs = arena_alloc(cfg->arena, sizeof(int) * num_address_taken);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (cfg->blocks[pc].address_taken)
+      indirect->succs[indirect->num_succs++] = pc;
+  }
+
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++)
+      cfg->blocks[bb->succs[j]].num_preds++;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    bb->preds = arena_alloc(cfg->arena, sizeof(int) * bb->num_preds);
+    bb->num_preds = 0;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++) {
+      BasicBlock* succ = &cfg->blocks[bb->succs[j]];
+      succ->preds[succ->num_preds++] = i;
+    }
+  }
+}
+
+static void cfg_compute_rpo(CFG* cfg) {
+  int n = cfg->num_blocks;
+  cfg->rpo = arena_alloc(cfg->arena, sizeof(int) * n);
+  for (int i = 0; i < n; i++)
+    cfg->blocks[i].rpo = -1;
+  if (!cfg->module->num_pcs)
+    return;
+
+  int* stack = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* next = arena_alloc(cfg->arena, sizeof(int) * n);
+  bool* visited = arena_alloc(cfg->arena, sizeof(bool) * n);
+  int sp = 0;
+  int num_post = 0;
+  stack[sp++] = 0;
+  visited[0] = true;
+  while (sp) {
+    int b = stack[sp - 1];
+    BasicBlock* bb = &cfg->blocks[b];
+    if (next[b] < bb->num_succs) {
+      int s = bb->succs[next[b]++];
+      if (!visited[s]) {
+        visited[s] = true;
+        stack[sp++] = s;
+      }
+    } else {
+      // Blocks are stored in postorder and reversed below.
+      cfg->rpo[num_post++] = b;
+      sp--;
+    }
+  }
+
+  for (int i = 0; i < num_post / 2; i++) {
+    int t = cfg->rpo[i];
+    cfg->rpo[i] = cfg->rpo[num_post - 1 - i];
+    cfg->rpo[num_post - 1 - i] = t;
+  }
+  cfg->num_rpo = num_post;
+  for (int i = 0; i < num_post; i++)
+    cfg->blocks[cfg->rpo[i]].rpo = i;
+}
+
+static int cfg_intersect(CFG* cfg, int a, int b) {
+  BasicBlock* blocks = cfg->blocks;
+  while (a != b) {
+    while (blocks[a].rpo > blocks[b].rpo)
+      a = blocks[a].idom;
+    while (blocks[b].rpo > blocks[a].rpo)
+      b = blocks[b].idom;
+  }
+  return a;
+}
+
+// "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy.
+static void cfg_compute_dominators(CFG* cfg) {
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < cfg->num_blocks; i++)
+    blocks[i].idom = -1;
+  if (!cfg->num_rpo)
+    return;
+
+  int entry = cfg->rpo[0];
+  blocks[entry].idom = entry;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 1; i < cfg->num_rpo; i++) {
+      BasicBlock* bb = &blocks[cfg->rpo[i]];
+      int idom = -1;
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].idom < 0)
+          continue;
+        idom = idom < 0 ? p : cfg_intersect(cfg, p, idom);
+      }
+      if (bb->idom != idom) {
+        bb->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  blocks[entry].idom = -1;
+}
+
+bool cfg_dominates(CFG* cfg, int a, int b) {
+  if (cfg->blocks[a].rpo < 0)
+    return false;
+  for (; b >= 0; b = cfg->blocks[b].idom) {
+    if (b == a)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_compare_ints(const void* a, const void* b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+static void cfg_find_loops(CFG* cfg) {
+  int n = cfg->num_blocks;
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < n; i++)
+    blocks[i].loop = -1;
+  cfg->loops = arena_alloc(cfg->arena, sizeof(Loop) * n);
+  int* body = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* work = arena_alloc(cfg->arena, sizeof(int) * n);
+  // mark[b] == id + 1 once b is in the loop being built.
+  int* mark = arena_alloc(cfg->arena, sizeof(int) * n);
+
+  // A header dominates every block of its loop, so visiting headers in
+  // reverse postorder finds outer loops first.
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int h = cfg->rpo[i];
+    int id = cfg->num_loops;
+    int num_body = 0;
+    int num_work = 0;
+    for (int j = 0; j < blocks[h].num_preds; j++) {
+      int t = blocks[h].preds[j];
+      if (blocks[t].rpo < i || !cfg_dominates(cfg, h, t))
+        continue;
+      if (mark[t] != id + 1) {
+        mark[t] = id + 1;
+        body[num_body++] = t;
+        if (t != h)
+          work[num_work++] = t;
+      }
+    }
+    if (!num_body)
+      continue;
+    if (mark[h] != id + 1) {
+      mark[h] = id + 1;
+      body[num_body++] = h;
+    }
+    while (num_work) {
+      BasicBlock* bb = &blocks[work[--num_work]];
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].rpo < 0 || mark[p] == id + 1)
+          continue;
+        mark[p] = id + 1;
+        body[num_body++] = p;
+        work[num_work++] = p;
+      }
+    }
+
+    Loop* loop = &cfg->loops[cfg->num_loops++];
+    loop->header = h;
+    // Loops are either nested or disjoint, so the last loop found which
+    // contains |h| is the innermost one around this loop.
+    loop->parent = blocks[h].loop;
+    loop->depth = loop->parent < 0 ? 1 : cfg->loops[loop->parent].depth + 1;
+    qsort(body, num_body, sizeof(int), cfg_compare_ints);
+    loop->blocks = arena_alloc(cfg->arena, sizeof(int) * num_body);
+    loop->num_blocks = num_body;
+    for (int j = 0; j < num_body; j++) {
+      loop->blocks[j] = body[j];
+      blocks[body[j]].loop = id;
+      blocks[body[j]].loop_depth = loop->depth;
+    }
+  }
+}
+
+CFG* build_cfg(Module* m) {
+  Arena* arena = arena_new();
+  CFG* cfg = arena_alloc(arena, sizeof(CFG));
+  cfg->arena = arena;
+  cfg->module = m;
+  cfg->num_blocks = m->num_pcs + 1;
+  cfg->indirect = m->num_pcs;
+  cfg->max_plain_pc = -1;
+  cfg->blocks = arena_alloc(arena, sizeof(BasicBlock) * cfg->num_blocks);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    bb->pc = pc;
+    bb->insts = &m->insts[m->pc_start[pc]];
+    bb->num_insts = m->pc_start[pc + 1] - m->pc_start[pc];
+  }
+  cfg->blocks[cfg->indirect].pc = -1;
+
+  cfg_build_edges(cfg);
+  cfg_compute_rpo(cfg);
+  cfg_compute_dominators(cfg);
+  cfg_find_loops(cfg);
+  return cfg;
+}
+
+void free_cfg(CFG* cfg) {
+  arena_free(cfg->arena);
+}
+
+static void cfg_dump_list(FILE* fp, const char* name, int* list, int n) {
+  fprintf(fp, " %s=", name);
+  if (!n)
+    fprintf(fp, "-");
+  for (int i = 0; i < n; i++)
+    fprintf(fp, i ? ",%d" : "%d", list[i]);
+}
+
+void dump_cfg(CFG* cfg, FILE* fp) {
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    if (bb->pc < 0)
+      fprintf(fp, "indirect=%d", i);
+    else
+      fprintf(fp, "pc=%d insts=%d", bb->pc, bb->num_insts);
+    cfg_dump_list(fp, "succs", bb->succs, bb->num_succs);
+    cfg_dump_list(fp, "preds", bb->preds, bb->num_preds);
+    if (bb->rpo < 0)
+      fprintf(fp, " unreachable");
+    else
+      fprintf(fp, " idom=%d", bb->idom);
+    if (bb->loop >= 0)
+      fprintf(fp, " loop=%d depth=%d", bb->loop, bb->loop_depth);
+    if (bb->address_taken)
+      fprintf(fp, " address_taken");
+    fprintf(fp, "\n");
+  }
+  for (int i = 0; i < cfg->num_loops; i++) {
+    Loop* loop = &cfg->loops[i];
+    fprintf(fp, "loop=%d header=%d parent=%d depth=%d",
+            i, loop->header, loop->parent, loop->depth);
+    cfg_dump_list(fp, "blocks", loop->blocks, loop->num_blocks);
+    fprintf(fp, "\n");
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef ELVM_CFG_H_
+#define ELVM_CFG_H_
+
+#include <ir/ir.h>
+
+// The control flow graph of a Module. Each pc is a basic block, since
+// jumps always end a pc and only labels start one. Blocks are indexed by
+// pc, and one extra block, blocks[indirect], stands for the unknown
+// target of register jumps. It has an edge to every address-taken block,
+// so a register jump adds one edge instead of one per possible target.
+
+typedef struct {
+  // -1 for the indirect block.
+  int pc;
+  Inst* insts;
+  int num_insts;
+  int* succs;
+  int num_succs;
+  int* preds;
+  int num_preds;
+  // A register jump may reach this block. See cfg_code_address.
+  bool address_taken;
+  // Position in cfg->rpo, or -1 if the block is unreachable from pc 0.
+  int rpo;
+  // The immediate dominator, or -1 for the entry and unreachable blocks.
+  int idom;
+  // The innermost loop containing this block, or -1.
+  int loop;
+  int loop_depth;
+} BasicBlock;
+
+// A natural loop: |header| and every block which reaches a back edge to
+// it without passing through it. |blocks| is sorted and includes
+// |header| and the blocks of nested loops.
+typedef struct {
+  int header;
+  int parent;
+  int depth;
+  int* blocks;
+  int num_blocks;
+} Loop;
+
+typedef struct {
+  Module* module;
+  BasicBlock* blocks;
+  int num_blocks;
+  int indirect;
+  // Reachable blocks in reverse postorder.
+  int* rpo;
+  int num_rpo;
+  // Outer loops come before the loops they contain.
+  Loop* loops;
+  int num_loops;
+  // The highest pc a plain number may name, or -1. Passes which renumber
+  // pcs keep this one and every pc before it in place.
+  int max_plain_pc;
+  struct Arena_* arena;
+} CFG;
+
+// EIR does not tell code addresses from other numbers. A text label
+// used as a value is one. So may be a plain number below num_pcs given
+// as the source of mov, add, sub, or an extended arithmetic op, or held
+// by a data word, but only if the module jumps through a register,
+// which |plain| says. These return the pc which |v|, an operand of
+// |inst| other than a jump target, or |data| may hold, or -1.
+bool cfg_has_reg_jump(Module* m);
+int cfg_code_address(Module* m, Inst* inst, Value* v, bool plain);
+int cfg_data_code_address(Module* m, Data* data, bool plain);
+
+// The CFG keeps pointers into |m|, so rebuild it after |m| changes.
+CFG* build_cfg(Module* m);
+
+void free_cfg(CFG* cfg);
+
+// Whether every path from the entry to |b| goes through |a|.
+bool cfg_dominates(CFG* cfg, int a, int b);
+
+void dump_cfg(CFG* cfg, FILE* fp);
+
+#endif  // ELVM_CFG_H_
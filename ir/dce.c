@@ -0,0 +1,287 @@
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/cfg.h>
+
+// Keeps the pcs reachable from pc 0 and the data they refer to, then
+// renumbers both. Any text label value in kept code or data is assumed
+// to be jumped to.
+//
+// Plain numbers are never relocated. When kept code jumps through a
+// register, a plain number in kept code or data which cfg_code_address
+// says may be a pc makes every pc up to it keep its place. Likewise, data up to the
+// highest plain address given to a load or store keeps its place.
+//
+// A data object spans from one data label to the next. Objects are
+// dropped only while every kept load and store has a fixed address, as
+// code which computes addresses may step from one label into the
+// objects around it. Otherwise the data segment is kept whole.
+
+typedef struct {
+  Module* m;
+  bool* pc_live;
+  int* pc_stack;
+  int num_pc_stack;
+  // Pcs below this are kept.
+  int pc_pinned;
+  // Whether a kept jump goes through a register, and the highest plain
+  // number in kept code or data which may be a pc, or -1.
+  bool reg_jump;
+  int max_pc_number;
+  Data** words;
+  int num_words;
+  // The object of each word, and where each object starts.
+  int* word_obj;
+  int* obj_start;
+  int num_objs;
+  bool* obj_live;
+  int* obj_stack;
+  int num_obj_stack;
+  // Words below this are kept.
+  int pinned;
+  // Whether every kept load and store has a fixed address.
+  bool data_exact;
+} Dce;
+
+static void dce_mark_pc(Dce* d, int pc) {
+  if (pc < 0 || pc >= d->m->num_pcs || d->pc_live[pc])
+    return;
+  d->pc_live[pc] = true;
+  d->pc_stack[d->num_pc_stack++] = pc;
+}
+
+static void dce_mark_addr(Dce* d, int addr) {
+  if (addr < 0 || addr >= d->num_words)
+    return;
+  int obj = d->word_obj[addr];
+  if (d->obj_live[obj])
+    return;
+  d->obj_live[obj] = true;
+  d->obj_stack[d->num_obj_stack++] = obj;
+}
+
+// Keeps |pc| and every pc before it where they are.
+static void dce_pin_pc(Dce* d, int pc) {
+  if (pc >= d->m->num_pcs)
+    pc = d->m->num_pcs - 1;
+  for (; d->pc_pinned <= pc; d->pc_pinned++)
+    dce_mark_pc(d, d->pc_pinned);
+}
+
+static void dce_note_number(Dce* d, int pc) {
+  if (pc > d->max_pc_number)
+    d->max_pc_number = pc;
+}
+
+// Keeps |addr| where it is. Addresses past the data are the heap's.
+static void dce_pin(Dce* d, int addr) {
+  if (addr >= d->num_words)
+    return;
+  for (; d->pinned <= addr; d->pinned++)
+    dce_mark_addr(d, d->pinned);
+}
+
+static void dce_mark_label(Dce* d, LabelType label, int v) {
+  if (label == TEXT_LABEL)
+    dce_mark_pc(d, v);
+  else if (label == DATA_LABEL)
+    dce_mark_addr(d, v);
+}
+
+static void dce_mark_value(Dce* d, Value* v) {
+  if (v->type == IMM)
+    dce_mark_label(d, v->label, v->imm);
+}
+
+static void dce_scan_pc(Dce* d, int pc) {
+  Module* m = d->m;
+  bool falls = true;
+  for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+    Inst* inst = &m->insts[i];
+    Op op = inst->op;
+    dce_mark_value(d, &inst->dst);
+    dce_mark_value(d, &inst->src);
+    if (op >= JEQ && op <= JMP) {
+      if (inst->jmp.type == IMM)
+        dce_mark_pc(d, inst->jmp.imm);
+      else
+        d->reg_jump = true;
+    } else {
+      dce_mark_value(d, &inst->jmp);
+    }
+    bool plain_src = inst->src.type == IMM && inst->src.label == NOT_LABEL;
+    if (op == LOAD || op == STORE) {
+      if (plain_src)
+        dce_pin(d, inst->src.imm);
+      else if (inst->src.type == REG)
+        d->data_exact = false;
+    } else if (op == COPY || op == FILL) {
+      d->data_exact = false;
+    } else if (plain_src) {
+      dce_note_number(d, cfg_code_address(m, inst, &inst->src, true));
+    }
+    if (inst->op == JMP || inst->op == EXIT)
+      falls = false;
+  }
+  if (falls)
+    dce_mark_pc(d, pc + 1);
+}
+
+static void dce_scan_obj(Dce* d, int obj) {
+  for (int a = d->obj_start[obj]; a < d->obj_start[obj + 1]; a++) {
+    Data* data = d->words[a];
+    if (data->label == NOT_LABEL)
+      dce_note_number(d, cfg_data_code_address(d->m, data, true));
+    else
+      dce_mark_label(d, data->label, data->v);
+  }
+}
+
+static void dce_init_objects(Dce* d) {
+  Module* m = d->m;
+  bool* starts = calloc(d->num_words + 1, sizeof(bool));
+  starts[0] = true;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && sym->value >= 0 && sym->value < d->num_words)
+      starts[sym->value] = true;
+  }
+  d->word_obj = malloc(sizeof(int) * (d->num_words + 1));
+  d->obj_start = malloc(sizeof(int) * (d->num_words + 1));
+  for (int a = 0; a < d->num_words; a++) {
+    if (starts[a])
+      d->obj_start[d->num_objs++] = a;
+    d->word_obj[a] = d->num_objs - 1;
+  }
+  d->obj_start[d->num_objs] = d->num_words;
+  d->obj_live = calloc(d->num_objs + 1, sizeof(bool));
+  d->obj_stack = malloc(sizeof(int) * (d->num_objs + 1));
+  free(starts);
+}
+
+static void dce_relocate_data(Value* v, const int* data_map, int num_words) {
+  if (v->type == IMM && v->label == DATA_LABEL &&
+      v->imm >= 0 && v->imm <= num_words)
+    v->imm = data_map[v->imm];
+}
+
+void remove_dead_code_and_data(Module* m) {
+  if (!m->num_pcs)
+    return;
+
+  Dce d = {};
+  d.m = m;
+  d.max_pc_number = -1;
+  d.data_exact = true;
+  d.pc_live = calloc(m->num_pcs, sizeof(bool));
+  d.pc_stack = malloc(sizeof(int) * m->num_pcs);
+  for (Data* data = m->data; data; data = data->next)
+    d.num_words++;
+  d.words = malloc(sizeof(Data*) * (d.num_words + 1));
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    d.words[n++] = data;
+  dce_init_objects(&d);
+
+  // _edata holds the start of the heap, which malloc reads.
+  Data* edata = NULL;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && !strcmp(sym->name, "_edata") &&
+        sym->value >= 0 && sym->value < d.num_words) {
+      edata = d.words[sym->value];
+      dce_mark_addr(&d, sym->value);
+    }
+  }
+  dce_mark_pc(&d, 0);
+  for (;;) {
+    while (d.num_pc_stack || d.num_obj_stack) {
+      if (d.num_pc_stack)
+        dce_scan_pc(&d, d.pc_stack[--d.num_pc_stack]);
+      else
+        dce_scan_obj(&d, d.obj_stack[--d.num_obj_stack]);
+    }
+    // Both may keep more code, which may find more of either.
+    if (!d.data_exact && d.pinned < d.num_words)
+      dce_pin(&d, d.num_words - 1);
+    else if (d.reg_jump && d.pc_pinned <= d.max_pc_number)
+      dce_pin_pc(&d, d.max_pc_number);
+    else
+      break;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int num_pcs = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = num_pcs;
+    num_pcs += d.pc_live[pc];
+  }
+  pc_map[m->num_pcs] = num_pcs;
+  int* data_map = malloc(sizeof(int) * (d.num_words + 1));
+  int num_words = 0;
+  for (int a = 0; a < d.num_words; a++) {
+    data_map[a] = num_words;
+    num_words += d.obj_live[d.word_obj[a]];
+  }
+  data_map[d.num_words] = num_words;
+
+  if (num_pcs < m->num_pcs || num_words < d.num_words) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      Inst* inst = &m->insts[i];
+      if (!d.pc_live[inst->pc])
+        continue;
+      if (prev)
+        prev->next = inst;
+      else
+        m->text = inst;
+      prev = inst;
+    }
+    prev->next = NULL;
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next) {
+      inst->pc = pc_map[inst->pc];
+      dce_relocate_data(&inst->dst, data_map, d.num_words);
+      dce_relocate_data(&inst->src, data_map, d.num_words);
+      if (inst->op < JEQ || inst->op > JMP)
+        dce_relocate_data(&inst->jmp, data_map, d.num_words);
+    }
+
+    Data* last = NULL;
+    m->data = NULL;
+    for (int a = 0; a < d.num_words; a++) {
+      Data* data = d.words[a];
+      if (!d.obj_live[d.word_obj[a]])
+        continue;
+      if (data->label == DATA_LABEL && data->v >= 0 && data->v <= d.num_words)
+        data->v = data_map[data->v];
+      if (last)
+        last->next = data;
+      else
+        m->data = data;
+      last = data;
+    }
+    if (last)
+      last->next = NULL;
+    if (edata && edata->v >= 0 && edata->v <= d.num_words)
+      edata->v = data_map[edata->v];
+    for (int i = 0; i < m->num_syms; i++) {
+      Symbol* sym = &m->syms[i];
+      if (!sym->is_text && sym->value >= 0 && sym->value <= d.num_words)
+        sym->value = data_map[sym->value];
+    }
+    reindex_module(m);
+  }
+
+  free(pc_map);
+  free(data_map);
+  free(d.pc_live);
+  free(d.pc_stack);
+  free(d.words);
+  free(d.word_obj);
+  free(d.obj_start);
+  free(d.obj_live);
+  free(d.obj_stack);
+}
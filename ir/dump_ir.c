@@ -1,6 +1,14 @@
 #include <stdlib.h>
+#include <string.h>
+#ifndef __eir__
+#include <time.h>
+#endif
 
+#include <ir/cfg.h>
 #include <ir/ir.h>
+#include <ir/live.h>
+#include <ir/pass.h>
+#include <ir/table.h>
 
 int main(int argc, char* argv[]) {
 #if defined(NOFILE) || defined(__eir__)
@@ -8,11 +16,102 @@ int main(int argc, char* argv[]) {
   // Host dump_ir.c.exe should dump to stdout for testing.
   stderr = stdout;
 #else
+  bool show_load_stats = false;
+  bool show_lines = false;
+  bool show_cfg = false;
+  bool show_live = false;
+  bool show_pass_stats = false;
+  const char* binary_out = NULL;
+  const char* profile = NULL;
+  for (;;) {
+    if (argc >= 2 && !strcmp(argv[1], "-t")) {
+      show_load_stats = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-l")) {
+      show_lines = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-O")) {
+      add_passes("opt,merge");
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-passes=", 8)) {
+      add_passes(argv[1] + 8);
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-stats")) {
+      show_pass_stats = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-g")) {
+      show_cfg = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-live")) {
+      show_live = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-profile=", 9)) {
+      profile = argv[1] + 9;
+      argc--;
+      argv++;
+    } else if (argc >= 3 && !strcmp(argv[1], "-b")) {
+      binary_out = argv[2];
+      argc -= 2;
+      argv += 2;
+    } else {
+      break;
+    }
+  }
+
   if (argc < 2) {
     fprintf(stderr, "no input file\n");
     exit(1);
   }
+
+  clock_t start = clock();
   Module* m = load_eir_from_file(argv[1]);
+  if (show_load_stats) {
+    fprintf(stderr, "load: %.3f ms, syms=%d lookups=%d probes=%d\n",
+            (clock() - start) * 1000.0 / CLOCKS_PER_SEC,
+            table_stats.adds, table_stats.lookups, table_stats.probes);
+    return 0;
+  }
+  if (show_lines) {
+    for (int pc = 0; pc < m->num_pcs; pc++) {
+      const char* file;
+      int line;
+      if (get_pc_source_loc(m, pc, &file, &line))
+        printf("pc=%d %s:%d\n", pc, file ? file : "?", line);
+    }
+    return 0;
+  }
+  if (profile)
+    load_pc_profile(m, profile);
+  run_passes(m, show_pass_stats);
+  if (show_cfg) {
+    CFG* cfg = build_cfg(m);
+    dump_cfg(cfg, stdout);
+    free_cfg(cfg);
+    return 0;
+  }
+  if (show_live) {
+    Liveness* lv = build_liveness(m);
+    dump_liveness(lv, stdout);
+    free_liveness(lv);
+    return 0;
+  }
+  if (binary_out) {
+    FILE* fp = fopen(binary_out, "wb");
+    if (!fp) {
+      fprintf(stderr, "cannot open %s\n", binary_out);
+      exit(1);
+    }
+    write_eir_binary(m, fp);
+    fclose(fp);
+    return 0;
+  }
 #endif
   for (Inst* inst = m->text; inst; inst = inst->next) {
     dump_inst(inst);
@@ -0,0 +1,282 @@
+#include <ir/ir.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <ir/arena.h>
+
+// Binary EIR layout. All fields are host-endian 32-bit integers unless
+// noted, and every section starts right after the previous one.
+//
+//   EirbHeader
+//   EirbInst     insts[num_insts]
+//   int32        pc_start[num_pcs + 1]
+//   EirbData     data[num_data]
+//   EirbSymbol   syms[num_syms]
+//   SourceLoc    locs[num_locs]
+//   uint32       files[num_files]     (strtab offsets, or ~0 for none)
+//   char         strtab[strtab_size]  (NUL-terminated names)
+//
+// Operands are already resolved, so the loader does not parse. It still
+// decodes the instruction and data records into new Inst and Data
+// arrays, since their layout differs from the records. Only pc_start,
+// locs and the names are used in place from the mapping. Every index
+// in the file is checked before use, so a broken file is an error
+// rather than a bad read later.
+
+// Text EIR never contains DEL, so the magic cannot be a valid text file.
+#define EIRB_MAGIC "\177EIR"
+#define EIRB_VERSION 3
+#define EIRB_NO_FILE 0xffffffffu
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_insts;
+  uint32_t num_pcs;
+  uint32_t num_data;
+  uint32_t num_syms;
+  uint32_t num_locs;
+  uint32_t num_files;
+  uint32_t strtab_size;
+} EirbHeader;
+
+typedef struct {
+  uint8_t op;
+  // ValueType of dst, src, and jmp in the low nibble and LabelType in
+  // the high nibble.
+  uint8_t types[3];
+  int32_t vals[3];
+  int32_t pc;
+  int32_t lineno;
+  int32_t loc;
+} EirbInst;
+
+typedef struct {
+  int32_t v;
+  uint32_t label;
+} EirbData;
+
+typedef struct {
+  uint32_t name;
+  int32_t value;
+  uint32_t is_text;
+} EirbSymbol;
+
+static void eirb_encode_value(Value* v, uint8_t* type, int32_t* val) {
+  *type = v->type | (v->type == IMM ? v->label << 4 : 0);
+  *val = v->type == REG ? (int32_t)v->reg : v->imm;
+}
+
+static bool eirb_check_value(uint8_t type, int32_t val) {
+  if ((type & 15) == REG)
+    return type >> 4 == 0 && val >= A && val <= SP;
+  // The text parser keeps every number in the word size, and the
+  // engines index memory with them unchecked.
+  return (type & 15) == IMM && type >> 4 <= DATA_LABEL &&
+         val >= 0 && val <= UINT_MAX;
+}
+
+static void eirb_decode_value(uint8_t type, int32_t val, Value* v) {
+  v->type = (ValueType)(type & 15);
+  v->label = (LabelType)(type >> 4);
+  if (v->type == REG)
+    v->reg = (Reg)val;
+  else
+    v->imm = val;
+}
+
+void write_eir_binary(Module* m, FILE* fp) {
+  EirbHeader h = {};
+  memcpy(h.magic, EIRB_MAGIC, 4);
+  h.version = EIRB_VERSION;
+  h.num_insts = m->num_insts;
+  h.num_pcs = m->num_pcs;
+  for (Data* d = m->data; d; d = d->next)
+    h.num_data++;
+  h.num_syms = m->num_syms;
+  h.num_locs = m->num_locs;
+  h.num_files = m->num_files;
+  for (int i = 0; i < m->num_syms; i++)
+    h.strtab_size += strlen(m->syms[i].name) + 1;
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      h.strtab_size += strlen(m->files[i]) + 1;
+  }
+  // Keep the file size a multiple of 4.
+  h.strtab_size = (h.strtab_size + 3) & ~3u;
+  fwrite(&h, sizeof(h), 1, fp);
+
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    EirbInst r = {};
+    r.op = inst->op;
+    eirb_encode_value(&inst->dst, &r.types[0], &r.vals[0]);
+    eirb_encode_value(&inst->src, &r.types[1], &r.vals[1]);
+    eirb_encode_value(&inst->jmp, &r.types[2], &r.vals[2]);
+    r.pc = inst->pc;
+    r.lineno = inst->lineno;
+    r.loc = inst->loc;
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  fwrite(m->pc_start, sizeof(int32_t), m->num_pcs + 1, fp);
+
+  for (Data* d = m->data; d; d = d->next) {
+    EirbData r = { d->v, d->label };
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  uint32_t name = 0;
+  for (int i = 0; i < m->num_syms; i++) {
+    EirbSymbol s = {
+      .name = name,
+      .value = m->syms[i].value,
+      .is_text = m->syms[i].is_text
+    };
+    fwrite(&s, sizeof(s), 1, fp);
+    name += strlen(m->syms[i].name) + 1;
+  }
+  fwrite(m->locs, sizeof(SourceLoc), m->num_locs, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    uint32_t off = EIRB_NO_FILE;
+    if (m->files[i]) {
+      off = name;
+      name += strlen(m->files[i]) + 1;
+    }
+    fwrite(&off, sizeof(off), 1, fp);
+  }
+  for (int i = 0; i < m->num_syms; i++)
+    fwrite(m->syms[i].name, 1, strlen(m->syms[i].name) + 1, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      fwrite(m->files[i], 1, strlen(m->files[i]) + 1, fp);
+  }
+  for (; name < h.strtab_size; name++)
+    fputc(0, fp);
+}
+
+bool is_eir_binary(const void* buf, size_t size) {
+  return size >= sizeof(EirbHeader) && !memcmp(buf, EIRB_MAGIC, 4);
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void eirb_error(const char* filename, const char* msg) {
+  fprintf(stderr, "%s: %s\n", filename, msg);
+  exit(1);
+}
+
+Module* load_eir_binary(const char* filename, void* buf, size_t size) {
+  const EirbHeader* h = buf;
+  if (h->version != EIRB_VERSION)
+    eirb_error(filename, "unsupported binary EIR version");
+  size_t need = (sizeof(EirbHeader) +
+                 sizeof(EirbInst) * (size_t)h->num_insts +
+                 sizeof(int32_t) * ((size_t)h->num_pcs + 1) +
+                 sizeof(EirbData) * (size_t)h->num_data +
+                 sizeof(EirbSymbol) * (size_t)h->num_syms +
+                 sizeof(SourceLoc) * (size_t)h->num_locs +
+                 sizeof(uint32_t) * (size_t)h->num_files +
+                 h->strtab_size);
+  if (need != size)
+    eirb_error(filename, "broken binary EIR");
+
+  const EirbInst* rec = (const EirbInst*)(h + 1);
+  int* pc_start = (int*)(rec + h->num_insts);
+  const EirbData* data = (const EirbData*)(pc_start + h->num_pcs + 1);
+  const EirbSymbol* syms = (const EirbSymbol*)(data + h->num_data);
+  SourceLoc* locs = (SourceLoc*)(syms + h->num_syms);
+  const uint32_t* files = (const uint32_t*)(locs + h->num_locs);
+  const char* strtab = (const char*)(files + h->num_files);
+  if (h->strtab_size && strtab[h->strtab_size - 1])
+    eirb_error(filename, "broken binary EIR");
+  if (pc_start[0] != 0 || pc_start[h->num_pcs] != (int)h->num_insts)
+    eirb_error(filename, "broken binary EIR");
+  for (uint32_t pc = 0; pc < h->num_pcs; pc++) {
+    if (pc_start[pc] > pc_start[pc + 1])
+      eirb_error(filename, "broken binary EIR");
+  }
+  // A file number without a .file has no name, but it is never negative
+  // except in locs[0], which no instruction uses.
+  for (uint32_t i = 1; i < h->num_locs; i++) {
+    if (locs[i].file < 0)
+      eirb_error(filename, "broken binary EIR");
+  }
+
+  Arena* arena = arena_new();
+  Module* m = arena_alloc(arena, sizeof(Module));
+  m->arena = arena;
+  m->map = buf;
+  m->map_size = size;
+
+  int n = h->num_insts;
+  Inst* insts = arena_alloc(arena, sizeof(Inst) * n);
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    int op = rec[i].op;
+    int pc = rec[i].pc;
+    int loc = rec[i].loc;
+    if (op >= LAST_OP || (op > JMP && op < EQ) ||
+        !eirb_check_value(rec[i].types[0], rec[i].vals[0]) ||
+        !eirb_check_value(rec[i].types[1], rec[i].vals[1]) ||
+        !eirb_check_value(rec[i].types[2], rec[i].vals[2]) ||
+        pc < 0 || pc >= (int)h->num_pcs ||
+        i < pc_start[pc] || i >= pc_start[pc + 1] ||
+        loc < 0 || (loc >= (int)h->num_locs && loc != 0))
+      eirb_error(filename, "broken binary EIR");
+    inst->op = (Op)op;
+    eirb_decode_value(rec[i].types[0], rec[i].vals[0], &inst->dst);
+    eirb_decode_value(rec[i].types[1], rec[i].vals[1], &inst->src);
+    eirb_decode_value(rec[i].types[2], rec[i].vals[2], &inst->jmp);
+    inst->pc = rec[i].pc;
+    inst->lineno = rec[i].lineno;
+    inst->loc = rec[i].loc;
+    inst->next = i + 1 < n ? &insts[i + 1] : NULL;
+  }
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = h->num_pcs;
+
+  Data* d = arena_alloc(arena, sizeof(Data) * h->num_data);
+  for (uint32_t i = 0; i < h->num_data; i++) {
+    if (data[i].label > DATA_LABEL || data[i].v < 0 || data[i].v > UINT_MAX)
+      eirb_error(filename, "broken binary EIR");
+    d[i].v = data[i].v;
+    d[i].label = (LabelType)data[i].label;
+    d[i].next = i + 1 < h->num_data ? &d[i + 1] : NULL;
+  }
+  m->data = h->num_data ? d : NULL;
+
+  m->syms = arena_alloc(arena, sizeof(Symbol) * h->num_syms);
+  m->num_syms = h->num_syms;
+  for (uint32_t i = 0; i < h->num_syms; i++) {
+    if (syms[i].name >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->syms[i].name = strtab + syms[i].name;
+    m->syms[i].value = syms[i].value;
+    m->syms[i].is_text = syms[i].is_text;
+  }
+
+  m->locs = locs;
+  m->num_locs = h->num_locs;
+  m->files = arena_alloc(arena, sizeof(char*) * h->num_files);
+  m->num_files = h->num_files;
+  for (uint32_t i = 0; i < h->num_files; i++) {
+    if (files[i] == EIRB_NO_FILE)
+      continue;
+    if (files[i] >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->files[i] = strtab + files[i];
+  }
+  return m;
+}
+
+#endif
@@ -1,97 +1,491 @@
-#include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <ir/elivm.h>
 #include <ir/ir.h>
 
-#ifdef __eir__
-#define MEMSZ 0x100000
-#else
-#define MEMSZ 0x1000000
+#if !defined(NOFILE) && !defined(__eir__)
+# include <dirent.h>
+# include <pthread.h>
+# include <sys/stat.h>
+# include <time.h>
+# include <unistd.h>
 #endif
 
-int pc;
-Inst* prog[65536];
-int mem[MEMSZ];
-int regs[6];
 bool verbose;
+bool use_jit;
+// Whether to print how much of the run went through fused handlers and
+// how much memory it touched.
+bool show_stats;
+#if !defined(NOFILE) && !defined(__eir__)
+// Where -profile writes its counts, or NULL.
+const char* profile_out;
+// The directory or list of inputs for -batch, or NULL.
+const char* batch_inputs;
+// How many threads -batch runs, or 0 for one per core.
+int batch_threads;
+// Where -checkpoint writes a snapshot at the first GETC or DUMP, and
+// the snapshot -restore resumes from, or NULL.
+const char* checkpoint_file;
+const char* restore_file;
 
-#ifdef __GNUC__
-__attribute__((noreturn))
-#endif
-static void error(const char* msg) {
-  fprintf(stderr, "%s (pc=%d)\n", msg, pc);
-  exit(1);
+static int compare_edges(const void* a, const void* b) {
+  const EliEdge* x = a;
+  const EliEdge* y = b;
+  if (x->count != y->count)
+    return x->count > y->count ? -1 : 1;
+  return x->from != y->from ? x->from - y->from : x->to - y->to;
 }
 
-static inline void dump_regs(Inst* inst) {
-  bool had_negative = false;
-  static const char* REG_NAMES[] = {
-    "A", "B", "C", "D", "BP", "SP"
-  };
-  fprintf(stderr, "PC=%d ", inst->lineno);
-  for (int i = 0; i < 6; i++) {
-    if (regs[i] < 0)
-      had_negative = true;
-    fprintf(stderr, "%s=%d", REG_NAMES[i], regs[i]);
-    fprintf(stderr, i == 5 ? "\n" : " ");
+// How much ran in one pc or one function.
+typedef struct {
+  int id;
+  long insts;
+  long entries;
+} ProfTotal;
+
+static int compare_totals(const void* a, const void* b) {
+  const ProfTotal* x = a;
+  const ProfTotal* y = b;
+  if (x->insts != y->insts)
+    return x->insts > y->insts ? -1 : 1;
+  return x->id - y->id;
+}
+
+// Returns, for each pc, the index in m->syms of the function it is in,
+// or -1. A function starts at a text label which does not start with
+// a '.', as 8cc names C functions that way and its own labels not.
+static int* find_functions(Module* m) {
+  int* funcs = malloc(sizeof(int) * (m->num_pcs + 1));
+  for (int pc = 0; pc < m->num_pcs; pc++)
+    funcs[pc] = -1;
+  // If several start at one pc, the last one wins.
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (sym->is_text && sym->name[0] != '.' &&
+        sym->value >= 0 && sym->value < m->num_pcs)
+      funcs[sym->value] = i;
   }
-  if (had_negative) {
-    error("had negative!");
+  for (int pc = 1; pc < m->num_pcs; pc++) {
+    if (funcs[pc] == -1)
+      funcs[pc] = funcs[pc - 1];
   }
+  return funcs;
 }
 
-static int value(Value* v) {
-  if (v->type == REG) {
-    return regs[v->reg];
-  } else if (v->type == IMM) {
-    return v->imm;
+#define PROF_REPORT_LINES 20
+
+// Prints the pcs and functions which ran the most instructions.
+static void print_profile_report(Module* m, ProfTotal* pcs, ProfTotal* funcs,
+                                 int num_funcs, int* func_of, long total) {
+  qsort(pcs, m->num_pcs, sizeof(ProfTotal), compare_totals);
+  fprintf(stderr, "eli profile: %ld insts\n", total);
+  fprintf(stderr, "%8s %12s %6s %12s  %s\n",
+          "pc", "insts", "%", "entries", "function");
+  for (int i = 0; i < m->num_pcs && i < PROF_REPORT_LINES; i++) {
+    ProfTotal* t = &pcs[i];
+    if (!t->insts)
+      break;
+    int f = func_of[t->id];
+    const char* file;
+    int line;
+    fprintf(stderr, "%8d %12ld %6.2f %12ld  %s",
+            t->id, t->insts, t->insts * 100.0 / total, t->entries,
+            f >= 0 ? m->syms[f].name : "?");
+    if (get_pc_source_loc(m, t->id, &file, &line))
+      fprintf(stderr, " (%s:%d)", file ? file : "?", line);
+    fprintf(stderr, "\n");
+  }
+
+  qsort(funcs, num_funcs, sizeof(ProfTotal), compare_totals);
+  if (num_funcs && funcs[0].insts) {
+    fprintf(stderr, "%-24s %12s %6s %12s\n",
+            "function", "insts", "%", "calls");
+  }
+  for (int i = 0; i < num_funcs && i < PROF_REPORT_LINES; i++) {
+    ProfTotal* t = &funcs[i];
+    if (!t->insts)
+      break;
+    fprintf(stderr, "%-24s %12ld %6.2f %12ld\n",
+            m->syms[t->id].name, t->insts, t->insts * 100.0 / total,
+            t->entries);
+  }
+}
+
+// Writes the profile of |vm| to profile_out and a report of the hottest
+// code to stderr. The file has "pc <pc> <count>" lines, which
+// load_pc_profile in ir/pass.h reads, for how many times each pc was
+// entered, then "inst <pc> <n> <count>" for the n-th instruction of a
+// pc, "edge <from> <to> <count>" for taken jumps, and "func <name>
+// <insts> <calls>" for functions.
+static void write_profile(EliVM* vm) {
+  Module* m = vm->module;
+  FILE* fp = fopen(profile_out, "w");
+  if (!fp) {
+    fprintf(stderr, "cannot open %s\n", profile_out);
+    return;
+  }
+  long* inst_counts = calloc(m->num_insts + 1, sizeof(long));
+  eli_get_inst_counts(vm, inst_counts);
+
+  int* func_of = find_functions(m);
+  ProfTotal* pcs = calloc(m->num_pcs + 1, sizeof(ProfTotal));
+  ProfTotal* funcs = calloc(m->num_syms + 1, sizeof(ProfTotal));
+  long total = 0;
+  fprintf(fp, "# eli profile\n");
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    ProfTotal* t = &pcs[pc];
+    t->id = pc;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++)
+      t->insts += inst_counts[i];
+    if (m->pc_start[pc] < m->pc_start[pc + 1])
+      t->entries = inst_counts[m->pc_start[pc]];
+    if (t->entries)
+      fprintf(fp, "pc %d %ld\n", pc, t->entries);
+    total += t->insts;
+  }
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (inst_counts[i])
+        fprintf(fp, "inst %d %d %ld\n", pc, i - m->pc_start[pc],
+                inst_counts[i]);
+    }
+  }
+
+  int num_edges;
+  EliEdge* edges = eli_get_edges(vm, &num_edges);
+  qsort(edges, num_edges, sizeof(EliEdge), compare_edges);
+  for (int i = 0; i < num_edges; i++) {
+    fprintf(fp, "edge %d %d %ld\n",
+            edges[i].from, edges[i].to, edges[i].count);
+  }
+
+  // A call is a jump to the first pc of a function from outside it.
+  for (int i = 0; i < m->num_syms; i++)
+    funcs[i].id = i;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (func_of[pc] >= 0)
+      funcs[func_of[pc]].insts += pcs[pc].insts;
+  }
+  for (int i = 0; i < num_edges; i++) {
+    EliEdge* e = &edges[i];
+    if (e->to < 0 || e->to >= m->num_pcs || func_of[e->to] < 0)
+      continue;
+    Symbol* sym = &m->syms[func_of[e->to]];
+    if (sym->value == e->to && func_of[e->from] != func_of[e->to])
+      funcs[func_of[e->to]].entries += e->count;
+  }
+  for (int i = 0; i < m->num_syms; i++) {
+    if (funcs[i].insts) {
+      fprintf(fp, "func %s %ld %ld\n",
+              m->syms[i].name, funcs[i].insts, funcs[i].entries);
+    }
+  }
+  fclose(fp);
+
+  print_profile_report(m, pcs, funcs, m->num_syms, func_of, total);
+  free(edges);
+  free(funcs);
+  free(pcs);
+  free(func_of);
+  free(inst_counts);
+}
+
+
+// -batch runs the program over many inputs on a pool of threads. The
+// module is decoded once, and each input gets its own VM, reads its
+// file from memory, and has its output written to <input>.out.
+
+typedef struct {
+  const char* in;
+  long in_len;
+  long in_pos;
+  char* out;
+  long out_len;
+  long out_cap;
+} BatchIo;
+
+static int batch_getc(void* opaque) {
+  BatchIo* io = opaque;
+  if (io->in_pos >= io->in_len)
+    return EOF;
+  return (unsigned char)io->in[io->in_pos++];
+}
+
+static void batch_putc(int c, void* opaque) {
+  BatchIo* io = opaque;
+  if (io->out_len == io->out_cap) {
+    io->out_cap = io->out_cap ? io->out_cap * 2 : 4096;
+    io->out = realloc(io->out, io->out_cap);
+  }
+  io->out[io->out_len++] = c;
+}
+
+typedef struct {
+  char* input;
+  EliStatus status;
+  const char* error;
+  int pc;
+  long insts;
+  double secs;
+} BatchJob;
+
+typedef struct {
+  EliProgram* prog;
+  BatchJob* jobs;
+  int num_jobs;
+  // The next job to take, which the workers increment atomically.
+  int next_job;
+} Batch;
+
+static double batch_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char* batch_read_file(const char* name, long* len) {
+  FILE* fp = fopen(name, "rb");
+  if (!fp)
+    return NULL;
+  long cap = 4096;
+  char* buf = malloc(cap);
+  *len = 0;
+  size_t n;
+  while ((n = fread(buf + *len, 1, cap - *len, fp)) > 0) {
+    *len += n;
+    if (*len == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  fclose(fp);
+  return buf;
+}
+
+static void run_batch_job(EliProgram* prog, BatchJob* job) {
+  double start = batch_now();
+  BatchIo io = {};
+  io.in = batch_read_file(job->input, &io.in_len);
+  EliVM* vm = io.in ? eli_new_vm(prog) : NULL;
+  if (!vm) {
+    job->status = ELI_ERROR;
+    job->error = io.in ? "cannot map memory" : "cannot read input";
+    free((char*)io.in);
+    return;
+  }
+  eli_set_io(vm, batch_getc, batch_putc, &io);
+  const char* err = NULL;
+  if (restore_file) {
+    err = eli_load_snapshot(vm, restore_file, &io.out, &io.out_len);
+    io.out_cap = io.out_len;
+  }
+  if (err) {
+    job->status = ELI_ERROR;
+    job->error = err;
   } else {
-    error("invalid value");
-  }
-}
-
-static int src(Inst* inst) {
-  return value(&inst->src);
-}
-
-static int cmp(Inst* inst) {
-  int op = inst->op;
-  if (op >= 16)
-    op -= 8;
-  assert(inst->dst.type == REG);
-  int d = regs[inst->dst.reg];
-  int s = src(inst);
-  switch (op) {
-    case JEQ:
-      return d == s;
-    case JNE:
-      return d != s;
-    case JLT:
-      return d < s;
-    case JGT:
-      return d > s;
-    case JLE:
-      return d <= s;
-    case JGE:
-      return d >= s;
-    case JMP:
-      return 1;
-    default:
-      error("oops");
+    job->status = use_jit ? eli_run_jit(vm) : eli_run(vm, -1);
+    job->error = vm->error;
+  }
+  job->pc = vm->pc;
+  job->insts = vm->executed;
+  eli_free_vm(vm);
+
+  char* out_name = malloc(strlen(job->input) + 5);
+  sprintf(out_name, "%s.out", job->input);
+  FILE* fp = fopen(out_name, "wb");
+  if (fp) {
+    fwrite(io.out, 1, io.out_len, fp);
+    fclose(fp);
+  } else if (job->status != ELI_ERROR) {
+    job->status = ELI_ERROR;
+    job->error = "cannot write output";
+  }
+  free(out_name);
+  free(io.out);
+  free((char*)io.in);
+  job->secs = batch_now() - start;
+}
+
+// Prints as usual and keeps the output for the snapshot.
+static void checkpoint_putc(int c, void* opaque) {
+  putchar(c);
+  batch_putc(c, opaque);
+}
+
+static void* batch_worker(void* arg) {
+  Batch* b = arg;
+  for (;;) {
+    int i = __sync_fetch_and_add(&b->next_job, 1);
+    if (i >= b->num_jobs)
+      return NULL;
+    run_batch_job(b->prog, &b->jobs[i]);
+  }
+}
+
+static int compare_names(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool has_suffix(const char* s, const char* suffix) {
+  size_t n = strlen(s);
+  size_t m = strlen(suffix);
+  return n >= m && !strcmp(s + n - m, suffix);
+}
+
+// Returns the inputs named by |arg|, which is either a directory, whose
+// files but outputs of an earlier run are taken in order, or a file
+// with a name on each line.
+static char** list_batch_inputs(const char* arg, int* num_inputs) {
+  int cap = 64;
+  char** inputs = malloc(sizeof(char*) * cap);
+  *num_inputs = 0;
+  struct stat st;
+  if (stat(arg, &st)) {
+    fprintf(stderr, "cannot open %s\n", arg);
+    exit(1);
+  }
+  if (S_ISDIR(st.st_mode)) {
+    DIR* dir = opendir(arg);
+    if (!dir) {
+      fprintf(stderr, "cannot open %s\n", arg);
+      exit(1);
+    }
+    struct dirent* ent;
+    while ((ent = readdir(dir))) {
+      if (ent->d_name[0] == '.' || has_suffix(ent->d_name, ".out"))
+        continue;
+      char* name = malloc(strlen(arg) + strlen(ent->d_name) + 2);
+      sprintf(name, "%s/%s", arg, ent->d_name);
+      if (stat(name, &st) || !S_ISREG(st.st_mode)) {
+        free(name);
+        continue;
+      }
+      if (*num_inputs == cap) {
+        cap *= 2;
+        inputs = realloc(inputs, sizeof(char*) * cap);
+      }
+      inputs[(*num_inputs)++] = name;
+    }
+    closedir(dir);
+    qsort(inputs, *num_inputs, sizeof(char*), compare_names);
+    return inputs;
+  }
+
+  FILE* fp = fopen(arg, "r");
+  if (!fp) {
+    fprintf(stderr, "cannot open %s\n", arg);
+    exit(1);
   }
+  char buf[4096];
+  while (fgets(buf, sizeof(buf), fp)) {
+    buf[strcspn(buf, "\r\n")] = 0;
+    if (!buf[0])
+      continue;
+    if (*num_inputs == cap) {
+      cap *= 2;
+      inputs = realloc(inputs, sizeof(char*) * cap);
+    }
+    inputs[(*num_inputs)++] = strdup(buf);
+  }
+  fclose(fp);
+  return inputs;
 }
 
+// Runs |prog| over every input and prints how each went and how long it
+// took. Returns the exit status of eli.
+static int run_batch(EliProgram* prog) {
+  Batch b = {};
+  b.prog = prog;
+  char** inputs = list_batch_inputs(batch_inputs, &b.num_jobs);
+  b.jobs = calloc(b.num_jobs + 1, sizeof(BatchJob));
+  for (int i = 0; i < b.num_jobs; i++)
+    b.jobs[i].input = inputs[i];
+
+  int num_threads = batch_threads;
+  if (num_threads <= 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads > b.num_jobs)
+    num_threads = b.num_jobs;
+  if (num_threads < 1)
+    num_threads = 1;
+  double start = batch_now();
+  pthread_t* threads = malloc(sizeof(pthread_t) * num_threads);
+  for (int i = 0; i < num_threads; i++)
+    pthread_create(&threads[i], NULL, batch_worker, &b);
+  for (int i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+  double wall = batch_now() - start;
+
+  int failed = 0;
+  double total = 0;
+  printf("%-40s %12s %10s  %s\n", "input", "insts", "ms", "status");
+  for (int i = 0; i < b.num_jobs; i++) {
+    BatchJob* job = &b.jobs[i];
+    total += job->secs;
+    printf("%-40s %12ld %10.3f  ", job->input, job->insts, job->secs * 1000);
+    if (job->status == ELI_ERROR) {
+      printf("%s (pc=%d)\n", job->error, job->pc);
+      failed++;
+    } else {
+      printf("ok\n");
+    }
+    free(job->input);
+  }
+  printf("%d inputs, %d failed, %.3f s on %d threads, %.3f s per input\n",
+         b.num_jobs, failed, wall, num_threads,
+         b.num_jobs ? total / b.num_jobs : 0.0);
+  free(threads);
+  free(b.jobs);
+  free(inputs);
+  return failed ? 1 : 0;
+}
+
+#endif
+
 int main(int argc, char* argv[]) {
 #if defined(NOFILE) || defined(__eir__)
   Module* m = load_eir(stdin);
+  int flags = 0;
 #else
-  if (argc >= 2 && !strcmp(argv[1], "-v")) {
-    verbose = true;
-    argc--;
-    argv++;
+  for (;;) {
+    if (argc >= 2 && !strcmp(argv[1], "-v")) {
+      verbose = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-profile=", 9)) {
+      profile_out = argv[1] + 9;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-jit")) {
+      use_jit = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-stats")) {
+      show_stats = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-batch=", 7)) {
+      batch_inputs = argv[1] + 7;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-threads=", 9)) {
+      batch_threads = atoi(argv[1] + 9);
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-checkpoint=", 12)) {
+      checkpoint_file = argv[1] + 12;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-restore=", 9)) {
+      restore_file = argv[1] + 9;
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
   }
 
   if (argc < 2) {
@@ -99,116 +493,87 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  if (verbose && (profile_out || show_stats || use_jit)) {
+    fprintf(stderr, "-v cannot be used with -profile, -stats, or -jit\n");
+    return 1;
+  }
+  if (use_jit && (profile_out || show_stats)) {
+    fprintf(stderr, "-jit cannot be used with -profile or -stats\n");
+    return 1;
+  }
+  if (batch_inputs && (verbose || profile_out || show_stats)) {
+    fprintf(stderr, "-batch cannot be used with -v, -profile, or -stats\n");
+    return 1;
+  }
+  if (checkpoint_file && (restore_file || batch_inputs)) {
+    fprintf(stderr, "-checkpoint cannot be used with -restore or -batch\n");
+    return 1;
+  }
+
   Module* m = load_eir_from_file(argv[1]);
+  int flags = ((profile_out ? ELI_PROFILE : 0) |
+               (show_stats ? ELI_STATS : 0));
 #endif
 
-  int i;
-  i = 0;
-  for (Data* d = m->data; d; d = d->next, i++) {
-    mem[i] = d->v;
+  EliProgram* prog = eli_new_program(m, flags);
+#if !defined(NOFILE) && !defined(__eir__)
+  if (batch_inputs)
+    return run_batch(prog);
+#endif
+  EliVM* vm = eli_new_vm(prog);
+  if (!vm) {
+    fprintf(stderr, "cannot map memory\n");
+    return 1;
   }
-  for (Inst* inst = m->text; inst; i++) {
-    pc = inst->pc;
-    prog[pc] = inst;
-    for (; inst && pc == inst->pc; inst = inst->next) {}
+  vm->trace = verbose;
+  EliStatus status = ELI_RUNNING;
+#if !defined(NOFILE) && !defined(__eir__)
+  if (restore_file) {
+    char* out;
+    long out_len;
+    const char* err = eli_load_snapshot(vm, restore_file, &out, &out_len);
+    if (err) {
+      fprintf(stderr, "%s: %s\n", restore_file, err);
+      return 1;
+    }
+    fwrite(out, 1, out_len, stdout);
+    free(out);
   }
-
-  pc = m->text->pc;
-  for (;;) {
-    Inst* inst = prog[pc];
-    for (; inst; inst = inst->next) {
-      if (verbose) {
-        dump_regs(inst);
-        dump_inst(inst);
-      }
-      int npc = -1;
-      switch (inst->op) {
-        case MOV:
-          assert(inst->dst.type == REG);
-          regs[inst->dst.reg] = src(inst);
-          break;
-
-        case ADD:
-          assert(inst->dst.type == REG);
-          regs[inst->dst.reg] += src(inst);
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
-          break;
-
-        case SUB:
-          assert(inst->dst.type == REG);
-          regs[inst->dst.reg] -= src(inst);
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
-          break;
-
-        case LOAD: {
-          assert(inst->dst.type == REG);
-          int addr = src(inst);
-          if (addr < 0)
-            error("zero page load");
-          regs[inst->dst.reg] = mem[addr];
-          break;
-        }
-
-        case STORE: {
-          assert(inst->dst.type == REG);
-          int addr = src(inst);
-          if (addr < 0)
-            error("zero page store");
-          mem[addr] = regs[inst->dst.reg];
-          break;
-        }
-
-        case PUTC:
-          putchar(src(inst));
-          break;
-
-        case GETC: {
-          int c = getchar();
-          regs[inst->dst.reg] = c == EOF ? 0 : c;
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
-          break;
-        }
-
-        case EXIT:
-          exit(0);
-
-        case DUMP:
-          break;
-
-        case EQ:
-        case NE:
-        case LT:
-        case GT:
-        case LE:
-        case GE:
-          regs[inst->dst.reg] = cmp(inst);
-          break;
-
-        case JEQ:
-        case JNE:
-        case JLT:
-        case JGT:
-        case JLE:
-        case JGE:
-        case JMP:
-          if (cmp(inst)) {
-            npc = value(&inst->jmp);
-          }
-          break;
-
-        default:
-          error("oops");
-      }
-
-      if (npc != -1) {
-        pc = npc;
-        break;
+  if (checkpoint_file) {
+    BatchIo prefix = {};
+    vm->break_on_input = true;
+    eli_set_io(vm, NULL, checkpoint_putc, &prefix);
+    status = eli_run(vm, -1);
+    if (status == ELI_BREAK) {
+      const char* err = eli_save_snapshot(vm, checkpoint_file,
+                                          prefix.out, prefix.out_len);
+      if (err) {
+        fprintf(stderr, "%s: %s\n", checkpoint_file, err);
+        return 1;
       }
+      vm->break_on_input = false;
+      eli_set_io(vm, NULL, NULL, NULL);
+      status = ELI_RUNNING;
+    } else if (status == ELI_EXITED) {
+      fprintf(stderr, "no GETC or DUMP before exit, no snapshot written\n");
     }
+    free(prefix.out);
+  }
+#endif
+  if (status == ELI_RUNNING && use_jit)
+    status = eli_run_jit(vm);
+  else if (status == ELI_RUNNING)
+    status = eli_run(vm, -1);
+  if (status == ELI_ERROR) {
+    fprintf(stderr, "%s (pc=%d)\n", vm->error, vm->pc);
+    return 1;
   }
 
+#if !defined(NOFILE) && !defined(__eir__)
+  if (show_stats)
+    eli_print_stats(vm, stderr);
+  if (profile_out)
+    write_profile(vm);
+#endif
   return 0;
 }
@@ -0,0 +1,1703 @@
+#include <ir/elivm.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define MEMSZ 0x100000
+#else
+#define MEMSZ 0x1000000
+#endif
+
+// The fast engine needs computed goto. Without it, or with trace, the
+// switch in slow_run runs the program.
+#if defined(__GNUC__) && !defined(__eir__)
+#define ELI_FAST
+#endif
+
+// Memory is a mapping whose pages are committed as the program
+// touches them, which costs the same for any MEMSZ.
+#if !defined(NOFILE) && !defined(__eir__)
+#define ELI_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// eli_run_jit compiles to x86-64 code instead.
+#if defined(ELI_FAST) && defined(__x86_64__) && !defined(NOFILE)
+#define ELI_JIT
+#endif
+
+#ifdef ELI_FAST
+
+// A predecoded instruction. code[i] is m->insts[i], so pc_start indexes
+// code as well, and jumps into the middle of nothing need no care.
+// Immediates are already within a word and registers never leave one,
+// so the handlers need neither modulo nor address checks.
+typedef struct {
+  const void* op;
+  int d;
+  // A register or an immediate, as the handler expects.
+  int s;
+  // The register a fused load writes or a fused store reads.
+  int t;
+  // The index in code of a direct jump target, or the immediate of the
+  // add in a fused mov/add pair.
+  int j;
+  // The pc of a direct jump target.
+  int jpc;
+  Inst* inst;
+} FastInst;
+
+#endif
+
+struct EliProgram_ {
+  Module* module;
+  int flags;
+#ifdef ELI_FAST
+  FastInst* code;
+  // The handler of each instruction run alone, for fused sequences the
+  // budget does not cover.
+  const void** plain;
+  // The handler COUNT goes on to with ELI_PROFILE or ELI_STATS.
+  const void** real;
+  // The FuseKind of each instruction.
+  char* kinds;
+#endif
+};
+
+static EliStatus vm_error(EliVM* vm, const char* msg) {
+  vm->error = msg;
+  vm->status = ELI_ERROR;
+  return ELI_ERROR;
+}
+
+static int vm_getc(EliVM* vm) {
+  int c = vm->getc_fn ? vm->getc_fn(vm->io) : getchar();
+  return c == EOF ? 0 : c;
+}
+
+static void vm_putc(EliVM* vm, int c) {
+  if (vm->putc_fn)
+    vm->putc_fn(c, vm->io);
+  else
+    putchar(c);
+}
+
+static int vm_value(EliVM* vm, Value* v) {
+  if (v->type == REG)
+    return vm->regs[v->reg];
+  return v->imm;
+}
+
+static int vm_cmp(EliVM* vm, Inst* inst) {
+  int op = inst->op;
+  if (op >= 16)
+    op -= 8;
+  assert(inst->dst.type == REG);
+  int d = vm->regs[inst->dst.reg];
+  int s = vm_value(vm, &inst->src);
+  switch (op) {
+    case JEQ:
+      return d == s;
+    case JNE:
+      return d != s;
+    case JLT:
+      return d < s;
+    case JGT:
+      return d > s;
+    case JLE:
+      return d <= s;
+    case JGE:
+      return d >= s;
+    default:
+      return 1;
+  }
+}
+
+static bool vm_copy(EliVM* vm, Inst* inst) {
+  assert(inst->dst.type == REG);
+  int dst = vm->regs[inst->dst.reg];
+  int s = vm_value(vm, &inst->src);
+  int n = vm_value(vm, &inst->jmp);
+  if (n > MEMSZ - dst || n > MEMSZ - s) {
+    vm_error(vm, "copy out of range");
+    return false;
+  }
+  memmove(vm->mem + dst, vm->mem + s, n * sizeof(int));
+  return true;
+}
+
+static bool vm_fill(EliVM* vm, Inst* inst) {
+  assert(inst->dst.type == REG);
+  int dst = vm->regs[inst->dst.reg];
+  int v = vm_value(vm, &inst->src);
+  int n = vm_value(vm, &inst->jmp);
+  if (n > MEMSZ - dst) {
+    vm_error(vm, "fill out of range");
+    return false;
+  }
+  if (v) {
+    for (int i = 0; i < n; i++)
+      vm->mem[dst + i] = v;
+  } else {
+    memset(vm->mem + dst, 0, n * sizeof(int));
+  }
+  return true;
+}
+
+// Taken jumps by source and target pc, in an open addressing table
+// whose size is a power of two.
+static EliEdge* find_edge(EliEdge* edges, int cap, int from, int to) {
+  unsigned h = (unsigned)from * 2654435761u ^ (unsigned)to * 40503u;
+  for (int i = h & (cap - 1);; i = (i + 1) & (cap - 1)) {
+    EliEdge* e = &edges[i];
+    if (!e->count || (e->from == from && e->to == to))
+      return e;
+  }
+}
+
+static void add_edge(EliEdge** edges, int* num, int* cap,
+                     int from, int to, long n) {
+  if (*num * 2 >= *cap) {
+    int new_cap = *cap ? *cap * 2 : 256;
+    EliEdge* new_edges = calloc(new_cap, sizeof(EliEdge));
+    for (int i = 0; i < *cap; i++) {
+      EliEdge* e = &(*edges)[i];
+      if (e->count)
+        *find_edge(new_edges, new_cap, e->from, e->to) = *e;
+    }
+    free(*edges);
+    *edges = new_edges;
+    *cap = new_cap;
+  }
+  EliEdge* e = find_edge(*edges, *cap, from, to);
+  if (!e->count) {
+    e->from = from;
+    e->to = to;
+    (*num)++;
+  }
+  e->count += n;
+}
+
+#ifdef ELI_FAST
+
+#define FAST_MASK (MEMSZ - 1)
+
+// Every handler is entered through FAST_DISPATCH, which charges it to
+// the budget, except COUNT, which goes on to the real one, and END.
+#define FAST_DISPATCH() do {                    \
+    if (left <= 0)                              \
+      goto OUT;                                 \
+    left--;                                     \
+    goto *ip->op;                               \
+  } while (0)
+
+#define FAST_NEXT() do {                        \
+    ip++;                                       \
+    FAST_DISPATCH();                            \
+  } while (0)
+
+#define FAST_JUMP() do {                        \
+    pc = ip->jpc;                               \
+    ip = code + ip->j;                          \
+    FAST_DISPATCH();                            \
+  } while (0)
+
+#define FAST_SKIP(n) do {                       \
+    ip += n;                                    \
+    FAST_DISPATCH();                            \
+  } while (0)
+
+// Charges the rest of a fused sequence of |n|, or runs its first
+// instruction alone if the budget does not cover them.
+#define FAST_FUSED(n) do {                      \
+    if (left < n - 1)                           \
+      goto *plain[ip - code];                   \
+    left -= n - 1;                              \
+  } while (0)
+
+#define FAST_CMP_HANDLERS(name, cmp_op)                         \
+  name##_R: r[ip->d] = r[ip->d] cmp_op r[ip->s]; FAST_NEXT();   \
+  name##_I: r[ip->d] = r[ip->d] cmp_op ip->s; FAST_NEXT();      \
+  J##name##_R: if (r[ip->d] cmp_op r[ip->s]) FAST_JUMP();       \
+  FAST_NEXT();                                                  \
+  J##name##_I: if (r[ip->d] cmp_op ip->s) FAST_JUMP();          \
+  FAST_NEXT()
+
+// A compare whose result a "jeq/jne label, reg, 0" tests right away.
+#define FAST_CMP_JUMP_HANDLERS(name, cmp_op)                            \
+  name##_JZ_R: FAST_FUSED(2);                                           \
+  if (!(r[ip->d] = r[ip->d] cmp_op r[ip->s])) FAST_JUMP();              \
+  FAST_SKIP(2);                                                         \
+  name##_JZ_I: FAST_FUSED(2);                                           \
+  if (!(r[ip->d] = r[ip->d] cmp_op ip->s)) FAST_JUMP();                 \
+  FAST_SKIP(2);                                                         \
+  name##_JNZ_R: FAST_FUSED(2);                                          \
+  if ((r[ip->d] = r[ip->d] cmp_op r[ip->s])) FAST_JUMP();               \
+  FAST_SKIP(2);                                                         \
+  name##_JNZ_I: FAST_FUSED(2);                                          \
+  if ((r[ip->d] = r[ip->d] cmp_op ip->s)) FAST_JUMP();                  \
+  FAST_SKIP(2)
+
+// Sequences of instructions which run as one handler. The first entry
+// of a sequence gets the fused handler and the others keep their own,
+// so jumps into the middle of one still work.
+typedef enum {
+  FUSE_NONE,
+  // eq .. ge x, y; jeq/jne label, x, 0
+  FUSE_CMP_JZ,
+  FUSE_CMP_JNZ,
+  // mov x, y; load z, x
+  FUSE_MOV_LOAD,
+  // mov x, y; store z, x
+  FUSE_MOV_STORE,
+  // add/sub x, imm; load z, x
+  FUSE_ADD_LOAD,
+  // add/sub x, imm; store z, x, which covers "sub SP, 1; store A, SP"
+  FUSE_ADD_STORE,
+  // mov x, reg; add/sub x, imm; load z, x
+  FUSE_MOV_ADD_LOAD,
+  // mov x, reg; add/sub x, imm; store z, x
+  FUSE_MOV_ADD_STORE,
+  NUM_FUSE
+} FuseKind;
+
+static const char* FUSE_NAMES[NUM_FUSE] = {
+  "none", "cmp+jeq", "cmp+jne", "mov+load", "mov+store",
+  "add+load", "add+store", "mov+add+load", "mov+add+store",
+};
+
+static const int FUSE_LEN[NUM_FUSE] = { 1, 2, 2, 2, 2, 2, 2, 3, 3 };
+
+static bool is_reg(Value* v, Reg reg) {
+  return v->type == REG && v->reg == reg;
+}
+
+// An ADD or SUB of an immediate to a register, as the immediate to add.
+static bool get_add_imm(Inst* inst, int* imm) {
+  if ((inst->op != ADD && inst->op != SUB) || inst->src.type != IMM)
+    return false;
+  *imm = inst->op == ADD ? inst->src.imm : (MEMSZ - inst->src.imm) & FAST_MASK;
+  return true;
+}
+
+static bool is_mem_through(Inst* inst, Reg reg) {
+  return (inst->op == LOAD || inst->op == STORE) && is_reg(&inst->src, reg);
+}
+
+// Returns the sequence which starts at |insts[0]|, with |n| instructions
+// left in the module.
+static FuseKind match_fusion(Inst* insts, int n, int num_pcs) {
+  if (n < 2)
+    return FUSE_NONE;
+  Inst* a = &insts[0];
+  Inst* b = &insts[1];
+  Reg x = a->dst.reg;
+  int imm;
+  if (a->op >= EQ && a->op <= GE &&
+      (b->op == JEQ || b->op == JNE) && is_reg(&b->dst, x) &&
+      b->src.type == IMM && b->src.imm == 0 && b->jmp.type == IMM &&
+      b->jmp.imm >= 0 && b->jmp.imm < num_pcs)
+    return b->op == JEQ ? FUSE_CMP_JZ : FUSE_CMP_JNZ;
+  if (a->op == MOV && a->src.type == REG && n >= 3 &&
+      get_add_imm(b, &imm) && is_reg(&b->dst, x) &&
+      is_mem_through(&insts[2], x))
+    return insts[2].op == LOAD ? FUSE_MOV_ADD_LOAD : FUSE_MOV_ADD_STORE;
+  if (a->op == MOV && is_mem_through(b, x))
+    return b->op == LOAD ? FUSE_MOV_LOAD : FUSE_MOV_STORE;
+  if (get_add_imm(a, &imm) && is_mem_through(b, x))
+    return b->op == LOAD ? FUSE_ADD_LOAD : FUSE_ADD_STORE;
+  return FUSE_NONE;
+}
+
+// Runs |vm| for |budget| instructions, or decodes |decode| if |vm| is
+// NULL. Decoding lives here as the handlers are labels of this function.
+static EliStatus fast_run(EliVM* vm, long budget, EliProgram* decode) {
+  // Handlers by op for a register and an immediate src. Ops without a
+  // specialized handler run through the same helpers as the slow path.
+  static const void* const REG_HANDLERS[LAST_OP] = {
+    [MOV] = &&MOV_R, [ADD] = &&ADD_R, [SUB] = &&SUB_R,
+    [LOAD] = &&LOAD_R, [STORE] = &&STORE_R, [PUTC] = &&PUTC_R,
+    [GETC] = &&GETC_R, [EXIT] = &&EXIT_R,
+    [JEQ] = &&JEQ_R, [JNE] = &&JNE_R, [JLT] = &&JLT_R,
+    [JGT] = &&JGT_R, [JLE] = &&JLE_R, [JGE] = &&JGE_R, [JMP] = &&JMP_R,
+    [EQ] = &&EQ_R, [NE] = &&NE_R, [LT] = &&LT_R,
+    [GT] = &&GT_R, [LE] = &&LE_R, [GE] = &&GE_R, [DUMP] = &&DUMP_OP,
+    [MUL] = &&EXT, [DIV] = &&EXT, [MOD] = &&EXT, [AND] = &&EXT,
+    [OR] = &&EXT, [XOR] = &&EXT, [SHL] = &&EXT, [SHR] = &&EXT,
+    [COPY] = &&COPY, [FILL] = &&FILL,
+  };
+  static const void* const IMM_HANDLERS[LAST_OP] = {
+    [MOV] = &&MOV_I, [ADD] = &&ADD_I, [SUB] = &&SUB_I,
+    [LOAD] = &&LOAD_I, [STORE] = &&STORE_I, [PUTC] = &&PUTC_I,
+    [GETC] = &&GETC_R, [EXIT] = &&EXIT_R,
+    [JEQ] = &&JEQ_I, [JNE] = &&JNE_I, [JLT] = &&JLT_I,
+    [JGT] = &&JGT_I, [JLE] = &&JLE_I, [JGE] = &&JGE_I, [JMP] = &&JMP_R,
+    [EQ] = &&EQ_I, [NE] = &&NE_I, [LT] = &&LT_I,
+    [GT] = &&GT_I, [LE] = &&LE_I, [GE] = &&GE_I, [DUMP] = &&DUMP_OP,
+    [MUL] = &&EXT, [DIV] = &&EXT, [MOD] = &&EXT, [AND] = &&EXT,
+    [OR] = &&EXT, [XOR] = &&EXT, [SHL] = &&EXT, [SHR] = &&EXT,
+    [COPY] = &&COPY, [FILL] = &&FILL,
+  };
+  static const void* const CMP_JZ_R[] = {
+    &&EQ_JZ_R, &&NE_JZ_R, &&LT_JZ_R, &&GT_JZ_R, &&LE_JZ_R, &&GE_JZ_R,
+  };
+  static const void* const CMP_JZ_I[] = {
+    &&EQ_JZ_I, &&NE_JZ_I, &&LT_JZ_I, &&GT_JZ_I, &&LE_JZ_I, &&GE_JZ_I,
+  };
+  static const void* const CMP_JNZ_R[] = {
+    &&EQ_JNZ_R, &&NE_JNZ_R, &&LT_JNZ_R, &&GT_JNZ_R, &&LE_JNZ_R, &&GE_JNZ_R,
+  };
+  static const void* const CMP_JNZ_I[] = {
+    &&EQ_JNZ_I, &&NE_JNZ_I, &&LT_JNZ_I, &&GT_JNZ_I, &&LE_JNZ_I, &&GE_JNZ_I,
+  };
+
+  if (!vm) {
+    Module* m = decode->module;
+    FastInst* code = calloc(m->num_insts + 1, sizeof(FastInst));
+    for (int i = 0; i < m->num_insts; i++) {
+      Inst* inst = &m->insts[i];
+      FastInst* f = &code[i];
+      f->inst = inst;
+      f->d = inst->dst.reg;
+      if (inst->src.type == REG) {
+        f->op = REG_HANDLERS[inst->op];
+        f->s = inst->src.reg;
+      } else {
+        f->op = IMM_HANDLERS[inst->op];
+        f->s = inst->src.imm;
+      }
+      assert(f->op);
+      // Jumps through registers or out of the module take the slow way,
+      // which sets pc and checks it.
+      if (inst->op >= JEQ && inst->op <= JMP) {
+        if (inst->jmp.type == IMM &&
+            inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs) {
+          f->jpc = inst->jmp.imm;
+          f->j = m->pc_start[f->jpc];
+        } else {
+          f->op = &&JUMP_SLOW;
+        }
+      }
+    }
+    // Running off the end starts over from the last jump target, as
+    // slow_run does.
+    code[m->num_insts].op = &&END;
+
+    // A profile counts the entries to each pc and the taken jumps, so
+    // jumps take the slow way, which records them, and a fused sequence
+    // must not run over the start of a pc.
+    bool profile = decode->flags & ELI_PROFILE;
+    bool stats = decode->flags & ELI_STATS;
+    if (profile) {
+      for (int i = 0; i < m->num_insts; i++) {
+        Op op = m->insts[i].op;
+        if (op >= JEQ && op <= JMP) {
+          code[i].op = (code[i].op == &&JUMP_SLOW ?
+                        &&JUMP_PROF : &&JUMP_PROF_DIRECT);
+        }
+      }
+    }
+    const void** plain = malloc(sizeof(void*) * (m->num_insts + 1));
+    for (int i = 0; i <= m->num_insts; i++)
+      plain[i] = code[i].op;
+
+    char* kinds = calloc(m->num_insts + 1, 1);
+    for (int i = 0; i < m->num_insts; i++) {
+      FuseKind kind = match_fusion(&m->insts[i], m->num_insts - i,
+                                   m->num_pcs);
+      if (profile && (kind == FUSE_CMP_JZ || kind == FUSE_CMP_JNZ ||
+                      m->insts[i + FUSE_LEN[kind] - 1].pc != m->insts[i].pc))
+        kind = FUSE_NONE;
+      FastInst* f = &code[i];
+      Inst* next = &m->insts[i + 1];
+      Inst* last = &m->insts[i + FUSE_LEN[kind] - 1];
+      kinds[i] = kind;
+      switch (kind) {
+        case FUSE_NONE:
+          break;
+
+        case FUSE_CMP_JZ:
+        case FUSE_CMP_JNZ: {
+          bool imm = f->inst->src.type == IMM;
+          int k = f->inst->op - EQ;
+          if (kind == FUSE_CMP_JZ)
+            f->op = imm ? CMP_JZ_I[k] : CMP_JZ_R[k];
+          else
+            f->op = imm ? CMP_JNZ_I[k] : CMP_JNZ_R[k];
+          f->j = code[i + 1].j;
+          f->jpc = code[i + 1].jpc;
+          break;
+        }
+
+        case FUSE_MOV_LOAD:
+        case FUSE_MOV_STORE:
+          if (kind == FUSE_MOV_LOAD)
+            f->op = f->inst->src.type == IMM ? &&MOV_LOAD_I : &&MOV_LOAD_R;
+          else
+            f->op = f->inst->src.type == IMM ? &&MOV_STORE_I : &&MOV_STORE_R;
+          f->t = last->dst.reg;
+          break;
+
+        case FUSE_ADD_LOAD:
+        case FUSE_ADD_STORE:
+          f->op = kind == FUSE_ADD_LOAD ? &&ADD_LOAD : &&ADD_STORE;
+          get_add_imm(f->inst, &f->s);
+          // s is what to add now, for a sub as well.
+          plain[i] = &&ADD_I;
+          f->t = last->dst.reg;
+          break;
+
+        case FUSE_MOV_ADD_LOAD:
+        case FUSE_MOV_ADD_STORE:
+          f->op = kind == FUSE_MOV_ADD_LOAD ? &&MOV_ADD_LOAD : &&MOV_ADD_STORE;
+          get_add_imm(next, &f->j);
+          f->t = last->dst.reg;
+          break;
+
+        default:
+          assert(false);
+      }
+    }
+
+    // With ELI_STATS, every handler is entered through COUNT, and with
+    // ELI_PROFILE the first one of each pc is.
+    if (stats || profile) {
+      const void** real = malloc(sizeof(void*) * (m->num_insts + 1));
+      for (int i = 0; i <= m->num_insts; i++) {
+        real[i] = code[i].op;
+        if (stats || (i < m->num_insts &&
+                      m->pc_start[m->insts[i].pc] == i))
+          code[i].op = &&COUNT;
+      }
+      decode->real = real;
+    }
+    decode->code = code;
+    decode->plain = plain;
+    decode->kinds = kinds;
+    return ELI_RUNNING;
+  }
+
+  const EliProgram* prog = vm->prog;
+  Module* m = vm->module;
+  FastInst* code = prog->code;
+  const void* const* plain = prog->plain;
+  const void* const* real = prog->real;
+  long* counts = vm->counts;
+  long* taken = vm->taken;
+  int* r = vm->regs;
+  int* mem = vm->mem;
+  int pc = vm->pc;
+  long start = budget < 0 ? LONG_MAX : budget;
+  long left = start;
+  FastInst* ip = code + vm->next;
+  FAST_DISPATCH();
+
+END:
+  left++;
+ENTER:
+  if (pc < 0 || pc >= m->num_pcs) {
+    vm_error(vm, "pc out of range");
+    goto OUT;
+  }
+  ip = code + m->pc_start[pc];
+  FAST_DISPATCH();
+
+MOV_R: r[ip->d] = r[ip->s]; FAST_NEXT();
+MOV_I: r[ip->d] = ip->s; FAST_NEXT();
+ADD_R: r[ip->d] = (r[ip->d] + r[ip->s]) & FAST_MASK; FAST_NEXT();
+ADD_I: r[ip->d] = (r[ip->d] + ip->s) & FAST_MASK; FAST_NEXT();
+SUB_R: r[ip->d] = (r[ip->d] - r[ip->s]) & FAST_MASK; FAST_NEXT();
+SUB_I: r[ip->d] = (r[ip->d] - ip->s) & FAST_MASK; FAST_NEXT();
+LOAD_R: r[ip->d] = mem[r[ip->s]]; FAST_NEXT();
+LOAD_I: r[ip->d] = mem[ip->s]; FAST_NEXT();
+STORE_R: mem[r[ip->s]] = r[ip->d]; FAST_NEXT();
+STORE_I: mem[ip->s] = r[ip->d]; FAST_NEXT();
+PUTC_R: vm_putc(vm, r[ip->s]); FAST_NEXT();
+PUTC_I: vm_putc(vm, ip->s); FAST_NEXT();
+GETC_R:
+  if (vm->break_on_input)
+    goto BREAK;
+  r[ip->d] = vm_getc(vm);
+  FAST_NEXT();
+EXIT_R:
+  vm->status = ELI_EXITED;
+  goto OUT;
+DUMP_OP:
+  if (vm->break_on_input)
+    goto BREAK;
+  FAST_NEXT();
+BREAK:
+  // The instruction has not run, so it is not charged.
+  left++;
+  vm->status = ELI_BREAK;
+  goto OUT;
+JMP_R: FAST_JUMP();
+FAST_CMP_HANDLERS(EQ, ==);
+FAST_CMP_HANDLERS(NE, !=);
+FAST_CMP_HANDLERS(LT, <);
+FAST_CMP_HANDLERS(GT, >);
+FAST_CMP_HANDLERS(LE, <=);
+FAST_CMP_HANDLERS(GE, >=);
+JUMP_SLOW:
+  if (vm_cmp(vm, ip->inst)) {
+    pc = vm_value(vm, &ip->inst->jmp);
+    goto ENTER;
+  }
+  FAST_NEXT();
+EXT:
+  r[ip->d] = eval_ext_op(ip->inst->op, r[ip->d],
+                         vm_value(vm, &ip->inst->src));
+  FAST_NEXT();
+COPY:
+  if (!vm_copy(vm, ip->inst))
+    goto OUT;
+  FAST_NEXT();
+FILL:
+  if (!vm_fill(vm, ip->inst))
+    goto OUT;
+  FAST_NEXT();
+
+FAST_CMP_JUMP_HANDLERS(EQ, ==);
+FAST_CMP_JUMP_HANDLERS(NE, !=);
+FAST_CMP_JUMP_HANDLERS(LT, <);
+FAST_CMP_JUMP_HANDLERS(GT, >);
+FAST_CMP_JUMP_HANDLERS(LE, <=);
+FAST_CMP_JUMP_HANDLERS(GE, >=);
+MOV_LOAD_R:
+  FAST_FUSED(2);
+  r[ip->d] = r[ip->s];
+  r[ip->t] = mem[r[ip->d]];
+  FAST_SKIP(2);
+MOV_LOAD_I:
+  FAST_FUSED(2);
+  r[ip->d] = ip->s;
+  r[ip->t] = mem[ip->s];
+  FAST_SKIP(2);
+MOV_STORE_R:
+  FAST_FUSED(2);
+  r[ip->d] = r[ip->s];
+  mem[r[ip->d]] = r[ip->t];
+  FAST_SKIP(2);
+MOV_STORE_I:
+  FAST_FUSED(2);
+  r[ip->d] = ip->s;
+  mem[ip->s] = r[ip->t];
+  FAST_SKIP(2);
+ADD_LOAD:
+  FAST_FUSED(2);
+  r[ip->d] = (r[ip->d] + ip->s) & FAST_MASK;
+  r[ip->t] = mem[r[ip->d]];
+  FAST_SKIP(2);
+ADD_STORE:
+  FAST_FUSED(2);
+  r[ip->d] = (r[ip->d] + ip->s) & FAST_MASK;
+  mem[r[ip->d]] = r[ip->t];
+  FAST_SKIP(2);
+MOV_ADD_LOAD:
+  FAST_FUSED(3);
+  r[ip->d] = (r[ip->s] + ip->j) & FAST_MASK;
+  r[ip->t] = mem[r[ip->d]];
+  FAST_SKIP(3);
+MOV_ADD_STORE:
+  FAST_FUSED(3);
+  r[ip->d] = (r[ip->s] + ip->j) & FAST_MASK;
+  mem[r[ip->d]] = r[ip->t];
+  FAST_SKIP(3);
+
+COUNT:
+  counts[ip - code]++;
+  goto *real[ip - code];
+JUMP_PROF:
+  if (vm_cmp(vm, ip->inst)) {
+    taken[ip - code]++;
+    pc = vm_value(vm, &ip->inst->jmp);
+    if (ip->inst->jmp.type == REG) {
+      add_edge(&vm->edges, &vm->num_edges, &vm->cap_edges,
+               ip->inst->pc, pc, 1);
+    }
+    goto ENTER;
+  }
+  FAST_NEXT();
+JUMP_PROF_DIRECT:
+  if (vm_cmp(vm, ip->inst)) {
+    taken[ip - code]++;
+    FAST_JUMP();
+  }
+  FAST_NEXT();
+
+OUT:
+  vm->pc = pc;
+  vm->next = ip - code;
+  vm->executed += start - left;
+  return vm->status;
+}
+
+#endif  // ELI_FAST
+
+// Prints the registers for trace, which finds values gone negative.
+static bool dump_regs(EliVM* vm, Inst* inst) {
+  bool had_negative = false;
+  static const char* REG_NAMES[] = {
+    "A", "B", "C", "D", "BP", "SP"
+  };
+  fprintf(stderr, "PC=%d ", inst->lineno);
+  for (int i = 0; i < 6; i++) {
+    if (vm->regs[i] < 0)
+      had_negative = true;
+    fprintf(stderr, "%s=%d", REG_NAMES[i], vm->regs[i]);
+    fprintf(stderr, i == 5 ? "\n" : " ");
+  }
+  if (had_negative) {
+    vm_error(vm, "had negative!");
+    return false;
+  }
+  return true;
+}
+
+// The portable engine, which also traces.
+static EliStatus slow_run(EliVM* vm, long budget) {
+  Module* m = vm->module;
+  int* regs = vm->regs;
+  int* mem = vm->mem;
+  while (budget) {
+    if (vm->next >= m->num_insts) {
+      // Running off the end starts over from the last jump target.
+      if (vm->pc < 0 || vm->pc >= m->num_pcs)
+        return vm_error(vm, "pc out of range");
+      vm->next = m->pc_start[vm->pc];
+      continue;
+    }
+    Inst* inst = &m->insts[vm->next];
+    if (vm->break_on_input && (inst->op == GETC || inst->op == DUMP)) {
+      vm->status = ELI_BREAK;
+      return ELI_BREAK;
+    }
+    if (vm->trace) {
+      if (!dump_regs(vm, inst))
+        return ELI_ERROR;
+      dump_inst(inst);
+    }
+    if (budget > 0)
+      budget--;
+    vm->executed++;
+    vm->next++;
+    switch (inst->op) {
+      case MOV:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] = vm_value(vm, &inst->src);
+        break;
+
+      case ADD:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] += vm_value(vm, &inst->src);
+        regs[inst->dst.reg] += MEMSZ;
+        regs[inst->dst.reg] %= MEMSZ;
+        break;
+
+      case SUB:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] -= vm_value(vm, &inst->src);
+        regs[inst->dst.reg] += MEMSZ;
+        regs[inst->dst.reg] %= MEMSZ;
+        break;
+
+      case LOAD: {
+        assert(inst->dst.type == REG);
+        int addr = vm_value(vm, &inst->src);
+        if (addr < 0)
+          return vm_error(vm, "zero page load");
+        regs[inst->dst.reg] = mem[addr];
+        break;
+      }
+
+      case STORE: {
+        assert(inst->dst.type == REG);
+        int addr = vm_value(vm, &inst->src);
+        if (addr < 0)
+          return vm_error(vm, "zero page store");
+        mem[addr] = regs[inst->dst.reg];
+        break;
+      }
+
+      case PUTC:
+        vm_putc(vm, vm_value(vm, &inst->src));
+        break;
+
+      case GETC:
+        regs[inst->dst.reg] = vm_getc(vm);
+        regs[inst->dst.reg] += MEMSZ;
+        regs[inst->dst.reg] %= MEMSZ;
+        break;
+
+      case EXIT:
+        vm->next--;
+        vm->status = ELI_EXITED;
+        return ELI_EXITED;
+
+      case DUMP:
+        break;
+
+      case EQ:
+      case NE:
+      case LT:
+      case GT:
+      case LE:
+      case GE:
+        regs[inst->dst.reg] = vm_cmp(vm, inst);
+        break;
+
+      case MUL:
+      case DIV:
+      case MOD:
+      case AND:
+      case OR:
+      case XOR:
+      case SHL:
+      case SHR:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] =
+            eval_ext_op(inst->op, regs[inst->dst.reg],
+                        vm_value(vm, &inst->src));
+        break;
+
+      case COPY:
+        if (!vm_copy(vm, inst))
+          return ELI_ERROR;
+        break;
+
+      case FILL:
+        if (!vm_fill(vm, inst))
+          return ELI_ERROR;
+        break;
+
+      case JEQ:
+      case JNE:
+      case JLT:
+      case JGT:
+      case JLE:
+      case JGE:
+      case JMP:
+        if (vm_cmp(vm, inst)) {
+          vm->pc = vm_value(vm, &inst->jmp);
+          if (vm->pc < 0 || vm->pc >= m->num_pcs)
+            return vm_error(vm, "pc out of range");
+          vm->next = m->pc_start[vm->pc];
+        }
+        break;
+
+      default:
+        return vm_error(vm, "oops");
+    }
+  }
+  return ELI_RUNNING;
+}
+
+#ifdef ELI_JIT
+
+// A JIT which compiles a pc at a time to x86-64 the first time it runs.
+// EIR registers live in callee-saved host registers, so calls to the C
+// helpers below keep them, and r11 holds the base of mem, which is
+// reloaded after each call. Compiled pcs run until they need a pc which
+// is not compiled yet, and then return it to eli_run_jit with the
+// address of the rel32 to point at the new code, which chains the two.
+// The code has the addresses of one VM, which owns it.
+//
+// Running off the end of the last pc is reported as out of range,
+// where the interpreters start over from the last jump target.
+
+enum {
+  JIT_RAX = 0, JIT_RCX = 1, JIT_RDX = 2, JIT_RBX = 3,
+  JIT_RSP = 4, JIT_RBP = 5, JIT_RSI = 6, JIT_RDI = 7,
+  JIT_R11 = 11, JIT_R12 = 12, JIT_R13 = 13, JIT_R14 = 14, JIT_R15 = 15,
+};
+
+static const int JIT_REGS[6] = {
+  JIT_RBX, JIT_R12, JIT_R13, JIT_R14, JIT_R15, JIT_RBP
+};
+
+// Condition codes of jcc and setcc for JEQ .. JGE. Values are never
+// negative, so unsigned ones work.
+static const int JIT_CC[6] = { 0x4, 0x5, 0x2, 0x7, 0x6, 0x3 };
+
+// The most bytes one instruction and the end of a pc can take, with
+// their exit stubs.
+#define JIT_MAX_INST_SIZE 128
+#define JIT_MAX_PC_SIZE 32
+
+// What the code returns when the program exits or a helper fails.
+#define JIT_EXITED -1
+#define JIT_FAILED -2
+
+typedef struct {
+  int pc;
+  unsigned char* rel;
+} JitStub;
+
+typedef struct EliJit_ {
+  EliVM* vm;
+  Module* m;
+  unsigned char* buf;
+  unsigned char* p;
+  unsigned char* end;
+  // Compiled code by pc, or NULL. Register jumps look this up.
+  unsigned char** blocks;
+  unsigned char* (*enter)(unsigned char* code);
+  unsigned char* exit;
+  // Exits to pcs which are not compiled yet, emitted after each pc.
+  JitStub* stubs;
+  int num_stubs;
+  // Where the last return to eli_run_jit came from, or NULL.
+  unsigned char* patch;
+} Jit;
+
+static void jit_byte(Jit* j, int b) {
+  *j->p++ = b;
+}
+
+static void jit_int32(Jit* j, int v) {
+  memcpy(j->p, &v, 4);
+  j->p += 4;
+}
+
+static void jit_ptr(Jit* j, const void* v) {
+  memcpy(j->p, &v, 8);
+  j->p += 8;
+}
+
+static void jit_set_rel(unsigned char* rel, unsigned char* to) {
+  int v = to - (rel + 4);
+  memcpy(rel, &v, 4);
+}
+
+static void jit_rex(Jit* j, bool w, int reg, int index, int base) {
+  int rex = 0x40 | (w << 3) | (reg >= 8) << 2 | (index >= 8) << 1 | (base >= 8);
+  if (rex != 0x40)
+    jit_byte(j, rex);
+}
+
+// An op with a register |reg| and a register operand |rm|.
+static void jit_op_rr(Jit* j, int op, int reg, int rm) {
+  jit_rex(j, false, reg, 0, rm);
+  jit_byte(j, op);
+  jit_byte(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// An op with a register |reg| and the operand mem[index] or mem[imm] if
+// |index| is -1.
+static void jit_op_mem(Jit* j, int op, int reg, int index, int imm) {
+  if (index < 0) {
+    jit_rex(j, false, reg, 0, JIT_R11);
+    jit_byte(j, op);
+    jit_byte(j, 0x80 | (reg & 7) << 3 | (JIT_R11 & 7));
+    jit_int32(j, imm * 4);
+  } else {
+    jit_rex(j, false, reg, index, JIT_R11);
+    jit_byte(j, op);
+    jit_byte(j, (reg & 7) << 3 | 4);
+    jit_byte(j, 0x80 | (index & 7) << 3 | (JIT_R11 & 7));
+  }
+}
+
+static void jit_movabs(Jit* j, int reg, const void* v) {
+  jit_rex(j, true, 0, 0, reg);
+  jit_byte(j, 0xb8 | (reg & 7));
+  jit_ptr(j, v);
+}
+
+static void jit_mov_imm(Jit* j, int reg, int imm) {
+  jit_rex(j, false, 0, 0, reg);
+  jit_byte(j, 0xb8 | (reg & 7));
+  jit_int32(j, imm);
+}
+
+// Sets |reg| to the value of |v|.
+static void jit_mov_value(Jit* j, int reg, Value* v) {
+  if (v->type == REG)
+    jit_op_rr(j, 0x89, JIT_REGS[v->reg], reg);
+  else
+    jit_mov_imm(j, reg, v->imm);
+}
+
+// add, sub, and, or cmp of |v| to |reg|, as the /digit of opcode 0x81.
+static void jit_arith(Jit* j, int digit, int reg, Value* v) {
+  static const int RR_OPS[8] = { 0x01, 0, 0, 0, 0x21, 0x29, 0, 0x39 };
+  if (v->type == REG) {
+    jit_op_rr(j, RR_OPS[digit], JIT_REGS[v->reg], reg);
+  } else {
+    jit_rex(j, false, 0, 0, reg);
+    jit_byte(j, 0x81);
+    jit_byte(j, 0xc0 | digit << 3 | (reg & 7));
+    jit_int32(j, v->imm);
+  }
+}
+
+static void jit_mask(Jit* j, int reg) {
+  Value v = { .type = IMM, .imm = MEMSZ - 1 };
+  jit_arith(j, 4, reg, &v);
+}
+
+// Calls |fn| and restores the base of mem. Arguments are set already.
+static void jit_call(Jit* j, const void* fn) {
+  jit_movabs(j, JIT_RAX, fn);
+  jit_byte(j, 0xff);
+  jit_byte(j, 0xd0);
+  jit_movabs(j, JIT_R11, j->vm->mem);
+}
+
+// Stores every register to regs for helpers which read them.
+static void jit_spill(Jit* j) {
+  jit_movabs(j, JIT_RCX, j->vm->regs);
+  for (int i = 0; i < 6; i++) {
+    jit_rex(j, false, JIT_REGS[i], 0, JIT_RCX);
+    jit_byte(j, 0x89);
+    jit_byte(j, 0x40 | (JIT_REGS[i] & 7) << 3 | JIT_RCX);
+    jit_byte(j, i * 4);
+  }
+}
+
+static void jit_fill(Jit* j) {
+  jit_movabs(j, JIT_RCX, j->vm->regs);
+  for (int i = 0; i < 6; i++) {
+    jit_rex(j, false, JIT_REGS[i], 0, JIT_RCX);
+    jit_byte(j, 0x8b);
+    jit_byte(j, 0x40 | (JIT_REGS[i] & 7) << 3 | JIT_RCX);
+    jit_byte(j, i * 4);
+  }
+}
+
+// Returns to eli_run_jit with pc in eax and the rel32 to patch in rdx.
+static void jit_exit(Jit* j, int npc, unsigned char* rel) {
+  jit_mov_imm(j, JIT_RAX, npc);
+  jit_movabs(j, JIT_RDX, rel);
+  jit_byte(j, 0xe9);
+  jit_set_rel(j->p, j->exit);
+  j->p += 4;
+}
+
+// Ends a jmp (0xe9) or jcc (0x0f 0x8?) to |npc| whose rel32 comes next.
+static void jit_branch_to(Jit* j, int npc) {
+  unsigned char* rel = j->p;
+  j->p += 4;
+  if (npc >= 0 && npc < j->m->num_pcs && j->blocks[npc]) {
+    jit_set_rel(rel, j->blocks[npc]);
+  } else {
+    j->stubs[j->num_stubs].pc = npc;
+    j->stubs[j->num_stubs].rel = rel;
+    j->num_stubs++;
+  }
+}
+
+// Jumps to the pc in eax through blocks, or returns to eli_run_jit if
+// it is not compiled yet.
+static void jit_jump_eax(Jit* j) {
+  // cmp eax, num_pcs; jae exit
+  jit_byte(j, 0x3d);
+  jit_int32(j, j->m->num_pcs);
+  jit_byte(j, 0x0f);
+  jit_byte(j, 0x83);
+  unsigned char* out_of_range = j->p;
+  j->p += 4;
+  // mov rcx, blocks[rax]; test rcx, rcx; jz exit; jmp rcx
+  jit_movabs(j, JIT_RCX, j->blocks);
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x8b);
+  jit_byte(j, 0x0c);
+  jit_byte(j, 0xc1);
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x85);
+  jit_byte(j, 0xc9);
+  jit_byte(j, 0x0f);
+  jit_byte(j, 0x84);
+  unsigned char* not_compiled = j->p;
+  j->p += 4;
+  jit_byte(j, 0xff);
+  jit_byte(j, 0xe1);
+  jit_set_rel(out_of_range, j->p);
+  jit_set_rel(not_compiled, j->p);
+  // xor edx, edx; jmp exit
+  jit_byte(j, 0x31);
+  jit_byte(j, 0xd2);
+  jit_byte(j, 0xe9);
+  jit_set_rel(j->p, j->exit);
+  j->p += 4;
+}
+
+static void jit_putc(EliVM* vm, int c) {
+  vm_putc(vm, c);
+}
+
+static int jit_getc(EliVM* vm) {
+  return vm_getc(vm);
+}
+
+// COPY and FILL, which can fail. The code does not keep pc, so this
+// sets it for the error.
+static bool jit_block_op(EliVM* vm, Inst* inst) {
+  vm->pc = inst->pc;
+  return inst->op == COPY ? vm_copy(vm, inst) : vm_fill(vm, inst);
+}
+
+static void jit_inst(Jit* j, Inst* inst) {
+  int d = JIT_REGS[inst->dst.reg];
+  switch (inst->op) {
+    case MOV:
+      jit_mov_value(j, d, &inst->src);
+      break;
+
+    case ADD:
+    case SUB:
+      jit_arith(j, inst->op == ADD ? 0 : 5, d, &inst->src);
+      jit_mask(j, d);
+      break;
+
+    case LOAD:
+    case STORE: {
+      int op = inst->op == LOAD ? 0x8b : 0x89;
+      if (inst->src.type == REG)
+        jit_op_mem(j, op, d, JIT_REGS[inst->src.reg], 0);
+      else
+        jit_op_mem(j, op, d, -1, inst->src.imm);
+      break;
+    }
+
+    case PUTC:
+      jit_mov_value(j, JIT_RSI, &inst->src);
+      jit_movabs(j, JIT_RDI, j->vm);
+      jit_call(j, jit_putc);
+      break;
+
+    case GETC:
+      jit_movabs(j, JIT_RDI, j->vm);
+      jit_call(j, jit_getc);
+      jit_op_rr(j, 0x89, JIT_RAX, d);
+      break;
+
+    case EXIT:
+      jit_exit(j, JIT_EXITED, NULL);
+      break;
+
+    case DUMP:
+      break;
+
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+      // cmp; setcc al; movzx d, al
+      jit_arith(j, 7, d, &inst->src);
+      jit_byte(j, 0x0f);
+      jit_byte(j, 0x90 | JIT_CC[inst->op - EQ]);
+      jit_byte(j, 0xc0);
+      jit_rex(j, false, d, 0, 0);
+      jit_byte(j, 0x0f);
+      jit_byte(j, 0xb6);
+      jit_byte(j, 0xc0 | (d & 7) << 3);
+      break;
+
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      jit_mov_value(j, JIT_RDX, &inst->src);
+      jit_op_rr(j, 0x89, d, JIT_RSI);
+      jit_mov_imm(j, JIT_RDI, inst->op);
+      jit_call(j, eval_ext_op);
+      jit_op_rr(j, 0x89, JIT_RAX, d);
+      break;
+
+    case COPY:
+    case FILL: {
+      jit_spill(j);
+      jit_movabs(j, JIT_RDI, j->vm);
+      jit_movabs(j, JIT_RSI, inst);
+      jit_call(j, jit_block_op);
+      // test al, al; jnz ok
+      jit_byte(j, 0x84);
+      jit_byte(j, 0xc0);
+      jit_byte(j, 0x0f);
+      jit_byte(j, 0x85);
+      unsigned char* ok = j->p;
+      j->p += 4;
+      jit_exit(j, JIT_FAILED, NULL);
+      jit_set_rel(ok, j->p);
+      break;
+    }
+
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+    case JMP: {
+      bool direct = inst->jmp.type == IMM;
+      unsigned char* skip = NULL;
+      if (inst->op != JMP) {
+        jit_arith(j, 7, d, &inst->src);
+        jit_byte(j, 0x0f);
+        if (direct) {
+          jit_byte(j, 0x80 | JIT_CC[inst->op - JEQ]);
+          jit_branch_to(j, inst->jmp.imm);
+          break;
+        }
+        // The opposite condition skips the register jump.
+        jit_byte(j, 0x80 | (JIT_CC[inst->op - JEQ] ^ 1));
+        skip = j->p;
+        j->p += 4;
+      }
+      if (direct) {
+        jit_byte(j, 0xe9);
+        jit_branch_to(j, inst->jmp.imm);
+      } else {
+        jit_op_rr(j, 0x89, JIT_REGS[inst->jmp.reg], JIT_RAX);
+        jit_jump_eax(j);
+      }
+      if (skip)
+        jit_set_rel(skip, j->p);
+      break;
+    }
+
+    default:
+      assert(false);
+  }
+}
+
+static bool jit_compile(Jit* j, int npc) {
+  Module* m = j->m;
+  int start = m->pc_start[npc];
+  int end = m->pc_start[npc + 1];
+  if (j->end - j->p < (end - start) * JIT_MAX_INST_SIZE + JIT_MAX_PC_SIZE)
+    return false;
+  j->blocks[npc] = j->p;
+  j->num_stubs = 0;
+  for (int i = start; i < end; i++)
+    jit_inst(j, &m->insts[i]);
+  if (end == start || (m->insts[end - 1].op != JMP &&
+                       m->insts[end - 1].op != EXIT)) {
+    jit_byte(j, 0xe9);
+    jit_branch_to(j, npc + 1);
+  }
+  for (int i = 0; i < j->num_stubs; i++) {
+    jit_set_rel(j->stubs[i].rel, j->p);
+    jit_exit(j, j->stubs[i].pc, j->stubs[i].rel);
+  }
+  return true;
+}
+
+static size_t jit_size(Module* m) {
+  return ((size_t)m->num_insts * JIT_MAX_INST_SIZE +
+          (size_t)m->num_pcs * JIT_MAX_PC_SIZE + 4096);
+}
+
+static Jit* jit_new(EliVM* vm) {
+  Module* m = vm->module;
+  unsigned char* buf = mmap(NULL, jit_size(m),
+                            PROT_READ | PROT_WRITE | PROT_EXEC,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    return NULL;
+  Jit* j = calloc(1, sizeof(Jit));
+  j->vm = vm;
+  j->m = m;
+  j->buf = buf;
+  j->p = j->buf;
+  j->end = j->buf + jit_size(m);
+  j->blocks = calloc(m->num_pcs + 1, sizeof(unsigned char*));
+  int max_stubs = 1;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (m->pc_start[pc + 1] - m->pc_start[pc] + 1 > max_stubs)
+      max_stubs = m->pc_start[pc + 1] - m->pc_start[pc] + 1;
+  }
+  j->stubs = malloc(sizeof(JitStub) * max_stubs);
+
+  // enter(code): saves the callee-saved registers, keeping the stack
+  // aligned for calls, loads regs, and jumps to |code|.
+  j->enter = (unsigned char* (*)(unsigned char*))j->p;
+  static const int SAVED[6] = {
+    JIT_RBX, JIT_RBP, JIT_R12, JIT_R13, JIT_R14, JIT_R15
+  };
+  for (int i = 0; i < 6; i++) {
+    jit_rex(j, false, 0, 0, SAVED[i]);
+    jit_byte(j, 0x50 | (SAVED[i] & 7));
+  }
+  // sub rsp, 8
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x83);
+  jit_byte(j, 0xec);
+  jit_byte(j, 8);
+  jit_fill(j);
+  jit_movabs(j, JIT_R11, vm->mem);
+  // jmp rdi
+  jit_byte(j, 0xff);
+  jit_byte(j, 0xe7);
+
+  // The exit: stores regs and patch, and returns pc.
+  j->exit = j->p;
+  jit_spill(j);
+  jit_movabs(j, JIT_RCX, &j->patch);
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x89);
+  jit_byte(j, 0x11);
+  // add rsp, 8
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x83);
+  jit_byte(j, 0xc4);
+  jit_byte(j, 8);
+  for (int i = 5; i >= 0; i--) {
+    jit_rex(j, false, 0, 0, SAVED[i]);
+    jit_byte(j, 0x58 | (SAVED[i] & 7));
+  }
+  jit_byte(j, 0xc3);
+  return j;
+}
+
+static void jit_free(Jit* j) {
+  munmap(j->buf, jit_size(j->m));
+  free(j->blocks);
+  free(j->stubs);
+  free(j);
+}
+
+#endif  // ELI_JIT
+
+EliProgram* eli_new_program(Module* m, int flags) {
+  EliProgram* prog = calloc(1, sizeof(EliProgram));
+  prog->module = m;
+  prog->flags = flags;
+#ifdef ELI_FAST
+  fast_run(NULL, 0, prog);
+#endif
+  return prog;
+}
+
+void eli_free_program(EliProgram* prog) {
+#ifdef ELI_FAST
+  free(prog->code);
+  free(prog->plain);
+  free(prog->real);
+  free(prog->kinds);
+#endif
+  free(prog);
+}
+
+static int* alloc_mem(void) {
+#ifdef ELI_MMAP
+  void* p = mmap(NULL, MEMSZ * sizeof(int), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+#else
+  return calloc(MEMSZ, sizeof(int));
+#endif
+}
+
+static void free_mem(int* mem) {
+#ifdef ELI_MMAP
+  munmap(mem, MEMSZ * sizeof(int));
+#else
+  free(mem);
+#endif
+}
+
+EliVM* eli_new_vm(const EliProgram* prog) {
+  Module* m = prog->module;
+  int* mem = alloc_mem();
+  if (!mem)
+    return NULL;
+  EliVM* vm = calloc(1, sizeof(EliVM));
+  vm->prog = prog;
+  vm->module = m;
+  vm->mem = mem;
+  int i = 0;
+  for (Data* d = m->data; d; d = d->next, i++) {
+    vm->mem[i] = d->v;
+  }
+  if (m->text)
+    vm->pc = m->text->pc;
+  vm->next = vm->pc < m->num_pcs ? m->pc_start[vm->pc] : m->num_insts;
+  if (prog->flags & (ELI_PROFILE | ELI_STATS))
+    vm->counts = calloc(m->num_insts + 1, sizeof(long));
+  if (prog->flags & ELI_PROFILE)
+    vm->taken = calloc(m->num_insts + 1, sizeof(long));
+  return vm;
+}
+
+void eli_free_vm(EliVM* vm) {
+#ifdef ELI_JIT
+  if (vm->jit)
+    jit_free(vm->jit);
+#endif
+  free_mem(vm->mem);
+  free(vm->counts);
+  free(vm->taken);
+  free(vm->edges);
+  free(vm);
+}
+
+void eli_set_io(EliVM* vm, EliGetc getc_fn, EliPutc putc_fn, void* opaque) {
+  vm->getc_fn = getc_fn;
+  vm->putc_fn = putc_fn;
+  vm->io = opaque;
+}
+
+EliStatus eli_run(EliVM* vm, long budget) {
+  if (vm->status == ELI_BREAK)
+    vm->status = ELI_RUNNING;
+  if (vm->status != ELI_RUNNING)
+    return vm->status;
+#ifdef ELI_FAST
+  if (!vm->trace)
+    return fast_run(vm, budget, NULL);
+#endif
+  return slow_run(vm, budget);
+}
+
+EliStatus eli_step(EliVM* vm) {
+  return eli_run(vm, 1);
+}
+
+EliStatus eli_run_jit(EliVM* vm) {
+#ifdef ELI_JIT
+  Module* m = vm->module;
+  if (vm->status == ELI_BREAK)
+    vm->status = ELI_RUNNING;
+  // Compiled code is entered at the start of a pc.
+  while (vm->status == ELI_RUNNING && vm->next < m->num_insts &&
+         m->pc_start[m->insts[vm->next].pc] != vm->next)
+    eli_step(vm);
+  if (vm->status != ELI_RUNNING)
+    return vm->status;
+  if (!vm->jit)
+    vm->jit = jit_new(vm);
+  if (!vm->jit)
+    return vm_error(vm, "cannot map jit buffer");
+
+  Jit* j = vm->jit;
+  int pc = vm->next < m->num_insts ? m->insts[vm->next].pc : vm->pc;
+  for (;;) {
+    vm->pc = pc;
+    if (pc < 0 || pc >= m->num_pcs)
+      return vm_error(vm, "pc out of range");
+    if (!j->blocks[pc] && !jit_compile(j, pc))
+      return vm_error(vm, "jit buffer full");
+    if (j->patch)
+      jit_set_rel(j->patch, j->blocks[pc]);
+    j->patch = NULL;
+    // The returned pointer is the pc, as eax.
+    pc = (int)(long)j->enter(j->blocks[pc]);
+    if (pc == JIT_EXITED) {
+      vm->status = ELI_EXITED;
+      return ELI_EXITED;
+    }
+    if (pc == JIT_FAILED)
+      return ELI_ERROR;
+  }
+#else
+  return eli_run(vm, -1);
+#endif
+}
+
+long eli_resident_pages(EliVM* vm) {
+#ifdef ELI_MMAP
+  long page = sysconf(_SC_PAGESIZE);
+  long num_pages = (MEMSZ * sizeof(int) + page - 1) / page;
+  unsigned char* vec = malloc(num_pages);
+  long n = -1;
+  if (!mincore(vm->mem, MEMSZ * sizeof(int), vec)) {
+    n = 0;
+    for (long i = 0; i < num_pages; i++)
+      n += vec[i] & 1;
+  }
+  free(vec);
+  return n;
+#else
+  (void)vm;
+  return -1;
+#endif
+}
+
+#ifdef ELI_MMAP
+
+// A snapshot file starts with this, followed by the index of each saved
+// page of memory and the output so far. The pages follow at data_offset,
+// which is aligned to a host page so they can be mapped as they are.
+typedef struct {
+  char magic[8];
+  unsigned module_hash;
+  int regs[6];
+  int pc;
+  int next;
+  int page_size;
+  int num_pages;
+  long out_len;
+  long data_offset;
+} EliSnapshot;
+
+static const char SNAPSHOT_MAGIC[8] = "ELISNAP";
+
+static unsigned hash_int(unsigned h, int v) {
+  return (h ^ (unsigned)v) * 16777619u;
+}
+
+static unsigned hash_value(unsigned h, Value* v) {
+  h = hash_int(h, v->type);
+  return hash_int(h, v->type == REG ? (int)v->reg : v->imm);
+}
+
+// The code and data a snapshot belongs to, so it is not resumed with
+// another program.
+static unsigned module_hash(Module* m) {
+  unsigned h = hash_int(2166136261u, m->num_insts);
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    h = hash_int(h, inst->op);
+    h = hash_int(h, inst->pc);
+    h = hash_value(h, &inst->dst);
+    h = hash_value(h, &inst->src);
+    h = hash_value(h, &inst->jmp);
+  }
+  for (Data* d = m->data; d; d = d->next)
+    h = hash_int(h, d->v);
+  return h;
+}
+
+static int num_data_words(Module* m) {
+  int n = 0;
+  for (Data* d = m->data; d; d = d->next)
+    n++;
+  return n;
+}
+
+#endif
+
+const char* eli_save_snapshot(EliVM* vm, const char* filename,
+                              const char* out, long out_len) {
+#ifdef ELI_MMAP
+  if (vm->status != ELI_RUNNING && vm->status != ELI_BREAK)
+    return "the program is not running";
+  Module* m = vm->module;
+  long page = sysconf(_SC_PAGESIZE);
+  long page_words = page / sizeof(int);
+  long max_pages = MEMSZ / page_words;
+  // A new VM has the data and zeros elsewhere, so the snapshot needs
+  // the pages with the data and the pages which are not zero. mincore
+  // would be cheaper, but it misses pages which were swapped out or,
+  // after a restore, dropped from the page cache.
+  int data_words = num_data_words(m);
+  int* pages = malloc(sizeof(int) * max_pages);
+  int num_pages = 0;
+  for (long p = 0; p < max_pages; p++) {
+    int* words = vm->mem + p * page_words;
+    bool zero = p * page_words >= data_words;
+    for (long i = 0; zero && i < page_words; i++)
+      zero = !words[i];
+    if (!zero)
+      pages[num_pages++] = p;
+  }
+
+  EliSnapshot s = {};
+  memcpy(s.magic, SNAPSHOT_MAGIC, sizeof(s.magic));
+  s.module_hash = module_hash(m);
+  memcpy(s.regs, vm->regs, sizeof(s.regs));
+  s.pc = vm->pc;
+  s.next = vm->next;
+  s.page_size = page;
+  s.num_pages = num_pages;
+  s.out_len = out_len;
+  long head = sizeof(s) + sizeof(int) * num_pages + out_len;
+  s.data_offset = (head + page - 1) / page * page;
+
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    free(pages);
+    return "cannot open snapshot";
+  }
+  fwrite(&s, sizeof(s), 1, fp);
+  fwrite(pages, sizeof(int), num_pages, fp);
+  fwrite(out, 1, out_len, fp);
+  for (long i = head; i < s.data_offset; i++)
+    fputc(0, fp);
+  for (int i = 0; i < num_pages; i++)
+    fwrite(vm->mem + pages[i] * page_words, 1, page, fp);
+  free(pages);
+  bool ok = !ferror(fp);
+  if (fclose(fp))
+    ok = false;
+  return ok ? NULL : "cannot write snapshot";
+#else
+  (void)vm;
+  (void)filename;
+  (void)out;
+  (void)out_len;
+  return "snapshots are not supported";
+#endif
+}
+
+#ifdef ELI_MMAP
+
+// Maps the pages of the snapshot |s| in |fd| over the memory of |vm|,
+// copy on write, and restores the rest of its state.
+static const char* load_snapshot(EliVM* vm, EliSnapshot* s, long size,
+                                 int fd, char** out, long* out_len) {
+  long page = sysconf(_SC_PAGESIZE);
+  long page_words = page / sizeof(int);
+  long max_pages = MEMSZ / page_words;
+  if (memcmp(s->magic, SNAPSHOT_MAGIC, sizeof(s->magic)))
+    return "not a snapshot";
+  if (s->module_hash != module_hash(vm->module))
+    return "snapshot of another program";
+  if (s->page_size != page)
+    return "snapshot of another page size";
+  if (s->num_pages < 0 || s->num_pages > max_pages || s->out_len < 0 ||
+      (long)(sizeof(*s) + sizeof(int) * s->num_pages) + s->out_len >
+      s->data_offset ||
+      s->data_offset % page ||
+      s->data_offset + s->num_pages * page > size)
+    return "broken snapshot";
+  int* pages = (int*)(s + 1);
+  for (int i = 0; i < s->num_pages; i++) {
+    if (pages[i] < 0 || pages[i] >= max_pages ||
+        (i && pages[i] <= pages[i - 1]))
+      return "broken snapshot";
+  }
+
+  // Runs of pages are mapped at once.
+  for (int i = 0; i < s->num_pages;) {
+    int j = i + 1;
+    while (j < s->num_pages && pages[j] == pages[j - 1] + 1)
+      j++;
+    void* p = mmap(vm->mem + pages[i] * page_words, (j - i) * page,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                   fd, s->data_offset + i * page);
+    if (p == MAP_FAILED)
+      return "cannot map snapshot";
+    i = j;
+  }
+  memcpy(vm->regs, s->regs, sizeof(vm->regs));
+  vm->pc = s->pc;
+  vm->next = s->next;
+  vm->status = ELI_RUNNING;
+  *out_len = s->out_len;
+  *out = malloc(s->out_len + 1);
+  memcpy(*out, (char*)(pages + s->num_pages), s->out_len);
+  return NULL;
+}
+
+#endif
+
+const char* eli_load_snapshot(EliVM* vm, const char* filename,
+                              char** out, long* out_len) {
+#ifdef ELI_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return "cannot open snapshot";
+  struct stat st;
+  const char* err = "broken snapshot";
+  if (!fstat(fd, &st) && st.st_size >= (long)sizeof(EliSnapshot)) {
+    EliSnapshot* s = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (s == MAP_FAILED) {
+      err = "cannot map snapshot";
+    } else {
+      err = load_snapshot(vm, s, st.st_size, fd, out, out_len);
+      munmap(s, st.st_size);
+    }
+  }
+  close(fd);
+  return err;
+#else
+  (void)vm;
+  (void)filename;
+  (void)out;
+  (void)out_len;
+  return "snapshots are not supported";
+#endif
+}
+
+void eli_get_inst_counts(EliVM* vm, long* counts) {
+  Module* m = vm->module;
+  if (!vm->taken) {
+    memset(counts, 0, sizeof(long) * m->num_insts);
+    return;
+  }
+  // Jumps only go to the start of a pc, so the entries to each pc and
+  // the jumps taken out of it give how many times every instruction ran.
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    long n = 0;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (i == m->pc_start[pc])
+        n = vm->counts[i];
+      counts[i] = n;
+      n -= vm->taken[i];
+    }
+  }
+}
+
+EliEdge* eli_get_edges(EliVM* vm, int* num_edges) {
+  Module* m = vm->module;
+  EliEdge* edges = NULL;
+  int num = 0;
+  int cap = 0;
+  // Register jumps are counted by target as they run, and direct ones
+  // by instruction.
+  for (int i = 0; i < vm->cap_edges; i++) {
+    EliEdge* e = &vm->edges[i];
+    if (e->count)
+      add_edge(&edges, &num, &cap, e->from, e->to, e->count);
+  }
+  for (int i = 0; vm->taken && i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (inst->op >= JEQ && inst->op <= JMP && inst->jmp.type == IMM &&
+        vm->taken[i])
+      add_edge(&edges, &num, &cap, inst->pc, inst->jmp.imm, vm->taken[i]);
+  }
+  EliEdge* r = malloc(sizeof(EliEdge) * (num + 1));
+  *num_edges = 0;
+  for (int i = 0; i < cap; i++) {
+    if (edges[i].count)
+      r[(*num_edges)++] = edges[i];
+  }
+  free(edges);
+  return r;
+}
+
+void eli_print_stats(EliVM* vm, FILE* fp) {
+#ifdef ELI_FAST
+  Module* m = vm->module;
+  char* kinds = vm->prog->kinds;
+  long total = 0;
+  long by_kind[NUM_FUSE] = {};
+  for (int i = 0; vm->counts && i < m->num_insts; i++) {
+    long n = vm->counts[i] * FUSE_LEN[(int)kinds[i]];
+    total += n;
+    by_kind[(int)kinds[i]] += n;
+  }
+  fprintf(fp, "fused: %ld of %ld insts (%.1f%%)\n",
+          total - by_kind[FUSE_NONE], total,
+          total ? (total - by_kind[FUSE_NONE]) * 100.0 / total : 0.0);
+  for (int k = 1; k < NUM_FUSE; k++) {
+    if (by_kind[k])
+      fprintf(fp, "  %s: %ld\n", FUSE_NAMES[k], by_kind[k]);
+  }
+#endif
+  long pages = eli_resident_pages(vm);
+  if (pages >= 0) {
+#ifdef ELI_MMAP
+    long kib = pages * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    long kib = 0;
+#endif
+    fprintf(fp, "memory: %ld pages (%ld KiB) resident of %ld KiB\n",
+            pages, kib, (long)(MEMSZ * sizeof(int) / 1024));
+  }
+}
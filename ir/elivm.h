@@ -0,0 +1,126 @@
+#ifndef ELVM_ELIVM_H_
+#define ELVM_ELIVM_H_
+
+#include <ir/ir.h>
+
+// The EIR interpreter behind out/eli, without global state. An
+// EliProgram is decoded once from a Module and only read afterwards, so
+// any number of EliVMs, each with its own registers, memory, and I/O,
+// can run one program at once, on different threads if they like.
+
+typedef enum {
+  // The budget ran out. eli_run continues from there.
+  ELI_RUNNING,
+  ELI_EXITED,
+  ELI_ERROR,
+  // Stopped before a GETC or DUMP as break_on_input asks. Clear it to
+  // go on with eli_run.
+  ELI_BREAK
+} EliStatus;
+
+// Flags for eli_new_program.
+enum {
+  // Counts the entries to each pc and the taken jumps into the counts,
+  // taken, and edges of each EliVM. See eli_get_inst_counts.
+  ELI_PROFILE = 1,
+  // Counts every handler run into counts for eli_print_stats.
+  ELI_STATS = 2
+};
+
+typedef struct EliProgram_ EliProgram;
+
+// A taken jump and how many times it was taken.
+typedef struct {
+  int from;
+  int to;
+  long count;
+} EliEdge;
+
+// Returns the next input byte, or EOF.
+typedef int (*EliGetc)(void* opaque);
+typedef void (*EliPutc)(int c, void* opaque);
+
+typedef struct EliVM_ {
+  const EliProgram* prog;
+  Module* module;
+  int regs[6];
+  // The last pc jumped to. Error messages show it, and running off the
+  // end of the program starts over from it.
+  int pc;
+  // The index in module->insts of the next instruction to run.
+  int next;
+  int* mem;
+  EliStatus status;
+  // Why status is ELI_ERROR.
+  const char* error;
+  // How many instructions eli_run and eli_step ran.
+  long executed;
+  // NULL reads stdin and writes stdout.
+  EliGetc getc_fn;
+  EliPutc putc_fn;
+  void* io;
+  // Prints each instruction and the registers before it to stderr.
+  bool trace;
+  // Stops eli_run before the next GETC or DUMP, which is where
+  // eli_save_snapshot is most useful. eli_run_jit does not stop.
+  bool break_on_input;
+  // Counts by index in module->insts with ELI_PROFILE or ELI_STATS.
+  long* counts;
+  long* taken;
+  // Register jumps taken with ELI_PROFILE, in a hash table.
+  EliEdge* edges;
+  int num_edges;
+  int cap_edges;
+  struct EliJit_* jit;
+} EliVM;
+
+// The program keeps pointers into |m|, which must outlive it.
+EliProgram* eli_new_program(Module* m, int flags);
+void eli_free_program(EliProgram* prog);
+
+// A VM at the start of |prog| with its data loaded, or NULL if its
+// memory cannot be mapped.
+EliVM* eli_new_vm(const EliProgram* prog);
+void eli_free_vm(EliVM* vm);
+
+void eli_set_io(EliVM* vm, EliGetc getc, EliPutc putc, void* opaque);
+
+// Runs at most |budget| instructions, or until the program exits or
+// fails if |budget| is negative.
+EliStatus eli_run(EliVM* vm, long budget);
+EliStatus eli_step(EliVM* vm);
+
+// Runs until the program exits or fails, compiling it to x86-64 code as
+// it goes. Falls back to eli_run where there is no JIT. |executed| is
+// not updated.
+EliStatus eli_run_jit(EliVM* vm);
+
+// How many pages of memory the VM has touched, or -1 where this is not
+// known. Pages are those of the host.
+long eli_resident_pages(EliVM* vm);
+
+// Writes the registers, the position, and the memory of |vm| which is
+// not as a new VM has it to |filename|, with |out|, what the program
+// printed so far. This reads all of memory, so eli_resident_pages counts
+// all of it afterwards. Returns NULL or why it failed.
+const char* eli_save_snapshot(EliVM* vm, const char* filename,
+                              const char* out, long out_len);
+// Puts a new VM of the same program where the snapshot in |filename|
+// left off. The pages of the file are mapped as the VM's memory, so
+// this takes time by the pages the program touched, not by the size of
+// memory. |out| gets a new copy of the output of the snapshot. Returns
+// NULL or why it failed.
+const char* eli_load_snapshot(EliVM* vm, const char* filename,
+                              char** out, long* out_len);
+
+// How many times each instruction ran, into |counts|, which has
+// module->num_insts entries. Needs ELI_PROFILE.
+void eli_get_inst_counts(EliVM* vm, long* counts);
+// Every taken jump, in a new array the caller frees. Needs ELI_PROFILE.
+EliEdge* eli_get_edges(EliVM* vm, int* num_edges);
+
+// Prints how much of the run went through fused handlers, which needs
+// ELI_STATS, and how much memory it touched.
+void eli_print_stats(EliVM* vm, FILE* fp);
+
+#endif  // ELVM_ELIVM_H_
@@ -7,23 +7,65 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <ir/arena.h>
 #include <ir/table.h>
 
-static bool g_split_basic_block_by_mem = false;
+#if !defined(NOFILE) && !defined(__eir__)
+# define IR_USE_MMAP
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
 
 typedef struct DataPrivate_ {
   int v;
   struct DataPrivate_* next;
+  LabelType label;
   Value val;
   int lineno;
 } DataPrivate;
 
+typedef struct SymbolPrivate_ {
+  Symbol sym;
+  struct SymbolPrivate_* next;
+} SymbolPrivate;
+
+// The entry jump goes to pc 1 if the program has no main.
+static Symbol default_main = { "main", 1, true };
+
+typedef struct LocPrivate_ {
+  SourceLoc loc;
+  struct LocPrivate_* next;
+} LocPrivate;
+
+typedef struct FilePrivate_ {
+  int num;
+  const char* name;
+  struct FilePrivate_* next;
+} FilePrivate;
+
 typedef struct {
   const char* filename;
   int lineno;
   int col;
   FILE* fp;
+  const char* buf;
+  const char* cur;
+  const char* end;
   Table* symtab;
+  Table* strtab;
+  Arena* arena;
+  SymbolPrivate sym_root;
+  SymbolPrivate* syms;
+  int num_syms;
+  LocPrivate loc_root;
+  LocPrivate* locs;
+  int num_locs;
+  int loc;
+  FilePrivate file_root;
+  FilePrivate* files;
+  int num_files;
   int in_text;
   Inst* text;
   int pc;
@@ -48,8 +90,15 @@ static void ir_error(Parser* p, const char* msg) {
   exit(1);
 }
 
+// When the whole input is in memory (|buf| is set), the lexer scans it
+// with a pointer. Otherwise it reads |fp| one character at a time.
 static int ir_getc(Parser* p) {
-  int c = fgetc(p->fp);
+  int c;
+  if (p->buf) {
+    c = p->cur < p->end ? (unsigned char)*p->cur++ : EOF;
+  } else {
+    c = fgetc(p->fp);
+  }
   if (c == '\n') {
     p->lineno++;
     p->col = 0;
@@ -63,16 +112,37 @@ static void ir_ungetc(Parser* p, int c) {
   if (c == '\n') {
     p->lineno--;
   }
-  ungetc(c, p->fp);
+  if (p->buf) {
+    if (c != EOF)
+      p->cur--;
+  } else {
+    ungetc(c, p->fp);
+  }
 }
 
 static int peek(Parser* p) {
+  if (p->buf)
+    return p->cur < p->end ? (unsigned char)*p->cur : EOF;
   int c = fgetc(p->fp);
   ungetc(c, p->fp);
   return c;
 }
 
+static bool is_ident_char(int c) {
+  return isalnum(c) || c == '_' || c == '.';
+}
+
 static void skip_until_ret(Parser* p) {
+  if (p->buf) {
+    // ELVM's libc has no memchr.
+    const char* e = p->cur;
+    while (e < p->end && *e != '\n')
+      e++;
+    p->col += e - p->cur;
+    p->cur = e;
+    return;
+  }
+
   int c;
   for (;;) {
     c = ir_getc(p);
@@ -83,6 +153,20 @@ static void skip_until_ret(Parser* p) {
 }
 
 static void skip_ws(Parser* p) {
+  if (p->buf) {
+    const char* q = p->cur;
+    for (; q < p->end && isspace((unsigned char)*q); q++) {
+      if (*q == '\n') {
+        p->lineno++;
+        p->col = 0;
+      } else {
+        p->col++;
+      }
+    }
+    p->cur = q;
+    return;
+  }
+
   int c;
   for (;;) {
     c = ir_getc(p);
@@ -93,9 +177,23 @@ static void skip_ws(Parser* p) {
 }
 
 static void read_while_ident(Parser* p, char* buf, int len) {
+  if (p->buf) {
+    const char* q = p->cur;
+    const char* e = p->end - q > len ? q + len : p->end;
+    for (; q < e && is_ident_char((unsigned char)*q); q++) {}
+    int n = q - p->cur;
+    if (n == len)
+      ir_error(p, "too long ident");
+    memcpy(buf, p->cur, n);
+    buf[n] = 0;
+    p->col += n;
+    p->cur = q;
+    return;
+  }
+
   while (len--) {
     int c = ir_getc(p);
-    if (!isalnum(c) && c != '_' && c != '.') {
+    if (!is_ident_char(c)) {
       ir_ungetc(p, c);
       *buf = 0;
       return;
@@ -114,6 +212,17 @@ static int read_int(Parser* p, int c) {
     if (!isdigit(c))
       ir_error(p, "digit expected");
   }
+  if (p->buf) {
+    const char* q = p->cur;
+    r = c - '0';
+    for (; q < p->end && '0' <= *q && *q <= '9'; q++) {
+      r *= 10;
+      r += *q - '0';
+    }
+    p->col += q - p->cur;
+    p->cur = q;
+    return is_minus ? -r : r;
+  }
   while ('0' <= c && c <= '9') {
     r *= 10;
     r += c - '0';
@@ -123,9 +232,30 @@ static int read_int(Parser* p, int c) {
   return is_minus ? -r : r;
 }
 
+// Returns a copy of |s| owned by the module. Every occurrence of the
+// same name shares one copy.
+static const char* intern(Parser* p, const char* s) {
+  const void* r;
+  if (table_get(p->strtab, s, &r))
+    return r;
+  char* n = arena_strdup(p->arena, s);
+  p->strtab = table_add(p->strtab, n, n);
+  return n;
+}
+
+static void add_sym(Parser* p, const char* name, int value, bool is_text) {
+  SymbolPrivate* s = arena_alloc(p->arena, sizeof(SymbolPrivate));
+  s->sym.name = name;
+  s->sym.value = value;
+  s->sym.is_text = is_text;
+  p->symtab = table_add(p->symtab, name, &s->sym);
+  p->syms->next = s;
+  p->syms = s;
+  p->num_syms++;
+}
+
 static DataPrivate* add_data(Parser* p) {
-  DataPrivate* n = malloc(sizeof(DataPrivate));
-  n->next = 0;
+  DataPrivate* n = arena_alloc(p->arena, sizeof(DataPrivate));
   n->v = p->subsection;
   n->lineno = p->lineno;
   p->data->next = n;
@@ -139,107 +269,312 @@ static void add_imm_data(Parser* p, int v) {
   n->val.imm = v;
 }
 
+typedef struct {
+  int subsection;
+  DataPrivate* head;
+  DataPrivate* tail;
+} DataBucket;
+
+static DataBucket* find_data_bucket(DataBucket* buckets, int cap,
+                                    int subsection) {
+  int mask = cap - 1;
+  for (int i = subsection & mask;; i = (i + 1) & mask) {
+    if (!buckets[i].head || buckets[i].subsection == subsection)
+      return &buckets[i];
+  }
+}
+
+static int compare_data_buckets(const void* a, const void* b) {
+  int x = ((const DataBucket*)a)->subsection;
+  int y = ((const DataBucket*)b)->subsection;
+  return x < y ? -1 : x > y;
+}
+
+// Lays out data by ascending subsection, keeping the order of entries
+// within a subsection. Entries are bucketed in a single pass, so this
+// is linear in the number of data words plus sorting the subsections.
 static void serialize_data(Parser* p, DataPrivate* data_root) {
-  bool done = false;
-  DataPrivate serialized_root = {};
-  DataPrivate* serialized = &serialized_root;
-  intptr_t mp = 0;
-  for (int subsection = 0; !done; subsection++) {
-    done = true;
-    for (DataPrivate* data = data_root; data->next;) {
-      DataPrivate* prev = data;
-      data = prev->next;
-      if (data->v != subsection) {
+  int cap = 16;
+  int num_buckets = 0;
+  DataBucket* buckets = calloc(cap, sizeof(DataBucket));
+  DataBucket* last = NULL;
+  for (DataPrivate* data = data_root->next; data;) {
+    DataPrivate* next = data->next;
+    data->next = 0;
+    if (!last || last->subsection != data->v) {
+      last = find_data_bucket(buckets, cap, data->v);
+      if (!last->head) {
+        if ((num_buckets + 1) * 2 > cap) {
+          DataBucket* old = buckets;
+          buckets = calloc(cap * 2, sizeof(DataBucket));
+          for (int i = 0; i < cap; i++) {
+            if (old[i].head)
+              *find_data_bucket(buckets, cap * 2, old[i].subsection) = old[i];
+          }
+          cap *= 2;
+          free(old);
+          last = find_data_bucket(buckets, cap, data->v);
+        }
+        last->subsection = data->v;
+        last->head = data;
+        last->tail = data;
+        num_buckets++;
+        data = next;
         continue;
       }
-      done = false;
+    }
+    last->tail->next = data;
+    last->tail = data;
+    data = next;
+  }
 
-      prev->next = data->next;
+  int n = 0;
+  for (int i = 0; i < cap; i++) {
+    if (buckets[i].head)
+      buckets[n++] = buckets[i];
+  }
+  qsort(buckets, n, sizeof(DataBucket), compare_data_buckets);
 
+  DataPrivate serialized_root = {};
+  DataPrivate* serialized = &serialized_root;
+  intptr_t mp = 0;
+  for (int i = 0; i < n; i++) {
+    for (DataPrivate* data = buckets[i].head; data;) {
+      DataPrivate* next = data->next;
       if (data->val.type == (ValueType)LABEL) {
-        p->symtab = table_add(p->symtab, data->val.tmp, (void*)mp);
+        add_sym(p, data->val.tmp, mp, false);
       } else {
         serialized->next = data;
         serialized = data;
         serialized->next = 0;
         mp++;
       }
-      data = prev;
+      data = next;
     }
   }
+  free(buckets);
 
-  p->symtab = table_add(p->symtab, "_edata", (void*)mp);
-  serialized->next = malloc(sizeof(DataPrivate));
+  add_sym(p, "_edata", mp, false);
+  serialized->next = arena_alloc(p->arena, sizeof(DataPrivate));
   serialized->next->v = mp + 1;
-  serialized->next->next = 0;
   serialized->next->val.type = IMM;
   serialized->next->val.imm = mp + 1;
   data_root->next = serialized_root.next;
 }
 
+// Dispatches on the first character so each op name is compared with
+// at most a few candidates.
 static Op get_op(Parser* p, const char* buf) {
   if (peek(p) == ':')
     return OP_UNSET;
-  if (!strcmp(buf, "mov")) {
-    return MOV;
-  } else if (!strcmp(buf, "add")) {
-    return ADD;
-  } else if (!strcmp(buf, "sub")) {
-    return SUB;
-  } else if (!strcmp(buf, "load")) {
-    return LOAD;
-  } else if (!strcmp(buf, "store")) {
-    return STORE;
-  } else if (!strcmp(buf, "putc")) {
-    return PUTC;
-  } else if (!strcmp(buf, "getc")) {
-    return GETC;
-  } else if (!strcmp(buf, "exit")) {
-    return EXIT;
-  } else if (!strcmp(buf, "dump")) {
-    return DUMP;
-  } else if (!strcmp(buf, "jeq")) {
-    return JEQ;
-  } else if (!strcmp(buf, "jne")) {
-    return JNE;
-  } else if (!strcmp(buf, "jlt")) {
-    return JLT;
-  } else if (!strcmp(buf, "jgt")) {
-    return JGT;
-  } else if (!strcmp(buf, "jle")) {
-    return JLE;
-  } else if (!strcmp(buf, "jge")) {
-    return JGE;
-  } else if (!strcmp(buf, "jmp")) {
-    return JMP;
-  } else if (!strcmp(buf, "eq")) {
-    return EQ;
-  } else if (!strcmp(buf, "ne")) {
-    return NE;
-  } else if (!strcmp(buf, "lt")) {
-    return LT;
-  } else if (!strcmp(buf, "gt")) {
-    return GT;
-  } else if (!strcmp(buf, "le")) {
-    return LE;
-  } else if (!strcmp(buf, "ge")) {
-    return GE;
-  } else if (!strcmp(buf, ".text")) {
-    return TEXT;
-  } else if (!strcmp(buf, ".data")) {
-    return DATA;
-  } else if (!strcmp(buf, ".long")) {
-    return LONG;
-  } else if (!strcmp(buf, ".string")) {
-    return STRING;
-  } else if (!strcmp(buf, ".file")) {
-    return FILENAME;
-  } else if (!strcmp(buf, ".loc")) {
-    return LOC;
+  switch (buf[0]) {
+    case 'a':
+      if (!strcmp(buf, "add")) return ADD;
+      if (!strcmp(buf, "and")) return AND;
+      break;
+    case 'c':
+      if (!strcmp(buf, "copy")) return COPY;
+      break;
+    case 'd':
+      if (!strcmp(buf, "dump")) return DUMP;
+      if (!strcmp(buf, "div")) return DIV;
+      break;
+    case 'e':
+      if (!strcmp(buf, "exit")) return EXIT;
+      if (!strcmp(buf, "eq")) return EQ;
+      break;
+    case 'f':
+      if (!strcmp(buf, "fill")) return FILL;
+      break;
+    case 'g':
+      if (buf[1] == 'e' && !buf[2]) return GE;
+      if (buf[1] == 't' && !buf[2]) return GT;
+      if (!strcmp(buf, "getc")) return GETC;
+      break;
+    case 'j':
+      switch (buf[1]) {
+        case 'e':
+          if (buf[2] == 'q' && !buf[3]) return JEQ;
+          break;
+        case 'n':
+          if (buf[2] == 'e' && !buf[3]) return JNE;
+          break;
+        case 'l':
+          if (buf[2] == 't' && !buf[3]) return JLT;
+          if (buf[2] == 'e' && !buf[3]) return JLE;
+          break;
+        case 'g':
+          if (buf[2] == 't' && !buf[3]) return JGT;
+          if (buf[2] == 'e' && !buf[3]) return JGE;
+          break;
+        case 'm':
+          if (buf[2] == 'p' && !buf[3]) return JMP;
+          break;
+      }
+      break;
+    case 'l':
+      if (buf[1] == 't' && !buf[2]) return LT;
+      if (buf[1] == 'e' && !buf[2]) return LE;
+      if (!strcmp(buf, "load")) return LOAD;
+      break;
+    case 'm':
+      if (!strcmp(buf, "mov")) return MOV;
+      if (!strcmp(buf, "mul")) return MUL;
+      if (!strcmp(buf, "mod")) return MOD;
+      break;
+    case 'n':
+      if (!strcmp(buf, "ne")) return NE;
+      break;
+    case 'o':
+      if (!strcmp(buf, "or")) return OR;
+      break;
+    case 'p':
+      if (!strcmp(buf, "putc")) return PUTC;
+      break;
+    case 's':
+      if (!strcmp(buf, "sub")) return SUB;
+      if (!strcmp(buf, "store")) return STORE;
+      if (!strcmp(buf, "shl")) return SHL;
+      if (!strcmp(buf, "shr")) return SHR;
+      break;
+    case 'x':
+      if (!strcmp(buf, "xor")) return XOR;
+      break;
+    case '.':
+      switch (buf[1]) {
+        case 't':
+          if (!strcmp(buf, ".text")) return (Op)TEXT;
+          break;
+        case 'd':
+          if (!strcmp(buf, ".data")) return (Op)DATA;
+          break;
+        case 'l':
+          if (!strcmp(buf, ".long")) return (Op)LONG;
+          if (!strcmp(buf, ".loc")) return (Op)LOC;
+          break;
+        case 's':
+          if (!strcmp(buf, ".string")) return (Op)STRING;
+          break;
+        case 'f':
+          if (!strcmp(buf, ".file")) return (Op)FILENAME;
+          break;
+      }
+      break;
   }
   return OP_UNSET;
 }
 
+static bool get_reg(const char* buf, Reg* r) {
+  if (!buf[1]) {
+    if (buf[0] >= 'A' && buf[0] <= 'D') {
+      *r = (Reg)(A + buf[0] - 'A');
+      return true;
+    }
+  } else if (buf[1] == 'P' && !buf[2]) {
+    if (buf[0] == 'S') {
+      *r = SP;
+      return true;
+    } else if (buf[0] == 'B') {
+      *r = BP;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int read_escape(Parser* p) {
+  int c = ir_getc(p);
+  if (c == 'n') {
+    c = '\n';
+  } else if (c == 't') {
+    c = '\t';
+  } else if (c == 'b') {
+    c = '\b';
+  } else if (c == 'f') {
+    c = '\f';
+  } else if (c == 'r') {
+    c = '\r';
+  } else if (c == '\"') {
+    c = '\"';
+  } else if (c == '\\') {
+    c = '\\';
+  } else if (c == 'x') {
+    char b[3];
+    b[0] = ir_getc(p);
+    c = ir_getc(p);
+    if (!((c >= '0' && c <= '9') ||
+          (c >= 'a' && c <= 'f') ||
+          (c >= 'A' && c <= 'F'))) {
+      ir_ungetc(p, c);
+      c = 0;
+    }
+    b[1] = c;
+    b[2] = 0;
+    c = strtoul(b, NULL, 16);
+  } else {
+    ir_error(p, "unknown escape");
+  }
+  return c;
+}
+
+// .file [n] "name"
+static void parse_file(Parser* p) {
+  char buf[1024];
+  int num = 0;
+  skip_ws(p);
+  int c = ir_getc(p);
+  if (isdigit(c)) {
+    num = read_int(p, c);
+    skip_ws(p);
+    c = ir_getc(p);
+  }
+  if (c != '"')
+    ir_error(p, "expected open '\"'");
+  int len = 0;
+  for (c = ir_getc(p); c != '"'; c = ir_getc(p)) {
+    if (c == '\n' || c == EOF)
+      ir_error(p, "unterminated file name");
+    if (c == '\\')
+      c = read_escape(p);
+    if (len == (int)sizeof(buf) - 1)
+      ir_error(p, "too long file name");
+    buf[len++] = c;
+  }
+  buf[len] = 0;
+
+  FilePrivate* f = arena_alloc(p->arena, sizeof(FilePrivate));
+  f->num = num;
+  f->name = intern(p, buf);
+  p->files->next = f;
+  p->files = f;
+  if (p->num_files <= num)
+    p->num_files = num + 1;
+  skip_until_ret(p);
+}
+
+// .loc file line [column]
+static void parse_loc(Parser* p) {
+  int v[2];
+  for (int i = 0; i < 2; i++) {
+    skip_ws(p);
+    int c = ir_getc(p);
+    if (!isdigit(c))
+      ir_error(p, "number expected");
+    v[i] = read_int(p, c);
+  }
+  skip_until_ret(p);
+
+  SourceLoc* cur = &p->locs->loc;
+  if (p->loc && cur->file == v[0] && cur->line == v[1])
+    return;
+  LocPrivate* l = arena_alloc(p->arena, sizeof(LocPrivate));
+  l->loc.file = v[0];
+  l->loc.line = v[1];
+  p->locs->next = l;
+  p->locs = l;
+  p->loc = p->num_locs++;
+}
+
 static void parse_line(Parser* p, int c) {
   char buf[64];
   buf[0] = c;
@@ -257,51 +592,18 @@ static void parse_line(Parser* p, int c) {
 
     c = ir_getc(p);
     while (c != '"') {
-      if (c == '\\') {
-        c = ir_getc(p);
-        if (c == 'n') {
-          c = '\n';
-        } else if (c == 't') {
-          c = '\t';
-        } else if (c == 'b') {
-          c = '\b';
-        } else if (c == 'f') {
-          c = '\f';
-        } else if (c == 'r') {
-          c = '\r';
-        } else if (c == '\"') {
-          c = '\"';
-        } else if (c == '\\') {
-          c = '\\';
-        } else if (c == 'x') {
-          char b[3];
-          b[0] = ir_getc(p);
-          c = ir_getc(p);
-          if (!((c >= '0' && c <= '9') ||
-                (c >= 'a' && c <= 'f') ||
-                (c >= 'A' && c <= 'F'))) {
-            ir_ungetc(p, c);
-            c = 0;
-          }
-          b[1] = c;
-          b[2] = 0;
-          c = strtoul(b, NULL, 16);
-        } else {
-          ir_error(p, "unknown escape");
-        }
-        add_imm_data(p, c);
-      } else {
-        add_imm_data(p, c);
-      }
+      if (c == '\\')
+        c = read_escape(p);
+      add_imm_data(p, c);
       c = ir_getc(p);
     }
     add_imm_data(p, 0);
     return;
   } else if (op == (Op)FILENAME) {
-    skip_until_ret(p);
+    parse_file(p);
     return;
   } else if (op == (Op)LOC) {
-    skip_until_ret(p);
+    parse_loc(p);
     return;
   } else if (op == OP_UNSET) {
     c = ir_getc(p);
@@ -312,11 +614,11 @@ static void parse_line(Parser* p, int c) {
           p->pc++;
         value = p->pc;
         p->prev_boundary = true;
-        p->symtab = table_add(p->symtab, strdup(buf), (void*)value);
+        add_sym(p, intern(p, buf), value, true);
       } else {
         DataPrivate* d = add_data(p);
-        d->val.type = LABEL;
-        d->val.tmp = strdup(buf);
+        d->val.type = (ValueType)LABEL;
+        d->val.tmp = (void*)intern(p, buf);
       }
       return;
     }
@@ -341,6 +643,10 @@ static void parse_line(Parser* p, int c) {
     argc = 2;
   else if (op == DUMP)
     argc = 0;
+  else if (op <= SHR)
+    argc = 2;
+  else if (op <= FILL)
+    argc = 3;
   else if (op == (Op)LONG)
     argc = 1;
   else if (op == (Op)DATA) {
@@ -361,6 +667,7 @@ static void parse_line(Parser* p, int c) {
     }
 
     Value a;
+    a.label = NOT_LABEL;
     c = ir_getc(p);
     if (isdigit(c) || c == '-') {
       a.type = IMM;
@@ -369,21 +676,9 @@ static void parse_line(Parser* p, int c) {
       buf[0] = c;
       read_while_ident(p, buf + 1, 62);
       a.type = REG;
-      if (!strcmp(buf, "A")) {
-        a.reg = A;
-      } else if (!strcmp(buf, "B")) {
-        a.reg = B;
-      } else if (!strcmp(buf, "C")) {
-        a.reg = C;
-      } else if (!strcmp(buf, "D")) {
-        a.reg = D;
-      } else if (!strcmp(buf, "SP")) {
-        a.reg = SP;
-      } else if (!strcmp(buf, "BP")) {
-        a.reg = BP;
-      } else {
+      if (!get_reg(buf, &a.reg)) {
         a.type = (ValueType)REF;
-        a.tmp = strdup(buf);
+        a.tmp = (void*)intern(p, buf);
       }
     }
     args[i] = a;
@@ -394,7 +689,7 @@ static void parse_line(Parser* p, int c) {
       add_imm_data(p, args[0].imm);
     } else if (args[0].type == (ValueType)REF) {
       DataPrivate* d = add_data(p);
-      d->val.type = REF;
+      d->val.type = (ValueType)REF;
       d->val.tmp = args[0].tmp;
     } else {
       ir_error(p, "number expected");
@@ -410,20 +705,16 @@ static void parse_line(Parser* p, int c) {
     return;
   }
 
-  p->text->next = calloc(1, sizeof(Inst));
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
   p->text = p->text->next;
   p->text->op = op;
   p->text->pc = p->pc;
   p->text->lineno = p->lineno;
+  p->text->loc = p->loc;
   p->prev_boundary = false;
   switch (op) {
     case LOAD:
     case STORE:
-      if (g_split_basic_block_by_mem) {
-        p->pc++;
-        p->prev_boundary = true;
-      }
-      FALLTHROUGH;
     case MOV:
     case ADD:
     case SUB:
@@ -433,6 +724,14 @@ static void parse_line(Parser* p, int c) {
     case GT:
     case LE:
     case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
       p->text->src = args[1];
       FALLTHROUGH;
     case GETC:
@@ -440,6 +739,13 @@ static void parse_line(Parser* p, int c) {
       break;
     case PUTC:
       p->text->src = args[0];
+      break;
+    case COPY:
+    case FILL:
+      p->text->dst = args[0];
+      p->text->src = args[1];
+      p->text->jmp = args[2];
+      break;
     case EXIT:
     case DUMP:
       break;
@@ -475,10 +781,14 @@ static void parse_eir(Parser* p) {
   p->lineno = 1;
   p->text = &text_root;
   p->data = &data_root;
+  p->syms = &p->sym_root;
+  p->locs = &p->loc_root;
+  p->num_locs = 1;
+  p->files = &p->file_root;
   p->pc = 0;
   p->prev_boundary = true;
 
-  p->text->next = calloc(1, sizeof(Inst));
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
   p->text = p->text->next;
   p->text->op = JMP;
   p->text->pc = p->pc++;
@@ -486,7 +796,7 @@ static void parse_eir(Parser* p) {
   p->text->jmp.type = (ValueType)REF;
   p->text->jmp.tmp = "main";
   p->text->next = 0;
-  p->symtab = table_add(p->symtab, "main", (void*)1);
+  p->symtab = table_add(p->symtab, "main", &default_main);
 
   for (;;) {
     skip_ws(p);
@@ -512,12 +822,15 @@ static void resolve(Value* v, Table* symtab) {
   if (v->type != (ValueType)REF)
     return;
   const char* name = (const char*)v->tmp;
-  if (!table_get(symtab, name, (void*)&v->imm)) {
+  Symbol* sym;
+  if (!table_get(symtab, name, (void*)&sym)) {
     fprintf(stderr, "undefined sym: %s\n", name);
     exit(1);
   }
-  //fprintf(stderr, "resolved: %s %d\n", name, v->imm);
+  //fprintf(stderr, "resolved: %s %d\n", name, sym->value);
   v->type = IMM;
+  v->imm = sym->value;
+  v->label = sym->is_text ? TEXT_LABEL : DATA_LABEL;
 }
 
 static void resolve_syms(Parser* p) {
@@ -526,6 +839,7 @@ static void resolve_syms(Parser* p) {
       resolve(&data->val, p->symtab);
     }
     data->v = MOD24(data->val.imm);
+    data->label = data->val.label;
   }
 
   for (Inst* inst = p->text; inst; inst = inst->next) {
@@ -535,44 +849,191 @@ static void resolve_syms(Parser* p) {
   }
 }
 
-Module* load_eir_impl(const char* filename, FILE* fp) {
+static Module* load_eir_impl(const char* filename, FILE* fp,
+                             const char* buf, size_t size) {
   Parser parser = {
     .filename = filename,
-    .fp = fp
+    .fp = fp,
+    .buf = buf,
+    .cur = buf,
+    .end = buf + size,
+    .arena = arena_new()
   };
   parse_eir(&parser);
   resolve_syms(&parser);
+  table_free(parser.symtab);
+  table_free(parser.strtab);
 
-  Module* m = malloc(sizeof(Module));
+  Module* m = arena_alloc(parser.arena, sizeof(Module));
   m->text = parser.text;
   m->data = (Data*)parser.data;
+  m->arena = parser.arena;
+  m->syms = arena_alloc(m->arena, sizeof(Symbol) * parser.num_syms);
+  m->num_syms = parser.num_syms;
+  int i = 0;
+  for (SymbolPrivate* s = parser.sym_root.next; s; s = s->next)
+    m->syms[i++] = s->sym;
+
+  m->files = arena_alloc(m->arena, sizeof(char*) * parser.num_files);
+  m->num_files = parser.num_files;
+  for (FilePrivate* f = parser.file_root.next; f; f = f->next)
+    m->files[f->num] = f->name;
+  m->locs = arena_alloc(m->arena, sizeof(SourceLoc) * parser.num_locs);
+  m->num_locs = parser.num_locs;
+  m->locs[0].file = -1;
+  i = 1;
+  for (LocPrivate* l = parser.loc_root.next; l; l = l->next)
+    m->locs[i++] = l->loc;
+
+  reindex_module(m);
   return m;
 }
 
+bool get_inst_source_loc(Module* m, Inst* inst,
+                         const char** file, int* line) {
+  if (inst->loc <= 0 || inst->loc >= m->num_locs)
+    return false;
+  SourceLoc* l = &m->locs[inst->loc];
+  *file = l->file < m->num_files ? m->files[l->file] : NULL;
+  *line = l->line;
+  return true;
+}
+
+bool get_pc_source_loc(Module* m, int pc, const char** file, int* line) {
+  if (pc < 0 || pc >= m->num_pcs || m->pc_start[pc] == m->pc_start[pc + 1])
+    return false;
+  return get_inst_source_loc(m, &m->insts[m->pc_start[pc]], file, line);
+}
+
+void reindex_module(Module* m) {
+  int n = 0;
+  int num_pcs = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    n++;
+    num_pcs = inst->pc + 1;
+  }
+
+  Inst* insts = arena_alloc(m->arena, sizeof(Inst) * n);
+  int* pc_start = arena_alloc(m->arena, sizeof(int) * (num_pcs + 1));
+  int i = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next, i++) {
+    insts[i] = *inst;
+    insts[i].next = i + 1 < n ? &insts[i + 1] : NULL;
+    for (; pc <= inst->pc; pc++)
+      pc_start[pc] = i;
+  }
+  for (; pc <= num_pcs; pc++)
+    pc_start[pc] = n;
+
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = num_pcs;
+}
+
+void free_module(Module* m) {
+#ifdef IR_USE_MMAP
+  if (m->map)
+    munmap(m->map, m->map_size);
+#endif
+  // |m| itself lives in the arena.
+  arena_free(m->arena);
+}
+
 Module* load_eir(FILE* fp) {
-  return load_eir_impl("<stdin>", fp);
+  return load_eir_impl("<stdin>", fp, NULL, 0);
 }
 
+#ifdef IR_USE_MMAP
+
+// Maps the whole file so the lexer can scan it without stdio.
+Module* load_eir_from_file(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    // Pipes and devices cannot be mapped.
+    close(fd);
+    FILE* fp = fopen(filename, "r");
+    Module* r = load_eir_impl(filename, fp, NULL, 0);
+    fclose(fp);
+    return r;
+  }
+
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return load_eir_impl(filename, NULL, "", 0);
+  }
+  char* buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  if (is_eir_binary(buf, size))
+    return load_eir_binary(filename, buf, size);
+  Module* r = load_eir_impl(filename, NULL, buf, size);
+  munmap(buf, size);
+  return r;
+}
+
+#else
+
 Module* load_eir_from_file(const char* filename) {
   FILE* fp = fopen(filename, "r");
   if (!fp) {
     fprintf(stderr, "no such file: %s\n", filename);
     exit(1);
   }
-  Module* r = load_eir_impl(filename, fp);
+  Module* r = load_eir_impl(filename, fp, NULL, 0);
   fclose(fp);
   return r;
 }
 
-void split_basic_block_by_mem() {
-  g_split_basic_block_by_mem = true;
+#endif
+
+bool is_ext_op(Op op) {
+  return op >= MUL && op <= SHR;
+}
+
+int eval_ext_op(Op op, int dst, int src) {
+  unsigned int d = dst;
+  unsigned int s = src;
+  switch (op) {
+    case MUL:
+      return MOD24(d * s);
+    case DIV:
+      return s ? d / s : 0;
+    case MOD:
+      return s ? d % s : d;
+    case AND:
+      return d & s;
+    case OR:
+      return d | s;
+    case XOR:
+      return d ^ s;
+    case SHL:
+      return s < 24 ? MOD24(d << s) : 0;
+    case SHR:
+      return s < 24 ? d >> s : 0;
+    default:
+      return 0;
+  }
 }
 
 void dump_op(Op op, FILE* fp) {
   static const char* op_strs[] = {
     "mov", "add", "sub", "load", "store", "putc", "getc", "exit",
     "jeq", "jne", "jlt", "jgt", "jle", "jge", "jmp", "xxx",
-    "eq", "ne", "lt", "gt", "le", "ge", "dump"
+    "eq", "ne", "lt", "gt", "le", "ge", "dump",
+    "mul", "div", "mod", "and", "or", "xor", "shl", "shr",
+    "copy", "fill"
   };
   fprintf(fp, "%s", op_strs[op]);
 }
@@ -604,6 +1065,14 @@ void dump_inst_fp(Inst* inst, FILE* fp) {
     case GT:
     case LE:
     case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
       fprintf(fp, " ");
       dump_val(&inst->dst, fp);
       fprintf(fp, " ");
@@ -637,10 +1106,21 @@ void dump_inst_fp(Inst* inst, FILE* fp) {
       fprintf(fp, " ");
       dump_val(&inst->jmp, fp);
       break;
+    case COPY:
+    case FILL:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
     default:
       fprintf(fp, "oops op=%d\n", inst->op);
       exit(1);
   }
+  if (inst->no_wrap)
+    fprintf(fp, " nowrap");
   fprintf(fp, " pc=%d @", inst->pc);
   int lineno = inst->lineno;
   // A hack to make the test for dump_ir.c.eir pass.
@@ -1,6 +1,8 @@
 #ifndef ELVM_IR_H_
 #define ELVM_IR_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
 #define UINT_MAX 16777215
@@ -25,11 +27,25 @@ typedef enum {
   JEQ = 8, JNE, JLT, JGT, JLE, JGE, JMP,
   // Optional operations follow.
   EQ = 16, NE, LT, GT, LE, GE, DUMP,
+  // Extended arithmetic. Backends without native support get them
+  // through the lower_ext pass.
+  MUL, DIV, MOD, AND, OR, XOR, SHL, SHR,
+  // Block memory ops. The length is stored in Inst.jmp. Backends
+  // without native support get them through the lower_block pass.
+  COPY, FILL,
   LAST_OP
 } Op;
 
+// Whether an immediate is the value of a label. Passes which renumber
+// pcs or move data use this to find the addresses they must fix up.
+typedef enum {
+  NOT_LABEL, TEXT_LABEL, DATA_LABEL
+} LabelType;
+
 typedef struct {
   ValueType type;
+  // Only meaningful for IMM.
+  LabelType label;
   union {
     Reg reg;
     int imm;
@@ -44,24 +60,100 @@ typedef struct Inst_ {
   Value jmp;
   int pc;
   int lineno;
+  // Index into Module.locs, or 0 if no .loc directive preceded it.
+  int loc;
+  // Set by the ranges pass on an ADD or SUB whose result never needs
+  // to be wrapped to the word size.
+  bool no_wrap;
+  // How many times the instruction ran in a profile, or 0 if unknown.
+  // See load_pc_profile in ir/pass.h.
+  long count;
   struct Inst_* next;
 } Inst;
 
 typedef struct Data_ {
   int v;
   struct Data_* next;
+  LabelType label;
 } Data;
 
+// A label. |value| is a pc for text labels and an address for data
+// labels.
+typedef struct {
+  const char* name;
+  int value;
+  bool is_text;
+} Symbol;
+
+// A position in the original source given by .file and .loc. |file|
+// indexes Module.files.
+typedef struct {
+  int file;
+  int line;
+} SourceLoc;
+
+struct Arena_;
+
 typedef struct {
   Inst* text;
   Data* data;
+  // A flat view of |text|: text == insts and each inst->next points to
+  // the following element. Instructions whose pc is p are
+  // insts[pc_start[p]] .. insts[pc_start[p + 1] - 1], so a pc without
+  // instructions has an empty range. pc_start has num_pcs + 1 entries.
+  Inst* insts;
+  int num_insts;
+  int* pc_start;
+  int num_pcs;
+  // Labels in definition order.
+  Symbol* syms;
+  int num_syms;
+  // Debug info from .file and .loc. files[n] is the name given by
+  // ".file n", or NULL. Consecutive instructions share one SourceLoc
+  // and locs[0] stands for an unknown location.
+  const char** files;
+  int num_files;
+  SourceLoc* locs;
+  int num_locs;
+  // Owns the module, its instructions, its data, and its strings.
+  struct Arena_* arena;
+  // The file a binary module was mapped from, or NULL.
+  void* map;
+  size_t map_size;
 } Module;
 
 Module* load_eir(FILE* fp);
 
 Module* load_eir_from_file(const char* filename);
 
-void split_basic_block_by_mem();
+// Releases everything load_eir allocated for |m|, including |m|.
+void free_module(Module* m);
+
+// Rebuilds |insts| and |pc_start| from the |text| list. Code which edits
+// |text| must call this before anything uses the flat view again. Inst
+// pointers taken before the call keep pointing at the old copies.
+void reindex_module(Module* m);
+
+// Looks up the source file and line of |inst|, or of the first
+// instruction of |pc|. |*file| is NULL if the .file directive for the
+// location is missing. Returns false when there is no debug info.
+bool get_inst_source_loc(Module* m, Inst* inst, const char** file, int* line);
+bool get_pc_source_loc(Module* m, int pc, const char** file, int* line);
+
+// Binary EIR: a fixed-size instruction table, the resolved data segment
+// and the symbol table, which can be loaded without parsing. See
+// ir/eirb.c for the layout. load_eir_from_file accepts both formats.
+void write_eir_binary(Module* m, FILE* fp);
+bool is_eir_binary(const void* buf, size_t size);
+// Takes ownership of |buf|, a read-only mapping of |size| bytes, which
+// is unmapped by free_module.
+Module* load_eir_binary(const char* filename, void* buf, size_t size);
+
+// Whether |op| is one of MUL .. SHR.
+bool is_ext_op(Op op);
+// Computes an extended op on 24-bit words. Division by zero gives 0 and
+// leaves the remainder as |dst|, and shifts by 24 or more give 0.
+int eval_ext_op(Op op, int dst, int src);
 
 void dump_inst(Inst* inst);
 void dump_inst_fp(Inst* inst, FILE* fp);
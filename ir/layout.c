@@ -0,0 +1,220 @@
+#include <ir/cfg.h>
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Backends built on emit_chunked_main_loop put pcs p with the same
+// p / chunk size into one function, and every jump between functions
+// goes through the outer dispatcher. The layout pass moves hot code
+// together so hot loops do not cross a chunk boundary.
+//
+// Pcs linked by fallthrough form a chain, which is moved as a whole so
+// no jump needs to be added. Starting from the hottest chain not yet
+// placed, a group grows by the hottest chain any of its members jumps
+// to, until it would not fit in a chunk. A group which would straddle
+// a boundary starts at the next one instead, leaving unused pcs. The
+// chains with pc 0 and with the pcs a plain number may name keep their
+// place, hot groups follow by heat, and chains which never ran keep
+// their order at the end.
+
+static int g_layout_chunk_size = 512;
+
+void set_layout_chunk_size(int n) {
+  g_layout_chunk_size = n;
+}
+
+// Only the hosted tools take -profile=, and ELVM's libc has no strncmp.
+#ifndef __eir__
+void load_pc_profile(Module* m, const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "cannot open profile: %s\n", filename);
+    exit(1);
+  }
+  char buf[256];
+  while (fgets(buf, sizeof(buf), fp)) {
+    if (strncmp(buf, "pc ", 3))
+      continue;
+    char* p;
+    int pc = strtol(buf + 3, &p, 10);
+    long count = strtol(p, NULL, 10);
+    if (pc < 0 || pc >= m->num_pcs)
+      continue;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++)
+      m->insts[i].count = count;
+  }
+  fclose(fp);
+}
+#endif
+
+typedef struct {
+  int first_pc;
+  int num_pcs;
+  long heat;
+  bool placed;
+} LayoutChain;
+
+static bool layout_falls(Module* m, int pc) {
+  int end = m->pc_start[pc + 1];
+  if (end == m->pc_start[pc])
+    return true;
+  Op op = m->insts[end - 1].op;
+  return op != JMP && op != EXIT;
+}
+
+static int layout_compare_heat(const void* a, const void* b) {
+  const LayoutChain* x = *(LayoutChain* const*)a;
+  const LayoutChain* y = *(LayoutChain* const*)b;
+  if (x->heat != y->heat)
+    return x->heat > y->heat ? -1 : 1;
+  return x->first_pc - y->first_pc;
+}
+
+// Returns the hottest unplaced chain the chains in |group| jump to, or
+// -1 if there is none with a count.
+static int layout_best_succ(Module* m, LayoutChain* chains, int* chain_of,
+                            int* group, int num_group) {
+  int best = -1;
+  for (int g = 0; g < num_group; g++) {
+    LayoutChain* c = &chains[group[g]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op < JEQ || inst->op > JMP || inst->jmp.type != IMM ||
+          inst->jmp.imm < 0 || inst->jmp.imm >= m->num_pcs)
+        continue;
+      int to = chain_of[inst->jmp.imm];
+      if (chains[to].placed || !chains[to].heat)
+        continue;
+      if (best == -1 || chains[to].heat > chains[best].heat)
+        best = to;
+    }
+  }
+  return best;
+}
+
+// Returns the hottest unplaced chain, or -1 if there is none with a
+// count. |by_heat| before |*next_seed| are all placed.
+static int layout_next_seed(LayoutChain* chains, LayoutChain** by_heat,
+                            int num_chains, int* next_seed) {
+  for (; *next_seed < num_chains; (*next_seed)++) {
+    LayoutChain* c = by_heat[*next_seed];
+    if (!c->placed && c->heat)
+      return c - chains;
+  }
+  return -1;
+}
+
+void layout_by_profile(Module* m) {
+  bool has_counts = false;
+  for (int i = 0; i < m->num_insts; i++)
+    has_counts |= m->insts[i].count != 0;
+  if (!has_counts)
+    return;
+
+  int num_pcs = m->num_pcs;
+  int chunk = g_layout_chunk_size;
+  LayoutChain* chains = calloc(num_pcs, sizeof(LayoutChain));
+  int* chain_of = malloc(sizeof(int) * num_pcs);
+  int num_chains = 0;
+  for (int pc = 0; pc < num_pcs; pc++) {
+    if (pc == 0 || !layout_falls(m, pc - 1))
+      chains[num_chains++].first_pc = pc;
+    LayoutChain* c = &chains[num_chains - 1];
+    c->num_pcs++;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (m->insts[i].count > c->heat)
+        c->heat = m->insts[i].count;
+    }
+    chain_of[pc] = num_chains - 1;
+  }
+  // Falling off the last pc must still end the program, so the last
+  // chain stays last if it can.
+  if (layout_falls(m, num_pcs - 1))
+    chains[num_chains - 1].heat = 0;
+
+  LayoutChain** by_heat = malloc(sizeof(LayoutChain*) * num_chains);
+  for (int i = 0; i < num_chains; i++)
+    by_heat[i] = &chains[i];
+  qsort(by_heat, num_chains, sizeof(LayoutChain*), layout_compare_heat);
+
+  // Chains in their new order, and where each goes.
+  int* order = malloc(sizeof(int) * num_chains);
+  int* base = malloc(sizeof(int) * num_chains);
+  int num_order = 0;
+  int next_pc = 0;
+  int next_seed = 0;
+  CFG* cfg = build_cfg(m);
+  int max_fixed_pc = cfg->max_plain_pc;
+  free_cfg(cfg);
+  for (int c = 0; c < num_chains &&
+                  (c == 0 || chains[c].first_pc <= max_fixed_pc); c++) {
+    chains[c].placed = true;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+  for (int seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+       seed >= 0;) {
+    int* group = &order[num_order];
+    int num_group = 0;
+    int size = 0;
+    for (int c = seed; c >= 0;
+         c = layout_best_succ(m, chains, chain_of, group, num_group)) {
+      if (num_group && size + chains[c].num_pcs > chunk)
+        break;
+      chains[c].placed = true;
+      group[num_group++] = c;
+      size += chains[c].num_pcs;
+    }
+    if (size <= chunk && next_pc % chunk + size > chunk)
+      next_pc += chunk - next_pc % chunk;
+    for (int g = 0; g < num_group; g++) {
+      base[group[g]] = next_pc;
+      next_pc += chains[group[g]].num_pcs;
+    }
+    num_order += num_group;
+    seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+  }
+  for (int c = 0; c < num_chains; c++) {
+    if (chains[c].placed)
+      continue;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  for (int c = 0; c < num_chains; c++) {
+    for (int i = 0; i < chains[c].num_pcs; i++)
+      pc_map[chains[c].first_pc + i] = base[c] + i;
+  }
+  pc_map[num_pcs] = next_pc;
+  relocate_text_labels(m, pc_map);
+
+  Inst root = {};
+  Inst* tail = &root;
+  for (int o = 0; o < num_order; o++) {
+    LayoutChain* c = &chains[order[o]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      inst->pc = pc_map[inst->pc];
+      tail->next = inst;
+      tail = inst;
+    }
+  }
+  tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+
+  free(pc_map);
+  free(base);
+  free(order);
+  free(by_heat);
+  free(chain_of);
+  free(chains);
+}
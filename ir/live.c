@@ -0,0 +1,152 @@
+#include <ir/live.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static int live_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+static bool live_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static int live_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return live_reg_bit(&inst->src);
+    case JMP:
+      return live_reg_bit(&inst->jmp);
+    case GETC:
+    case EXIT:
+    case DUMP:
+      return 0;
+    case COPY:
+    case FILL:
+      // The length is in jmp.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              live_reg_bit(&inst->jmp));
+    default:
+      // STORE keeps its value in dst.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              (live_is_jump(inst->op) ? live_reg_bit(&inst->jmp) : 0));
+  }
+}
+
+static int live_defs(Inst* inst) {
+  switch (inst->op) {
+    case MOV: case ADD: case SUB: case LOAD: case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return live_reg_bit(&inst->dst);
+    default:
+      return 0;
+  }
+}
+
+// Computes the live-in set of the block at |pc| from the live-in sets
+// of blocks in |in|, filling in per-instruction sets if |record|.
+static int live_block(Liveness* lv, CFG* cfg, int* in, int pc,
+                      bool record) {
+  Module* m = lv->module;
+  BasicBlock* bb = &cfg->blocks[pc];
+  int live = pc + 1 < m->num_pcs ? in[pc + 1] : 0;
+  for (int i = bb->num_insts - 1; i >= 0; i--) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT) {
+      live = 0;
+    } else if (live_is_jump(inst->op)) {
+      int target = 0;
+      if (inst->jmp.type == REG)
+        target = in[cfg->indirect];
+      else if (inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs)
+        target = in[inst->jmp.imm];
+      live = inst->op == JMP ? target : live | target;
+    }
+    if (record)
+      lv->live_out[inst - m->insts] = live;
+    live = (live & ~live_defs(inst)) | live_uses(inst);
+    if (record)
+      lv->live_in[inst - m->insts] = live;
+  }
+  return live;
+}
+
+Liveness* build_liveness(Module* m) {
+  Liveness* lv = calloc(1, sizeof(Liveness));
+  lv->module = m;
+  lv->live_in = calloc(m->num_insts + 1, sizeof(int));
+  lv->live_out = calloc(m->num_insts + 1, sizeof(int));
+
+  CFG* cfg = build_cfg(m);
+  int* in = calloc(cfg->num_blocks, sizeof(int));
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int pc = m->num_pcs - 1; pc >= 0; pc--) {
+      int live = live_block(lv, cfg, in, pc, false);
+      if (live != in[pc]) {
+        in[pc] = live;
+        changed = true;
+      }
+    }
+    int live = 0;
+    for (int i = 0; i < indirect->num_succs; i++)
+      live |= in[indirect->succs[i]];
+    if (live != in[cfg->indirect]) {
+      in[cfg->indirect] = live;
+      changed = true;
+    }
+  }
+  for (int pc = 0; pc < m->num_pcs; pc++)
+    live_block(lv, cfg, in, pc, true);
+
+  free(in);
+  free_cfg(cfg);
+  return lv;
+}
+
+void free_liveness(Liveness* lv) {
+  free(lv->live_in);
+  free(lv->live_out);
+  free(lv);
+}
+
+int get_live_in(Liveness* lv, Inst* inst) {
+  return lv->live_in[inst - lv->module->insts];
+}
+
+int get_live_out(Liveness* lv, Inst* inst) {
+  return lv->live_out[inst - lv->module->insts];
+}
+
+bool is_dead_store(Liveness* lv, Inst* inst) {
+  // GETC also consumes input.
+  return (inst->op != GETC && live_defs(inst) &&
+          !(live_defs(inst) & get_live_out(lv, inst)));
+}
+
+static void live_dump_set(const char* name, int regs, FILE* fp) {
+  static const char* names[] = { "A", "B", "C", "D", "BP", "SP" };
+  fprintf(fp, "%s={", name);
+  const char* sep = "";
+  for (int r = 0; r < 6; r++) {
+    if (regs & (1 << r)) {
+      fprintf(fp, "%s%s", sep, names[r]);
+      sep = ",";
+    }
+  }
+  fprintf(fp, "} ");
+}
+
+void dump_liveness(Liveness* lv, FILE* fp) {
+  for (Inst* inst = lv->module->text; inst; inst = inst->next) {
+    live_dump_set("in", get_live_in(lv, inst), fp);
+    live_dump_set("out", get_live_out(lv, inst), fp);
+    dump_inst_fp(inst, fp);
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef ELVM_LIVE_H_
+#define ELVM_LIVE_H_
+
+#include <ir/ir.h>
+
+// Register liveness of a Module. Register sets are bit masks with bit
+// (1 << r) set for each live Reg r. A register is live if some path
+// reads it before writing it, where register jumps may reach any
+// address-taken pc.
+
+typedef struct {
+  Module* module;
+  // Indexed by the position of an Inst in module->insts.
+  int* live_in;
+  int* live_out;
+} Liveness;
+
+// The result keeps pointers into |m|, so rebuild it after |m| changes.
+Liveness* build_liveness(Module* m);
+
+void free_liveness(Liveness* lv);
+
+int get_live_in(Liveness* lv, Inst* inst);
+
+int get_live_out(Liveness* lv, Inst* inst);
+
+// Whether |inst| does nothing but write a register which is dead after
+// it, so it can be skipped.
+bool is_dead_store(Liveness* lv, Inst* inst);
+
+// Prints the live-in and live-out sets before every instruction.
+void dump_liveness(Liveness* lv, FILE* fp);
+
+#endif  // ELVM_LIVE_H_
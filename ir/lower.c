@@ -0,0 +1,594 @@
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+// lower_ext and lower_block replace each MUL .. SHR and COPY .. FILL
+// with a call to a helper routine made of basic ops. The call site
+// saves A-D, loads the operands into A, B and (for block ops) C, and
+// pushes its return pc:
+//
+//     sub SP, 1; store A, SP       ; ... and B, C, D
+//     <C = len>; <B = src>; <A = dst>
+//     mov D, ret; sub SP, 1; store D, SP; jmp helper
+//   ret:                           ; a new pc
+//     <the saved dst = A>          ; ext ops only
+//     load A, SP; mov D, A; add SP, 1   ; ... and C, B, A
+//
+// Helpers may clobber A-D, leave the result in A, and return by popping
+// the return pc. Each used helper is emitted once after the last pc.
+// Only "load A, X" is used since some backends support nothing else.
+
+#define LOWER_BIT23 0x800000
+#define LOWER_NUM_SAVED 4
+
+// An instruction of a helper routine. |jmp| is a local label for jumps,
+// or LOWER_JMP_D for "jmp D". LOWER_LABEL entries define label |jmp|.
+typedef struct {
+  int op;
+  Reg dst;
+  int src;
+  bool src_is_imm;
+  int jmp;
+} LowerInst;
+
+enum {
+  LOWER_LABEL = -1,
+  LOWER_END = -2,
+  LOWER_JMP_D = -1,
+  LOWER_MAX_LABELS = 16
+};
+
+#define LL(l) { LOWER_LABEL, A, 0, false, l }
+#define RR(op, d, s) { op, d, s, false, 0 }
+#define RI(op, d, i) { op, d, i, true, 0 }
+#define JI(op, l, d, i) { op, d, i, true, l }
+#define JR(op, l, d, s) { op, d, s, false, l }
+#define JL(l) { JMP, A, 0, false, l }
+#define RET                                     \
+  RR(MOV, C, A), RR(LOAD, A, SP), RI(ADD, SP, 1), \
+  RR(MOV, D, A), RR(MOV, A, C),                   \
+  { JMP, D, 0, false, LOWER_JMP_D }
+#define END { LOWER_END, A, 0, false, 0 }
+
+// Shift-and-add over the bits of B from the top, after skipping its
+// leading zeros.
+static const LowerInst lower_mul[] = {
+  RI(MOV, C, 0),
+  RI(MOV, D, 24),
+  JI(JEQ, 3, B, 0),
+  LL(0),
+  JI(JGE, 1, B, LOWER_BIT23),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, C, C),
+  JI(JLT, 2, B, LOWER_BIT23),
+  RR(ADD, C, A),
+  LL(2),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JI(JNE, 1, D, 0),
+  LL(3),
+  RR(MOV, A, C),
+  RET,
+  END
+};
+
+// Restoring division. C is the quotient and D the remainder. C starts as
+// 1 and this bit reaches bit 23 at the 24th and last step. When D has
+// bit 23 set, doubling it overflows but the subtraction is then always
+// needed and wraps back to the right value.
+#define LOWER_DIV_BODY                          \
+  JI(JEQ, 10, B, 0),                            \
+  RI(MOV, C, 1),                                \
+  RI(MOV, D, 0),                                \
+  LL(0),                                        \
+  JI(JGE, 5, C, LOWER_BIT23),                   \
+  JI(JGE, 3, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 1, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JR(JLT, 0, D, B),                             \
+  LL(2),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(0),                                        \
+  LL(3),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 4, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(4),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JL(2),                                        \
+  LL(5),                                        \
+  JI(JGE, 8, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 6, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(6),                                        \
+  RR(ADD, C, C),                                \
+  JR(JLT, 9, D, B),                             \
+  LL(7),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(9),                                        \
+  LL(8),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 11, A, LOWER_BIT23),                  \
+  RI(ADD, D, 1),                                \
+  LL(11),                                       \
+  RR(ADD, C, C),                                \
+  JL(7),                                        \
+  LL(9)
+
+static const LowerInst lower_div[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, C),
+  RET,
+  LL(10),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+static const LowerInst lower_mod[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, D),
+  RET,
+  // The remainder of a division by zero is the dividend, already in A.
+  LL(10),
+  RET,
+  END
+};
+
+// Bitwise ops build C from the top bits of A and B, doubling all three
+// 24 times.
+#define LOWER_BITWISE_HEAD                      \
+  RI(MOV, C, 0),                                \
+  RI(MOV, D, 24),                               \
+  LL(0),                                        \
+  RR(ADD, C, C)
+
+#define LOWER_BITWISE_TAIL                      \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, B, B),                                \
+  RI(SUB, D, 1),                                \
+  JI(JNE, 0, D, 0),                             \
+  RR(MOV, A, C),                                \
+  RET,                                          \
+  END
+
+static const LowerInst lower_and[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JLT, 1, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_or[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 2, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_xor[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 3, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  JL(2),
+  LL(3),
+  JI(JGE, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_shl[] = {
+  JI(JGE, 2, B, 24),
+  LL(0),
+  JI(JEQ, 1, B, 0),
+  RR(ADD, A, A),
+  RI(SUB, B, 1),
+  JL(0),
+  LL(2),
+  RI(MOV, A, 0),
+  LL(1),
+  RET,
+  END
+};
+
+// Takes the top 24 - B bits of A.
+static const LowerInst lower_shr[] = {
+  JI(JGE, 3, B, 24),
+  RI(MOV, C, 24),
+  RR(SUB, C, B),
+  RI(MOV, D, 0),
+  LL(0),
+  JI(JEQ, 2, C, 0),
+  RR(ADD, D, D),
+  JI(JLT, 1, A, LOWER_BIT23),
+  RI(ADD, D, 1),
+  LL(1),
+  RR(ADD, A, A),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(2),
+  RR(MOV, A, D),
+  RET,
+  LL(3),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+// memmove of C words from B to A. Copies backwards if A is above B.
+static const LowerInst lower_copy[] = {
+  RR(MOV, D, A),
+  JR(JGT, 1, D, B),
+  LL(0),
+  JI(JEQ, 3, C, 0),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(ADD, B, 1),
+  RI(ADD, D, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, B, C),
+  RR(ADD, D, C),
+  LL(2),
+  JI(JEQ, 3, C, 0),
+  RI(SUB, B, 1),
+  RI(SUB, D, 1),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(SUB, C, 1),
+  JL(2),
+  LL(3),
+  RET,
+  END
+};
+
+static const LowerInst lower_fill[] = {
+  LL(0),
+  JI(JEQ, 1, C, 0),
+  RR(STORE, B, A),
+  RI(ADD, A, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RET,
+  END
+};
+
+static const LowerInst* lower_helper_code(Op op) {
+  switch (op) {
+    case MUL: return lower_mul;
+    case DIV: return lower_div;
+    case MOD: return lower_mod;
+    case AND: return lower_and;
+    case OR: return lower_or;
+    case XOR: return lower_xor;
+    case SHL: return lower_shl;
+    case SHR: return lower_shr;
+    case COPY: return lower_copy;
+    case FILL: return lower_fill;
+    default: return NULL;
+  }
+}
+
+// Appends instructions to |tail| and numbers pcs the way the parser
+// does: a jump ends its pc and a label after instructions starts one.
+typedef struct {
+  Arena* arena;
+  Inst* tail;
+  int pc;
+  bool at_boundary;
+  // Debug info and profile counts for the emitted instructions.
+  int lineno;
+  int loc;
+  long count;
+} LowerEmitter;
+
+static Inst* lower_emit(LowerEmitter* e, int op) {
+  Inst* inst = arena_alloc(e->arena, sizeof(Inst));
+  inst->op = (Op)op;
+  inst->pc = e->pc;
+  inst->lineno = e->lineno;
+  inst->loc = e->loc;
+  inst->count = e->count;
+  e->tail->next = inst;
+  e->tail = inst;
+  e->at_boundary = false;
+  if (op >= JEQ && op <= JMP) {
+    e->pc++;
+    e->at_boundary = true;
+  }
+  return inst;
+}
+
+static void lower_set_reg(Value* v, Reg r) {
+  v->type = REG;
+  v->reg = r;
+}
+
+static void lower_set_imm(Value* v, int imm, LabelType label) {
+  v->type = IMM;
+  v->imm = imm;
+  v->label = label;
+}
+
+static void lower_emit_rr(LowerEmitter* e, Op op, Reg dst, Reg src) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_reg(&inst->src, src);
+}
+
+static void lower_emit_ri(LowerEmitter* e, Op op, Reg dst, int imm) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_imm(&inst->src, imm, NOT_LABEL);
+}
+
+static void lower_emit_push(LowerEmitter* e, Reg r) {
+  lower_emit_ri(e, SUB, SP, 1);
+  lower_emit_rr(e, STORE, r, SP);
+}
+
+static void lower_emit_pop(LowerEmitter* e, Reg r) {
+  lower_emit_rr(e, LOAD, A, SP);
+  if (r != A)
+    lower_emit_rr(e, MOV, r, A);
+  lower_emit_ri(e, ADD, SP, 1);
+}
+
+// Assigns pcs to the labels of |code| placed at |pc| and returns the
+// first pc after it.
+static int lower_layout_helper(const LowerInst* code, int pc, int* labels) {
+  bool at_boundary = true;
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!at_boundary)
+        pc++;
+      at_boundary = true;
+      labels[li->jmp] = pc;
+    } else if (li->op >= JEQ && li->op <= JMP) {
+      pc++;
+      at_boundary = true;
+    } else {
+      at_boundary = false;
+    }
+  }
+  return at_boundary ? pc : pc + 1;
+}
+
+// Emits |code| starting at a new pc.
+static void lower_emit_helper(LowerEmitter* e, const LowerInst* code) {
+  int labels[LOWER_MAX_LABELS];
+  lower_layout_helper(code, e->pc, labels);
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!e->at_boundary)
+        e->pc++;
+      e->at_boundary = true;
+      continue;
+    }
+    Inst* inst = lower_emit(e, li->op);
+    if (li->op == JMP && li->jmp == LOWER_JMP_D) {
+      lower_set_reg(&inst->jmp, D);
+      continue;
+    }
+    if (li->op != JMP) {
+      lower_set_reg(&inst->dst, li->dst);
+      if (li->src_is_imm)
+        lower_set_imm(&inst->src, li->src, NOT_LABEL);
+      else
+        lower_set_reg(&inst->src, (Reg)li->src);
+    }
+    if (li->op >= JEQ && li->op <= JMP)
+      lower_set_imm(&inst->jmp, labels[li->jmp], TEXT_LABEL);
+  }
+}
+
+// Stack slot of a saved register once the frame is complete.
+static int lower_slot(Reg r) {
+  return LOWER_NUM_SAVED - 1 - r;
+}
+
+// Makes |addr| point to the stack slot of |r|.
+static void lower_emit_slot_addr(LowerEmitter* e, Reg addr, Reg r) {
+  lower_emit_rr(e, MOV, addr, SP);
+  lower_emit_ri(e, ADD, addr, lower_slot(r));
+}
+
+// Loads the value |v| had before the call site into |r|, which is A, B
+// or C. They are loaded in the order C, B, A since A is used to load
+// from memory. D is used as a scratch register.
+static void lower_emit_operand(LowerEmitter* e, Reg r, Value* v) {
+  if (v->type == IMM) {
+    Inst* inst = lower_emit(e, MOV);
+    lower_set_reg(&inst->dst, r);
+    inst->src = *v;
+  } else if (v->reg == BP) {
+    lower_emit_rr(e, MOV, r, BP);
+  } else if (v->reg == SP) {
+    lower_emit_rr(e, MOV, r, SP);
+    lower_emit_ri(e, ADD, r, LOWER_NUM_SAVED);
+  } else {
+    lower_emit_slot_addr(e, D, v->reg);
+    lower_emit_rr(e, LOAD, A, D);
+    if (r != A)
+      lower_emit_rr(e, MOV, r, A);
+  }
+}
+
+// Copies the saved registers from the frame at SP to the one at B.
+static void lower_emit_copy_frame(LowerEmitter* e, bool descending) {
+  for (int i = 0; i < LOWER_NUM_SAVED; i++) {
+    Reg r = (Reg)(descending ? i : D - i);
+    lower_emit_slot_addr(e, C, r);
+    lower_emit_rr(e, LOAD, A, C);
+    lower_emit_rr(e, MOV, C, B);
+    lower_emit_ri(e, ADD, C, lower_slot(r));
+    lower_emit_rr(e, STORE, A, C);
+  }
+}
+
+// Moves the saved registers to just below the new SP in A, so popping
+// them leaves SP at the result. The frames may overlap, so the copy
+// runs in the direction of the move:
+//
+//     mov B, A; sub B, 4; jgt down, B, SP
+//     <copy upwards>; jmp done
+//   down:
+//     <copy downwards>
+//   done:
+//     mov SP, B
+static void lower_emit_move_frame(LowerEmitter* e) {
+  lower_emit_rr(e, MOV, B, A);
+  lower_emit_ri(e, SUB, B, LOWER_NUM_SAVED);
+  Inst* down = lower_emit(e, JGT);
+  lower_set_reg(&down->dst, B);
+  lower_set_reg(&down->src, SP);
+  lower_set_imm(&down->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, false);
+  Inst* done = lower_emit(e, JMP);
+  lower_set_imm(&done->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, true);
+  e->pc++;
+  lower_emit_rr(e, MOV, SP, B);
+}
+
+// The number of pcs a call site adds to the pc of |inst|.
+static int lower_call_pcs(Inst* inst) {
+  return is_ext_op(inst->op) && inst->dst.reg == SP ? 4 : 1;
+}
+
+static void lower_emit_call(LowerEmitter* e, Inst* inst, int helper_pc) {
+  for (int r = A; r <= D; r++)
+    lower_emit_push(e, (Reg)r);
+  if (!is_ext_op(inst->op))
+    lower_emit_operand(e, C, &inst->jmp);
+  lower_emit_operand(e, B, &inst->src);
+  lower_emit_operand(e, A, &inst->dst);
+
+  Inst* ret = lower_emit(e, MOV);
+  lower_set_reg(&ret->dst, D);
+  lower_set_imm(&ret->src, e->pc + 1, TEXT_LABEL);
+  lower_emit_push(e, D);
+  Inst* jmp = lower_emit(e, JMP);
+  lower_set_imm(&jmp->jmp, helper_pc, TEXT_LABEL);
+
+  Reg dst = inst->dst.reg;
+  if (!is_ext_op(inst->op)) {
+    // Block ops have no result.
+  } else if (dst == BP) {
+    lower_emit_rr(e, MOV, BP, A);
+  } else if (dst == SP) {
+    lower_emit_move_frame(e);
+  } else {
+    lower_emit_slot_addr(e, C, dst);
+    lower_emit_rr(e, STORE, A, C);
+  }
+  for (int r = D; r >= A; r--)
+    lower_emit_pop(e, (Reg)r);
+}
+
+// Replaces the ops from |first| to |last| by calls.
+static void lower_ops(Module* m, Op first, Op last) {
+  int num_calls = 0;
+  bool used[LAST_OP] = {};
+  long helper_count[LAST_OP] = {};
+  for (int i = 0; i < m->num_insts; i++) {
+    Op op = m->insts[i].op;
+    if (op >= first && op <= last) {
+      num_calls++;
+      used[op] = true;
+      helper_count[op] += m->insts[i].count;
+    }
+  }
+  if (!num_calls)
+    return;
+
+  // Every call site splits its pc.
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = pc + shift;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      Op op = m->insts[i].op;
+      if (op >= first && op <= last)
+        shift += lower_call_pcs(&m->insts[i]);
+    }
+  }
+  pc_map[m->num_pcs] = m->num_pcs + shift;
+  relocate_text_labels(m, pc_map);
+
+  // Helpers go after the last pc, in Op order.
+  int helper_pc[LAST_OP];
+  int labels[LOWER_MAX_LABELS];
+  int pc = pc_map[m->num_pcs];
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    helper_pc[op] = pc;
+    pc = lower_layout_helper(lower_helper_code((Op)op), pc, labels);
+  }
+
+  Inst root = {};
+  LowerEmitter e = {};
+  e.arena = m->arena;
+  e.tail = &root;
+  for (int old_pc = 0; old_pc < m->num_pcs; old_pc++) {
+    e.pc = pc_map[old_pc];
+    for (int i = m->pc_start[old_pc]; i < m->pc_start[old_pc + 1]; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op >= first && inst->op <= last) {
+        e.lineno = inst->lineno;
+        e.loc = inst->loc;
+        e.count = inst->count;
+        lower_emit_call(&e, inst, helper_pc[inst->op]);
+        continue;
+      }
+      inst->pc = e.pc;
+      e.tail->next = inst;
+      e.tail = inst;
+    }
+  }
+
+  e.pc = pc_map[m->num_pcs];
+  e.at_boundary = true;
+  e.lineno = -1;
+  e.loc = 0;
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    // A helper runs as often as all its call sites together.
+    e.count = helper_count[op];
+    lower_emit_helper(&e, lower_helper_code((Op)op));
+  }
+  e.tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+  free(pc_map);
+}
+
+void lower_ext_ops(Module* m) {
+  lower_ops(m, MUL, SHR);
+}
+
+void lower_block_ops(Module* m) {
+  lower_ops(m, COPY, FILL);
+}
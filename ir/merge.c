@@ -0,0 +1,128 @@
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static bool merge_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+// Whether |inst| is a jump to an immediate pc of |m|.
+static bool merge_is_direct_jump(Module* m, Inst* inst) {
+  return (merge_is_jump(inst->op) && inst->jmp.type == IMM &&
+          inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs);
+}
+
+// Returns where a jump to |pc| ends up, following blocks which are only
+// a "jmp" to another pc. Loops of such blocks are left alone.
+static int merge_thread(Module* m, int pc) {
+  int to = pc;
+  for (int steps = 0; steps < m->num_pcs; steps++) {
+    int start = m->pc_start[to];
+    if (m->pc_start[to + 1] - start != 1)
+      return to;
+    Inst* inst = &m->insts[start];
+    if (inst->op != JMP || !merge_is_direct_jump(m, inst))
+      return to;
+    to = inst->jmp.imm;
+  }
+  return pc;
+}
+
+// The last instruction of |pc| which was not removed, or NULL.
+static Inst* merge_last_inst(Module* m, bool* removed, int pc) {
+  for (int i = m->pc_start[pc + 1] - 1; i >= m->pc_start[pc]; i--) {
+    if (!removed[i])
+      return &m->insts[i];
+  }
+  return NULL;
+}
+
+void merge_basic_blocks(Module* m) {
+  int num_pcs = m->num_pcs;
+  if (!num_pcs)
+    return;
+
+  // Jumps go straight to the end of jump chains.
+  int* thread = malloc(sizeof(int) * num_pcs);
+  for (int pc = 0; pc < num_pcs; pc++)
+    thread[pc] = merge_thread(m, pc);
+  bool changed = false;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (merge_is_direct_jump(m, inst) && thread[inst->jmp.imm] != inst->jmp.imm) {
+      inst->jmp.imm = thread[inst->jmp.imm];
+      changed = true;
+    }
+  }
+  free(thread);
+
+  // A jump to the next pc does nothing, unless it is all its pc has.
+  bool* removed = calloc(m->num_insts + 1, sizeof(bool));
+  for (int pc = 0; pc + 1 < num_pcs; pc++) {
+    int last = m->pc_start[pc + 1] - 1;
+    if (last <= m->pc_start[pc])
+      continue;
+    Inst* inst = &m->insts[last];
+    if (merge_is_direct_jump(m, inst) && inst->jmp.imm == pc + 1) {
+      removed[last] = true;
+      changed = true;
+    }
+  }
+
+  // A pc which is entered only by falling into it joins the previous
+  // one. Pcs a register jump may reach keep their pcs, and so does every
+  // pc up to the highest one a plain number may name, since plain
+  // numbers are not relocated.
+  CFG* cfg = build_cfg(m);
+  bool* entered = calloc(num_pcs, sizeof(bool));
+  entered[0] = true;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (!removed[i] && merge_is_direct_jump(m, inst))
+      entered[inst->jmp.imm] = true;
+  }
+  for (int pc = 0; pc < num_pcs; pc++)
+    entered[pc] |= cfg->blocks[pc].address_taken || pc <= cfg->max_plain_pc;
+  free_cfg(cfg);
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  pc_map[0] = 0;
+  for (int pc = 1; pc < num_pcs; pc++) {
+    Inst* prev = merge_last_inst(m, removed, pc - 1);
+    bool falls = !prev || (!merge_is_jump(prev->op) && prev->op != EXIT);
+    if (falls && !entered[pc]) {
+      pc_map[pc] = pc_map[pc - 1];
+      changed = true;
+    } else {
+      pc_map[pc] = pc_map[pc - 1] + 1;
+    }
+  }
+  pc_map[num_pcs] = pc_map[num_pcs - 1] + 1;
+  free(entered);
+
+  if (changed) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (removed[i])
+        continue;
+      if (prev)
+        prev->next = &m->insts[i];
+      else
+        m->text = &m->insts[i];
+      prev = &m->insts[i];
+    }
+    if (prev)
+      prev->next = NULL;
+    else
+      m->text = NULL;
+
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next)
+      inst->pc = pc_map[inst->pc];
+    reindex_module(m);
+  }
+  free(pc_map);
+  free(removed);
+}
@@ -0,0 +1,395 @@
+#include <ir/opt.h>
+
+#include <stdlib.h>
+
+#define OPT_NUM_REGS 6
+#define OPT_ALL_REGS ((1 << OPT_NUM_REGS) - 1)
+#define OPT_MAX_MEM_FACTS 8
+
+// What the forward pass knows at the current instruction. A known
+// register holds either an immediate or the same value as another
+// register, and a memory fact says the word at |addr| equals |val|.
+typedef struct {
+  Value addr;
+  Value val;
+} MemFact;
+
+typedef struct {
+  bool known[OPT_NUM_REGS];
+  Value regs[OPT_NUM_REGS];
+  MemFact mem[OPT_MAX_MEM_FACTS];
+  int num_mem;
+} OptState;
+
+static bool opt_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static bool opt_is_cmp(Op op) {
+  return op >= EQ && op <= GE;
+}
+
+static bool opt_same_value(Value* a, Value* b) {
+  if (a->type != b->type)
+    return false;
+  if (a->type == REG)
+    return a->reg == b->reg;
+  return a->imm == b->imm && a->label == b->label;
+}
+
+static bool opt_is_plain_imm(Value* v) {
+  return v->type == IMM && v->label == NOT_LABEL;
+}
+
+static void opt_set_mov_imm(Inst* inst, int v) {
+  inst->op = MOV;
+  inst->src.type = IMM;
+  inst->src.label = NOT_LABEL;
+  inst->src.imm = MOD24(v);
+}
+
+// Forgets everything which depends on the old value of |r|.
+static void opt_kill_reg(OptState* s, Reg r) {
+  s->known[r] = false;
+  for (int i = 0; i < OPT_NUM_REGS; i++) {
+    if (s->known[i] && s->regs[i].type == REG && s->regs[i].reg == r)
+      s->known[i] = false;
+  }
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if ((f->addr.type == REG && f->addr.reg == r) ||
+        (f->val.type == REG && f->val.reg == r))
+      continue;
+    s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+}
+
+// Replaces a register operand by what it is known to hold.
+static void opt_rewrite_use(OptState* s, Value* v, bool allow_imm) {
+  if (v->type != REG || !s->known[v->reg])
+    return;
+  Value* k = &s->regs[v->reg];
+  if (k->type == REG || allow_imm)
+    *v = *k;
+}
+
+// The value a register will be known to hold after it is set to |v|.
+static void opt_canonical(OptState* s, Value* v, Value* out) {
+  if (v->type == REG && s->known[v->reg])
+    *out = s->regs[v->reg];
+  else
+    *out = *v;
+}
+
+static MemFact* opt_find_mem(OptState* s, Value* addr) {
+  for (int i = 0; i < s->num_mem; i++) {
+    if (opt_same_value(&s->mem[i].addr, addr))
+      return &s->mem[i];
+  }
+  return NULL;
+}
+
+static void opt_add_mem(OptState* s, Value* addr, Value* val) {
+  if (s->num_mem == OPT_MAX_MEM_FACTS) {
+    for (int i = 1; i < s->num_mem; i++)
+      s->mem[i - 1] = s->mem[i];
+    s->num_mem--;
+  }
+  s->mem[s->num_mem].addr = *addr;
+  s->mem[s->num_mem].val = *val;
+  s->num_mem++;
+}
+
+// Two immediates never alias unless they are equal. Anything else may.
+static void opt_store_mem(OptState* s, Value* addr, Value* val) {
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if (f->addr.type == IMM && addr->type == IMM && f->addr.imm != addr->imm)
+      s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+  opt_add_mem(s, addr, val);
+}
+
+static bool opt_compare(Op op, int l, int r) {
+  switch (op) {
+    case JEQ: case EQ: return l == r;
+    case JNE: case NE: return l != r;
+    case JLT: case LT: return l < r;
+    case JGT: case GT: return l > r;
+    case JLE: case LE: return l <= r;
+    case JGE: case GE: return l >= r;
+    default:
+      return false;
+  }
+}
+
+// Whether "op dst, v" leaves dst unchanged.
+static bool opt_is_identity(Op op, Value* v) {
+  if (!opt_is_plain_imm(v))
+    return false;
+  switch (op) {
+    case ADD: case SUB: case OR: case XOR: case SHL: case SHR:
+      return v->imm == 0;
+    case MUL: case DIV:
+      return v->imm == 1;
+    default:
+      return false;
+  }
+}
+
+// Rewrites |inst| using and updating |s|. Returns false if the
+// instruction has no effect and can be dropped.
+static bool opt_forward(OptState* s, Inst* inst) {
+  Op op = inst->op;
+  switch (op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case PUTC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_rewrite_use(s, &inst->src, true);
+      break;
+    case STORE:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      break;
+    case COPY:
+    case FILL:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      opt_rewrite_use(s, &inst->jmp, true);
+      break;
+    default:
+      break;
+  }
+  if (opt_is_jump(op)) {
+    if (op != JMP)
+      opt_rewrite_use(s, &inst->dst, false);
+    opt_rewrite_use(s, &inst->jmp, true);
+  }
+
+  Value* dst = &inst->dst;
+  Value* src = &inst->src;
+  Value* known_dst =
+      dst->type == REG && s->known[dst->reg] ? &s->regs[dst->reg] : NULL;
+  bool folds = (known_dst && opt_is_plain_imm(known_dst) &&
+                opt_is_plain_imm(src));
+
+  if (opt_is_identity(op, src))
+    return false;
+
+  switch (op) {
+    case ADD:
+    case SUB:
+      if (folds) {
+        int v = (op == ADD ? known_dst->imm + src->imm :
+                 known_dst->imm - src->imm);
+        opt_set_mov_imm(inst, v);
+      }
+      break;
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      if (folds)
+        opt_set_mov_imm(inst, opt_compare(op, known_dst->imm, src->imm));
+      break;
+
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      if (folds)
+        opt_set_mov_imm(inst, eval_ext_op(op, known_dst->imm, src->imm));
+      break;
+
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+      if (folds) {
+        if (!opt_compare(op, known_dst->imm, src->imm))
+          return false;
+        inst->op = JMP;
+        inst->dst.type = REG;
+        inst->dst.reg = A;
+        inst->src = inst->dst;
+      }
+      break;
+
+    case LOAD: {
+      MemFact* f = opt_find_mem(s, src);
+      if (f && f->val.type == REG && f->val.reg == dst->reg)
+        return false;
+      if (f) {
+        inst->op = MOV;
+        *src = f->val;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  switch (inst->op) {
+    case MOV: {
+      if (src->type == REG && src->reg == dst->reg)
+        return false;
+      if (known_dst && opt_same_value(known_dst, src))
+        return false;
+      Value v;
+      opt_canonical(s, src, &v);
+      opt_kill_reg(s, dst->reg);
+      s->known[dst->reg] = true;
+      s->regs[dst->reg] = v;
+      break;
+    }
+
+    case ADD:
+    case SUB:
+    case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_kill_reg(s, dst->reg);
+      break;
+
+    case LOAD: {
+      Value addr = *src;
+      opt_kill_reg(s, dst->reg);
+      if (!(addr.type == REG && addr.reg == dst->reg))
+        opt_add_mem(s, &addr, dst);
+      break;
+    }
+
+    case STORE: {
+      Value v;
+      opt_canonical(s, dst, &v);
+      opt_store_mem(s, src, &v);
+      break;
+    }
+
+    case COPY:
+    case FILL:
+      s->num_mem = 0;
+      break;
+
+    default:
+      break;
+  }
+  return true;
+}
+
+static int opt_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+// Registers |inst| reads.
+static int opt_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return opt_reg_bit(&inst->src);
+    case ADD:
+    case SUB:
+    case STORE:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              (opt_is_jump(inst->op) ? opt_reg_bit(&inst->jmp) : 0));
+    case JMP:
+      return opt_reg_bit(&inst->jmp);
+    case COPY:
+    case FILL:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              opt_reg_bit(&inst->jmp));
+    default:
+      return 0;
+  }
+}
+
+// Whether |inst| only writes its dst register.
+static bool opt_is_pure_def(Inst* inst) {
+  return (inst->op == MOV || inst->op == ADD || inst->op == SUB ||
+          inst->op == LOAD || opt_is_cmp(inst->op) || is_ext_op(inst->op));
+}
+
+// Returns the number of instructions of a block that were dropped.
+static int opt_block(Inst* insts, int n, bool* dead) {
+  OptState s = {};
+  int removed = 0;
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    if (!opt_forward(&s, inst)) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (inst->op == EXIT || inst->op == JMP) {
+      // The rest of the block never runs.
+      for (i++; i < n; i++) {
+        dead[i] = true;
+        removed++;
+      }
+    }
+  }
+
+  // Every register may be read by later blocks.
+  int live = OPT_ALL_REGS;
+  for (int i = n - 1; i >= 0; i--) {
+    Inst* inst = &insts[i];
+    if (dead[i])
+      continue;
+    if (inst->op == EXIT) {
+      live = 0;
+      continue;
+    }
+    if (opt_is_jump(inst->op))
+      live = OPT_ALL_REGS;
+    if (opt_is_pure_def(inst) && !(live & (1 << inst->dst.reg))) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (opt_is_pure_def(inst) || inst->op == GETC)
+      live &= ~(1 << inst->dst.reg);
+    live |= opt_uses(inst);
+  }
+
+  // Keep one instruction so the pc stays a valid jump target.
+  if (n && removed == n) {
+    dead[n - 1] = false;
+    removed--;
+  }
+  return removed;
+}
+
+void optimize_module(Module* m) {
+  bool* dead = calloc(m->num_insts + 1, sizeof(bool));
+  int removed = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    int start = m->pc_start[pc];
+    int n = m->pc_start[pc + 1] - start;
+    removed += opt_block(&m->insts[start], n, &dead[start]);
+  }
+
+  if (removed) {
+    Inst root;
+    Inst* prev = &root;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (dead[i])
+        continue;
+      prev->next = &m->insts[i];
+      prev = prev->next;
+    }
+    prev->next = NULL;
+    m->text = root.next;
+    reindex_module(m);
+  }
+  free(dead);
+}
@@ -0,0 +1,13 @@
+#ifndef ELVM_OPT_H_
+#define ELVM_OPT_H_
+
+#include <ir/ir.h>
+
+// Simplifies each basic block of |m| on its own: constant and copy
+// propagation with folding in 24-bit arithmetic, store-to-load
+// forwarding, and removal of register writes which are overwritten
+// before the end of the block. Nothing is assumed at block boundaries,
+// so no pc gains or loses a label and no pc becomes empty.
+void optimize_module(Module* m);
+
+#endif  // ELVM_OPT_H_
@@ -0,0 +1,180 @@
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef __eir__
+#include <time.h>
+#endif
+
+#include <ir/opt.h>
+#include <ir/range.h>
+
+static const Pass g_passes[] = {
+  { "opt", optimize_module,
+    "block-local constant/copy propagation and dead write removal" },
+  { "dce", remove_dead_code_and_data,
+    "remove unreachable pcs and unreferenced data" },
+  { "merge", merge_basic_blocks,
+    "thread jumps to jumps and merge fallthrough-only pcs" },
+  { "lower_ext", lower_ext_ops,
+    "replace mul/div/mod/and/or/xor/shl/shr with calls to helpers" },
+  { "lower_block", lower_block_ops,
+    "replace copy/fill with calls to loop helpers" },
+  { "layout", layout_by_profile,
+    "reorder pcs by profile counts so hot loops stay in one chunk" },
+  { "ranges", analyze_ranges,
+    "mark add/sub which never wrap around so backends skip the mask" },
+  { "split_mem", split_basic_block_by_mem,
+    "start a new pc after every load and store" },
+  { NULL, NULL, NULL }
+};
+
+#define MAX_PIPELINE 64
+
+static const Pass* g_pipeline[MAX_PIPELINE];
+static int g_num_pipeline;
+
+const Pass* find_pass(const char* name) {
+  for (const Pass* pass = g_passes; pass->name; pass++) {
+    if (!strcmp(pass->name, name))
+      return pass;
+  }
+  return NULL;
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void pass_error(const char* msg, const char* name) {
+  fprintf(stderr, "%s: %s\navailable passes:\n", msg, name);
+  for (const Pass* pass = g_passes; pass->name; pass++)
+    fprintf(stderr, "  %s: %s\n", pass->name, pass->help);
+  exit(1);
+}
+
+void add_pass(const char* name) {
+  const Pass* pass = find_pass(name);
+  if (!pass)
+    pass_error("unknown pass", name);
+  if (g_num_pipeline == MAX_PIPELINE)
+    pass_error("too many passes", name);
+  g_pipeline[g_num_pipeline++] = pass;
+}
+
+void add_passes(const char* names) {
+  char buf[64];
+  while (*names) {
+    const char* end = strchr(names, ',');
+    int len = end ? end - names : (int)strlen(names);
+    if (len >= (int)sizeof(buf))
+      pass_error("unknown pass", names);
+    if (len) {
+      memcpy(buf, names, len);
+      buf[len] = 0;
+      add_pass(buf);
+    }
+    names += len;
+    if (*names)
+      names++;
+  }
+}
+
+static int pass_count_data(Module* m) {
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    n++;
+  return n;
+}
+
+static void pass_print_count(const char* name, int before, int after) {
+  fprintf(stderr, " %s %d -> %d (%s%d)", name, before, after,
+          after >= before ? "+" : "", after - before);
+}
+
+#ifndef __eir__
+static double pass_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+#endif
+
+void run_passes(Module* m, bool show_stats) {
+  for (int i = 0; i < g_num_pipeline; i++) {
+    const Pass* pass = g_pipeline[i];
+    if (!show_stats) {
+      pass->run(m);
+      continue;
+    }
+
+    int insts = m->num_insts;
+    int pcs = m->num_pcs;
+    int data = pass_count_data(m);
+#ifndef __eir__
+    double start = pass_now_ms();
+#endif
+    pass->run(m);
+    fprintf(stderr, "pass %s:", pass->name);
+#ifndef __eir__
+    fprintf(stderr, " %.3f ms", pass_now_ms() - start);
+#endif
+    pass_print_count("insts", insts, m->num_insts);
+    pass_print_count("pcs", pcs, m->num_pcs);
+    pass_print_count("data", data, pass_count_data(m));
+    fprintf(stderr, "\n");
+  }
+}
+
+static void pass_relocate_value(Value* v, const int* pc_map, int num_pcs) {
+  if (v->type == IMM && v->label == TEXT_LABEL &&
+      v->imm >= 0 && v->imm <= num_pcs)
+    v->imm = pc_map[v->imm];
+}
+
+void relocate_text_labels(Module* m, const int* pc_map) {
+  int num_pcs = m->num_pcs;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    pass_relocate_value(&inst->dst, pc_map, num_pcs);
+    pass_relocate_value(&inst->src, pc_map, num_pcs);
+    // A jump target is a pc even if it was written as a number.
+    if (inst->op >= JEQ && inst->op <= JMP) {
+      Value* v = &inst->jmp;
+      if (v->type == IMM && v->imm >= 0 && v->imm <= num_pcs)
+        v->imm = pc_map[v->imm];
+    } else {
+      pass_relocate_value(&inst->jmp, pc_map, num_pcs);
+    }
+  }
+  for (Data* data = m->data; data; data = data->next) {
+    if (data->label == TEXT_LABEL && data->v >= 0 && data->v <= num_pcs)
+      data->v = pc_map[data->v];
+  }
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (sym->is_text && sym->value >= 0 && sym->value <= num_pcs)
+      sym->value = pc_map[sym->value];
+  }
+}
+
+void split_basic_block_by_mem(Module* m) {
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    for (; pc <= inst->pc; pc++)
+      pc_map[pc] = pc + shift;
+    int old_pc = inst->pc;
+    inst->pc += shift;
+    if ((inst->op == LOAD || inst->op == STORE) &&
+        inst->next && inst->next->pc == old_pc)
+      shift++;
+  }
+  for (; pc <= m->num_pcs; pc++)
+    pc_map[pc] = pc + shift;
+
+  if (shift) {
+    relocate_text_labels(m, pc_map);
+    reindex_module(m);
+  }
+  free(pc_map);
+}
@@ -0,0 +1,64 @@
+#ifndef ELVM_PASS_H_
+#define ELVM_PASS_H_
+
+#include <ir/ir.h>
+
+// A named transformation of a Module. Passes which edit |text| call
+// reindex_module themselves.
+typedef struct {
+  const char* name;
+  void (*run)(Module* m);
+  const char* help;
+} Pass;
+
+const Pass* find_pass(const char* name);
+
+// Appends passes to the pipeline. |names| is a comma separated list.
+// Unknown names are fatal.
+void add_pass(const char* name);
+void add_passes(const char* names);
+
+// Runs the pipeline in order. With |show_stats|, prints the time each
+// pass took and how it changed the instruction, pc, and data word counts
+// to stderr.
+void run_passes(Module* m, bool show_stats);
+
+// Rewrites every reference to a pc, which are jump targets, text label
+// immediates, text label data words, and text symbols, by |pc_map|,
+// which has num_pcs + 1 entries since a label may follow the last
+// instruction. Instruction pcs are left to the caller.
+void relocate_text_labels(Module* m, const int* pc_map);
+
+// Points jumps at the end of chains of pcs which only jump, drops jumps
+// to the next pc, and joins each pc which is only reached by falling
+// into it with the previous one. Text label values keep their targets.
+void merge_basic_blocks(Module* m);
+
+// Removes the pcs which cannot be reached from pc 0 and the data which
+// kept code and data never refer to, and renumbers what is left. See
+// ir/dce.c for what counts as a reference.
+void remove_dead_code_and_data(Module* m);
+
+// Sets the count of every instruction from a profile written by
+// "eli -profile=FILE", whose "pc <pc> <count>" lines give how many times
+// each pc was entered. Other lines are ignored. Not in self-hosted tools.
+#ifndef __eir__
+void load_pc_profile(Module* m, const char* filename);
+#endif
+// Reorders pcs so the pcs which run most often together share a chunk
+// of |n| pcs, as emit_chunked_main_loop in target/util.c groups them.
+// Does nothing without counts. See ir/layout.c.
+void set_layout_chunk_size(int n);
+void layout_by_profile(Module* m);
+
+// Starts a new pc after every load and store. Some backends need this
+// to keep memory accesses at the end of a basic block.
+void split_basic_block_by_mem(Module* m);
+
+// Replaces MUL .. SHR with calls to helper routines built from basic
+// ops, for backends without native support. See ir/lower.c.
+void lower_ext_ops(Module* m);
+// Does the same for COPY and FILL, whose helpers are word loops.
+void lower_block_ops(Module* m);
+
+#endif  // ELVM_PASS_H_
@@ -0,0 +1,291 @@
+#include <ir/range.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+#define RANGE_NUM_REGS 6
+#define RANGE_MAX 16777215
+// A bound of an entry state which keeps moving after this many changes
+// is widened to the end of the word, so loops reach a fixpoint quickly.
+#define RANGE_WIDEN_AFTER 2
+// Rounds of recomputing every entry state from the widened ones, which
+// brings back bounds given by loop conditions.
+#define RANGE_NARROW_ROUNDS 2
+
+// An inclusive interval of unsigned 24-bit values. Bounds are compared
+// before any addition or subtraction so nothing leaves [0, RANGE_MAX],
+// which keeps this correct when ints are 24-bit too.
+typedef struct {
+  int lo;
+  int hi;
+} Range;
+
+typedef struct {
+  bool reached;
+  int changes;
+  Range regs[RANGE_NUM_REGS];
+} RangeState;
+
+static void range_set(Range* r, int lo, int hi) {
+  r->lo = lo;
+  r->hi = hi;
+}
+
+static void range_of_value(RangeState* s, Value* v, Range* out) {
+  if (v->type == REG)
+    *out = s->regs[v->reg];
+  else
+    range_set(out, v->imm, v->imm);
+}
+
+static int range_min(int a, int b) {
+  return a < b ? a : b;
+}
+
+static int range_max(int a, int b) {
+  return a > b ? a : b;
+}
+
+// Updates |s| for a non-jump |inst|. Records whether an ADD or SUB can
+// wrap around if |mark| is set.
+static void range_transfer(RangeState* s, Inst* inst, bool mark) {
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  switch (inst->op) {
+    case MOV:
+      range_of_value(s, &inst->src, d);
+      break;
+
+    case ADD:
+    case SUB: {
+      range_of_value(s, &inst->src, &b);
+      bool no_wrap = (inst->op == ADD ?
+                      d->hi <= RANGE_MAX - b.hi : d->lo >= b.hi);
+      if (mark)
+        inst->no_wrap = no_wrap;
+      if (!no_wrap)
+        range_set(d, 0, RANGE_MAX);
+      else if (inst->op == ADD)
+        range_set(d, d->lo + b.lo, d->hi + b.hi);
+      else
+        range_set(d, d->lo - b.hi, d->hi - b.lo);
+      break;
+    }
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      range_set(d, 0, 1);
+      break;
+
+    case AND:
+      range_of_value(s, &inst->src, &b);
+      range_set(d, 0, range_min(d->hi, b.hi));
+      break;
+
+    case DIV:
+    case MOD:
+    case SHR:
+      range_set(d, 0, d->hi);
+      break;
+
+    case LOAD:
+    case GETC:
+    case MUL:
+    case OR:
+    case XOR:
+    case SHL:
+      range_set(d, 0, RANGE_MAX);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static Op range_negate(Op op) {
+  switch (op) {
+    case JEQ: return JNE;
+    case JNE: return JEQ;
+    case JLT: return JGE;
+    case JGT: return JLE;
+    case JLE: return JGT;
+    case JGE: return JLT;
+    default: return op;
+  }
+}
+
+// Narrows the dst of a conditional jump in |s| to the values for which
+// it is taken, or not taken if |taken| is false. Returns false if that
+// never happens.
+static bool range_refine(RangeState* s, Inst* inst, bool taken) {
+  if (inst->op == JMP)
+    return taken;
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  range_of_value(s, &inst->src, &b);
+  int lo = d->lo;
+  int hi = d->hi;
+  switch (taken ? inst->op : range_negate(inst->op)) {
+    case JEQ:
+      lo = range_max(lo, b.lo);
+      hi = range_min(hi, b.hi);
+      break;
+    case JNE:
+      if (b.lo != b.hi)
+        break;
+      if (lo == hi && lo == b.lo)
+        return false;
+      if (lo == b.lo)
+        lo++;
+      if (hi == b.lo)
+        hi--;
+      break;
+    case JLT:
+      if (b.hi == 0)
+        return false;
+      hi = range_min(hi, b.hi - 1);
+      break;
+    case JGT:
+      if (b.lo == RANGE_MAX)
+        return false;
+      lo = range_max(lo, b.lo + 1);
+      break;
+    case JLE:
+      hi = range_min(hi, b.hi);
+      break;
+    case JGE:
+      lo = range_max(lo, b.lo);
+      break;
+    default:
+      break;
+  }
+  if (lo > hi)
+    return false;
+  range_set(d, lo, hi);
+  return true;
+}
+
+// Widens |to| to include |from|. Returns whether |to| changed.
+static bool range_join(RangeState* to, RangeState* from, bool widen) {
+  if (!to->reached) {
+    *to = *from;
+    to->reached = true;
+    to->changes = 1;
+    return true;
+  }
+  widen &= to->changes >= RANGE_WIDEN_AFTER;
+  bool changed = false;
+  for (int i = 0; i < RANGE_NUM_REGS; i++) {
+    Range* t = &to->regs[i];
+    Range* f = &from->regs[i];
+    if (f->lo < t->lo) {
+      t->lo = widen ? 0 : f->lo;
+      changed = true;
+    }
+    if (f->hi > t->hi) {
+      t->hi = widen ? RANGE_MAX : f->hi;
+      changed = true;
+    }
+  }
+  if (changed)
+    to->changes++;
+  return changed;
+}
+
+// Runs the block at |pc| from its entry state in |in| and joins its exit
+// states into the entry states of its successors in |out|. Returns
+// whether any of them changed.
+static bool range_block(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, int pc, bool widen) {
+  BasicBlock* bb = &cfg->blocks[pc];
+  int num_pcs = cfg->module->num_pcs;
+  RangeState s = in[pc];
+  bool changed = false;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return changed;
+    if (inst->op < JEQ || inst->op > JMP) {
+      range_transfer(&s, inst, false);
+      continue;
+    }
+
+    RangeState t = s;
+    if (range_refine(&t, inst, true)) {
+      if (inst->jmp.type == REG) {
+        changed |= range_join(indirect, &t, widen);
+      } else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs) {
+        changed |= range_join(&out[inst->jmp.imm], &t, widen);
+      }
+    }
+    if (!range_refine(&s, inst, false))
+      return changed;
+  }
+  if (pc + 1 < num_pcs)
+    changed |= range_join(&out[pc + 1], &s, widen);
+  return changed;
+}
+
+// Runs every reached block once, joining into |out|, and joins the
+// states of register jumps into the address-taken blocks. Returns
+// whether |out| changed.
+static bool range_sweep(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, bool widen) {
+  bool changed = false;
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int pc = cfg->rpo[i];
+    if (pc != cfg->indirect && in[pc].reached)
+      changed |= range_block(cfg, in, out, indirect, pc, widen);
+  }
+  if (indirect->reached) {
+    for (int pc = 0; pc < cfg->module->num_pcs; pc++) {
+      if (cfg->blocks[pc].address_taken)
+        changed |= range_join(&out[pc], indirect, widen);
+    }
+  }
+  return changed;
+}
+
+static RangeState* range_new_states(int num_pcs) {
+  RangeState* states = calloc(num_pcs, sizeof(RangeState));
+  // Registers start at zero.
+  states[0].reached = true;
+  return states;
+}
+
+void analyze_ranges(Module* m) {
+  for (int i = 0; i < m->num_insts; i++)
+    m->insts[i].no_wrap = false;
+  if (!m->num_pcs)
+    return;
+
+  CFG* cfg = build_cfg(m);
+  RangeState* in = range_new_states(m->num_pcs);
+  RangeState indirect = {};
+  while (range_sweep(cfg, in, in, &indirect, true)) {}
+
+  // A sweep from a fixpoint gives a tighter one, so it is fine to stop
+  // after any round.
+  for (int round = 0; round < RANGE_NARROW_ROUNDS; round++) {
+    RangeState* next = range_new_states(m->num_pcs);
+    RangeState next_indirect = {};
+    range_sweep(cfg, in, next, &next_indirect, false);
+    free(in);
+    in = next;
+  }
+
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (!in[pc].reached)
+      continue;
+    BasicBlock* bb = &cfg->blocks[pc];
+    RangeState s = in[pc];
+    for (int i = 0; i < bb->num_insts; i++) {
+      Inst* inst = &bb->insts[i];
+      if (inst->op == EXIT || (inst->op >= JEQ && inst->op <= JMP))
+        break;
+      range_transfer(&s, inst, true);
+    }
+  }
+  free(in);
+  free_cfg(cfg);
+}
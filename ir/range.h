@@ -0,0 +1,14 @@
+#ifndef ELVM_RANGE_H_
+#define ELVM_RANGE_H_
+
+#include <ir/ir.h>
+
+// Computes an interval for every register at every pc reachable from
+// pc 0, starting from all registers being zero and narrowing registers
+// compared against at conditional jumps. Sets Inst.no_wrap on each ADD
+// and SUB whose result stays within 24 bits on every path, so backends
+// can skip masking it. Register jumps are assumed to reach any
+// address-taken pc with the registers of any register jump.
+void analyze_ranges(Module* m);
+
+#endif  // ELVM_RANGE_H_
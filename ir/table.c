@@ -3,20 +3,81 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __eir__
+#define TABLE_INIT_CAP 64
+#else
+#define TABLE_INIT_CAP 1024
+#endif
+
+TableStats table_stats;
+
+static unsigned int table_hash(const char* key) {
+  // FNV-1a, which spreads similar labels such as .L1 and .L2 well enough
+  // for linear probing.
+  unsigned int h = 2166136261u;
+  for (; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static TableEntry* table_find(Table* tbl, const char* key, unsigned int h) {
+  unsigned int mask = tbl->cap - 1;
+  for (unsigned int i = h & mask;; i = (i + 1) & mask) {
+    TableEntry* e = &tbl->entries[i];
+    table_stats.probes++;
+    if (!e->key)
+      return e;
+    if (e->key == key || (e->hash == h && !strcmp(e->key, key)))
+      return e;
+  }
+}
+
+static void table_grow(Table* tbl) {
+  TableEntry* old = tbl->entries;
+  int old_cap = tbl->cap;
+  tbl->cap = old_cap ? old_cap * 2 : TABLE_INIT_CAP;
+  tbl->entries = calloc(tbl->cap, sizeof(TableEntry));
+  for (int i = 0; i < old_cap; i++) {
+    if (old[i].key)
+      *table_find(tbl, old[i].key, old[i].hash) = old[i];
+  }
+  free(old);
+}
+
 Table* table_add(Table* tbl, const char* key, const void* value) {
-  Table* ntbl = malloc(sizeof(Table));
-  ntbl->next = tbl;
-  ntbl->key = key;
-  ntbl->value = value;
-  return ntbl;
+  if (!tbl)
+    tbl = calloc(1, sizeof(Table));
+  // Keep the load factor at most 1/2 so probe sequences stay short.
+  if ((tbl->size + 1) * 2 > tbl->cap)
+    table_grow(tbl);
+  unsigned int h = table_hash(key);
+  TableEntry* e = table_find(tbl, key, h);
+  if (!e->key) {
+    e->key = key;
+    e->hash = h;
+    tbl->size++;
+  }
+  e->value = value;
+  table_stats.adds++;
+  return tbl;
 }
 
 bool table_get(Table* tbl, const char* key, const void** value) {
-  for (; tbl; tbl = tbl->next) {
-    if (!strcmp(tbl->key, key)) {
-      *value = tbl->value;
-      return true;
-    }
-  }
-  return false;
+  table_stats.lookups++;
+  if (!tbl)
+    return false;
+  TableEntry* e = table_find(tbl, key, table_hash(key));
+  if (!e->key)
+    return false;
+  *value = e->value;
+  return true;
+}
+
+void table_free(Table* tbl) {
+  if (!tbl)
+    return;
+  free(tbl->entries);
+  free(tbl);
 }
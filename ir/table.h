@@ -3,14 +3,34 @@
 
 #include <stdbool.h>
 
-typedef struct Table_ {
+// An open-addressing hash table keyed by strings. Keys are not copied,
+// so they must outlive the table. Adding a key which is already in the
+// table overwrites its value.
+typedef struct {
   const char* key;
   const void* value;
-  struct Table_* next;
+  unsigned int hash;
+} TableEntry;
+
+typedef struct Table_ {
+  TableEntry* entries;
+  int cap;
+  int size;
 } Table;
 
+// Returns |tbl|, or a newly allocated table if |tbl| is NULL.
 Table* table_add(Table* tbl, const char* key, const void* value);
 
 bool table_get(Table* tbl, const char* key, const void** value);
 
+void table_free(Table* tbl);
+
+typedef struct {
+  int adds;
+  int lookups;
+  int probes;
+} TableStats;
+
+extern TableStats table_stats;
+
 #endif  // ELVM_TABLE_H_
@@ -21,6 +21,20 @@ void* memcpy(void* d, const void* s, size_t n) {
   return d;
 }
 
+void* memmove(void* d, const void* s, size_t n) {
+  size_t i;
+  if (d <= s) {
+    for (i = 0; i < n; i++) {
+      ((char*)d)[i] = ((char*)s)[i];
+    }
+  } else {
+    for (i = n; i > 0; i--) {
+      ((char*)d)[i-1] = ((char*)s)[i-1];
+    }
+  }
+  return d;
+}
+
 size_t strlen(const char* s) {
   size_t r;
   for (r = 0; s[r]; r++) {}
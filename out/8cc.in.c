@@ -0,0 +1,6 @@
+int putchar(int x);
+
+int main() {
+  putchar('X');
+  return 0;
+}
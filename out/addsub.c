@@ -0,0 +1,7 @@
+int putchar(int x);
+
+int main() {
+  putchar('5' + 3);
+  putchar('5' - 3);
+  return 0;
+}
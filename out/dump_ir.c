@@ -0,0 +1,4291 @@
+#include <stdlib.h>
+#include <string.h>
+#ifndef __eir__
+#include <time.h>
+#endif
+
+#include <ir/cfg.h>
+#include <ir/ir.h>
+#include <ir/live.h>
+#include <ir/pass.h>
+#include <ir/table.h>
+
+int main(int argc, char* argv[]) {
+#if defined(NOFILE) || defined(__eir__)
+  Module* m = load_eir(stdin);
+  // Host dump_ir.c.exe should dump to stdout for testing.
+  stderr = stdout;
+#else
+  bool show_load_stats = false;
+  bool show_lines = false;
+  bool show_cfg = false;
+  bool show_live = false;
+  bool show_pass_stats = false;
+  const char* binary_out = NULL;
+  const char* profile = NULL;
+  for (;;) {
+    if (argc >= 2 && !strcmp(argv[1], "-t")) {
+      show_load_stats = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-l")) {
+      show_lines = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-O")) {
+      add_passes("opt,merge");
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-passes=", 8)) {
+      add_passes(argv[1] + 8);
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-stats")) {
+      show_pass_stats = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-g")) {
+      show_cfg = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-live")) {
+      show_live = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-profile=", 9)) {
+      profile = argv[1] + 9;
+      argc--;
+      argv++;
+    } else if (argc >= 3 && !strcmp(argv[1], "-b")) {
+      binary_out = argv[2];
+      argc -= 2;
+      argv += 2;
+    } else {
+      break;
+    }
+  }
+
+  if (argc < 2) {
+    fprintf(stderr, "no input file\n");
+    exit(1);
+  }
+
+  clock_t start = clock();
+  Module* m = load_eir_from_file(argv[1]);
+  if (show_load_stats) {
+    fprintf(stderr, "load: %.3f ms, syms=%d lookups=%d probes=%d\n",
+            (clock() - start) * 1000.0 / CLOCKS_PER_SEC,
+            table_stats.adds, table_stats.lookups, table_stats.probes);
+    return 0;
+  }
+  if (show_lines) {
+    for (int pc = 0; pc < m->num_pcs; pc++) {
+      const char* file;
+      int line;
+      if (get_pc_source_loc(m, pc, &file, &line))
+        printf("pc=%d %s:%d\n", pc, file ? file : "?", line);
+    }
+    return 0;
+  }
+  if (profile)
+    load_pc_profile(m, profile);
+  run_passes(m, show_pass_stats);
+  if (show_cfg) {
+    CFG* cfg = build_cfg(m);
+    dump_cfg(cfg, stdout);
+    free_cfg(cfg);
+    return 0;
+  }
+  if (show_live) {
+    Liveness* lv = build_liveness(m);
+    dump_liveness(lv, stdout);
+    free_liveness(lv);
+    return 0;
+  }
+  if (binary_out) {
+    FILE* fp = fopen(binary_out, "wb");
+    if (!fp) {
+      fprintf(stderr, "cannot open %s\n", binary_out);
+      exit(1);
+    }
+    write_eir_binary(m, fp);
+    fclose(fp);
+    return 0;
+  }
+#endif
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    dump_inst(inst);
+  }
+  return 0;
+}
+#include <ir/ir.h>
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/arena.h>
+#include <ir/table.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+# define IR_USE_MMAP
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+typedef struct DataPrivate_ {
+  int v;
+  struct DataPrivate_* next;
+  LabelType label;
+  Value val;
+  int lineno;
+} DataPrivate;
+
+typedef struct SymbolPrivate_ {
+  Symbol sym;
+  struct SymbolPrivate_* next;
+} SymbolPrivate;
+
+// The entry jump goes to pc 1 if the program has no main.
+static Symbol default_main = { "main", 1, true };
+
+typedef struct LocPrivate_ {
+  SourceLoc loc;
+  struct LocPrivate_* next;
+} LocPrivate;
+
+typedef struct FilePrivate_ {
+  int num;
+  const char* name;
+  struct FilePrivate_* next;
+} FilePrivate;
+
+typedef struct {
+  const char* filename;
+  int lineno;
+  int col;
+  FILE* fp;
+  const char* buf;
+  const char* cur;
+  const char* end;
+  Table* symtab;
+  Table* strtab;
+  Arena* arena;
+  SymbolPrivate sym_root;
+  SymbolPrivate* syms;
+  int num_syms;
+  LocPrivate loc_root;
+  LocPrivate* locs;
+  int num_locs;
+  int loc;
+  FilePrivate file_root;
+  FilePrivate* files;
+  int num_files;
+  int in_text;
+  Inst* text;
+  int pc;
+  int subsection;
+  DataPrivate* data;
+  bool prev_boundary;
+} Parser;
+
+enum {
+  DATA = LAST_OP + 1, TEXT, LONG, STRING, FILENAME, LOC
+};
+
+enum {
+  REF = IMM + 1, LABEL
+};
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void ir_error(Parser* p, const char* msg) {
+  fprintf(stderr, "%s:%d:%d: %s\n", p->filename, p->lineno, p->col, msg);
+  exit(1);
+}
+
+// When the whole input is in memory (|buf| is set), the lexer scans it
+// with a pointer. Otherwise it reads |fp| one character at a time.
+static int ir_getc(Parser* p) {
+  int c;
+  if (p->buf) {
+    c = p->cur < p->end ? (unsigned char)*p->cur++ : EOF;
+  } else {
+    c = fgetc(p->fp);
+  }
+  if (c == '\n') {
+    p->lineno++;
+    p->col = 0;
+  } else {
+    p->col++;
+  }
+  return c;
+}
+
+static void ir_ungetc(Parser* p, int c) {
+  if (c == '\n') {
+    p->lineno--;
+  }
+  if (p->buf) {
+    if (c != EOF)
+      p->cur--;
+  } else {
+    ungetc(c, p->fp);
+  }
+}
+
+static int peek(Parser* p) {
+  if (p->buf)
+    return p->cur < p->end ? (unsigned char)*p->cur : EOF;
+  int c = fgetc(p->fp);
+  ungetc(c, p->fp);
+  return c;
+}
+
+static bool is_ident_char(int c) {
+  return isalnum(c) || c == '_' || c == '.';
+}
+
+static void skip_until_ret(Parser* p) {
+  if (p->buf) {
+    // ELVM's libc has no memchr.
+    const char* e = p->cur;
+    while (e < p->end && *e != '\n')
+      e++;
+    p->col += e - p->cur;
+    p->cur = e;
+    return;
+  }
+
+  int c;
+  for (;;) {
+    c = ir_getc(p);
+    if (c == '\n' || c == EOF)
+      break;
+  }
+  ir_ungetc(p, c);
+}
+
+static void skip_ws(Parser* p) {
+  if (p->buf) {
+    const char* q = p->cur;
+    for (; q < p->end && isspace((unsigned char)*q); q++) {
+      if (*q == '\n') {
+        p->lineno++;
+        p->col = 0;
+      } else {
+        p->col++;
+      }
+    }
+    p->cur = q;
+    return;
+  }
+
+  int c;
+  for (;;) {
+    c = ir_getc(p);
+    if (!isspace(c))
+      break;
+  }
+  ir_ungetc(p, c);
+}
+
+static void read_while_ident(Parser* p, char* buf, int len) {
+  if (p->buf) {
+    const char* q = p->cur;
+    const char* e = p->end - q > len ? q + len : p->end;
+    for (; q < e && is_ident_char((unsigned char)*q); q++) {}
+    int n = q - p->cur;
+    if (n == len)
+      ir_error(p, "too long ident");
+    memcpy(buf, p->cur, n);
+    buf[n] = 0;
+    p->col += n;
+    p->cur = q;
+    return;
+  }
+
+  while (len--) {
+    int c = ir_getc(p);
+    if (!is_ident_char(c)) {
+      ir_ungetc(p, c);
+      *buf = 0;
+      return;
+    }
+    *buf++ = c;
+  }
+  ir_error(p, "too long ident");
+}
+
+static int read_int(Parser* p, int c) {
+  bool is_minus = false;
+  int r = 0;
+  if (c == '-') {
+    is_minus = true;
+    c = ir_getc(p);
+    if (!isdigit(c))
+      ir_error(p, "digit expected");
+  }
+  if (p->buf) {
+    const char* q = p->cur;
+    r = c - '0';
+    for (; q < p->end && '0' <= *q && *q <= '9'; q++) {
+      r *= 10;
+      r += *q - '0';
+    }
+    p->col += q - p->cur;
+    p->cur = q;
+    return is_minus ? -r : r;
+  }
+  while ('0' <= c && c <= '9') {
+    r *= 10;
+    r += c - '0';
+    c = ir_getc(p);
+  }
+  ir_ungetc(p, c);
+  return is_minus ? -r : r;
+}
+
+// Returns a copy of |s| owned by the module. Every occurrence of the
+// same name shares one copy.
+static const char* intern(Parser* p, const char* s) {
+  const void* r;
+  if (table_get(p->strtab, s, &r))
+    return r;
+  char* n = arena_strdup(p->arena, s);
+  p->strtab = table_add(p->strtab, n, n);
+  return n;
+}
+
+static void add_sym(Parser* p, const char* name, int value, bool is_text) {
+  SymbolPrivate* s = arena_alloc(p->arena, sizeof(SymbolPrivate));
+  s->sym.name = name;
+  s->sym.value = value;
+  s->sym.is_text = is_text;
+  p->symtab = table_add(p->symtab, name, &s->sym);
+  p->syms->next = s;
+  p->syms = s;
+  p->num_syms++;
+}
+
+static DataPrivate* add_data(Parser* p) {
+  DataPrivate* n = arena_alloc(p->arena, sizeof(DataPrivate));
+  n->v = p->subsection;
+  n->lineno = p->lineno;
+  p->data->next = n;
+  p->data = n;
+  return n;
+}
+
+static void add_imm_data(Parser* p, int v) {
+  DataPrivate* n = add_data(p);
+  n->val.type = IMM;
+  n->val.imm = v;
+}
+
+typedef struct {
+  int subsection;
+  DataPrivate* head;
+  DataPrivate* tail;
+} DataBucket;
+
+static DataBucket* find_data_bucket(DataBucket* buckets, int cap,
+                                    int subsection) {
+  int mask = cap - 1;
+  for (int i = subsection & mask;; i = (i + 1) & mask) {
+    if (!buckets[i].head || buckets[i].subsection == subsection)
+      return &buckets[i];
+  }
+}
+
+static int compare_data_buckets(const void* a, const void* b) {
+  int x = ((const DataBucket*)a)->subsection;
+  int y = ((const DataBucket*)b)->subsection;
+  return x < y ? -1 : x > y;
+}
+
+// Lays out data by ascending subsection, keeping the order of entries
+// within a subsection. Entries are bucketed in a single pass, so this
+// is linear in the number of data words plus sorting the subsections.
+static void serialize_data(Parser* p, DataPrivate* data_root) {
+  int cap = 16;
+  int num_buckets = 0;
+  DataBucket* buckets = calloc(cap, sizeof(DataBucket));
+  DataBucket* last = NULL;
+  for (DataPrivate* data = data_root->next; data;) {
+    DataPrivate* next = data->next;
+    data->next = 0;
+    if (!last || last->subsection != data->v) {
+      last = find_data_bucket(buckets, cap, data->v);
+      if (!last->head) {
+        if ((num_buckets + 1) * 2 > cap) {
+          DataBucket* old = buckets;
+          buckets = calloc(cap * 2, sizeof(DataBucket));
+          for (int i = 0; i < cap; i++) {
+            if (old[i].head)
+              *find_data_bucket(buckets, cap * 2, old[i].subsection) = old[i];
+          }
+          cap *= 2;
+          free(old);
+          last = find_data_bucket(buckets, cap, data->v);
+        }
+        last->subsection = data->v;
+        last->head = data;
+        last->tail = data;
+        num_buckets++;
+        data = next;
+        continue;
+      }
+    }
+    last->tail->next = data;
+    last->tail = data;
+    data = next;
+  }
+
+  int n = 0;
+  for (int i = 0; i < cap; i++) {
+    if (buckets[i].head)
+      buckets[n++] = buckets[i];
+  }
+  qsort(buckets, n, sizeof(DataBucket), compare_data_buckets);
+
+  DataPrivate serialized_root = {};
+  DataPrivate* serialized = &serialized_root;
+  intptr_t mp = 0;
+  for (int i = 0; i < n; i++) {
+    for (DataPrivate* data = buckets[i].head; data;) {
+      DataPrivate* next = data->next;
+      if (data->val.type == (ValueType)LABEL) {
+        add_sym(p, data->val.tmp, mp, false);
+      } else {
+        serialized->next = data;
+        serialized = data;
+        serialized->next = 0;
+        mp++;
+      }
+      data = next;
+    }
+  }
+  free(buckets);
+
+  add_sym(p, "_edata", mp, false);
+  serialized->next = arena_alloc(p->arena, sizeof(DataPrivate));
+  serialized->next->v = mp + 1;
+  serialized->next->val.type = IMM;
+  serialized->next->val.imm = mp + 1;
+  data_root->next = serialized_root.next;
+}
+
+// Dispatches on the first character so each op name is compared with
+// at most a few candidates.
+static Op get_op(Parser* p, const char* buf) {
+  if (peek(p) == ':')
+    return OP_UNSET;
+  switch (buf[0]) {
+    case 'a':
+      if (!strcmp(buf, "add")) return ADD;
+      if (!strcmp(buf, "and")) return AND;
+      break;
+    case 'c':
+      if (!strcmp(buf, "copy")) return COPY;
+      break;
+    case 'd':
+      if (!strcmp(buf, "dump")) return DUMP;
+      if (!strcmp(buf, "div")) return DIV;
+      break;
+    case 'e':
+      if (!strcmp(buf, "exit")) return EXIT;
+      if (!strcmp(buf, "eq")) return EQ;
+      break;
+    case 'f':
+      if (!strcmp(buf, "fill")) return FILL;
+      break;
+    case 'g':
+      if (buf[1] == 'e' && !buf[2]) return GE;
+      if (buf[1] == 't' && !buf[2]) return GT;
+      if (!strcmp(buf, "getc")) return GETC;
+      break;
+    case 'j':
+      switch (buf[1]) {
+        case 'e':
+          if (buf[2] == 'q' && !buf[3]) return JEQ;
+          break;
+        case 'n':
+          if (buf[2] == 'e' && !buf[3]) return JNE;
+          break;
+        case 'l':
+          if (buf[2] == 't' && !buf[3]) return JLT;
+          if (buf[2] == 'e' && !buf[3]) return JLE;
+          break;
+        case 'g':
+          if (buf[2] == 't' && !buf[3]) return JGT;
+          if (buf[2] == 'e' && !buf[3]) return JGE;
+          break;
+        case 'm':
+          if (buf[2] == 'p' && !buf[3]) return JMP;
+          break;
+      }
+      break;
+    case 'l':
+      if (buf[1] == 't' && !buf[2]) return LT;
+      if (buf[1] == 'e' && !buf[2]) return LE;
+      if (!strcmp(buf, "load")) return LOAD;
+      break;
+    case 'm':
+      if (!strcmp(buf, "mov")) return MOV;
+      if (!strcmp(buf, "mul")) return MUL;
+      if (!strcmp(buf, "mod")) return MOD;
+      break;
+    case 'n':
+      if (!strcmp(buf, "ne")) return NE;
+      break;
+    case 'o':
+      if (!strcmp(buf, "or")) return OR;
+      break;
+    case 'p':
+      if (!strcmp(buf, "putc")) return PUTC;
+      break;
+    case 's':
+      if (!strcmp(buf, "sub")) return SUB;
+      if (!strcmp(buf, "store")) return STORE;
+      if (!strcmp(buf, "shl")) return SHL;
+      if (!strcmp(buf, "shr")) return SHR;
+      break;
+    case 'x':
+      if (!strcmp(buf, "xor")) return XOR;
+      break;
+    case '.':
+      switch (buf[1]) {
+        case 't':
+          if (!strcmp(buf, ".text")) return (Op)TEXT;
+          break;
+        case 'd':
+          if (!strcmp(buf, ".data")) return (Op)DATA;
+          break;
+        case 'l':
+          if (!strcmp(buf, ".long")) return (Op)LONG;
+          if (!strcmp(buf, ".loc")) return (Op)LOC;
+          break;
+        case 's':
+          if (!strcmp(buf, ".string")) return (Op)STRING;
+          break;
+        case 'f':
+          if (!strcmp(buf, ".file")) return (Op)FILENAME;
+          break;
+      }
+      break;
+  }
+  return OP_UNSET;
+}
+
+static bool get_reg(const char* buf, Reg* r) {
+  if (!buf[1]) {
+    if (buf[0] >= 'A' && buf[0] <= 'D') {
+      *r = (Reg)(A + buf[0] - 'A');
+      return true;
+    }
+  } else if (buf[1] == 'P' && !buf[2]) {
+    if (buf[0] == 'S') {
+      *r = SP;
+      return true;
+    } else if (buf[0] == 'B') {
+      *r = BP;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int read_escape(Parser* p) {
+  int c = ir_getc(p);
+  if (c == 'n') {
+    c = '\n';
+  } else if (c == 't') {
+    c = '\t';
+  } else if (c == 'b') {
+    c = '\b';
+  } else if (c == 'f') {
+    c = '\f';
+  } else if (c == 'r') {
+    c = '\r';
+  } else if (c == '\"') {
+    c = '\"';
+  } else if (c == '\\') {
+    c = '\\';
+  } else if (c == 'x') {
+    char b[3];
+    b[0] = ir_getc(p);
+    c = ir_getc(p);
+    if (!((c >= '0' && c <= '9') ||
+          (c >= 'a' && c <= 'f') ||
+          (c >= 'A' && c <= 'F'))) {
+      ir_ungetc(p, c);
+      c = 0;
+    }
+    b[1] = c;
+    b[2] = 0;
+    c = strtoul(b, NULL, 16);
+  } else {
+    ir_error(p, "unknown escape");
+  }
+  return c;
+}
+
+// .file [n] "name"
+static void parse_file(Parser* p) {
+  char buf[1024];
+  int num = 0;
+  skip_ws(p);
+  int c = ir_getc(p);
+  if (isdigit(c)) {
+    num = read_int(p, c);
+    skip_ws(p);
+    c = ir_getc(p);
+  }
+  if (c != '"')
+    ir_error(p, "expected open '\"'");
+  int len = 0;
+  for (c = ir_getc(p); c != '"'; c = ir_getc(p)) {
+    if (c == '\n' || c == EOF)
+      ir_error(p, "unterminated file name");
+    if (c == '\\')
+      c = read_escape(p);
+    if (len == (int)sizeof(buf) - 1)
+      ir_error(p, "too long file name");
+    buf[len++] = c;
+  }
+  buf[len] = 0;
+
+  FilePrivate* f = arena_alloc(p->arena, sizeof(FilePrivate));
+  f->num = num;
+  f->name = intern(p, buf);
+  p->files->next = f;
+  p->files = f;
+  if (p->num_files <= num)
+    p->num_files = num + 1;
+  skip_until_ret(p);
+}
+
+// .loc file line [column]
+static void parse_loc(Parser* p) {
+  int v[2];
+  for (int i = 0; i < 2; i++) {
+    skip_ws(p);
+    int c = ir_getc(p);
+    if (!isdigit(c))
+      ir_error(p, "number expected");
+    v[i] = read_int(p, c);
+  }
+  skip_until_ret(p);
+
+  SourceLoc* cur = &p->locs->loc;
+  if (p->loc && cur->file == v[0] && cur->line == v[1])
+    return;
+  LocPrivate* l = arena_alloc(p->arena, sizeof(LocPrivate));
+  l->loc.file = v[0];
+  l->loc.line = v[1];
+  p->locs->next = l;
+  p->locs = l;
+  p->loc = p->num_locs++;
+}
+
+static void parse_line(Parser* p, int c) {
+  char buf[64];
+  buf[0] = c;
+  read_while_ident(p, buf + 1, 62);
+  Op op = get_op(p, buf);
+  if (op == (Op)TEXT) {
+    p->in_text = 1;
+    return;
+  } else if (op == (Op)STRING) {
+    if (p->in_text)
+      ir_error(p, "in text");
+    skip_ws(p);
+    if (ir_getc(p) != '"')
+      ir_error(p, "expected open '\"'");
+
+    c = ir_getc(p);
+    while (c != '"') {
+      if (c == '\\')
+        c = read_escape(p);
+      add_imm_data(p, c);
+      c = ir_getc(p);
+    }
+    add_imm_data(p, 0);
+    return;
+  } else if (op == (Op)FILENAME) {
+    parse_file(p);
+    return;
+  } else if (op == (Op)LOC) {
+    parse_loc(p);
+    return;
+  } else if (op == OP_UNSET) {
+    c = ir_getc(p);
+    if (c == ':') {
+      intptr_t value = 0;
+      if (p->in_text) {
+        if (!p->prev_boundary)
+          p->pc++;
+        value = p->pc;
+        p->prev_boundary = true;
+        add_sym(p, intern(p, buf), value, true);
+      } else {
+        DataPrivate* d = add_data(p);
+        d->val.type = (ValueType)LABEL;
+        d->val.tmp = (void*)intern(p, buf);
+      }
+      return;
+    }
+    ir_error(p, "unknown op");
+  }
+
+  if (op < 0) {
+    ir_error(p, "oops");
+  }
+  int argc;
+  if (op <= STORE)
+    argc = 2;
+  else if (op <= GETC)
+    argc = 1;
+  else if (op <= EXIT)
+    argc = 0;
+  else if (op <= JGE)
+    argc = 3;
+  else if (op <= JMP)
+    argc = 1;
+  else if (op <= GE)
+    argc = 2;
+  else if (op == DUMP)
+    argc = 0;
+  else if (op <= SHR)
+    argc = 2;
+  else if (op <= FILL)
+    argc = 3;
+  else if (op == (Op)LONG)
+    argc = 1;
+  else if (op == (Op)DATA) {
+    skip_ws(p);
+    c = peek(p);
+    argc = c == '-' || isdigit(c) ? 1 : 0;
+  } else
+    ir_error(p, "oops");
+
+  Value args[3];
+  for (int i = 0; i < argc; i++) {
+    skip_ws(p);
+    if (i) {
+      c = ir_getc(p);
+      if (c != ',')
+        ir_error(p, "comma expected");
+      skip_ws(p);
+    }
+
+    Value a;
+    a.label = NOT_LABEL;
+    c = ir_getc(p);
+    if (isdigit(c) || c == '-') {
+      a.type = IMM;
+      a.imm = MOD24(read_int(p, c));
+    } else {
+      buf[0] = c;
+      read_while_ident(p, buf + 1, 62);
+      a.type = REG;
+      if (!get_reg(buf, &a.reg)) {
+        a.type = (ValueType)REF;
+        a.tmp = (void*)intern(p, buf);
+      }
+    }
+    args[i] = a;
+  }
+
+  if (op == (Op)LONG) {
+    if (args[0].type == IMM) {
+      add_imm_data(p, args[0].imm);
+    } else if (args[0].type == (ValueType)REF) {
+      DataPrivate* d = add_data(p);
+      d->val.type = (ValueType)REF;
+      d->val.tmp = args[0].tmp;
+    } else {
+      ir_error(p, "number expected");
+    }
+    return;
+  } else if (op == (Op)DATA) {
+    if (argc == 1) {
+      if (args[0].type != IMM)
+        ir_error(p, "number expected");
+      p->subsection = args[0].imm;
+    }
+    p->in_text = 0;
+    return;
+  }
+
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = op;
+  p->text->pc = p->pc;
+  p->text->lineno = p->lineno;
+  p->text->loc = p->loc;
+  p->prev_boundary = false;
+  switch (op) {
+    case LOAD:
+    case STORE:
+    case MOV:
+    case ADD:
+    case SUB:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      p->text->src = args[1];
+      FALLTHROUGH;
+    case GETC:
+      p->text->dst = args[0];
+      break;
+    case PUTC:
+      p->text->src = args[0];
+      break;
+    case COPY:
+    case FILL:
+      p->text->dst = args[0];
+      p->text->src = args[1];
+      p->text->jmp = args[2];
+      break;
+    case EXIT:
+    case DUMP:
+      break;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      p->text->dst = args[1];
+      p->text->src = args[2];
+      FALLTHROUGH;
+    case JMP:
+      p->text->jmp = args[0];
+      p->pc++;
+      p->prev_boundary = true;
+      break;
+    default:
+      ir_error(p, "oops");
+  }
+
+#if 0
+  dump_inst(p->text);
+#endif
+}
+
+static void parse_eir(Parser* p) {
+  Inst text_root = {};
+  DataPrivate data_root = {};
+  int c;
+
+  p->in_text = 1;
+  p->lineno = 1;
+  p->text = &text_root;
+  p->data = &data_root;
+  p->syms = &p->sym_root;
+  p->locs = &p->loc_root;
+  p->num_locs = 1;
+  p->files = &p->file_root;
+  p->pc = 0;
+  p->prev_boundary = true;
+
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = JMP;
+  p->text->pc = p->pc++;
+  p->text->lineno = -1;
+  p->text->jmp.type = (ValueType)REF;
+  p->text->jmp.tmp = "main";
+  p->text->next = 0;
+  p->symtab = table_add(p->symtab, "main", &default_main);
+
+  for (;;) {
+    skip_ws(p);
+    c = ir_getc(p);
+    if (c == EOF)
+      break;
+
+    if (c == '#') {
+      skip_until_ret(p);
+    } else if (c == '_' || c == '.' || isalpha(c)) {
+      parse_line(p, c);
+    } else {
+      ir_error(p, "unexpected char");
+    }
+  }
+
+  serialize_data(p, &data_root);
+  p->text = text_root.next;
+  p->data = data_root.next;
+}
+
+static void resolve(Value* v, Table* symtab) {
+  if (v->type != (ValueType)REF)
+    return;
+  const char* name = (const char*)v->tmp;
+  Symbol* sym;
+  if (!table_get(symtab, name, (void*)&sym)) {
+    fprintf(stderr, "undefined sym: %s\n", name);
+    exit(1);
+  }
+  //fprintf(stderr, "resolved: %s %d\n", name, sym->value);
+  v->type = IMM;
+  v->imm = sym->value;
+  v->label = sym->is_text ? TEXT_LABEL : DATA_LABEL;
+}
+
+static void resolve_syms(Parser* p) {
+  for (DataPrivate* data = p->data; data; data = data->next) {
+    if (data->val.type == (ValueType)REF) {
+      resolve(&data->val, p->symtab);
+    }
+    data->v = MOD24(data->val.imm);
+    data->label = data->val.label;
+  }
+
+  for (Inst* inst = p->text; inst; inst = inst->next) {
+    resolve(&inst->dst, p->symtab);
+    resolve(&inst->src, p->symtab);
+    resolve(&inst->jmp, p->symtab);
+  }
+}
+
+static Module* load_eir_impl(const char* filename, FILE* fp,
+                             const char* buf, size_t size) {
+  Parser parser = {
+    .filename = filename,
+    .fp = fp,
+    .buf = buf,
+    .cur = buf,
+    .end = buf + size,
+    .arena = arena_new()
+  };
+  parse_eir(&parser);
+  resolve_syms(&parser);
+  table_free(parser.symtab);
+  table_free(parser.strtab);
+
+  Module* m = arena_alloc(parser.arena, sizeof(Module));
+  m->text = parser.text;
+  m->data = (Data*)parser.data;
+  m->arena = parser.arena;
+  m->syms = arena_alloc(m->arena, sizeof(Symbol) * parser.num_syms);
+  m->num_syms = parser.num_syms;
+  int i = 0;
+  for (SymbolPrivate* s = parser.sym_root.next; s; s = s->next)
+    m->syms[i++] = s->sym;
+
+  m->files = arena_alloc(m->arena, sizeof(char*) * parser.num_files);
+  m->num_files = parser.num_files;
+  for (FilePrivate* f = parser.file_root.next; f; f = f->next)
+    m->files[f->num] = f->name;
+  m->locs = arena_alloc(m->arena, sizeof(SourceLoc) * parser.num_locs);
+  m->num_locs = parser.num_locs;
+  m->locs[0].file = -1;
+  i = 1;
+  for (LocPrivate* l = parser.loc_root.next; l; l = l->next)
+    m->locs[i++] = l->loc;
+
+  reindex_module(m);
+  return m;
+}
+
+bool get_inst_source_loc(Module* m, Inst* inst,
+                         const char** file, int* line) {
+  if (inst->loc <= 0 || inst->loc >= m->num_locs)
+    return false;
+  SourceLoc* l = &m->locs[inst->loc];
+  *file = l->file < m->num_files ? m->files[l->file] : NULL;
+  *line = l->line;
+  return true;
+}
+
+bool get_pc_source_loc(Module* m, int pc, const char** file, int* line) {
+  if (pc < 0 || pc >= m->num_pcs || m->pc_start[pc] == m->pc_start[pc + 1])
+    return false;
+  return get_inst_source_loc(m, &m->insts[m->pc_start[pc]], file, line);
+}
+
+void reindex_module(Module* m) {
+  int n = 0;
+  int num_pcs = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    n++;
+    num_pcs = inst->pc + 1;
+  }
+
+  Inst* insts = arena_alloc(m->arena, sizeof(Inst) * n);
+  int* pc_start = arena_alloc(m->arena, sizeof(int) * (num_pcs + 1));
+  int i = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next, i++) {
+    insts[i] = *inst;
+    insts[i].next = i + 1 < n ? &insts[i + 1] : NULL;
+    for (; pc <= inst->pc; pc++)
+      pc_start[pc] = i;
+  }
+  for (; pc <= num_pcs; pc++)
+    pc_start[pc] = n;
+
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = num_pcs;
+}
+
+void free_module(Module* m) {
+#ifdef IR_USE_MMAP
+  if (m->map)
+    munmap(m->map, m->map_size);
+#endif
+  // |m| itself lives in the arena.
+  arena_free(m->arena);
+}
+
+Module* load_eir(FILE* fp) {
+  return load_eir_impl("<stdin>", fp, NULL, 0);
+}
+
+#ifdef IR_USE_MMAP
+
+// Maps the whole file so the lexer can scan it without stdio.
+Module* load_eir_from_file(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    // Pipes and devices cannot be mapped.
+    close(fd);
+    FILE* fp = fopen(filename, "r");
+    Module* r = load_eir_impl(filename, fp, NULL, 0);
+    fclose(fp);
+    return r;
+  }
+
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return load_eir_impl(filename, NULL, "", 0);
+  }
+  char* buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  if (is_eir_binary(buf, size))
+    return load_eir_binary(filename, buf, size);
+  Module* r = load_eir_impl(filename, NULL, buf, size);
+  munmap(buf, size);
+  return r;
+}
+
+#else
+
+Module* load_eir_from_file(const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  Module* r = load_eir_impl(filename, fp, NULL, 0);
+  fclose(fp);
+  return r;
+}
+
+#endif
+
+bool is_ext_op(Op op) {
+  return op >= MUL && op <= SHR;
+}
+
+int eval_ext_op(Op op, int dst, int src) {
+  unsigned int d = dst;
+  unsigned int s = src;
+  switch (op) {
+    case MUL:
+      return MOD24(d * s);
+    case DIV:
+      return s ? d / s : 0;
+    case MOD:
+      return s ? d % s : d;
+    case AND:
+      return d & s;
+    case OR:
+      return d | s;
+    case XOR:
+      return d ^ s;
+    case SHL:
+      return s < 24 ? MOD24(d << s) : 0;
+    case SHR:
+      return s < 24 ? d >> s : 0;
+    default:
+      return 0;
+  }
+}
+
+void dump_op(Op op, FILE* fp) {
+  static const char* op_strs[] = {
+    "mov", "add", "sub", "load", "store", "putc", "getc", "exit",
+    "jeq", "jne", "jlt", "jgt", "jle", "jge", "jmp", "xxx",
+    "eq", "ne", "lt", "gt", "le", "ge", "dump",
+    "mul", "div", "mod", "and", "or", "xor", "shl", "shr",
+    "copy", "fill"
+  };
+  fprintf(fp, "%s", op_strs[op]);
+}
+
+void dump_val(Value* val, FILE* fp) {
+  static const char* reg_strs[] = {
+    "A", "B", "C", "D", "BP", "SP"
+  };
+  if (val->type == REG) {
+    fprintf(fp, "%s", reg_strs[val->reg]);
+  } else if (val->type == IMM) {
+    fprintf(fp, "%d", val->imm);
+  } else {
+    fprintf(fp, "%d (type=%d)", val->imm, val->type);
+  }
+}
+
+void dump_inst_fp(Inst* inst, FILE* fp) {
+  dump_op(inst->op, fp);
+  switch (inst->op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case STORE:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case PUTC:
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case GETC:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      break;
+    case EXIT:
+    case DUMP:
+      break;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case JMP:
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
+    case COPY:
+    case FILL:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
+    default:
+      fprintf(fp, "oops op=%d\n", inst->op);
+      exit(1);
+  }
+  if (inst->no_wrap)
+    fprintf(fp, " nowrap");
+  fprintf(fp, " pc=%d @", inst->pc);
+  int lineno = inst->lineno;
+  // A hack to make the test for dump_ir.c.eir pass.
+#ifndef __eir__
+  lineno &= UINT_MAX;
+#endif
+  fprintf(fp, "%d\n", lineno);
+}
+
+void dump_inst(Inst* inst) {
+  dump_inst_fp(inst, stderr);
+}
+#include <ir/table.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define TABLE_INIT_CAP 64
+#else
+#define TABLE_INIT_CAP 1024
+#endif
+
+TableStats table_stats;
+
+static unsigned int table_hash(const char* key) {
+  // FNV-1a, which spreads similar labels such as .L1 and .L2 well enough
+  // for linear probing.
+  unsigned int h = 2166136261u;
+  for (; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static TableEntry* table_find(Table* tbl, const char* key, unsigned int h) {
+  unsigned int mask = tbl->cap - 1;
+  for (unsigned int i = h & mask;; i = (i + 1) & mask) {
+    TableEntry* e = &tbl->entries[i];
+    table_stats.probes++;
+    if (!e->key)
+      return e;
+    if (e->key == key || (e->hash == h && !strcmp(e->key, key)))
+      return e;
+  }
+}
+
+static void table_grow(Table* tbl) {
+  TableEntry* old = tbl->entries;
+  int old_cap = tbl->cap;
+  tbl->cap = old_cap ? old_cap * 2 : TABLE_INIT_CAP;
+  tbl->entries = calloc(tbl->cap, sizeof(TableEntry));
+  for (int i = 0; i < old_cap; i++) {
+    if (old[i].key)
+      *table_find(tbl, old[i].key, old[i].hash) = old[i];
+  }
+  free(old);
+}
+
+Table* table_add(Table* tbl, const char* key, const void* value) {
+  if (!tbl)
+    tbl = calloc(1, sizeof(Table));
+  // Keep the load factor at most 1/2 so probe sequences stay short.
+  if ((tbl->size + 1) * 2 > tbl->cap)
+    table_grow(tbl);
+  unsigned int h = table_hash(key);
+  TableEntry* e = table_find(tbl, key, h);
+  if (!e->key) {
+    e->key = key;
+    e->hash = h;
+    tbl->size++;
+  }
+  e->value = value;
+  table_stats.adds++;
+  return tbl;
+}
+
+bool table_get(Table* tbl, const char* key, const void** value) {
+  table_stats.lookups++;
+  if (!tbl)
+    return false;
+  TableEntry* e = table_find(tbl, key, table_hash(key));
+  if (!e->key)
+    return false;
+  *value = e->value;
+  return true;
+}
+
+void table_free(Table* tbl) {
+  if (!tbl)
+    return;
+  free(tbl->entries);
+  free(tbl);
+}
+#include <ir/arena.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN(n) (n)
+#else
+#define ARENA_CHUNK_SIZE (256 * 1024)
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#endif
+
+Arena* arena_new(void) {
+  return calloc(1, sizeof(Arena));
+}
+
+static ArenaChunk* arena_add_chunk(Arena* arena, size_t size) {
+  ArenaChunk* chunk = malloc(sizeof(ArenaChunk));
+  chunk->buf = calloc(1, size);
+  chunk->used = 0;
+  chunk->size = size;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  return chunk;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  ArenaChunk* chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size) {
+    if (size > ARENA_CHUNK_SIZE / 4) {
+      // Give big objects their own chunk and keep filling the current one.
+      ArenaChunk* big = arena_add_chunk(arena, size);
+      if (chunk) {
+        arena->chunks = chunk;
+        big->next = chunk->next;
+        chunk->next = big;
+      }
+      big->used = size;
+      return big->buf;
+    }
+    chunk = arena_add_chunk(arena, ARENA_CHUNK_SIZE);
+  }
+  void* r = chunk->buf + chunk->used;
+  chunk->used += size;
+  return r;
+}
+
+char* arena_strdup(Arena* arena, const char* s) {
+  size_t n = strlen(s) + 1;
+  char* r = arena_alloc(arena, n);
+  memcpy(r, s, n);
+  return r;
+}
+
+void arena_free(Arena* arena) {
+  if (!arena)
+    return;
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk* next = chunk->next;
+    free(chunk->buf);
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+#include <ir/ir.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <ir/arena.h>
+
+// Binary EIR layout. All fields are host-endian 32-bit integers unless
+// noted, and every section starts right after the previous one.
+//
+//   EirbHeader
+//   EirbInst     insts[num_insts]
+//   int32        pc_start[num_pcs + 1]
+//   EirbData     data[num_data]
+//   EirbSymbol   syms[num_syms]
+//   SourceLoc    locs[num_locs]
+//   uint32       files[num_files]     (strtab offsets, or ~0 for none)
+//   char         strtab[strtab_size]  (NUL-terminated names)
+//
+// Operands are already resolved, so the loader does not parse. It still
+// decodes the instruction and data records into new Inst and Data
+// arrays, since their layout differs from the records. Only pc_start,
+// locs and the names are used in place from the mapping. Every index
+// in the file is checked before use, so a broken file is an error
+// rather than a bad read later.
+
+// Text EIR never contains DEL, so the magic cannot be a valid text file.
+#define EIRB_MAGIC "\177EIR"
+#define EIRB_VERSION 3
+#define EIRB_NO_FILE 0xffffffffu
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_insts;
+  uint32_t num_pcs;
+  uint32_t num_data;
+  uint32_t num_syms;
+  uint32_t num_locs;
+  uint32_t num_files;
+  uint32_t strtab_size;
+} EirbHeader;
+
+typedef struct {
+  uint8_t op;
+  // ValueType of dst, src, and jmp in the low nibble and LabelType in
+  // the high nibble.
+  uint8_t types[3];
+  int32_t vals[3];
+  int32_t pc;
+  int32_t lineno;
+  int32_t loc;
+} EirbInst;
+
+typedef struct {
+  int32_t v;
+  uint32_t label;
+} EirbData;
+
+typedef struct {
+  uint32_t name;
+  int32_t value;
+  uint32_t is_text;
+} EirbSymbol;
+
+static void eirb_encode_value(Value* v, uint8_t* type, int32_t* val) {
+  *type = v->type | (v->type == IMM ? v->label << 4 : 0);
+  *val = v->type == REG ? (int32_t)v->reg : v->imm;
+}
+
+static bool eirb_check_value(uint8_t type, int32_t val) {
+  if ((type & 15) == REG)
+    return type >> 4 == 0 && val >= A && val <= SP;
+  // The text parser keeps every number in the word size, and the
+  // engines index memory with them unchecked.
+  return (type & 15) == IMM && type >> 4 <= DATA_LABEL &&
+         val >= 0 && val <= UINT_MAX;
+}
+
+static void eirb_decode_value(uint8_t type, int32_t val, Value* v) {
+  v->type = (ValueType)(type & 15);
+  v->label = (LabelType)(type >> 4);
+  if (v->type == REG)
+    v->reg = (Reg)val;
+  else
+    v->imm = val;
+}
+
+void write_eir_binary(Module* m, FILE* fp) {
+  EirbHeader h = {};
+  memcpy(h.magic, EIRB_MAGIC, 4);
+  h.version = EIRB_VERSION;
+  h.num_insts = m->num_insts;
+  h.num_pcs = m->num_pcs;
+  for (Data* d = m->data; d; d = d->next)
+    h.num_data++;
+  h.num_syms = m->num_syms;
+  h.num_locs = m->num_locs;
+  h.num_files = m->num_files;
+  for (int i = 0; i < m->num_syms; i++)
+    h.strtab_size += strlen(m->syms[i].name) + 1;
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      h.strtab_size += strlen(m->files[i]) + 1;
+  }
+  // Keep the file size a multiple of 4.
+  h.strtab_size = (h.strtab_size + 3) & ~3u;
+  fwrite(&h, sizeof(h), 1, fp);
+
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    EirbInst r = {};
+    r.op = inst->op;
+    eirb_encode_value(&inst->dst, &r.types[0], &r.vals[0]);
+    eirb_encode_value(&inst->src, &r.types[1], &r.vals[1]);
+    eirb_encode_value(&inst->jmp, &r.types[2], &r.vals[2]);
+    r.pc = inst->pc;
+    r.lineno = inst->lineno;
+    r.loc = inst->loc;
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  fwrite(m->pc_start, sizeof(int32_t), m->num_pcs + 1, fp);
+
+  for (Data* d = m->data; d; d = d->next) {
+    EirbData r = { d->v, d->label };
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  uint32_t name = 0;
+  for (int i = 0; i < m->num_syms; i++) {
+    EirbSymbol s = {
+      .name = name,
+      .value = m->syms[i].value,
+      .is_text = m->syms[i].is_text
+    };
+    fwrite(&s, sizeof(s), 1, fp);
+    name += strlen(m->syms[i].name) + 1;
+  }
+  fwrite(m->locs, sizeof(SourceLoc), m->num_locs, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    uint32_t off = EIRB_NO_FILE;
+    if (m->files[i]) {
+      off = name;
+      name += strlen(m->files[i]) + 1;
+    }
+    fwrite(&off, sizeof(off), 1, fp);
+  }
+  for (int i = 0; i < m->num_syms; i++)
+    fwrite(m->syms[i].name, 1, strlen(m->syms[i].name) + 1, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      fwrite(m->files[i], 1, strlen(m->files[i]) + 1, fp);
+  }
+  for (; name < h.strtab_size; name++)
+    fputc(0, fp);
+}
+
+bool is_eir_binary(const void* buf, size_t size) {
+  return size >= sizeof(EirbHeader) && !memcmp(buf, EIRB_MAGIC, 4);
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void eirb_error(const char* filename, const char* msg) {
+  fprintf(stderr, "%s: %s\n", filename, msg);
+  exit(1);
+}
+
+Module* load_eir_binary(const char* filename, void* buf, size_t size) {
+  const EirbHeader* h = buf;
+  if (h->version != EIRB_VERSION)
+    eirb_error(filename, "unsupported binary EIR version");
+  size_t need = (sizeof(EirbHeader) +
+                 sizeof(EirbInst) * (size_t)h->num_insts +
+                 sizeof(int32_t) * ((size_t)h->num_pcs + 1) +
+                 sizeof(EirbData) * (size_t)h->num_data +
+                 sizeof(EirbSymbol) * (size_t)h->num_syms +
+                 sizeof(SourceLoc) * (size_t)h->num_locs +
+                 sizeof(uint32_t) * (size_t)h->num_files +
+                 h->strtab_size);
+  if (need != size)
+    eirb_error(filename, "broken binary EIR");
+
+  const EirbInst* rec = (const EirbInst*)(h + 1);
+  int* pc_start = (int*)(rec + h->num_insts);
+  const EirbData* data = (const EirbData*)(pc_start + h->num_pcs + 1);
+  const EirbSymbol* syms = (const EirbSymbol*)(data + h->num_data);
+  SourceLoc* locs = (SourceLoc*)(syms + h->num_syms);
+  const uint32_t* files = (const uint32_t*)(locs + h->num_locs);
+  const char* strtab = (const char*)(files + h->num_files);
+  if (h->strtab_size && strtab[h->strtab_size - 1])
+    eirb_error(filename, "broken binary EIR");
+  if (pc_start[0] != 0 || pc_start[h->num_pcs] != (int)h->num_insts)
+    eirb_error(filename, "broken binary EIR");
+  for (uint32_t pc = 0; pc < h->num_pcs; pc++) {
+    if (pc_start[pc] > pc_start[pc + 1])
+      eirb_error(filename, "broken binary EIR");
+  }
+  // A file number without a .file has no name, but it is never negative
+  // except in locs[0], which no instruction uses.
+  for (uint32_t i = 1; i < h->num_locs; i++) {
+    if (locs[i].file < 0)
+      eirb_error(filename, "broken binary EIR");
+  }
+
+  Arena* arena = arena_new();
+  Module* m = arena_alloc(arena, sizeof(Module));
+  m->arena = arena;
+  m->map = buf;
+  m->map_size = size;
+
+  int n = h->num_insts;
+  Inst* insts = arena_alloc(arena, sizeof(Inst) * n);
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    int op = rec[i].op;
+    int pc = rec[i].pc;
+    int loc = rec[i].loc;
+    if (op >= LAST_OP || (op > JMP && op < EQ) ||
+        !eirb_check_value(rec[i].types[0], rec[i].vals[0]) ||
+        !eirb_check_value(rec[i].types[1], rec[i].vals[1]) ||
+        !eirb_check_value(rec[i].types[2], rec[i].vals[2]) ||
+        pc < 0 || pc >= (int)h->num_pcs ||
+        i < pc_start[pc] || i >= pc_start[pc + 1] ||
+        loc < 0 || (loc >= (int)h->num_locs && loc != 0))
+      eirb_error(filename, "broken binary EIR");
+    inst->op = (Op)op;
+    eirb_decode_value(rec[i].types[0], rec[i].vals[0], &inst->dst);
+    eirb_decode_value(rec[i].types[1], rec[i].vals[1], &inst->src);
+    eirb_decode_value(rec[i].types[2], rec[i].vals[2], &inst->jmp);
+    inst->pc = rec[i].pc;
+    inst->lineno = rec[i].lineno;
+    inst->loc = rec[i].loc;
+    inst->next = i + 1 < n ? &insts[i + 1] : NULL;
+  }
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = h->num_pcs;
+
+  Data* d = arena_alloc(arena, sizeof(Data) * h->num_data);
+  for (uint32_t i = 0; i < h->num_data; i++) {
+    if (data[i].label > DATA_LABEL || data[i].v < 0 || data[i].v > UINT_MAX)
+      eirb_error(filename, "broken binary EIR");
+    d[i].v = data[i].v;
+    d[i].label = (LabelType)data[i].label;
+    d[i].next = i + 1 < h->num_data ? &d[i + 1] : NULL;
+  }
+  m->data = h->num_data ? d : NULL;
+
+  m->syms = arena_alloc(arena, sizeof(Symbol) * h->num_syms);
+  m->num_syms = h->num_syms;
+  for (uint32_t i = 0; i < h->num_syms; i++) {
+    if (syms[i].name >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->syms[i].name = strtab + syms[i].name;
+    m->syms[i].value = syms[i].value;
+    m->syms[i].is_text = syms[i].is_text;
+  }
+
+  m->locs = locs;
+  m->num_locs = h->num_locs;
+  m->files = arena_alloc(arena, sizeof(char*) * h->num_files);
+  m->num_files = h->num_files;
+  for (uint32_t i = 0; i < h->num_files; i++) {
+    if (files[i] == EIRB_NO_FILE)
+      continue;
+    if (files[i] >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->files[i] = strtab + files[i];
+  }
+  return m;
+}
+
+#endif
+#include <ir/cfg.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+static bool cfg_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+bool cfg_has_reg_jump(Module* m) {
+  for (int i = 0; i < m->num_insts; i++) {
+    if (cfg_is_jump(m->insts[i].op) && m->insts[i].jmp.type == REG)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_pc_value(Module* m, LabelType label, int v, bool plain) {
+  if (label == DATA_LABEL || (label == NOT_LABEL && !plain))
+    return -1;
+  return v >= 0 && v < m->num_pcs ? v : -1;
+}
+
+int cfg_code_address(Module* m, Inst* inst, Value* v, bool plain) {
+  if (v->type != IMM)
+    return -1;
+  if (v->label == NOT_LABEL) {
+    Op op = inst->op;
+    if (v != &inst->src ||
+        (op != MOV && op != ADD && op != SUB && (op < MUL || op > SHR)))
+      return -1;
+  }
+  return cfg_pc_value(m, v->label, v->imm, plain);
+}
+
+int cfg_data_code_address(Module* m, Data* data, bool plain) {
+  return cfg_pc_value(m, data->label, data->v, plain);
+}
+
+static void cfg_mark_address(CFG* cfg, int pc, LabelType label) {
+  if (pc < 0)
+    return;
+  cfg->blocks[pc].address_taken = true;
+  if (label == NOT_LABEL && pc > cfg->max_plain_pc)
+    cfg->max_plain_pc = pc;
+}
+
+static void cfg_mark_value(CFG* cfg, Inst* inst, Value* v, bool plain) {
+  cfg_mark_address(cfg, cfg_code_address(cfg->module, inst, v, plain),
+                   v->label);
+}
+
+static void cfg_add_succ(BasicBlock* bb, int to) {
+  for (int i = 0; i < bb->num_succs; i++) {
+    if (bb->succs[i] == to)
+      return;
+  }
+  bb->succs[bb->num_succs++] = to;
+}
+
+static void cfg_add_succs(CFG* cfg, BasicBlock* bb) {
+  int num_pcs = cfg->module->num_pcs;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return;
+    if (!cfg_is_jump(inst->op))
+      continue;
+    if (inst->jmp.type == REG)
+      cfg_add_succ(bb, cfg->indirect);
+    else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs)
+      cfg_add_succ(bb, inst->jmp.imm);
+    if (inst->op == JMP)
+      return;
+  }
+  if (bb->pc + 1 < num_pcs)
+    cfg_add_succ(bb, bb->pc + 1);
+}
+
+static void cfg_build_edges(CFG* cfg) {
+  Module* m = cfg->module;
+  bool plain = cfg_has_reg_jump(m);
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    cfg_mark_value(cfg, inst, &inst->dst, plain);
+    cfg_mark_value(cfg, inst, &inst->src, plain);
+    if (!cfg_is_jump(inst->op))
+      cfg_mark_value(cfg, inst, &inst->jmp, plain);
+  }
+  for (Data* data = m->data; data; data = data->next)
+    cfg_mark_address(cfg, cfg_data_code_address(m, data, plain), data->label);
+
+  int num_address_taken = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    if (bb->address_taken)
+      num_address_taken++;
+    int max_succs = 1;
+    for (int i = 0; i < bb->num_insts; i++) {
+      if (cfg_is_jump(bb->insts[i].op))
+        max_succs++;
+    }
+    bb->succs = arena_alloc(cfg->arena, sizeof(int) * max_succs);
+    cfg_add_succs(cfg, bb);
+  }
+
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  indirect->succs = arena_alloc(cfg->arena, sizeof(int) * num_address_taken);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (cfg->blocks[pc].address_taken)
+      indirect->succs[indirect->num_succs++] = pc;
+  }
+
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++)
+      cfg->blocks[bb->succs[j]].num_preds++;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    bb->preds = arena_alloc(cfg->arena, sizeof(int) * bb->num_preds);
+    bb->num_preds = 0;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++) {
+      BasicBlock* succ = &cfg->blocks[bb->succs[j]];
+      succ->preds[succ->num_preds++] = i;
+    }
+  }
+}
+
+static void cfg_compute_rpo(CFG* cfg) {
+  int n = cfg->num_blocks;
+  cfg->rpo = arena_alloc(cfg->arena, sizeof(int) * n);
+  for (int i = 0; i < n; i++)
+    cfg->blocks[i].rpo = -1;
+  if (!cfg->module->num_pcs)
+    return;
+
+  int* stack = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* next = arena_alloc(cfg->arena, sizeof(int) * n);
+  bool* visited = arena_alloc(cfg->arena, sizeof(bool) * n);
+  int sp = 0;
+  int num_post = 0;
+  stack[sp++] = 0;
+  visited[0] = true;
+  while (sp) {
+    int b = stack[sp - 1];
+    BasicBlock* bb = &cfg->blocks[b];
+    if (next[b] < bb->num_succs) {
+      int s = bb->succs[next[b]++];
+      if (!visited[s]) {
+        visited[s] = true;
+        stack[sp++] = s;
+      }
+    } else {
+      // Blocks are stored in postorder and reversed below.
+      cfg->rpo[num_post++] = b;
+      sp--;
+    }
+  }
+
+  for (int i = 0; i < num_post / 2; i++) {
+    int t = cfg->rpo[i];
+    cfg->rpo[i] = cfg->rpo[num_post - 1 - i];
+    cfg->rpo[num_post - 1 - i] = t;
+  }
+  cfg->num_rpo = num_post;
+  for (int i = 0; i < num_post; i++)
+    cfg->blocks[cfg->rpo[i]].rpo = i;
+}
+
+static int cfg_intersect(CFG* cfg, int a, int b) {
+  BasicBlock* blocks = cfg->blocks;
+  while (a != b) {
+    while (blocks[a].rpo > blocks[b].rpo)
+      a = blocks[a].idom;
+    while (blocks[b].rpo > blocks[a].rpo)
+      b = blocks[b].idom;
+  }
+  return a;
+}
+
+// "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy.
+static void cfg_compute_dominators(CFG* cfg) {
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < cfg->num_blocks; i++)
+    blocks[i].idom = -1;
+  if (!cfg->num_rpo)
+    return;
+
+  int entry = cfg->rpo[0];
+  blocks[entry].idom = entry;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 1; i < cfg->num_rpo; i++) {
+      BasicBlock* bb = &blocks[cfg->rpo[i]];
+      int idom = -1;
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].idom < 0)
+          continue;
+        idom = idom < 0 ? p : cfg_intersect(cfg, p, idom);
+      }
+      if (bb->idom != idom) {
+        bb->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  blocks[entry].idom = -1;
+}
+
+bool cfg_dominates(CFG* cfg, int a, int b) {
+  if (cfg->blocks[a].rpo < 0)
+    return false;
+  for (; b >= 0; b = cfg->blocks[b].idom) {
+    if (b == a)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_compare_ints(const void* a, const void* b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+static void cfg_find_loops(CFG* cfg) {
+  int n = cfg->num_blocks;
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < n; i++)
+    blocks[i].loop = -1;
+  cfg->loops = arena_alloc(cfg->arena, sizeof(Loop) * n);
+  int* body = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* work = arena_alloc(cfg->arena, sizeof(int) * n);
+  // mark[b] == id + 1 once b is in the loop being built.
+  int* mark = arena_alloc(cfg->arena, sizeof(int) * n);
+
+  // A header dominates every block of its loop, so visiting headers in
+  // reverse postorder finds outer loops first.
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int h = cfg->rpo[i];
+    int id = cfg->num_loops;
+    int num_body = 0;
+    int num_work = 0;
+    for (int j = 0; j < blocks[h].num_preds; j++) {
+      int t = blocks[h].preds[j];
+      if (blocks[t].rpo < i || !cfg_dominates(cfg, h, t))
+        continue;
+      if (mark[t] != id + 1) {
+        mark[t] = id + 1;
+        body[num_body++] = t;
+        if (t != h)
+          work[num_work++] = t;
+      }
+    }
+    if (!num_body)
+      continue;
+    if (mark[h] != id + 1) {
+      mark[h] = id + 1;
+      body[num_body++] = h;
+    }
+    while (num_work) {
+      BasicBlock* bb = &blocks[work[--num_work]];
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].rpo < 0 || mark[p] == id + 1)
+          continue;
+        mark[p] = id + 1;
+        body[num_body++] = p;
+        work[num_work++] = p;
+      }
+    }
+
+    Loop* loop = &cfg->loops[cfg->num_loops++];
+    loop->header = h;
+    // Loops are either nested or disjoint, so the last loop found which
+    // contains |h| is the innermost one around this loop.
+    loop->parent = blocks[h].loop;
+    loop->depth = loop->parent < 0 ? 1 : cfg->loops[loop->parent].depth + 1;
+    qsort(body, num_body, sizeof(int), cfg_compare_ints);
+    loop->blocks = arena_alloc(cfg->arena, sizeof(int) * num_body);
+    loop->num_blocks = num_body;
+    for (int j = 0; j < num_body; j++) {
+      loop->blocks[j] = body[j];
+      blocks[body[j]].loop = id;
+      blocks[body[j]].loop_depth = loop->depth;
+    }
+  }
+}
+
+CFG* build_cfg(Module* m) {
+  Arena* arena = arena_new();
+  CFG* cfg = arena_alloc(arena, sizeof(CFG));
+  cfg->arena = arena;
+  cfg->module = m;
+  cfg->num_blocks = m->num_pcs + 1;
+  cfg->indirect = m->num_pcs;
+  cfg->max_plain_pc = -1;
+  cfg->blocks = arena_alloc(arena, sizeof(BasicBlock) * cfg->num_blocks);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    bb->pc = pc;
+    bb->insts = &m->insts[m->pc_start[pc]];
+    bb->num_insts = m->pc_start[pc + 1] - m->pc_start[pc];
+  }
+  cfg->blocks[cfg->indirect].pc = -1;
+
+  cfg_build_edges(cfg);
+  cfg_compute_rpo(cfg);
+  cfg_compute_dominators(cfg);
+  cfg_find_loops(cfg);
+  return cfg;
+}
+
+void free_cfg(CFG* cfg) {
+  arena_free(cfg->arena);
+}
+
+static void cfg_dump_list(FILE* fp, const char* name, int* list, int n) {
+  fprintf(fp, " %s=", name);
+  if (!n)
+    fprintf(fp, "-");
+  for (int i = 0; i < n; i++)
+    fprintf(fp, i ? ",%d" : "%d", list[i]);
+}
+
+void dump_cfg(CFG* cfg, FILE* fp) {
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    if (bb->pc < 0)
+      fprintf(fp, "indirect=%d", i);
+    else
+      fprintf(fp, "pc=%d insts=%d", bb->pc, bb->num_insts);
+    cfg_dump_list(fp, "succs", bb->succs, bb->num_succs);
+    cfg_dump_list(fp, "preds", bb->preds, bb->num_preds);
+    if (bb->rpo < 0)
+      fprintf(fp, " unreachable");
+    else
+      fprintf(fp, " idom=%d", bb->idom);
+    if (bb->loop >= 0)
+      fprintf(fp, " loop=%d depth=%d", bb->loop, bb->loop_depth);
+    if (bb->address_taken)
+      fprintf(fp, " address_taken");
+    fprintf(fp, "\n");
+  }
+  for (int i = 0; i < cfg->num_loops; i++) {
+    Loop* loop = &cfg->loops[i];
+    fprintf(fp, "loop=%d header=%d parent=%d depth=%d",
+            i, loop->header, loop->parent, loop->depth);
+    cfg_dump_list(fp, "blocks", loop->blocks, loop->num_blocks);
+    fprintf(fp, "\n");
+  }
+}
+#include <ir/opt.h>
+
+#include <stdlib.h>
+
+#define OPT_NUM_REGS 6
+#define OPT_ALL_REGS ((1 << OPT_NUM_REGS) - 1)
+#define OPT_MAX_MEM_FACTS 8
+
+// What the forward pass knows at the current instruction. A known
+// register holds either an immediate or the same value as another
+// register, and a memory fact says the word at |addr| equals |val|.
+typedef struct {
+  Value addr;
+  Value val;
+} MemFact;
+
+typedef struct {
+  bool known[OPT_NUM_REGS];
+  Value regs[OPT_NUM_REGS];
+  MemFact mem[OPT_MAX_MEM_FACTS];
+  int num_mem;
+} OptState;
+
+static bool opt_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static bool opt_is_cmp(Op op) {
+  return op >= EQ && op <= GE;
+}
+
+static bool opt_same_value(Value* a, Value* b) {
+  if (a->type != b->type)
+    return false;
+  if (a->type == REG)
+    return a->reg == b->reg;
+  return a->imm == b->imm && a->label == b->label;
+}
+
+static bool opt_is_plain_imm(Value* v) {
+  return v->type == IMM && v->label == NOT_LABEL;
+}
+
+static void opt_set_mov_imm(Inst* inst, int v) {
+  inst->op = MOV;
+  inst->src.type = IMM;
+  inst->src.label = NOT_LABEL;
+  inst->src.imm = MOD24(v);
+}
+
+// Forgets everything which depends on the old value of |r|.
+static void opt_kill_reg(OptState* s, Reg r) {
+  s->known[r] = false;
+  for (int i = 0; i < OPT_NUM_REGS; i++) {
+    if (s->known[i] && s->regs[i].type == REG && s->regs[i].reg == r)
+      s->known[i] = false;
+  }
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if ((f->addr.type == REG && f->addr.reg == r) ||
+        (f->val.type == REG && f->val.reg == r))
+      continue;
+    s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+}
+
+// Replaces a register operand by what it is known to hold.
+static void opt_rewrite_use(OptState* s, Value* v, bool allow_imm) {
+  if (v->type != REG || !s->known[v->reg])
+    return;
+  Value* k = &s->regs[v->reg];
+  if (k->type == REG || allow_imm)
+    *v = *k;
+}
+
+// The value a register will be known to hold after it is set to |v|.
+static void opt_canonical(OptState* s, Value* v, Value* out) {
+  if (v->type == REG && s->known[v->reg])
+    *out = s->regs[v->reg];
+  else
+    *out = *v;
+}
+
+static MemFact* opt_find_mem(OptState* s, Value* addr) {
+  for (int i = 0; i < s->num_mem; i++) {
+    if (opt_same_value(&s->mem[i].addr, addr))
+      return &s->mem[i];
+  }
+  return NULL;
+}
+
+static void opt_add_mem(OptState* s, Value* addr, Value* val) {
+  if (s->num_mem == OPT_MAX_MEM_FACTS) {
+    for (int i = 1; i < s->num_mem; i++)
+      s->mem[i - 1] = s->mem[i];
+    s->num_mem--;
+  }
+  s->mem[s->num_mem].addr = *addr;
+  s->mem[s->num_mem].val = *val;
+  s->num_mem++;
+}
+
+// Two immediates never alias unless they are equal. Anything else may.
+static void opt_store_mem(OptState* s, Value* addr, Value* val) {
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if (f->addr.type == IMM && addr->type == IMM && f->addr.imm != addr->imm)
+      s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+  opt_add_mem(s, addr, val);
+}
+
+static bool opt_compare(Op op, int l, int r) {
+  switch (op) {
+    case JEQ: case EQ: return l == r;
+    case JNE: case NE: return l != r;
+    case JLT: case LT: return l < r;
+    case JGT: case GT: return l > r;
+    case JLE: case LE: return l <= r;
+    case JGE: case GE: return l >= r;
+    default:
+      return false;
+  }
+}
+
+// Whether "op dst, v" leaves dst unchanged.
+static bool opt_is_identity(Op op, Value* v) {
+  if (!opt_is_plain_imm(v))
+    return false;
+  switch (op) {
+    case ADD: case SUB: case OR: case XOR: case SHL: case SHR:
+      return v->imm == 0;
+    case MUL: case DIV:
+      return v->imm == 1;
+    default:
+      return false;
+  }
+}
+
+// Rewrites |inst| using and updating |s|. Returns false if the
+// instruction has no effect and can be dropped.
+static bool opt_forward(OptState* s, Inst* inst) {
+  Op op = inst->op;
+  switch (op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case PUTC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_rewrite_use(s, &inst->src, true);
+      break;
+    case STORE:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      break;
+    case COPY:
+    case FILL:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      opt_rewrite_use(s, &inst->jmp, true);
+      break;
+    default:
+      break;
+  }
+  if (opt_is_jump(op)) {
+    if (op != JMP)
+      opt_rewrite_use(s, &inst->dst, false);
+    opt_rewrite_use(s, &inst->jmp, true);
+  }
+
+  Value* dst = &inst->dst;
+  Value* src = &inst->src;
+  Value* known_dst =
+      dst->type == REG && s->known[dst->reg] ? &s->regs[dst->reg] : NULL;
+  bool folds = (known_dst && opt_is_plain_imm(known_dst) &&
+                opt_is_plain_imm(src));
+
+  if (opt_is_identity(op, src))
+    return false;
+
+  switch (op) {
+    case ADD:
+    case SUB:
+      if (folds) {
+        int v = (op == ADD ? known_dst->imm + src->imm :
+                 known_dst->imm - src->imm);
+        opt_set_mov_imm(inst, v);
+      }
+      break;
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      if (folds)
+        opt_set_mov_imm(inst, opt_compare(op, known_dst->imm, src->imm));
+      break;
+
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      if (folds)
+        opt_set_mov_imm(inst, eval_ext_op(op, known_dst->imm, src->imm));
+      break;
+
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+      if (folds) {
+        if (!opt_compare(op, known_dst->imm, src->imm))
+          return false;
+        inst->op = JMP;
+        inst->dst.type = REG;
+        inst->dst.reg = A;
+        inst->src = inst->dst;
+      }
+      break;
+
+    case LOAD: {
+      MemFact* f = opt_find_mem(s, src);
+      if (f && f->val.type == REG && f->val.reg == dst->reg)
+        return false;
+      if (f) {
+        inst->op = MOV;
+        *src = f->val;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  switch (inst->op) {
+    case MOV: {
+      if (src->type == REG && src->reg == dst->reg)
+        return false;
+      if (known_dst && opt_same_value(known_dst, src))
+        return false;
+      Value v;
+      opt_canonical(s, src, &v);
+      opt_kill_reg(s, dst->reg);
+      s->known[dst->reg] = true;
+      s->regs[dst->reg] = v;
+      break;
+    }
+
+    case ADD:
+    case SUB:
+    case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_kill_reg(s, dst->reg);
+      break;
+
+    case LOAD: {
+      Value addr = *src;
+      opt_kill_reg(s, dst->reg);
+      if (!(addr.type == REG && addr.reg == dst->reg))
+        opt_add_mem(s, &addr, dst);
+      break;
+    }
+
+    case STORE: {
+      Value v;
+      opt_canonical(s, dst, &v);
+      opt_store_mem(s, src, &v);
+      break;
+    }
+
+    case COPY:
+    case FILL:
+      s->num_mem = 0;
+      break;
+
+    default:
+      break;
+  }
+  return true;
+}
+
+static int opt_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+// Registers |inst| reads.
+static int opt_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return opt_reg_bit(&inst->src);
+    case ADD:
+    case SUB:
+    case STORE:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              (opt_is_jump(inst->op) ? opt_reg_bit(&inst->jmp) : 0));
+    case JMP:
+      return opt_reg_bit(&inst->jmp);
+    case COPY:
+    case FILL:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              opt_reg_bit(&inst->jmp));
+    default:
+      return 0;
+  }
+}
+
+// Whether |inst| only writes its dst register.
+static bool opt_is_pure_def(Inst* inst) {
+  return (inst->op == MOV || inst->op == ADD || inst->op == SUB ||
+          inst->op == LOAD || opt_is_cmp(inst->op) || is_ext_op(inst->op));
+}
+
+// Returns the number of instructions of a block that were dropped.
+static int opt_block(Inst* insts, int n, bool* dead) {
+  OptState s = {};
+  int removed = 0;
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    if (!opt_forward(&s, inst)) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (inst->op == EXIT || inst->op == JMP) {
+      // The rest of the block never runs.
+      for (i++; i < n; i++) {
+        dead[i] = true;
+        removed++;
+      }
+    }
+  }
+
+  // Every register may be read by later blocks.
+  int live = OPT_ALL_REGS;
+  for (int i = n - 1; i >= 0; i--) {
+    Inst* inst = &insts[i];
+    if (dead[i])
+      continue;
+    if (inst->op == EXIT) {
+      live = 0;
+      continue;
+    }
+    if (opt_is_jump(inst->op))
+      live = OPT_ALL_REGS;
+    if (opt_is_pure_def(inst) && !(live & (1 << inst->dst.reg))) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (opt_is_pure_def(inst) || inst->op == GETC)
+      live &= ~(1 << inst->dst.reg);
+    live |= opt_uses(inst);
+  }
+
+  // Keep one instruction so the pc stays a valid jump target.
+  if (n && removed == n) {
+    dead[n - 1] = false;
+    removed--;
+  }
+  return removed;
+}
+
+void optimize_module(Module* m) {
+  bool* dead = calloc(m->num_insts + 1, sizeof(bool));
+  int removed = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    int start = m->pc_start[pc];
+    int n = m->pc_start[pc + 1] - start;
+    removed += opt_block(&m->insts[start], n, &dead[start]);
+  }
+
+  if (removed) {
+    Inst root;
+    Inst* prev = &root;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (dead[i])
+        continue;
+      prev->next = &m->insts[i];
+      prev = prev->next;
+    }
+    prev->next = NULL;
+    m->text = root.next;
+    reindex_module(m);
+  }
+  free(dead);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef __eir__
+#include <time.h>
+#endif
+
+#include <ir/opt.h>
+#include <ir/range.h>
+
+static const Pass g_passes[] = {
+  { "opt", optimize_module,
+    "block-local constant/copy propagation and dead write removal" },
+  { "dce", remove_dead_code_and_data,
+    "remove unreachable pcs and unreferenced data" },
+  { "merge", merge_basic_blocks,
+    "thread jumps to jumps and merge fallthrough-only pcs" },
+  { "lower_ext", lower_ext_ops,
+    "replace mul/div/mod/and/or/xor/shl/shr with calls to helpers" },
+  { "lower_block", lower_block_ops,
+    "replace copy/fill with calls to loop helpers" },
+  { "layout", layout_by_profile,
+    "reorder pcs by profile counts so hot loops stay in one chunk" },
+  { "ranges", analyze_ranges,
+    "mark add/sub which never wrap around so backends skip the mask" },
+  { "split_mem", split_basic_block_by_mem,
+    "start a new pc after every load and store" },
+  { NULL, NULL, NULL }
+};
+
+#define MAX_PIPELINE 64
+
+static const Pass* g_pipeline[MAX_PIPELINE];
+static int g_num_pipeline;
+
+const Pass* find_pass(const char* name) {
+  for (const Pass* pass = g_passes; pass->name; pass++) {
+    if (!strcmp(pass->name, name))
+      return pass;
+  }
+  return NULL;
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void pass_error(const char* msg, const char* name) {
+  fprintf(stderr, "%s: %s\navailable passes:\n", msg, name);
+  for (const Pass* pass = g_passes; pass->name; pass++)
+    fprintf(stderr, "  %s: %s\n", pass->name, pass->help);
+  exit(1);
+}
+
+void add_pass(const char* name) {
+  const Pass* pass = find_pass(name);
+  if (!pass)
+    pass_error("unknown pass", name);
+  if (g_num_pipeline == MAX_PIPELINE)
+    pass_error("too many passes", name);
+  g_pipeline[g_num_pipeline++] = pass;
+}
+
+void add_passes(const char* names) {
+  char buf[64];
+  while (*names) {
+    const char* end = strchr(names, ',');
+    int len = end ? end - names : (int)strlen(names);
+    if (len >= (int)sizeof(buf))
+      pass_error("unknown pass", names);
+    if (len) {
+      memcpy(buf, names, len);
+      buf[len] = 0;
+      add_pass(buf);
+    }
+    names += len;
+    if (*names)
+      names++;
+  }
+}
+
+static int pass_count_data(Module* m) {
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    n++;
+  return n;
+}
+
+static void pass_print_count(const char* name, int before, int after) {
+  fprintf(stderr, " %s %d -> %d (%s%d)", name, before, after,
+          after >= before ? "+" : "", after - before);
+}
+
+#ifndef __eir__
+static double pass_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+#endif
+
+void run_passes(Module* m, bool show_stats) {
+  for (int i = 0; i < g_num_pipeline; i++) {
+    const Pass* pass = g_pipeline[i];
+    if (!show_stats) {
+      pass->run(m);
+      continue;
+    }
+
+    int insts = m->num_insts;
+    int pcs = m->num_pcs;
+    int data = pass_count_data(m);
+#ifndef __eir__
+    double start = pass_now_ms();
+#endif
+    pass->run(m);
+    fprintf(stderr, "pass %s:", pass->name);
+#ifndef __eir__
+    fprintf(stderr, " %.3f ms", pass_now_ms() - start);
+#endif
+    pass_print_count("insts", insts, m->num_insts);
+    pass_print_count("pcs", pcs, m->num_pcs);
+    pass_print_count("data", data, pass_count_data(m));
+    fprintf(stderr, "\n");
+  }
+}
+
+static void pass_relocate_value(Value* v, const int* pc_map, int num_pcs) {
+  if (v->type == IMM && v->label == TEXT_LABEL &&
+      v->imm >= 0 && v->imm <= num_pcs)
+    v->imm = pc_map[v->imm];
+}
+
+void relocate_text_labels(Module* m, const int* pc_map) {
+  int num_pcs = m->num_pcs;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    pass_relocate_value(&inst->dst, pc_map, num_pcs);
+    pass_relocate_value(&inst->src, pc_map, num_pcs);
+    // A jump target is a pc even if it was written as a number.
+    if (inst->op >= JEQ && inst->op <= JMP) {
+      Value* v = &inst->jmp;
+      if (v->type == IMM && v->imm >= 0 && v->imm <= num_pcs)
+        v->imm = pc_map[v->imm];
+    } else {
+      pass_relocate_value(&inst->jmp, pc_map, num_pcs);
+    }
+  }
+  for (Data* data = m->data; data; data = data->next) {
+    if (data->label == TEXT_LABEL && data->v >= 0 && data->v <= num_pcs)
+      data->v = pc_map[data->v];
+  }
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (sym->is_text && sym->value >= 0 && sym->value <= num_pcs)
+      sym->value = pc_map[sym->value];
+  }
+}
+
+void split_basic_block_by_mem(Module* m) {
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    for (; pc <= inst->pc; pc++)
+      pc_map[pc] = pc + shift;
+    int old_pc = inst->pc;
+    inst->pc += shift;
+    if ((inst->op == LOAD || inst->op == STORE) &&
+        inst->next && inst->next->pc == old_pc)
+      shift++;
+  }
+  for (; pc <= m->num_pcs; pc++)
+    pc_map[pc] = pc + shift;
+
+  if (shift) {
+    relocate_text_labels(m, pc_map);
+    reindex_module(m);
+  }
+  free(pc_map);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+// lower_ext and lower_block replace each MUL .. SHR and COPY .. FILL
+// with a call to a helper routine made of basic ops. The call site
+// saves A-D, loads the operands into A, B and (for block ops) C, and
+// pushes its return pc:
+//
+//     sub SP, 1; store A, SP       ; ... and B, C, D
+//     <C = len>; <B = src>; <A = dst>
+//     mov D, ret; sub SP, 1; store D, SP; jmp helper
+//   ret:                           ; a new pc
+//     <the saved dst = A>          ; ext ops only
+//     load A, SP; mov D, A; add SP, 1   ; ... and C, B, A
+//
+// Helpers may clobber A-D, leave the result in A, and return by popping
+// the return pc. Each used helper is emitted once after the last pc.
+// Only "load A, X" is used since some backends support nothing else.
+
+#define LOWER_BIT23 0x800000
+#define LOWER_NUM_SAVED 4
+
+// An instruction of a helper routine. |jmp| is a local label for jumps,
+// or LOWER_JMP_D for "jmp D". LOWER_LABEL entries define label |jmp|.
+typedef struct {
+  int op;
+  Reg dst;
+  int src;
+  bool src_is_imm;
+  int jmp;
+} LowerInst;
+
+enum {
+  LOWER_LABEL = -1,
+  LOWER_END = -2,
+  LOWER_JMP_D = -1,
+  LOWER_MAX_LABELS = 16
+};
+
+#define LL(l) { LOWER_LABEL, A, 0, false, l }
+#define RR(op, d, s) { op, d, s, false, 0 }
+#define RI(op, d, i) { op, d, i, true, 0 }
+#define JI(op, l, d, i) { op, d, i, true, l }
+#define JR(op, l, d, s) { op, d, s, false, l }
+#define JL(l) { JMP, A, 0, false, l }
+#define RET                                     \
+  RR(MOV, C, A), RR(LOAD, A, SP), RI(ADD, SP, 1), \
+  RR(MOV, D, A), RR(MOV, A, C),                   \
+  { JMP, D, 0, false, LOWER_JMP_D }
+#define END { LOWER_END, A, 0, false, 0 }
+
+// Shift-and-add over the bits of B from the top, after skipping its
+// leading zeros.
+static const LowerInst lower_mul[] = {
+  RI(MOV, C, 0),
+  RI(MOV, D, 24),
+  JI(JEQ, 3, B, 0),
+  LL(0),
+  JI(JGE, 1, B, LOWER_BIT23),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, C, C),
+  JI(JLT, 2, B, LOWER_BIT23),
+  RR(ADD, C, A),
+  LL(2),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JI(JNE, 1, D, 0),
+  LL(3),
+  RR(MOV, A, C),
+  RET,
+  END
+};
+
+// Restoring division. C is the quotient and D the remainder. C starts as
+// 1 and this bit reaches bit 23 at the 24th and last step. When D has
+// bit 23 set, doubling it overflows but the subtraction is then always
+// needed and wraps back to the right value.
+#define LOWER_DIV_BODY                          \
+  JI(JEQ, 10, B, 0),                            \
+  RI(MOV, C, 1),                                \
+  RI(MOV, D, 0),                                \
+  LL(0),                                        \
+  JI(JGE, 5, C, LOWER_BIT23),                   \
+  JI(JGE, 3, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 1, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JR(JLT, 0, D, B),                             \
+  LL(2),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(0),                                        \
+  LL(3),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 4, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(4),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JL(2),                                        \
+  LL(5),                                        \
+  JI(JGE, 8, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 6, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(6),                                        \
+  RR(ADD, C, C),                                \
+  JR(JLT, 9, D, B),                             \
+  LL(7),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(9),                                        \
+  LL(8),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 11, A, LOWER_BIT23),                  \
+  RI(ADD, D, 1),                                \
+  LL(11),                                       \
+  RR(ADD, C, C),                                \
+  JL(7),                                        \
+  LL(9)
+
+static const LowerInst lower_div[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, C),
+  RET,
+  LL(10),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+static const LowerInst lower_mod[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, D),
+  RET,
+  // The remainder of a division by zero is the dividend, already in A.
+  LL(10),
+  RET,
+  END
+};
+
+// Bitwise ops build C from the top bits of A and B, doubling all three
+// 24 times.
+#define LOWER_BITWISE_HEAD                      \
+  RI(MOV, C, 0),                                \
+  RI(MOV, D, 24),                               \
+  LL(0),                                        \
+  RR(ADD, C, C)
+
+#define LOWER_BITWISE_TAIL                      \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, B, B),                                \
+  RI(SUB, D, 1),                                \
+  JI(JNE, 0, D, 0),                             \
+  RR(MOV, A, C),                                \
+  RET,                                          \
+  END
+
+static const LowerInst lower_and[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JLT, 1, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_or[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 2, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_xor[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 3, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  JL(2),
+  LL(3),
+  JI(JGE, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_shl[] = {
+  JI(JGE, 2, B, 24),
+  LL(0),
+  JI(JEQ, 1, B, 0),
+  RR(ADD, A, A),
+  RI(SUB, B, 1),
+  JL(0),
+  LL(2),
+  RI(MOV, A, 0),
+  LL(1),
+  RET,
+  END
+};
+
+// Takes the top 24 - B bits of A.
+static const LowerInst lower_shr[] = {
+  JI(JGE, 3, B, 24),
+  RI(MOV, C, 24),
+  RR(SUB, C, B),
+  RI(MOV, D, 0),
+  LL(0),
+  JI(JEQ, 2, C, 0),
+  RR(ADD, D, D),
+  JI(JLT, 1, A, LOWER_BIT23),
+  RI(ADD, D, 1),
+  LL(1),
+  RR(ADD, A, A),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(2),
+  RR(MOV, A, D),
+  RET,
+  LL(3),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+// memmove of C words from B to A. Copies backwards if A is above B.
+static const LowerInst lower_copy[] = {
+  RR(MOV, D, A),
+  JR(JGT, 1, D, B),
+  LL(0),
+  JI(JEQ, 3, C, 0),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(ADD, B, 1),
+  RI(ADD, D, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, B, C),
+  RR(ADD, D, C),
+  LL(2),
+  JI(JEQ, 3, C, 0),
+  RI(SUB, B, 1),
+  RI(SUB, D, 1),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(SUB, C, 1),
+  JL(2),
+  LL(3),
+  RET,
+  END
+};
+
+static const LowerInst lower_fill[] = {
+  LL(0),
+  JI(JEQ, 1, C, 0),
+  RR(STORE, B, A),
+  RI(ADD, A, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RET,
+  END
+};
+
+static const LowerInst* lower_helper_code(Op op) {
+  switch (op) {
+    case MUL: return lower_mul;
+    case DIV: return lower_div;
+    case MOD: return lower_mod;
+    case AND: return lower_and;
+    case OR: return lower_or;
+    case XOR: return lower_xor;
+    case SHL: return lower_shl;
+    case SHR: return lower_shr;
+    case COPY: return lower_copy;
+    case FILL: return lower_fill;
+    default: return NULL;
+  }
+}
+
+// Appends instructions to |tail| and numbers pcs the way the parser
+// does: a jump ends its pc and a label after instructions starts one.
+typedef struct {
+  Arena* arena;
+  Inst* tail;
+  int pc;
+  bool at_boundary;
+  // Debug info and profile counts for the emitted instructions.
+  int lineno;
+  int loc;
+  long count;
+} LowerEmitter;
+
+static Inst* lower_emit(LowerEmitter* e, int op) {
+  Inst* inst = arena_alloc(e->arena, sizeof(Inst));
+  inst->op = (Op)op;
+  inst->pc = e->pc;
+  inst->lineno = e->lineno;
+  inst->loc = e->loc;
+  inst->count = e->count;
+  e->tail->next = inst;
+  e->tail = inst;
+  e->at_boundary = false;
+  if (op >= JEQ && op <= JMP) {
+    e->pc++;
+    e->at_boundary = true;
+  }
+  return inst;
+}
+
+static void lower_set_reg(Value* v, Reg r) {
+  v->type = REG;
+  v->reg = r;
+}
+
+static void lower_set_imm(Value* v, int imm, LabelType label) {
+  v->type = IMM;
+  v->imm = imm;
+  v->label = label;
+}
+
+static void lower_emit_rr(LowerEmitter* e, Op op, Reg dst, Reg src) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_reg(&inst->src, src);
+}
+
+static void lower_emit_ri(LowerEmitter* e, Op op, Reg dst, int imm) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_imm(&inst->src, imm, NOT_LABEL);
+}
+
+static void lower_emit_push(LowerEmitter* e, Reg r) {
+  lower_emit_ri(e, SUB, SP, 1);
+  lower_emit_rr(e, STORE, r, SP);
+}
+
+static void lower_emit_pop(LowerEmitter* e, Reg r) {
+  lower_emit_rr(e, LOAD, A, SP);
+  if (r != A)
+    lower_emit_rr(e, MOV, r, A);
+  lower_emit_ri(e, ADD, SP, 1);
+}
+
+// Assigns pcs to the labels of |code| placed at |pc| and returns the
+// first pc after it.
+static int lower_layout_helper(const LowerInst* code, int pc, int* labels) {
+  bool at_boundary = true;
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!at_boundary)
+        pc++;
+      at_boundary = true;
+      labels[li->jmp] = pc;
+    } else if (li->op >= JEQ && li->op <= JMP) {
+      pc++;
+      at_boundary = true;
+    } else {
+      at_boundary = false;
+    }
+  }
+  return at_boundary ? pc : pc + 1;
+}
+
+// Emits |code| starting at a new pc.
+static void lower_emit_helper(LowerEmitter* e, const LowerInst* code) {
+  int labels[LOWER_MAX_LABELS];
+  lower_layout_helper(code, e->pc, labels);
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!e->at_boundary)
+        e->pc++;
+      e->at_boundary = true;
+      continue;
+    }
+    Inst* inst = lower_emit(e, li->op);
+    if (li->op == JMP && li->jmp == LOWER_JMP_D) {
+      lower_set_reg(&inst->jmp, D);
+      continue;
+    }
+    if (li->op != JMP) {
+      lower_set_reg(&inst->dst, li->dst);
+      if (li->src_is_imm)
+        lower_set_imm(&inst->src, li->src, NOT_LABEL);
+      else
+        lower_set_reg(&inst->src, (Reg)li->src);
+    }
+    if (li->op >= JEQ && li->op <= JMP)
+      lower_set_imm(&inst->jmp, labels[li->jmp], TEXT_LABEL);
+  }
+}
+
+// Stack slot of a saved register once the frame is complete.
+static int lower_slot(Reg r) {
+  return LOWER_NUM_SAVED - 1 - r;
+}
+
+// Makes |addr| point to the stack slot of |r|.
+static void lower_emit_slot_addr(LowerEmitter* e, Reg addr, Reg r) {
+  lower_emit_rr(e, MOV, addr, SP);
+  lower_emit_ri(e, ADD, addr, lower_slot(r));
+}
+
+// Loads the value |v| had before the call site into |r|, which is A, B
+// or C. They are loaded in the order C, B, A since A is used to load
+// from memory. D is used as a scratch register.
+static void lower_emit_operand(LowerEmitter* e, Reg r, Value* v) {
+  if (v->type == IMM) {
+    Inst* inst = lower_emit(e, MOV);
+    lower_set_reg(&inst->dst, r);
+    inst->src = *v;
+  } else if (v->reg == BP) {
+    lower_emit_rr(e, MOV, r, BP);
+  } else if (v->reg == SP) {
+    lower_emit_rr(e, MOV, r, SP);
+    lower_emit_ri(e, ADD, r, LOWER_NUM_SAVED);
+  } else {
+    lower_emit_slot_addr(e, D, v->reg);
+    lower_emit_rr(e, LOAD, A, D);
+    if (r != A)
+      lower_emit_rr(e, MOV, r, A);
+  }
+}
+
+// Copies the saved registers from the frame at SP to the one at B.
+static void lower_emit_copy_frame(LowerEmitter* e, bool descending) {
+  for (int i = 0; i < LOWER_NUM_SAVED; i++) {
+    Reg r = (Reg)(descending ? i : D - i);
+    lower_emit_slot_addr(e, C, r);
+    lower_emit_rr(e, LOAD, A, C);
+    lower_emit_rr(e, MOV, C, B);
+    lower_emit_ri(e, ADD, C, lower_slot(r));
+    lower_emit_rr(e, STORE, A, C);
+  }
+}
+
+// Moves the saved registers to just below the new SP in A, so popping
+// them leaves SP at the result. The frames may overlap, so the copy
+// runs in the direction of the move:
+//
+//     mov B, A; sub B, 4; jgt down, B, SP
+//     <copy upwards>; jmp done
+//   down:
+//     <copy downwards>
+//   done:
+//     mov SP, B
+static void lower_emit_move_frame(LowerEmitter* e) {
+  lower_emit_rr(e, MOV, B, A);
+  lower_emit_ri(e, SUB, B, LOWER_NUM_SAVED);
+  Inst* down = lower_emit(e, JGT);
+  lower_set_reg(&down->dst, B);
+  lower_set_reg(&down->src, SP);
+  lower_set_imm(&down->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, false);
+  Inst* done = lower_emit(e, JMP);
+  lower_set_imm(&done->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, true);
+  e->pc++;
+  lower_emit_rr(e, MOV, SP, B);
+}
+
+// The number of pcs a call site adds to the pc of |inst|.
+static int lower_call_pcs(Inst* inst) {
+  return is_ext_op(inst->op) && inst->dst.reg == SP ? 4 : 1;
+}
+
+static void lower_emit_call(LowerEmitter* e, Inst* inst, int helper_pc) {
+  for (int r = A; r <= D; r++)
+    lower_emit_push(e, (Reg)r);
+  if (!is_ext_op(inst->op))
+    lower_emit_operand(e, C, &inst->jmp);
+  lower_emit_operand(e, B, &inst->src);
+  lower_emit_operand(e, A, &inst->dst);
+
+  Inst* ret = lower_emit(e, MOV);
+  lower_set_reg(&ret->dst, D);
+  lower_set_imm(&ret->src, e->pc + 1, TEXT_LABEL);
+  lower_emit_push(e, D);
+  Inst* jmp = lower_emit(e, JMP);
+  lower_set_imm(&jmp->jmp, helper_pc, TEXT_LABEL);
+
+  Reg dst = inst->dst.reg;
+  if (!is_ext_op(inst->op)) {
+    // Block ops have no result.
+  } else if (dst == BP) {
+    lower_emit_rr(e, MOV, BP, A);
+  } else if (dst == SP) {
+    lower_emit_move_frame(e);
+  } else {
+    lower_emit_slot_addr(e, C, dst);
+    lower_emit_rr(e, STORE, A, C);
+  }
+  for (int r = D; r >= A; r--)
+    lower_emit_pop(e, (Reg)r);
+}
+
+// Replaces the ops from |first| to |last| by calls.
+static void lower_ops(Module* m, Op first, Op last) {
+  int num_calls = 0;
+  bool used[LAST_OP] = {};
+  long helper_count[LAST_OP] = {};
+  for (int i = 0; i < m->num_insts; i++) {
+    Op op = m->insts[i].op;
+    if (op >= first && op <= last) {
+      num_calls++;
+      used[op] = true;
+      helper_count[op] += m->insts[i].count;
+    }
+  }
+  if (!num_calls)
+    return;
+
+  // Every call site splits its pc.
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = pc + shift;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      Op op = m->insts[i].op;
+      if (op >= first && op <= last)
+        shift += lower_call_pcs(&m->insts[i]);
+    }
+  }
+  pc_map[m->num_pcs] = m->num_pcs + shift;
+  relocate_text_labels(m, pc_map);
+
+  // Helpers go after the last pc, in Op order.
+  int helper_pc[LAST_OP];
+  int labels[LOWER_MAX_LABELS];
+  int pc = pc_map[m->num_pcs];
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    helper_pc[op] = pc;
+    pc = lower_layout_helper(lower_helper_code((Op)op), pc, labels);
+  }
+
+  Inst root = {};
+  LowerEmitter e = {};
+  e.arena = m->arena;
+  e.tail = &root;
+  for (int old_pc = 0; old_pc < m->num_pcs; old_pc++) {
+    e.pc = pc_map[old_pc];
+    for (int i = m->pc_start[old_pc]; i < m->pc_start[old_pc + 1]; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op >= first && inst->op <= last) {
+        e.lineno = inst->lineno;
+        e.loc = inst->loc;
+        e.count = inst->count;
+        lower_emit_call(&e, inst, helper_pc[inst->op]);
+        continue;
+      }
+      inst->pc = e.pc;
+      e.tail->next = inst;
+      e.tail = inst;
+    }
+  }
+
+  e.pc = pc_map[m->num_pcs];
+  e.at_boundary = true;
+  e.lineno = -1;
+  e.loc = 0;
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    // A helper runs as often as all its call sites together.
+    e.count = helper_count[op];
+    lower_emit_helper(&e, lower_helper_code((Op)op));
+  }
+  e.tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+  free(pc_map);
+}
+
+void lower_ext_ops(Module* m) {
+  lower_ops(m, MUL, SHR);
+}
+
+void lower_block_ops(Module* m) {
+  lower_ops(m, COPY, FILL);
+}
+#include <ir/range.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+#define RANGE_NUM_REGS 6
+#define RANGE_MAX 16777215
+// A bound of an entry state which keeps moving after this many changes
+// is widened to the end of the word, so loops reach a fixpoint quickly.
+#define RANGE_WIDEN_AFTER 2
+// Rounds of recomputing every entry state from the widened ones, which
+// brings back bounds given by loop conditions.
+#define RANGE_NARROW_ROUNDS 2
+
+// An inclusive interval of unsigned 24-bit values. Bounds are compared
+// before any addition or subtraction so nothing leaves [0, RANGE_MAX],
+// which keeps this correct when ints are 24-bit too.
+typedef struct {
+  int lo;
+  int hi;
+} Range;
+
+typedef struct {
+  bool reached;
+  int changes;
+  Range regs[RANGE_NUM_REGS];
+} RangeState;
+
+static void range_set(Range* r, int lo, int hi) {
+  r->lo = lo;
+  r->hi = hi;
+}
+
+static void range_of_value(RangeState* s, Value* v, Range* out) {
+  if (v->type == REG)
+    *out = s->regs[v->reg];
+  else
+    range_set(out, v->imm, v->imm);
+}
+
+static int range_min(int a, int b) {
+  return a < b ? a : b;
+}
+
+static int range_max(int a, int b) {
+  return a > b ? a : b;
+}
+
+// Updates |s| for a non-jump |inst|. Records whether an ADD or SUB can
+// wrap around if |mark| is set.
+static void range_transfer(RangeState* s, Inst* inst, bool mark) {
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  switch (inst->op) {
+    case MOV:
+      range_of_value(s, &inst->src, d);
+      break;
+
+    case ADD:
+    case SUB: {
+      range_of_value(s, &inst->src, &b);
+      bool no_wrap = (inst->op == ADD ?
+                      d->hi <= RANGE_MAX - b.hi : d->lo >= b.hi);
+      if (mark)
+        inst->no_wrap = no_wrap;
+      if (!no_wrap)
+        range_set(d, 0, RANGE_MAX);
+      else if (inst->op == ADD)
+        range_set(d, d->lo + b.lo, d->hi + b.hi);
+      else
+        range_set(d, d->lo - b.hi, d->hi - b.lo);
+      break;
+    }
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      range_set(d, 0, 1);
+      break;
+
+    case AND:
+      range_of_value(s, &inst->src, &b);
+      range_set(d, 0, range_min(d->hi, b.hi));
+      break;
+
+    case DIV:
+    case MOD:
+    case SHR:
+      range_set(d, 0, d->hi);
+      break;
+
+    case LOAD:
+    case GETC:
+    case MUL:
+    case OR:
+    case XOR:
+    case SHL:
+      range_set(d, 0, RANGE_MAX);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static Op range_negate(Op op) {
+  switch (op) {
+    case JEQ: return JNE;
+    case JNE: return JEQ;
+    case JLT: return JGE;
+    case JGT: return JLE;
+    case JLE: return JGT;
+    case JGE: return JLT;
+    default: return op;
+  }
+}
+
+// Narrows the dst of a conditional jump in |s| to the values for which
+// it is taken, or not taken if |taken| is false. Returns false if that
+// never happens.
+static bool range_refine(RangeState* s, Inst* inst, bool taken) {
+  if (inst->op == JMP)
+    return taken;
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  range_of_value(s, &inst->src, &b);
+  int lo = d->lo;
+  int hi = d->hi;
+  switch (taken ? inst->op : range_negate(inst->op)) {
+    case JEQ:
+      lo = range_max(lo, b.lo);
+      hi = range_min(hi, b.hi);
+      break;
+    case JNE:
+      if (b.lo != b.hi)
+        break;
+      if (lo == hi && lo == b.lo)
+        return false;
+      if (lo == b.lo)
+        lo++;
+      if (hi == b.lo)
+        hi--;
+      break;
+    case JLT:
+      if (b.hi == 0)
+        return false;
+      hi = range_min(hi, b.hi - 1);
+      break;
+    case JGT:
+      if (b.lo == RANGE_MAX)
+        return false;
+      lo = range_max(lo, b.lo + 1);
+      break;
+    case JLE:
+      hi = range_min(hi, b.hi);
+      break;
+    case JGE:
+      lo = range_max(lo, b.lo);
+      break;
+    default:
+      break;
+  }
+  if (lo > hi)
+    return false;
+  range_set(d, lo, hi);
+  return true;
+}
+
+// Widens |to| to include |from|. Returns whether |to| changed.
+static bool range_join(RangeState* to, RangeState* from, bool widen) {
+  if (!to->reached) {
+    *to = *from;
+    to->reached = true;
+    to->changes = 1;
+    return true;
+  }
+  widen &= to->changes >= RANGE_WIDEN_AFTER;
+  bool changed = false;
+  for (int i = 0; i < RANGE_NUM_REGS; i++) {
+    Range* t = &to->regs[i];
+    Range* f = &from->regs[i];
+    if (f->lo < t->lo) {
+      t->lo = widen ? 0 : f->lo;
+      changed = true;
+    }
+    if (f->hi > t->hi) {
+      t->hi = widen ? RANGE_MAX : f->hi;
+      changed = true;
+    }
+  }
+  if (changed)
+    to->changes++;
+  return changed;
+}
+
+// Runs the block at |pc| from its entry state in |in| and joins its exit
+// states into the entry states of its successors in |out|. Returns
+// whether any of them changed.
+static bool range_block(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, int pc, bool widen) {
+  BasicBlock* bb = &cfg->blocks[pc];
+  int num_pcs = cfg->module->num_pcs;
+  RangeState s = in[pc];
+  bool changed = false;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return changed;
+    if (inst->op < JEQ || inst->op > JMP) {
+      range_transfer(&s, inst, false);
+      continue;
+    }
+
+    RangeState t = s;
+    if (range_refine(&t, inst, true)) {
+      if (inst->jmp.type == REG) {
+        changed |= range_join(indirect, &t, widen);
+      } else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs) {
+        changed |= range_join(&out[inst->jmp.imm], &t, widen);
+      }
+    }
+    if (!range_refine(&s, inst, false))
+      return changed;
+  }
+  if (pc + 1 < num_pcs)
+    changed |= range_join(&out[pc + 1], &s, widen);
+  return changed;
+}
+
+// Runs every reached block once, joining into |out|, and joins the
+// states of register jumps into the address-taken blocks. Returns
+// whether |out| changed.
+static bool range_sweep(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, bool widen) {
+  bool changed = false;
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int pc = cfg->rpo[i];
+    if (pc != cfg->indirect && in[pc].reached)
+      changed |= range_block(cfg, in, out, indirect, pc, widen);
+  }
+  if (indirect->reached) {
+    for (int pc = 0; pc < cfg->module->num_pcs; pc++) {
+      if (cfg->blocks[pc].address_taken)
+        changed |= range_join(&out[pc], indirect, widen);
+    }
+  }
+  return changed;
+}
+
+static RangeState* range_new_states(int num_pcs) {
+  RangeState* states = calloc(num_pcs, sizeof(RangeState));
+  // Registers start at zero.
+  states[0].reached = true;
+  return states;
+}
+
+void analyze_ranges(Module* m) {
+  for (int i = 0; i < m->num_insts; i++)
+    m->insts[i].no_wrap = false;
+  if (!m->num_pcs)
+    return;
+
+  CFG* cfg = build_cfg(m);
+  RangeState* in = range_new_states(m->num_pcs);
+  RangeState indirect = {};
+  while (range_sweep(cfg, in, in, &indirect, true)) {}
+
+  // A sweep from a fixpoint gives a tighter one, so it is fine to stop
+  // after any round.
+  for (int round = 0; round < RANGE_NARROW_ROUNDS; round++) {
+    RangeState* next = range_new_states(m->num_pcs);
+    RangeState next_indirect = {};
+    range_sweep(cfg, in, next, &next_indirect, false);
+    free(in);
+    in = next;
+  }
+
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (!in[pc].reached)
+      continue;
+    BasicBlock* bb = &cfg->blocks[pc];
+    RangeState s = in[pc];
+    for (int i = 0; i < bb->num_insts; i++) {
+      Inst* inst = &bb->insts[i];
+      if (inst->op == EXIT || (inst->op >= JEQ && inst->op <= JMP))
+        break;
+      range_transfer(&s, inst, true);
+    }
+  }
+  free(in);
+  free_cfg(cfg);
+}
+#include <ir/live.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static int live_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+static bool live_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static int live_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return live_reg_bit(&inst->src);
+    case JMP:
+      return live_reg_bit(&inst->jmp);
+    case GETC:
+    case EXIT:
+    case DUMP:
+      return 0;
+    case COPY:
+    case FILL:
+      // The length is in jmp.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              live_reg_bit(&inst->jmp));
+    default:
+      // STORE keeps its value in dst.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              (live_is_jump(inst->op) ? live_reg_bit(&inst->jmp) : 0));
+  }
+}
+
+static int live_defs(Inst* inst) {
+  switch (inst->op) {
+    case MOV: case ADD: case SUB: case LOAD: case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return live_reg_bit(&inst->dst);
+    default:
+      return 0;
+  }
+}
+
+// Computes the live-in set of the block at |pc| from the live-in sets
+// of blocks in |in|, filling in per-instruction sets if |record|.
+static int live_block(Liveness* lv, CFG* cfg, int* in, int pc,
+                      bool record) {
+  Module* m = lv->module;
+  BasicBlock* bb = &cfg->blocks[pc];
+  int live = pc + 1 < m->num_pcs ? in[pc + 1] : 0;
+  for (int i = bb->num_insts - 1; i >= 0; i--) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT) {
+      live = 0;
+    } else if (live_is_jump(inst->op)) {
+      int target = 0;
+      if (inst->jmp.type == REG)
+        target = in[cfg->indirect];
+      else if (inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs)
+        target = in[inst->jmp.imm];
+      live = inst->op == JMP ? target : live | target;
+    }
+    if (record)
+      lv->live_out[inst - m->insts] = live;
+    live = (live & ~live_defs(inst)) | live_uses(inst);
+    if (record)
+      lv->live_in[inst - m->insts] = live;
+  }
+  return live;
+}
+
+Liveness* build_liveness(Module* m) {
+  Liveness* lv = calloc(1, sizeof(Liveness));
+  lv->module = m;
+  lv->live_in = calloc(m->num_insts + 1, sizeof(int));
+  lv->live_out = calloc(m->num_insts + 1, sizeof(int));
+
+  CFG* cfg = build_cfg(m);
+  int* in = calloc(cfg->num_blocks, sizeof(int));
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int pc = m->num_pcs - 1; pc >= 0; pc--) {
+      int live = live_block(lv, cfg, in, pc, false);
+      if (live != in[pc]) {
+        in[pc] = live;
+        changed = true;
+      }
+    }
+    int live = 0;
+    for (int i = 0; i < indirect->num_succs; i++)
+      live |= in[indirect->succs[i]];
+    if (live != in[cfg->indirect]) {
+      in[cfg->indirect] = live;
+      changed = true;
+    }
+  }
+  for (int pc = 0; pc < m->num_pcs; pc++)
+    live_block(lv, cfg, in, pc, true);
+
+  free(in);
+  free_cfg(cfg);
+  return lv;
+}
+
+void free_liveness(Liveness* lv) {
+  free(lv->live_in);
+  free(lv->live_out);
+  free(lv);
+}
+
+int get_live_in(Liveness* lv, Inst* inst) {
+  return lv->live_in[inst - lv->module->insts];
+}
+
+int get_live_out(Liveness* lv, Inst* inst) {
+  return lv->live_out[inst - lv->module->insts];
+}
+
+bool is_dead_store(Liveness* lv, Inst* inst) {
+  // GETC also consumes input.
+  return (inst->op != GETC && live_defs(inst) &&
+          !(live_defs(inst) & get_live_out(lv, inst)));
+}
+
+static void live_dump_set(const char* name, int regs, FILE* fp) {
+  static const char* names[] = { "A", "B", "C", "D", "BP", "SP" };
+  fprintf(fp, "%s={", name);
+  const char* sep = "";
+  for (int r = 0; r < 6; r++) {
+    if (regs & (1 << r)) {
+      fprintf(fp, "%s%s", sep, names[r]);
+      sep = ",";
+    }
+  }
+  fprintf(fp, "} ");
+}
+
+void dump_liveness(Liveness* lv, FILE* fp) {
+  for (Inst* inst = lv->module->text; inst; inst = inst->next) {
+    live_dump_set("in", get_live_in(lv, inst), fp);
+    live_dump_set("out", get_live_out(lv, inst), fp);
+    dump_inst_fp(inst, fp);
+  }
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static bool merge_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+// Whether |inst| is a jump to an immediate pc of |m|.
+static bool merge_is_direct_jump(Module* m, Inst* inst) {
+  return (merge_is_jump(inst->op) && inst->jmp.type == IMM &&
+          inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs);
+}
+
+// Returns where a jump to |pc| ends up, following blocks which are only
+// a "jmp" to another pc. Loops of such blocks are left alone.
+static int merge_thread(Module* m, int pc) {
+  int to = pc;
+  for (int steps = 0; steps < m->num_pcs; steps++) {
+    int start = m->pc_start[to];
+    if (m->pc_start[to + 1] - start != 1)
+      return to;
+    Inst* inst = &m->insts[start];
+    if (inst->op != JMP || !merge_is_direct_jump(m, inst))
+      return to;
+    to = inst->jmp.imm;
+  }
+  return pc;
+}
+
+// The last instruction of |pc| which was not removed, or NULL.
+static Inst* merge_last_inst(Module* m, bool* removed, int pc) {
+  for (int i = m->pc_start[pc + 1] - 1; i >= m->pc_start[pc]; i--) {
+    if (!removed[i])
+      return &m->insts[i];
+  }
+  return NULL;
+}
+
+void merge_basic_blocks(Module* m) {
+  int num_pcs = m->num_pcs;
+  if (!num_pcs)
+    return;
+
+  // Jumps go straight to the end of jump chains.
+  int* thread = malloc(sizeof(int) * num_pcs);
+  for (int pc = 0; pc < num_pcs; pc++)
+    thread[pc] = merge_thread(m, pc);
+  bool changed = false;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (merge_is_direct_jump(m, inst) && thread[inst->jmp.imm] != inst->jmp.imm) {
+      inst->jmp.imm = thread[inst->jmp.imm];
+      changed = true;
+    }
+  }
+  free(thread);
+
+  // A jump to the next pc does nothing, unless it is all its pc has.
+  bool* removed = calloc(m->num_insts + 1, sizeof(bool));
+  for (int pc = 0; pc + 1 < num_pcs; pc++) {
+    int last = m->pc_start[pc + 1] - 1;
+    if (last <= m->pc_start[pc])
+      continue;
+    Inst* inst = &m->insts[last];
+    if (merge_is_direct_jump(m, inst) && inst->jmp.imm == pc + 1) {
+      removed[last] = true;
+      changed = true;
+    }
+  }
+
+  // A pc which is entered only by falling into it joins the previous
+  // one. Pcs a register jump may reach keep their pcs, and so does every
+  // pc up to the highest one a plain number may name, since plain
+  // numbers are not relocated.
+  CFG* cfg = build_cfg(m);
+  bool* entered = calloc(num_pcs, sizeof(bool));
+  entered[0] = true;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (!removed[i] && merge_is_direct_jump(m, inst))
+      entered[inst->jmp.imm] = true;
+  }
+  for (int pc = 0; pc < num_pcs; pc++)
+    entered[pc] |= cfg->blocks[pc].address_taken || pc <= cfg->max_plain_pc;
+  free_cfg(cfg);
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  pc_map[0] = 0;
+  for (int pc = 1; pc < num_pcs; pc++) {
+    Inst* prev = merge_last_inst(m, removed, pc - 1);
+    bool falls = !prev || (!merge_is_jump(prev->op) && prev->op != EXIT);
+    if (falls && !entered[pc]) {
+      pc_map[pc] = pc_map[pc - 1];
+      changed = true;
+    } else {
+      pc_map[pc] = pc_map[pc - 1] + 1;
+    }
+  }
+  pc_map[num_pcs] = pc_map[num_pcs - 1] + 1;
+  free(entered);
+
+  if (changed) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (removed[i])
+        continue;
+      if (prev)
+        prev->next = &m->insts[i];
+      else
+        m->text = &m->insts[i];
+      prev = &m->insts[i];
+    }
+    if (prev)
+      prev->next = NULL;
+    else
+      m->text = NULL;
+
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next)
+      inst->pc = pc_map[inst->pc];
+    reindex_module(m);
+  }
+  free(pc_map);
+  free(removed);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/cfg.h>
+
+// Keeps the pcs reachable from pc 0 and the data they refer to, then
+// renumbers both. Any text label value in kept code or data is assumed
+// to be jumped to.
+//
+// Plain numbers are never relocated. When kept code jumps through a
+// register, a plain number in kept code or data which cfg_code_address
+// says may be a pc makes every pc up to it keep its place. Likewise, data up to the
+// highest plain address given to a load or store keeps its place.
+//
+// A data object spans from one data label to the next. Objects are
+// dropped only while every kept load and store has a fixed address, as
+// code which computes addresses may step from one label into the
+// objects around it. Otherwise the data segment is kept whole.
+
+typedef struct {
+  Module* m;
+  bool* pc_live;
+  int* pc_stack;
+  int num_pc_stack;
+  // Pcs below this are kept.
+  int pc_pinned;
+  // Whether a kept jump goes through a register, and the highest plain
+  // number in kept code or data which may be a pc, or -1.
+  bool reg_jump;
+  int max_pc_number;
+  Data** words;
+  int num_words;
+  // The object of each word, and where each object starts.
+  int* word_obj;
+  int* obj_start;
+  int num_objs;
+  bool* obj_live;
+  int* obj_stack;
+  int num_obj_stack;
+  // Words below this are kept.
+  int pinned;
+  // Whether every kept load and store has a fixed address.
+  bool data_exact;
+} Dce;
+
+static void dce_mark_pc(Dce* d, int pc) {
+  if (pc < 0 || pc >= d->m->num_pcs || d->pc_live[pc])
+    return;
+  d->pc_live[pc] = true;
+  d->pc_stack[d->num_pc_stack++] = pc;
+}
+
+static void dce_mark_addr(Dce* d, int addr) {
+  if (addr < 0 || addr >= d->num_words)
+    return;
+  int obj = d->word_obj[addr];
+  if (d->obj_live[obj])
+    return;
+  d->obj_live[obj] = true;
+  d->obj_stack[d->num_obj_stack++] = obj;
+}
+
+// Keeps |pc| and every pc before it where they are.
+static void dce_pin_pc(Dce* d, int pc) {
+  if (pc >= d->m->num_pcs)
+    pc = d->m->num_pcs - 1;
+  for (; d->pc_pinned <= pc; d->pc_pinned++)
+    dce_mark_pc(d, d->pc_pinned);
+}
+
+static void dce_note_number(Dce* d, int pc) {
+  if (pc > d->max_pc_number)
+    d->max_pc_number = pc;
+}
+
+// Keeps |addr| where it is. Addresses past the data are the heap's.
+static void dce_pin(Dce* d, int addr) {
+  if (addr >= d->num_words)
+    return;
+  for (; d->pinned <= addr; d->pinned++)
+    dce_mark_addr(d, d->pinned);
+}
+
+static void dce_mark_label(Dce* d, LabelType label, int v) {
+  if (label == TEXT_LABEL)
+    dce_mark_pc(d, v);
+  else if (label == DATA_LABEL)
+    dce_mark_addr(d, v);
+}
+
+static void dce_mark_value(Dce* d, Value* v) {
+  if (v->type == IMM)
+    dce_mark_label(d, v->label, v->imm);
+}
+
+static void dce_scan_pc(Dce* d, int pc) {
+  Module* m = d->m;
+  bool falls = true;
+  for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+    Inst* inst = &m->insts[i];
+    Op op = inst->op;
+    dce_mark_value(d, &inst->dst);
+    dce_mark_value(d, &inst->src);
+    if (op >= JEQ && op <= JMP) {
+      if (inst->jmp.type == IMM)
+        dce_mark_pc(d, inst->jmp.imm);
+      else
+        d->reg_jump = true;
+    } else {
+      dce_mark_value(d, &inst->jmp);
+    }
+    bool plain_src = inst->src.type == IMM && inst->src.label == NOT_LABEL;
+    if (op == LOAD || op == STORE) {
+      if (plain_src)
+        dce_pin(d, inst->src.imm);
+      else if (inst->src.type == REG)
+        d->data_exact = false;
+    } else if (op == COPY || op == FILL) {
+      d->data_exact = false;
+    } else if (plain_src) {
+      dce_note_number(d, cfg_code_address(m, inst, &inst->src, true));
+    }
+    if (inst->op == JMP || inst->op == EXIT)
+      falls = false;
+  }
+  if (falls)
+    dce_mark_pc(d, pc + 1);
+}
+
+static void dce_scan_obj(Dce* d, int obj) {
+  for (int a = d->obj_start[obj]; a < d->obj_start[obj + 1]; a++) {
+    Data* data = d->words[a];
+    if (data->label == NOT_LABEL)
+      dce_note_number(d, cfg_data_code_address(d->m, data, true));
+    else
+      dce_mark_label(d, data->label, data->v);
+  }
+}
+
+static void dce_init_objects(Dce* d) {
+  Module* m = d->m;
+  bool* starts = calloc(d->num_words + 1, sizeof(bool));
+  starts[0] = true;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && sym->value >= 0 && sym->value < d->num_words)
+      starts[sym->value] = true;
+  }
+  d->word_obj = malloc(sizeof(int) * (d->num_words + 1));
+  d->obj_start = malloc(sizeof(int) * (d->num_words + 1));
+  for (int a = 0; a < d->num_words; a++) {
+    if (starts[a])
+      d->obj_start[d->num_objs++] = a;
+    d->word_obj[a] = d->num_objs - 1;
+  }
+  d->obj_start[d->num_objs] = d->num_words;
+  d->obj_live = calloc(d->num_objs + 1, sizeof(bool));
+  d->obj_stack = malloc(sizeof(int) * (d->num_objs + 1));
+  free(starts);
+}
+
+static void dce_relocate_data(Value* v, const int* data_map, int num_words) {
+  if (v->type == IMM && v->label == DATA_LABEL &&
+      v->imm >= 0 && v->imm <= num_words)
+    v->imm = data_map[v->imm];
+}
+
+void remove_dead_code_and_data(Module* m) {
+  if (!m->num_pcs)
+    return;
+
+  Dce d = {};
+  d.m = m;
+  d.max_pc_number = -1;
+  d.data_exact = true;
+  d.pc_live = calloc(m->num_pcs, sizeof(bool));
+  d.pc_stack = malloc(sizeof(int) * m->num_pcs);
+  for (Data* data = m->data; data; data = data->next)
+    d.num_words++;
+  d.words = malloc(sizeof(Data*) * (d.num_words + 1));
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    d.words[n++] = data;
+  dce_init_objects(&d);
+
+  // _edata holds the start of the heap, which malloc reads.
+  Data* edata = NULL;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && !strcmp(sym->name, "_edata") &&
+        sym->value >= 0 && sym->value < d.num_words) {
+      edata = d.words[sym->value];
+      dce_mark_addr(&d, sym->value);
+    }
+  }
+  dce_mark_pc(&d, 0);
+  for (;;) {
+    while (d.num_pc_stack || d.num_obj_stack) {
+      if (d.num_pc_stack)
+        dce_scan_pc(&d, d.pc_stack[--d.num_pc_stack]);
+      else
+        dce_scan_obj(&d, d.obj_stack[--d.num_obj_stack]);
+    }
+    // Both may keep more code, which may find more of either.
+    if (!d.data_exact && d.pinned < d.num_words)
+      dce_pin(&d, d.num_words - 1);
+    else if (d.reg_jump && d.pc_pinned <= d.max_pc_number)
+      dce_pin_pc(&d, d.max_pc_number);
+    else
+      break;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int num_pcs = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = num_pcs;
+    num_pcs += d.pc_live[pc];
+  }
+  pc_map[m->num_pcs] = num_pcs;
+  int* data_map = malloc(sizeof(int) * (d.num_words + 1));
+  int num_words = 0;
+  for (int a = 0; a < d.num_words; a++) {
+    data_map[a] = num_words;
+    num_words += d.obj_live[d.word_obj[a]];
+  }
+  data_map[d.num_words] = num_words;
+
+  if (num_pcs < m->num_pcs || num_words < d.num_words) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      Inst* inst = &m->insts[i];
+      if (!d.pc_live[inst->pc])
+        continue;
+      if (prev)
+        prev->next = inst;
+      else
+        m->text = inst;
+      prev = inst;
+    }
+    prev->next = NULL;
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next) {
+      inst->pc = pc_map[inst->pc];
+      dce_relocate_data(&inst->dst, data_map, d.num_words);
+      dce_relocate_data(&inst->src, data_map, d.num_words);
+      if (inst->op < JEQ || inst->op > JMP)
+        dce_relocate_data(&inst->jmp, data_map, d.num_words);
+    }
+
+    Data* last = NULL;
+    m->data = NULL;
+    for (int a = 0; a < d.num_words; a++) {
+      Data* data = d.words[a];
+      if (!d.obj_live[d.word_obj[a]])
+        continue;
+      if (data->label == DATA_LABEL && data->v >= 0 && data->v <= d.num_words)
+        data->v = data_map[data->v];
+      if (last)
+        last->next = data;
+      else
+        m->data = data;
+      last = data;
+    }
+    if (last)
+      last->next = NULL;
+    if (edata && edata->v >= 0 && edata->v <= d.num_words)
+      edata->v = data_map[edata->v];
+    for (int i = 0; i < m->num_syms; i++) {
+      Symbol* sym = &m->syms[i];
+      if (!sym->is_text && sym->value >= 0 && sym->value <= d.num_words)
+        sym->value = data_map[sym->value];
+    }
+    reindex_module(m);
+  }
+
+  free(pc_map);
+  free(data_map);
+  free(d.pc_live);
+  free(d.pc_stack);
+  free(d.words);
+  free(d.word_obj);
+  free(d.obj_start);
+  free(d.obj_live);
+  free(d.obj_stack);
+}
+#include <ir/cfg.h>
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Backends built on emit_chunked_main_loop put pcs p with the same
+// p / chunk size into one function, and every jump between functions
+// goes through the outer dispatcher. The layout pass moves hot code
+// together so hot loops do not cross a chunk boundary.
+//
+// Pcs linked by fallthrough form a chain, which is moved as a whole so
+// no jump needs to be added. Starting from the hottest chain not yet
+// placed, a group grows by the hottest chain any of its members jumps
+// to, until it would not fit in a chunk. A group which would straddle
+// a boundary starts at the next one instead, leaving unused pcs. The
+// chains with pc 0 and with the pcs a plain number may name keep their
+// place, hot groups follow by heat, and chains which never ran keep
+// their order at the end.
+
+static int g_layout_chunk_size = 512;
+
+void set_layout_chunk_size(int n) {
+  g_layout_chunk_size = n;
+}
+
+// Only the hosted tools take -profile=, and ELVM's libc has no strncmp.
+#ifndef __eir__
+void load_pc_profile(Module* m, const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "cannot open profile: %s\n", filename);
+    exit(1);
+  }
+  char buf[256];
+  while (fgets(buf, sizeof(buf), fp)) {
+    if (strncmp(buf, "pc ", 3))
+      continue;
+    char* p;
+    int pc = strtol(buf + 3, &p, 10);
+    long count = strtol(p, NULL, 10);
+    if (pc < 0 || pc >= m->num_pcs)
+      continue;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++)
+      m->insts[i].count = count;
+  }
+  fclose(fp);
+}
+#endif
+
+typedef struct {
+  int first_pc;
+  int num_pcs;
+  long heat;
+  bool placed;
+} LayoutChain;
+
+static bool layout_falls(Module* m, int pc) {
+  int end = m->pc_start[pc + 1];
+  if (end == m->pc_start[pc])
+    return true;
+  Op op = m->insts[end - 1].op;
+  return op != JMP && op != EXIT;
+}
+
+static int layout_compare_heat(const void* a, const void* b) {
+  const LayoutChain* x = *(LayoutChain* const*)a;
+  const LayoutChain* y = *(LayoutChain* const*)b;
+  if (x->heat != y->heat)
+    return x->heat > y->heat ? -1 : 1;
+  return x->first_pc - y->first_pc;
+}
+
+// Returns the hottest unplaced chain the chains in |group| jump to, or
+// -1 if there is none with a count.
+static int layout_best_succ(Module* m, LayoutChain* chains, int* chain_of,
+                            int* group, int num_group) {
+  int best = -1;
+  for (int g = 0; g < num_group; g++) {
+    LayoutChain* c = &chains[group[g]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op < JEQ || inst->op > JMP || inst->jmp.type != IMM ||
+          inst->jmp.imm < 0 || inst->jmp.imm >= m->num_pcs)
+        continue;
+      int to = chain_of[inst->jmp.imm];
+      if (chains[to].placed || !chains[to].heat)
+        continue;
+      if (best == -1 || chains[to].heat > chains[best].heat)
+        best = to;
+    }
+  }
+  return best;
+}
+
+// Returns the hottest unplaced chain, or -1 if there is none with a
+// count. |by_heat| before |*next_seed| are all placed.
+static int layout_next_seed(LayoutChain* chains, LayoutChain** by_heat,
+                            int num_chains, int* next_seed) {
+  for (; *next_seed < num_chains; (*next_seed)++) {
+    LayoutChain* c = by_heat[*next_seed];
+    if (!c->placed && c->heat)
+      return c - chains;
+  }
+  return -1;
+}
+
+void layout_by_profile(Module* m) {
+  bool has_counts = false;
+  for (int i = 0; i < m->num_insts; i++)
+    has_counts |= m->insts[i].count != 0;
+  if (!has_counts)
+    return;
+
+  int num_pcs = m->num_pcs;
+  int chunk = g_layout_chunk_size;
+  LayoutChain* chains = calloc(num_pcs, sizeof(LayoutChain));
+  int* chain_of = malloc(sizeof(int) * num_pcs);
+  int num_chains = 0;
+  for (int pc = 0; pc < num_pcs; pc++) {
+    if (pc == 0 || !layout_falls(m, pc - 1))
+      chains[num_chains++].first_pc = pc;
+    LayoutChain* c = &chains[num_chains - 1];
+    c->num_pcs++;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (m->insts[i].count > c->heat)
+        c->heat = m->insts[i].count;
+    }
+    chain_of[pc] = num_chains - 1;
+  }
+  // Falling off the last pc must still end the program, so the last
+  // chain stays last if it can.
+  if (layout_falls(m, num_pcs - 1))
+    chains[num_chains - 1].heat = 0;
+
+  LayoutChain** by_heat = malloc(sizeof(LayoutChain*) * num_chains);
+  for (int i = 0; i < num_chains; i++)
+    by_heat[i] = &chains[i];
+  qsort(by_heat, num_chains, sizeof(LayoutChain*), layout_compare_heat);
+
+  // Chains in their new order, and where each goes.
+  int* order = malloc(sizeof(int) * num_chains);
+  int* base = malloc(sizeof(int) * num_chains);
+  int num_order = 0;
+  int next_pc = 0;
+  int next_seed = 0;
+  CFG* cfg = build_cfg(m);
+  int max_fixed_pc = cfg->max_plain_pc;
+  free_cfg(cfg);
+  for (int c = 0; c < num_chains &&
+                  (c == 0 || chains[c].first_pc <= max_fixed_pc); c++) {
+    chains[c].placed = true;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+  for (int seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+       seed >= 0;) {
+    int* group = &order[num_order];
+    int num_group = 0;
+    int size = 0;
+    for (int c = seed; c >= 0;
+         c = layout_best_succ(m, chains, chain_of, group, num_group)) {
+      if (num_group && size + chains[c].num_pcs > chunk)
+        break;
+      chains[c].placed = true;
+      group[num_group++] = c;
+      size += chains[c].num_pcs;
+    }
+    if (size <= chunk && next_pc % chunk + size > chunk)
+      next_pc += chunk - next_pc % chunk;
+    for (int g = 0; g < num_group; g++) {
+      base[group[g]] = next_pc;
+      next_pc += chains[group[g]].num_pcs;
+    }
+    num_order += num_group;
+    seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+  }
+  for (int c = 0; c < num_chains; c++) {
+    if (chains[c].placed)
+      continue;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  for (int c = 0; c < num_chains; c++) {
+    for (int i = 0; i < chains[c].num_pcs; i++)
+      pc_map[chains[c].first_pc + i] = base[c] + i;
+  }
+  pc_map[num_pcs] = next_pc;
+  relocate_text_labels(m, pc_map);
+
+  Inst root = {};
+  Inst* tail = &root;
+  for (int o = 0; o < num_order; o++) {
+    LayoutChain* c = &chains[order[o]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      inst->pc = pc_map[inst->pc];
+      tail->next = inst;
+      tail = inst;
+    }
+  }
+  tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+
+  free(pc_map);
+  free(base);
+  free(order);
+  free(by_heat);
+  free(chain_of);
+  free(chains);
+}
@@ -0,0 +1,15530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/ir.h>
+#include <ir/pass.h>
+#include <target/util.h>
+
+void target_arm(Module* module);
+void target_asmjs(Module* module);
+void target_bef(Module* module);
+void target_bf(Module* module);
+void target_c(Module* module);
+void target_cl(Module* module);
+void target_cpp(Module* module);
+void target_cpp_template(Module* module);
+void target_cr(Module* module);
+void target_cs(Module* module);
+void target_el(Module* module);
+void target_forth(Module* module);
+void target_fs(Module* module);
+void target_go(Module* module);
+void target_i(Module* module);
+void target_java(Module* module);
+void target_js(Module* module);
+void target_lua(Module* module);
+void target_ll(Module* module);
+void target_php(Module* module);
+void target_piet(Module* module);
+void target_pietasm(Module* module);
+void target_pl(Module* module);
+void target_py(Module* module);
+void target_ps(Module* module);
+void target_rb(Module* module);
+void target_scm_sr(Module* module);
+void target_sed(Module* module);
+void target_sh(Module* module);
+void target_sqlite3(Module* module);
+void target_swift(Module* module);
+void target_tex(Module* module);
+void target_tf(Module* module);
+void target_tm(Module* module);
+void target_unl(Module* module);
+void target_vim(Module* module);
+void target_ws(Module* module);
+void target_x86(Module* module);
+
+typedef void (*target_func_t)(Module*);
+
+// Passes the chosen backend relies on. They run after the ones given by
+// flags.
+static char target_passes[64];
+
+static void add_target_pass(const char* name) {
+  if (*target_passes)
+    strcat(target_passes, ",");
+  strcat(target_passes, name);
+}
+
+// Backends which implement MUL .. SHR themselves.
+static bool has_ext_ops(const char* ext) {
+  return (!strcmp(ext, "arm") || !strcmp(ext, "c") || !strcmp(ext, "js") ||
+          !strcmp(ext, "ll") || !strcmp(ext, "x86"));
+}
+
+// Backends which implement COPY and FILL themselves.
+static bool has_block_ops(const char* ext) {
+  return !strcmp(ext, "c") || !strcmp(ext, "js") || !strcmp(ext, "x86");
+}
+
+// Backends which skip wrapping ADD and SUB marked as no_wrap.
+static bool uses_ranges(const char* ext) {
+  return (!strcmp(ext, "arm") || !strcmp(ext, "c") || !strcmp(ext, "cpp") ||
+          !strcmp(ext, "go") || !strcmp(ext, "java") || !strcmp(ext, "js") ||
+          !strcmp(ext, "ll") || !strcmp(ext, "x86"));
+}
+
+// Profile counts given by -profile=FILE, which the layout pass uses.
+static const char* profile_file = NULL;
+
+// The number of pcs in each function emit_chunked_main_loop emits for
+// the backend, or 0 if the backend does not use it.
+static int chunk_size(const char* ext) {
+  static const char* CHUNKED[] = {
+    "asmjs", "c", "cl", "cr", "el", "forth", "fs", "js", "ll", "lua", "php",
+    "py", "rb", "vim", NULL
+  };
+  if (!strcmp(ext, "cs") || !strcmp(ext, "java") || !strcmp(ext, "swift"))
+    return 256;
+  for (int i = 0; CHUNKED[i]; i++) {
+    if (!strcmp(ext, CHUNKED[i]))
+      return 512;
+  }
+  return 0;
+}
+
+static void add_target_passes(const char* ext) {
+  if (!has_ext_ops(ext))
+    add_target_pass("lower_ext");
+  if (!has_block_ops(ext))
+    add_target_pass("lower_block");
+  // Helpers from lowering are placed by their call counts too.
+  if (profile_file && chunk_size(ext)) {
+    set_layout_chunk_size(chunk_size(ext));
+    add_target_pass("layout");
+  }
+  // Lowering adds ADD and SUB, so the ranges pass runs last.
+  if (uses_ranges(ext))
+    add_target_pass("ranges");
+  if (!strcmp(ext, "bf"))
+    add_target_pass("split_mem");
+}
+
+static target_func_t get_target_func(const char* ext) {
+  if (!strcmp(ext, "arm")) return target_arm;
+  if (!strcmp(ext, "asmjs")) return target_asmjs;
+  if (!strcmp(ext, "bef")) return target_bef;
+  if (!strcmp(ext, "bf")) return target_bf;
+  if (!strcmp(ext, "c")) return target_c;
+  if (!strcmp(ext, "cl")) return target_cl;
+  if (!strcmp(ext, "cpp")) return target_cpp;
+  if (!strcmp(ext, "cpp_template")) return target_cpp_template;
+  if (!strcmp(ext, "cr")) return target_cr;
+  if (!strcmp(ext, "cs")) return target_cs;
+  if (!strcmp(ext, "el")) return target_el;
+  if (!strcmp(ext, "forth")) return target_forth;
+  if (!strcmp(ext, "fs")) return target_fs;
+  if (!strcmp(ext, "go")) return target_go;
+  if (!strcmp(ext, "i")) return target_i;
+  if (!strcmp(ext, "java")) return target_java;
+  if (!strcmp(ext, "js")) return target_js;
+  if (!strcmp(ext, "lua")) return target_lua;
+  if (!strcmp(ext, "ll")) return target_ll;
+  if (!strcmp(ext, "php")) return target_php;
+  if (!strcmp(ext, "piet")) return target_piet;
+  if (!strcmp(ext, "pietasm")) return target_pietasm;
+  if (!strcmp(ext, "pl")) return target_pl;
+  if (!strcmp(ext, "py")) return target_py;
+  if (!strcmp(ext, "ps")) return target_ps;
+  if (!strcmp(ext, "rb")) return target_rb;
+  if (!strcmp(ext, "scm_sr")) return target_scm_sr;
+  if (!strcmp(ext, "sed")) return target_sed;
+  if (!strcmp(ext, "sh")) return target_sh;
+  if (!strcmp(ext, "sqlite3")) return target_sqlite3;
+  if (!strcmp(ext, "swift")) return target_swift;
+  if (!strcmp(ext, "tex")) return target_tex;
+  if (!strcmp(ext, "tf")) return target_tf;
+  if (!strcmp(ext, "tm")) return target_tm;
+  if (!strcmp(ext, "unl")) return target_unl;
+  if (!strcmp(ext, "vim")) return target_vim;
+  if (!strcmp(ext, "ws")) return target_ws;
+  if (!strcmp(ext, "x86")) return target_x86;
+  error("unknown flag: %s", ext);
+}
+
+static bool show_pass_stats = false;
+
+// ELVM's libc has no strncmp, and this runs when elc is self-hosted.
+static bool has_prefix(const char* s, const char* prefix) {
+  for (; *prefix; s++, prefix++) {
+    if (*s != *prefix)
+      return false;
+  }
+  return true;
+}
+
+static bool handle_pass_flag(const char* arg) {
+  if (!strcmp(arg, "-O")) {
+    add_passes("opt,merge");
+  } else if (has_prefix(arg, "-passes=")) {
+    add_passes(arg + 8);
+  } else if (!strcmp(arg, "-stats")) {
+    show_pass_stats = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+#if defined(NOFILE) || defined(__eir__)
+  // The first line is the target, optionally followed by flags such as
+  // "-O" separated by spaces.
+  char buf[256];
+  for (int i = 0;; i++) {
+    int c = getchar();
+    if (c == '\n' || c == EOF || i == 255) {
+      buf[i] = 0;
+      break;
+    }
+    buf[i] = c;
+  }
+  char* flags = strchr(buf, ' ');
+  while (flags) {
+    *flags++ = 0;
+    char* next = strchr(flags, ' ');
+    if (next)
+      *next = 0;
+    if (*flags && !handle_pass_flag(flags))
+      error("unknown flag: %s", flags);
+    if (next)
+      *next = ' ';
+    flags = next;
+  }
+  const char* ext = buf;
+  target_func_t target_func = get_target_func(ext);
+  Module* module = load_eir(stdin);
+#else
+  target_func_t target_func = NULL;
+  const char* ext = NULL;
+  const char* filename = NULL;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (handle_pass_flag(arg)) {
+      continue;
+    } else if (!strncmp(arg, "-profile=", 9)) {
+      profile_file = arg + 9;
+    } else if (arg[0] == '-') {
+      ext = arg + 1;
+      target_func = get_target_func(ext);
+    } else {
+      filename = arg;
+    }
+  }
+
+  if (!filename) {
+    error("no input file");
+  }
+  if (!target_func) {
+    error("no target");
+  }
+
+  Module* module = load_eir_from_file(filename);
+  if (profile_file)
+    load_pc_profile(module, profile_file);
+#endif
+  add_target_passes(ext);
+  add_passes(target_passes);
+  run_passes(module, show_pass_stats);
+  target_func(module);
+}
+#include <target/util.h>
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char* vformat(const char* fmt, va_list ap) {
+  char buf[256];
+  vsnprintf(buf, 255, fmt, ap);
+  buf[255] = 0;
+  return strdup(buf);
+}
+
+char* format(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char* r = vformat(fmt, ap);
+  va_end(ap);
+  return r;
+}
+
+void error(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char* r = vformat(fmt, ap);
+  va_end(ap);
+  fprintf(stderr, "%s\n", r);
+  exit(1);
+}
+
+static int g_indent;
+
+void inc_indent() {
+  g_indent++;
+}
+
+void dec_indent() {
+  g_indent--;
+}
+
+void emit_line(const char* fmt, ...) {
+  if (fmt[0]) {
+    for (int i = 0; i < g_indent; i++)
+      putchar(' ');
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+  }
+  putchar('\n');
+}
+
+static const char* DEFAULT_REG_NAMES[7] = {
+  "a", "b", "c", "d", "bp", "sp", "pc"
+};
+
+const char** reg_names = DEFAULT_REG_NAMES;
+
+const char* value_str(Value* v) {
+  if (v->type == REG) {
+    return reg_names[v->reg];
+  } else if (v->type == IMM) {
+    return format("%d", v->imm);
+  } else {
+    error("invalid value");
+  }
+}
+
+const char* src_str(Inst* inst) {
+  return value_str(&inst->src);
+}
+
+Op normalize_cond(Op op, bool flip) {
+  if (op >= 16)
+    op -= 8;
+  if (flip) {
+    static const Op TBL[] = {
+      JNE, JEQ, JGE, JLE, JGT, JLT, JMP
+    };
+    op = TBL[op-JEQ];
+  }
+  return (Op)op;
+}
+
+const char* cmp_str(Inst* inst, const char* true_str) {
+  int op = normalize_cond(inst->op, 0);
+  const char* op_str;
+  switch (op) {
+    case JEQ:
+      op_str = "=="; break;
+    case JNE:
+      op_str = "!="; break;
+    case JLT:
+      op_str = "<"; break;
+    case JGT:
+      op_str = ">"; break;
+    case JLE:
+      op_str = "<="; break;
+    case JGE:
+      op_str = ">="; break;
+    case JMP:
+      return true_str;
+    default:
+      error("oops");
+  }
+  return format("%s %s %s", reg_names[inst->dst.reg], op_str, src_str(inst));
+}
+
+static int g_emit_cnt;
+static bool g_emit_started;
+
+int emit_cnt() {
+  return g_emit_cnt;
+}
+
+void emit_reset() {
+  g_emit_cnt = 0;
+  g_emit_started = false;
+}
+
+void emit_start() {
+  g_emit_started = true;
+}
+
+void emit_1(int a) {
+  g_emit_cnt++;
+  if (g_emit_started)
+    putchar(a);
+}
+
+void emit_2(int a, int b) {
+  emit_1(a);
+  emit_1(b);
+}
+
+void emit_3(int a, int b, int c) {
+  emit_1(a);
+  emit_1(b);
+  emit_1(c);
+}
+
+void emit_4(int a, int b, int c, int d) {
+  emit_1(a);
+  emit_1(b);
+  emit_1(c);
+  emit_1(d);
+}
+
+void emit_5(int a, int b, int c, int d, int e) {
+  emit_1(a);
+  emit_1(b);
+  emit_1(c);
+  emit_1(d);
+  emit_1(e);
+}
+
+void emit_6(int a, int b, int c, int d, int e, int f) {
+  emit_1(a);
+  emit_1(b);
+  emit_1(c);
+  emit_1(d);
+  emit_1(e);
+  emit_1(f);
+}
+
+void emit_le(uint32_t a) {
+  emit_1(a % 256);
+  a /= 256;
+  emit_1(a % 256);
+  a /= 256;
+  emit_1(a % 256);
+  a /= 256;
+  emit_1(a);
+}
+
+void emit_diff(uint32_t a, uint32_t b) {
+  uint32_t v = a - b;
+  emit_1(v % 256);
+  v /= 256;
+  emit_1(v % 256);
+  v /= 256;
+  emit_1(v % 256);
+  emit_1(a >= b ? 0 : 0xff);
+}
+
+int CHUNKED_FUNC_SIZE = 512;
+
+int emit_chunked_main_loop(Inst* inst,
+                           void (*emit_func_prologue)(int func_id),
+                           void (*emit_func_epilogue)(void),
+                           void (*emit_pc_change)(int pc),
+                           void (*emit_inst)(Inst* inst)) {
+  int prev_pc = -1;
+  int prev_func_id = -1;
+  for (; inst; inst = inst->next) {
+    int func_id = inst->pc / CHUNKED_FUNC_SIZE;
+    if (prev_pc != inst->pc) {
+      if (prev_func_id != func_id) {
+        if (prev_func_id != -1) {
+          emit_func_epilogue();
+        }
+        emit_func_prologue(func_id);
+      }
+
+      emit_pc_change(inst->pc);
+    }
+    prev_pc = inst->pc;
+    prev_func_id = func_id;
+
+    emit_inst(inst);
+  }
+  emit_func_epilogue();
+  return prev_func_id + 1;
+}
+
+#define PACK2(x) ((x) % 256), ((x) / 256)
+#define PACK4(x) ((x) % 256), ((x) / 256 % 256), ((x) / 65536), 0
+
+void emit_elf_header(uint16_t machine, uint32_t filesz) {
+  const char ehdr[52] = {
+    // e_ident
+    0x7f, 0x45, 0x4c, 0x46, 0x01, 0x01, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    PACK2(2),  // e_type
+    PACK2(machine),  // e_machine
+    PACK4(1),  // e_version
+    PACK4(ELF_TEXT_START + ELF_HEADER_SIZE),  // e_entry
+    PACK4(52),  // e_phoff
+    PACK4(0),  // e_shoff
+    PACK4(0),  // e_flags
+    PACK2(52),  // e_ehsize
+    PACK2(32),  // e_phentsize
+    PACK2(1),  // e_phnum
+    PACK2(40),  // e_shentsize
+    PACK2(0),  // e_shnum
+    PACK2(0),  // e_shstrndx
+  };
+  const char phdr[32] = {
+    PACK4(1),  // p_type
+    PACK4(0),  // p_offset
+    PACK4(ELF_TEXT_START),  // p_vaddr
+    PACK4(ELF_TEXT_START),  // p_paddr
+    PACK4(filesz + ELF_HEADER_SIZE),  // p_filesz
+    PACK4(filesz + ELF_HEADER_SIZE),  // p_memsz
+    PACK4(5),  // p_flags
+    PACK4(0x1000),  // p_align
+  };
+  fwrite(ehdr, 52, 1, stdout);
+  fwrite(phdr, 32, 1, stdout);
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void init_state_asmjs(Data* data) {
+  emit_line("var main = function() {");
+  emit_line("var mod = function(stdlib, foreign, heap) {");
+  emit_line("\"use asm\";");
+  emit_line("var mem = new stdlib.Int32Array(heap);");
+  emit_line("var putchar = foreign.putchar;");
+  emit_line("var getchar = foreign.getchar;");
+  emit_line("var running = 1;");
+
+  for (int i = 0; i < 7; i++) {
+    emit_line("var %s = 0;", reg_names[i]);
+  }
+  emit_line("function init() {");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("mem[%d] = %d;", mp, data->v);
+    }
+  }
+  emit_line("}");
+}
+
+static void asmjs_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("function func%d() {", func_id);
+  inc_indent();
+  emit_line("while ((%d <= (pc | 0)) & ((pc | 0) < %d) & running) {",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("switch (pc | 0) {");
+  emit_line("case -1:  // dummy");
+  inc_indent();
+}
+
+static const char *unsigned_cmp_str(Inst *inst) {
+  int op = normalize_cond(inst->op, 0);
+  const char* op_str;
+  switch (op) {
+    case JEQ:
+      op_str = "=="; break;
+    case JNE:
+      op_str = "!="; break;
+    case JLT:
+      op_str = "<"; break;
+    case JGT:
+      op_str = ">"; break;
+    case JLE:
+      op_str = "<="; break;
+    case JGE:
+      op_str = ">="; break;
+    case JMP:
+      return "1";
+    default:
+      error("oops");
+  }
+  return format("(%s >>> 0) %s (%s >>> 0)", reg_names[inst->dst.reg], op_str, src_str(inst));
+}
+
+static void asmjs_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("}"); /* switch (pc) */
+  emit_line("pc = (pc + 1) | 0;");
+  dec_indent();
+  emit_line("}"); /* while (_ <= pc && pc < _ && running) */
+  dec_indent();
+  emit_line("}"); /* function func%d */
+}
+
+static void asmjs_emit_pc_change(int pc) {
+  emit_line("break;");
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void asmjs_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[(%s << 2) >> 2] | 0;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[(%s << 2) >> 2] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("putchar(%s | 0);", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("%s = getchar() | 0;",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("running = 0; break;");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s;",
+              reg_names[inst->dst.reg], unsigned_cmp_str(inst));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if (%s) pc = (%s - 1) | 0;",
+              unsigned_cmp_str(inst), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_asmjs(Module* module) {
+  init_state_asmjs(module->data);
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         asmjs_emit_func_prologue,
+                                         asmjs_emit_func_epilogue,
+                                         asmjs_emit_pc_change,
+                                         asmjs_emit_inst);
+
+  emit_line("");
+  emit_line("function main() {");
+  emit_line("init();");
+  emit_line("while (running) {");
+  inc_indent();
+  emit_line("switch ((pc | 0) / %d | 0) {", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("case %d:", i);
+    emit_line(" func%d();", i);
+    emit_line(" break;");
+  }
+  emit_line("}"); /* switch (pc / CHUNKED_FUNC_SIZE) */
+  dec_indent();
+  emit_line("}"); /* while (running) */
+  emit_line("}"); /* function main */
+
+  emit_line("return main;");
+  emit_line("};"); /* var mod = function() */
+  emit_line("return function(getchar, putchar) {");
+  emit_line("return mod((0,eval)('this'), {getchar: getchar, putchar: putchar}, new ArrayBuffer(1 << 26))();");
+  emit_line("};"); /* function(getchar, putchar) */
+  emit_line("}();"); /* var main = function() */
+
+  // For nodejs
+  emit_line("if (typeof require != 'undefined') {");
+  emit_line(" var sys = require('sys');");
+  emit_line(" var input = null;");
+  emit_line(" var ip = 0;");
+  emit_line(" var getchar = function() {");
+  emit_line("  if (input === null)");
+  emit_line("   input = require('fs').readFileSync('/dev/stdin');");
+  emit_line("  return input[ip++] | 0;");
+  emit_line(" };");
+  emit_line(" var putchar = function(c) {");
+  emit_line("  sys.print(String.fromCharCode(c & 255));");
+  emit_line(" };");
+  emit_line(" main(getchar, putchar);");
+  emit_line("}");
+}
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ir/ir.h>
+#include <target/util.h>
+
+static int ARMREG[] = {
+  4,  // A
+  5,  // B
+  6,  // C
+  7,  // D
+  8,  // BP
+  9,  // SP
+  0,  // R0
+  1,  // R1
+  2,  // R2
+  3,  // R3
+  10, // ARM_MEM
+  11, // RODATA
+  12, // FFFFFF
+  13, // ARM_SP
+  14,
+  15, // ARM_PC
+};
+
+#define R0 ((Reg)6)
+#define R1 ((Reg)7)
+#define R2 ((Reg)8)
+#define R3 ((Reg)9)
+#define R4 A
+#define R5 B
+#define R6 C
+#define R7 D
+#define ARM_MEM ((Reg)10)
+#define RODATA ((Reg)11)
+#define FFFFFF ((Reg)12)
+#define ARM_SP ((Reg)13)
+#define ARM_PC ((Reg)15)
+
+void emit_elf_header(uint16_t machine, uint32_t filesz);
+
+static void emit_4le(int a, int b, int c, int d) {
+  emit_1(d);
+  emit_1(c);
+  emit_1(b);
+  emit_1(a);
+}
+
+static void emit_svc() {
+  emit_4le(0xef, 0x00, 0x00, 0x00);
+}
+
+typedef enum {
+  ARM_AND = 0x00,
+  ARM_SUB = 0x40,
+  ARM_ADD = 0x80,
+} ArmOp;
+
+static void emit_reg2op(ArmOp op, Reg dst, Reg src) {
+  emit_4le(0xe0, op + ARMREG[dst], ARMREG[dst] * 16, ARMREG[src]);
+}
+
+typedef enum {
+  Shl0 = 0,
+  Shl24 = 4,
+  Shl16 = 8,
+  Shl8 = 12
+} ImmRot;
+
+static void emit_arm_mov_reg(Reg dst, Reg src) {
+  emit_4le(0xe1, 0xa0, ARMREG[dst] * 16, ARMREG[src]);
+}
+
+static void emit_arm_mov_imm8(Reg dst, int imm8, ImmRot rot) {
+  emit_4le(0xe3, 0xa0, ARMREG[dst] * 16 + rot, imm8);
+}
+
+static void emit_arm_mvn_imm8(Reg dst, int imm8, ImmRot rot) {
+  emit_4le(0xe3, 0xe0, ARMREG[dst] * 16 + rot, imm8);
+}
+
+static void emit_arm_add_imm8(Reg dst, int imm8, ImmRot rot) {
+  emit_4le(0xe2, ARM_ADD + ARMREG[dst], ARMREG[dst] * 16 + rot, imm8);
+}
+
+static void emit_arm_sub_imm8(Reg dst, int imm8, ImmRot rot) {
+  emit_4le(0xe2, ARM_SUB + ARMREG[dst], ARMREG[dst] * 16 + rot, imm8);
+}
+
+static void emit_arm_mov_imm(Reg dst, int imm) {
+  emit_arm_mov_imm8(dst, imm % 256, Shl0);
+  imm /= 256;
+  if (!imm)
+    return;
+  emit_arm_add_imm8(dst, imm % 256, Shl8);
+  imm /= 256;
+  if (!imm)
+    return;
+  emit_arm_add_imm8(dst, imm % 256, Shl16);
+}
+
+static void emit_arm_add_imm(Reg dst, int imm) {
+  if (imm > 0xffff00) {
+    emit_arm_sub_imm8(dst, 0x1000000 - imm, Shl0);
+    return;
+  }
+
+  emit_arm_add_imm8(dst, imm % 256, Shl0);
+  imm /= 256;
+  if (!imm)
+    return;
+  emit_arm_add_imm8(dst, imm % 256, Shl8);
+  imm /= 256;
+  if (!imm)
+    return;
+  emit_arm_add_imm8(dst, imm, Shl16);
+}
+
+static void emit_arm_sub_imm(Reg dst, int imm) {
+  emit_arm_sub_imm8(dst, imm % 256, Shl0);
+  imm /= 256;
+  if (!imm)
+    return;
+  emit_arm_sub_imm8(dst, imm % 256, Shl8);
+  imm /= 256;
+  if (!imm)
+    return;
+  emit_arm_sub_imm8(dst, imm, Shl16);
+}
+
+typedef enum {
+  MEM_STORE = 0x80,
+  MEM_LOAD = 0x90,
+} LoadOrStore;
+
+static void emit_arm_mem(LoadOrStore op, Reg val, Reg base, Reg offset) {
+  emit_4le(0xe7, op + ARMREG[base], ARMREG[val] * 16 + 1, ARMREG[offset]);
+}
+
+static void emit_arm_cmp(Inst* inst) {
+  Reg reg;
+  if (inst->src.type == REG) {
+    reg = inst->src.reg;
+  } else {
+    reg = R0;
+    emit_arm_mov_imm(reg, inst->src.imm);
+  }
+  emit_4le(0xe1, 0x50 + ARMREG[inst->dst.reg], 0x00, ARMREG[reg]);
+}
+
+static void emit_arm_setcc(Inst* inst, int op) {
+  emit_arm_cmp(inst);
+  emit_arm_mov_imm8(inst->dst.reg, 0, Shl0);
+  emit_4le(op, 0xa0, ARMREG[inst->dst.reg] * 16, 0x01);
+}
+
+static void emit_arm_jcc(Inst* inst, int op, int* pc2addr) {
+  if (inst->op != JMP) {
+    emit_arm_cmp(inst);
+  }
+
+  if (inst->jmp.type == REG) {
+    emit_arm_mem(MEM_LOAD, ARM_PC, RODATA, inst->jmp.reg);
+  } else {
+    uint32_t v = pc2addr[inst->jmp.imm] / 4 - (emit_cnt() + 8) / 4;
+    emit_1(v % 256);
+    v /= 256;
+    emit_1(v % 256);
+    v /= 256;
+    emit_1(v % 256);
+    emit_1(op);
+  }
+}
+
+static void init_state_arm(Data* data, int rodata_addr) {
+  emit_arm_mov_imm8(R0, 0, Shl0);
+  emit_arm_mov_imm8(R1, 4, Shl24);
+  emit_arm_mov_imm8(R2, 3, Shl0);  // PROT_READ | PROT_WRITE
+  emit_arm_mov_imm8(R3, 0x22, Shl0);  // MAP_PRIVATE | MAP_ANONYMOUS
+  emit_arm_mvn_imm8(R4, 0, Shl0);  // 0xffffffff
+  emit_arm_mov_imm8(R5, 0, Shl0);
+  emit_arm_mov_imm8(R7, 192, Shl0);  // mmap2
+  emit_svc();
+
+  emit_arm_mov_reg(ARM_MEM, R0);
+
+  int prev = 0;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (!data->v)
+      continue;
+    int d = (mp - prev) * 4;
+    if (d >= 4096) {
+      emit_arm_add_imm(R0, d);
+      d = 0;
+    }
+    emit_arm_mov_imm(R1, data->v);
+    emit_4le(0xe5, 0xa0, 0x10 + d / 256, d % 256);
+    prev = mp;
+  }
+
+  emit_arm_mov_imm8(RODATA, rodata_addr % 256, Shl0);
+  rodata_addr /= 256;
+  emit_arm_add_imm8(RODATA, rodata_addr % 256, Shl8);
+  rodata_addr /= 256;
+  emit_arm_add_imm8(RODATA, rodata_addr % 256, Shl16);
+  emit_arm_mvn_imm8(FFFFFF, 0xff, Shl24);
+
+  emit_arm_mov_imm8(A, 0, Shl0);
+  emit_arm_mov_imm8(B, 0, Shl0);
+  emit_arm_mov_imm8(C, 0, Shl0);
+  emit_arm_mov_imm8(D, 0, Shl0);
+  emit_arm_mov_imm8(BP, 0, Shl0);
+  emit_arm_mov_imm8(SP, 0, Shl0);
+}
+
+// Computes "R0 = R0 op R1" for an extended op. R2 and R3 are scratch.
+static void emit_arm_ext_op(Op op) {
+  switch (op) {
+  case MUL:
+    emit_4le(0xe0, 0x00, 0x00, 0x91);  // mul r0, r1, r0
+    emit_reg2op(ARM_AND, R0, FFFFFF);
+    break;
+
+  case AND:
+    emit_reg2op(ARM_AND, R0, R1);
+    break;
+
+  case OR:
+    emit_4le(0xe1, 0x80, 0x00, 0x01);  // orr r0, r0, r1
+    break;
+
+  case XOR:
+    emit_4le(0xe0, 0x20, 0x00, 0x01);  // eor r0, r0, r1
+    break;
+
+  case SHL:
+  case SHR:
+    emit_4le(0xe3, 0x51, 0x00, 0x18);  // cmp r1, #24
+    emit_4le(0x23, 0xa0, 0x00, 0x00);  // movhs r0, #0
+    // lsllo/lsrlo r0, r0, r1
+    emit_4le(0x31, 0xa0, 0x01, op == SHL ? 0x10 : 0x30);
+    emit_reg2op(ARM_AND, R0, FFFFFF);
+    break;
+
+  case DIV:
+  case MOD:
+    // Restoring division. R2 collects the quotient above a sentinel
+    // bit which reaches bit 24 after 24 rounds, R3 is the remainder.
+    // A zero divisor leaves the dividend in R3.
+    emit_arm_mov_imm8(R2, 1, Shl0);
+    emit_arm_mov_imm8(R3, 0, Shl0);
+    emit_4le(0xe1, 0xa0, 0x00, 0x80);  // lsl r0, r0, #1
+    emit_4le(0xe1, 0xa0, 0x30, 0x83);  // lsl r3, r3, #1
+    emit_4le(0xe1, 0x83, 0x3c, 0x20);  // orr r3, r3, r0, lsr #24
+    emit_reg2op(ARM_AND, R0, FFFFFF);
+    emit_4le(0xe1, 0x53, 0x00, 0x01);  // cmp r3, r1
+    emit_4le(0x20, 0x43, 0x30, 0x01);  // subhs r3, r3, r1
+    emit_4le(0xe0, 0xa2, 0x20, 0x02);  // adc r2, r2, r2
+    emit_4le(0xe3, 0x12, 0x04, 0x01);  // tst r2, #1<<24
+    emit_4le(0x0a, 0xff, 0xff, 0xf6);  // beq (8 insts back)
+    if (op == DIV) {
+      emit_4le(0xe0, 0x02, 0x00, 0x0c);  // and r0, r2, r12
+      emit_4le(0xe3, 0x51, 0x00, 0x00);  // cmp r1, #0
+      emit_4le(0x03, 0xa0, 0x00, 0x00);  // moveq r0, #0
+    } else {
+      emit_arm_mov_reg(R0, R3);
+    }
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static void arm_emit_inst(Inst* inst, int* pc2addr) {
+  Reg reg;
+
+  switch (inst->op) {
+  case MOV:
+    if (inst->src.type == REG) {
+      emit_arm_mov_reg(inst->dst.reg, inst->src.reg);
+    } else {
+      emit_arm_mov_imm(inst->dst.reg, inst->src.imm);
+    }
+    break;
+
+  case ADD:
+    if (inst->src.type == REG) {
+      emit_reg2op(ARM_ADD, inst->dst.reg, inst->src.reg);
+    } else {
+      emit_arm_add_imm(inst->dst.reg, inst->src.imm);
+    }
+    // emit_arm_add_imm subtracts for big immediates, which needs the mask
+    // even if the sum fits.
+    if (!inst->no_wrap || (inst->src.type == IMM && inst->src.imm > 0xffff00))
+      emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
+    break;
+
+  case SUB:
+    if (inst->src.type == REG) {
+      emit_reg2op(ARM_SUB, inst->dst.reg, inst->src.reg);
+    } else {
+      emit_arm_sub_imm(inst->dst.reg, inst->src.imm);
+    }
+    if (!inst->no_wrap)
+      emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
+    break;
+
+  case LOAD:
+  case STORE:
+    if (inst->src.type == REG) {
+      reg = inst->src.reg;
+    } else {
+      emit_arm_mov_imm(R0, inst->src.imm);
+      reg = R0;
+    }
+    emit_arm_mem(inst->op == LOAD ? MEM_LOAD : MEM_STORE,
+		 inst->dst.reg, ARM_MEM, reg);
+    break;
+
+  case PUTC:
+    if (inst->src.type == REG) {
+      reg = inst->src.reg;
+    } else {
+      reg = R0;
+      emit_arm_mov_imm8(reg, inst->src.imm, Shl0);
+    }
+    emit_4le(0xe5, 0x2d, ARMREG[reg] * 16, 0x04);  // push reg
+    emit_arm_mov_imm8(R0, 1, Shl0);  // stdout
+    emit_arm_mov_reg(R1, ARM_SP);
+    emit_arm_mov_imm8(R2, 1, Shl0);
+    emit_arm_mov_imm8(R7, 4, Shl0);  // write
+    emit_svc();
+    emit_4le(0xe4, 0x9d, ARMREG[R0] * 16, 0x04);  // pop R0
+    break;
+
+  case GETC:
+    emit_arm_mov_imm8(R0, 0, Shl0);  // stdin
+    emit_4le(0xe5, 0x2d, ARMREG[R0] * 16, 0x04);  // push 0
+    emit_arm_mov_reg(R1, ARM_SP);
+    emit_arm_mov_imm8(R2, 1, Shl0);
+    emit_arm_mov_imm8(R7, 3, Shl0);  // read
+    emit_svc();
+    emit_4le(0xe4, 0x9d, ARMREG[inst->dst.reg] * 16, 0x04);  // pop dst
+    break;
+
+  case EXIT:
+    emit_arm_mov_imm8(R0, 0, Shl0);
+    emit_arm_mov_imm8(R7, 1, Shl0);  // exit
+    emit_svc();
+    break;
+
+  case DUMP:
+    break;
+
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+  case SHL:
+  case SHR:
+    if (inst->src.type == REG) {
+      emit_arm_mov_reg(R1, inst->src.reg);
+    } else {
+      emit_arm_mov_imm(R1, inst->src.imm);
+    }
+    emit_arm_mov_reg(R0, inst->dst.reg);
+    emit_arm_ext_op(inst->op);
+    emit_arm_mov_reg(inst->dst.reg, R0);
+    break;
+
+  case EQ:
+    emit_arm_setcc(inst, 0x03);
+    break;
+
+  case NE:
+    emit_arm_setcc(inst, 0x13);
+    break;
+
+  case LT:
+    emit_arm_setcc(inst, 0xb3);
+    break;
+
+  case GT:
+    emit_arm_setcc(inst, 0xc3);
+    break;
+
+  case LE:
+    emit_arm_setcc(inst, 0xd3);
+    break;
+
+  case GE:
+    emit_arm_setcc(inst, 0xa3);
+    break;
+
+  case JEQ:
+    emit_arm_jcc(inst, 0x0a, pc2addr);
+    break;
+
+  case JNE:
+    emit_arm_jcc(inst, 0x1a, pc2addr);
+    break;
+
+  case JLT:
+    emit_arm_jcc(inst, 0xba, pc2addr);
+    break;
+
+  case JGT:
+    emit_arm_jcc(inst, 0xca, pc2addr);
+    break;
+
+  case JLE:
+    emit_arm_jcc(inst, 0xda, pc2addr);
+    break;
+
+  case JGE:
+    emit_arm_jcc(inst, 0xaa, pc2addr);
+    break;
+
+  case JMP:
+    emit_arm_jcc(inst, 0xea, pc2addr);
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_arm(Module* module) {
+  emit_reset();
+  init_state_arm(module->data, 0);
+
+  int pc_cnt = module->num_pcs;
+  int* pc2addr = calloc(pc_cnt, sizeof(int));
+  for (int pc = 0; pc < pc_cnt; pc++) {
+    pc2addr[pc] = emit_cnt();
+    for (int i = module->pc_start[pc]; i < module->pc_start[pc + 1]; i++) {
+      Inst* inst = &module->insts[i];
+      arm_emit_inst(inst, pc2addr);
+    }
+  }
+
+  int rodata_addr = ELF_TEXT_START + emit_cnt() + ELF_HEADER_SIZE;
+
+  emit_elf_header(40, emit_cnt() + pc_cnt * 4);
+
+  emit_reset();
+  emit_start();
+  init_state_arm(module->data, rodata_addr);
+
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    arm_emit_inst(inst, pc2addr);
+  }
+
+  for (int i = 0; i < pc_cnt; i++) {
+    emit_le(ELF_TEXT_START + pc2addr[i] + ELF_HEADER_SIZE);
+  }
+}
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const uint BEF_MEM = 4782969;  // 9**7
+
+typedef struct {
+  char block[299][80];
+  uint x;
+  uint y;
+  uint vx;
+  bool was_jmp;
+} Befunge;
+
+Befunge g_bef;
+
+static void bef_emit(uint c);
+
+static void bef_clear_block_line(int y) {
+  assert(y < 297);
+  for (uint i = 0; i < 78; i++)
+    g_bef.block[y][i] = ' ';
+  g_bef.block[y][79] = '\0';
+}
+
+static void bef_block_init() {
+  if (g_bef.x) {
+    for (uint i = 0; i <= g_bef.y; i++) {
+      puts(g_bef.block[i]);
+    }
+  }
+
+  g_bef.x = 10;
+  g_bef.y = 0;
+  g_bef.vx = 1;
+  g_bef.was_jmp = false;
+  bef_clear_block_line(0);
+  bef_emit('>');
+}
+
+static void bef_emit(uint c) {
+  g_bef.block[g_bef.y][g_bef.x] = c;
+  g_bef.x += g_bef.vx;
+  if (g_bef.x == 10 || g_bef.x == 78) {
+    g_bef.block[g_bef.y][g_bef.x] = 'v';
+    g_bef.y++;
+    g_bef.vx *= -1;
+    bef_clear_block_line(g_bef.y);
+    bef_emit(g_bef.vx == 1 ? '>' : '<');
+  }
+}
+
+static void bef_emit_s(const char* s) {
+  for (; *s; s++)
+    bef_emit(*s);
+}
+
+static int bef_num_base9(uint v, char *c) {
+  char *cbase = c;
+  char b9[10];
+  int b9l = 0;
+  do {
+    b9[b9l++] = v % 9;
+    v /= 9;
+  } while(v);
+  for (int i = 0; i < b9l; i++) {
+    if (i == 0 && b9[b9l - 1] == 1) {
+      *c++ = '9';
+      if (b9l == 1) return 1;
+      i++;
+    } else if (i != 0) {
+      *c++ = '9';
+      *c++ = '*';
+    }
+    uint n = b9[b9l - i - 1];
+    if (n) {
+      *c++ = '0' + n;
+      if (i != 0) {
+        *c++ = '+';
+      }
+    }
+  }
+  return c - cbase;
+}
+
+#ifndef BEFNUMCACHESIZE
+#define BEFNUMCACHESIZE 6562
+#endif
+#ifndef BEFNUMMAXFACTOR
+#define BEFNUMMAXFACTOR 59049
+#endif
+static char* befnumcache[BEFNUMCACHESIZE] = {
+  "0","1","2","3","4","5","6","7","8","9",
+  "19+", "29+", "39+", "49+", "59+", "69+", "79+", "89+", "99+",
+};
+static int bef_num_digits(uint v, char *c);
+static int bef_num_factor_core(uint v, char *c) {
+  int shortlen = 36;
+  int incr = 1 + (v&1); // Skip even numbers for odd numbers
+  for (uint i = 1 + incr; i*i <= v; i += incr) {
+    if (v % i == 0) {
+      char ijs[74];
+      uint j = v / i;
+      int ijlen = bef_num_digits(i, ijs);
+      if (i == j && i > 9) {
+        ijs[ijlen++] = ':';
+      } else {
+        ijlen += bef_num_digits(j, ijs + ijlen);
+      }
+      if (ijlen < shortlen) {
+        shortlen = ijlen;
+        memcpy(c, ijs, ijlen);
+        c[ijlen] = '*';
+        if (ijlen == 2) return 3;
+      }
+    }
+  }
+  return shortlen < 36 ? shortlen + 1 : 99;
+}
+
+static int bef_num_factor(uint v, char *c) {
+  int shortlen = 99; // An arbitrarily large number bef_num_base9 will beat
+  for (int off = 0; off < 19; off++) {
+    char cs[37];
+    int len = bef_num_factor_core(v + off - 9, cs);
+    if (len < (off != 9 ? shortlen-2 : shortlen)) {
+      if (off != 9) {
+        cs[len] = off < 9 ? '9' - off : '0' + (off - 9);
+        cs[len+1] = off < 9 ? '+' : '-';
+        len += 2;
+      }
+      shortlen = len;
+      memcpy(c, cs, len);
+      if (len == 3) return 3;
+    }
+  }
+  return shortlen;
+}
+
+static int bef_num_digits(uint v, char *c) {
+  if (v < BEFNUMCACHESIZE) {
+    char *code = befnumcache[v];
+    if (code != NULL) {
+      strcpy(c, code);
+      return strlen(code);
+    }
+  } else if (v > BEFNUMMAXFACTOR) {
+    return bef_num_base9(v, c);
+  }
+  int f9l = bef_num_factor(v, c);
+  if (0 && f9l > 3) {
+    char b9[37];
+    int b9l = bef_num_base9(v, b9);
+    if (b9l <= f9l) {
+      memcpy(c, b9, b9l);
+      if (v < BEFNUMCACHESIZE) {
+        befnumcache[v] = malloc(b9l+1);
+        memcpy(befnumcache[v], b9, b9l);
+        befnumcache[v][b9l] = 0;
+      }
+      return b9l;
+    }
+  }
+  if (v < BEFNUMCACHESIZE) {
+    befnumcache[v] = malloc(f9l+1);
+    memcpy(befnumcache[v], c, f9l);
+    befnumcache[v][f9l] = 0;
+  }
+  return f9l;
+}
+
+static void bef_emit_num(uint v) {
+  char c[37];
+  int clen = bef_num_digits(v, c);
+  for (int i = 0; i < clen; i++) {
+    bef_emit(c[i]);
+  }
+}
+
+static void bef_emit_uint_mod() {
+  bef_emit_s("88*:*:*");
+}
+
+static void bef_emit_value(Value* v) {
+  if (v->type == REG) {
+    bef_emit('0' + v->reg);
+    bef_emit('0');
+    bef_emit('g');
+  } else {
+    bef_emit_num(v->imm);
+  }
+}
+
+static void bef_emit_src(Inst* inst) {
+  bef_emit_value(&inst->src);
+}
+
+static void bef_emit_dst(Inst* inst) {
+  bef_emit_value(&inst->dst);
+}
+
+static void bef_emit_store_reg(uint r) {
+  bef_emit('0' + r);
+  bef_emit('0');
+  bef_emit('p');
+}
+
+static void bef_make_room() {
+  uint r = g_bef.vx == 1 ? 79 - g_bef.x : g_bef.x - 10;
+  if (r < 10) {
+    uint y = g_bef.y;
+    while (y == g_bef.y)
+      bef_emit(' ');
+  }
+}
+
+static void bef_emit_cmp(Inst* inst, int boolify) {
+  uint op = normalize_cond(inst->op, false);
+  if (op == JLT || op == JGE) {
+    bef_emit_src(inst);
+    bef_emit_dst(inst);
+    op = op == JLT ? JGT : JLE;
+  } else {
+    bef_emit_dst(inst);
+    bef_emit_src(inst);
+  }
+  switch (op) {
+    case JEQ:
+    case JNE:
+      bef_emit('-');
+      break;
+    case JGT:
+    case JLE:
+      bef_emit('`');
+      break;
+  }
+  if (op == JEQ || op == JLE) {
+    bef_emit('!');
+  } else if (op == JNE && boolify) {
+    bef_emit_s("!!");
+  }
+}
+
+static void bef_emit_jmp(Inst* inst) {
+  bef_emit_cmp(inst, 0);
+  bef_make_room();
+  bef_emit_s("#v_v");
+
+  int x = g_bef.x;
+  int y = g_bef.y;
+  bef_clear_block_line(y + 1);
+  bef_clear_block_line(y + 2);
+
+  if (g_bef.vx == 1) {
+    x -= 1;
+  } else {
+    x += 3;
+  }
+
+  g_bef.block[y + 2][x] = '<';
+  g_bef.block[y + 2][x - 1] = '$';
+
+  x -= 2;
+  g_bef.block[y + 1][x] = '<';
+  g_bef.block[y + 1][6] = '^';
+
+  g_bef.x = x - 1;
+  g_bef.y = y + 2;
+  g_bef.vx = -1;
+}
+
+static void bef_emit_inst(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+      bef_emit_src(inst);
+      bef_emit_store_reg(inst->dst.reg);
+      break;
+
+    case ADD:
+      bef_emit_dst(inst);
+      bef_emit_src(inst);
+      bef_emit('+');
+      bef_emit_uint_mod();
+      bef_emit('%');
+      bef_emit_store_reg(inst->dst.reg);
+      break;
+
+    case SUB:
+      bef_emit_dst(inst);
+      bef_emit_src(inst);
+      bef_emit('-');
+      bef_emit_uint_mod();
+      bef_emit('+');
+      bef_emit_uint_mod();
+      bef_emit('%');
+      bef_emit_store_reg(inst->dst.reg);
+      break;
+
+    case LOAD:
+      bef_emit('0');
+      bef_emit_src(inst);
+      bef_emit_num(BEF_MEM);
+      bef_emit('+');
+      bef_emit('g');
+      bef_emit_store_reg(inst->dst.reg);
+      break;
+
+    case STORE:
+      bef_emit_dst(inst);
+      bef_emit('0');
+      bef_emit_src(inst);
+      bef_emit_num(BEF_MEM);
+      bef_emit('+');
+      bef_emit('p');
+      break;
+
+    case PUTC:
+      bef_emit_src(inst);
+      bef_emit(',');
+      break;
+
+    case GETC: {
+      bef_make_room();
+      bef_emit_s("#v~v");
+      g_bef.y++;
+      bef_clear_block_line(g_bef.y);
+      g_bef.x += g_bef.vx == 1 ? -3 : 3;
+      bef_emit(g_bef.vx == 1 ? '>' : '<');
+      bef_emit('0');
+      bef_emit(g_bef.vx == 1 ? '>' : '<');
+      // To support implementations which return -1 on EOF.
+      bef_emit_s(":1+!+");
+      bef_emit_store_reg(inst->dst.reg);
+      break;
+    }
+
+    case EXIT:
+      bef_emit('@');
+      break;
+
+    case DUMP:
+      break;
+
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+      bef_emit_cmp(inst, 1);
+      bef_emit_store_reg(inst->dst.reg);
+      break;
+
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      bef_emit_value(&inst->jmp);
+      bef_emit_jmp(inst);
+      break;
+
+    case JMP:
+      bef_emit_value(&inst->jmp);
+      g_bef.was_jmp = true;
+      break;
+
+    default:
+      error("oops");
+  }
+}
+
+static void bef_flush_code_block() {
+  if (g_bef.vx == 1) {
+    g_bef.block[g_bef.y][g_bef.x] = 'v';
+    g_bef.y++;
+    bef_clear_block_line(g_bef.y);
+    g_bef.block[g_bef.y][g_bef.x] = '<';
+  }
+  if (g_bef.was_jmp) {
+    g_bef.block[g_bef.y][6] = '^';
+  } else {
+    g_bef.block[g_bef.y][10] = 'v';
+  }
+
+  memcpy(g_bef.block[0], ">:#v_$", 6);
+  memcpy(g_bef.block[1], "v-1<> ", 6);
+  bef_block_init();
+}
+
+static void bef_init_state(Data* data) {
+  bef_block_init();
+  for (uint mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      bef_emit_num(data->v);
+      bef_emit('0');
+      bef_emit_num(mp);
+      bef_emit_num(BEF_MEM);
+      bef_emit('+');
+      bef_emit('p');
+
+      if (g_bef.y > 90) {
+        bef_flush_code_block();
+      }
+    }
+  }
+
+  for (uint i = 0; i < 6; i++) {
+    bef_emit('0');
+    bef_emit_store_reg(i);
+  }
+  // PC
+  bef_emit('0');
+
+  while (g_bef.y == 0) {
+    bef_emit(' ');
+  }
+  g_bef.block[g_bef.y][0] = 'v';
+  g_bef.block[g_bef.y][6] = '<';
+}
+
+void target_bef(Module* module) {
+  bef_init_state(module->data);
+
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      if (prev_pc == -1)
+        bef_block_init();
+      else
+        bef_flush_code_block();
+    }
+    prev_pc = inst->pc;
+    bef_emit_inst(inst);
+  }
+
+  bef_flush_code_block();
+}
+#include <assert.h>
+#include <stdbool.h>
+
+#include <ir/ir.h>
+#include <ir/live.h>
+#include <target/util.h>
+
+typedef struct {
+  int mp;
+  int loop_ptr;
+  int ifzero_cnt;
+  int ifzero_off[4];
+  int ifzero_omp[4];
+} BFGen;
+
+static BFGen bf;
+static Liveness* bf_live;
+
+static const int BF_RUNNING = 0;
+static const int BF_PC = 2;
+static const int BF_NPC = 8;
+static const int BF_A = 14;
+static const int BF_B = 20;
+static const int BF_C = 26;
+static const int BF_D = 32;
+static const int BF_BP = 38;
+static const int BF_SP = 44;
+static const int BF_OP = 50;
+
+static const int BF_DBG = 58;
+
+static const int BF_WRK = 60;
+
+static const int BF_LOAD_REQ = 67;
+static const int BF_STORE_REQ = 68;
+
+static const int BF_MEM = 70;
+static const int BF_MEM_V = 1;
+static const int BF_MEM_A = 4;
+static const int BF_MEM_WRK = 7;
+static const int BF_MEM_USE = 13;
+#define BF_MEM_CTL_LEN 16
+static const int BF_MEM_BLK_LEN = (256*3) + BF_MEM_CTL_LEN;
+
+static void bf_emit(const char* s) {
+  fputs(s, stdout);
+}
+
+static void bf_comment(const char* s) {
+  printf("\n# %s\n", s);
+}
+
+static void bf_rep(char c, int n) {
+  for (int i = 0; i < n; i++)
+    putchar(c);
+}
+
+static void bf_set_ptr(int ptr) {
+  bf.mp = ptr;
+}
+
+static void bf_move_ptr(int ptr) {
+  if (ptr > bf.mp) {
+    bf_rep('>', ptr - bf.mp);
+  } else {
+    bf_rep('<', bf.mp - ptr);
+  }
+  bf.mp = ptr;
+}
+
+static void bf_move_neg(int from, int to) {
+  bf_move_ptr(from);
+  bf_emit("[-");
+  bf_move_ptr(to);
+  putchar('-');
+  bf_move_ptr(from);
+  bf_emit("]");
+}
+
+static void bf_move(int from, int to) {
+  bf_move_ptr(from);
+  bf_emit("[-");
+  bf_move_ptr(to);
+  putchar('+');
+  bf_move_ptr(from);
+  bf_emit("]");
+}
+
+static void bf_move2(int from, int to, int to2) {
+  bf_move_ptr(from);
+  bf_emit("[-");
+  bf_move_ptr(to);
+  putchar('+');
+  bf_move_ptr(to2);
+  putchar('+');
+  bf_move_ptr(from);
+  bf_emit("]");
+}
+
+static void bf_move_word(int from, int to) {
+  bf_move(from-1, to-1);
+  bf_move(from, to);
+  bf_move(from+1, to+1);
+}
+
+static void bf_move_word2(int from, int to, int to2) {
+  bf_move2(from-1, to-1, to2-1);
+  bf_move2(from, to, to2);
+  bf_move2(from+1, to+1, to2+1);
+}
+
+#if 0
+static void bf_copy(int from, int to, int wrk) {
+  bf_move2(from, to, wrk);
+  bf_move(wrk, from);
+}
+#endif
+
+static void bf_copy_word(int from, int to, int wrk) {
+  bf_move_word2(from, to, wrk);
+  bf_move_word(wrk, from);
+}
+
+static void bf_add(int ptr, int v) {
+  bf_move_ptr(ptr);
+#ifdef __eir__
+  v %= 256;
+#else
+  v &= 255;
+#endif
+  if (v > 127) {
+    bf_rep('-', 256 - v);
+  } else {
+    bf_rep('+', v);
+  }
+}
+
+static void bf_add_word(int ptr, int v) {
+  bf_add(ptr - 1, v / 65536);
+  bf_add(ptr, v / 256 % 256);
+  bf_add(ptr + 1, v % 256);
+}
+
+static void bf_clear(int ptr) {
+  bf_move_ptr(ptr);
+  bf_emit("[-]");
+}
+
+static void bf_clear_word(int ptr) {
+  bf_clear(ptr-1);
+  bf_clear(ptr);
+  bf_clear(ptr+1);
+}
+
+static int bf_regpos(int r) {
+  switch (r) {
+  case A: return BF_A;
+  case B: return BF_B;
+  case C: return BF_C;
+  case D: return BF_D;
+  case BP: return BF_BP;
+  case SP: return BF_SP;
+  default:
+    error("unknown reg: %d", r);
+  }
+}
+
+static void bf_dbg(const char* s) {
+  for (; *s; s++) {
+    bf_clear(BF_DBG);
+    bf_add(BF_DBG, *s);
+    bf_emit(".");
+  }
+  bf_clear(BF_DBG);
+}
+
+static void bf_interpreter_check(void) {
+  bf_comment("interpreter check");
+
+  // Test for cell wrap != 256
+  emit_line(">[-]<[-]++++++++[>++++++++<-]>[<++++>-]<[>>");
+
+  // Print message 'Sorry this program needs an 8bit interpreter\n'
+  emit_line(">++++[<++++>-]<+[>++++++>+++++++>++>+++>+++++<<<<<-]>>>>>--.<<<-");
+  emit_line("-------.+++..+++++++.>--.<-----.<++.+.>-.>.<---.++.---.<--.>+++.");
+  emit_line("<------.>-----.>.<+.<++++..-.>+++++.>.<<---.>-----.>.>+++++.<<<+");
+  emit_line(".>-----.+++++++++++.>.<<+++++++.+++++.>.<---------.>--.--.++.<.>");
+  emit_line("++.<.>--.<<++++++++++.");
+
+  // endif
+  emit_line("<<[-]]");
+
+  // Test for cell wrap != 256 and flip condition
+  emit_line(">[-]<[-]++++++++[>++++++++<-]>[<++++>-]+<[>-<[-]]>[-<");
+}
+
+static void bf_init_state(Data* data) {
+  bf_interpreter_check();
+
+  bf_comment("init data");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      int hi = mp / 256;
+      int lo = mp % 256;
+      int ptr = BF_MEM + BF_MEM_BLK_LEN * hi + BF_MEM_CTL_LEN + lo * 3;
+      bf_add_word(ptr, data->v);
+    }
+  }
+}
+
+static void bf_loop_begin(int ptr, char c) {
+  bf_move_ptr(ptr);
+  bf_emit("[");
+  if (c)
+    putchar(c);
+  bf.loop_ptr = ptr;
+}
+
+static void bf_loop_end(void) {
+  bf_move_ptr(bf.loop_ptr);
+  bf_emit("]");
+}
+
+static void bf_ifzero_begin_impl(int off, bool reset, const char* ifnz) {
+  bf.ifzero_omp[bf.ifzero_cnt] = bf.mp;
+  bf.mp = 0;
+
+  bf_add(off * 2, -1);
+  bf_move_ptr(0);
+  bf_emit("[");
+  if (reset)
+    bf_emit("[-]");
+  bf_emit(ifnz);
+  bf_move_ptr(off);
+  bf_emit("]");
+  bf_move_ptr(off * 2);
+  bf_emit("+[-");
+
+  bf.mp = bf.ifzero_omp[bf.ifzero_cnt] + off;
+  bf.ifzero_off[bf.ifzero_cnt] = off;
+  bf.ifzero_cnt++;
+}
+
+static void bf_ifzero_begin(int off) {
+  bf_ifzero_begin_impl(off, false, "");
+}
+
+static void bf_ifzero_end(void) {
+  bf.ifzero_cnt--;
+  int off = bf.ifzero_off[bf.ifzero_cnt];
+  int omp = bf.ifzero_omp[bf.ifzero_cnt];
+
+  bf_move_ptr(omp + off);
+
+  bf_set_ptr(0);
+  bf_move_ptr(off);
+  bf_emit("+]");
+
+  bf.mp = omp + off * 2;
+}
+
+static int bf_emit_addsub_prep(Inst* inst) {
+  int dst = bf_regpos(inst->dst.reg);
+  if (inst->src.type == REG) {
+    int src = bf_regpos(inst->src.reg);
+    bf_copy_word(src, BF_WRK, BF_WRK+3);
+  } else {
+    bf_add_word(BF_WRK, inst->src.imm);
+  }
+  return dst;
+}
+
+static void bf_emit_add(Inst* inst) {
+  int dst = bf_emit_addsub_prep(inst);
+
+  // Add BF_WRK to dst.
+  bf_loop_begin(BF_WRK+1, '-'); {
+    // Increment.
+    bf_move_ptr(dst+1);
+    bf_emit("+");
+    // Carry?
+    bf_ifzero_begin(1); {
+      bf_add(dst, 1);
+      bf_move_ptr(dst);
+      bf_ifzero_begin(2); {
+        bf_add(dst-1, 1);
+      }; bf_ifzero_end();
+    }; bf_ifzero_end();
+  }; bf_loop_end();
+
+  bf_loop_begin(BF_WRK, '-'); {
+    // Increment.
+    bf_move_ptr(dst);
+    bf_emit("+");
+    // Carry?
+    bf_ifzero_begin(2); {
+      bf_add(dst-1, 1);
+    }; bf_ifzero_end();
+  }; bf_loop_end();
+  bf_move(BF_WRK-1, dst-1);
+}
+
+static void bf_emit_sub(Inst* inst) {
+  int dst = bf_emit_addsub_prep(inst);
+
+  // Add BF_WRK to dst.
+  bf_loop_begin(BF_WRK+1, '-'); {
+    bf_move_ptr(dst+1);
+    // Carry?
+    bf_ifzero_begin(1); {
+      bf_move_ptr(dst);
+      bf_ifzero_begin(2); {
+        bf_add(dst-1, -1);
+      }; bf_ifzero_end();
+      bf_add(dst, -1);
+    }; bf_ifzero_end();
+    // Decrement.
+    bf_add(dst+1, -1);
+  }; bf_loop_end();
+
+  bf_loop_begin(BF_WRK, '-'); {
+    bf_move_ptr(dst);
+    // Carry?
+    bf_ifzero_begin(2); {
+      bf_add(dst-1, -1);
+    }; bf_ifzero_end();
+    // Decrement.
+    bf_add(dst, -1);
+  }; bf_loop_end();
+  bf_move_neg(BF_WRK-1, dst-1);
+}
+
+static void bf_emit_cmp(Inst* inst) {
+  if (inst->op == JMP) {
+    bf_add(BF_WRK, 1);
+    return;
+  }
+  int op = normalize_cond(inst->op, false);
+
+  int lhspos = BF_WRK;
+  int rhspos = BF_WRK+3;
+  if (op == JGT || op == JLE) {
+    lhspos = BF_WRK+3;
+    rhspos = BF_WRK;
+  }
+
+  bf_copy_word(bf_regpos(inst->dst.reg), lhspos, BF_WRK+6);
+  if (inst->src.type == REG) {
+    bf_copy_word(bf_regpos(inst->src.reg), rhspos, BF_WRK+6);
+  } else {
+    bf_add_word(rhspos, inst->src.imm);
+  }
+
+  if (op == JEQ || op == JNE) {
+    bf_move_neg(BF_WRK-1, BF_WRK+3-1);
+    bf_move_neg(BF_WRK, BF_WRK+3);
+    bf_move_neg(BF_WRK+1, BF_WRK+3+1);
+
+    if (op == JEQ) {
+      bf_add(BF_WRK, 1);
+      for (int i = 2; i < 5; i++) {
+        bf_loop_begin(BF_WRK+i, 0); {
+          bf_clear(BF_WRK+i);
+          bf_clear(BF_WRK);
+        }; bf_loop_end();
+      }
+    } else {
+      for (int i = 2; i < 5; i++) {
+        bf_loop_begin(BF_WRK+i, 0); {
+          bf_clear(BF_WRK+i);
+          bf_add(BF_WRK, 1);
+        }; bf_loop_end();
+      }
+    }
+    return;
+  }
+
+  bf_loop_begin(BF_WRK-1, '-'); {
+    bf_move_ptr(BF_WRK+2);
+    // If the RHS becomes zero at this moment, LHS >=
+    // RHS. Modify the next byte.
+    bf_ifzero_begin(5); {
+      bf_clear(BF_WRK-1);
+      bf_clear(BF_WRK);
+      bf_clear(BF_WRK+1);
+      bf_clear(BF_WRK+3);
+      bf_clear(BF_WRK+4);
+      bf_add(BF_WRK+2, 1);
+    }; bf_ifzero_end();
+    bf_add(BF_WRK+2, -1);
+  }; bf_loop_end();
+
+  bf_move_ptr(BF_WRK+2);
+  bf_ifzero_begin_impl(4, true, "<<[-]>>"); {
+    // Compare the higher byte first.
+    bf_loop_begin(BF_WRK, '-'); {
+      bf_move_ptr(BF_WRK+3);
+      // If the RHS becomes zero at this moment, LHS >=
+      // RHS. Modify the next byte.
+      bf_ifzero_begin(3); {
+        bf_clear(BF_WRK+4);
+        bf_add(BF_WRK+3, 1);
+        bf_clear(BF_WRK);
+      }; bf_ifzero_end();
+      bf_add(BF_WRK+3, -1);
+    }; bf_loop_end();
+
+    // LH=0. If RH is also zero compare the lower byte.
+    bf_move_ptr(BF_WRK+3);
+    bf_ifzero_begin_impl(3, true, ""); {
+      // Compare the lower byte.
+      bf_loop_begin(BF_WRK+1, '-'); {
+        bf_move_ptr(BF_WRK+4);
+        bf_ifzero_begin(1); {
+          bf_add(BF_WRK, 1);
+        }; bf_ifzero_end();
+        bf_add(BF_WRK+4, -1);
+      }; bf_loop_end();
+
+      // LL=0. Check RL again.
+      bf_move_ptr(BF_WRK+4);
+      bf_ifzero_begin_impl(1, true, ""); {
+        bf_add(BF_WRK, 1);
+      }; bf_ifzero_end();
+    }; bf_ifzero_end();
+  }; bf_ifzero_end();
+
+  bf_clear(BF_WRK+1);
+  bf_clear_word(BF_WRK+3);
+  bf_clear_word(BF_WRK+6);
+
+  // Negate the result.
+  if (op == JLT || op == JGT) {
+    bf_move_ptr(BF_WRK);
+    bf_ifzero_begin_impl(1, true, ""); {
+      bf_add(BF_WRK, 1);
+    }; bf_ifzero_end();
+  }
+}
+
+static void bf_emit_op(Inst* inst) {
+  switch (inst->op) {
+  case MOV: {
+    int dst = bf_regpos(inst->dst.reg);
+    if (inst->src.type == REG) {
+      int src = bf_regpos(inst->src.reg);
+      if (src != dst) {
+        bf_clear_word(dst);
+        bf_copy_word(src, dst, BF_WRK);
+      }
+    } else {
+      bf_clear_word(dst);
+      bf_add_word(dst, inst->src.imm);
+    }
+    break;
+  }
+
+  case ADD:
+    bf_emit_add(inst);
+    break;
+
+  case SUB:
+    bf_emit_sub(inst);
+    break;
+
+  case LOAD:
+    bf_add(BF_LOAD_REQ, 1);
+    if (inst->dst.reg != A)
+      error("only \"load a, X\" is supported");
+
+    if (inst->src.type == REG) {
+      bf_copy_word(bf_regpos(inst->src.reg), BF_MEM + BF_MEM_A, BF_WRK);
+    } else {
+      bf_add_word(BF_MEM + BF_MEM_A, inst->src.imm);
+    }
+    break;
+
+  case STORE:
+    bf_add(BF_STORE_REQ, 1);
+    bf_copy_word(bf_regpos(inst->dst.reg), BF_MEM + BF_MEM_V, BF_WRK);
+    if (inst->src.type == REG) {
+      bf_copy_word(bf_regpos(inst->src.reg), BF_MEM + BF_MEM_A, BF_WRK);
+    } else {
+      bf_add_word(BF_MEM + BF_MEM_A, inst->src.imm);
+    }
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE: {
+    bf_emit_cmp(inst);
+    int dst = bf_regpos(inst->dst.reg);
+    bf_clear_word(dst);
+    bf_move_word(BF_WRK, dst+1);
+    break;
+  }
+
+  case PUTC:
+    if (inst->src.type == REG) {
+      int src = bf_regpos(inst->src.reg);
+      bf_move_ptr(src + 1);
+      bf_emit(".");
+    } else {
+      bf_add(BF_WRK, inst->src.imm % 256);
+      bf_emit(".");
+      bf_clear(BF_WRK);
+    }
+    break;
+
+  case GETC: {
+    int src = bf_regpos(inst->dst.reg);
+    bf_clear_word(src);
+    bf_move_ptr(src+1);
+    bf_emit(",");
+    bf_emit("+");
+    bf_ifzero_begin(1); {
+      bf_add(src + 1, 1);
+    }; bf_ifzero_end();
+    bf_add(src + 1, -1);
+    break;
+  }
+
+  case EXIT:
+    bf_clear(BF_RUNNING);
+    break;
+
+  case DUMP:
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP: {
+    bf_emit_cmp(inst);
+    bf_move_ptr(BF_WRK);
+    bf_emit("[[-]");
+    bf_clear_word(BF_NPC);
+    if (inst->jmp.type == REG) {
+      bf_copy_word(bf_regpos(inst->jmp.reg), BF_NPC, BF_WRK);
+    } else {
+      bf_add_word(BF_NPC, inst->jmp.imm);
+    }
+    bf_move_ptr(BF_WRK);
+    bf_emit("]");
+    break;
+  }
+
+  default:
+    error("oops");
+  }
+}
+
+void bf_emit_code(Inst* inst) {
+  bf_comment("fetch pc");
+  bf_move_word2(BF_PC, BF_NPC, BF_OP);
+
+  bf_comment("increment pc");
+  bf_move_ptr(BF_NPC+3);
+  bf_emit("-");
+  bf_move_ptr(BF_NPC+1);
+  bf_emit("+");
+  bf_emit("[>]>+");
+  // if 0
+  bf_emit("[-<<+>>>+]");
+  bf_set_ptr(BF_NPC+3);
+
+  for (int pc_h = 0; pc_h < 256; pc_h++) {
+    printf("\n# pc_h=%d\n", pc_h);
+
+    bf_add(BF_OP-2, -1);
+    bf_move_ptr(BF_OP);
+    bf_emit("[<]<+[-<+");
+    bf_set_ptr(BF_OP-2);
+
+    for (int pc_l = 0; pc_l < 256; pc_l++) {
+      int pc = pc_h * 256 + pc_l;
+      if (!inst)
+        break;
+
+      bf_add(BF_OP+3, -1);
+      bf_move_ptr(BF_OP+1);
+      bf_emit("[>]>+[->+");
+      bf_set_ptr(BF_OP+3);
+
+      printf("\n# pc_l=%d\n", pc_l);
+
+      for (; inst && inst->pc == pc; inst = inst->next) {
+        printf("\n# ");
+        dump_inst_fp(inst, stdout);
+
+        if (0) {
+          bf_emit("@");
+          bf_dbg(format("%d pc=%d\n", inst->op, pc));
+        }
+
+        // Every op moves a lot of cells, so skip ones whose
+        // result is never read.
+        if (!is_dead_store(bf_live, inst))
+          bf_emit_op(inst);
+      }
+
+      bf_move_ptr(BF_OP+3);
+      bf_emit("]");
+      bf_add(BF_OP+1, -1);
+    }
+
+    bf_move_ptr(BF_OP-2);
+    bf_emit("]");
+    bf_add(BF_OP, -1);
+  }
+
+  bf_clear_word(BF_OP);
+}
+
+static void bf_emit_mem_load(void) {
+  bf_comment("memory (load)");
+
+  bf_move_ptr(BF_LOAD_REQ);
+  bf_emit("[-");
+
+  bf_move_ptr(BF_MEM);
+  bf_set_ptr(0);
+
+  bf_loop_begin(BF_MEM_A-1, '-'); {
+    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN*256);
+    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN*256);
+    bf_set_ptr(BF_MEM_A);
+    bf_add(BF_MEM_USE+1, 1);
+  }; bf_loop_end();
+
+  bf_loop_begin(BF_MEM_A, '-'); {
+    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN);
+    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN);
+    bf_set_ptr(BF_MEM_A);
+    bf_add(BF_MEM_USE, 1);
+  }; bf_loop_end();
+
+  for (int al = 0; al < 256; al++) {
+    bf_move_ptr(BF_MEM_A + 1);
+    bf_ifzero_begin(1); {
+      bf_copy_word(BF_MEM_CTL_LEN + al * 3, BF_MEM_V, BF_MEM_WRK + 2);
+    }; bf_ifzero_end();
+    bf_add(BF_MEM_A + 1, -1);
+  }
+  bf_clear(BF_MEM_A + 1);
+
+  bf_loop_begin(BF_MEM_USE, '-'); {
+    bf_move_ptr(BF_MEM_V);
+    bf_set_ptr(BF_MEM_V + BF_MEM_BLK_LEN);
+    bf_move_word(BF_MEM_V + BF_MEM_BLK_LEN, BF_MEM_V);
+  }; bf_loop_end();
+
+  bf_loop_begin(BF_MEM_USE+1, '-'); {
+    bf_move_ptr(BF_MEM_V);
+    bf_set_ptr(BF_MEM_V + BF_MEM_BLK_LEN * 256);
+    bf_move_word(BF_MEM_V + BF_MEM_BLK_LEN * 256, BF_MEM_V);
+  }; bf_loop_end();
+
+  bf_move_ptr(0);
+  bf_set_ptr(BF_MEM);
+  bf_clear_word(BF_A);
+  bf_move_word(BF_MEM + BF_MEM_V, BF_A);
+
+  bf_move_ptr(BF_LOAD_REQ);
+  bf_emit("]");
+}
+
+static void bf_emit_mem_store(void) {
+  bf_comment("memory (store)");
+
+  bf_move_ptr(BF_STORE_REQ);
+  bf_emit("[-");
+
+  bf_move_ptr(BF_MEM);
+  bf_set_ptr(0);
+
+  bf_loop_begin(BF_MEM_A-1, '-'); {
+    bf_move_word(BF_MEM_V, BF_MEM_V + BF_MEM_BLK_LEN*256);
+    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN*256);
+    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN*256);
+    bf_set_ptr(BF_MEM_A);
+    bf_add(BF_MEM_USE+1, 1);
+  }; bf_loop_end();
+
+  bf_loop_begin(BF_MEM_A, '-'); {
+    bf_move_word(BF_MEM_V, BF_MEM_V + BF_MEM_BLK_LEN);
+    bf_move_word(BF_MEM_A, BF_MEM_A + BF_MEM_BLK_LEN);
+    bf_move_ptr(BF_MEM_A + BF_MEM_BLK_LEN);
+    bf_set_ptr(BF_MEM_A);
+    bf_add(BF_MEM_USE, 1);
+  }; bf_loop_end();
+
+  // VH VL 0 AL 1
+  for (int al = 0; al < 256; al++) {
+    bf_move_ptr(BF_MEM_A + 1);
+    bf_ifzero_begin(1); {
+      bf_clear_word(BF_MEM_CTL_LEN + al * 3);
+      bf_move_word(BF_MEM_V, BF_MEM_CTL_LEN + al * 3);
+    }; bf_ifzero_end();
+    bf_add(BF_MEM_A + 1, -1);
+  }
+  bf_clear(BF_MEM_A + 1);
+
+  bf_move_ptr(BF_MEM_USE);
+  bf_emit("[-");
+  for (int i = 0; i < BF_MEM_BLK_LEN; i++)
+    putchar('<');
+  bf_emit("]");
+
+  bf_move_ptr(BF_MEM_USE+1);
+  bf_emit("[-");
+  for (int i = 0; i < BF_MEM_BLK_LEN*256; i++)
+    putchar('<');
+  bf_emit("]");
+
+  bf_move_ptr(0);
+  bf_set_ptr(BF_MEM);
+
+  bf_move_ptr(BF_STORE_REQ);
+  bf_emit("]");
+}
+
+void target_bf(Module* module) {
+  bf_live = build_liveness(module);
+  bf_init_state(module->data);
+
+  bf_comment("prologue");
+  bf_add(BF_RUNNING, 1);
+  emit_line("[");
+
+  bf_emit_code(module->text);
+  bf_emit_mem_load();
+  bf_emit_mem_store();
+  bf_move_word(BF_NPC, BF_PC);
+
+  bf_comment("epilogue");
+  bf_move_ptr(BF_RUNNING);
+  emit_line("]");
+
+  // endif for cell size check. (should be [-]] but we already have a zero)
+  emit_line("]");
+  // EOL at EOF
+  emit_line("[...THE END...]");
+  free_liveness(bf_live);
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void c_init_state(void) {
+  emit_line("#include <stdio.h>");
+  emit_line("#include <stdlib.h>");
+  emit_line("#include <string.h>");
+
+  for (int i = 0; i < 7; i++) {
+    emit_line("unsigned int %s;", reg_names[i]);
+  }
+  emit_line("unsigned int mem[1<<24];");
+}
+
+static void c_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("void func%d() {", func_id);
+  inc_indent();
+  emit_line("while (%d <= pc && pc < %d) {",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("switch (pc) {");
+  emit_line("case -1:  /* dummy */");
+  inc_indent();
+}
+
+static void c_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("}");
+  emit_line("pc++;");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+}
+
+static void c_emit_pc_change(int pc) {
+  emit_line("break;");
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void c_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case SUB:
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s];", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("putchar(%s);", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("{ int _ = getchar(); %s = _ != EOF ? _ : 0; }",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("exit(0);");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s;",
+              reg_names[inst->dst.reg], cmp_str(inst, "1"));
+    break;
+
+  case MUL:
+    emit_line("%s = (%s * %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case DIV:
+  case MOD: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s ? %s %s %s : %s;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == DIV ? "/" : "%", src,
+              inst->op == DIV ? "0" : reg_names[inst->dst.reg]);
+    break;
+  }
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s %s= %s;", reg_names[inst->dst.reg],
+              inst->op == AND ? "&" : inst->op == OR ? "|" : "^",
+              src_str(inst));
+    break;
+
+  case SHL:
+  case SHR: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s < 24 ? (%s %s %s) & " UINT_MAX_STR " : 0;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == SHL ? "<<" : ">>", src);
+    break;
+  }
+
+  case COPY:
+    emit_line("memmove(mem + %s, mem + %s, %s * sizeof(*mem));",
+              reg_names[inst->dst.reg], src_str(inst),
+              value_str(&inst->jmp));
+    break;
+
+  case FILL:
+    if (inst->src.type == IMM && inst->src.imm == 0) {
+      emit_line("memset(mem + %s, 0, %s * sizeof(*mem));",
+                reg_names[inst->dst.reg], value_str(&inst->jmp));
+    } else {
+      emit_line("for (unsigned int i = 0; i < %s; i++) mem[%s + i] = %s;",
+                value_str(&inst->jmp), reg_names[inst->dst.reg],
+                src_str(inst));
+    }
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if (%s) pc = %s - 1;",
+              cmp_str(inst, "1"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_c(Module* module) {
+  c_init_state();
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         c_emit_func_prologue,
+                                         c_emit_func_epilogue,
+                                         c_emit_pc_change,
+                                         c_emit_inst);
+
+  emit_line("int main() {");
+  inc_indent();
+
+  Data* data = module->data;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("mem[%d] = %d;", mp, data->v);
+    }
+  }
+
+  emit_line("");
+  emit_line("while (1) {");
+  inc_indent();
+  emit_line("switch (pc / %d | 0) {", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("case %d:", i);
+    emit_line(" func%d();", i);
+    emit_line(" break;");
+  }
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+
+  emit_line("return 1;");
+  dec_indent();
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void init_state_cl(Data* data) {
+  emit_line("(declaim (optimize (debug 0) (safety 0) (speed 3)))");
+  emit_line("(defpackage #:elvm-compiled (:use #:cl) (:export #:elvm-main))");
+  emit_line("(in-package #:elvm-compiled)");
+  for (int i = 0; i < 7; i++) {
+    emit_line("(defvar %s 0)", reg_names[i]);
+  }
+  emit_line("(declaim (type fixnum");
+  for (int i = 0; i < 7; i++) {
+    emit_line(" %s", reg_names[i]);
+  }
+  emit_line("))");
+  emit_line("(defvar mem nil)");
+  emit_line("(defparameter mem-init '(");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("  (%d . %d)", mp, data->v);
+    }
+  }
+  emit_line("))");
+  emit_line("(defvar elvm-running nil)");
+  emit_line("(defvar elvm-input nil)");
+  emit_line("(defvar elvm-output nil)");
+}
+
+static void cl_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("(defun elvm-func%d ()", func_id);
+  inc_indent();
+  emit_line("(loop while (and (<= %d pc) (< pc %d) elvm-running) do",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("(case pc");
+  emit_line("(-1 nil");
+  inc_indent();
+}
+
+static void cl_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("))");
+  emit_line("(setq pc (+ pc 1))");
+  dec_indent();
+  emit_line(")");
+  dec_indent();
+  emit_line(")");
+}
+
+static void cl_emit_pc_change(int pc) {
+  emit_line(")");
+  emit_line("");
+  dec_indent();
+  emit_line("(%d", pc);
+  inc_indent();
+}
+
+static const char* cl_cmp_str(Inst* inst) {
+  int op = normalize_cond(inst->op, false);
+  const char* fmt;
+  switch (op) {
+    case JEQ: fmt = "(= %s %s)"; break;
+    case JNE: fmt = "(/= %s %s)"; break;
+    case JLT: fmt = "(< %s %s)"; break;
+    case JGT: fmt = "(> %s %s)"; break;
+    case JLE: fmt = "(<= %s %s)"; break;
+    case JGE: fmt = "(>= %s %s)"; break;
+    default:
+      error("oops");
+  }
+  return format(fmt, reg_names[inst->dst.reg], src_str(inst));
+}
+
+static void cl_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("(setq %s %s)", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("(setq %s (logand (+ %s %s) " UINT_MAX_STR "))",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("(setq %s (logand (- %s %s) " UINT_MAX_STR "))",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("(setq %s (aref mem %s))",
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("(setf (aref mem %s) %s)", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("(putchar %s)", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("(setq %s (getchar))",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("(setq elvm-running nil)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("(setq %s (if %s 1 0))",
+              reg_names[inst->dst.reg], cl_cmp_str(inst));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("(if %s (setq pc (- %s 1)))",
+              cl_cmp_str(inst), value_str(&inst->jmp));
+    break;
+
+  case JMP:
+    emit_line("(setq pc (- %s 1))", value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_cl(Module* module) {
+  init_state_cl(module->data);
+  emit_line("(defun getchar ()");
+  emit_line(" (if (listen elvm-input)");
+  emit_line("  (char-code (read-char elvm-input))");
+  emit_line("  0))");
+  emit_line("(defun putchar (c)");
+  emit_line(" (princ (code-char c) elvm-output))");
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         cl_emit_func_prologue,
+                                         cl_emit_func_epilogue,
+                                         cl_emit_pc_change,
+                                         cl_emit_inst);
+
+  emit_line("(defun elvm-main (&optional (input-stream *standard-input*) (output-stream *standard-output*))");
+  inc_indent();
+  emit_line("(setq elvm-input input-stream)");
+  emit_line("(setq elvm-output output-stream)");
+  for (int i = 0; i < 7; i++) {
+    emit_line("(setq %s 0)", reg_names[i]);
+  }
+  emit_line("(setq mem (make-array 16777216 :element-type 'fixnum :initial-element 0))");
+  emit_line("(dolist (p mem-init)");
+  emit_line(" (setf (aref mem (car p)) (cdr p)))");
+  emit_line("(setq elvm-running t)");
+  emit_line("(loop while elvm-running do");
+  inc_indent();
+  emit_line("(case (truncate pc %d)", CHUNKED_FUNC_SIZE);
+  inc_indent();
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("(%d (elvm-func%d))", i, i);
+  }
+  emit_line(")))");
+  dec_indent();
+  dec_indent();
+  dec_indent();
+  emit_line("(elvm-main)");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+size_t BUF_SIZE = 10000;
+
+static void cpp_defs(void) {
+  emit_line("#include <cstdio>");
+  emit_line("#include <utility>");
+  emit_line("");
+  emit_line("const size_t BUF_SIZE = %d;", BUF_SIZE);
+  emit_line("");
+  emit_line("constexpr char input[] =");
+  emit_line("#include \"input.txt\"");
+  emit_line(";");
+  emit_line("");
+  emit_line("struct buffer {");
+  emit_line(" unsigned int size;");
+  emit_line(" unsigned int b[BUF_SIZE];");
+  emit_line("};");
+  emit_line("template <size_t... I>");
+  emit_line("constexpr buffer make_buf_impl(unsigned int size, unsigned int* buf, std::index_sequence<I...>) {");
+  emit_line(" return buffer{size, {buf[I]...}};");
+  emit_line("}");
+  emit_line("constexpr buffer make_buf(unsigned int size, unsigned int* buf) {");
+  emit_line(" return make_buf_impl(size, buf, std::make_index_sequence<BUF_SIZE>{});");
+  emit_line("}");
+}
+
+static void cpp_init_state(Data* data) {
+  for (int i = 0; i < 7; i++) {
+    emit_line("unsigned int %s = 0;", reg_names[i]);
+  }
+
+  emit_line("unsigned int i_cur = 0;");
+  emit_line("unsigned int o_cur = 0;");
+  emit_line("unsigned int mem[1<<24] = {0};");
+  emit_line("unsigned int buf[BUF_SIZE] = {0};");
+
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("mem[%d] = %d;", mp, data->v);
+    }
+  }
+}
+
+static void cpp_emit_prologue(void) {
+  emit_line("");
+  emit_line("while (1) {");
+  inc_indent();
+  emit_line("switch (pc) {");
+  emit_line("case 0:");
+  inc_indent();
+}
+
+static void cpp_emit_epilogue(void) {
+  dec_indent();
+  emit_line("}");
+  emit_line("pc++;");
+  dec_indent();
+  emit_line("}");
+  emit_line("return make_buf(o_cur, buf);");
+  dec_indent();
+  emit_line("}");
+}
+
+static void cpp_emit_pc_change(int pc) {
+  emit_line("break;");
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void cpp_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case SUB:
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s];", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("buf[o_cur++] = %s;", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("%s = (input[i_cur] ? input[i_cur++] : 0);",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("return make_buf(o_cur, buf);");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s;",
+              reg_names[inst->dst.reg], cmp_str(inst, "1"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if (%s) pc = %s - 1;",
+              cmp_str(inst, "1"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void cpp_emit_main_loop(Inst* inst) {
+  int prev_pc = 0;
+  for (; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      cpp_emit_pc_change(inst->pc);
+    }
+    prev_pc = inst->pc;
+    cpp_emit_inst(inst);
+  }
+}
+
+void target_cpp(Module* module) {
+  cpp_defs();
+  emit_line("");
+  emit_line("constexpr buffer constexpr_main() {");
+  inc_indent();
+
+  cpp_init_state(module->data);
+  cpp_emit_prologue();
+  cpp_emit_main_loop(module->text);
+  cpp_emit_epilogue();
+
+  emit_line("");
+  emit_line("int main() {");
+  emit_line(" constexpr buffer buf = constexpr_main();");
+  emit_line(" constexpr unsigned int output_size = buf.size;");
+  emit_line("");
+  emit_line(" for(int i = 0; i < output_size; ++i) {");
+  emit_line("  putchar(buf.b[i]);");
+  emit_line(" }");
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+#include <target/cpp_template_lib.h>
+
+static void cpp_template_emit_file_prologue(void) {
+  emit_line("#include <cstdio>");
+  emit_line("");
+  emit_line(cpp_template_lib);
+  emit_line("");
+  emit_line("typedef enum { a, b, c, d, bp, sp } Reg_Name;");
+}
+
+static const char* cpp_template_op_str(Inst* inst) {
+  const char * op_str;
+  const char * src_str = inst->src.type == REG ? "reg" : "imm";
+  switch (inst->op) {
+  case MOV:
+    op_str = "mov"; break;
+  case ADD:
+    op_str = "add"; break;
+  case SUB:
+    op_str = "sub"; break;
+  case LOAD:
+    op_str = "load"; break;
+  case STORE:
+    op_str = "store"; break;
+  case PUTC:
+    op_str = "putc"; break;
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    op_str = "cmp"; break;
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    op_str = "jcmp"; break;
+  default:
+    error("oops");
+  }
+  return format("%s_%s", op_str, src_str);
+}
+
+
+int reg_id = 0;
+int mem_id = 0;
+int buf_id = 0;
+int exit_flag = 0;
+
+static void cpp_template_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+  case ADD:
+  case SUB:
+    emit_line("typedef %s<r%d, %s, %s> r%d;",
+              cpp_template_op_str(inst),
+              reg_id, reg_names[inst->dst.reg], src_str(inst), reg_id + 1);
+    reg_id++;
+    break;
+
+  case LOAD:
+    emit_line("typedef %s<r%d, m%d, %s, %s> r%d;",
+              cpp_template_op_str(inst),
+              reg_id, mem_id, reg_names[inst->dst.reg], src_str(inst), reg_id + 1);
+    reg_id++;
+    break;
+
+  case STORE:
+    emit_line("typedef %s<r%d, m%d, %s, %s> m%d;",
+              cpp_template_op_str(inst),
+              reg_id, mem_id, reg_names[inst->dst.reg], src_str(inst), mem_id + 1);
+    mem_id++;
+    break;
+
+  case PUTC:
+    emit_line("typedef %s<r%d, b%d,%s> b%d;",
+              cpp_template_op_str(inst),
+              reg_id, buf_id, src_str(inst), buf_id + 1);
+    buf_id++;
+    break;
+
+  case GETC:
+    emit_line("typedef getc_reg<r%d, %s> r%d;",
+              reg_id, reg_names[inst->dst.reg], reg_id + 1);
+    reg_id++;
+    break;
+
+  case EXIT:
+    emit_line("typedef exit_inst<r%d> r%d;",
+              reg_id, reg_id + 1);
+    exit_flag = 1;
+    reg_id++;
+    return;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("typedef %s<r%d, %s, %s, %d> r%d;",
+              cpp_template_op_str(inst),
+              reg_id,
+              reg_names[inst->dst.reg],
+              src_str(inst),
+              inst->op - EQ,
+              reg_id + 1);
+    reg_id++;
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("typedef %s<r%d, %s - 1, %s, %s, %d> r%d;",
+              cpp_template_op_str(inst),
+              reg_id,
+              value_str(&inst->jmp),
+              reg_names[inst->dst.reg],
+              src_str(inst),
+              inst->op - JEQ,
+              reg_id + 1);
+    reg_id++;
+    break;
+
+  case JMP:
+    emit_line("typedef jmp_%s<r%d, %s> r%d;",
+              inst->jmp.type == REG ? "reg" : "imm",
+              reg_id, value_str(&inst->jmp), reg_id + 1);
+    reg_id++;
+    break;
+
+  default:
+    error("oops");
+  }
+  return;
+}
+
+static void cpp_template_emit_pc_change(int pc) {
+  emit_line("typedef inc_pc<r%d, m%d, b%d> result;", reg_id, mem_id, buf_id);
+  dec_indent();
+  emit_line("};");
+  emit_line("");
+  emit_line("template <typename r0, typename m0, typename b0>");
+  emit_line("struct func_switch_impl<r0, m0, b0, %d> {", pc);
+  inc_indent();
+}
+
+static void cpp_template_emit_func_epilogue() {
+  emit_line("typedef inc_pc<r%d, m%d, b%d> result;", reg_id, mem_id, buf_id);
+  dec_indent();
+  emit_line("};");
+  emit_line("");
+  emit_line("template <typename env, int pc>");
+  emit_line("struct func_switch : func_switch_impl<"
+            "typename env::regs, typename env::mem, "
+            "typename env::buf, pc>::result {};");
+}
+
+void cpp_template_emit_func_switch_impl(Inst* inst) {
+  int prev_pc = 0;
+  emit_line("template <typename r0, typename m0, typename b0, int pc>");
+  emit_line("struct func_switch_impl { typedef inc_pc<r0, m0, b0> result; };");
+  emit_line("");
+  emit_line("template <typename r0, typename m0, typename b0>");
+  emit_line("struct func_switch_impl<r0, m0, b0, 0> {");
+  inc_indent();
+  for (; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      cpp_template_emit_pc_change(inst->pc);
+      reg_id = 0;
+      mem_id = 0;
+      buf_id = 0;
+      exit_flag = 0;
+    }
+    prev_pc = inst->pc;
+
+    cpp_template_emit_inst(inst);
+  }
+  cpp_template_emit_func_epilogue();
+}
+
+static void cpp_template_emit_main_loop(void) {
+  emit_line("template <typename env, bool, int>");
+  emit_line("struct main_loop { typedef env result; };");
+  emit_line("template <typename env, int pc>");
+  emit_line("struct main_loop<env, false, pc> {");
+  inc_indent();
+  emit_line("typedef func_switch<env, pc> env2;");
+  emit_line("typedef typename main_loop<env2, env2::regs::exit_flag, env2::regs::pc>::result result;");
+  dec_indent();
+  emit_line("};");
+}
+
+static void cpp_template_emit_calc_main(Data* data) {
+  emit_line("struct calc_main {");
+  inc_indent();
+  emit_line("typedef init_memory<MEM_SIZE> mem0;");
+  int mp;
+  for (mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("typedef store_value<mem%d, %d, %d> mem%d;", mp, mp, data->v, mp + 1);
+    } else {
+      emit_line("typedef mem%d mem%d;", mp, mp + 1);
+    }
+  }
+  emit_line("typedef init_regs<0> regs;");
+  emit_line(" typedef make_env<regs, mem%d, Nil> env;", mp);
+  emit_line("typedef main_loop<env, false, 0>::result result;");
+  dec_indent();
+  emit_line("};");
+}
+
+void target_cpp_template(Module* module) {
+  cpp_template_emit_file_prologue();
+  emit_line("");
+
+  cpp_template_emit_func_switch_impl(module->text);
+  emit_line("");
+
+  cpp_template_emit_main_loop();
+  emit_line("");
+
+  cpp_template_emit_calc_main(module->data);
+  emit_line("");
+
+  emit_line("int main() {");
+  inc_indent();
+  emit_line("typedef calc_main::result result;");
+  emit_line("print_buffer<result::buf>::run();");
+  dec_indent();
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char* CR_REG_NAMES[] = {
+  "REG[:a]", "REG[:b]", "REG[:c]", "REG[:d]", "REG[:bp]", "REG[:sp]", "REG[:pc]"
+};
+
+static void cr_init_state(Data* data) {
+  emit_line("{%% if flag?(:cr_elvm_input) %%}");
+  emit_line(" print \"#{STDIN.each_byte.to_a.map(&.to_i32).inspect} of Int32\"");
+  emit_line("{%% elsif flag?(:cr_elvm_output) %%}");
+  emit_line(" STDERR.write_byte ARGV[0].to_u8");
+  emit_line("{%% else %%}");
+  inc_indent();
+
+  emit_line("STATE = {input: 0, exit: 0}");
+  emit_line("");
+
+  reg_names = CR_REG_NAMES;
+  emit_line("REG = {a: 0, b: 0, c: 0, d: 0, bp: 0, sp: 0, pc: 0}");
+  emit_line("");
+
+  emit_line("MEM = {");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line(" %d => %d,", mp, data->v);
+    }
+  }
+  emit_line("}");
+  emit_line("");
+
+  emit_line("INPUT = {{ `crystal run -D cr_elvm_input #{1.filename}` }}");
+  dec_indent();
+  emit_line("{%% end %%}");
+}
+
+static void cr_emit_func_prologue(int func_id) {
+  emit_line("{%% if %d <= REG[:pc] && REG[:pc] < %d %%}",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("{%% loop2 = STATE[:exit] == 1 ? [] of Int32 : [0] %%}");
+  emit_line("{%% for x in loop2 %%}");
+  inc_indent();
+  emit_line("{%% if STATE[:exit] == 0 && loop2.size < 100000 && (%d <= REG[:pc] && REG[:pc] < %d)",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("loop2.push 0");
+  emit_line("if false");
+  inc_indent();
+}
+
+static void cr_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("end");
+  emit_line("REG[:pc] = REG[:pc] + 1");
+  dec_indent();
+  emit_line("end %%}");
+  dec_indent();
+  emit_line("{%% end %%}");
+  dec_indent();
+  emit_line("{%% end %%}");
+}
+
+static void cr_emit_pc_change(int pc) {
+  dec_indent();
+  emit_line("elsif REG[:pc] == %d", pc);
+  inc_indent();
+}
+
+static void cr_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = MEM[%s] || 0", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("MEM[%s] = %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("`crystal run -D cr_elvm_output #{1.filename} -- #{%s & 255}`", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("if c = INPUT[STATE[:input]]");
+    emit_line(" %s = c", reg_names[inst->dst.reg]);
+    emit_line(" STATE[:input] = STATE[:input] + 1");
+    emit_line("else");
+    emit_line(" %s = 0", reg_names[inst->dst.reg]);
+    emit_line("end");
+    break;
+
+  case EXIT:
+    emit_line("STATE[:exit] = 1");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s ? 1 : 0",
+              reg_names[inst->dst.reg], cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("REG[:pc] = %s ? %s - 1 : REG[:pc]",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  case JMP:
+    emit_line("REG[:pc] = %s - 1", value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_cr(Module* module) {
+  cr_init_state(module->data);
+  emit_line("{%% unless flag?(:cr_elvm_input) || flag?(:cr_elvm_output) %%}");
+  inc_indent();
+  emit_line("{%% loop1 = [0] %%}");
+  emit_line("{%% for x in loop1 %%}");
+  inc_indent();
+  emit_line("{%% loop2 = [] of Int32 %%}");
+  emit_line("{%% unless STATE[:exit] == 1 %%}");
+  emit_line(" {%% loop1.push 0 %%}");
+  emit_line("{%% end %%}");
+  emit_chunked_main_loop(module->text,
+                         cr_emit_func_prologue,
+                         cr_emit_func_epilogue,
+                         cr_emit_pc_change,
+                         cr_emit_inst);
+  dec_indent();
+  emit_line("{%% end %%}");
+  dec_indent();
+  emit_line("{%% end %%}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void cs_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("private static void func%d() {", func_id);
+  inc_indent();
+  emit_line("while (%d <= pc && pc < %d) {",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("switch (pc) {");
+  emit_line("case -1:  /* dummy */");
+  inc_indent();
+}
+
+static void cs_emit_func_epilogue(void) {
+  emit_line("break;");
+  dec_indent();
+  emit_line("}");
+  emit_line("pc++;");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+}
+
+static void cs_emit_pc_change(int pc) {
+  emit_line("break;");
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void cs_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s];", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("Console.Out.Write((char)%s);", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("try { int _ = Console.In.Read(); "
+              "  %s = _ == -1 ? 0 : _; }"
+              "catch (Exception e) {}",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("Environment.Exit(0);");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s ? 1 : 0;",
+              reg_names[inst->dst.reg], cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if (%s) pc = %s - 1;",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static int cs_init_state(Data* data) {
+  int prev_mc = -1;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      int mc = mp / 1000;
+      while (prev_mc != mc) {
+        if (prev_mc != -1) {
+          dec_indent();
+          emit_line("}");
+        }
+        prev_mc++;
+        emit_line("static void init%d() {", prev_mc);
+        inc_indent();
+      }
+      emit_line("mem[%d] = %d;", mp, data->v);
+    }
+  }
+
+  if (prev_mc != -1) {
+    dec_indent();
+    emit_line("}");
+  }
+
+  return prev_mc + 1;
+}
+
+void target_cs(Module* module) {
+  emit_line("using System;");
+  emit_line("namespace ConsoleApplication {");
+  inc_indent();
+  emit_line("public class Program {");
+  inc_indent();
+  for (int i = 0; i < 7; i++) {
+    emit_line("static int %s;", reg_names[i]);
+  }
+  emit_line("static int[] mem = new int[1<<24];");
+
+  int num_inits = cs_init_state(module->data);
+
+  CHUNKED_FUNC_SIZE = 256;
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         cs_emit_func_prologue,
+                                         cs_emit_func_epilogue,
+                                         cs_emit_pc_change,
+                                         cs_emit_inst);
+
+  emit_line("public static void Main(string[] args) {");
+  inc_indent();
+
+  for (int i = 0; i < num_inits; i++) {
+    emit_line("init%d();", i);
+  }
+
+  emit_line("");
+  emit_line("while (true) {");
+  inc_indent();
+  emit_line("switch (pc / %d | 0) {", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("case %d:", i);
+    emit_line(" func%d();", i);
+    emit_line(" break;");
+  }
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void init_state_el(Data* data) {
+  emit_line("(setq elvm-main (lambda ()");
+  emit_line("(load \"cl\" nil t)");
+  for (int i = 0; i < 7; i++) {
+    emit_line("(setq %s 0)", reg_names[i]);
+  }
+  emit_line("(setq mem (make-vector 16777216 0))");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("(aset mem %d %d)", mp, data->v);
+    }
+  }
+}
+
+static void el_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("(defun elvm-func%d ()", func_id);
+  inc_indent();
+  emit_line("(while (and (<= %d pc) (< pc %d) elvm-running)",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("(cl-case pc");
+  emit_line("(-1 nil");
+  inc_indent();
+}
+
+static void el_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("))");
+  emit_line("(setq pc (+ pc 1))");
+  dec_indent();
+  emit_line(")");
+  dec_indent();
+  emit_line(")");
+}
+
+static void el_emit_pc_change(int pc) {
+  emit_line(")");
+  emit_line("");
+  dec_indent();
+  emit_line("(%d", pc);
+  inc_indent();
+}
+
+static const char* el_cmp_str(Inst* inst) {
+  int op = normalize_cond(inst->op, false);
+  const char* fmt;
+  switch (op) {
+    case JEQ: fmt = "(eq %s %s)"; break;
+    case JNE: fmt = "(not (eq %s %s))"; break;
+    case JLT: fmt = "(< %s %s)"; break;
+    case JGT: fmt = "(> %s %s)"; break;
+    case JLE: fmt = "(<= %s %s)"; break;
+    case JGE: fmt = "(>= %s %s)"; break;
+    default:
+      error("oops");
+  }
+  return format(fmt, reg_names[inst->dst.reg], src_str(inst));
+}
+
+static void el_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("(setq %s %s)", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("(setq %s (logand (+ %s %s) " UINT_MAX_STR "))",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("(setq %s (logand (- %s %s) " UINT_MAX_STR "))",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("(setq %s (aref mem %s))",
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("(aset mem %s %s)", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("(putchar %s)", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("(setq %s (getchar))",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("(setq elvm-running nil)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("(setq %s (if %s 1 0))",
+              reg_names[inst->dst.reg], el_cmp_str(inst));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("(if %s (setq pc (- %s 1)))",
+              el_cmp_str(inst), value_str(&inst->jmp));
+    break;
+
+  case JMP:
+    emit_line("(setq pc (- %s 1))", value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_el(Module* module) {
+  init_state_el(module->data);
+  emit_line("(setq elvm-running t)");
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         el_emit_func_prologue,
+                                         el_emit_func_epilogue,
+                                         el_emit_pc_change,
+                                         el_emit_inst);
+
+  emit_line("");
+  emit_line("(while elvm-running");
+  inc_indent();
+  emit_line("(cl-case (/ pc %d)", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("(%d (elvm-func%d))", i, i);
+  }
+  emit_line(")");
+  dec_indent();
+  emit_line(")");
+
+  emit_line("))");
+
+  emit_line("(defun getchar ()");
+  emit_line(" (if (eq (length elvm-input) 0) 0");
+  emit_line("  (setq r (string-to-char elvm-input))");
+  emit_line("  (setq elvm-input (substring elvm-input 1))");
+  emit_line("  r))");
+  emit_line("(if noninteractive (progn");
+  emit_line(" (setq elvm-input");
+  emit_line("  (with-temp-buffer");
+  emit_line("   (insert-file-contents \"/dev/stdin\")");
+  emit_line("   (buffer-string)))");
+  emit_line(" (defun putchar (c) (princ (char-to-string c)))");
+  emit_line(" (funcall elvm-main)))");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+#define FORTH_MEM_SIZE_STR "16777216"
+#define FORTH_ADDR_MASK UINT_MAX
+
+static const char* FORTH_REG_NAMES[] = {
+  "reg-a", "reg-b", "reg-c", "reg-d", "reg-bp", "reg-sp", "reg-pc"
+};
+
+static void init_state_forth(Data* data) {
+  reg_names = FORTH_REG_NAMES;
+  for (int i = 0; i < 7; i++) {
+    emit_line("variable %s", reg_names[i]);
+    emit_line("0 %s !", reg_names[i]);
+  }
+  emit_line("variable mem");
+  emit_line(FORTH_MEM_SIZE_STR " cells allocate throw mem !");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("%d mem @ %d cells + !", data->v, mp);
+    }
+  }
+  emit_line("");
+  emit_line("variable tmpchar");
+  emit_line(": getc");
+  inc_indent();
+  emit_line("tmpchar 1 stdin read-file");
+  emit_line("0= swap 1 = and if tmpchar @ else 0 then");
+  dec_indent();
+  emit_line(";");
+}
+
+static void forth_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line(": func%d", func_id);
+  inc_indent();
+  emit_line("begin");
+  inc_indent();
+  emit_line("reg-pc @ dup %d >= swap %d < and",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  dec_indent();
+  emit_line("while");
+  inc_indent();
+  emit_line("reg-pc @");
+  emit_line("dup -1 = if");
+  inc_indent();
+}
+
+static void forth_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("then");
+  emit_line("drop");
+  emit_line("1 reg-pc +!");
+  dec_indent();
+  emit_line("repeat");
+  dec_indent();
+  emit_line(";");
+}
+
+static void forth_emit_pc_change(int pc) {
+  dec_indent();
+  emit_line("then");
+  emit_line("dup %d = if", pc);
+  inc_indent();
+}
+
+static const char* forth_value_str(Value* v) {
+  if (v->type == REG) {
+    return format("%s @", reg_names[v->reg]);
+  } else if (v->type == IMM) {
+    return format("%d", v->imm);
+  } else {
+    error("invalid value");
+  }
+}
+
+static const char* forth_src_str(Inst* inst) {
+  return forth_value_str(&inst->src);
+}
+
+static void emit_cmp(Inst* inst, const char* cmp_op) {
+  emit_line("%s @ %s %s if 1 else 0 then %s !",
+            reg_names[inst->dst.reg], forth_src_str(inst),
+            cmp_op, reg_names[inst->dst.reg]);
+}
+
+static void emit_jump(Inst* inst) {
+  emit_line("%s 1 - reg-pc !", forth_value_str(&inst->jmp));
+}
+
+static void emit_cond_jump(Inst* inst, const char* cmp_op) {
+  emit_line("%s @ %s %s if",
+            reg_names[inst->dst.reg], forth_src_str(inst), cmp_op);
+  inc_indent();
+  emit_jump(inst);
+  dec_indent();
+  emit_line("then");
+}
+
+static void forth_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s %s !", forth_src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case ADD:
+    emit_line("%s @ %s + %d and",
+              reg_names[inst->dst.reg], forth_src_str(inst), FORTH_ADDR_MASK);
+    emit_line("%s !", reg_names[inst->dst.reg]);
+    break;
+
+  case SUB:
+    emit_line("%s @ %s - %d and",
+              reg_names[inst->dst.reg], forth_src_str(inst), FORTH_ADDR_MASK);
+    emit_line("%s !", reg_names[inst->dst.reg]);
+    break;
+
+  case LOAD:
+    emit_line("mem @ %s cells + @ %s !",
+              forth_src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case STORE:
+    emit_line("%s @ mem  @ %s cells + !",
+              reg_names[inst->dst.reg], forth_src_str(inst));
+    break;
+
+  case PUTC:
+    emit_line("%s emit", forth_src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("getc %s !", reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("bye");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+    emit_cmp(inst, "=");
+    break;
+  case NE:
+    emit_cmp(inst, "<>");
+    break;
+  case LT:
+    emit_cmp(inst, "<");
+    break;
+  case GT:
+    emit_cmp(inst, ">");
+    break;
+  case LE:
+    emit_cmp(inst, "<=");
+    break;
+  case GE:
+    emit_cmp(inst, ">=");
+    break;
+
+  case JEQ:
+    emit_cond_jump(inst, "=");
+    break;
+  case JNE:
+    emit_cond_jump(inst, "<>");
+    break;
+  case JLT:
+    emit_cond_jump(inst, "<");
+    break;
+  case JGT:
+    emit_cond_jump(inst, ">");
+    break;
+  case JLE:
+    emit_cond_jump(inst, "<=");
+    break;
+  case JGE:
+    emit_cond_jump(inst, ">=");
+    break;
+  case JMP:
+    emit_jump(inst);
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_forth(Module* module) {
+  init_state_forth(module->data);
+  emit_line("");
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         forth_emit_func_prologue,
+                                         forth_emit_func_epilogue,
+                                         forth_emit_pc_change,
+                                         forth_emit_inst);
+
+  emit_line("");
+  emit_line(": main");
+  inc_indent();
+  emit_line("begin");
+  inc_indent();
+  emit_line("reg-pc @ %d /", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("dup %d = if func%d else", i, i);
+  }
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("then");
+  }
+  emit_line("drop");
+  dec_indent();
+  emit_line("0 until");
+  dec_indent();
+  emit_line(";");
+  emit_line("");
+  emit_line("main");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char* FS_REG_NAMES[] = {
+  "a", "b", "c", "d", "bp", "sp", "pc"
+};
+
+static void init_state_fs(Data* data) {
+  reg_names = FS_REG_NAMES;
+  for (int i = 0; i < 7; i++) {
+    emit_line("let mutable %s = 0", reg_names[i]);
+  }
+  emit_line("let mem : int array = Array.zeroCreate (1 <<< 24)");
+  emit_line("");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("Array.set mem %d %d", mp, data->v);
+    }
+  }
+}
+
+static void fs_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("let func%d() =", func_id);
+  inc_indent();
+  emit_line("while %d <= pc && pc < %d do",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("match pc with");
+  inc_indent();
+}
+
+static void fs_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("| _ -> failwith(\"oops\")");
+  emit_line("pc <- pc + 1");
+  dec_indent();
+  dec_indent();
+}
+
+static void fs_emit_pc_change(int pc) {
+  dec_indent();
+  emit_line("| %d ->", pc);
+  inc_indent();
+}
+
+static const char* fs_cmp_str(Inst* inst, const char* true_str) {
+  int op = normalize_cond(inst->op, 0);
+  const char* op_str;
+  switch (op) {
+    case JEQ:
+      op_str = "="; break;
+    case JNE:
+      op_str = "<>"; break;
+    case JLT:
+      op_str = "<"; break;
+    case JGT:
+      op_str = ">"; break;
+    case JLE:
+      op_str = "<="; break;
+    case JGE:
+      op_str = ">="; break;
+    case JMP:
+      return true_str;
+    default:
+      error("oops");
+  }
+  return format("%s %s %s", reg_names[inst->dst.reg], op_str, src_str(inst));
+}
+
+static void fs_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s <- %s", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s <- (%s + %s) &&& " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s <- (%s - %s) &&& " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s <- mem.[%s]", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("Array.set mem %s %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("printf \"%%c\" (char %s)", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("%s <- let x = Console.Read() in if x <> -1 then x else 0",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("Environment.Exit(0)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s <- if %s then 1 else 0",
+              reg_names[inst->dst.reg], fs_cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if %s then pc <- %s - 1",
+              fs_cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_fs(Module* module) {
+  emit_line("open System");
+  emit_line("");
+
+  init_state_fs(module->data);
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         fs_emit_func_prologue,
+                                         fs_emit_func_epilogue,
+                                         fs_emit_pc_change,
+                                         fs_emit_inst);
+
+  emit_line("");
+  emit_line("[<EntryPoint>]");
+  emit_line("let main argv =");
+  inc_indent();
+
+  emit_line("while true do");
+  inc_indent();
+  emit_line("match pc / %d with", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("| %d -> func%d()", i, i);
+  }
+  emit_line("| _ -> failwith(\"oops\")");
+  dec_indent();
+  emit_line("0");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+#define GO_INT_TYPE "int32"
+
+static void go_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case SUB:
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s]", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("buf[0] = byte(%s); os.Stdout.Write(buf[:])", src_str(inst));
+    break;
+
+  case GETC:
+      emit_line("if n, err := os.Stdin.Read(buf[:]); n != 0 && err == nil { %s = " GO_INT_TYPE "(buf[0]) } else { %s = 0 }",
+                reg_names[inst->dst.reg], reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("os.Exit(0)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("if %s { %s = 1 } else { %s = 0 }",
+              cmp_str(inst, "true"), reg_names[inst->dst.reg], reg_names[inst->dst.reg]);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if %s { pc = %s - 1 }",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static void go_init_state(Data* data) {
+  emit_line("copy(mem, []" GO_INT_TYPE "{");
+  for (int mp = 0; data; data = data->next, mp++) {
+    emit_line(" %d,", data->v);
+  }
+  emit_line("})");
+}
+
+void target_go(Module* module) {
+  emit_line("package main");
+  emit_line("import \"os\"");
+
+  emit_line("func main() {");
+  inc_indent();
+
+  for (int i = 0; i < 7; i++) {
+    emit_line("var %s " GO_INT_TYPE, reg_names[i]);
+    emit_line("_ = %s", reg_names[i]);
+  }
+  emit_line("var buf [1]byte");
+  emit_line("_ = buf");
+
+  emit_line("mem := make([]" GO_INT_TYPE ", 1<<24)");
+  go_init_state(module->data);
+
+  emit_line("");
+  emit_line("for {");
+  inc_indent();
+
+  emit_line("switch pc {");
+  inc_indent();
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      dec_indent();
+      emit_line("");
+      emit_line("case %d:", inst->pc);
+      prev_pc = inst->pc;
+      inc_indent();
+    }
+    go_emit_inst(inst);
+  }
+  // end of switch
+  dec_indent();
+  emit_line("}");
+  emit_line("pc++");
+
+  // end of for
+  dec_indent();
+  emit_line("}");
+
+  // end of main
+  dec_indent();
+  emit_line("}");
+}
+#include <stdarg.h>
+
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char* I_REG_NAMES[] = {
+  ":1", ":2", ":3", ":4", ":5", ":6", ":7"
+};
+
+// :8  = tmp dst
+// :9  = tmp src
+// :10 = interleave(#0, #65535)
+// :11 = reg jmp
+// :12 = prev putc
+// :13 = prev getc
+// ;1  = memory
+// ;2  = putc table
+// ;3  = getc table (for CLC-INTERCAL only)
+// ;4  = temporary buffer for getc/putc
+
+#define USE_C_INTERCAL
+
+#if defined(USE_C_INTERCAL)
+
+#define I_INT "$"
+
+static const int I_PUTC_TBL[] = {
+  256,128,192,64,224,96,160,32,240,112,176,48,208,80,144,16,
+  248,120,184,56,216,88,152,24,232,104,168,40,200,72,136,8,
+  252,124,188,60,220,92,156,28,236,108,172,44,204,76,140,12,
+  244,116,180,52,212,84,148,20,228,100,164,36,196,68,132,4,
+  254,126,190,62,222,94,158,30,238,110,174,46,206,78,142,14,
+  246,118,182,54,214,86,150,22,230,102,166,38,198,70,134,6,
+  250,122,186,58,218,90,154,26,234,106,170,42,202,74,138,10,
+  242,114,178,50,210,82,146,18,226,98,162,34,194,66,130,2,
+  255,127,191,63,223,95,159,31,239,111,175,47,207,79,143,15,
+  247,119,183,55,215,87,151,23,231,103,167,39,199,71,135,7,
+  251,123,187,59,219,91,155,27,235,107,171,43,203,75,139,11,
+  243,115,179,51,211,83,147,19,227,99,163,35,195,67,131,3,
+  253,125,189,61,221,93,157,29,237,109,173,45,205,77,141,13,
+  245,117,181,53,213,85,149,21,229,101,165,37,197,69,133,5,
+  249,121,185,57,217,89,153,25,233,105,169,41,201,73,137,9,
+  241,113,177,49,209,81,145,17,225,97,161,33,193,65,129,1
+};
+
+#else
+
+#define I_INT "C\x08/"
+
+static const int I_PUTC_TBL[] = {
+  85,84,81,80,87,86,83,82,93,92,89,88,95,94,91,90,
+  69,68,65,64,71,70,67,66,77,76,73,72,79,78,75,74,
+  117,116,113,112,119,118,115,114,125,124,121,120,127,126,123,122,
+  101,100,97,96,103,102,99,98,109,108,105,104,111,110,107,106,
+  21,20,17,16,23,22,19,18,29,28,25,24,31,30,27,26,
+  5,4,1,256,7,6,3,2,13,12,9,8,15,14,11,10,
+  53,52,49,48,55,54,51,50,61,60,57,56,63,62,59,58,
+  37,36,33,32,39,38,35,34,45,44,41,40,47,46,43,42,
+  213,212,209,208,215,214,211,210,221,220,217,216,223,222,219,218,
+  197,196,193,192,199,198,195,194,205,204,201,200,207,206,203,202,
+  245,244,241,240,247,246,243,242,253,252,249,248,255,254,251,250,
+  229,228,225,224,231,230,227,226,237,236,233,232,239,238,235,234,
+  149,148,145,144,151,150,147,146,157,156,153,152,159,158,155,154,
+  133,132,129,128,135,134,131,130,141,140,137,136,143,142,139,138,
+  181,180,177,176,183,182,179,178,189,188,185,184,191,190,187,186,
+  165,164,161,160,167,166,163,162,173,172,169,168,175,174,171,170
+};
+
+#endif
+
+static uint i_interleave(uint a, uint b) {
+  uint r = 0;
+  uint m = 1;
+  while (a > 0 || b > 0) {
+    r += (a % 2 * 2 + b % 2) * m;
+    m *= 4;
+    a /= 2;
+    b /= 2;
+  }
+  return r;
+}
+
+static uint i_emit_please_cnt;
+static void i_emit_line(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char* r = vformat(fmt, ap);
+  va_end(ap);
+
+  if (++i_emit_please_cnt == 3) {
+    printf("PLEASE ");
+    i_emit_please_cnt = 0;
+  }
+  printf("DO %s\n", r);
+}
+
+static char* i_imm(uint v) {
+  return format("#%d", v % 65536);
+#if 0
+  if (v < 65536) {
+    return format("#%d", v);
+  }
+  uint a = 0, b = 0;
+  while (v) {
+    uint b0 = v % 2;
+    v /= 2;
+    uint a0 = v % 2;
+    v /= 2;
+    b = b * 2 + b0;
+    a = a * 2 + a0;
+  }
+  return format("#%d"I_INT"#%d", a, b);
+#endif
+}
+
+static void i_init_state(Data* data) {
+  for (int i = 0; i < 7; i++) {
+    if (i == SP) {
+      // INTERCAL backend cannot access mem[65535].
+      // TODO: Adjust memory layout to allow this.
+      i_emit_line("%s <- #65534", I_REG_NAMES[i]);
+    } else {
+      i_emit_line("%s <- #0", I_REG_NAMES[i]);
+    }
+  }
+  i_emit_line(":10 <- #0"I_INT"#65535");
+  i_emit_line(":12 <- #0");
+  i_emit_line(":13 <- #0");
+
+  //i_emit_line(";1 <- #0"I_INT"#4096");
+  i_emit_line(";1 <- #65535");
+  for (int mp = 1; data; data = data->next, mp++) {
+    i_emit_line(";1 SUB #%d <- %s", mp, i_imm(data->v));
+  }
+
+  i_emit_line(";2 <- #%d", i_interleave(1, 255) + 1);
+  i_emit_line(";3 <- #%d", i_interleave(1, 255) + 1);
+  for (int i = 1; i < 256; i++) {
+    i_emit_line(";2 SUB #%d <- #%d", i_interleave(1, i), I_PUTC_TBL[i]);
+    i_emit_line(";3 SUB #%d <- #%d", i_interleave(1, I_PUTC_TBL[i] % 256), i);
+  }
+}
+
+static const char* i_value_str(Value* v) {
+  if (v->type == REG) {
+    return I_REG_NAMES[v->reg];
+  } else if (v->type == IMM) {
+    return i_imm(v->imm);
+  } else {
+    error("invalid value");
+  }
+}
+
+static const char* i_src_str(Inst* inst) {
+  return i_value_str(&inst->src);
+}
+
+static void i_emit_bitop(const char* op, int dst,
+                         const char* a, const char* b) {
+  i_emit_line(":%d <- %s " I_INT " %s", dst, a, b);
+  i_emit_line(":%d <- ':%s%d' ~ :10", dst, op, dst);
+}
+
+static void i_emit_and(int dst, const char* a, const char* b) {
+  i_emit_bitop("&", dst, a, b);
+}
+
+static void i_emit_xor(int dst, const char* a, const char* b) {
+  i_emit_bitop("V\x08-", dst, a, b);
+}
+
+static void i_emit_add(int add_fn) {
+  i_emit_line("(%d) NEXT", add_fn);
+}
+
+static void i_emit_sub(int add_fn) {
+  i_emit_xor(9, ":9", "#65535");
+  i_emit_line(":9 <- :9 ~ #65535");
+  i_emit_add(add_fn);
+  i_emit_line(":9 <- #1");
+  i_emit_add(add_fn);
+}
+
+// Converts 0, 1 in :8 to 1, 2.
+static void i_emit_intercal_boolize() {
+  i_emit_line(":8 <- :8" I_INT "#1");
+  i_emit_line(":8 <- :V\x08-8");
+  i_emit_line(":8 <- :8 ~ #3");
+}
+
+static void i_emit_cmp(Inst* inst, int add_fn) {
+  int op = normalize_cond(inst->op, false);
+  if (op == JGT || op == JLE) {
+    op = op == JGT ? JLT : JGE;
+    i_emit_line(":9 <- %s", I_REG_NAMES[inst->dst.reg]);
+    i_emit_line(":8 <- %s", i_src_str(inst));
+  } else {
+    i_emit_line(":8 <- %s", I_REG_NAMES[inst->dst.reg]);
+    i_emit_line(":9 <- %s", i_src_str(inst));
+  }
+  i_emit_sub(add_fn);
+
+  switch (op) {
+    case JEQ:
+      i_emit_line(":8 <- #65535 ~ :8");
+      i_emit_line(":8 <- :8 ~ #1");
+      i_emit_xor(8, ":8", "#1");
+      break;
+
+    case JNE:
+      i_emit_line(":8 <- #65535 ~ :8");
+      i_emit_line(":8 <- :8 ~ #1");
+      break;
+
+    case JGE:
+      i_emit_xor(8, ":8", "#32768");
+      FALLTHROUGH;
+
+    case JLT:
+      i_emit_and(8, ":8", "#32768");
+      i_emit_line(":8 <- #32768 ~ :8");
+      break;
+
+    default:
+      error("oops %d", op);
+  }
+}
+
+static void i_emit_jmp(Inst* inst, int reg_jmp) {
+  if (inst->jmp.type == REG) {
+    i_emit_line(":11 <- %s", I_REG_NAMES[inst->jmp.reg]);
+    i_emit_line("(%d) NEXT", reg_jmp);
+  } else {
+    i_emit_line("(%d) NEXT", inst->jmp.imm);
+  }
+}
+
+static void i_emit_inst(Inst* inst, int add_fn, int reg_jmp, int* label) {
+  switch (inst->op) {
+  case MOV:
+    i_emit_line("%s <- %s", I_REG_NAMES[inst->dst.reg], i_src_str(inst));
+    break;
+
+  case ADD:
+    i_emit_line(":8 <- %s", I_REG_NAMES[inst->dst.reg]);
+    i_emit_line(":9 <- %s", i_src_str(inst));
+    i_emit_add(add_fn);
+    i_emit_line("%s <- :8", I_REG_NAMES[inst->dst.reg]);
+    break;
+
+  case SUB:
+    i_emit_line(":8 <- %s", I_REG_NAMES[inst->dst.reg]);
+    i_emit_line(":9 <- %s", i_src_str(inst));
+    i_emit_sub(add_fn);
+    i_emit_line("%s <- :8", I_REG_NAMES[inst->dst.reg]);
+    break;
+
+  case LOAD:
+    i_emit_line(":8 <- %s", i_src_str(inst));
+    i_emit_line(":9 <- #1");
+    i_emit_add(add_fn);
+    i_emit_line("%s <- ;1 SUB :8", I_REG_NAMES[inst->dst.reg]);
+    break;
+
+  case STORE:
+    i_emit_line(":8 <- %s", i_src_str(inst));
+    i_emit_line(":9 <- #1");
+    i_emit_add(add_fn);
+    i_emit_line(";1 SUB :8 <- %s", I_REG_NAMES[inst->dst.reg]);
+    break;
+
+  case PUTC:
+#if defined(USE_C_INTERCAL)
+    i_emit_line(":9 <- %s~#255", i_src_str(inst));
+    i_emit_line(":9 <- #1"I_INT":9");
+    i_emit_line(":8 <- ;2 SUB :9");
+    i_emit_line(":9 <- :12");
+    i_emit_line(":12 <- :8");
+    i_emit_sub(add_fn);
+    i_emit_line(";4 <- #1");
+    i_emit_line(";4 SUB #1 <- :8");
+    i_emit_line("READ OUT ;4");
+#else
+    i_emit_line(":9 <- %s~#255", i_src_str(inst));
+    i_emit_line(":9 <- #1"I_INT":9");
+    i_emit_line(";4 <- #1");
+    i_emit_line(";4 SUB #1 <- ;2 SUB :9");
+    i_emit_line("READ OUT ;4");
+#endif
+    break;
+
+  case GETC:
+    i_emit_line(";4 <- #1");
+    i_emit_line(";4 SUB #1 <- #0");
+    i_emit_line("WRITE IN ;4");
+#if defined(USE_C_INTERCAL)
+    i_emit_line(":8 <- ;4 SUB #1");
+
+    i_emit_line(":7 <- :8 ~ #256");
+    for (int i = 0; i < 16; i++) {
+      i_emit_line(":7 <- :7"I_INT":7");
+      i_emit_line(":7 <- :7 ~ #65535");
+    }
+    i_emit_xor(7, ":7", "#255");
+    i_emit_line(":7 <- :7 ~ #255");
+
+    i_emit_line(":9 <- :13");
+    i_emit_add(add_fn);
+    i_emit_line(":13 <- :8");
+
+    i_emit_and(8, ":8", ":7");
+
+    i_emit_line("%s <- :8", I_REG_NAMES[inst->dst.reg]);
+#else
+    i_emit_line(":9 <- ;4 SUB #1");
+    i_emit_line(":9 <- :9~#255");
+    i_emit_line(":9 <- #1"I_INT":9");
+    i_emit_line("%s <- ;3 SUB :9", I_REG_NAMES[inst->dst.reg]);
+#endif
+    break;
+
+  case EXIT:
+    i_emit_line("GIVE UP");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    i_emit_cmp(inst, add_fn);
+    i_emit_line("%s <- :8", I_REG_NAMES[inst->dst.reg]);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE: {
+    if (inst->jmp.type == REG) {
+      error("jcc reg");
+    }
+
+    i_emit_cmp(inst, add_fn);
+    i_emit_intercal_boolize();
+
+    int l1 = ++*label;
+    int l2 = ++*label;
+    i_emit_line("(%d) NEXT", l1);
+    i_emit_line("(%d) NEXT", inst->jmp.imm);
+
+    emit_line("(%d) DO RESUME :8", l2);
+    emit_line("(%d) DO (%d) NEXT", l1, l2);
+    i_emit_line("FORGET #1");
+    break;
+  }
+
+  case JMP: {
+    i_emit_jmp(inst, reg_jmp);
+    break;
+  }
+
+  default:
+    error("oops");
+  }
+}
+
+static void i_emit_reg_jmp_table(uint pc, uint bit, uint max_pc, int* label) {
+  if (bit > max_pc) {
+    if (pc >= max_pc || pc == 0) {
+      i_emit_line("ERR %d", pc);
+    } else {
+      i_emit_line("(%d) NEXT", pc);
+    }
+    return;
+  }
+
+  i_emit_line(":8 <- :11 ~ #%d", bit);
+  i_emit_intercal_boolize();
+
+  int l1 = ++*label;
+  int l2 = ++*label;
+  i_emit_line("(%d) NEXT", l1);
+
+  i_emit_reg_jmp_table(pc + bit, bit * 2, max_pc, label);
+
+  emit_line("(%d) DO RESUME :8", l2);
+  emit_line("(%d) DO (%d) NEXT", l1, l2);
+  i_emit_line("FORGET #1");
+
+  i_emit_reg_jmp_table(pc, bit * 2, max_pc, label);
+}
+
+void target_i(Module* module) {
+  i_init_state(module->data);
+
+  int label = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    label = inst->pc;
+  }
+  int reg_jmp = ++label;
+  int add_fn = ++label;
+
+  int prev_pc = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      emit_line("(%d) DO FORGET #1", inst->pc);
+    }
+    prev_pc = inst->pc;
+    emit_line("");
+    i_emit_inst(inst, add_fn, reg_jmp, &label);
+  }
+
+  emit_line("");
+  emit_line("(%d) DO NOTe add function", add_fn);
+  for (int i = 0; i < 16; i++) {
+    i_emit_line(":9 <- :8"I_INT":9");
+    i_emit_line(":8 <- :V\x08-9");
+    i_emit_line(":8 <- :8 ~ :10");
+    i_emit_line(":9 <- :&9");
+    i_emit_line(":9 <- :9 ~ :10");
+    i_emit_line(":9 <- ':9"I_INT"#0'~'#32767"I_INT"#1'");
+  }
+  i_emit_line("RESUME #1");
+
+  emit_line("");
+  i_emit_line("NOTe reg jmp");
+  emit_line("(%d) DO FORGET #1", reg_jmp);
+  i_emit_reg_jmp_table(0, 1, reg_jmp, &label);
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void java_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("private static void func%d() {", func_id);
+  inc_indent();
+  emit_line("while (%d <= pc && pc < %d) {",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("switch (pc) {");
+  emit_line("case -1:  /* dummy */");
+  inc_indent();
+}
+
+static void java_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("}");
+  emit_line("pc++;");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+}
+
+static void java_emit_pc_change(int pc) {
+  emit_line("break;");
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void java_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case SUB:
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s];", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("System.out.print(String.valueOf((char)%s));", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("try { int __ = System.in.read(); "
+              "  %s = __ == -1 ? 0 : __; }"
+              "catch (Exception e) {}",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("System.exit(0);");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s ? 1 : 0;",
+              reg_names[inst->dst.reg], cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if (%s) pc = %s - 1;",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static int java_init_state(Data* data) {
+  int prev_mc = -1;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      int mc = mp / 1000;
+      while (prev_mc != mc) {
+        if (prev_mc != -1) {
+          dec_indent();
+          emit_line("}");
+        }
+        prev_mc++;
+        emit_line("static void init%d() {", prev_mc);
+        inc_indent();
+      }
+      emit_line("mem[%d] = %d;", mp, data->v);
+    }
+  }
+
+  if (prev_mc != -1) {
+    dec_indent();
+    emit_line("}");
+  }
+
+  return prev_mc + 1;
+}
+
+void target_java(Module* module) {
+  emit_line("public class Main {");
+  inc_indent();
+  for (int i = 0; i < 7; i++) {
+    emit_line("static int %s;", reg_names[i]);
+  }
+  emit_line("static int[] mem;");
+
+  int num_inits = java_init_state(module->data);
+
+  CHUNKED_FUNC_SIZE = 256;
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         java_emit_func_prologue,
+                                         java_emit_func_epilogue,
+                                         java_emit_pc_change,
+                                         java_emit_inst);
+
+  emit_line("public static void main(String[] args) {");
+  inc_indent();
+
+  emit_line("mem = new int[1<<24];");
+  for (int i = 0; i < num_inits; i++) {
+    emit_line("init%d();", i);
+  }
+
+  emit_line("");
+  emit_line("while (true) {");
+  inc_indent();
+  emit_line("switch (pc / %d | 0) {", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("case %d:", i);
+    emit_line(" func%d();", i);
+    emit_line(" break;");
+  }
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void init_state_js(Data* data) {
+  emit_line("var main = function(getchar, putchar) {");
+
+  for (int i = 0; i < 7; i++) {
+    emit_line("var %s = 0;", reg_names[i]);
+  }
+  emit_line("var mem = new Int32Array(1 << 24);");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("mem[%d] = %d;", mp, data->v);
+    }
+  }
+}
+
+static void js_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("var func%d = function() {", func_id);
+  inc_indent();
+  emit_line("while (%d <= pc && pc < %d && running) {",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("switch (pc) {");
+  emit_line("case -1:  // dummy");
+  inc_indent();
+}
+
+static void js_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("}");
+  emit_line("pc++;");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("};");
+}
+
+static void js_emit_pc_change(int pc) {
+  emit_line("break;");
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void js_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case SUB:
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s];", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("putchar(%s);", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("%s = getchar();",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("running = false; break;");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = (%s) | 0;",
+              reg_names[inst->dst.reg], cmp_str(inst, "true"));
+    break;
+
+  case MUL:
+    emit_line("%s = Math.imul(%s, %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case DIV:
+  case MOD: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s ? (%s %s %s) | 0 : %s;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == DIV ? "/" : "%", src,
+              inst->op == DIV ? "0" : reg_names[inst->dst.reg]);
+    break;
+  }
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s %s= %s;", reg_names[inst->dst.reg],
+              inst->op == AND ? "&" : inst->op == OR ? "|" : "^",
+              src_str(inst));
+    break;
+
+  case SHL:
+  case SHR: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s < 24 ? (%s %s %s) & " UINT_MAX_STR " : 0;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == SHL ? "<<" : ">>", src);
+    break;
+  }
+
+  case COPY:
+    emit_line("mem.copyWithin(%s, %s, %s + %s);",
+              reg_names[inst->dst.reg], src_str(inst),
+              src_str(inst), value_str(&inst->jmp));
+    break;
+
+  case FILL:
+    emit_line("mem.fill(%s, %s, %s + %s);",
+              src_str(inst), reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], value_str(&inst->jmp));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if (%s) pc = %s - 1;",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_js(Module* module) {
+  init_state_js(module->data);
+
+  emit_line("var running = true;");
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         js_emit_func_prologue,
+                                         js_emit_func_epilogue,
+                                         js_emit_pc_change,
+                                         js_emit_inst);
+
+  emit_line("");
+  emit_line("while (running) {");
+  inc_indent();
+  emit_line("switch (pc / %d | 0) {", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("case %d:", i);
+    emit_line(" func%d();", i);
+    emit_line(" break;");
+  }
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+
+  emit_line("};");
+
+  // For nodejs
+  emit_line("if (typeof require != 'undefined') {");
+  emit_line(" var sys = require('sys');");
+  emit_line(" var input = null;");
+  emit_line(" var ip = 0;");
+  emit_line(" var getchar = function() {");
+  emit_line("  if (input === null)");
+  emit_line("   input = require('fs').readFileSync('/dev/stdin');");
+  emit_line("  return input[ip++] | 0;");
+  emit_line(" };");
+  emit_line(" var putchar = function(c) {");
+  emit_line("  sys.print(String.fromCharCode(c & 255));");
+  emit_line(" };");
+  emit_line(" main(getchar, putchar);");
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+const char* lua_cmp_str(Inst* inst, const char* true_str) {
+  int op = normalize_cond(inst->op, 0);
+  const char* op_str;
+  switch (op) {
+    case JEQ:
+      op_str = "=="; break;
+    case JNE:
+      op_str = "~="; break;
+    case JLT:
+      op_str = "<"; break;
+    case JGT:
+      op_str = ">"; break;
+    case JLE:
+      op_str = "<="; break;
+    case JGE:
+      op_str = ">="; break;
+    case JMP:
+      return true_str;
+    default:
+      error("oops");
+  }
+  return format("%s %s %s", reg_names[inst->dst.reg], op_str, src_str(inst));
+}
+
+static void init_state_lua(Data* data) {
+  for (int i = 0; i < 7; i++) {
+    emit_line("%s = 0", reg_names[i]);
+  }
+  emit_line("mem = {}");
+  emit_line("for _ = 0, ((1 << 24) -1) do mem[_] = 0; end");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("mem[%d] = %d", mp, data->v);
+    }
+  }
+}
+
+static void lua_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("function func%d()", func_id);
+  inc_indent();
+  emit_line("");
+
+  emit_line("while %d <= pc and pc < %d do",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("if false then");
+  inc_indent();
+}
+
+static void lua_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("end");
+  emit_line("pc = pc + 1");
+  dec_indent();
+  emit_line("end");
+  dec_indent();
+  emit_line("end");
+}
+
+static void lua_emit_pc_change(int pc) {
+  emit_line("");
+  dec_indent();
+  emit_line("elseif pc == %d then", pc);
+  inc_indent();
+}
+
+static void lua_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s]", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("io.write(string.char(%s))", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("_ = io.read(1); %s = _ and string.byte(_) or 0",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("os.exit(0)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = ((%s) and 1 or 0)",
+              reg_names[inst->dst.reg], lua_cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if %s then pc = %s - 1; end",
+              lua_cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_lua(Module* module) {
+  init_state_lua(module->data);
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         lua_emit_func_prologue,
+                                         lua_emit_func_epilogue,
+                                         lua_emit_pc_change,
+                                         lua_emit_inst);
+
+  emit_line("");
+  emit_line("while true do");
+  inc_indent();
+  emit_line("if false then");
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("elseif pc < %d then func%d();", (i + 1) * CHUNKED_FUNC_SIZE, i);
+  }
+  emit_line("end");
+  dec_indent();
+  emit_line("end");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static int func_idx;
+static int case_idx;
+static int case_pc[512];
+static int case_label[512];
+static int putc_idx;
+
+static void ll_init_state(void) {
+  func_idx = 1;
+  case_idx = 0;
+  putc_idx = 0;
+  for (int i = 0; i < 7; i++) {
+    emit_line("@%s = common global i32 0, align 4", reg_names[i]);
+  }
+  emit_line("@mem = common global [16777216 x i32] zeroinitializer, align 16");
+}
+
+static void ll_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("define void @func%d() {", func_id);
+  inc_indent();
+
+  emit_line("br label %%1");
+
+  emit_line("");
+  emit_line("; <label>:1");
+  emit_line("%%2 = load i32, i32* @pc, align 4");
+  emit_line("%%3 = icmp ule i32 %d, %%2", func_id * CHUNKED_FUNC_SIZE);
+  emit_line("br i1 %%3, label %%4, label %%7");
+
+  emit_line("");
+  emit_line("; <label>:4");
+  emit_line("%%5 = load i32, i32* @pc, align 4");
+  emit_line("%%6 = icmp ult i32 %%5, %d", (func_id + 1) * CHUNKED_FUNC_SIZE);
+  emit_line("br label %%7");
+
+  emit_line("");
+  emit_line("; <label>:7");
+  emit_line("%%8 = phi i1 [ false, %%1 ], [ %%6, %%4 ]");
+  emit_line("br i1 %%8, label %%switch_top, label %%func_bottom");
+
+  emit_line("");
+  emit_line("; <label>:9");
+  /* set func_idx */
+  func_idx = 10;
+}
+
+static void ll_emit_func_epilogue(void) {
+  emit_line("br label %%case_bottom");
+  emit_line("");
+  emit_line("switch_top:");
+  emit_line("%%%d = load i32, i32* @pc, align 4", func_idx);
+  emit_line("switch i32 %%%d, label %%case_bottom [", func_idx);
+  inc_indent();
+  emit_line("i32 -1, label %%9");
+  for (int i=0; i<case_idx; i++) {
+    emit_line("i32 %d, label %%%d", case_pc[i], case_label[i]);
+  }
+  dec_indent();
+  emit_line("]");
+
+  emit_line("");
+  emit_line("case_bottom:");
+  emit_line("%%%d = load i32, i32* @pc, align 4", func_idx+1);
+  emit_line("%%%d = add i32 %%%d, 1", func_idx+2, func_idx+1);
+  emit_line("store i32 %%%d, i32* @pc, align 4", func_idx+2);
+  emit_line("br label %%1");
+
+  emit_line("");
+  emit_line("func_bottom:");
+  emit_line("ret void");
+  dec_indent();
+  emit_line("}");
+  /* reset func_idx */
+  func_idx = 1;
+  case_idx = 0;
+  putc_idx = 0;
+}
+
+static void ll_emit_pc_change(int pc) {
+  emit_line("br label %%case_bottom");
+
+  emit_line("");
+  emit_line("; <label>:%d", func_idx);
+  case_pc[case_idx] = pc;
+  case_label[case_idx] = func_idx;
+  case_idx += 1;
+  func_idx += 1;
+}
+
+const char* ll_cmp_str(Inst* inst) {
+  int op = normalize_cond(inst->op, 0);
+  switch (op) {
+    case JEQ:
+      return "eq";
+    case JNE:
+      return "ne";
+    case JLT:
+      return "ult";
+    case JGT:
+      return "ugt";
+    case JLE:
+      return "ule";
+    case JGE:
+      return "uge";
+    default:
+      error("oops");
+  }
+}
+
+static void ll_emit_cmp(Inst* inst) {
+  if (inst->src.type == REG) {
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
+    emit_line("%%%d = icmp %s i32 %%%d, %%%d",
+              func_idx+2, ll_cmp_str(inst), func_idx, func_idx+1);
+    func_idx += 3;
+  } else if (inst->src.type == IMM) {
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+    emit_line("%%%d = icmp %s i32 %%%d, %s",
+              func_idx+1, ll_cmp_str(inst), func_idx, src_str(inst));
+    func_idx += 2;
+  } else {
+    error("invalid value");
+  }
+}
+
+// Leaves the 24-bit result of an extended op in %(func_idx-1).
+static void ll_emit_ext_op(Inst* inst) {
+  int d = func_idx;
+  emit_line("%%%d = load i32, i32* @%s, align 4", d, reg_names[inst->dst.reg]);
+  func_idx += 1;
+  const char* s;
+  if (inst->src.type == REG) {
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
+    s = format("%%%d", func_idx);
+    func_idx += 1;
+  } else if (inst->src.type == IMM) {
+    s = src_str(inst);
+  } else {
+    error("invalid value");
+  }
+
+  switch (inst->op) {
+  case MUL:
+    emit_line("%%%d = mul i32 %%%d, %s", func_idx, d, s);
+    emit_line("%%%d = and i32 %%%d, 16777215", func_idx+1, func_idx);
+    func_idx += 2;
+    break;
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%%%d = %s i32 %%%d, %s", func_idx,
+              inst->op == AND ? "and" : inst->op == OR ? "or" : "xor", d, s);
+    func_idx += 1;
+    break;
+
+  case DIV:
+  case MOD:
+    // Division by zero gives 0 for div and leaves dst as is for mod.
+    emit_line("%%%d = icmp eq i32 %s, 0", func_idx, s);
+    emit_line("%%%d = select i1 %%%d, i32 1, i32 %s",
+              func_idx+1, func_idx, s);
+    emit_line("%%%d = %s i32 %%%d, %%%d", func_idx+2,
+              inst->op == DIV ? "udiv" : "urem", d, func_idx+1);
+    if (inst->op == DIV) {
+      emit_line("%%%d = select i1 %%%d, i32 0, i32 %%%d",
+                func_idx+3, func_idx, func_idx+2);
+    } else {
+      emit_line("%%%d = select i1 %%%d, i32 %%%d, i32 %%%d",
+                func_idx+3, func_idx, d, func_idx+2);
+    }
+    func_idx += 4;
+    break;
+
+  case SHL:
+  case SHR:
+    emit_line("%%%d = icmp ult i32 %s, 24", func_idx, s);
+    emit_line("%%%d = select i1 %%%d, i32 %s, i32 0",
+              func_idx+1, func_idx, s);
+    emit_line("%%%d = %s i32 %%%d, %%%d", func_idx+2,
+              inst->op == SHL ? "shl" : "lshr", d, func_idx+1);
+    emit_line("%%%d = and i32 %%%d, 16777215", func_idx+3, func_idx+2);
+    emit_line("%%%d = select i1 %%%d, i32 %%%d, i32 0",
+              func_idx+4, func_idx, func_idx+3);
+    func_idx += 5;
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+const char* ll_emit_load(Inst* inst) {
+  if (inst->src.type == REG) {
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
+    func_idx += 2;
+    return format("%d", func_idx);
+  } else if (inst->src.type == IMM) {
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+    func_idx += 1;
+    return format("@%s", reg_names[inst->dst.reg]);
+  } else {
+    error("invalid value");
+  }
+}
+
+static void ll_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    if (inst->src.type == REG) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
+      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      func_idx += 1;
+    } else if (inst->src.type == IMM) {
+      emit_line("store i32 %s, i32* @%s, align 4", src_str(inst), reg_names[inst->dst.reg]);
+    }
+    break;
+
+  case ADD:
+    if (inst->src.type == REG) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
+      emit_line("%%%d = add i32 %%%d, %%%d", func_idx+2, func_idx, func_idx+1);
+      func_idx += 3;
+    } else if (inst->src.type == IMM) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      emit_line("%%%d = add i32 %%%d, %s", func_idx+1, func_idx, src_str(inst));
+      func_idx += 2;
+    } else {
+      error("invalid value");
+    }
+    if (inst->no_wrap) {
+      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx-1, reg_names[inst->dst.reg]);
+      break;
+    }
+    emit_line("%%%d = and i32 %%%d, 16777215", func_idx, func_idx-1);
+    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+    func_idx += 1;
+    break;
+
+  case SUB:
+    if (inst->src.type == REG) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
+      emit_line("%%%d = sub i32 %%%d, %%%d", func_idx+2, func_idx, func_idx+1);
+      func_idx += 3;
+    } else if (inst->src.type == IMM) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      emit_line("%%%d = sub i32 %%%d, %s", func_idx+1, func_idx, src_str(inst));
+      func_idx += 2;
+    } else {
+      error("invalid value");
+    }
+    if (inst->no_wrap) {
+      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx-1, reg_names[inst->dst.reg]);
+      break;
+    }
+    emit_line("%%%d = and i32 %%%d, 16777215", func_idx, func_idx-1);
+    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+    func_idx += 1;
+    break;
+
+  case LOAD:
+    if (inst->src.type == REG) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
+      emit_line("%%%d = zext i32 %%%d to i64", func_idx+1, func_idx);
+      emit_line("%%%d = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %%%d", func_idx+2, func_idx+1);
+      emit_line("%%%d = load i32, i32* %%%d, align 4", func_idx+3, func_idx+2);
+      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx+3, reg_names[inst->dst.reg]);
+      func_idx += 4;
+    } else if (inst->src.type == IMM) {
+      emit_line("%%%d = load i32, i32* getelementptr inbounds ([16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %s)", func_idx, src_str(inst));
+      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      func_idx += 1;
+    } else {
+      error("invalid value");
+    }
+    break;
+
+  case STORE:
+    if (inst->src.type == REG) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, src_str(inst));
+      emit_line("%%%d = zext i32 %%%d to i64", func_idx+2, func_idx+1);
+      emit_line("%%%d = getelementptr inbounds [16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %%%d", func_idx+3, func_idx+2);
+      emit_line("store i32 %%%d, i32* %%%d, align 4", func_idx, func_idx+3);
+      func_idx += 4;
+    } else if (inst->src.type == IMM) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+      emit_line("store i32 %%%d, i32* getelementptr inbounds ([16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %s)", func_idx, src_str(inst));
+      func_idx += 1;
+    } else {
+      error("invalid value");
+    }
+    break;
+
+  case PUTC:
+    if (inst->src.type == REG) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
+      emit_line("%%%d = call i32 @putchar(i32 %%%d)", func_idx+1, func_idx);
+      func_idx += 2;
+    } else if (inst->src.type == IMM) {
+      emit_line("%%%d = call i32 @putchar(i32 %s)", func_idx, src_str(inst));
+      func_idx += 1;
+    } else {
+      error("invalid value");
+    }
+    break;
+
+  case GETC:
+    emit_line("%%_%d = alloca i32, align 4", putc_idx);
+    emit_line("%%%d = call i32 @getchar()", func_idx);
+    emit_line("store i32 %%%d, i32* %%_%d, align 4", func_idx, putc_idx);
+    emit_line("%%%d = load i32, i32* %%_%d, align 4", func_idx+1, putc_idx);
+    emit_line("%%%d = icmp ne i32 %%%d, -1", func_idx+2, func_idx+1);
+    emit_line("br i1 %%%d, label %%%d, label %%%d", func_idx+2, func_idx+3, func_idx+5);
+
+    emit_line("");
+    emit_line("; <label>:%%%d", func_idx+3);
+    emit_line("%%%d = load i32, i32* %%_%d, align 4", func_idx+4, putc_idx);
+    emit_line("br label %%%d", func_idx+6);
+
+    emit_line("");
+    emit_line("; <label>:%%%d", func_idx+5);
+    emit_line("br label %%%d", func_idx+6);
+
+    emit_line("");
+    emit_line("; <label>:%%%d", func_idx+6);
+    emit_line("%%%d = phi i32 [ %%%d, %%%d ], [0, %%%d]",
+                func_idx+7, func_idx+4, func_idx+3, func_idx+5);
+    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx+7, reg_names[inst->dst.reg]);
+    func_idx += 8;
+    putc_idx += 1;
+    break;
+
+  case EXIT:
+    emit_line("call void @exit(i32 0)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    ll_emit_cmp(inst);
+    emit_line("%%%d = zext i1 %%%d to i32", func_idx, func_idx-1);
+    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
+    func_idx += 1;
+    break;
+
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+  case SHL:
+  case SHR:
+    ll_emit_ext_op(inst);
+    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx-1, reg_names[inst->dst.reg]);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("; cmp jmp %s", ll_cmp_str(inst));
+    ll_emit_cmp(inst);
+    if (inst->jmp.type == REG) {
+      emit_line("br i1 %%%d, label %%%d, label %%%d",
+                func_idx-1, func_idx, func_idx+3);
+      emit_line("");
+      emit_line("; <label>:%%%d", func_idx);
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx+1, value_str(&inst->jmp));
+      emit_line("%%%d = sub i32 %%%d, 1", func_idx+2, func_idx+1);
+      emit_line("store i32 %d, i32* @pc, align 4", func_idx+2);
+      func_idx += 3;
+    } else if (inst->jmp.type == IMM) {
+      emit_line("br i1 %%%d, label %%%d, label %%%d",
+                func_idx-1, func_idx, func_idx+1);
+      emit_line("");
+      emit_line("; <label>:%%%d", func_idx);
+      emit_line("store i32 %d, i32* @pc, align 4", inst->jmp.imm-1);
+      func_idx += 1;
+    } else {
+      error("invalid value");
+    }
+    emit_line("br label %%%d", func_idx);
+    emit_line("");
+    emit_line("; <label>:%%%d", func_idx);
+    func_idx += 1;
+    break;
+
+  case JMP:
+    emit_line("; jmp");
+    if (inst->jmp.type == REG) {
+      emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, value_str(&inst->jmp));
+      emit_line("%%%d = sub i32 %%%d, 1", func_idx+1, func_idx);
+      emit_line("store i32 %%%d, i32* @pc, align 4", func_idx+1);
+      func_idx += 2;
+    } else if (inst->jmp.type == IMM) {
+      emit_line("store i32 %d, i32* @pc, align 4", inst->jmp.imm-1);
+    }
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_ll(Module* module) {
+  ll_init_state();
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         ll_emit_func_prologue,
+                                         ll_emit_func_epilogue,
+                                         ll_emit_pc_change,
+                                         ll_emit_inst);
+
+  emit_line("");
+  emit_line("declare i32 @getchar()");
+  emit_line("declare i32 @putchar(i32)");
+  emit_line("declare void @exit(i32)");
+
+  emit_line("");
+  emit_line("define i32 @main() {");
+  inc_indent();
+
+  emit_line("%%1 = alloca i32, align 4");
+  emit_line("store i32 0, i32* %%1");
+  Data* data = module->data;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("store i32 %d, i32* getelementptr inbounds ([16777216 x i32], [16777216 x i32]* @mem, i32 0, i64 %d), align 4", data->v, mp);
+    }
+  }
+  emit_line("br label %%2");
+
+  emit_line("");
+  emit_line("; <label>:2");
+  emit_line("%%3 = load i32, i32* @pc, align 4");
+  emit_line("%%4 = udiv i32 %%3, %d", CHUNKED_FUNC_SIZE);
+
+  int label_offset = 5;
+  int while_bottom = label_offset + num_funcs;
+
+  emit_line("switch i32 %%4, label %%%d [", while_bottom);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("i32 %d, label %%%d", i, label_offset+i);
+  }
+  emit_line("]");
+
+  emit_line("");
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("; <label>:%d", label_offset+i);
+    inc_indent();
+    emit_line("call void @func%d()", i);
+    emit_line("br label %%%d", while_bottom);
+    dec_indent();
+  }
+
+  emit_line("");
+  emit_line("; <label>:%d", while_bottom);
+  emit_line("br label %%2");
+
+  emit_line("");
+  emit_line("%%%d = load i32, i32* %%1, align 4", while_bottom+2);
+  emit_line("ret i32 %%%d", while_bottom+2);
+  dec_indent();
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char* PHP_REG_NAMES[] = {
+  "$a", "$b", "$c", "$d", "$bp", "$sp", "$pc"
+};
+
+static void init_state_php(Data* data) {
+  reg_names = PHP_REG_NAMES;
+  emit_line("<?php");
+
+  emit_line("call_user_func(function(){");
+  inc_indent();
+  for (int i = 0; i < 7; i++) {
+    emit_line("%s = 0;", reg_names[i]);
+  }
+  emit_line("$running = true;");
+  emit_line("$mem = array();");
+  /* Array initialization wastes a lot of memory */
+  emit_line("ini_set(\"memory_limit\", \"768M\");");
+  emit_line("// for ($_ = 0; $_ < (1 << 24); $_++) $mem[$_] = null; unset($_);");
+
+  emit_line("$stdin = fopen('php://stdin', 'r');");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("$mem[%d] = %d;", mp, data->v);
+    }
+  }
+  emit_line("goto main;");
+}
+
+static void php_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("proc%d:", func_id);
+  inc_indent();
+  emit_line("while (%d <= $pc && $pc < %d && $running) {",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("switch ($pc) {");
+  emit_line("case -1:  // dummy");
+  inc_indent();
+}
+
+static void php_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("}");
+  emit_line("$pc++;");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("goto main;");
+}
+
+static void php_emit_pc_change(int pc) {
+  emit_line("break;");
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void php_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg],
+              src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg],
+              src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = @$mem[%s] ?: 0; // @undefined index as 0",
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("$mem[%s] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("printf(\"%%c\", %s);", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("%s = ord(fgetc($stdin));",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("$running = false; break;");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = (%s) | 0;",
+              reg_names[inst->dst.reg], cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if (%s) $pc = %s - 1;",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_php(Module* module) {
+  init_state_php(module->data);
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         php_emit_func_prologue,
+                                         php_emit_func_epilogue,
+                                         php_emit_pc_change,
+                                         php_emit_inst);
+
+  emit_line("");
+  emit_line("main:");
+  emit_line("while ($running) {");
+  inc_indent();
+  emit_line("switch ($pc / %d | 0) {", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("case %d:", i);
+    emit_line(" goto proc%d;", i);
+    emit_line(" break;");
+  }
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("});");
+}
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <ir/ir.h>
+#include <target/util.h>
+
+#define PIET_IMM_BASE 6
+#define PIET_INIT_STACK_SIZE 65545
+#define PIET_DUMP_INST 0
+
+enum {
+  PIET_PUSH,
+  PIET_POP,
+  PIET_ADD,
+  PIET_SUB,
+  PIET_MUL,
+  PIET_DIV,
+  PIET_MOD,
+  PIET_NOT,
+  PIET_GT,
+  PIET_PTR,
+  PIET_SWITCH,
+  PIET_DUP,
+  PIET_ROLL,
+  PIET_INN,
+  PIET_IN,
+  PIET_OUTN,
+  PIET_OUT,
+
+  PIET_JMP,
+  PIET_EXIT
+} PietOp;
+
+byte PIET_COLOR_TABLE[20][3] = {
+  { 0x00, 0x00, 0x00 },
+  { 0xff, 0xff, 0xff },
+
+  { 0xff, 0xc0, 0xc0 },
+  { 0xff, 0x00, 0x00 },
+  { 0xc0, 0x00, 0x00 },
+
+  { 0xff, 0xff, 0xc0 },
+  { 0xff, 0xff, 0x00 },
+  { 0xc0, 0xc0, 0x00 },
+
+  { 0xc0, 0xff, 0xc0 },
+  { 0x00, 0xff, 0x00 },
+  { 0x00, 0xc0, 0x00 },
+
+  { 0xc0, 0xff, 0xff },
+  { 0x00, 0xff, 0xff },
+  { 0x00, 0xc0, 0xc0 },
+
+  { 0xc0, 0xc0, 0xff },
+  { 0x00, 0x00, 0xff },
+  { 0x00, 0x00, 0xc0 },
+
+  { 0xff, 0xc0, 0xff },
+  { 0xff, 0x00, 0xff },
+  { 0xc0, 0x00, 0xc0 },
+};
+
+typedef struct PietInst {
+  uint op;
+  uint arg;
+  struct PietInst* next;
+} PietInst;
+
+typedef struct PietBlock {
+  PietInst* inst;
+  struct PietBlock* next;
+} PietBlock;
+
+#if PIET_DUMP_INST
+static void dump_piet_inst(PietInst* pi) {
+  static const char* PIET_INST_NAMES[] = {
+    "push",
+    "pop",
+    "add",
+    "sub",
+    "mul",
+    "div",
+    "mod",
+    "not",
+    "gt",
+    "ptr",
+    "switch",
+    "dup",
+    "roll",
+    "inn",
+    "in",
+    "outn",
+    "out",
+
+    "jmp",
+    "exit",
+  };
+  fprintf(stderr, "%s", PIET_INST_NAMES[pi->op]);
+  if (pi->op == PIET_PUSH) {
+    fprintf(stderr, " %d", pi->arg);
+  }
+  fprintf(stderr, "\n");
+}
+#endif
+
+static void piet_emit_a(PietInst** pi, uint op, uint arg) {
+  (*pi)->next = calloc(1, sizeof(PietInst));
+  *pi = (*pi)->next;
+  (*pi)->op = op;
+  (*pi)->arg = arg;
+}
+
+static void piet_emit(PietInst** pi, uint op) {
+  piet_emit_a(pi, op, 0);
+}
+
+static void piet_push_digit(PietInst** pi, uint v) {
+  assert(v > 0);
+  piet_emit_a(pi, PIET_PUSH, v);
+}
+
+static void piet_push(PietInst** pi, uint v) {
+  if (v == 0) {
+    piet_push_digit(pi, 1);
+    piet_emit(pi, PIET_NOT);
+    return;
+  }
+
+  uint c[16];
+  uint cs = 0;
+  do {
+    c[cs++] = v % PIET_IMM_BASE;
+    v /= PIET_IMM_BASE;
+  } while (v);
+
+  for (uint i = 0; i < cs; i++) {
+    if (i != 0) {
+      piet_push_digit(pi, PIET_IMM_BASE);
+      piet_emit(pi, PIET_MUL);
+    }
+    char v = c[cs - i - 1];
+    if (v) {
+      piet_push_digit(pi, v);
+      if (i != 0)
+        piet_emit(pi, PIET_ADD);
+    }
+  }
+}
+
+static void piet_push_minus1(PietInst** pi) {
+  piet_push(pi, 0);
+  piet_push(pi, 1);
+  piet_emit(pi, PIET_SUB);
+}
+
+enum {
+  PIET_A = 1,
+  PIET_B,
+  PIET_C,
+  PIET_D,
+  PIET_BP,
+  PIET_SP,
+  PIET_MEM
+};
+
+static void piet_roll(PietInst** pi, uint depth, uint count) {
+  piet_push(pi, depth);
+  piet_push(pi, count);
+  piet_emit(pi, PIET_ROLL);
+}
+
+static void piet_rroll(PietInst** pi, uint depth, uint count) {
+  piet_push(pi, depth);
+  piet_push(pi, 1);
+  piet_push(pi, count + 1);
+  piet_emit(pi, PIET_SUB);
+  piet_emit(pi, PIET_ROLL);
+}
+
+static void piet_load(PietInst** pi, uint pos) {
+  piet_rroll(pi, pos + 1, 1);
+  piet_emit(pi, PIET_DUP);
+  piet_roll(pi, pos + 2, 1);
+}
+
+static void piet_store_top(PietInst** pi, uint pos) {
+  piet_rroll(pi, pos + 2, 1);
+  piet_emit(pi, PIET_POP);
+  piet_roll(pi, pos + 1, 1);
+}
+
+static void piet_push_value(PietInst** pi, Value* v, uint stk) {
+  if (v->type == REG) {
+    piet_load(pi, PIET_A + v->reg + stk);
+  } else if (v->type == IMM) {
+    piet_push(pi, v->imm % 65536);
+  } else {
+    error("invalid value");
+  }
+}
+
+static void piet_push_dst(PietInst** pi, Inst* inst, uint stk) {
+  piet_push_value(pi, &inst->dst, stk);
+}
+
+static void piet_push_src(PietInst** pi, Inst* inst, uint stk) {
+  piet_push_value(pi, &inst->src, stk);
+}
+
+static void piet_uint_mod(PietInst** pi) {
+  //emit_line("16777216 mod");
+  piet_push(pi, 65536);
+  piet_emit(pi, PIET_MOD);
+}
+
+static void piet_cmp(PietInst** pi, Inst* inst, int stk) {
+  Op op = normalize_cond(inst->op, false);
+  if (op == JLT) {
+    op = JGT;
+    piet_push_src(pi, inst, stk);
+    piet_push_dst(pi, inst, stk + 1);
+  } else if (op == JGE) {
+    op = JLE;
+    piet_push_src(pi, inst, stk);
+    piet_push_dst(pi, inst, stk + 1);
+  } else {
+    piet_push_dst(pi, inst, stk);
+    piet_push_src(pi, inst, stk + 1);
+  }
+  switch (op) {
+  case JEQ:
+    piet_emit(pi, PIET_SUB);
+    piet_emit(pi, PIET_NOT);
+    break;
+  case JNE:
+    piet_emit(pi, PIET_SUB);
+    piet_emit(pi, PIET_NOT);
+    piet_emit(pi, PIET_NOT);
+    break;
+  case JGT:
+    piet_emit(pi, PIET_GT);
+    break;
+  case JLE:
+    piet_emit(pi, PIET_GT);
+    piet_emit(pi, PIET_NOT);
+    break;
+  default:
+    error("cmp");
+  }
+}
+
+static void piet_emit_inst(PietInst** pi, Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    piet_push_src(pi, inst, 0);
+    piet_store_top(pi, PIET_A + inst->dst.reg);
+    break;
+
+  case ADD:
+    piet_push_dst(pi, inst, 0);
+    piet_push_src(pi, inst, 1);
+    piet_emit(pi, PIET_ADD);
+    piet_uint_mod(pi);
+    piet_store_top(pi, PIET_A + inst->dst.reg);
+    break;
+
+  case SUB:
+    piet_push_dst(pi, inst, 0);
+    piet_push_src(pi, inst, 1);
+    piet_emit(pi, PIET_SUB);
+    piet_push(pi, 65536);
+    piet_emit(pi, PIET_ADD);
+    piet_uint_mod(pi);
+    piet_store_top(pi, PIET_A + inst->dst.reg);
+    break;
+
+  case LOAD:
+    piet_push_src(pi, inst, 0);
+    piet_emit(pi, PIET_DUP);
+    // Put the address to the bottom of the stack.
+    piet_push(pi, PIET_INIT_STACK_SIZE);
+    piet_push(pi, 1);
+    piet_emit(pi, PIET_ROLL);
+
+    piet_push(pi, PIET_MEM + 1);
+    piet_emit(pi, PIET_ADD);
+    piet_push_minus1(pi);
+    piet_emit(pi, PIET_ROLL);
+    piet_emit(pi, PIET_DUP);
+
+    // Get the address from the bottom of the stack.
+    piet_push(pi, PIET_INIT_STACK_SIZE);
+    piet_push_minus1(pi);
+    piet_emit(pi, PIET_ROLL);
+
+    piet_push(pi, PIET_MEM + 2);
+    piet_emit(pi, PIET_ADD);
+    piet_push(pi, 1);
+    piet_emit(pi, PIET_ROLL);
+
+    piet_store_top(pi, PIET_A + inst->dst.reg);
+    break;
+
+  case STORE:
+    piet_push_dst(pi, inst, 0);
+    piet_push_src(pi, inst, 1);
+    piet_emit(pi, PIET_DUP);
+
+    piet_push(pi, PIET_MEM + 3);
+    piet_emit(pi, PIET_ADD);
+    piet_push_minus1(pi);
+    piet_emit(pi, PIET_ROLL);
+    piet_emit(pi, PIET_POP);
+
+    piet_push(pi, PIET_MEM + 1);
+    piet_emit(pi, PIET_ADD);
+    piet_push(pi, 1);
+    piet_emit(pi, PIET_ROLL);
+    break;
+
+  case PUTC:
+    piet_push_src(pi, inst, 0);
+    piet_emit(pi, PIET_OUT);
+    break;
+
+  case GETC: {
+    // TODO: Handle EOF
+#if 0
+    piet_push(pi, 256);
+#endif
+    piet_emit(pi, PIET_IN);
+#if 0
+    piet_emit(pi, PIET_DUP);
+    piet_push(pi, 256);
+    piet_emit(pi, PIET_SUB);
+
+    uint zero_id = piet_gen_label();
+    uint done_id = piet_gen_label();
+
+    piet_bz(zero_id);
+    piet_roll(pi, 2, 1);
+    piet_emit(pi, PIET_POP);
+    piet_br(done_id);
+
+    piet_label(zero_id);
+    piet_emit(pi, PIET_POP);
+    piet_push(pi, 0);
+
+    piet_label(done_id);
+#endif
+    piet_store_top(pi, PIET_A + inst->dst.reg);
+
+    break;
+  }
+
+  case EXIT:
+    piet_emit(pi, PIET_EXIT);
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    piet_cmp(pi, inst, 0);
+    piet_store_top(pi, PIET_A + inst->dst.reg);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    piet_push(pi, inst->pc + 1);
+    piet_push_value(pi, &inst->jmp, 1);
+    piet_push(pi, 2);
+    piet_cmp(pi, inst, 3);
+    piet_emit(pi, PIET_ROLL);
+    piet_emit(pi, PIET_POP);
+    piet_emit(pi, PIET_JMP);
+    break;
+
+  case JMP:
+    piet_push_value(pi, &inst->jmp, 0);
+    piet_emit(pi, PIET_JMP);
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static uint piet_next_color(uint c, uint op) {
+  op++;
+  uint l = (c + op) % 3;
+  uint h = (c / 3 + op / 3) % 6;
+  return l + h * 3;
+}
+
+static uint piet_init_state(Data* data, PietInst* pi) {
+  uint vals[PIET_INIT_STACK_SIZE];
+  for (uint i = 0; i < PIET_INIT_STACK_SIZE; i++) {
+    uint v = 0;
+    if (i >= PIET_MEM + 1 && data) {
+      v = data->v % 65536;
+      data = data->next;
+    }
+    vals[PIET_INIT_STACK_SIZE-i-1] = v;
+  }
+
+  PietInst* opi = pi;
+  bool prev_zero = false;
+  for (uint i = 0; i < PIET_INIT_STACK_SIZE; i++) {
+    uint v = vals[i];
+    if (v == 0 && prev_zero) {
+      piet_emit(&pi, PIET_DUP);
+    } else {
+      piet_push(&pi, v);
+    }
+    prev_zero = v == 0;
+  }
+
+  uint size = 0;
+  for (pi = opi->next; pi; pi = pi->next) {
+    if (pi->op == PIET_PUSH) {
+      size += pi->arg;
+    } else {
+      size++;
+    }
+  }
+  return size;
+}
+
+
+void target_piet(Module* module) {
+  PietBlock pb_head;
+  PietBlock* pb = &pb_head;
+  PietInst* pi = 0;
+
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      if (pi && pi->op != PIET_JMP) {
+        piet_push(&pi, inst->pc);
+      }
+
+      pb->next = calloc(1, sizeof(PietBlock));
+      pb = pb->next;
+
+      pi = calloc(1, sizeof(PietInst));
+      pb->inst = pi;
+
+      piet_emit(&pi, PIET_POP);
+
+      // Dump PC.
+#if 0
+      piet_push(&pi, 80); piet_emit(&pi, PIET_OUT);
+      piet_push(&pi, 67); piet_emit(&pi, PIET_OUT);
+      piet_push(&pi, 61); piet_emit(&pi, PIET_OUT);
+      piet_push(&pi, inst->pc); piet_emit(&pi, PIET_OUTN);
+      piet_push(&pi, 10); piet_emit(&pi, PIET_OUT);
+#endif
+    }
+    prev_pc = inst->pc;
+    piet_emit_inst(&pi, inst);
+  }
+
+  int pc = 0;
+  int longest_block = 0;
+  for (pb = pb_head.next; pb; pb = pb->next) {
+    pc++;
+    int block_len = 0;
+    for (pi = pb->inst->next; pi; pi = pi->next) {
+      block_len++;
+    }
+    if (longest_block < block_len)
+      longest_block = block_len;
+  }
+
+#if PIET_DUMP_INST
+  pc = 0;
+  for (pb = pb_head.next; pb; pb = pb->next) {
+    fprintf(stderr, "\npc=%d:\n", pc++);
+    for (pi = pb->inst->next; pi; pi = pi->next) {
+      fprintf(stderr, " ");
+      dump_piet_inst(pi);
+    }
+  }
+#endif
+
+  PietInst init_state = {};
+  uint init_state_size = piet_init_state(module->data, &init_state);
+
+  uint w = longest_block + 20;
+  uint h =
+      pc * 7 + (init_state_size / (w - 4 - PIET_IMM_BASE * 2) + 1) * 4 + 10;
+  byte* pixels = calloc(w * h, 1);
+
+#if 0
+  fprintf(stderr, "estimated init_state_size=%d w=%d h=%d\n",
+          init_state_size, w, h);
+#endif
+
+  uint c = 0;
+  uint y = 0;
+  uint x = 0;
+  int dx = 1;
+  pixels[y*w+x++] = 2;
+  for (pi = init_state.next; pi; pi = pi->next) {
+    assert(y < h);
+    c = piet_next_color(c, pi->op);
+
+    if (pi->next && pi->next->op == PIET_PUSH) {
+      for (uint i = 0; i < pi->next->arg; i++) {
+        pixels[y*w+x] = c + 2;
+        x += dx;
+      }
+    } else {
+      pixels[y*w+x] = c + 2;
+      x += dx;
+    }
+
+    if (x >= w - PIET_IMM_BASE && dx == 1) {
+      pixels[(y+1)*w+x-1] = c + 2;
+      pixels[(y+2)*w+x-1] = c + 2;
+      pixels[(y+3)*w+x-1] = c + 2;
+      x = x-1;
+      y += 4;
+      dx = -1;
+    }
+
+    if ((x <= 1 + PIET_IMM_BASE || !pi->next) && dx == -1) {
+      while (x >= w - 2) {
+        pixels[(y+0)*w+x+0] = 1;
+        x--;
+      }
+      pixels[(y+0)*w+x+0] = 1;
+      pixels[(y+0)*w+x-1] = 1;
+      pixels[(y-1)*w+x-1] = 1;
+      pixels[(y-1)*w+x+0] = 1;
+      pixels[(y+1)*w+x+0] = 1;
+      pixels[(y+2)*w+x+0] = 1;
+      pixels[(y+3)*w+x+0] = 1;
+      pixels[(y+3)*w+x-1] = 1;
+      pixels[(y+2)*w+x-1] = 1;
+      pixels[(y+2)*w+x+1] = 2;
+      c = 0;
+      x += 2;
+      y += 2;
+      dx = 1;
+    }
+  }
+
+  for (; x < w; x++) {
+    pixels[y*w+x] = 1;
+  }
+
+  pixels[(y+1)*w+w-1] = 1;
+  pixels[(y+2)*w+w-1] = 1;
+
+  y += 3;
+
+  c = 0;
+  byte BORDER_TABLE[7];
+  BORDER_TABLE[0] = 1;
+  BORDER_TABLE[1] = 2;
+  c = piet_next_color(c, PIET_PUSH);
+  BORDER_TABLE[2] = c + 2;
+  c = piet_next_color(c, PIET_SUB);
+  BORDER_TABLE[3] = c + 2;
+  c = piet_next_color(c, PIET_DUP);
+  BORDER_TABLE[4] = c + 2;
+  c = piet_next_color(c, PIET_NOT);
+  BORDER_TABLE[5] = c + 2;
+  c = piet_next_color(c, PIET_PTR);
+  BORDER_TABLE[6] = c + 2;
+
+  for (uint i = 0; i < 3; i++) {
+    pixels[(y+i)*w+w-1] = 1;
+  }
+
+  for (uint x = 0; x < w; x++) {
+    pixels[(y+3)*w+x] = 1;
+  }
+
+  for (uint i = 3; i < h - y; i++) {
+    pixels[(y+i)*w] = 1;
+    pixels[(y+i)*w+w-1] = BORDER_TABLE[i%7];
+  }
+
+  y += 6;
+
+  for (pb = pb_head.next; pb; pb = pb->next, y += 7) {
+    assert(y < h);
+    pixels[y*w+w-2] = 1;
+    pixels[y*w+w-3] = 2;
+    uint x = w - 3;
+    c = 0;
+    bool goto_next = true;
+    for (pi = pb->inst->next; pi; pi = pi->next, x--) {
+      assert(x < w);
+      if (pi->op == PIET_PUSH) {
+        assert(pi->arg);
+        for (uint i = 0; i < pi->arg; i++) {
+          pixels[(y+i)*w+x] = c + 2;
+        }
+      } else if (pi->op == PIET_JMP) {
+        break;
+      } else if (pi->op == PIET_EXIT) {
+        pixels[(y+1)*w+x] = pixels[(y+0)*w+x];
+        pixels[(y+1)*w+x-1] = 1;
+        pixels[(y+0)*w+x-2] = 3;
+        pixels[(y+1)*w+x-2] = 3;
+        pixels[(y+2)*w+x-2] = 3;
+        goto_next = false;
+        break;
+      }
+
+      if (!goto_next)
+        break;
+
+      c = piet_next_color(c, pi->op);
+      pixels[y*w+x-1] = c + 2;
+    }
+
+    if (goto_next) {
+      for (x--; x > 0; x--) {
+        pixels[y*w+x] = 1;
+      }
+    }
+  }
+
+  h = y + 10;
+
+  printf("P6\n");
+  printf("#\n");
+  printf("%d %d\n", w, h);
+  printf("255\n");
+
+  for (uint y = 0; y < h; y++) {
+    for (uint x = 0; x < w; x++) {
+      byte* c = PIET_COLOR_TABLE[pixels[y*w+x]];
+      putchar(c[0]);
+      putchar(c[1]);
+      putchar(c[2]);
+    }
+  }
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+enum {
+  PIETASM_A = 1,
+  PIETASM_B,
+  PIETASM_C,
+  PIETASM_D,
+  PIETASM_BP,
+  PIETASM_SP,
+  PIETASM_MEM
+};
+
+static uint g_pietasm_label_id;
+static uint pietasm_gen_label() {
+  return ++g_pietasm_label_id;
+}
+
+static void pietasm_label(uint id) {
+  emit_line("_track_%u:", id);
+}
+
+static void pietasm_push(int v) {
+  emit_line("%d", v);
+}
+
+static void pietasm_pop() {
+  emit_line("pop");
+}
+
+static void pietasm_dup() {
+  emit_line("dup");
+}
+
+static void pietasm_br(uint id) {
+  emit_line("br._track_%u", id);
+}
+
+static void pietasm_bz(uint id) {
+  emit_line("bz._track_%u", id);
+}
+
+static void pietasm_roll(uint depth, uint count) {
+  emit_line("%d %d roll", depth, count);
+}
+
+static void pietasm_rroll(uint depth, uint count) {
+  emit_line("%d -%d roll", depth, count);
+}
+
+static void pietasm_load(uint pos) {
+  pietasm_rroll(pos + 1, 1);
+  pietasm_dup();
+  pietasm_roll(pos + 2, 1);
+}
+
+static void pietasm_store_top(uint pos) {
+  pietasm_rroll(pos + 2, 1);
+  pietasm_pop();
+  pietasm_roll(pos + 1, 1);
+}
+
+static void pietasm_store(uint pos, uint val) {
+  pietasm_push(val);
+  pietasm_store_top(pos);
+}
+
+static void pietasm_init_state(Data* data) {
+  //emit_line("16777223");
+  emit_line("65543");  // 65536 + 7
+  uint loop_id = pietasm_gen_label();
+  uint done_id = pietasm_gen_label();
+  pietasm_label(loop_id);
+  emit_line("1 sub");
+  emit_line("dup");
+  pietasm_bz(done_id);
+  emit_line("0");
+  pietasm_roll(2, 1);
+  pietasm_br(loop_id);
+  pietasm_label(done_id);
+  emit_line("");
+
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      pietasm_store(PIETASM_MEM + mp, data->v % 65536);
+    }
+  }
+}
+
+static void pietasm_push_value(Value* v, uint stk) {
+  if (v->type == REG) {
+    pietasm_load(PIETASM_A + v->reg + stk);
+  } else if (v->type == IMM) {
+    pietasm_push(v->imm % 65536);
+  } else {
+    error("invalid value");
+  }
+}
+
+static void pietasm_push_dst(Inst* inst, uint stk) {
+  pietasm_push_value(&inst->dst, stk);
+}
+
+static void pietasm_push_src(Inst* inst, uint stk) {
+  pietasm_push_value(&inst->src, stk);
+}
+
+static void pietasm_uint_mod() {
+  //emit_line("16777216 mod");
+  emit_line("65536 mod");
+}
+
+static void pietasm_cmp(Inst* inst, bool is_jmp) {
+  Op op = normalize_cond(inst->op, is_jmp);
+  if (op == JLT) {
+    op = JGT;
+    pietasm_push_src(inst, 0);
+    pietasm_push_dst(inst, 1);
+  } else if (op == JGE) {
+    op = JLE;
+    pietasm_push_src(inst, 0);
+    pietasm_push_dst(inst, 1);
+  } else {
+    pietasm_push_dst(inst, 0);
+    pietasm_push_src(inst, 1);
+  }
+  switch (op) {
+  case JEQ:
+    emit_line("sub");
+    emit_line("not");
+    break;
+  case JNE:
+    emit_line("sub");
+    if (!is_jmp) {
+      emit_line("not");
+      emit_line("not");
+    }
+    break;
+  case JGT:
+    emit_line("gt");
+    break;
+  case JLE:
+    emit_line("gt");
+    emit_line("not");
+    break;
+  default:
+    error("cmp");
+  }
+}
+
+static void pietasm_reg_jmp_table(int min_pc, int max_pc, int last_label) {
+  if (min_pc + 1 == max_pc) {
+    pietasm_pop();
+    pietasm_br(min_pc);
+    return;
+  }
+
+  int mid_pc = (min_pc + max_pc) / 2;
+  pietasm_dup();
+  pietasm_push(mid_pc-1);
+  emit_line("gt");
+  pietasm_bz(last_label + mid_pc);
+  pietasm_reg_jmp_table(mid_pc, max_pc, last_label);
+  pietasm_label(last_label + mid_pc);
+  pietasm_reg_jmp_table(min_pc, mid_pc, last_label);
+}
+
+static void pietasm_emit_inst(Inst* inst, int reg_jmp) {
+  emit_line("");
+  switch (inst->op) {
+  case MOV:
+    pietasm_push_src(inst, 0);
+    pietasm_store_top(PIETASM_A + inst->dst.reg);
+    break;
+
+  case ADD:
+    pietasm_push_dst(inst, 0);
+    pietasm_push_src(inst, 1);
+    emit_line("add");
+    pietasm_uint_mod();
+    pietasm_store_top(PIETASM_A + inst->dst.reg);
+    break;
+
+  case SUB:
+    pietasm_push_dst(inst, 0);
+    pietasm_push_src(inst, 1);
+    emit_line("sub");
+    pietasm_uint_mod();
+    pietasm_store_top(PIETASM_A + inst->dst.reg);
+    break;
+
+  case LOAD:
+    pietasm_push_src(inst, 0);
+    pietasm_dup();
+    // Put the address to the bottom of the stack.
+    emit_line("65544 1 roll");
+
+    pietasm_push(PIETASM_MEM + 1);
+    emit_line("add");
+    emit_line("-1 roll");
+    pietasm_dup();
+
+    // Get the address from the bottom of the stack.
+    emit_line("65544 -1 roll");
+    pietasm_push(PIETASM_MEM + 2);
+    emit_line("add");
+    emit_line("1 roll");
+
+    pietasm_store_top(PIETASM_A + inst->dst.reg);
+    break;
+
+  case STORE:
+    pietasm_push_dst(inst, 0);
+    pietasm_push_src(inst, 1);
+    pietasm_dup();
+
+    pietasm_push(PIETASM_MEM + 3);
+    emit_line("add");
+    emit_line("-1 roll");
+    pietasm_pop();
+
+    pietasm_push(PIETASM_MEM + 1);
+    emit_line("add");
+    emit_line("1 roll");
+    break;
+
+  case PUTC:
+    pietasm_push_src(inst, 0);
+    emit_line("out");
+    break;
+
+  case GETC: {
+    pietasm_push(256);
+    emit_line("in");
+    pietasm_dup();
+    pietasm_push(256);
+    emit_line("sub");
+
+    uint zero_id = pietasm_gen_label();
+    uint done_id = pietasm_gen_label();
+
+    pietasm_bz(zero_id);
+    pietasm_roll(2, 1);
+    pietasm_pop();
+    pietasm_br(done_id);
+
+    pietasm_label(zero_id);
+    pietasm_pop();
+    pietasm_push(0);
+
+    pietasm_label(done_id);
+    pietasm_store_top(PIETASM_A + inst->dst.reg);
+
+    break;
+  }
+
+  case EXIT:
+    emit_line("halt");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    pietasm_cmp(inst, false);
+    pietasm_store_top(PIETASM_A + inst->dst.reg);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    pietasm_cmp(inst, true);
+    if (inst->jmp.type == REG) {
+      error("jcc reg");
+    } else {
+      pietasm_bz(inst->jmp.imm);
+    }
+    break;
+
+  case JMP:
+    if (inst->jmp.type == REG) {
+      pietasm_push_value(&inst->jmp, 0);
+      pietasm_br(reg_jmp);
+    } else {
+      pietasm_br(inst->jmp.imm);
+    }
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_pietasm(Module* module) {
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    g_pietasm_label_id = inst->pc;
+  }
+
+  int reg_jmp = pietasm_gen_label();
+  pietasm_init_state(module->data);
+
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      pietasm_label(inst->pc);
+    }
+    prev_pc = inst->pc;
+
+    pietasm_emit_inst(inst, reg_jmp);
+  }
+
+  pietasm_label(reg_jmp);
+  pietasm_reg_jmp_table(0, reg_jmp, pietasm_gen_label());
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char* PL_REG_NAMES[] = {
+  "$a", "$b", "$c", "$d", "$bp", "$sp", "$pc"
+};
+
+static void init_state_pl(Data* data) {
+  emit_line("#!/usr/bin/env perl");
+  emit_line("use 5.008;");
+  emit_line("use strict;");
+  emit_line("use warnings;");
+  emit_line("use utf8;");
+  emit_line("$| = 1;");
+  emit_line("");
+  reg_names = PL_REG_NAMES;
+  for (int i = 0; i < 7; i++) {
+    emit_line("my %s = 0;", reg_names[i]);
+  }
+  emit_line("my @mem = (");
+  inc_indent();
+  for (int mp = 0; data; data = data->next, mp++) {
+    emit_line("%d,", data->v);
+  }
+  dec_indent();
+  emit_line(");");
+}
+
+static void pl_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = $mem[%s]||0;", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("$mem[%s] = %s;", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("print chr(%s);", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("$c = getc(); %s = defined $c ? ord($c) : 0;",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("exit;");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s ? 1 : 0;",
+              reg_names[inst->dst.reg], cmp_str(inst, "1"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("$pc = %s - 1 if %s;",
+              value_str(&inst->jmp), cmp_str(inst, "1"));
+    break;
+  case JMP:
+    emit_line("$pc = %s - 1;",
+              value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_pl(Module* module) {
+  init_state_pl(module->data);
+  emit_line("");
+
+  emit_line("");
+  emit_line("my @codes; @codes = (");
+  inc_indent();
+
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      if (prev_pc != -1) {
+        emit_line("goto $codes[++$pc];");
+        dec_indent();
+        emit_line("},");
+      }
+      emit_line("sub {");
+      inc_indent();
+      prev_pc = inst->pc;
+    }
+    pl_emit_inst(inst);
+  }
+
+  dec_indent();
+  emit_line("});");
+  emit_line("$codes[0]->();");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void init_state_py(Data* data) {
+  emit_line("import sys");
+  for (int i = 0; i < 7; i++) {
+    emit_line("%s = 0", reg_names[i]);
+  }
+  emit_line("mem = [0] * (1 << 24)");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("mem[%d] = %d", mp, data->v);
+    }
+  }
+}
+
+static void py_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("def func%d():", func_id);
+  inc_indent();
+  for (int i = 0; i < 7; i++) {
+    emit_line("global %s", reg_names[i]);
+  }
+  emit_line("global mem");
+  emit_line("");
+
+  emit_line("while %d <= pc and pc < %d:",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("if False:");
+  inc_indent();
+  emit_line("pass");
+}
+
+static void py_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("pc += 1");
+  dec_indent();
+  dec_indent();
+}
+
+static void py_emit_pc_change(int pc) {
+  emit_line("");
+  dec_indent();
+  emit_line("elif pc == %d:", pc);
+  inc_indent();
+}
+
+static void py_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s]", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("sys.stdout.write(chr(%s))", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("_ = sys.stdin.read(1); %s = ord(_) if _ else 0",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("sys.exit(0)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = int(%s)",
+              reg_names[inst->dst.reg], cmp_str(inst, "True"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if %s: pc = %s - 1",
+              cmp_str(inst, "True"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_py(Module* module) {
+  init_state_py(module->data);
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         py_emit_func_prologue,
+                                         py_emit_func_epilogue,
+                                         py_emit_pc_change,
+                                         py_emit_inst);
+
+  emit_line("");
+  emit_line("while True:");
+  inc_indent();
+  emit_line("if False: pass");
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("elif pc < %d: func%d()", (i + 1) * CHUNKED_FUNC_SIZE, i);
+  }
+  dec_indent();
+}
+#include<ir/ir.h>
+#include<target/util.h>
+
+const char *ps_op_names[]={
+    "eq", "ne", "lt", "gt", "le", "ge"
+};
+
+static void ps_init_state(int max_pc) {
+    for(int i=0; i<7; i++){
+        emit_line("/%s 0 def", reg_names[i]);
+    }
+
+    int ps_array_size_shift=15;
+    int ps_array_size=1<<ps_array_size_shift;
+    emit_line("/mem %d array def", 1 << (24 - ps_array_size_shift));
+    emit_line("/zeros{");
+    emit_line(" %d array dup", ps_array_size);
+    emit_line(" 0 1 %d{", ps_array_size-1);
+    emit_line("  0 put dup");
+    emit_line(" }for");
+    emit_line(" pop");
+    emit_line("}def");
+    emit_line("/mem_addr{");
+    emit_line(" mem 1 index %d idiv get", ps_array_size);
+    emit_line(" dup null eq{");
+    emit_line("  pop zeros");
+    emit_line("  mem 2 index %d idiv 2 index put", ps_array_size);
+    emit_line(" }if");
+    emit_line(" exch %d mod", ps_array_size);
+    emit_line("}def");
+
+    emit_line("/stdout (%%stdout) (w) file def");
+    emit_line("/stdin (%%stdin) (r) file def");
+
+    int num_funcs=max_pc/CHUNKED_FUNC_SIZE+1;
+    emit_line("/func_table %d array def", num_funcs);
+    emit_line("0 1 %d{", num_funcs-1);
+    inc_indent();
+    emit_line("func_table exch %d array put", CHUNKED_FUNC_SIZE);
+    dec_indent();
+    emit_line("}for");
+}
+
+static void ps_emit_func_prologue(int func_id) {
+    emit_line("");
+    emit_line("func_table %d get", func_id);
+    // dummy
+    emit_line("dup 0 {");
+    inc_indent();
+}
+
+static void ps_emit_func_epilogue(void) {
+    dec_indent();
+    emit_line("} put");
+    emit_line("pop");
+}
+
+static void ps_emit_pc_change(int pc) {
+    dec_indent();
+    emit_line("} put");
+    emit_line("");
+    emit_line("dup %d %d mod {", pc, CHUNKED_FUNC_SIZE);
+    inc_indent();
+}
+
+static char* ps_value_str(Value* value) {
+    switch(value->type){
+        case REG:
+            return format("%s", reg_names[value->reg]);
+        case IMM:
+            return format("%d", value->imm);
+        default:
+            error("invalid value");
+            break;
+    }
+}
+
+static void ps_emit_inst(Inst* inst) {
+    int jumped=0;
+    const char *reg_name;
+
+    switch(inst->op){
+        case MOV:
+            emit_line("/%s %s def",
+                    reg_names[inst->dst.reg], ps_value_str(&inst->src));
+            break;
+        case ADD:
+            reg_name=reg_names[inst->dst.reg];
+            emit_line("/%s %s %s add 16#FFFFFF and def",
+                    reg_name, reg_name, ps_value_str(&inst->src));
+            break;
+        case SUB:
+            reg_name=reg_names[inst->dst.reg];
+            emit_line("/%s %s %s sub 16#FFFFFF and def",
+                    reg_name, reg_name, ps_value_str(&inst->src));
+            break;
+        case LOAD:
+            emit_line("/%s %s mem_addr get def",
+                    reg_names[inst->dst.reg], ps_value_str(&inst->src));
+            break;
+        case STORE:
+            emit_line("%s mem_addr %s put",
+                    ps_value_str(&inst->src), reg_names[inst->dst.reg]);
+            break;
+        case EXIT:
+            emit_line("quit");
+            break;
+        case JEQ:
+        case JNE:
+        case JLT:
+        case JGT:
+        case JLE:
+        case JGE:
+            emit_line("%s %s %s{",
+                    reg_names[inst->dst.reg], ps_value_str(&inst->src),
+                    ps_op_names[inst->op-JEQ]);
+            emit_line(" /pc %s def", ps_value_str(&inst->jmp));
+            emit_line("}{");
+            if(inst->next) emit_line(" /pc %d def", inst->next->pc);
+            emit_line("}ifelse");
+            jumped=1;
+            break;
+        case JMP:
+            emit_line("/pc %s def", ps_value_str(&inst->jmp));
+            jumped=1;
+            break;
+        case PUTC:
+            emit_line("stdout %s write", ps_value_str(&inst->src));
+            break;
+        case GETC:
+            emit_line("/%s stdin read not{0}if def", reg_names[inst->dst.reg]);
+            break;
+        case EQ:
+        case NE:
+        case LT:
+        case GT:
+        case LE:
+        case GE:
+            reg_name=reg_names[inst->dst.reg];
+            emit_line("/%s %s %s %s{1}{0}ifelse def",
+                    reg_name, reg_name, ps_value_str(&inst->src),
+                    ps_op_names[inst->op-EQ]);
+            break;
+        case DUMP:
+            break;
+        default:
+            error("unknown operator");
+            break;
+    }
+    if(!jumped && inst->next && inst->pc!=inst->next->pc){
+        emit_line("/pc %d def", inst->next->pc);
+    }
+}
+
+void target_ps(Module *module) {
+    ps_init_state(module->num_pcs - 1);
+    emit_chunked_main_loop(
+            module->text,
+            ps_emit_func_prologue,
+            ps_emit_func_epilogue,
+            ps_emit_pc_change,
+            ps_emit_inst);
+    emit_line("");
+
+    Data *data=module->data;
+    for(int mp=0; data; data=data->next, mp++){
+        if(data->v){
+            emit_line("%d mem_addr %d put", mp, data->v);
+        }
+    }
+    emit_line("");
+
+    emit_line("{");
+    inc_indent();
+    emit_line("func_table pc %d idiv get", CHUNKED_FUNC_SIZE);
+    emit_line("pc %d mod get", CHUNKED_FUNC_SIZE);
+    emit_line("exec");
+    dec_indent();
+    emit_line("}loop");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char* RB_REG_NAMES[] = {
+  "@a", "@b", "@c", "@d", "@bp", "@sp", "@pc"
+};
+
+static void init_state_rb(Data* data) {
+  reg_names = RB_REG_NAMES;
+  for (int i = 0; i < 7; i++) {
+    emit_line("%s = 0", reg_names[i]);
+  }
+  emit_line("@mem = [0] * (1 << 24)");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("@mem[%d] = %d", mp, data->v);
+    }
+  }
+}
+
+static void rb_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("def func%d", func_id);
+  inc_indent();
+  emit_line("while %d <= @pc && @pc < %d",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("case @pc");
+  inc_indent();
+}
+
+static void rb_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("end");
+  emit_line("@pc += 1");
+  dec_indent();
+  emit_line("end");
+  dec_indent();
+  emit_line("end");
+}
+
+static void rb_emit_pc_change(int pc) {
+  emit_line("");
+  dec_indent();
+  emit_line("when %d", pc);
+  inc_indent();
+}
+
+static void rb_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = @mem[%s]", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("@mem[%s] = %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("putc %s", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("c = STDIN.getc; %s = c ? c.ord : 0",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("exit");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s ? 1 : 0",
+              reg_names[inst->dst.reg], cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("%s && @pc = %s - 1",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_rb(Module* module) {
+  init_state_rb(module->data);
+  emit_line("");
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         rb_emit_func_prologue,
+                                         rb_emit_func_epilogue,
+                                         rb_emit_pc_change,
+                                         rb_emit_inst);
+
+  emit_line("");
+  emit_line("while true");
+  inc_indent();
+  emit_line("case @pc / %d", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("when %d", i);
+    emit_line(" func%d", i);
+  }
+  emit_line("end");
+  dec_indent();
+  emit_line("end");
+}
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char SED_REG_NAMES[] = "ABCDFS";
+
+static void sed_init_state(Data* data) {
+  emit_line(":in_loop");
+  emit_line("/^$/{x\ns/$/a,/\nx\nbin_done\n}");
+  for (int i = 1; i < 128; i++) {
+    if (i == 10)
+      continue;
+    putchar('/');
+    putchar('^');
+    if (i == '$' || i == '.' || i == '/' ||
+        i == '[' || i == '\\' || i == ']') {
+      putchar('\\');
+    }
+    putchar(i);
+    emit_line("/{s/.//\nx\ns/$/%x,/\nx\nbin_loop\n}", i);
+  }
+  emit_line(":in_done");
+  emit_line("${");
+
+  emit_line("x");
+  emit_line("s/a,$//");
+  emit_line("s/.*/i=& /");
+  for (int i = 0; i < 6; i++) {
+    emit_line("s/$/%c=0 /", SED_REG_NAMES[i]);
+  }
+  emit_line("s/$/o= /");
+  for (int mp = 0; data; data = data->next, mp++) {
+    emit_line("s/$/m%x=%x /", mp, data->v);
+  }
+  emit_line("x");
+}
+
+static void sed_emit_value(Value* v) {
+  if (v->type == REG) {
+    emit_line("G");
+    emit_line("s/\\n[^%c]* %c=\\([^ ]*\\).*/\\1/",
+              SED_REG_NAMES[v->reg], SED_REG_NAMES[v->reg]);
+  } else {
+    emit_line("s/$/%x/", v->imm);
+  }
+}
+
+static void sed_emit_src(Inst* inst) {
+  sed_emit_value(&inst->src);
+}
+
+static void sed_emit_dst(Inst* inst) {
+  sed_emit_value(&inst->dst);
+}
+
+static void sed_emit_dst_src(Inst* inst) {
+  sed_emit_dst(inst);
+  emit_line("s/$/ /");
+  sed_emit_src(inst);
+}
+
+static void sed_emit_set_dst(Inst* inst) {
+  emit_line("G");
+  emit_line("s/^\\([^\\n]*\\)\\n\\([^%c]* %c=\\)[^ ]*/\\2\\1/",
+            SED_REG_NAMES[inst->dst.reg], SED_REG_NAMES[inst->dst.reg]);
+  emit_line("x");
+  emit_line("s/.*//");
+}
+
+static void sed_emit_add(Inst* inst) {
+  static int id = 0;
+  sed_emit_dst_src(inst);
+  emit_line(" s/\\(.*\\) \\([0-9a-f]*\\)"
+            "/\\1@ \\2@ fedcba9876543210 fedcba9876543210;/");
+  emit_line(":add_loop_%d", id);
+  emit_line(" s/\\(.\\)@\\([^@]*\\)\\(.\\)@\\(.\\)\\? "
+            "\\([^ ]*\\1\\([^ ]*\\)\\) [^;]*\\(\\3[^;]*\\);"
+            "/@\\2; \\4\\6\\7\\5 \\5 \\5;/");
+  emit_line(" s/; .\\{16\\}\\(.\\)\\([0-9a-f]\\{15\\}\\([0-9a-f]\\)\\)\\?"
+            "[0-9a-f]* \\([^;]*\\);\\(.*\\)/@\\3 \\4;\\1\\5/");
+
+  emit_line(" /^@ @/!{");
+  emit_line("  s/^@/0@/");
+  emit_line("  s/ @/ 0@/");
+  emit_line("  badd_loop_%d", id);
+  emit_line(" }");
+
+  emit_line(" s/@ @. .*;/;1/");
+  emit_line(" s/.*;//");
+  emit_line(" s/.*\\(......\\)$/\\1/");
+  emit_line(" s/^0*\\([0-9a-f]\\)/\\1/");
+
+  sed_emit_set_dst(inst);
+
+  id++;
+}
+
+static void sed_emit_sub(Inst* inst) {
+  static int id = 0;
+  sed_emit_dst_src(inst);
+  emit_line("s/^/1000000/");
+  emit_line(" s/\\(.*\\) \\([0-9a-f]*\\)"
+            "/\\1@ \\2@x fedcba9876543210 0123456789abcdef;@\\1 \\2/");
+  emit_line(":sub_loop_%d", id);
+  emit_line(" s/\\(.\\)@\\([^@]*\\)\\(.\\)@\\(.\\)\\? "
+            "\\([^ ]*\\1\\([^ ]*\\)\\) \\([^;]*\\3\\([^;]*\\)\\);"
+            "/@\\2; \\4\\8\\1\\6\\5 \\5 \\7;/");
+  emit_line(" s/; .\\{16\\}\\(.\\)\\([0-9a-f]\\{15\\}\\([^ ]\\)\\)\\?"
+            "[0-9a-f]* \\(.*\\);\\(.*\\)/@\\3 \\4;\\1\\5/");
+
+  emit_line(" /^@ @/!{");
+  emit_line("  s/^@/0@/");
+  emit_line("  s/ @/ 0@/");
+  emit_line("  bsub_loop_%d", id);
+  emit_line(" }");
+
+  emit_line(" s/@ @. .*;/;/");
+  emit_line(" s/@.*//");
+  emit_line(" s/.*\\(......\\)$/\\1/");
+  emit_line(" s/^0*\\([0-9a-f]\\)/\\1/");
+
+  sed_emit_set_dst(inst);
+
+  id++;
+}
+
+static void sed_emit_cmp(Inst* inst) {
+  static int id = 0;
+  uint op = normalize_cond(inst->op, false);
+  sed_emit_dst_src(inst);
+  if (op == JLT || op == JLE) {
+    emit_line("s/\\(.*\\) \\(.*\\)/\\2 \\1/");
+    op = op == JLT ? JGT : JGE;
+  }
+
+  switch (op) {
+  case JEQ:
+    emit_line("s/^\\(.*\\) \\1$/1/");
+    emit_line("s/^.* .*$/0/");
+    break;
+
+  case JNE:
+    emit_line("s/^\\(.*\\) \\1$/0/");
+    emit_line("s/^.* .*$/1/");
+    break;
+
+  case JGE:
+  case JGT:
+    emit_line("s/^..* $/1/");
+    emit_line("s/^...* .$/1/");
+    emit_line("s/^....* ..$/1/");
+    emit_line("s/^.....* ...$/1/");
+    emit_line("s/^......* ....$/1/");
+    emit_line("s/^...... .....$/1/");
+    emit_line("s/^ ..*$/0/");
+    emit_line("s/^. ...*$/0/");
+    emit_line("s/^.. ....*$/0/");
+    emit_line("s/^... .....*$/0/");
+    emit_line("s/^.... ......*$/0/");
+    emit_line("s/^..... ......$/0/");
+    emit_line(":cmp_loop_%d", id);
+    emit_line("/^\\(.\\).* \\1/{");
+    emit_line(" s/^\\(.\\)\\(.*\\) \\1/\\2 /");
+    emit_line(" bcmp_loop_%d", id);
+    emit_line("}");
+    emit_line("s/$/;fedcba9876543210/");
+    emit_line("s/^\\(.\\).* \\(.\\).*;.*\\1.*\\2.*/1/");
+    if (op == JGE)
+      emit_line("s/^\\(.*\\) \\1;.*/1/");
+    emit_line("s/^.* .*/0/");
+    emit_line("s/;.*//");
+    id++;
+    break;
+  }
+}
+
+static void sed_emit_jmp(Inst* inst) {
+  if (inst->jmp.type == REG) {
+    sed_emit_value(&inst->jmp);
+    emit_line("bjmp_reg");
+  } else {
+    emit_line("bpc_%x", inst->jmp.imm);
+  }
+}
+
+static void sed_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    sed_emit_src(inst);
+    sed_emit_set_dst(inst);
+    break;
+
+  case ADD:
+    sed_emit_add(inst);
+    break;
+
+  case SUB:
+    sed_emit_sub(inst);
+    break;
+
+  case LOAD:
+    sed_emit_src(inst);
+    emit_line("G");
+    emit_line("s/^\\([^\\n]*\\)\\n.*m\\1=\\([^ ]*\\).*/@\\2/");
+    emit_line("/^@/!s/.*/0/");
+    emit_line("s/^@//");
+    sed_emit_set_dst(inst);
+    break;
+
+  case STORE:
+    sed_emit_dst_src(inst);
+    emit_line("G");
+    emit_line("/ \\([^\\n]*\\)\\n.*m\\1=/"
+              "s/^\\([^ ]*\\) \\([^\\n]*\\)\\n\\(.*m\\2=\\)[^ ]*/@\\3\\1/");
+    emit_line("/^@/!"
+              "s/^\\([^ ]*\\) \\([^\\n]*\\)\\n\\(.*\\)/\\3m\\2=\\1 /");
+    emit_line("s/^@//");
+    emit_line("x");
+    emit_line("s/.*//");
+    break;
+
+  case PUTC:
+    sed_emit_src(inst);
+    emit_line("s/^/0/");
+    emit_line("s/.*\\(..\\)$/\\1/");
+    emit_line("G");
+    emit_line("s/^\\(..\\)\\n\\(.*o=[^ ]*\\)/\\2\\1/");
+    emit_line("x");
+    emit_line("s/.*//");
+    break;
+
+  case GETC: {
+    emit_line("g");
+    emit_line("/i= /s/.*/0/");
+    emit_line("/i=[^ ]/{");
+    emit_line("s/.*i=\\([^,]*\\),.*/\\1/");
+    emit_line("x");
+    emit_line("s/i=[^,]*,/i=/");
+    emit_line("x");
+    emit_line("}");
+    sed_emit_set_dst(inst);
+    break;
+  }
+
+  case EXIT:
+    emit_line("bexit");
+    break;
+
+  case DUMP:
+    //emit_line("x");
+    //emit_line("p");
+    //emit_line("x");
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    sed_emit_cmp(inst);
+    sed_emit_set_dst(inst);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    sed_emit_cmp(inst);
+    emit_line("/^1$/{");
+    emit_line(" s/.//");
+    sed_emit_jmp(inst);
+    emit_line("}");
+    emit_line("s/.//");
+    break;
+
+  case JMP:
+    sed_emit_jmp(inst);
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static void sed_emit_jmp_table_rec(int depth, char* reg, int pc, int last_pc) {
+  static const int WIDTH[] = {
+    4096, 256, 16, 1
+  };
+  const int w = WIDTH[depth];
+  for (int i = 0; i < 16 && pc <= last_pc; i++, pc += w) {
+    reg[depth] = i > 9 ? 'a' + i - 10 : '0' + i;
+    reg[depth+1] = 0;
+    if (depth == 3) {
+      emit_line("/^%s$/bpc_%x", reg, pc);
+    } else {
+      emit_line("/^%s/{", reg);
+      sed_emit_jmp_table_rec(depth + 1, reg, pc, last_pc);
+      emit_line("}");
+    }
+  }
+}
+
+static void sed_emit_jmp_table(int last_pc) {
+  emit_line("");
+  emit_line(":jmp_reg");
+  emit_line("s/^/000/");
+  emit_line("s/.*\\(....\\)/\\1/");
+  char reg[5];
+  sed_emit_jmp_table_rec(0, reg, 0, last_pc);
+}
+
+void target_sed(Module* module) {
+  sed_init_state(module->data);
+
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      emit_line("");
+      emit_line(":pc_%x", inst->pc);
+      emit_line("s/.*//");
+    }
+    prev_pc = inst->pc;
+    sed_emit_inst(inst);
+  }
+
+  sed_emit_jmp_table(prev_pc);
+
+  emit_line("");
+  emit_line(":exit");
+  emit_line("s/.*//");
+  emit_line("x");
+  emit_line("s/.*o=\\([^ ]*\\).*/\\1/");
+  emit_line(":out_loop");
+  emit_line("/^$/bout_done");
+  for (int i = 0; i < 256; i++) {
+    printf("/^%x%x/{s/..//\nx\n", i / 16, i % 16);
+    if (i == 10) {
+      emit_line("p\ns/.*//\nx\n}");
+    } else {
+      char buf[6];
+      buf[0] = i;
+      buf[1] = 0;
+      if (i == '/' || i == '\\' || i == '&') {
+        buf[0] = '\\';
+        buf[1] = i;
+        buf[2] = 0;
+      } else if (i == 0 || (i >= 0xc2 && i <= 0xfd)) {
+        sprintf(buf, "\\x%x", i);
+      }
+      emit_line("s/$/%s/\nx\n}", buf);
+    }
+  }
+  emit_line("bout_loop");
+  emit_line(":out_done");
+  emit_line("x");
+  emit_line("p");
+
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void sh_init_state(Data* data) {
+  for (int i = 0; i < 7; i++) {
+    emit_line("%s=0", reg_names[i]);
+  }
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("m%d=%d", mp, data->v);
+    }
+  }
+}
+
+const char* sh_value_str(Value* v) {
+  if (v->type == REG) {
+    return format("$%s", reg_names[v->reg]);
+  } else if (v->type == IMM) {
+    return format("%d", v->imm);
+  } else {
+    error("invalid value");
+  }
+}
+
+static const char* sh_src_str(Inst* inst) {
+  return sh_value_str(&inst->src);
+}
+
+static const char* sh_cmp_str(Inst* inst) {
+  int op = normalize_cond(inst->op, 0);
+  const char* op_str;
+  switch (op) {
+    case JEQ:
+      op_str = "=="; break;
+    case JNE:
+      op_str = "!="; break;
+    case JLT:
+      op_str = "<"; break;
+    case JGT:
+      op_str = ">"; break;
+    case JLE:
+      op_str = "<="; break;
+    case JGE:
+      op_str = ">="; break;
+    case JMP:
+      return "1";
+    default:
+      error("oops");
+  }
+  return format("$(( $%s %s %s ))",
+                reg_names[inst->dst.reg], op_str, sh_src_str(inst));
+}
+
+static void sh_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s=%s", reg_names[inst->dst.reg], sh_src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s=$(( ($%s + %s) & " UINT_MAX_STR " ))",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], sh_src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s=$(( ($%s - %s) & " UINT_MAX_STR "))",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], sh_src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("eval z=\\$m%s", sh_src_str(inst));
+    emit_line("%s=$(( $z + 0 ))", reg_names[inst->dst.reg]);
+    break;
+
+  case STORE:
+    emit_line("eval m%s=$%s", sh_src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("t=$((%s&255))", sh_src_str(inst));
+    emit_line("printf \"\\\\$(printf '%%03o' $t)\"");
+    break;
+
+  case GETC:
+    emit_line("if read -rn1 t; then");
+    emit_line(" if [ -z $t ]; then");
+    emit_line("  %s=10", reg_names[inst->dst.reg]);
+    emit_line(" else");
+    emit_line("  %s=$(printf '%%d' \"'$t'\")", reg_names[inst->dst.reg]);
+    emit_line(" fi");
+    emit_line("else");
+    emit_line(" %s=0", reg_names[inst->dst.reg]);
+    emit_line("fi");
+    break;
+
+  case EXIT:
+    emit_line("exit");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s=%s",
+              reg_names[inst->dst.reg], sh_cmp_str(inst));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("if [ %s = 1 ]; then", sh_cmp_str(inst));
+    emit_line(" pc=$(( %s - 1 ))", sh_value_str(&inst->jmp));
+    emit_line("fi");
+    break;
+
+  case JMP:
+    emit_line("pc=$(( %s - 1 ))", sh_value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_sh(Module* module) {
+  sh_init_state(module->data);
+  emit_line("");
+
+  emit_line("while true; do");
+  emit_line("case $pc in");
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      if (prev_pc != -1) {
+        emit_line(";;");
+        dec_indent();
+        emit_line("");
+      }
+      emit_line("%d)", inst->pc);
+      inc_indent();
+    }
+    prev_pc = inst->pc;
+    sh_emit_inst(inst);
+  }
+
+  emit_line(";;");
+  dec_indent();
+  emit_line("esac");
+  emit_line("");
+  emit_line("pc=$(( $pc + 1 ))");
+  emit_line("done");
+}
+#include <stdlib.h>
+#include <ir/ir.h>
+#include <target/util.h>
+
+typedef enum {
+  SQLITE3_A = 0,
+  SQLITE3_B,
+  SQLITE3_C,
+  SQLITE3_D,
+  SQLITE3_BP,
+  SQLITE3_SP,
+  SQLITE3_PC,
+  SQLITE3_STEP,
+  SQLITE3_RUN,
+  SQLITE3_MEM,
+  SQLITE3_IN,
+  SQLITE3_OUT,
+  SQLITE3_NUM_COLS
+} SQLite3Col;
+
+static const char* COL_NAMES[SQLITE3_NUM_COLS] = {
+  "a", "b", "c", "d", "bp", "sp", "pc", "step",
+  "running", "mem", "stdin", "stdout"
+};
+
+typedef struct SQLite3CaseExpr_ {
+  int pc;
+  int step;
+  const char* expr;
+  struct SQLite3CaseExpr_* next;
+} SQLite3CaseExpr;
+
+
+static SQLite3CaseExpr* sqlite3_add_expr(SQLite3CaseExpr* expr,
+                                         int pc,
+                                         int step,
+                                         const char* expr_str) {
+  SQLite3CaseExpr* e = malloc(sizeof(SQLite3CaseExpr));
+  e->pc = pc;
+  e->step = step;
+  e->expr = expr_str;
+  e->next = 0;
+  expr->next = e;
+  return e;
+}
+
+const char* sqlite3_cmp_str(Inst* inst) {
+  int op = normalize_cond(inst->op, 0);
+  const char* op_str;
+  switch (op) {
+    case JEQ: op_str = "="; break;
+    case JNE: op_str = "<>"; break;
+    case JLT: op_str = "<"; break;
+    case JGT: op_str = ">"; break;
+    case JLE: op_str = "<="; break;
+    case JGE: op_str = ">="; break;
+    default:
+      error("oops");
+  }
+  return format("%s %s %s", COL_NAMES[inst->dst.reg], op_str, src_str(inst));
+}
+
+static void sqlite3_transpose_insts(Inst* inst, SQLite3CaseExpr* cols[]) {
+  
+  int step = 0;
+  int prev_pc = -1;
+  SQLite3Col col_idx = 0;
+  const char* expr = NULL;
+  int updcols = 0;
+
+  for (; inst; inst = inst->next) {
+    if (prev_pc != inst-> pc) {
+      if (prev_pc != -1) {
+        step++;
+        cols[SQLITE3_PC] = sqlite3_add_expr(cols[SQLITE3_PC], prev_pc, step, "pc+1");
+        cols[SQLITE3_STEP] = sqlite3_add_expr(cols[SQLITE3_STEP], prev_pc, step, "0");
+      }
+      updcols = 0;
+      step = 0;
+    }
+
+    int usecol = ((inst->src.type == REG) ? (1 << inst->src.reg) : 0) |
+                 ((inst->dst.type == REG) ? (1 << inst->dst.reg) : 0);
+
+    if ((usecol & updcols) != 0) {
+      step++;
+      updcols = 0;
+    }
+
+    switch (inst->op) {
+    case MOV:
+      col_idx = (SQLite3Col)inst->dst.reg;
+      expr = src_str(inst);
+      break;
+
+    case ADD:
+      col_idx = (SQLite3Col)inst->dst.reg;
+      expr = format("(%s + %s) & " UINT_MAX_STR,
+                    COL_NAMES[inst->dst.reg], src_str(inst));
+      break;
+
+    case SUB:
+      col_idx = (SQLite3Col)inst->dst.reg;
+      expr = format("(%s - %s) & " UINT_MAX_STR,
+                COL_NAMES[inst->dst.reg], src_str(inst));
+      break;
+
+    case LOAD:
+      col_idx = (SQLite3Col)inst->dst.reg;
+      expr = format("coalesce(json_extract(mem, '$.'||%s),0)", src_str(inst));
+      break;
+
+    case STORE:
+      col_idx = SQLITE3_MEM;
+      expr = format("json_set(mem, '$.'||%s, %s)",
+                    src_str(inst), COL_NAMES[inst->dst.reg]);
+      break;
+
+    case PUTC:
+      col_idx = SQLITE3_OUT;
+      expr = format("stdout||char(%s)", src_str(inst));
+      break;
+
+    case GETC:
+      cols[SQLITE3_IN] = sqlite3_add_expr(cols[SQLITE3_IN], inst->pc, step,
+                                          "substr(stdin, 2)");
+      col_idx = (SQLite3Col)inst->dst.reg;
+      // todo: can't read a single byte from multibyte character
+      expr = "CASE WHEN length(stdin) = 0 THEN 0 ELSE unicode(stdin) END";
+      break;
+
+    case EXIT:
+      col_idx = SQLITE3_RUN;
+      expr = "0";
+      break;
+
+    case DUMP:
+      goto next_inst;
+
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+      col_idx = (SQLite3Col)inst->dst.reg;
+      expr = sqlite3_cmp_str(inst);
+      break;
+
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      expr = format("CASE WHEN %s THEN 0 ELSE step+1 END", sqlite3_cmp_str(inst));
+      cols[SQLITE3_STEP] = sqlite3_add_expr(cols[SQLITE3_STEP], inst->pc, step, expr);
+      col_idx = SQLITE3_PC;
+      expr = format("CASE WHEN %s THEN %s ELSE pc END",
+                    sqlite3_cmp_str(inst), value_str(&inst->jmp));
+      break;
+    case JMP:
+      cols[SQLITE3_STEP] = sqlite3_add_expr(cols[SQLITE3_STEP], inst->pc, step, "0");
+      col_idx = SQLITE3_PC;
+      expr = value_str(&inst->jmp);
+      break;
+
+    default:
+      error("oops");
+    }
+
+    cols[col_idx] = sqlite3_add_expr(cols[col_idx], inst->pc, step, expr);
+
+    if (inst->op == GETC || inst->op == PUTC || inst->op == STORE) {
+      step++;
+      updcols = 0;
+    } else {
+      updcols |= (1 << col_idx);
+    }
+
+  next_inst:
+    prev_pc = inst->pc;
+  }
+  cols[SQLITE3_PC] = sqlite3_add_expr(cols[SQLITE3_PC], prev_pc, step, "pc+1");
+  cols[SQLITE3_STEP] = sqlite3_add_expr(cols[SQLITE3_STEP], prev_pc, step, "0");
+}
+
+
+void sqlite3_emit_stdin() {
+  emit_line("DROP TABLE IF EXISTS stdin;");
+  emit_line("CREATE TABLE stdin(i BLOB);");
+  emit_line("INSERT INTO stdin(i) VALUES(readfile('input.txt'));");
+}
+
+static void sqlite3_emit_column(SQLite3CaseExpr* ce, SQLite3Col col) {
+  if (ce == NULL) {
+    emit_line(COL_NAMES[col]);
+    return;
+  }
+
+  int prev_part = -1;
+  int prev_pc = -1;
+  
+  emit_line("CASE pc / %d", CHUNKED_FUNC_SIZE);
+  for (; ce != NULL; ce = ce->next) {
+    int part = ce->pc / CHUNKED_FUNC_SIZE;
+    if (ce->pc != prev_pc) {
+      if (prev_pc != -1) {
+        // end step
+        if (col == SQLITE3_STEP) {
+          emit_line("ELSE step + 1 END");
+        } else {
+          emit_line("ELSE %s END", COL_NAMES[col]);
+        }
+        dec_indent();
+      }
+      if (part != prev_part) {
+        if (prev_pc != -1) {
+          // end pc
+          if (col == SQLITE3_PC || col == SQLITE3_STEP) {
+            emit_line("END");
+          } else {
+            emit_line("ELSE %s END", COL_NAMES[col]);
+          }
+          dec_indent();
+        }
+        emit_line("WHEN %d THEN", part);
+        inc_indent();
+        emit_line("CASE pc");
+      }
+      emit_line("WHEN %d THEN", ce->pc);
+      inc_indent();
+      emit_line("CASE step");
+    }
+    emit_line("WHEN %d THEN %s", ce->step, ce->expr);
+    prev_part = part;
+    prev_pc = ce->pc;
+  }
+
+  if (col == SQLITE3_STEP) {
+    emit_line("ELSE step+1 END");
+  } else {
+    emit_line("ELSE %s END", COL_NAMES[col]);
+  }
+  for (int i = 0; i<2; i++) {
+    dec_indent();
+    if (col == SQLITE3_PC || col == SQLITE3_STEP) {
+      emit_line("END");
+    } else {
+      emit_line("ELSE %s END", COL_NAMES[col]);
+    }
+  }
+}
+
+
+void target_sqlite3(Module* module) {
+  reg_names = COL_NAMES;
+  SQLite3CaseExpr roots[SQLITE3_NUM_COLS] = {};
+  SQLite3CaseExpr* cols[SQLITE3_NUM_COLS];
+  for (int i = 0; i < SQLITE3_NUM_COLS; i++) {
+    roots[i].next = NULL;
+    cols[i] = &roots[i];
+  }
+  sqlite3_transpose_insts(module->text, cols);
+  for (int i = 0; i < SQLITE3_NUM_COLS; i++) {
+    cols[i] = roots[i].next;
+  }
+  
+  sqlite3_emit_stdin();
+
+  emit_line("WITH");
+  inc_indent();
+  emit_line("elvm AS (");
+  inc_indent();
+  emit_line("SELECT");
+  inc_indent();
+  for (int i = 0; i < 7; i++) {
+    emit_line("0 %s,", COL_NAMES[i]);
+  }
+  emit_line("0 step,");
+  emit_line("1 running,");
+  emit_line("json('{");
+  int mp = 0;
+  for (Data* data = module->data; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line(" %c\"%d\":%d", mp ? ',' : ' ', mp, data->v);
+    }
+  }
+  emit_line("}') mem,");
+  emit_line("(SELECT i FROM stdin) stdin,");
+  emit_line("'' stdout,");
+  emit_line("0 cycle");
+  dec_indent();
+  emit_line("UNION ALL SELECT");
+  inc_indent();
+
+  for (int i = 0; i < SQLITE3_NUM_COLS; i++) {
+    sqlite3_emit_column(cols[i], i);
+    emit_line(",");
+  }
+  emit_line("cycle + 1");
+  dec_indent();
+  emit_line("FROM elvm WHERE running = 1");
+  dec_indent();
+  emit_line(")");
+  dec_indent();
+
+  emit_line("SELECT writefile('output.txt', stdout) FROM elvm"
+            " WHERE running = 0;");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+#include <target/scm_sr_lib.h>
+
+static void scm_sr_emit_file_prologue(void) {
+  emit_line(scm_sr_lib);
+}
+
+static void scm_sr_emit_file_epilogue(void) {
+  emit_line(";;; Load Input");
+  emit_line("(load \"./input.scm\")");
+  emit_line(";;; Run VM!");
+  emit_line("(ck () (run-vm! '\"load\" (zero!) (init-reg!)");
+  emit_line("                (dmem-init!) (imem-init!)");
+  emit_line("                (input!) '()))");
+}
+
+static void scm_sr_emit_func_prologue(int i) {
+  emit_line("(define-syntax func-impl%d!", i);
+  inc_indent();
+  emit_line("(syntax-rules (quote) ((_ s) (ck s '(");
+  inc_indent();
+}
+
+static void scm_sr_emit_func_epilogue() {
+  dec_indent();
+  emit_line(")))))");
+  dec_indent();
+}
+
+static char* scm_sr_op_str(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    return "\"MOV\"";
+  case ADD:
+    return "\"ADD\"";
+  case SUB:
+    return "\"SUB\"";
+  case LOAD:
+    return "\"LOAD\"";
+  case STORE:
+    return "\"STORE\"";
+  case PUTC:
+    return "\"PUTC\"";
+  case EQ:
+  case JEQ:
+    return "\"EQ\"";
+  case NE:
+  case JNE:
+    return "\"NE\"";
+  case LT:
+  case JLT:
+    return "\"LT\"";
+  case GT:
+  case JGT:
+    return "\"GT\"";
+  case LE:
+  case JLE:
+    return "\"LE\"";
+  case GE:
+  case JGE:
+    return "\"GE\"";
+  default:
+    error("oopsa %d", inst->op);
+  }
+  return "BAD_INSTRUCTION";
+}
+
+static char* scm_sr_imm_str(int imm, int n) {
+  if (n == 1) {
+    return format("%d", imm & 1);
+  } else {
+    return format("%d %s", imm & 1, scm_sr_imm_str(imm >> 1, n - 1));
+  }
+}
+
+static char* scm_sr_jmp_str(Inst* inst) {
+  if (inst->jmp.type == REG) {
+    return format("(\"REG\" %s)", reg_names[inst->jmp.reg]);
+  } else {
+    return format("(\"IMM\" (%s))", scm_sr_imm_str(inst->jmp.imm, 24));
+  }
+}
+
+static char* scm_sr_src_str(Inst* inst) {
+  if (inst->src.type == REG) {
+    return format("(\"REG\" %s)", reg_names[inst->src.reg]);
+  } else {
+    return format("(\"IMM\" (%s))", scm_sr_imm_str(inst->src.imm, 24));
+  }
+}
+
+static void scm_sr_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+  case ADD:
+  case SUB:
+  case LOAD:
+  case STORE:
+    emit_line("(%s %s %s)",
+              scm_sr_op_str(inst),
+	      reg_names[inst->dst.reg],
+	      scm_sr_src_str(inst));
+    break;
+
+  case PUTC:
+    emit_line("(\"PUTC\" %s)",
+	      scm_sr_src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("(\"GETC\" %s)",
+	      reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("(\"EXIT\")");
+    return;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("(\"CMP\" %s %s %s)",
+              scm_sr_op_str(inst),
+	      reg_names[inst->dst.reg],
+	      scm_sr_src_str(inst));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("(\"JCOND\" %s %s %s %s)",
+              scm_sr_op_str(inst),
+              scm_sr_jmp_str(inst),
+	      reg_names[inst->dst.reg],
+	      scm_sr_src_str(inst));
+    break;
+
+  case JMP:
+    emit_line("(\"JMP\" %s)",
+              scm_sr_jmp_str(inst));
+    break;
+
+  default:
+    error("oops");
+  }
+  return;
+}
+
+static void scm_sr_emit_func_impl(Inst* inst) {
+  int prev_pc = 0;
+  scm_sr_emit_func_prologue(0);
+  for (; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      scm_sr_emit_func_epilogue();
+      emit_line("");
+      scm_sr_emit_func_prologue(inst->pc);
+    }
+    prev_pc = inst->pc;
+
+    scm_sr_emit_inst(inst);
+  }
+  scm_sr_emit_func_epilogue();
+}
+
+static void scm_sr_emit_inst_mem_rec(int max_pc, int from, int to) {
+  if (max_pc < from) {
+    emit_line("'()");
+  } else if (from + 1 >= to) {
+    emit_line("(func-impl%d!)", from);
+  } else {
+    int mid = (from + to)/2;
+    emit_line("(cons!");
+    inc_indent();
+    scm_sr_emit_inst_mem_rec(max_pc, from, mid);
+    scm_sr_emit_inst_mem_rec(max_pc, mid, to);
+    dec_indent();
+    emit_line(")");
+  }
+}
+
+static void scm_sr_emit_inst_mem(int max_pc) {
+  emit_line("(define-syntax imem-init!");
+  inc_indent();
+  emit_line("(syntax-rules (quote) ((_ s) (ck s");
+  inc_indent();
+  scm_sr_emit_inst_mem_rec(max_pc, 0, 1 << 24);
+  dec_indent();
+  emit_line("))))");
+  dec_indent();
+}
+
+static Data* scm_sr_take_data(Data* data, int n) {
+  int i = 0;
+  for (; i < n && data; i++) {
+    data = data->next;
+  }
+  return data;
+}
+
+static void scm_sr_emit_data_mem_rec(Data* data, int from, int to) {
+  if (data == NULL) {
+    emit_line("()");
+  } else if (from + 1 >= to) {
+    emit_line("(%s)", scm_sr_imm_str(data->v, 24));
+  } else {
+    int mid = (from + to)/2;
+    emit_line("(");
+    inc_indent();
+    scm_sr_emit_data_mem_rec(data, from, mid);
+    emit_line(".");
+    scm_sr_emit_data_mem_rec(scm_sr_take_data(data, mid - from), mid, to);
+    dec_indent();
+    emit_line(")");
+  }
+}
+
+static void scm_sr_emit_data_mem(Data* data) {
+  emit_line("(define-syntax dmem-init!");
+  inc_indent();
+  emit_line("(syntax-rules (quote) ((_ s) (ck s '");
+  inc_indent();
+  scm_sr_emit_data_mem_rec(data, 0, 1 << 24);
+  dec_indent();
+  emit_line("))))");
+  dec_indent();
+}
+
+static const char* SCM_SR_REG_NAMES[6] = {
+  "\"A\"", "\"B\"", "\"C\"", "\"D\"", "\"BP\"", "\"SP\""
+};
+
+void target_scm_sr(Module* module) {
+  reg_names = SCM_SR_REG_NAMES;
+
+  scm_sr_emit_file_prologue();
+  emit_line("");
+
+  scm_sr_emit_func_impl(module->text);
+  emit_line("");
+
+  scm_sr_emit_inst_mem(module->num_pcs - 1);
+  emit_line("");
+
+  scm_sr_emit_data_mem(module->data);
+  emit_line("");
+
+  scm_sr_emit_file_epilogue();
+}
+#include <string.h>
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void swift_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("private func func%d() {", func_id);
+  inc_indent();
+  emit_line("while %d <= pc && pc < %d {",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("switch pc {");
+  emit_line("case -1:  /* dummy */");
+  inc_indent();
+  emit_line("break");
+}
+
+static void swift_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("default:");
+  emit_line("  break");
+  emit_line("}");
+  emit_line("pc += 1");
+  dec_indent();
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+}
+
+static void swift_emit_pc_change(int pc) {
+  emit_line("");
+  dec_indent();
+  emit_line("case %d:", pc);
+  inc_indent();
+}
+
+static void swift_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    {
+      const char *_l = reg_names[inst->dst.reg];
+      const char *_r = src_str(inst);
+      if (strcmp(_l, _r)) {
+        emit_line("%s = %s", _l, _r);
+        /* emit_line("%s = %s", reg_names[inst->dst.reg], src_str(inst)); */
+      }
+    }
+    break;
+
+  case ADD:
+    emit_line("%s = (%s + %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("%s = (%s - %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s]", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("mem[%s] = %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    emit_line("print(\"\\(UnicodeScalar(%s)!)\", terminator:\"\")", src_str(inst));
+    break;
+
+  case GETC:
+    emit_line("if true {");
+    inc_indent();
+    emit_line("let _c = getchar()");
+    emit_line("%s = _c == -1 ? 0 : Int(_c)", reg_names[inst->dst.reg]);
+    dec_indent();
+    emit_line("}");
+    break;
+
+  case EXIT:
+    emit_line("exit(0)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = %s ? 1 : 0",
+              reg_names[inst->dst.reg], cmp_str(inst, "true"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if %s { pc = %s - 1 }",
+              cmp_str(inst, "true"), value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static int swift_init_state(Data* data) {
+  int prev_mc = -1;
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      int mc = mp / 1000;
+      while (prev_mc != mc) {
+        if (prev_mc != -1) {
+          dec_indent();
+          emit_line("}");
+        }
+        prev_mc++;
+        emit_line("private func init%d() {", prev_mc);
+        inc_indent();
+      }
+      emit_line("mem[%d] = %d", mp, data->v);
+    }
+  }
+
+  if (prev_mc != -1) {
+    dec_indent();
+    emit_line("}");
+  }
+
+  return prev_mc + 1;
+}
+
+void target_swift(Module* module) {
+  emit_line("import Foundation");
+  for (int i = 0; i < 7; i++) {
+    emit_line("private var %s: Int = 0", reg_names[i]);
+  }
+  emit_line("private var mem = [Int](repeating: 0, count: 1<<24)");
+
+  int num_inits = swift_init_state(module->data);
+
+  CHUNKED_FUNC_SIZE = 256;
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         swift_emit_func_prologue,
+                                         swift_emit_func_epilogue,
+                                         swift_emit_pc_change,
+                                         swift_emit_inst);
+  emit_line("");
+  for (int i = 0; i < num_inits; i++) {
+    emit_line("init%d()", i);
+  }
+  emit_line("");
+  emit_line("while true {");
+  inc_indent();
+  emit_line("switch pc / %d | 0 {", CHUNKED_FUNC_SIZE);
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("case %d:", i);
+    emit_line(" func%d()", i);
+  }
+  emit_line("default:");
+  emit_line(" break");
+  emit_line("}");
+  dec_indent();
+  emit_line("}");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+const char* tex_value_str(Value* v) {
+  if (v->type == REG) {
+    return format("\\@reg@%s", reg_names[v->reg]);
+  } else if (v->type == IMM) {
+    return format("%d", v->imm);
+  } else {
+    error("invalid value");
+  }
+}
+
+static const char* tex_src_str(Inst* inst) {
+  return tex_value_str(&inst->src);
+}
+
+static const char* tex_cmp_op_str(Inst* inst) {
+  int op = normalize_cond(inst->op, 0);
+  switch (op) {
+    case JEQ:
+      return "=";
+    case JLE:
+    case JLT:
+      return "<";
+    case JGE:
+    case JGT:
+      return ">";
+    default:
+      error("oops");
+  }
+}
+
+static void tex_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("\\edef\\@reg@%s{%s}%%", reg_names[inst->dst.reg], tex_src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("\\count0=\\@reg@%s\\relax", reg_names[inst->dst.reg]);
+    emit_line("\\advance\\count0by%s\\relax", tex_src_str(inst));
+    emit_line("\\ifnum\\count0>%d\\advance\\count0by-%s\\fi", UINT_MAX, "16777216");
+    emit_line("\\edef\\@reg@%s{\\the\\count0}%%", reg_names[inst->dst.reg]);
+    break;
+
+  case SUB:
+    emit_line("\\count0=\\@reg@%s\\relax", reg_names[inst->dst.reg]);
+    emit_line("\\advance\\count0by-%s\\relax", tex_src_str(inst));
+    emit_line("\\ifnum\\count0<0\\advance\\count0by%s\\fi", "16777216");
+    emit_line("\\edef\\@reg@%s{\\the\\count0}%%", reg_names[inst->dst.reg]);
+    break;
+
+  case LOAD:
+    emit_line("\\def\\@reg@%s{0}%%", reg_names[inst->dst.reg]);
+    emit_line("\\expandafter\\ifx\\csname @mem@%s\\endcsname\\relax\\else\\edef\\@reg@%s{\\csname @mem@%s\\endcsname}\\fi",
+              tex_src_str(inst), reg_names[inst->dst.reg], tex_src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("\\expandafter\\let\\csname @mem@%s\\endcsname\\@reg@%s",
+              tex_src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    // a output char c is represented by C where C is the code of c.
+    emit_line("\\immediate\\write\\@out{%s}%%", tex_src_str(inst));
+    break;
+
+  case GETC:
+    // input is also...
+    emit_line("\\read-1to\\@temp\\count0=\\@temp\\edef\\@reg@%s{\\the\\count0}%%", reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("\\let\\@@next\\relax");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case LT:
+  case GT:
+    emit_line("\\ifnum\\@reg@%s%s%s\\edef\\@reg@%s{1}\\else\\edef\\@reg@%s{0}\\fi%%",
+              reg_names[inst->dst.reg],
+              tex_cmp_op_str(inst),
+              tex_src_str(inst),
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg]);
+    break;
+  case NE:
+    emit_line("\\ifnum\\@reg@%s=%s\\edef\\@reg@%s{0}\\else\\edef\\@reg@%s{1}\\fi%%",
+              reg_names[inst->dst.reg], tex_src_str(inst),
+              reg_names[inst->dst.reg], reg_names[inst->dst.reg]);
+    break;
+  case LE:
+  case GE:
+    emit_line("\\ifnum\\@reg@%s=%s\\edef\\@reg@%s{1}\\else"
+              "\\ifnum\\@reg@%s%s%s\\edef\\@reg@%s{1}\\else\\edef\\@reg@%s{0}\\fi\\fi%%",
+              reg_names[inst->dst.reg], tex_src_str(inst),
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], tex_cmp_op_str(inst), tex_src_str(inst),
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg]);
+    break;
+
+  case JEQ:
+  case JLT:
+  case JGT:
+    emit_line("\\count0=%s\\relax\\advance\\count0by-1\\relax", tex_value_str(&inst->jmp));
+    emit_line("\\ifnum\\@reg@%s%s%s\\edef\\@reg@pc{\\the\\count0}\\fi",
+              reg_names[inst->dst.reg],
+              tex_cmp_op_str(inst),
+              tex_src_str(inst));
+    break;
+  case JNE:
+    emit_line("\\count0=%s\\relax\\advance\\count0by-1\\relax", tex_value_str(&inst->jmp));
+    emit_line("\\ifnum\\@reg@%s=%s\\else\\edef\\@reg@pc{\\the\\count0}\\fi",
+              reg_names[inst->dst.reg],
+              tex_src_str(inst));
+    break;
+  case JLE:
+  case JGE:
+    emit_line("\\count0=%s\\relax\\advance\\count0by-1\\relax", tex_value_str(&inst->jmp));
+    emit_line("\\ifnum\\@reg@%s=%s\\edef\\@reg@pc{\\the\\count0}\\fi",
+              reg_names[inst->dst.reg],
+              tex_src_str(inst));
+    emit_line("\\ifnum\\@reg@%s%s%s\\edef\\@reg@pc{\\the\\count0}\\fi",
+              reg_names[inst->dst.reg],
+              tex_cmp_op_str(inst),
+              tex_src_str(inst));
+    break;
+  case JMP:
+    emit_line("\\count0=%s\\relax\\advance\\count0by-1\\relax", tex_value_str(&inst->jmp));
+    emit_line("\\edef\\@reg@pc{\\the\\count0}%%");
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static void tex_init_state(Data* data) {
+  // register
+  for (int i = 0; i < 7; i++) {
+    emit_line("\\def\\@reg@%s{0}", reg_names[i]);
+  }
+
+  // memory
+  for (int mp = 0; data; data = data->next, mp++) {
+    if(data->v != 0) {
+      emit_line("\\expandafter\\def\\csname @mem@%d\\endcsname{%d}", mp, data->v);
+    }
+  }
+  return;
+}
+
+void target_tex(Module* module) {
+  emit_line("\\catcode`\\@=11\\relax");
+
+  // Initialize register and memory.
+  tex_init_state(module->data);
+
+  // open a file to output
+  //emit_line("\\read-1to\\@file");
+  emit_line("\\newwrite\\@out");
+  //emit_line("\\immediate\\openout\\@out=\\@file\\relax");
+  emit_line("\\immediate\\openout\\@out=\\jobname.tex.elvm.out\\relax");
+
+  // compile each instractions
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      if(prev_pc != -1) {
+        emit_line("}");
+      }
+      emit_line("\\expandafter\\def\\csname @inst@%d\\endcsname{%%", inst->pc);
+    }
+    prev_pc = inst->pc;
+    tex_emit_inst(inst);
+  }
+  if(prev_pc != -1) {
+    emit_line("}");
+  }
+
+  // define and do infinite loop
+  emit_line("\\def\\@loop@main{%%");
+  emit_line("\\let\\@@next\\@loop@main");
+  // execute instraction
+  emit_line("\\csname @inst@\\@reg@pc\\endcsname");
+  // increment pc
+  emit_line("\\count0=\\@reg@pc\\relax");
+  emit_line("\\advance\\count0by1\\relax");
+  emit_line("\\edef\\@reg@pc{\\the\\count0}%%");
+  emit_line("\\@@next}\\@loop@main");
+
+  // finnaly, close the output
+  emit_line("\\immediate\\closeout\\@out");
+  emit_line("\\bye");
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static void init_state_tf(Data* data) {
+  emit_line("import sys");
+  emit_line("import tensorflow as tf");
+  emit_line("from tensorflow.python.framework import function");
+  emit_line("from tensorflow.python.framework import tensor_shape");
+  emit_line("");
+
+  for (int i = 0; i < 7; i++) {
+    //emit_line("%s = tf.Variable(0, name='%s')", reg_names[i], reg_names[i]);
+    emit_line("%s = tf.constant(0, name='%s')", reg_names[i], reg_names[i]);
+  }
+  //emit_line("mem = tf.Variable([0] * (1<<24), dtype=tf.int32, name='mem')");
+  //emit_line("mem = tf.zeros([1<<24], dtype=tf.int32, name='mem')");
+  emit_line("data = []");
+  for (int mp = 0; data; data = data->next, mp++) {
+    emit_line("data.append(%d)", data->v);
+  }
+  emit_line("mem = tf.concat(0, [data, "
+            "tf.zeros([(1<<24)-len(data)], dtype=tf.int32, name='mem')])");
+  emit_line("done = tf.constant(0, name='done')");
+  emit_line("out = tf.constant('', name='out')");
+  emit_line("CHAR_TBL = tf.constant([chr(i) for i in xrange(256)])");
+  emit_line("input = map(ord, sys.stdin.read())");
+  emit_line("INPUT_LEN = len(input)");
+  emit_line("INPUT = tf.placeholder("
+            "shape=[INPUT_LEN], dtype=tf.int32)");
+  emit_line("inp = tf.constant(-1, name='inp')");
+  emit_line("");
+  emit_line("def read_input(inp):");
+  inc_indent();
+  emit_line("global INPUT");
+  emit_line("global INPUT_LEN");
+  emit_line("inp = inp + tf.constant(1)");
+  emit_line("r = tf.cond(tf.less(inp, INPUT_LEN),"
+            " lambda: INPUT[inp], lambda: tf.constant(0))");
+  emit_line("r.set_shape(())");
+  emit_line("return r, inp");
+  dec_indent();
+
+  emit_line("");
+  emit_line("@function.Defun(tf.int32, tf.int32)");
+  emit_line("def elvm_add(x, y):");
+  emit_line("  return (x + y) %% 16777216");
+  emit_line("");
+  emit_line("@function.Defun(tf.int32, tf.int32)");
+  emit_line("def elvm_sub(x, y):");
+  emit_line("  return (x - y + 16777216) %% 16777216");
+  emit_line("");
+  emit_line("@function.Defun(tf.int32, tf.int32, tf.int32)");
+  emit_line("def elvm_store(mem, x, y):");
+  emit_line("  return tf.concat(0, [mem[:y], [x], mem[y+1:]])");
+}
+
+static const char* tf_value_str(Value* v) {
+  if (v->type == REG) {
+    return reg_names[v->reg];
+  } else if (v->type == IMM) {
+    return format("tf.constant(%d)", v->imm);
+  } else {
+    error("invalid value");
+  }
+}
+
+static const char* tf_src_str(Inst* inst) {
+  return tf_value_str(&inst->src);
+}
+
+static const char* tf_cmp(Inst* inst) {
+  uint op = normalize_cond(inst->op, false);
+  static const char* OPS[] = {
+    "equal", "not_equal", "less", "greater", "less_equal", "greater_equal"
+  };
+  return format("tf.%s(%s, %s)",
+                OPS[op - JEQ], tf_value_str(&inst->dst), tf_src_str(inst));
+}
+
+static void tf_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("%s = %s", reg_names[inst->dst.reg], tf_src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("%s = elvm_add(%s, %s)",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], tf_src_str(inst));
+    emit_line("%s.set_shape(())", reg_names[inst->dst.reg]);
+    break;
+
+  case SUB:
+    emit_line("%s = elvm_sub(%s, %s)",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], tf_src_str(inst));
+    emit_line("%s.set_shape(())", reg_names[inst->dst.reg]);
+    break;
+
+  case LOAD:
+    emit_line("%s = mem[%s]", reg_names[inst->dst.reg], tf_src_str(inst));
+    // Workaround for .data, but I'm not sure why we need this.
+    // TODO: Remove this.
+    emit_line("%s.set_shape(())", reg_names[inst->dst.reg]);
+    break;
+
+  case STORE:
+    emit_line("mem = elvm_store(mem, %s, %s)",
+              reg_names[inst->dst.reg], tf_src_str(inst));
+    break;
+
+  case PUTC:
+    emit_line("out = out + CHAR_TBL[tf.mod(%s, 256)]", tf_src_str(inst));
+    emit_line("out.set_shape(())");
+    break;
+
+  case GETC:
+    emit_line("%s, inp = read_input(inp)",
+              reg_names[inst->dst.reg]);
+    break;
+
+  case EXIT:
+    emit_line("done = tf.constant(1)");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("%s = tf.cond(%s,"
+              " lambda: tf.constant(1), lambda: tf.constant(0))",
+              reg_names[inst->dst.reg], tf_cmp(inst));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    emit_line("pc = tf.cond(%s, lambda: %s - 1, lambda: pc)",
+              tf_cmp(inst), tf_value_str(&inst->jmp));
+    break;
+
+  case JMP:
+    emit_line("pc = %s - 1", tf_value_str(&inst->jmp));
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+static void tf_emit_func_epilogue(const char* args) {
+  emit_line("pc = pc + 1");
+  emit_line("return [%s]", args);
+  dec_indent();
+}
+
+void target_tf(Module* module) {
+  init_state_tf(module->data);
+
+  static const char STATE_ARGS_STR[] = "a,b,c,d,bp,sp,pc,done,mem,out,inp";
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      if (inst->pc) {
+        tf_emit_func_epilogue(STATE_ARGS_STR);
+      }
+      emit_line("");
+      emit_line("def pc_%d(%s):", inst->pc, STATE_ARGS_STR);
+      inc_indent();
+      emit_line("global CHAR_TBL");
+    }
+    prev_pc = inst->pc;
+    tf_emit_inst(inst);
+  }
+  tf_emit_func_epilogue(STATE_ARGS_STR);
+
+  emit_line("");
+  emit_line("def run_step(%s):", STATE_ARGS_STR);
+  inc_indent();
+  //emit_line("pc = tf.Print(pc, [pc])");
+  emit_line("fn_pairs = []");
+  for (int i = 0; i < prev_pc; i++) {
+    emit_line("fn_pairs.append((tf.equal(pc, %d), lambda: pc_%d(%s)))",
+              i, i, STATE_ARGS_STR);
+  }
+  emit_line("r = tf.case(fn_pairs, lambda: pc_%d(%s))",
+            prev_pc, STATE_ARGS_STR);
+  emit_line("r[8].set_shape([1<<24])");
+  emit_line("return r");
+  dec_indent();
+
+  emit_line("");
+  emit_line("loop = tf.while_loop(");
+  inc_indent();
+  emit_line("lambda %s: tf.equal(done, 0),", STATE_ARGS_STR);
+  emit_line("run_step,");
+  emit_line("loop_vars=[%s])", STATE_ARGS_STR);
+  dec_indent();
+
+  emit_line("");
+  emit_line("sess = tf.Session()");
+  emit_line("tf.train.write_graph(loop[9].graph.as_graph_def(),"
+            " '/tmp', 'graph.pbtxt')");
+  emit_line("tf.initialize_all_variables().run(session=sess)");
+  emit_line("r = sess.run(loop, feed_dict={INPUT: input})");
+
+  emit_line("");
+  emit_line("sys.stdout.write(r[9])");
+}
+#include <assert.h>
+#include <ctype.h>
+#include <ir/ir.h>
+#include <target/util.h>
+
+int tm_next_state;
+int tm_new_state() {
+  return tm_next_state++;
+}
+int tm_q_reject;
+
+/* The tape is laid out like this:
+     ^_00000...r_0_..._0_v_0_..._0_..._a_0_..._0_v_0_..._0_..._o000...0_...$
+       input   register    value       address   value         output
+
+   The blanks between the symbols are used as scratch space. */
+
+typedef enum {TM_BLANK, TM_START, TM_END, TM_ZERO, TM_ONE, TM_REGISTER, TM_ADDRESS, TM_VALUE, TM_OUTPUT, TM_SRC, TM_DST, TM_NUM_SYMBOLS} tm_symbol_t;
+const char *tm_symbol_names[] = {"_", "^", "$", "0", "1", "r", "a", "v", "o", "s", "d"};
+const int tm_bit[2] = {TM_ZERO, TM_ONE};
+
+const int tm_word_size = 24;
+
+typedef enum {
+  TM_SKIP_BEFORE_SRC = 1,
+  TM_SKIP_AFTER_SRC = 2,
+  TM_SKIP_BEFORE_DST = 4,
+  TM_SKIP_AFTER_DST = 8
+} tm_writemode_t;
+
+int tm_intcmp(int x, int y) {
+  if (x > y) return +1;
+  else if (x < y) return -1;
+  else return 0;
+}
+
+void tm_comment(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char* r = vformat(fmt, ap);
+  va_end(ap);
+  printf("// %s\n", r);
+}
+
+/* These functions take a start state and an accept state(s) as
+   arguments and, as a convenience, return the accept state. */
+
+/* Generate a transition from state q, read symbol a,
+   write symbol b, move in direction d, go to state r. */
+
+int tm_transition(int q, tm_symbol_t a, tm_symbol_t b, int d, int r) {
+  const char *dname;
+  if (d == -1)      dname = "L";
+  else if (d == 0)  dname = "N"; 
+  else if (d == +1) dname = "R";
+  else error("invalid direction %d", d);
+  emit_line("%d %s %d %s %s", 
+	    q, tm_symbol_names[a], 
+	    r, tm_symbol_names[b], dname);
+  return r;
+}
+
+/* Generate transitions to write symbol b and move in direction d,
+   regardless of input symbol. */
+
+int tm_write(int q, tm_symbol_t b, int d, int r) {
+  for (tm_symbol_t a=0; a<TM_NUM_SYMBOLS; a++)
+    tm_transition(q, a, b, d, r);
+  return r;
+}
+
+/* Generate write transitions that do one thing for symbol a, 
+   and another thing for all other symbols.
+
+   Returns the state for the latter case. */
+
+int tm_write_if(int q, 
+		tm_symbol_t a, int ba, int da, int ra,
+		tm_symbol_t b, int d, int r) {
+  for (tm_symbol_t s=0; s<TM_NUM_SYMBOLS; s++)
+    if (s == a) tm_transition(q, s, ba, da, ra); 
+    else        tm_transition(q, s, b, d, r);
+  return r;
+}
+
+int tm_write_if2(int q, 
+		 tm_symbol_t a1, int b1, int d1, int r1,
+		 tm_symbol_t a2, int b2, int d2, int r2,
+		 tm_symbol_t b, int d, int r) {
+  for (tm_symbol_t s=0; s<TM_NUM_SYMBOLS; s++)
+    if (s == a1)      tm_transition(q, s, b1, d1, r1); 
+    else if (s == a2) tm_transition(q, s, b2, d2, r2); 
+    else              tm_transition(q, s, b, d, r);
+  return r;
+}
+
+/* Generate transitions to move in direction d, regardless of input symbol. */
+
+int tm_move(int q, int d, int r) {
+  for (tm_symbol_t s=0; s<TM_NUM_SYMBOLS; s++)
+    tm_transition(q, s, s, d, r);
+  return r;
+}
+
+/* Generate move transitions that do one thing for symbol a, 
+   and another thing for all other symbols.
+
+   Returns the state for the latter case. */
+
+int tm_move_if(int q, 
+	       tm_symbol_t a, int da, int ra, 
+	       int d, int r) {
+  for (tm_symbol_t s=0; s<TM_NUM_SYMBOLS; s++)
+    if (s == a)      tm_transition(q, s, s, da, ra);
+    else             tm_transition(q, s, s, d, r);
+  return r;
+}
+
+/* Generate move transitions that do one thing for symbol a, 
+   another thing for symbol b,
+   and another thing for all other symbols.
+
+   Returns the state for the last case. */
+
+int tm_move_if2(int q, 
+		tm_symbol_t a, int da, int ra, 
+		tm_symbol_t b, int db, int rb, 
+		int d, int r) {
+  for (tm_symbol_t s=0; s<TM_NUM_SYMBOLS; s++)
+    if (s == a)      tm_transition(q, s, s, da, ra);
+    else if (s == b) tm_transition(q, s, s, db, rb);
+    else             tm_transition(q, s, s, d, r);
+  return r;
+}
+
+/* Generate transitions that just change state and do nothing else. */
+
+int tm_noop(int q, int r) { 
+  return tm_move(q, 0, r); 
+}
+
+/* Inserts a symbol and shifts existing tm_bits to the left/right until a
+   non-tm_bit is reached. Afterwards, the head is on the first
+   non-tm_bit. */
+
+int tm_insert(int q, tm_symbol_t a, int d, int r) {
+  int q0 = tm_new_state(), q1 = tm_new_state();
+  tm_write_if2(q,  TM_ZERO, a,    d, q0, TM_ONE, a,    d, q1, a,    d, r);
+  tm_write_if2(q0, TM_ZERO, TM_ZERO, d, q0, TM_ONE, TM_ZERO, d, q1, TM_ZERO, d, r);
+  tm_write_if2(q1, TM_ZERO, TM_ONE,  d, q0, TM_ONE, TM_ONE,  d, q1, TM_ONE,  d, r);
+  return r;
+}
+
+/* Generate transitions to write a binary number,
+   leaving a scratch cell before each tm_bit. */
+
+int tm_write_tm_bits(int q, unsigned int x, int n, int mode, int r) {
+  for (int i=n-1; i>=0; i--) {
+    if (mode & TM_SKIP_BEFORE_DST)
+      q = tm_move(q, +1, tm_new_state());
+    q = tm_write(q, (1<<i)&x?TM_ONE:TM_ZERO, +1, tm_new_state());
+    if (mode & TM_SKIP_AFTER_DST)
+      q = tm_move(q, +1, tm_new_state());
+  }
+  return tm_noop(q, r);
+}
+
+int tm_erase_tm_bits(int q, int r) {
+  int erase = q, skip = tm_new_state();
+  tm_write_if2(erase, TM_ZERO, TM_BLANK, +1, skip, TM_ONE, TM_BLANK, +1, skip, TM_BLANK, 0, r);
+  tm_move(skip, +1, erase);
+  return r;
+}
+
+/* Generate transitions to search in direction d for symbol a,
+   or until the end of the used portion of the tape is reached. */
+
+int tm_find(int q, int d, int a, int r_yes, int r_no) {
+  tm_symbol_t marker = d < 0 ? TM_START : TM_END;
+  tm_move_if2(q, a, 0, r_yes, marker, 0, r_no, d, q);
+  return r_yes;
+}
+
+/* Generate transitions to move to the left or right end of the tape. */
+
+int tm_rewind(int q, int r) { 
+  tm_move_if(q, TM_START, 0, r, -1, q);
+  return r;
+}
+
+int tm_ffwd(int q, int r) { 
+  tm_move_if(q, TM_END, 0, r, +1, q);
+  return r;
+}
+
+/* Generate transitions to find register reg or address addr. The head
+   ends on the scratch cell to the left of the corresponding value. */
+
+int tm_find_location(int q, tm_symbol_t type, int addr, int width, int r_found, int r_notfound) {
+  int qstart = q;
+  q = tm_find(q, +1, type, tm_new_state(), r_notfound);   // _[r]_0_1 ... _v_0_1
+  q = tm_move(q, +1, tm_new_state());                     // _r[_]0_1 ... _v_0_1
+  for (int i=width-1; i>=0; i--) {
+    q = tm_move(q, +1, tm_new_state());                   // _r_[0]_1 ... _v_0_1
+    tm_symbol_t tm_bit = (1<<i)&addr ? TM_ONE : TM_ZERO;
+    int q_match = tm_new_state();
+    tm_move_if(q,
+	       tm_bit, +1, q_match,                       // _r_0[_]1 ... _v_0_1
+	       +1, qstart);
+    q = q_match;
+  }
+  q = tm_move(q, +1, tm_new_state());                     // _r_0_1 ... _[v]_0_1
+  tm_move_if(q,
+	     TM_VALUE, +1, r_found,                       // _r_0_1 ... _v[_]0_1
+	     0, tm_q_reject);
+  return r_found;
+}
+
+int tm_new_location(int q, tm_symbol_t type, int addr, int awidth, int val, int r) {
+  q = tm_ffwd(q, tm_new_state());
+  q = tm_write(q, type, +1, tm_new_state());
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_write_tm_bits(q, addr, awidth, TM_SKIP_AFTER_DST, tm_new_state());
+  q = tm_write(q, TM_VALUE, +1, tm_new_state());
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_write_tm_bits(q, val, tm_word_size, TM_SKIP_AFTER_DST, tm_new_state());
+  return tm_write(q, TM_END, -1, r);
+}
+
+int tm_find_register(int q, Reg reg, int r) {
+  q = tm_rewind(q, tm_new_state()); // to do: can be slow if input is long
+  return tm_find_location(q, TM_REGISTER, reg, 3, r, tm_q_reject);
+}
+
+int tm_find_memory(int q, int addr, int r) {
+  q = tm_rewind(q, tm_new_state()); // to do: can be slow if input is long
+  int q_append = tm_new_state();
+  tm_find_location(q, TM_ADDRESS, addr, tm_word_size, r, q_append);
+  q = tm_new_location(q_append, TM_ADDRESS, addr, tm_word_size, 0, tm_new_state());
+  q = tm_find(q, -1, TM_VALUE, tm_new_state(), tm_q_reject);
+  tm_move(q, +1, r);
+  return r;
+}
+
+/* Copy tm_bits from current position to the position marked by TM_DST.
+
+   The head starts on the scratch cell to the left of the source word,
+   and ends on the cell to the right of the destination word (which is
+   erased). */
+
+int tm_copy(int q, int d, unsigned int mode, int r) {
+  // The examples show mode == TM_SKIP_BEFORE_SRC|TM_SKIP_AFTER_DST.
+  int q_store[2] = {tm_new_state(), tm_new_state()};
+  int q_cleansrc = tm_new_state(), q_cleandst = tm_new_state();
+  int q_nexttm_bit = q;                                  
+
+  if (mode & TM_SKIP_BEFORE_SRC) {
+    // Write TM_SRC, then store tm_bit
+                                                        // [_]0_1 ... d_x
+    q = tm_write(q, TM_SRC, 0, tm_new_state());               // [s]0_1 ... d_x
+    q = tm_move(q, +1, tm_new_state());                    // s[0]_1 ... d_x
+    tm_move_if2(q,
+		TM_ZERO, 0, q_store[0],                    // s[0]_1 ... d_x
+		TM_ONE,  0, q_store[1],
+		0, q_cleansrc);
+  } else {
+    // Store tm_bit, then write TM_SRC
+    tm_write_if2(q, 
+		 TM_ZERO, TM_SRC, 0, q_store[0], 
+		 TM_ONE, TM_SRC, 0, q_store[1], 
+		 TM_BLANK, 0, q_cleandst);
+  }
+  int q_write = tm_new_state();
+  for (int b=0; b<2; b++) {
+    q = q_store[b];
+    q = tm_find(q, d, TM_DST, tm_new_state(), tm_q_reject);    // s0_1 ... [d]_x
+    if (mode & TM_SKIP_BEFORE_DST)
+      q = tm_write(q, TM_BLANK, +1, tm_new_state());
+    tm_write(q, tm_bit[b], +1, q_write);                 // s0_1 ... 0[_]x
+  }
+  q = q_write;
+  if (mode & TM_SKIP_AFTER_DST)
+    q = tm_move(q, +1, tm_new_state());                  // s0_1 ... 0[_]x
+  q = tm_write(q, TM_DST, 0, tm_new_state());               // s0_1 ... 0[d]x
+  q = tm_find(q, -d, TM_SRC, tm_new_state(), tm_q_reject);     // [s]0_1 ... 0dx
+  q = tm_write(q, TM_BLANK, +1, tm_new_state());            // _[0]_1 ... 0dx
+  if (mode & (TM_SKIP_BEFORE_SRC|TM_SKIP_AFTER_SRC))
+    tm_move(q, +1, q_nexttm_bit);                        // _0[_]1 ... 0dx
+  else
+    tm_noop(q, q_nexttm_bit);
+
+  q = q_cleansrc;
+  q = tm_move(q, -1, tm_new_state());
+  q = tm_write(q, TM_BLANK, 0, q_cleandst);
+  q = tm_find(q, d, TM_DST, tm_new_state(), tm_q_reject);
+  return tm_write(q, TM_BLANK, 0, r);
+}
+
+/* Gets value from inst->src and copies it to inst->dst with mode
+   indicated by mode. */
+
+int tm_copy_value(int q, Inst *inst, int mode, int r) {
+  assert(inst->dst.type == REG);
+  q = tm_find_register(q, inst->dst.reg, tm_new_state()); // v[_]x_x...
+  if (inst->src.type == REG) {
+    if (inst->dst.reg == inst->src.reg) {
+      if (mode == TM_SKIP_AFTER_DST) {
+	// Copy each tm_bit to the cell to its left
+	int q_end = tm_new_state(), q_next = q;
+	q = tm_move(q, +1, tm_new_state());
+	tm_move_if2(q, TM_ZERO, +1, q_next, TM_ONE, +1, q_next, -1, q_end);
+	q = q_end;
+	q = tm_move(q, -1, tm_new_state());
+	q_next = q;
+	int q0 = tm_new_state(), q1 = tm_new_state();
+	q_end = tm_new_state();
+	tm_move_if2(q, TM_ZERO, -1, q0, TM_ONE, -1, q1, +1, q_end);
+	tm_write(q0, TM_ZERO, -1, q_next);
+	tm_write(q1, TM_ONE,  -1, q_next);
+	q = q_end;
+	tm_move_if2(q, TM_ZERO, +1, q, TM_ONE, +1, q, 0, r);
+      } else {
+	// Do nothing
+	tm_noop(q, r);
+      }
+    } else {
+      q = tm_write(q, TM_DST, -1, tm_new_state());
+      q = tm_find_register(q, inst->src.reg, tm_new_state());
+      q = tm_copy(q, tm_intcmp(inst->dst.reg, inst->src.reg), TM_SKIP_BEFORE_SRC|mode, r);
+    }
+  } else if (inst->src.type == IMM) {
+    q = tm_write_tm_bits(q, inst->src.imm, tm_word_size, mode, r);
+  } else
+    error("invalid src type");
+  return r;
+}
+
+/* Add/subtract binary number in scratch cells to/from binary number
+   in main cells, while erasing the scratch cells. */
+
+int tm_addsub(int q, int c, int r) {
+  assert (c == -1 || c == +1);
+
+  // Go to end of numbers
+  int q_end = tm_new_state();
+  q = tm_move_if2(q, TM_ZERO, +1, q, TM_ONE, +1, q, -1, q_end);
+
+  // Perform the operation, putting result in scratch cells
+
+  // Carry tm_bit
+  int carry[2] = {q, tm_new_state()};
+  if (c == -1) { int tmp = carry[0]; carry[0] = carry[1]; carry[1] = tmp; }
+
+  // Carry tm_bit plus tm_bit from first number
+  int inter[3] = {tm_new_state(), tm_new_state(), tm_new_state()};
+
+  int q_shift = tm_new_state();
+  for (int a=0; a<2; a++) {
+    tm_transition(carry[a], TM_ZERO,  TM_BLANK, -1, inter[a]);
+    tm_transition(carry[a], TM_ONE,   TM_BLANK, -1, inter[a+1]);
+    tm_transition(carry[a], TM_VALUE, TM_VALUE, +1, q_shift);
+  }
+  for (int a=0; a<3; a++)
+    for (int b=0; b<2; b++) {
+      tm_transition(inter[a], tm_bit[c == +1 ? b : !b], tm_bit[(a+b)&1], -1, carry[(a+b)>>1]);
+    }
+  c = 0;
+
+  // Shift scratch cells to main cells
+  int q0 = tm_new_state(), q1 = tm_new_state();
+  q = q_shift;
+  tm_write_if2(q, TM_ZERO, TM_BLANK, +1, q0, TM_ONE, TM_BLANK, +1, q1, TM_BLANK, 0, r);
+  q0 = tm_write(q0, TM_ZERO, +1, q);
+  q1 = tm_write(q1, TM_ONE,  +1, q);
+  return r;
+}
+
+/* Compare binary number in scratch cells to binary number in main
+   cells, while erasing the scratch cells. */
+
+int tm_compare(int q, Op op, int r_true, int r_false) {
+  int q_lt, q_eq, q_gt;
+  switch (op) {
+  case JEQ: case EQ: q_lt = r_false; q_eq = r_true;  q_gt = r_false; break;
+  case JNE: case NE: q_lt = r_true;  q_eq = r_false; q_gt = r_true;  break;
+  case JLT: case LT: q_lt = r_true;  q_eq = r_false; q_gt = r_false; break;
+  case JGE: case GE: q_lt = r_false; q_eq = r_true;  q_gt = r_true;  break;
+  case JGT: case GT: q_lt = r_false; q_eq = r_false; q_gt = r_true;  break;
+  case JLE: case LE: q_lt = r_true;  q_eq = r_true;  q_gt = r_false; break;
+  default: error("invalid comparison operation");
+  }
+
+  int q_nexttm_bit = q;
+  int q0 = tm_new_state(), q1 = tm_new_state();
+  int erase_gt = tm_new_state(), erase_lt = tm_new_state();
+  tm_write_if2(q, TM_ZERO, TM_BLANK, +1, q0, TM_ONE, TM_BLANK, +1, q1, TM_BLANK, 0, q_eq);
+  tm_move_if2(q0, TM_ZERO, +1, q_nexttm_bit, TM_ONE, +1, erase_gt, 0, tm_q_reject);
+  tm_move_if2(q1, TM_ZERO, +1, erase_lt, TM_ONE, +1, q_nexttm_bit, 0, tm_q_reject);
+  tm_erase_tm_bits(erase_lt, q_lt);
+  tm_erase_tm_bits(erase_gt, q_gt);
+  return r_true;
+}
+
+/* Test whether main cells are equal to scratch cells, without erasing
+   scratch cells. */
+
+int tm_equal(int q, int r_eq, int r_ne) {
+  int q_nexttm_bit = q;
+  int q0 = tm_new_state(), q1 = tm_new_state();
+  tm_move_if2(q, TM_ZERO, +1, q0, TM_ONE, +1, q1, 0, r_eq);
+  tm_move_if2(q0, TM_ZERO, +1, q_nexttm_bit, TM_ONE, +1, r_ne, 0, tm_q_reject);
+  tm_move_if2(q1, TM_ZERO, +1, r_ne, TM_ONE, +1, q_nexttm_bit, 0, tm_q_reject);
+  return r_eq;
+}
+
+/* Reads address from current location on tape, and finds the memory
+   location with that address, creating a new memory location if
+   necessary. */
+
+int tm_find_memory_indirect(int q, int reg, int r) {
+  // mark first address as TM_DST
+  int q_append = tm_new_state();
+  q = tm_find(q, +1, TM_ADDRESS, tm_new_state(), q_append);
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_write(q, TM_DST, -1, tm_new_state());
+  q = tm_find_register(q, reg, tm_new_state());
+
+  q = tm_copy(q, +1, TM_SKIP_BEFORE_SRC|TM_SKIP_AFTER_DST, tm_new_state()); // _axyxyxy...[_]v_z_z_z...
+
+  // compare addresses
+  int q_nextaddr = tm_new_state();
+  int q_compare = q;
+  q = tm_find(q, -1, TM_ADDRESS, tm_new_state(), tm_q_reject);
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_equal(q, tm_new_state(), q_nextaddr);
+
+  // if equal: move right to value
+  q = tm_move(q, +1, tm_new_state());
+  tm_move(q, +1, r);
+
+  // if not equal: 
+  // mark next address as TM_DST
+  q = q_nextaddr;
+  q = tm_find(q, +1, TM_ADDRESS, tm_new_state(), q_append);
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_write(q, TM_DST, -1, tm_new_state());
+
+  // return to previous address
+  q = tm_move(q, -1, tm_new_state());
+  q = tm_move(q, -1, tm_new_state());
+  q = tm_find(q, -1, TM_ADDRESS, tm_new_state(), tm_q_reject);
+  q = tm_move(q, +1, tm_new_state());
+  
+  // move address
+  tm_copy(q, +1, TM_SKIP_AFTER_SRC|TM_SKIP_AFTER_DST, q_compare);
+
+  // if no more addresses: create new memory location
+  q = q_append;
+  q = tm_write(q, TM_ADDRESS, +1, tm_new_state());
+  q = tm_write(q, TM_DST, -1, tm_new_state());
+  q = tm_move(q, -1, tm_new_state());
+  q = tm_find(q, -1, TM_ADDRESS, tm_new_state(), tm_q_reject);
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_copy(q, +1, TM_SKIP_AFTER_SRC|TM_SKIP_BEFORE_DST, tm_new_state());
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_write(q, TM_VALUE, +1, tm_new_state());
+  q = tm_write_tm_bits(q, 0, tm_word_size, TM_SKIP_BEFORE_DST, tm_new_state());
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_write(q, TM_END, -1, tm_new_state());
+  q = tm_find(q, -1, TM_VALUE, tm_new_state(), tm_q_reject);
+  tm_move(q, +1, r);
+  return r;
+}
+
+/* Create the trie node corresponding to the first (tm_word_size-h) tm_bits of i.
+   Returns the trie node.
+ */
+
+int tm_make_jmpreg(int pc_max, int h, int i) {
+  if (h == 0) {
+    return i;
+  } else {
+    int q_new = tm_new_state();
+    int q = tm_transition(q_new, TM_BLANK, TM_BLANK, +1, tm_new_state());
+    int q0 = tm_make_jmpreg(pc_max, h-1, i);
+    tm_transition(q, TM_ZERO, TM_ZERO, +1, q0);
+    if (i+(1<<(h-1)) <= pc_max) {
+      int q1 = tm_make_jmpreg(pc_max, h-1, i + (1<<(h-1)));
+      tm_transition(q, TM_ONE, TM_ONE, +1, q1);
+    }
+    return q_new;
+  }
+}
+
+void target_tm(Module* module) {
+  /* Every basic block's entry point is the state with the same number
+     as its pc. Additional states are numbered starting after the
+     highest pc. */
+  int pc_max = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next)
+    if (inst->pc >= pc_max)
+      pc_max = inst->pc;
+  tm_next_state = pc_max+1;
+  tm_q_reject = tm_new_state();
+
+  tm_comment("trie for jmp reg");
+  int q_jmpreg = tm_make_jmpreg(pc_max, tm_word_size, 0);
+
+  int q = 0; // start state (pc 0)
+
+  tm_comment("beginning-of-tape and input string");
+
+  // Insert TM_START and a single scratch cell before input string
+  q = tm_insert(q, TM_START, +1, tm_new_state());
+  q = tm_rewind(q, tm_new_state());
+  q = tm_move(q, +1, tm_new_state());
+  q = tm_insert(q, TM_BLANK, +1, tm_new_state());
+  q = tm_write(q, TM_END, 0, tm_new_state());
+
+  // Initialize registers
+  for (Reg reg=0; reg<6; reg++) {
+    tm_comment("register %s value 0", reg_names[reg]);
+    q = tm_new_location(q, TM_REGISTER, reg, 3, 0, tm_new_state());
+  }
+
+  // Initialize memory
+  Data *data = module->data;
+  int mp = 0;
+  while (data) {
+    if (0 <= data->v && data->v < 128 && isprint(data->v))
+      tm_comment("address %d value %d '%c'", mp, data->v, data->v);
+    else
+      tm_comment("address %d value %d", mp, data->v);
+    q = tm_new_location(q, TM_ADDRESS, mp, tm_word_size, data->v, tm_new_state());
+    data = data->next;
+    mp++;
+  }
+  q = tm_write(q, TM_BLANK, +1, tm_new_state());
+  q = tm_write(q, TM_END, -1, tm_new_state());
+  q = tm_rewind(q, tm_new_state());
+
+  int prev_pc = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    printf("// "); dump_inst_fp(inst, stdout);
+
+    // If new pc, transition to state corresponding to new pc
+    if (inst->pc != prev_pc && q != inst->pc)
+      q = tm_noop(q, inst->pc);
+    prev_pc = inst->pc;
+
+    q = tm_rewind(q, tm_new_state());
+
+    switch (inst->op) {
+
+    case MOV:
+      q = tm_copy_value(q, inst, TM_SKIP_BEFORE_DST, tm_new_state());
+      break;
+
+    case ADD:
+    case SUB:
+      q = tm_copy_value(q, inst, TM_SKIP_AFTER_DST, tm_new_state());
+      // ok not to go to beginning of value
+      if (inst->op == ADD)
+	q = tm_addsub(q, +1, tm_new_state());
+      else if (inst->op == SUB)
+	q = tm_addsub(q, -1, tm_new_state());
+      break;
+
+    case LOAD:
+      assert (inst->dst.type == REG);
+      if (inst->src.type == REG) {
+	q = tm_find_memory_indirect(q, inst->src.reg, tm_new_state());
+      } else if (inst->src.type == IMM) {
+	q = tm_find_memory(q, inst->src.imm, tm_new_state());
+      } else
+	error("invalid src type");
+      q = tm_write(q, TM_SRC, -1, tm_new_state());
+      q = tm_find_register(q, inst->dst.reg, tm_new_state());
+      q = tm_write(q, TM_DST, +1, tm_new_state());
+      q = tm_move(q, +1, tm_new_state());
+      q = tm_find(q, +1, TM_SRC, tm_new_state(), tm_q_reject);
+      q = tm_copy(q, -1, TM_SKIP_BEFORE_SRC|TM_SKIP_BEFORE_DST, tm_new_state());
+      break;
+
+    case STORE:
+      assert (inst->dst.type == REG);
+      if (inst->src.type == REG) {
+	q = tm_find_memory_indirect(q, inst->src.reg, tm_new_state());
+      } else if (inst->src.type == IMM) {
+	q = tm_find_memory(q, inst->src.imm, tm_new_state());
+      } else
+	error("invalid dst type");
+      q = tm_write(q, TM_DST, -1, tm_new_state());
+      q = tm_move(q, +1, tm_new_state());
+      q = tm_find_register(q, inst->dst.reg, tm_new_state());
+      q = tm_copy(q, +1, TM_SKIP_BEFORE_SRC|TM_SKIP_BEFORE_DST, tm_new_state());
+      break;
+
+    case GETC:
+      // Mark last 8 tm_bits of register as TM_DST
+      assert (inst->dst.type == REG);
+      q = tm_find_register(q, inst->dst.reg, tm_new_state());
+      q = tm_write_tm_bits(q, 0, tm_word_size-8, TM_SKIP_BEFORE_DST, tm_new_state());
+      q = tm_write(q, TM_DST, -1, tm_new_state());
+
+      // Copy next 8 tm_bits of input, if any
+      int q_eof = tm_new_state(), q_done = tm_new_state();
+      q = tm_rewind(q, tm_new_state());
+      q = tm_move(q, +1, tm_new_state()); // ^[_]...
+      q = tm_move_if(q, TM_BLANK, +1, q, 0, tm_new_state()); // ...[0] or ...[r]
+      q = tm_move_if(q, TM_REGISTER, 0, q_eof, +1, tm_new_state());
+      for (int i=0; i<6; i++)
+	q = tm_move(q, +1, tm_new_state());
+      q = tm_insert(q, TM_BLANK, -1, tm_new_state());
+      q = tm_move(q, +1, tm_new_state());
+      q = tm_copy(q, +1, TM_SKIP_BEFORE_DST, q_done);
+
+      // Go back to TM_DST and write zero byte indicating EOF
+      q = q_eof;
+      q = tm_find(q, +1, TM_DST, tm_new_state(), tm_q_reject);
+      q = tm_write(q, TM_BLANK, 0, tm_new_state());
+      q = tm_write_tm_bits(q, 0, 8, TM_SKIP_BEFORE_DST, q_done);
+
+      q = q_done;
+      
+      break;
+
+    case PUTC:
+      q = tm_ffwd(q, tm_new_state());
+      q = tm_write(q, TM_OUTPUT, +1, tm_new_state());
+      if (inst->src.type == REG) {
+	q = tm_write(q, TM_DST, -1, tm_new_state());
+	q = tm_find_register(q, inst->src.reg, tm_new_state());
+	for (int i=0; i<(tm_word_size-8)*2; i++)
+	  q = tm_move(q, +1, tm_new_state());
+	q = tm_copy(q, +1, TM_SKIP_BEFORE_SRC, tm_new_state());
+      } else if (inst->src.type == IMM) {
+	q = tm_write_tm_bits(q, inst->src.imm, 8, 0, tm_new_state());
+      } else
+	error("invalid src type");
+      q = tm_write(q, TM_BLANK, +1, tm_new_state());
+      q = tm_write(q, TM_END, 0, tm_new_state());
+      break;
+
+    case EXIT:
+      // Consolidate output segments
+      q = tm_write(q, TM_DST, +1, tm_new_state());
+      int q_clear = tm_new_state();
+      int q_findo = q;
+      q = tm_find(q, +1, TM_OUTPUT, tm_new_state(), q_clear);
+      q = tm_write(q, TM_BLANK, +1, tm_new_state());
+      q = tm_copy(q, -1, 0, tm_new_state());
+      tm_write(q, TM_DST, +1, q_findo);
+
+      // Clear rest of tape
+      q_clear = tm_ffwd(q_clear, tm_new_state());
+      tm_write_if(q_clear, TM_DST, TM_BLANK, 0, -1, TM_BLANK, -1, q_clear);
+      q = tm_new_state();
+      break;
+
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGE:
+    case JGT:
+    case JLE:
+      q = tm_copy_value(q, inst, TM_SKIP_AFTER_DST, tm_new_state());
+      q = tm_find(q, -1, TM_VALUE, tm_new_state(), tm_q_reject);
+      q = tm_move(q, +1, tm_new_state());
+      if (inst->jmp.type == REG)
+	error("jmp reg not implemented");
+      else if (inst->jmp.type == IMM) {
+	int q_false = tm_new_state();
+	tm_compare(q, inst->op, inst->jmp.imm, q_false);
+	q = q_false;
+      } else
+	error("invalid jmp type");
+      break;
+
+    case JMP:
+      if (inst->jmp.type == REG)
+	tm_find_register(q, inst->jmp.reg, q_jmpreg);
+      else if (inst->jmp.type == IMM)
+	tm_noop(q, inst->jmp.imm);
+      else
+	error("invalid jmp type");
+      q = tm_new_state();
+      break;
+
+    case EQ:
+    case NE:
+    case LT:
+    case GE:
+    case GT:
+    case LE:
+      q = tm_copy_value(q, inst, TM_SKIP_AFTER_DST, tm_new_state());
+      q = tm_find(q, -1, TM_VALUE, tm_new_state(), tm_q_reject);
+      q = tm_move(q, +1, tm_new_state());
+      int qt = tm_new_state(), qf = tm_new_state();
+      q = tm_compare(q, inst->op, qt, qf);
+      q = tm_new_state();
+      qf = tm_find(qf, -1, TM_VALUE, tm_new_state(), tm_q_reject);
+      qf = tm_move(qf, +1, tm_new_state());
+      qf = tm_write_tm_bits(qf, 0, tm_word_size, TM_SKIP_BEFORE_DST, q);
+      qt = tm_find(qt, -1, TM_VALUE, tm_new_state(), tm_q_reject);
+      qt = tm_move(qt, +1, tm_new_state());
+      qt = tm_write_tm_bits(qt, 1, tm_word_size, TM_SKIP_BEFORE_DST, q);
+      break;
+
+    case DUMP:
+      break;
+
+    default:
+      error("invalid operation");
+    }
+  }
+}
+#include <stdio.h>
+#include <ir/ir.h>
+#include <target/util.h>
+#include <target/unlcore.h>
+
+static const char S2[] = "``s";
+static const char K1[] = "`k";
+static const char CONS[] = "``s``s`ks``s`kk``s`ks``s`k`sik`kk";
+static const char CAR[] = "``si`kk";
+static const char CDR[] = "``si`k`ki";
+static const char DOTCAR[] = "k";   // (x DOTCAR) = (CAR x)
+
+// (CONS_KI x) = (cons (K I) x)
+static const char CONS_KI[] = "``s`k`s``si`k`kik";
+
+// (CONS_K x) = (cons K x)
+static const char CONS_K[] = "``s`k`s``si`kkk";
+
+// (APPLY_CDR f lst) = (cons (car lst) (f (cdr lst)))
+static const char APPLY_CDR[] = "``s`k`si``s`kk``s`k`s``s`ks``s`kk``s`ks``s`k`sik``s`kk`s`kk";
+
+// (REPLACE_CAR x lst) = (cons x (cdr lst))
+static const char REPLACE_CAR[] = "``s`k`si``s`kk``s`kk``s`k`s``s`k`s``s`ks``s`k`sik``s`kkkk";
+
+// ([REPLACE_CAR1 + <expr>] lst) = (cons <expr> (cdr lst))
+static const char REPLACE_CAR1[] = "``si`k`k``s``s`k`s``s`ks``s`k`sik``s`kkk`k";
+
+// (COMPOSE f g x) = (f (g x))
+static const char COMPOSE[] = "``s`ksk";
+
+// (n POST_INC) = n+1
+static const char POST_INC[] = "```sii``s``s`ks``s`k`si``s`kk``s`k`s`k``s`k`s``si`k`kik``s`k`si``s``s`kskk`k`k``s`k`s``si`kkk";
+
+// (n POST_DEC) = n-1
+static const char POST_DEC[] = "```sii``s`k`s``si`k``s`k`s``si`k`kik``s`kk``s`k`s`k``s`k`s``si`kkk``s`k`si``s``s`kskk";
+
+// Church numers up to 24
+static const char* CHURCHNUM[] = {
+  "`ki",
+  "i",
+  "``s``s`kski",
+  "```ss``ss`ki``s`ksk",
+  "``ci``s``s`kski",
+  "``s``s`ksk``ci``s``s`kski",
+  "```ss``ss`k``ci``s``s`kski``s`ksk",
+  "```ss``ss``ss`k``ci``s``s`kski``s`ksk",
+  "```s``s`ksk`ci``s``s`kski",
+  "````ss`ss``ss`ki``s`ksk",
+  "```ss```ss`ss``ss`ki``s`ksk", // 10
+  "```ss``ss```ss`ss``ss`ki``s`ksk",
+  "```ss``ss``ss```ss`ss``ss`ki``s`ksk",
+  "```ss``ss``ss``ss```ss`ss``ss`ki``s`ksk",
+  "```ss``ss``ss``ss``ss```ss`ss``ss`ki``s`ksk",
+  "```ss``ss``ss``ss``ss``ss```ss`ss``ss`ki``s`ksk",
+  "```s`cii``s``s`kski",
+  "``s``s`ksk```s`cii``s``s`kski",
+  "```ss``ss`k```s`cii``s``s`kski``s`ksk",
+  "```ss``ss``ss`k```s`cii``s``s`kski``s`ksk",
+  "````sss``s`ksk``ci``s``s`kski", // 20
+  "```ss``s``sss`k``ci``s``s`kski``s`ksk",
+  "```ss``ss``s``sss`k``ci``s``s`kski``s`ksk",
+  "```ss``ss``ss``s``sss`k``ci``s``s`kski``s`ksk",
+  "```s``si``s`ci`k`s``s`ksk``s`cii``s``s`kski",
+};
+
+typedef enum {
+  UNL_PC = 0, UNL_A, UNL_B, UNL_C, UNL_D, UNL_BP, UNL_SP
+} UnlReg;
+
+static UnlReg unl_regpos(Reg r) {
+  switch (r) {
+  case A: return UNL_A;
+  case B: return UNL_B;
+  case C: return UNL_C;
+  case D: return UNL_D;
+  case BP: return UNL_BP;
+  case SP: return UNL_SP;
+  default:
+    error("unknown reg: %d", r);
+  }
+}
+
+static void unl_emit(const char* s) {
+  fputs(s, stdout);
+}
+
+static void unl_emit_tick(int n) {
+  for (int i = 0; i < n; i++) {
+    putchar('`');
+  }
+}
+
+static void unl_list_begin(int is_first) {
+  if (!is_first)
+    unl_emit(K1);
+  unl_emit("``s``si`k");
+}
+
+static void unl_list_end(void) {
+  putchar('v');
+}
+
+static void unl_emit_churchnum(int n) {
+  if (n > 24)
+    error("churchnum table out of range: %d", n);
+  unl_emit(CHURCHNUM[n]);
+}
+
+static void unl_emit_number(int n) {
+  for (int i = 0; i < 24; i++) {
+    unl_list_begin(i == 0);
+    unl_emit(n % 2 ? "k" : "`ki");
+    n /= 2;
+  }
+  unl_list_end();
+}
+
+// Compact, but less efficient
+static void unl_emit_number2(int n) {
+  int all_one = UINT_MAX;
+  for (int i = 0; i < 24; i++) {
+    if (i < 23 && n == 0) {
+      if (i > 0) {
+	unl_emit(K1);
+      }
+      unl_emit_tick(2);
+      unl_emit_churchnum(24 - i);
+      unl_emit(CONS_KI);
+      break;
+    } else if (i < 23 && n == all_one) {
+      if (i > 0) {
+	unl_emit(K1);
+      }
+      unl_emit_tick(2);
+      unl_emit_churchnum(24 - i);
+      unl_emit(CONS_K);
+      break;
+    } else {
+      unl_list_begin(i == 0);
+      unl_emit(n % 2 ? "k" : "`ki");
+      n /= 2;
+      all_one /= 2;
+    }
+  }
+  unl_list_end();
+}
+
+static void unl_nth_begin(int n) {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit(K1);
+  unl_emit("`");
+  unl_emit_churchnum(n);
+  unl_emit(CDR);
+}
+
+static void unl_nth_end(void) {
+  unl_emit(K1);
+  unl_emit(DOTCAR);
+}
+
+typedef enum {
+  LIB_ADD = 2,
+  LIB_SUB,
+  LIB_EQ,
+  LIB_LT,
+  LIB_LOAD,
+  LIB_STORE,
+  LIB_PUTC,
+  LIB_GETC
+} LibNo;
+
+static void unl_emit_lib(LibNo n) {
+  unl_emit(S2);
+  unl_emit("`");
+  unl_emit_churchnum(n);
+  unl_emit(CDR);
+  unl_emit(K1);
+  unl_emit(DOTCAR);
+}
+
+static void unl_lib_add() {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit_lib(LIB_ADD);
+}
+
+static void unl_lib_sub() {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit_lib(LIB_SUB);
+}
+
+static void unl_lib_eq() {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit_lib(LIB_EQ);
+}
+
+static void unl_lib_lt() {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit_lib(LIB_LT);
+}
+
+static void unl_lib_load() {
+  unl_emit(S2);
+
+  unl_emit(S2);
+  unl_emit_lib(LIB_LOAD);
+  putchar('i');
+}
+
+static void unl_lib_store() {
+  unl_emit(S2);
+  unl_emit(S2);
+
+  unl_emit(S2);
+  unl_emit_lib(LIB_STORE);
+  putchar('i');
+}
+
+static void unl_lib_putc() {
+  unl_emit(S2);
+  unl_emit_lib(LIB_PUTC);
+}
+
+static void unl_lib_getc() {
+  unl_emit(S2);
+  unl_emit("`kc");
+  unl_emit_lib(LIB_GETC);
+}
+
+static void unl_getreg(Reg reg) {
+  unl_nth_begin(unl_regpos(reg));
+  unl_emit(CAR);  // regs = car(vm)
+  unl_nth_end();
+}
+
+static void unl_emit_value(Value* val) {
+  if (val->type == REG) {
+    unl_getreg(val->reg);
+  } else {
+    unl_emit(K1);
+    unl_emit_number(val->imm);
+  }
+}
+
+static void unl_setreg_begin(UnlReg reg) {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit(K1);
+  unl_emit(CONS);
+  unl_emit(S2);
+
+  unl_emit(S2);
+  unl_emit(K1);
+  unl_emit_tick(1);
+  unl_emit_churchnum(reg);
+  unl_emit(APPLY_CDR);
+  unl_emit(S2);
+  unl_emit(K1);
+  unl_emit(REPLACE_CAR);
+}
+
+static void unl_setreg_end(void) {
+  unl_emit(CAR);
+  unl_emit(CDR);
+}
+
+static void unl_setreg_imm(UnlReg reg, int n) {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit(K1);
+  unl_emit(CONS);
+  unl_emit(S2);
+
+  unl_emit(K1);
+  unl_emit_tick(2);
+  unl_emit_churchnum(reg);
+  unl_emit(APPLY_CDR);
+  unl_emit(REPLACE_CAR1);
+  unl_emit_number(n);
+
+  unl_emit(CAR);
+  unl_emit(CDR);
+}
+
+static void unl_emit_jmp(Value* jmp) {
+  if (jmp->type == REG) {
+    unl_setreg_begin(UNL_PC);
+    unl_getreg(jmp->reg);
+    unl_setreg_end();
+  } else {
+    unl_setreg_imm(UNL_PC, jmp->imm);
+  }
+}
+
+static void unl_bool_to_number_begin(void) {
+  unl_emit(S2);
+  unl_emit(S2);
+  unl_emit(K1);
+  unl_emit(CONS);
+}
+
+static void unl_bool_to_number_end(void) {
+  unl_emit(K1);
+  unl_emit_tick(2);
+  unl_emit_churchnum(23);
+  unl_emit(CONS_KI);
+  putchar('v');
+}
+
+static void unl_emit_op(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    if (inst->src.type == REG) {
+      unl_setreg_begin(unl_regpos(inst->dst.reg));
+      unl_getreg(inst->src.reg);
+      unl_setreg_end();
+    } else {
+      unl_setreg_imm(unl_regpos(inst->dst.reg), inst->src.imm);
+    }
+    break;
+
+  case ADD:
+    unl_setreg_begin(unl_regpos(inst->dst.reg));
+    if (inst->src.type == IMM && inst->src.imm == 1) {
+      unl_emit(S2);
+      unl_getreg(inst->dst.reg);
+      unl_emit(K1);
+      unl_emit(POST_INC);
+    } else if (inst->src.type == IMM && inst->src.imm == UINT_MAX) {
+      unl_emit(S2);
+      unl_getreg(inst->dst.reg);
+      unl_emit(K1);
+      unl_emit(POST_DEC);
+    } else {
+      unl_lib_add();
+      unl_getreg(inst->dst.reg);
+      unl_emit_value(&inst->src);
+    }
+    unl_setreg_end();
+    break;
+
+  case SUB:
+    unl_setreg_begin(unl_regpos(inst->dst.reg));
+    if (inst->src.type == IMM && inst->src.imm == 1) {
+      unl_emit(S2);
+      unl_getreg(inst->dst.reg);
+      unl_emit(K1);
+      unl_emit(POST_DEC);
+    } else {
+      unl_lib_sub();
+      unl_getreg(inst->dst.reg);
+      unl_emit_value(&inst->src);
+    }
+    unl_setreg_end();
+    break;
+
+  case JMP:
+    unl_emit_jmp(&inst->jmp);
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+    unl_emit(S2);
+    unl_emit(S2);
+    if (inst->op == JEQ || inst->op == JNE) {
+      unl_lib_eq();
+    } else {
+      unl_lib_lt();
+    }
+    if (inst->op == JGT || inst->op == JLE) {
+      unl_emit_value(&inst->src);
+      unl_emit_value(&inst->dst);
+    } else {
+      unl_emit_value(&inst->dst);
+      unl_emit_value(&inst->src);
+    }
+    if (inst->op == JNE || inst->op == JLE || inst->op == JGE) {
+      putchar('i');
+      unl_emit_jmp(&inst->jmp);
+    } else {
+      unl_emit_jmp(&inst->jmp);
+      putchar('i');
+    }
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    unl_setreg_begin(unl_regpos(inst->dst.reg));
+    unl_bool_to_number_begin();
+    if (inst->op == NE || inst->op == LE || inst->op == GE) {
+      unl_emit(S2);
+      unl_emit(S2);
+    }
+    if (inst->op == EQ || inst->op == NE) {
+      unl_lib_eq();
+    } else {
+      unl_lib_lt();
+    }
+    if (inst->op == GT || inst->op == LE) {
+      unl_emit_value(&inst->src);
+      unl_emit_value(&inst->dst);
+    } else {
+      unl_emit_value(&inst->dst);
+      unl_emit_value(&inst->src);
+    }
+    if (inst->op == NE || inst->op == LE || inst->op == GE) {
+      unl_emit("`k`ki");
+      unl_emit("`kk");
+    }
+    unl_bool_to_number_end();
+    unl_setreg_end();
+    break;
+
+  case LOAD:
+    unl_setreg_begin(unl_regpos(inst->dst.reg));
+    unl_lib_load();
+    unl_emit_value(&inst->src);
+    unl_setreg_end();
+    break;
+
+  case STORE:
+    unl_lib_store();
+    unl_emit_value(&inst->src);
+    unl_emit_value(&inst->dst);
+    break;
+
+  case PUTC:
+    unl_emit(S2);
+    unl_emit("k");
+    unl_lib_putc();
+    unl_emit_value(&inst->src);
+    break;
+
+  case GETC:
+    unl_setreg_begin(unl_regpos(inst->dst.reg));
+    unl_lib_getc();
+    unl_setreg_end();
+    break;
+
+  case EXIT:
+    unl_emit("``s`ke`ki");
+    break;
+
+  case DUMP:
+    putchar('i');
+    break;
+
+  default:
+    error("not implemented %d", inst->op);
+  }
+}
+
+static Inst* unl_emit_chunk(Inst* inst) {
+  int pc = inst->pc;
+  printf("\n# pc=%d\n", pc);
+
+  Inst* reversed = NULL;
+  while (inst && inst->pc == pc) {
+    Inst* next = inst->next;
+    inst->next = reversed;
+    reversed = inst;
+    inst = next;
+  }
+
+  for (; reversed; reversed = reversed->next) {
+    printf("# ");
+    dump_inst_fp(reversed, stdout);
+
+    if (reversed->next) {
+      unl_emit_tick(2);
+      unl_emit(COMPOSE);
+    }
+    unl_emit_op(reversed);
+    putchar('\n');
+  }
+
+  return inst;
+}
+
+static void unl_emit_text(Inst* inst) {
+  int first = 1;
+  while (inst) {
+    unl_list_begin(first);
+    first = 0;
+    inst = unl_emit_chunk(inst);
+  }
+  unl_list_end();
+}
+
+static void unl_emit_data(Data* data) {
+  for (Data* d = data; d; d = d->next) {
+    unl_list_begin(d == data);
+    unl_emit_number2(d->v);
+  }
+  unl_list_end();
+}
+
+static void unl_emit_print(int n) {
+  if (n == 10) {
+    putchar('r');
+  } else {
+    putchar('.');
+    putchar(n);
+  }
+}
+
+static void unl_emit_putc_rec(int n, int b) {
+  if (b == 128) {
+    unl_emit("``s``s`ks``s``s`ksk`k`k");
+    unl_emit_print(n + b);
+    unl_emit("`k`k");
+    unl_emit_print(n);
+  } else {
+    unl_emit("``s`k`si``s``s`ks``s``s`ksk");
+    unl_emit("`k`k");
+    unl_emit_putc_rec(n + b, b + b);
+    unl_emit("`k`k");
+    unl_emit_putc_rec(n, b + b);
+  }
+}
+
+static void unl_emit_libputc(void) {
+  unl_emit(S2);
+  unl_emit(S2);
+  putchar('i');
+  unl_emit(K1);
+  unl_emit_putc_rec(0, 1);
+  unl_emit("`ki");
+}
+
+static void unl_emit_libgetc(void) {
+  unl_emit("``s`d`@k");
+  for (int c = 1; c < 256; c++) {
+    unl_emit(S2);
+    unl_emit(S2);
+    unl_emit("`d");
+    unl_emit("`?");
+    putchar(c);
+    putchar('i');
+    unl_emit(K1);
+    unl_emit_number2(c);
+  }
+  unl_emit(S2);
+  putchar('i');
+  unl_emit(K1);
+  unl_emit_number2(0);
+}
+
+static void unl_emit_libs(void) {
+  unl_list_begin(1);
+  unl_emit_libputc();
+  unl_list_begin(0);
+  unl_emit_libgetc();
+  unl_list_end();
+}
+
+static void unl_emit_core(void) {
+  unl_emit(unl_core);
+  unl_emit_libs();
+  putchar('\n');
+}
+
+void target_unl(Module* module) {
+  unl_emit_tick(2);
+  printf("# VM core\n");
+  unl_emit_core();
+  printf("# instructions\n");
+  unl_emit_text(module->text);
+  printf("# data\n");
+  unl_emit_data(module->data);
+  putchar('\n');
+}
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const char* REG_NAMES_VIM[] = {
+  "s:a", "s:b", "s:c", "s:d", "s:bp", "s:sp", "s:pc"
+};
+
+static void init_state_vim(Data* data) {
+  reg_names = REG_NAMES_VIM;
+  for (int i = 0; i < 7; i++) {
+    emit_line("let %s = 0", reg_names[i]);
+  }
+  emit_line("let s:mem = repeat([0], 16777216)");
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      emit_line("let s:mem[%d] = %d", mp, data->v);
+    }
+  }
+
+  // Assumes that all stdin input is put in the current buffer.
+  // Load it to s:input list at first.
+  emit_line("let s:input = map(split(join(getline(1, '$'), \"\\n\"), '\\zs'), 'char2nr(v:val)')");
+  emit_line("let s:ic = 0");
+  emit_line("let s:output = []");
+
+  // After loading input to s:input, delete entire buffer to output the result.
+  emit_line("normal! dG");
+}
+
+static void vim_emit_func_prologue(int func_id) {
+  emit_line("");
+  emit_line("function! Func%d()", func_id);
+  inc_indent();
+  emit_line("while %d <= s:pc && s:pc < %d",
+            func_id * CHUNKED_FUNC_SIZE, (func_id + 1) * CHUNKED_FUNC_SIZE);
+  inc_indent();
+  emit_line("if 0");
+  inc_indent();
+}
+
+static void vim_emit_func_epilogue(void) {
+  dec_indent();
+  emit_line("endif");
+  emit_line("let s:pc += 1");
+  dec_indent();
+  emit_line("endwhile");
+  dec_indent();
+  emit_line("endfunction");
+}
+
+static void vim_emit_pc_change(int pc) {
+  emit_line("");
+  dec_indent();
+  emit_line("elseif s:pc == %d", pc);
+  inc_indent();
+}
+
+static void vim_emit_inst(Inst* inst) {
+  switch (inst->op) {
+  case MOV:
+    emit_line("let %s = %s", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case ADD:
+    emit_line("let %s = and((%s + %s), " UINT_MAX_STR ")",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SUB:
+    emit_line("let %s = and((%s - %s), " UINT_MAX_STR ")",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case LOAD:
+    emit_line("let %s = s:mem[%s]", reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case STORE:
+    emit_line("let s:mem[%s] = %s", src_str(inst), reg_names[inst->dst.reg]);
+    break;
+
+  case PUTC:
+    // :echon is not available because it can't output invisible characters such as Nul.
+    // So we save the output to s:output and will output it to the current buffer later.
+    emit_line("let s:output += [%s]", src_str(inst));
+    break;
+
+  case GETC:
+    // getchar() is not available because Vim finishes to run script when stdin reaches to EOF
+    // on calling getchar().  To emulate standard getc() behavior, we save the stdin input to
+    // s:input at first, then load a character from it.
+    emit_line("let %s = len(s:input) <= s:ic ? 0 : s:input[s:ic]", reg_names[inst->dst.reg]);
+    emit_line("let s:ic += 1");
+    break;
+
+  case EXIT:
+    // When no output, return the script immediately.
+    // We can't use :quit here because buffer is not saved yet.
+    // And we can't use :finish because script can't be terminated by finish from external
+    // input (please see `:help E168`).
+    emit_line("if len(s:output) == 0 | return 1 | endif");
+
+    // Convert the list of characters to list of line strings here.
+    emit_line("let s:lines = ['']");
+    emit_line("for s:ch in s:output");
+    inc_indent();
+    emit_line("if s:ch == 10");
+    inc_indent();
+    emit_line("let s:lines += ['']");
+    dec_indent();
+    emit_line("else");
+    inc_indent();
+    // Note that Vim treats Nul characters with NL (0xa) in a Vim buffer.
+    // So we need to care about it on coverting a character code to a string.
+    emit_line("let s:lines[len(s:lines)-1] .= nr2char(s:ch == 0 ? 10 : s:ch)");
+    dec_indent();
+    emit_line("endif");
+    emit_line("unlet s:ch");
+    dec_indent();
+    emit_line("endfor");
+
+    // Finally writes the result to the current buffer.
+    // Vim represents Nul character with NL (0xa) and represents newline with CR.
+    // Converted NL and CR will be automatically replaced on saving the buffer to
+    // a file on binary mode.
+    emit_line("call setline(1, s:lines)");
+    emit_line("return 1");
+    break;
+
+  case DUMP:
+    break;
+
+  case EQ:
+  case NE:
+  case LT:
+  case GT:
+  case LE:
+  case GE:
+    emit_line("let %s = %s ? 1 : 0",
+              reg_names[inst->dst.reg], cmp_str(inst, "1"));
+    break;
+
+  case JEQ:
+  case JNE:
+  case JLT:
+  case JGT:
+  case JLE:
+  case JGE:
+  case JMP:
+    emit_line("if %s", cmp_str(inst, "1"));
+    inc_indent();
+    emit_line("let s:pc = %s - 1", value_str(&inst->jmp));
+    dec_indent();
+    emit_line("endif");
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
+void target_vim(Module* module) {
+  init_state_vim(module->data);
+  emit_line("");
+
+  int num_funcs = emit_chunked_main_loop(module->text,
+                                         vim_emit_func_prologue,
+                                         vim_emit_func_epilogue,
+                                         vim_emit_pc_change,
+                                         vim_emit_inst);
+
+  emit_line("");
+  emit_line("while 1");
+  inc_indent();
+  emit_line("if 0");
+  for (int i = 0; i < num_funcs; i++) {
+    emit_line("elseif s:pc < %d", (i + 1) * CHUNKED_FUNC_SIZE);
+    inc_indent();
+    // Func%d() returns 1 if the program exited or not (otherwise returns 0).
+    emit_line("if Func%d() | break | endif", i);
+    dec_indent();
+  }
+  emit_line("endif");
+  dec_indent();
+  emit_line("endwhile");
+}
+// http://compsoc.dur.ac.uk/whitespace/tutorial.html
+
+#include <stdbool.h>
+
+#include <ir/ir.h>
+#include <target/util.h>
+
+static const int MEM = 8;
+
+static int mem(int a) { return MEM + a; }
+
+typedef enum {
+  WS_PUSH,
+  WS_DUP,
+  WS_COPY,
+  WS_SWAP,
+  WS_DISCARD,
+  WS_SLIDE,
+
+  WS_ADD,
+  WS_SUB,
+  WS_MUL,
+  WS_DIV,
+  WS_MOD,
+
+  WS_STORE,
+  WS_RETRIEVE,
+
+  WS_MARK,
+  WS_CALL,
+  WS_JMP,
+  WS_JZ,
+  WS_JN,
+  WS_RET,
+  WS_EXIT,
+
+  WS_PUTC,
+  WS_PUTINT,
+  WS_GETC,
+  WS_GETINT,
+} WsOp;
+
+static const char* WS_OPS[] = {
+  "  ",
+  " \n ",
+  " \t ",
+  " \n\t",
+  " \n\n",
+  " \t\n",
+
+  "\t   ",
+  "\t  \t",
+  "\t  \n",
+  "\t \t ",
+  "\t \t\t",
+
+  "\t\t ",
+  "\t\t\t",
+
+  "\n  ",
+  "\n \t",
+  "\n \n",
+  "\n\t ",
+  "\n\t\t",
+  "\n\t\n",
+  "\n\n\n",
+
+  "\t\n  ",
+  "\t\n \t",
+  "\t\n\t ",
+  "\t\n\t\t",
+};
+
+static void ws_emit_str(const char* s) {
+  fputs(s, stdout);
+}
+
+static void ws_emit_num(int v) {
+  char buf[40];
+  int i = 39;
+  buf[i--] = 0;
+  buf[i--] = '\n';
+  do {
+    buf[i--] = " \t"[v % 2];
+    v /= 2;
+  } while (v);
+  buf[i] = ' ';
+  ws_emit_str(&buf[i]);
+}
+
+static void ws_emit_uint_mod_ws() {
+  putchar(' ');
+  putchar('\t');
+  for (int i = 0; i < 24; i++)
+    putchar(' ');
+  putchar('\n');
+}
+
+static void ws_emit(WsOp op) {
+  ws_emit_str(WS_OPS[op]);
+}
+
+static void ws_emit_op(WsOp op, int a) {
+  ws_emit(op);
+  ws_emit_num(a);
+}
+
+static void ws_emit_local_jmp(WsOp op, int l) {
+  ws_emit(op);
+  ws_emit_num(l);
+}
+
+static void ws_emit_store(int addr, int val) {
+  ws_emit_op(WS_PUSH, addr);
+  ws_emit_op(WS_PUSH, val);
+  ws_emit(WS_STORE);
+}
+
+static void ws_emit_retrieve(int addr) {
+  ws_emit_op(WS_PUSH, addr);
+  ws_emit(WS_RETRIEVE);
+}
+
+static void ws_emit_value(Value* v, int off) {
+  if (v->type == REG) {
+    ws_emit_retrieve(v->reg);
+    if (off) {
+      ws_emit_op(WS_PUSH, off);
+      ws_emit(WS_ADD);
+    }
+  } else {
+    ws_emit_op(WS_PUSH, v->imm + off);
+  }
+}
+
+static void ws_emit_src(Inst* inst, int off) {
+  ws_emit_value(&inst->src, off);
+}
+
+static void ws_emit_addsub(Inst* inst, WsOp op) {
+  ws_emit_op(WS_PUSH, inst->dst.reg);
+  ws_emit_retrieve(inst->dst.reg);
+  ws_emit_src(inst, 0);
+  ws_emit(op);
+  ws_emit(WS_PUSH); ws_emit_uint_mod_ws();
+  ws_emit(WS_ADD);
+  ws_emit(WS_PUSH); ws_emit_uint_mod_ws();
+  ws_emit(WS_MOD);
+  ws_emit(WS_STORE);
+}
+
+static void ws_emit_cmp_ws(Inst* inst, int flip, int* label) {
+  int lf = ++*label;
+  int lt = ++*label;
+  int ld = ++*label;
+  int op = normalize_cond(inst->op, flip);
+
+  if (op == JGT || op == JLE) {
+    op = op == JGT ? JLT : JGE;
+    ws_emit_src(inst, 0);
+    ws_emit_retrieve(inst->dst.reg);
+  } else {
+    ws_emit_retrieve(inst->dst.reg);
+    ws_emit_src(inst, 0);
+  }
+  ws_emit(WS_SUB);
+
+  switch (op) {
+    case JEQ:
+      ws_emit_local_jmp(WS_JZ, lt);
+      ws_emit_local_jmp(WS_JMP, lf);
+      break;
+
+    case JNE:
+      ws_emit_local_jmp(WS_JZ, lf);
+      ws_emit_local_jmp(WS_JMP, lt);
+      break;
+
+    case JLT:
+      ws_emit_local_jmp(WS_JN, lt);
+      ws_emit_local_jmp(WS_JMP, lf);
+      break;
+
+    case JGE:
+      ws_emit_local_jmp(WS_JN, lf);
+      ws_emit_local_jmp(WS_JMP, lt);
+      break;
+
+    default:
+      error("oops %d", op);
+  }
+
+  ws_emit_op(WS_MARK, lt);
+  ws_emit_op(WS_PUSH, 1);
+  ws_emit_op(WS_JMP, ld);
+  ws_emit_op(WS_MARK, lf);
+  ws_emit_op(WS_PUSH, 0);
+  ws_emit_op(WS_MARK, ld);
+}
+
+static void ws_emit_jmp(Inst* inst, WsOp op, int reg_jmp) {
+  if (inst->jmp.type == REG) {
+    ws_emit_retrieve(inst->jmp.reg);
+    if (op != WS_JMP) {
+      ws_emit(WS_SWAP);
+    }
+    ws_emit_op(op, reg_jmp);
+  } else {
+    ws_emit_op(op, inst->jmp.imm);
+  }
+}
+
+static void ws_emit_reg_jmp_table(int min_pc, int max_pc, int last_label) {
+  if (min_pc + 1 == max_pc) {
+    ws_emit(WS_DISCARD);
+    ws_emit_op(WS_JMP, min_pc);
+    return;
+  }
+
+  int mid_pc = (min_pc + max_pc) / 2;
+  ws_emit(WS_DUP);
+  ws_emit_op(WS_PUSH, mid_pc);
+  ws_emit(WS_SUB);
+  ws_emit_op(WS_JN, last_label + mid_pc);
+  ws_emit_reg_jmp_table(mid_pc, max_pc, last_label);
+  ws_emit_op(WS_MARK, last_label + mid_pc);
+  ws_emit_reg_jmp_table(min_pc, mid_pc, last_label);
+}
+
+static void init_state_ws(Data* data) {
+  for (int i = 0; i < 7; i++) {
+    ws_emit_store(i, 0);
+  }
+  for (int mp = 0; data; data = data->next, mp++) {
+    ws_emit_store(mem(mp), data->v);
+  }
+}
+
+void target_ws(Module* module) {
+  init_state_ws(module->data);
+
+  int label = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    label = inst->pc;
+  }
+  int reg_jmp = ++label;
+
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev_pc != inst->pc) {
+      ws_emit_op(WS_MARK, inst->pc);
+    }
+    prev_pc = inst->pc;
+
+    switch (inst->op) {
+      case MOV:
+        ws_emit_op(WS_PUSH, inst->dst.reg);
+        ws_emit_src(inst, 0);
+        ws_emit(WS_STORE);
+        break;
+
+      case ADD:
+        ws_emit_addsub(inst, WS_ADD);
+        break;
+
+      case SUB:
+        ws_emit_addsub(inst, WS_SUB);
+        break;
+
+      case LOAD:
+        ws_emit_op(WS_PUSH, inst->dst.reg);
+        ws_emit_src(inst, 8);
+        ws_emit(WS_RETRIEVE);
+        ws_emit(WS_STORE);
+        break;
+
+      case STORE:
+        ws_emit_src(inst, 8);
+        ws_emit_retrieve(inst->dst.reg);
+        ws_emit(WS_STORE);
+        break;
+
+      case PUTC:
+        ws_emit_src(inst, 0);
+        ws_emit(WS_PUTC);
+        break;
+
+      case GETC:
+        ws_emit_op(WS_PUSH, inst->dst.reg);
+        ws_emit(WS_GETC);
+        break;
+
+      case EXIT:
+        ws_emit(WS_EXIT);
+        break;
+
+      case DUMP:
+        break;
+
+      case EQ:
+      case NE:
+      case LT:
+      case GT:
+      case LE:
+      case GE:
+        ws_emit_op(WS_PUSH, inst->dst.reg);
+        ws_emit_cmp_ws(inst, 0, &label);
+        ws_emit(WS_STORE);
+        break;
+
+      case JEQ:
+      case JNE:
+      case JLT:
+      case JGT:
+      case JLE:
+      case JGE:
+        ws_emit_cmp_ws(inst, 1, &label);
+        ws_emit_jmp(inst, WS_JZ, reg_jmp);
+        break;
+
+      case JMP:
+        ws_emit_jmp(inst, WS_JMP, reg_jmp);
+        break;
+
+      default:
+        error("oops");
+    }
+  }
+
+  ws_emit_op(WS_MARK, reg_jmp);
+  ws_emit_reg_jmp_table(0, reg_jmp, label);
+}
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ir/ir.h>
+#include <ir/live.h>
+#include <target/util.h>
+
+static int REGNO[] = {
+  0,  // A
+  3,  // B
+  1,  // C
+  2,  // D
+  5,  // BP
+  7,  // SP - EDI
+  6,  // ESI
+  4   // ESP
+};
+
+#define EDI SP
+#define ESI ((Reg)6)
+#define ESP ((Reg)7)
+
+static Liveness* x86_live;
+
+// Registers int 0x80 uses for the syscall number and arguments, in the
+// order they are pushed.
+static const Reg SYSCALL_REGS[] = { A, C, D, B };
+
+static void emit_int80() {
+  emit_2(0xcd, 0x80);
+}
+
+static int modr(Reg dst, Reg src) {
+  return 0xc0 + REGNO[dst] + (REGNO[src] * 8);
+}
+
+static void emit_reg2(Reg dst, Reg src) {
+  emit_1(modr(dst, src));
+}
+
+static void emit_zero_reg(Reg r) {
+  emit_2(0x31, modr(r, r));
+}
+
+static void emit_mov_reg(Reg dst, Reg src) {
+  emit_1(0x89);
+  emit_reg2(dst, src);
+}
+
+static void emit_mov_imm(Reg dst, int src) {
+  emit_1(0xb8 + REGNO[dst]);
+  emit_le(src);
+}
+
+static void emit_mov(Reg dst, Value* src) {
+  if (src->type == REG) {
+    emit_mov_reg(dst, src->reg);
+  } else {
+    emit_mov_imm(dst, src->imm);
+  }
+}
+
+static void emit_cmp_x86(Inst* inst) {
+  if (inst->src.type == REG) {
+    emit_2(0x39, modr(inst->dst.reg, inst->src.reg));
+  } else {
+    emit_2(0x81, 0xf8 + REGNO[inst->dst.reg]);
+    emit_le(inst->src.imm);
+  }
+}
+
+static void emit_setcc(Inst* inst, int op) {
+  emit_cmp_x86(inst);
+  emit_mov_imm(inst->dst.reg, 0);
+  emit_3(0x0f, op, 0xc0 + REGNO[inst->dst.reg]);
+}
+
+static void emit_jcc(Inst* inst, int op, int* pc2addr, int rodata_addr) {
+  if (op) {
+    emit_cmp_x86(inst);
+    emit_2(op, inst->jmp.type == REG ? 7 : 5);
+  }
+
+  if (inst->jmp.type == REG) {
+    emit_3(0xff, 0x24, 0x85 + (REGNO[inst->jmp.reg] * 8));
+    emit_le(rodata_addr);
+  } else {
+    emit_1(0xe9);
+    emit_diff(pc2addr[inst->jmp.imm], emit_cnt() + 4);
+  }
+}
+
+// Computes "EAX = EAX op ECX" for an extended op. EDX is scratch.
+static void emit_x86_ext_op(Op op) {
+  switch (op) {
+    case MUL:
+      // imul EAX, ECX; and EAX, 0xffffff
+      emit_3(0x0f, 0xaf, 0xc1);
+      emit_1(0x25);
+      emit_le(0xffffff);
+      break;
+
+    case AND:
+      emit_2(0x21, 0xc8);
+      break;
+
+    case OR:
+      emit_2(0x09, 0xc8);
+      break;
+
+    case XOR:
+      emit_2(0x31, 0xc8);
+      break;
+
+    case DIV:
+    case MOD:
+      emit_zero_reg(D);
+      // test ECX, ECX
+      emit_2(0x85, 0xc9);
+      if (op == DIV) {
+        // jz zero; div ECX; jmp done; zero: xor EAX, EAX
+        emit_2(0x74, 0x04);
+        emit_2(0xf7, 0xf1);
+        emit_2(0xeb, 0x02);
+        emit_zero_reg(A);
+      } else {
+        // jz done; div ECX; mov EAX, EDX
+        emit_2(0x74, 0x04);
+        emit_2(0xf7, 0xf1);
+        emit_mov_reg(A, D);
+      }
+      break;
+
+    case SHL:
+    case SHR:
+      // cmp ECX, 24; jae zero; shl/shr EAX, CL; and EAX, 0xffffff;
+      // jmp done; zero: xor EAX, EAX
+      emit_3(0x83, 0xf9, 0x18);
+      emit_2(0x73, 0x09);
+      emit_2(0xd3, op == SHL ? 0xe0 : 0xe8);
+      emit_1(0x25);
+      emit_le(0xffffff);
+      emit_2(0xeb, 0x02);
+      emit_zero_reg(A);
+      break;
+
+    default:
+      error("oops");
+  }
+}
+
+static void emit_push_value(Value* v) {
+  if (v->type == REG) {
+    emit_1(0x50 + REGNO[v->reg]);
+  } else {
+    emit_1(0x68);
+    emit_le(v->imm);
+  }
+}
+
+// Sets EDI to the address of dst, EAX to src and ECX to the length of
+// a block op.
+static void emit_push_operands(Inst* inst) {
+  emit_push_value(&inst->dst);
+  emit_push_value(&inst->src);
+  emit_push_value(&inst->jmp);
+  // pop ECX, EAX, EDI
+  emit_3(0x59, 0x58, 0x5f);
+  // lea EDI, [ESI+EDI*4]
+  emit_3(0x8d, 0x3c, 0xbe);
+}
+
+// Saves the registers in |regs| which a syscall clobbers.
+static void emit_save_regs(int regs) {
+  for (int i = 0; i < 4; i++) {
+    if (regs & (1 << SYSCALL_REGS[i]))
+      emit_1(0x50 + REGNO[SYSCALL_REGS[i]]);
+  }
+}
+
+static void emit_restore_regs(int regs) {
+  for (int i = 3; i >= 0; i--) {
+    if (regs & (1 << SYSCALL_REGS[i]))
+      emit_1(0x58 + REGNO[SYSCALL_REGS[i]]);
+  }
+}
+
+static void init_state_x86(Data* data) {
+  emit_mov_imm(B, 0);
+  // mov ECX, 1<<26
+  emit_5(0xb8 + REGNO[C], 0, 0, 0, 4);
+  emit_mov_imm(D, 3);  // PROT_READ | PROT_WRITE
+  emit_mov_imm(ESI, 0x22);  // MAP_PRIVATE | MAP_ANONYMOUS
+  // mov EDI, 0xffffffff
+  emit_5(0xb8 + REGNO[EDI], 0xff, 0xff, 0xff, 0xff);
+  emit_mov_imm(BP, 0);
+  emit_mov_imm(A, 192);  // mmap2
+  emit_int80();
+
+  emit_mov_reg(ESI, A);
+
+  for (int mp = 0; data; data = data->next, mp++) {
+    if (data->v) {
+      // mov dword [EAX+mp*4], data->v
+      emit_2(0xc7, 0x80);
+      emit_le(mp * 4);
+      emit_le(data->v);
+    }
+  }
+
+  emit_zero_reg(A);
+  emit_zero_reg(B);
+  emit_zero_reg(C);
+  emit_zero_reg(D);
+  emit_zero_reg(BP);
+  // SP starts at 0 like the other registers. elc -O drops "add SP, 0",
+  // so it must already be a 24-bit value.
+  emit_zero_reg(SP);
+}
+
+static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
+  switch (inst->op) {
+    case MOV:
+      emit_mov(inst->dst.reg, &inst->src);
+      break;
+
+    case ADD:
+      if (inst->src.type == REG) {
+        emit_1(0x01);
+        emit_reg2(inst->dst.reg, inst->src.reg);
+      } else {
+        emit_2(0x81, 0xc0 + REGNO[inst->dst.reg]);
+        emit_le(inst->src.imm);
+      }
+      if (!inst->no_wrap) {
+        emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
+        emit_le(0xffffff);
+      }
+      break;
+
+    case SUB:
+      if (inst->src.type == REG) {
+        emit_1(0x29);
+        emit_reg2(inst->dst.reg, inst->src.reg);
+      } else {
+        emit_2(0x81, 0xe8 + REGNO[inst->dst.reg]);
+        emit_le(inst->src.imm);
+      }
+      if (!inst->no_wrap) {
+        emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
+        emit_le(0xffffff);
+      }
+      break;
+
+    case LOAD:
+      emit_1(0x8b);
+      goto store_load_common;
+
+    case STORE:
+      emit_1(0x89);
+    store_load_common:
+      if (inst->src.type == REG) {
+        emit_2(4 + (REGNO[inst->dst.reg] * 8),
+               0x86 + (REGNO[inst->src.reg] * 8));
+      } else {
+        emit_1(0x86 + (REGNO[inst->dst.reg] * 8));
+        emit_le(inst->src.imm * 4);
+      }
+      break;
+
+    case PUTC: {
+      // Only registers read later need to survive the syscall.
+      int live = get_live_out(x86_live, inst);
+      emit_save_regs(live);
+      emit_push_value(&inst->src);
+      emit_mov_imm(B, 1);  // stdout
+      emit_mov_reg(C, ESP);
+      emit_mov_imm(D, 1);
+      emit_mov_imm(A, 4);  // write
+      emit_int80();
+      // add ESP, 4
+      emit_3(0x83, 0xc4, 0x04);
+      emit_restore_regs(live);
+      break;
+    }
+
+    case GETC: {
+      // EDI receives the character, and dst is overwritten anyway.
+      int live = get_live_out(x86_live, inst) & ~(1 << inst->dst.reg);
+      if (live & (1 << EDI)) {
+        // push EDI
+        emit_1(0x57);
+      }
+      emit_save_regs(live);
+      // push 0
+      emit_2(0x6a, 0x00);
+      emit_mov_imm(B, 0);  // stdin
+      emit_mov_reg(C, ESP);
+      emit_mov_imm(D, 1);
+      emit_mov_imm(A, 3);  // read
+      emit_int80();
+
+      // pop EDI
+      emit_1(0x5f);
+      emit_mov_imm(B, 0);
+      // cmp EAX, 1
+      emit_3(0x83, 0xf8, 0x01);
+      // cmovnz EDI, EBX
+      emit_3(0x0f, 0x45, 0xfb);
+
+      emit_restore_regs(live);
+      emit_mov_reg(inst->dst.reg, EDI);
+      if (live & (1 << EDI)) {
+        // pop EDI
+        emit_1(0x5f);
+      }
+      break;
+    }
+
+    case EXIT:
+      emit_mov_imm(B, 0);
+      emit_mov_imm(A, 1);  // exit
+      emit_int80();
+      break;
+
+    case DUMP:
+      break;
+
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      // push EAX, ECX, EDX
+      emit_3(0x50, 0x51, 0x52);
+      emit_push_value(&inst->src);
+      emit_push_value(&inst->dst);
+      // pop EAX, ECX
+      emit_2(0x58, 0x59);
+      emit_x86_ext_op(inst->op);
+      // Put the result where the pops below restore dst from, if any.
+      if (inst->dst.reg == A) {
+        emit_4(0x89, 0x44, 0x24, 0x08);
+      } else if (inst->dst.reg == C) {
+        emit_4(0x89, 0x44, 0x24, 0x04);
+      } else if (inst->dst.reg == D) {
+        emit_3(0x89, 0x04, 0x24);
+      } else {
+        emit_mov_reg(inst->dst.reg, A);
+      }
+      // pop EDX, ECX, EAX
+      emit_3(0x5a, 0x59, 0x58);
+      break;
+
+    case COPY:
+      // push EAX, ECX, ESI, EDI
+      emit_4(0x50, 0x51, 0x56, 0x57);
+      emit_push_operands(inst);
+      // lea ESI, [ESI+EAX*4]
+      emit_3(0x8d, 0x34, 0x86);
+      // cmp EDI, ESI; jbe forward
+      emit_4(0x39, 0xf7, 0x76, 0x0e);
+      // Copy backwards when the destination is above the source.
+      // lea ESI, [ESI+ECX*4-4]; lea EDI, [EDI+ECX*4-4]
+      emit_4(0x8d, 0x74, 0x8e, 0xfc);
+      emit_4(0x8d, 0x7c, 0x8f, 0xfc);
+      // std; rep movsd; cld; jmp done
+      emit_6(0xfd, 0xf3, 0xa5, 0xfc, 0xeb, 0x02);
+      // forward: rep movsd
+      emit_2(0xf3, 0xa5);
+      // done: pop EDI, ESI, ECX, EAX
+      emit_4(0x5f, 0x5e, 0x59, 0x58);
+      break;
+
+    case FILL:
+      // push EAX, ECX, EDI
+      emit_3(0x50, 0x51, 0x57);
+      emit_push_operands(inst);
+      // rep stosd
+      emit_2(0xf3, 0xab);
+      // pop EDI, ECX, EAX
+      emit_3(0x5f, 0x59, 0x58);
+      break;
+
+    case EQ:
+      emit_setcc(inst, 0x94);
+      break;
+
+    case NE:
+      emit_setcc(inst, 0x95);
+      break;
+
+    case LT:
+      emit_setcc(inst, 0x9c);
+      break;
+
+    case GT:
+      emit_setcc(inst, 0x9f);
+      break;
+
+    case LE:
+      emit_setcc(inst, 0x9e);
+      break;
+
+    case GE:
+      emit_setcc(inst, 0x9d);
+      break;
+
+    case JEQ:
+      emit_jcc(inst, 0x75, pc2addr, rodata_addr);
+      break;
+
+    case JNE:
+      emit_jcc(inst, 0x74, pc2addr, rodata_addr);
+      break;
+
+    case JLT:
+      emit_jcc(inst, 0x7d, pc2addr, rodata_addr);
+      break;
+
+    case JGT:
+      emit_jcc(inst, 0x7e, pc2addr, rodata_addr);
+      break;
+
+    case JLE:
+      emit_jcc(inst, 0x7f, pc2addr, rodata_addr);
+      break;
+
+    case JGE:
+      emit_jcc(inst, 0x7c, pc2addr, rodata_addr);
+      break;
+
+    case JMP:
+      emit_jcc(inst, 0, pc2addr, rodata_addr);
+      break;
+
+    default:
+      error("oops");
+  }
+}
+
+void target_x86(Module* module) {
+  emit_reset();
+  init_state_x86(module->data);
+  x86_live = build_liveness(module);
+
+  int pc_cnt = module->num_pcs;
+  int* pc2addr = calloc(pc_cnt, sizeof(int));
+  for (int pc = 0; pc < pc_cnt; pc++) {
+    pc2addr[pc] = emit_cnt();
+    for (int i = module->pc_start[pc]; i < module->pc_start[pc + 1]; i++) {
+      Inst* inst = &module->insts[i];
+      x86_emit_inst(inst, pc2addr, 0);
+    }
+  }
+
+  int rodata_addr = ELF_TEXT_START + emit_cnt() + ELF_HEADER_SIZE;
+
+  emit_elf_header(3, emit_cnt() + pc_cnt * 4);
+
+  emit_reset();
+  emit_start();
+  init_state_x86(module->data);
+
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    x86_emit_inst(inst, pc2addr, rodata_addr);
+  }
+
+  for (int i = 0; i < pc_cnt; i++) {
+    emit_le(ELF_TEXT_START + pc2addr[i] + ELF_HEADER_SIZE);
+  }
+  free_liveness(x86_live);
+}
+#include <ir/ir.h>
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/arena.h>
+#include <ir/table.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+# define IR_USE_MMAP
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+typedef struct DataPrivate_ {
+  int v;
+  struct DataPrivate_* next;
+  LabelType label;
+  Value val;
+  int lineno;
+} DataPrivate;
+
+typedef struct SymbolPrivate_ {
+  Symbol sym;
+  struct SymbolPrivate_* next;
+} SymbolPrivate;
+
+// The entry jump goes to pc 1 if the program has no main.
+static Symbol default_main = { "main", 1, true };
+
+typedef struct LocPrivate_ {
+  SourceLoc loc;
+  struct LocPrivate_* next;
+} LocPrivate;
+
+typedef struct FilePrivate_ {
+  int num;
+  const char* name;
+  struct FilePrivate_* next;
+} FilePrivate;
+
+typedef struct {
+  const char* filename;
+  int lineno;
+  int col;
+  FILE* fp;
+  const char* buf;
+  const char* cur;
+  const char* end;
+  Table* symtab;
+  Table* strtab;
+  Arena* arena;
+  SymbolPrivate sym_root;
+  SymbolPrivate* syms;
+  int num_syms;
+  LocPrivate loc_root;
+  LocPrivate* locs;
+  int num_locs;
+  int loc;
+  FilePrivate file_root;
+  FilePrivate* files;
+  int num_files;
+  int in_text;
+  Inst* text;
+  int pc;
+  int subsection;
+  DataPrivate* data;
+  bool prev_boundary;
+} Parser;
+
+enum {
+  DATA = LAST_OP + 1, TEXT, LONG, STRING, FILENAME, LOC
+};
+
+enum {
+  REF = IMM + 1, LABEL
+};
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void ir_error(Parser* p, const char* msg) {
+  fprintf(stderr, "%s:%d:%d: %s\n", p->filename, p->lineno, p->col, msg);
+  exit(1);
+}
+
+// When the whole input is in memory (|buf| is set), the lexer scans it
+// with a pointer. Otherwise it reads |fp| one character at a time.
+static int ir_getc(Parser* p) {
+  int c;
+  if (p->buf) {
+    c = p->cur < p->end ? (unsigned char)*p->cur++ : EOF;
+  } else {
+    c = fgetc(p->fp);
+  }
+  if (c == '\n') {
+    p->lineno++;
+    p->col = 0;
+  } else {
+    p->col++;
+  }
+  return c;
+}
+
+static void ir_ungetc(Parser* p, int c) {
+  if (c == '\n') {
+    p->lineno--;
+  }
+  if (p->buf) {
+    if (c != EOF)
+      p->cur--;
+  } else {
+    ungetc(c, p->fp);
+  }
+}
+
+static int peek(Parser* p) {
+  if (p->buf)
+    return p->cur < p->end ? (unsigned char)*p->cur : EOF;
+  int c = fgetc(p->fp);
+  ungetc(c, p->fp);
+  return c;
+}
+
+static bool is_ident_char(int c) {
+  return isalnum(c) || c == '_' || c == '.';
+}
+
+static void skip_until_ret(Parser* p) {
+  if (p->buf) {
+    // ELVM's libc has no memchr.
+    const char* e = p->cur;
+    while (e < p->end && *e != '\n')
+      e++;
+    p->col += e - p->cur;
+    p->cur = e;
+    return;
+  }
+
+  int c;
+  for (;;) {
+    c = ir_getc(p);
+    if (c == '\n' || c == EOF)
+      break;
+  }
+  ir_ungetc(p, c);
+}
+
+static void skip_ws(Parser* p) {
+  if (p->buf) {
+    const char* q = p->cur;
+    for (; q < p->end && isspace((unsigned char)*q); q++) {
+      if (*q == '\n') {
+        p->lineno++;
+        p->col = 0;
+      } else {
+        p->col++;
+      }
+    }
+    p->cur = q;
+    return;
+  }
+
+  int c;
+  for (;;) {
+    c = ir_getc(p);
+    if (!isspace(c))
+      break;
+  }
+  ir_ungetc(p, c);
+}
+
+static void read_while_ident(Parser* p, char* buf, int len) {
+  if (p->buf) {
+    const char* q = p->cur;
+    const char* e = p->end - q > len ? q + len : p->end;
+    for (; q < e && is_ident_char((unsigned char)*q); q++) {}
+    int n = q - p->cur;
+    if (n == len)
+      ir_error(p, "too long ident");
+    memcpy(buf, p->cur, n);
+    buf[n] = 0;
+    p->col += n;
+    p->cur = q;
+    return;
+  }
+
+  while (len--) {
+    int c = ir_getc(p);
+    if (!is_ident_char(c)) {
+      ir_ungetc(p, c);
+      *buf = 0;
+      return;
+    }
+    *buf++ = c;
+  }
+  ir_error(p, "too long ident");
+}
+
+static int read_int(Parser* p, int c) {
+  bool is_minus = false;
+  int r = 0;
+  if (c == '-') {
+    is_minus = true;
+    c = ir_getc(p);
+    if (!isdigit(c))
+      ir_error(p, "digit expected");
+  }
+  if (p->buf) {
+    const char* q = p->cur;
+    r = c - '0';
+    for (; q < p->end && '0' <= *q && *q <= '9'; q++) {
+      r *= 10;
+      r += *q - '0';
+    }
+    p->col += q - p->cur;
+    p->cur = q;
+    return is_minus ? -r : r;
+  }
+  while ('0' <= c && c <= '9') {
+    r *= 10;
+    r += c - '0';
+    c = ir_getc(p);
+  }
+  ir_ungetc(p, c);
+  return is_minus ? -r : r;
+}
+
+// Returns a copy of |s| owned by the module. Every occurrence of the
+// same name shares one copy.
+static const char* intern(Parser* p, const char* s) {
+  const void* r;
+  if (table_get(p->strtab, s, &r))
+    return r;
+  char* n = arena_strdup(p->arena, s);
+  p->strtab = table_add(p->strtab, n, n);
+  return n;
+}
+
+static void add_sym(Parser* p, const char* name, int value, bool is_text) {
+  SymbolPrivate* s = arena_alloc(p->arena, sizeof(SymbolPrivate));
+  s->sym.name = name;
+  s->sym.value = value;
+  s->sym.is_text = is_text;
+  p->symtab = table_add(p->symtab, name, &s->sym);
+  p->syms->next = s;
+  p->syms = s;
+  p->num_syms++;
+}
+
+static DataPrivate* add_data(Parser* p) {
+  DataPrivate* n = arena_alloc(p->arena, sizeof(DataPrivate));
+  n->v = p->subsection;
+  n->lineno = p->lineno;
+  p->data->next = n;
+  p->data = n;
+  return n;
+}
+
+static void add_imm_data(Parser* p, int v) {
+  DataPrivate* n = add_data(p);
+  n->val.type = IMM;
+  n->val.imm = v;
+}
+
+typedef struct {
+  int subsection;
+  DataPrivate* head;
+  DataPrivate* tail;
+} DataBucket;
+
+static DataBucket* find_data_bucket(DataBucket* buckets, int cap,
+                                    int subsection) {
+  int mask = cap - 1;
+  for (int i = subsection & mask;; i = (i + 1) & mask) {
+    if (!buckets[i].head || buckets[i].subsection == subsection)
+      return &buckets[i];
+  }
+}
+
+static int compare_data_buckets(const void* a, const void* b) {
+  int x = ((const DataBucket*)a)->subsection;
+  int y = ((const DataBucket*)b)->subsection;
+  return x < y ? -1 : x > y;
+}
+
+// Lays out data by ascending subsection, keeping the order of entries
+// within a subsection. Entries are bucketed in a single pass, so this
+// is linear in the number of data words plus sorting the subsections.
+static void serialize_data(Parser* p, DataPrivate* data_root) {
+  int cap = 16;
+  int num_buckets = 0;
+  DataBucket* buckets = calloc(cap, sizeof(DataBucket));
+  DataBucket* last = NULL;
+  for (DataPrivate* data = data_root->next; data;) {
+    DataPrivate* next = data->next;
+    data->next = 0;
+    if (!last || last->subsection != data->v) {
+      last = find_data_bucket(buckets, cap, data->v);
+      if (!last->head) {
+        if ((num_buckets + 1) * 2 > cap) {
+          DataBucket* old = buckets;
+          buckets = calloc(cap * 2, sizeof(DataBucket));
+          for (int i = 0; i < cap; i++) {
+            if (old[i].head)
+              *find_data_bucket(buckets, cap * 2, old[i].subsection) = old[i];
+          }
+          cap *= 2;
+          free(old);
+          last = find_data_bucket(buckets, cap, data->v);
+        }
+        last->subsection = data->v;
+        last->head = data;
+        last->tail = data;
+        num_buckets++;
+        data = next;
+        continue;
+      }
+    }
+    last->tail->next = data;
+    last->tail = data;
+    data = next;
+  }
+
+  int n = 0;
+  for (int i = 0; i < cap; i++) {
+    if (buckets[i].head)
+      buckets[n++] = buckets[i];
+  }
+  qsort(buckets, n, sizeof(DataBucket), compare_data_buckets);
+
+  DataPrivate serialized_root = {};
+  DataPrivate* serialized = &serialized_root;
+  intptr_t mp = 0;
+  for (int i = 0; i < n; i++) {
+    for (DataPrivate* data = buckets[i].head; data;) {
+      DataPrivate* next = data->next;
+      if (data->val.type == (ValueType)LABEL) {
+        add_sym(p, data->val.tmp, mp, false);
+      } else {
+        serialized->next = data;
+        serialized = data;
+        serialized->next = 0;
+        mp++;
+      }
+      data = next;
+    }
+  }
+  free(buckets);
+
+  add_sym(p, "_edata", mp, false);
+  serialized->next = arena_alloc(p->arena, sizeof(DataPrivate));
+  serialized->next->v = mp + 1;
+  serialized->next->val.type = IMM;
+  serialized->next->val.imm = mp + 1;
+  data_root->next = serialized_root.next;
+}
+
+// Dispatches on the first character so each op name is compared with
+// at most a few candidates.
+static Op get_op(Parser* p, const char* buf) {
+  if (peek(p) == ':')
+    return OP_UNSET;
+  switch (buf[0]) {
+    case 'a':
+      if (!strcmp(buf, "add")) return ADD;
+      if (!strcmp(buf, "and")) return AND;
+      break;
+    case 'c':
+      if (!strcmp(buf, "copy")) return COPY;
+      break;
+    case 'd':
+      if (!strcmp(buf, "dump")) return DUMP;
+      if (!strcmp(buf, "div")) return DIV;
+      break;
+    case 'e':
+      if (!strcmp(buf, "exit")) return EXIT;
+      if (!strcmp(buf, "eq")) return EQ;
+      break;
+    case 'f':
+      if (!strcmp(buf, "fill")) return FILL;
+      break;
+    case 'g':
+      if (buf[1] == 'e' && !buf[2]) return GE;
+      if (buf[1] == 't' && !buf[2]) return GT;
+      if (!strcmp(buf, "getc")) return GETC;
+      break;
+    case 'j':
+      switch (buf[1]) {
+        case 'e':
+          if (buf[2] == 'q' && !buf[3]) return JEQ;
+          break;
+        case 'n':
+          if (buf[2] == 'e' && !buf[3]) return JNE;
+          break;
+        case 'l':
+          if (buf[2] == 't' && !buf[3]) return JLT;
+          if (buf[2] == 'e' && !buf[3]) return JLE;
+          break;
+        case 'g':
+          if (buf[2] == 't' && !buf[3]) return JGT;
+          if (buf[2] == 'e' && !buf[3]) return JGE;
+          break;
+        case 'm':
+          if (buf[2] == 'p' && !buf[3]) return JMP;
+          break;
+      }
+      break;
+    case 'l':
+      if (buf[1] == 't' && !buf[2]) return LT;
+      if (buf[1] == 'e' && !buf[2]) return LE;
+      if (!strcmp(buf, "load")) return LOAD;
+      break;
+    case 'm':
+      if (!strcmp(buf, "mov")) return MOV;
+      if (!strcmp(buf, "mul")) return MUL;
+      if (!strcmp(buf, "mod")) return MOD;
+      break;
+    case 'n':
+      if (!strcmp(buf, "ne")) return NE;
+      break;
+    case 'o':
+      if (!strcmp(buf, "or")) return OR;
+      break;
+    case 'p':
+      if (!strcmp(buf, "putc")) return PUTC;
+      break;
+    case 's':
+      if (!strcmp(buf, "sub")) return SUB;
+      if (!strcmp(buf, "store")) return STORE;
+      if (!strcmp(buf, "shl")) return SHL;
+      if (!strcmp(buf, "shr")) return SHR;
+      break;
+    case 'x':
+      if (!strcmp(buf, "xor")) return XOR;
+      break;
+    case '.':
+      switch (buf[1]) {
+        case 't':
+          if (!strcmp(buf, ".text")) return (Op)TEXT;
+          break;
+        case 'd':
+          if (!strcmp(buf, ".data")) return (Op)DATA;
+          break;
+        case 'l':
+          if (!strcmp(buf, ".long")) return (Op)LONG;
+          if (!strcmp(buf, ".loc")) return (Op)LOC;
+          break;
+        case 's':
+          if (!strcmp(buf, ".string")) return (Op)STRING;
+          break;
+        case 'f':
+          if (!strcmp(buf, ".file")) return (Op)FILENAME;
+          break;
+      }
+      break;
+  }
+  return OP_UNSET;
+}
+
+static bool get_reg(const char* buf, Reg* r) {
+  if (!buf[1]) {
+    if (buf[0] >= 'A' && buf[0] <= 'D') {
+      *r = (Reg)(A + buf[0] - 'A');
+      return true;
+    }
+  } else if (buf[1] == 'P' && !buf[2]) {
+    if (buf[0] == 'S') {
+      *r = SP;
+      return true;
+    } else if (buf[0] == 'B') {
+      *r = BP;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int read_escape(Parser* p) {
+  int c = ir_getc(p);
+  if (c == 'n') {
+    c = '\n';
+  } else if (c == 't') {
+    c = '\t';
+  } else if (c == 'b') {
+    c = '\b';
+  } else if (c == 'f') {
+    c = '\f';
+  } else if (c == 'r') {
+    c = '\r';
+  } else if (c == '\"') {
+    c = '\"';
+  } else if (c == '\\') {
+    c = '\\';
+  } else if (c == 'x') {
+    char b[3];
+    b[0] = ir_getc(p);
+    c = ir_getc(p);
+    if (!((c >= '0' && c <= '9') ||
+          (c >= 'a' && c <= 'f') ||
+          (c >= 'A' && c <= 'F'))) {
+      ir_ungetc(p, c);
+      c = 0;
+    }
+    b[1] = c;
+    b[2] = 0;
+    c = strtoul(b, NULL, 16);
+  } else {
+    ir_error(p, "unknown escape");
+  }
+  return c;
+}
+
+// .file [n] "name"
+static void parse_file(Parser* p) {
+  char buf[1024];
+  int num = 0;
+  skip_ws(p);
+  int c = ir_getc(p);
+  if (isdigit(c)) {
+    num = read_int(p, c);
+    skip_ws(p);
+    c = ir_getc(p);
+  }
+  if (c != '"')
+    ir_error(p, "expected open '\"'");
+  int len = 0;
+  for (c = ir_getc(p); c != '"'; c = ir_getc(p)) {
+    if (c == '\n' || c == EOF)
+      ir_error(p, "unterminated file name");
+    if (c == '\\')
+      c = read_escape(p);
+    if (len == (int)sizeof(buf) - 1)
+      ir_error(p, "too long file name");
+    buf[len++] = c;
+  }
+  buf[len] = 0;
+
+  FilePrivate* f = arena_alloc(p->arena, sizeof(FilePrivate));
+  f->num = num;
+  f->name = intern(p, buf);
+  p->files->next = f;
+  p->files = f;
+  if (p->num_files <= num)
+    p->num_files = num + 1;
+  skip_until_ret(p);
+}
+
+// .loc file line [column]
+static void parse_loc(Parser* p) {
+  int v[2];
+  for (int i = 0; i < 2; i++) {
+    skip_ws(p);
+    int c = ir_getc(p);
+    if (!isdigit(c))
+      ir_error(p, "number expected");
+    v[i] = read_int(p, c);
+  }
+  skip_until_ret(p);
+
+  SourceLoc* cur = &p->locs->loc;
+  if (p->loc && cur->file == v[0] && cur->line == v[1])
+    return;
+  LocPrivate* l = arena_alloc(p->arena, sizeof(LocPrivate));
+  l->loc.file = v[0];
+  l->loc.line = v[1];
+  p->locs->next = l;
+  p->locs = l;
+  p->loc = p->num_locs++;
+}
+
+static void parse_line(Parser* p, int c) {
+  char buf[64];
+  buf[0] = c;
+  read_while_ident(p, buf + 1, 62);
+  Op op = get_op(p, buf);
+  if (op == (Op)TEXT) {
+    p->in_text = 1;
+    return;
+  } else if (op == (Op)STRING) {
+    if (p->in_text)
+      ir_error(p, "in text");
+    skip_ws(p);
+    if (ir_getc(p) != '"')
+      ir_error(p, "expected open '\"'");
+
+    c = ir_getc(p);
+    while (c != '"') {
+      if (c == '\\')
+        c = read_escape(p);
+      add_imm_data(p, c);
+      c = ir_getc(p);
+    }
+    add_imm_data(p, 0);
+    return;
+  } else if (op == (Op)FILENAME) {
+    parse_file(p);
+    return;
+  } else if (op == (Op)LOC) {
+    parse_loc(p);
+    return;
+  } else if (op == OP_UNSET) {
+    c = ir_getc(p);
+    if (c == ':') {
+      intptr_t value = 0;
+      if (p->in_text) {
+        if (!p->prev_boundary)
+          p->pc++;
+        value = p->pc;
+        p->prev_boundary = true;
+        add_sym(p, intern(p, buf), value, true);
+      } else {
+        DataPrivate* d = add_data(p);
+        d->val.type = (ValueType)LABEL;
+        d->val.tmp = (void*)intern(p, buf);
+      }
+      return;
+    }
+    ir_error(p, "unknown op");
+  }
+
+  if (op < 0) {
+    ir_error(p, "oops");
+  }
+  int argc;
+  if (op <= STORE)
+    argc = 2;
+  else if (op <= GETC)
+    argc = 1;
+  else if (op <= EXIT)
+    argc = 0;
+  else if (op <= JGE)
+    argc = 3;
+  else if (op <= JMP)
+    argc = 1;
+  else if (op <= GE)
+    argc = 2;
+  else if (op == DUMP)
+    argc = 0;
+  else if (op <= SHR)
+    argc = 2;
+  else if (op <= FILL)
+    argc = 3;
+  else if (op == (Op)LONG)
+    argc = 1;
+  else if (op == (Op)DATA) {
+    skip_ws(p);
+    c = peek(p);
+    argc = c == '-' || isdigit(c) ? 1 : 0;
+  } else
+    ir_error(p, "oops");
+
+  Value args[3];
+  for (int i = 0; i < argc; i++) {
+    skip_ws(p);
+    if (i) {
+      c = ir_getc(p);
+      if (c != ',')
+        ir_error(p, "comma expected");
+      skip_ws(p);
+    }
+
+    Value a;
+    a.label = NOT_LABEL;
+    c = ir_getc(p);
+    if (isdigit(c) || c == '-') {
+      a.type = IMM;
+      a.imm = MOD24(read_int(p, c));
+    } else {
+      buf[0] = c;
+      read_while_ident(p, buf + 1, 62);
+      a.type = REG;
+      if (!get_reg(buf, &a.reg)) {
+        a.type = (ValueType)REF;
+        a.tmp = (void*)intern(p, buf);
+      }
+    }
+    args[i] = a;
+  }
+
+  if (op == (Op)LONG) {
+    if (args[0].type == IMM) {
+      add_imm_data(p, args[0].imm);
+    } else if (args[0].type == (ValueType)REF) {
+      DataPrivate* d = add_data(p);
+      d->val.type = (ValueType)REF;
+      d->val.tmp = args[0].tmp;
+    } else {
+      ir_error(p, "number expected");
+    }
+    return;
+  } else if (op == (Op)DATA) {
+    if (argc == 1) {
+      if (args[0].type != IMM)
+        ir_error(p, "number expected");
+      p->subsection = args[0].imm;
+    }
+    p->in_text = 0;
+    return;
+  }
+
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = op;
+  p->text->pc = p->pc;
+  p->text->lineno = p->lineno;
+  p->text->loc = p->loc;
+  p->prev_boundary = false;
+  switch (op) {
+    case LOAD:
+    case STORE:
+    case MOV:
+    case ADD:
+    case SUB:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      p->text->src = args[1];
+      FALLTHROUGH;
+    case GETC:
+      p->text->dst = args[0];
+      break;
+    case PUTC:
+      p->text->src = args[0];
+      break;
+    case COPY:
+    case FILL:
+      p->text->dst = args[0];
+      p->text->src = args[1];
+      p->text->jmp = args[2];
+      break;
+    case EXIT:
+    case DUMP:
+      break;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      p->text->dst = args[1];
+      p->text->src = args[2];
+      FALLTHROUGH;
+    case JMP:
+      p->text->jmp = args[0];
+      p->pc++;
+      p->prev_boundary = true;
+      break;
+    default:
+      ir_error(p, "oops");
+  }
+
+#if 0
+  dump_inst(p->text);
+#endif
+}
+
+static void parse_eir(Parser* p) {
+  Inst text_root = {};
+  DataPrivate data_root = {};
+  int c;
+
+  p->in_text = 1;
+  p->lineno = 1;
+  p->text = &text_root;
+  p->data = &data_root;
+  p->syms = &p->sym_root;
+  p->locs = &p->loc_root;
+  p->num_locs = 1;
+  p->files = &p->file_root;
+  p->pc = 0;
+  p->prev_boundary = true;
+
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = JMP;
+  p->text->pc = p->pc++;
+  p->text->lineno = -1;
+  p->text->jmp.type = (ValueType)REF;
+  p->text->jmp.tmp = "main";
+  p->text->next = 0;
+  p->symtab = table_add(p->symtab, "main", &default_main);
+
+  for (;;) {
+    skip_ws(p);
+    c = ir_getc(p);
+    if (c == EOF)
+      break;
+
+    if (c == '#') {
+      skip_until_ret(p);
+    } else if (c == '_' || c == '.' || isalpha(c)) {
+      parse_line(p, c);
+    } else {
+      ir_error(p, "unexpected char");
+    }
+  }
+
+  serialize_data(p, &data_root);
+  p->text = text_root.next;
+  p->data = data_root.next;
+}
+
+static void resolve(Value* v, Table* symtab) {
+  if (v->type != (ValueType)REF)
+    return;
+  const char* name = (const char*)v->tmp;
+  Symbol* sym;
+  if (!table_get(symtab, name, (void*)&sym)) {
+    fprintf(stderr, "undefined sym: %s\n", name);
+    exit(1);
+  }
+  //fprintf(stderr, "resolved: %s %d\n", name, sym->value);
+  v->type = IMM;
+  v->imm = sym->value;
+  v->label = sym->is_text ? TEXT_LABEL : DATA_LABEL;
+}
+
+static void resolve_syms(Parser* p) {
+  for (DataPrivate* data = p->data; data; data = data->next) {
+    if (data->val.type == (ValueType)REF) {
+      resolve(&data->val, p->symtab);
+    }
+    data->v = MOD24(data->val.imm);
+    data->label = data->val.label;
+  }
+
+  for (Inst* inst = p->text; inst; inst = inst->next) {
+    resolve(&inst->dst, p->symtab);
+    resolve(&inst->src, p->symtab);
+    resolve(&inst->jmp, p->symtab);
+  }
+}
+
+static Module* load_eir_impl(const char* filename, FILE* fp,
+                             const char* buf, size_t size) {
+  Parser parser = {
+    .filename = filename,
+    .fp = fp,
+    .buf = buf,
+    .cur = buf,
+    .end = buf + size,
+    .arena = arena_new()
+  };
+  parse_eir(&parser);
+  resolve_syms(&parser);
+  table_free(parser.symtab);
+  table_free(parser.strtab);
+
+  Module* m = arena_alloc(parser.arena, sizeof(Module));
+  m->text = parser.text;
+  m->data = (Data*)parser.data;
+  m->arena = parser.arena;
+  m->syms = arena_alloc(m->arena, sizeof(Symbol) * parser.num_syms);
+  m->num_syms = parser.num_syms;
+  int i = 0;
+  for (SymbolPrivate* s = parser.sym_root.next; s; s = s->next)
+    m->syms[i++] = s->sym;
+
+  m->files = arena_alloc(m->arena, sizeof(char*) * parser.num_files);
+  m->num_files = parser.num_files;
+  for (FilePrivate* f = parser.file_root.next; f; f = f->next)
+    m->files[f->num] = f->name;
+  m->locs = arena_alloc(m->arena, sizeof(SourceLoc) * parser.num_locs);
+  m->num_locs = parser.num_locs;
+  m->locs[0].file = -1;
+  i = 1;
+  for (LocPrivate* l = parser.loc_root.next; l; l = l->next)
+    m->locs[i++] = l->loc;
+
+  reindex_module(m);
+  return m;
+}
+
+bool get_inst_source_loc(Module* m, Inst* inst,
+                         const char** file, int* line) {
+  if (inst->loc <= 0 || inst->loc >= m->num_locs)
+    return false;
+  SourceLoc* l = &m->locs[inst->loc];
+  *file = l->file < m->num_files ? m->files[l->file] : NULL;
+  *line = l->line;
+  return true;
+}
+
+bool get_pc_source_loc(Module* m, int pc, const char** file, int* line) {
+  if (pc < 0 || pc >= m->num_pcs || m->pc_start[pc] == m->pc_start[pc + 1])
+    return false;
+  return get_inst_source_loc(m, &m->insts[m->pc_start[pc]], file, line);
+}
+
+void reindex_module(Module* m) {
+  int n = 0;
+  int num_pcs = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    n++;
+    num_pcs = inst->pc + 1;
+  }
+
+  Inst* insts = arena_alloc(m->arena, sizeof(Inst) * n);
+  int* pc_start = arena_alloc(m->arena, sizeof(int) * (num_pcs + 1));
+  int i = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next, i++) {
+    insts[i] = *inst;
+    insts[i].next = i + 1 < n ? &insts[i + 1] : NULL;
+    for (; pc <= inst->pc; pc++)
+      pc_start[pc] = i;
+  }
+  for (; pc <= num_pcs; pc++)
+    pc_start[pc] = n;
+
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = num_pcs;
+}
+
+void free_module(Module* m) {
+#ifdef IR_USE_MMAP
+  if (m->map)
+    munmap(m->map, m->map_size);
+#endif
+  // |m| itself lives in the arena.
+  arena_free(m->arena);
+}
+
+Module* load_eir(FILE* fp) {
+  return load_eir_impl("<stdin>", fp, NULL, 0);
+}
+
+#ifdef IR_USE_MMAP
+
+// Maps the whole file so the lexer can scan it without stdio.
+Module* load_eir_from_file(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    // Pipes and devices cannot be mapped.
+    close(fd);
+    FILE* fp = fopen(filename, "r");
+    Module* r = load_eir_impl(filename, fp, NULL, 0);
+    fclose(fp);
+    return r;
+  }
+
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return load_eir_impl(filename, NULL, "", 0);
+  }
+  char* buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  if (is_eir_binary(buf, size))
+    return load_eir_binary(filename, buf, size);
+  Module* r = load_eir_impl(filename, NULL, buf, size);
+  munmap(buf, size);
+  return r;
+}
+
+#else
+
+Module* load_eir_from_file(const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  Module* r = load_eir_impl(filename, fp, NULL, 0);
+  fclose(fp);
+  return r;
+}
+
+#endif
+
+bool is_ext_op(Op op) {
+  return op >= MUL && op <= SHR;
+}
+
+int eval_ext_op(Op op, int dst, int src) {
+  unsigned int d = dst;
+  unsigned int s = src;
+  switch (op) {
+    case MUL:
+      return MOD24(d * s);
+    case DIV:
+      return s ? d / s : 0;
+    case MOD:
+      return s ? d % s : d;
+    case AND:
+      return d & s;
+    case OR:
+      return d | s;
+    case XOR:
+      return d ^ s;
+    case SHL:
+      return s < 24 ? MOD24(d << s) : 0;
+    case SHR:
+      return s < 24 ? d >> s : 0;
+    default:
+      return 0;
+  }
+}
+
+void dump_op(Op op, FILE* fp) {
+  static const char* op_strs[] = {
+    "mov", "add", "sub", "load", "store", "putc", "getc", "exit",
+    "jeq", "jne", "jlt", "jgt", "jle", "jge", "jmp", "xxx",
+    "eq", "ne", "lt", "gt", "le", "ge", "dump",
+    "mul", "div", "mod", "and", "or", "xor", "shl", "shr",
+    "copy", "fill"
+  };
+  fprintf(fp, "%s", op_strs[op]);
+}
+
+void dump_val(Value* val, FILE* fp) {
+  static const char* reg_strs[] = {
+    "A", "B", "C", "D", "BP", "SP"
+  };
+  if (val->type == REG) {
+    fprintf(fp, "%s", reg_strs[val->reg]);
+  } else if (val->type == IMM) {
+    fprintf(fp, "%d", val->imm);
+  } else {
+    fprintf(fp, "%d (type=%d)", val->imm, val->type);
+  }
+}
+
+void dump_inst_fp(Inst* inst, FILE* fp) {
+  dump_op(inst->op, fp);
+  switch (inst->op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case STORE:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case PUTC:
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case GETC:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      break;
+    case EXIT:
+    case DUMP:
+      break;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case JMP:
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
+    case COPY:
+    case FILL:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
+    default:
+      fprintf(fp, "oops op=%d\n", inst->op);
+      exit(1);
+  }
+  if (inst->no_wrap)
+    fprintf(fp, " nowrap");
+  fprintf(fp, " pc=%d @", inst->pc);
+  int lineno = inst->lineno;
+  // A hack to make the test for dump_ir.c.eir pass.
+#ifndef __eir__
+  lineno &= UINT_MAX;
+#endif
+  fprintf(fp, "%d\n", lineno);
+}
+
+void dump_inst(Inst* inst) {
+  dump_inst_fp(inst, stderr);
+}
+#include <ir/table.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define TABLE_INIT_CAP 64
+#else
+#define TABLE_INIT_CAP 1024
+#endif
+
+TableStats table_stats;
+
+static unsigned int table_hash(const char* key) {
+  // FNV-1a, which spreads similar labels such as .L1 and .L2 well enough
+  // for linear probing.
+  unsigned int h = 2166136261u;
+  for (; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static TableEntry* table_find(Table* tbl, const char* key, unsigned int h) {
+  unsigned int mask = tbl->cap - 1;
+  for (unsigned int i = h & mask;; i = (i + 1) & mask) {
+    TableEntry* e = &tbl->entries[i];
+    table_stats.probes++;
+    if (!e->key)
+      return e;
+    if (e->key == key || (e->hash == h && !strcmp(e->key, key)))
+      return e;
+  }
+}
+
+static void table_grow(Table* tbl) {
+  TableEntry* old = tbl->entries;
+  int old_cap = tbl->cap;
+  tbl->cap = old_cap ? old_cap * 2 : TABLE_INIT_CAP;
+  tbl->entries = calloc(tbl->cap, sizeof(TableEntry));
+  for (int i = 0; i < old_cap; i++) {
+    if (old[i].key)
+      *table_find(tbl, old[i].key, old[i].hash) = old[i];
+  }
+  free(old);
+}
+
+Table* table_add(Table* tbl, const char* key, const void* value) {
+  if (!tbl)
+    tbl = calloc(1, sizeof(Table));
+  // Keep the load factor at most 1/2 so probe sequences stay short.
+  if ((tbl->size + 1) * 2 > tbl->cap)
+    table_grow(tbl);
+  unsigned int h = table_hash(key);
+  TableEntry* e = table_find(tbl, key, h);
+  if (!e->key) {
+    e->key = key;
+    e->hash = h;
+    tbl->size++;
+  }
+  e->value = value;
+  table_stats.adds++;
+  return tbl;
+}
+
+bool table_get(Table* tbl, const char* key, const void** value) {
+  table_stats.lookups++;
+  if (!tbl)
+    return false;
+  TableEntry* e = table_find(tbl, key, table_hash(key));
+  if (!e->key)
+    return false;
+  *value = e->value;
+  return true;
+}
+
+void table_free(Table* tbl) {
+  if (!tbl)
+    return;
+  free(tbl->entries);
+  free(tbl);
+}
+#include <ir/arena.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN(n) (n)
+#else
+#define ARENA_CHUNK_SIZE (256 * 1024)
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#endif
+
+Arena* arena_new(void) {
+  return calloc(1, sizeof(Arena));
+}
+
+static ArenaChunk* arena_add_chunk(Arena* arena, size_t size) {
+  ArenaChunk* chunk = malloc(sizeof(ArenaChunk));
+  chunk->buf = calloc(1, size);
+  chunk->used = 0;
+  chunk->size = size;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  return chunk;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  ArenaChunk* chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size) {
+    if (size > ARENA_CHUNK_SIZE / 4) {
+      // Give big objects their own chunk and keep filling the current one.
+      ArenaChunk* big = arena_add_chunk(arena, size);
+      if (chunk) {
+        arena->chunks = chunk;
+        big->next = chunk->next;
+        chunk->next = big;
+      }
+      big->used = size;
+      return big->buf;
+    }
+    chunk = arena_add_chunk(arena, ARENA_CHUNK_SIZE);
+  }
+  void* r = chunk->buf + chunk->used;
+  chunk->used += size;
+  return r;
+}
+
+char* arena_strdup(Arena* arena, const char* s) {
+  size_t n = strlen(s) + 1;
+  char* r = arena_alloc(arena, n);
+  memcpy(r, s, n);
+  return r;
+}
+
+void arena_free(Arena* arena) {
+  if (!arena)
+    return;
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk* next = chunk->next;
+    free(chunk->buf);
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+#include <ir/ir.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <ir/arena.h>
+
+// Binary EIR layout. All fields are host-endian 32-bit integers unless
+// noted, and every section starts right after the previous one.
+//
+//   EirbHeader
+//   EirbInst     insts[num_insts]
+//   int32        pc_start[num_pcs + 1]
+//   EirbData     data[num_data]
+//   EirbSymbol   syms[num_syms]
+//   SourceLoc    locs[num_locs]
+//   uint32       files[num_files]     (strtab offsets, or ~0 for none)
+//   char         strtab[strtab_size]  (NUL-terminated names)
+//
+// Operands are already resolved, so the loader does not parse. It still
+// decodes the instruction and data records into new Inst and Data
+// arrays, since their layout differs from the records. Only pc_start,
+// locs and the names are used in place from the mapping. Every index
+// in the file is checked before use, so a broken file is an error
+// rather than a bad read later.
+
+// Text EIR never contains DEL, so the magic cannot be a valid text file.
+#define EIRB_MAGIC "\177EIR"
+#define EIRB_VERSION 3
+#define EIRB_NO_FILE 0xffffffffu
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_insts;
+  uint32_t num_pcs;
+  uint32_t num_data;
+  uint32_t num_syms;
+  uint32_t num_locs;
+  uint32_t num_files;
+  uint32_t strtab_size;
+} EirbHeader;
+
+typedef struct {
+  uint8_t op;
+  // ValueType of dst, src, and jmp in the low nibble and LabelType in
+  // the high nibble.
+  uint8_t types[3];
+  int32_t vals[3];
+  int32_t pc;
+  int32_t lineno;
+  int32_t loc;
+} EirbInst;
+
+typedef struct {
+  int32_t v;
+  uint32_t label;
+} EirbData;
+
+typedef struct {
+  uint32_t name;
+  int32_t value;
+  uint32_t is_text;
+} EirbSymbol;
+
+static void eirb_encode_value(Value* v, uint8_t* type, int32_t* val) {
+  *type = v->type | (v->type == IMM ? v->label << 4 : 0);
+  *val = v->type == REG ? (int32_t)v->reg : v->imm;
+}
+
+static bool eirb_check_value(uint8_t type, int32_t val) {
+  if ((type & 15) == REG)
+    return type >> 4 == 0 && val >= A && val <= SP;
+  // The text parser keeps every number in the word size, and the
+  // engines index memory with them unchecked.
+  return (type & 15) == IMM && type >> 4 <= DATA_LABEL &&
+         val >= 0 && val <= UINT_MAX;
+}
+
+static void eirb_decode_value(uint8_t type, int32_t val, Value* v) {
+  v->type = (ValueType)(type & 15);
+  v->label = (LabelType)(type >> 4);
+  if (v->type == REG)
+    v->reg = (Reg)val;
+  else
+    v->imm = val;
+}
+
+void write_eir_binary(Module* m, FILE* fp) {
+  EirbHeader h = {};
+  memcpy(h.magic, EIRB_MAGIC, 4);
+  h.version = EIRB_VERSION;
+  h.num_insts = m->num_insts;
+  h.num_pcs = m->num_pcs;
+  for (Data* d = m->data; d; d = d->next)
+    h.num_data++;
+  h.num_syms = m->num_syms;
+  h.num_locs = m->num_locs;
+  h.num_files = m->num_files;
+  for (int i = 0; i < m->num_syms; i++)
+    h.strtab_size += strlen(m->syms[i].name) + 1;
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      h.strtab_size += strlen(m->files[i]) + 1;
+  }
+  // Keep the file size a multiple of 4.
+  h.strtab_size = (h.strtab_size + 3) & ~3u;
+  fwrite(&h, sizeof(h), 1, fp);
+
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    EirbInst r = {};
+    r.op = inst->op;
+    eirb_encode_value(&inst->dst, &r.types[0], &r.vals[0]);
+    eirb_encode_value(&inst->src, &r.types[1], &r.vals[1]);
+    eirb_encode_value(&inst->jmp, &r.types[2], &r.vals[2]);
+    r.pc = inst->pc;
+    r.lineno = inst->lineno;
+    r.loc = inst->loc;
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  fwrite(m->pc_start, sizeof(int32_t), m->num_pcs + 1, fp);
+
+  for (Data* d = m->data; d; d = d->next) {
+    EirbData r = { d->v, d->label };
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  uint32_t name = 0;
+  for (int i = 0; i < m->num_syms; i++) {
+    EirbSymbol s = {
+      .name = name,
+      .value = m->syms[i].value,
+      .is_text = m->syms[i].is_text
+    };
+    fwrite(&s, sizeof(s), 1, fp);
+    name += strlen(m->syms[i].name) + 1;
+  }
+  fwrite(m->locs, sizeof(SourceLoc), m->num_locs, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    uint32_t off = EIRB_NO_FILE;
+    if (m->files[i]) {
+      off = name;
+      name += strlen(m->files[i]) + 1;
+    }
+    fwrite(&off, sizeof(off), 1, fp);
+  }
+  for (int i = 0; i < m->num_syms; i++)
+    fwrite(m->syms[i].name, 1, strlen(m->syms[i].name) + 1, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      fwrite(m->files[i], 1, strlen(m->files[i]) + 1, fp);
+  }
+  for (; name < h.strtab_size; name++)
+    fputc(0, fp);
+}
+
+bool is_eir_binary(const void* buf, size_t size) {
+  return size >= sizeof(EirbHeader) && !memcmp(buf, EIRB_MAGIC, 4);
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void eirb_error(const char* filename, const char* msg) {
+  fprintf(stderr, "%s: %s\n", filename, msg);
+  exit(1);
+}
+
+Module* load_eir_binary(const char* filename, void* buf, size_t size) {
+  const EirbHeader* h = buf;
+  if (h->version != EIRB_VERSION)
+    eirb_error(filename, "unsupported binary EIR version");
+  size_t need = (sizeof(EirbHeader) +
+                 sizeof(EirbInst) * (size_t)h->num_insts +
+                 sizeof(int32_t) * ((size_t)h->num_pcs + 1) +
+                 sizeof(EirbData) * (size_t)h->num_data +
+                 sizeof(EirbSymbol) * (size_t)h->num_syms +
+                 sizeof(SourceLoc) * (size_t)h->num_locs +
+                 sizeof(uint32_t) * (size_t)h->num_files +
+                 h->strtab_size);
+  if (need != size)
+    eirb_error(filename, "broken binary EIR");
+
+  const EirbInst* rec = (const EirbInst*)(h + 1);
+  int* pc_start = (int*)(rec + h->num_insts);
+  const EirbData* data = (const EirbData*)(pc_start + h->num_pcs + 1);
+  const EirbSymbol* syms = (const EirbSymbol*)(data + h->num_data);
+  SourceLoc* locs = (SourceLoc*)(syms + h->num_syms);
+  const uint32_t* files = (const uint32_t*)(locs + h->num_locs);
+  const char* strtab = (const char*)(files + h->num_files);
+  if (h->strtab_size && strtab[h->strtab_size - 1])
+    eirb_error(filename, "broken binary EIR");
+  if (pc_start[0] != 0 || pc_start[h->num_pcs] != (int)h->num_insts)
+    eirb_error(filename, "broken binary EIR");
+  for (uint32_t pc = 0; pc < h->num_pcs; pc++) {
+    if (pc_start[pc] > pc_start[pc + 1])
+      eirb_error(filename, "broken binary EIR");
+  }
+  // A file number without a .file has no name, but it is never negative
+  // except in locs[0], which no instruction uses.
+  for (uint32_t i = 1; i < h->num_locs; i++) {
+    if (locs[i].file < 0)
+      eirb_error(filename, "broken binary EIR");
+  }
+
+  Arena* arena = arena_new();
+  Module* m = arena_alloc(arena, sizeof(Module));
+  m->arena = arena;
+  m->map = buf;
+  m->map_size = size;
+
+  int n = h->num_insts;
+  Inst* insts = arena_alloc(arena, sizeof(Inst) * n);
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    int op = rec[i].op;
+    int pc = rec[i].pc;
+    int loc = rec[i].loc;
+    if (op >= LAST_OP || (op > JMP && op < EQ) ||
+        !eirb_check_value(rec[i].types[0], rec[i].vals[0]) ||
+        !eirb_check_value(rec[i].types[1], rec[i].vals[1]) ||
+        !eirb_check_value(rec[i].types[2], rec[i].vals[2]) ||
+        pc < 0 || pc >= (int)h->num_pcs ||
+        i < pc_start[pc] || i >= pc_start[pc + 1] ||
+        loc < 0 || (loc >= (int)h->num_locs && loc != 0))
+      eirb_error(filename, "broken binary EIR");
+    inst->op = (Op)op;
+    eirb_decode_value(rec[i].types[0], rec[i].vals[0], &inst->dst);
+    eirb_decode_value(rec[i].types[1], rec[i].vals[1], &inst->src);
+    eirb_decode_value(rec[i].types[2], rec[i].vals[2], &inst->jmp);
+    inst->pc = rec[i].pc;
+    inst->lineno = rec[i].lineno;
+    inst->loc = rec[i].loc;
+    inst->next = i + 1 < n ? &insts[i + 1] : NULL;
+  }
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = h->num_pcs;
+
+  Data* d = arena_alloc(arena, sizeof(Data) * h->num_data);
+  for (uint32_t i = 0; i < h->num_data; i++) {
+    if (data[i].label > DATA_LABEL || data[i].v < 0 || data[i].v > UINT_MAX)
+      eirb_error(filename, "broken binary EIR");
+    d[i].v = data[i].v;
+    d[i].label = (LabelType)data[i].label;
+    d[i].next = i + 1 < h->num_data ? &d[i + 1] : NULL;
+  }
+  m->data = h->num_data ? d : NULL;
+
+  m->syms = arena_alloc(arena, sizeof(Symbol) * h->num_syms);
+  m->num_syms = h->num_syms;
+  for (uint32_t i = 0; i < h->num_syms; i++) {
+    if (syms[i].name >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->syms[i].name = strtab + syms[i].name;
+    m->syms[i].value = syms[i].value;
+    m->syms[i].is_text = syms[i].is_text;
+  }
+
+  m->locs = locs;
+  m->num_locs = h->num_locs;
+  m->files = arena_alloc(arena, sizeof(char*) * h->num_files);
+  m->num_files = h->num_files;
+  for (uint32_t i = 0; i < h->num_files; i++) {
+    if (files[i] == EIRB_NO_FILE)
+      continue;
+    if (files[i] >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->files[i] = strtab + files[i];
+  }
+  return m;
+}
+
+#endif
+#include <ir/cfg.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+static bool cfg_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+bool cfg_has_reg_jump(Module* m) {
+  for (int i = 0; i < m->num_insts; i++) {
+    if (cfg_is_jump(m->insts[i].op) && m->insts[i].jmp.type == REG)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_pc_value(Module* m, LabelType label, int v, bool plain) {
+  if (label == DATA_LABEL || (label == NOT_LABEL && !plain))
+    return -1;
+  return v >= 0 && v < m->num_pcs ? v : -1;
+}
+
+int cfg_code_address(Module* m, Inst* inst, Value* v, bool plain) {
+  if (v->type != IMM)
+    return -1;
+  if (v->label == NOT_LABEL) {
+    Op op = inst->op;
+    if (v != &inst->src ||
+        (op != MOV && op != ADD && op != SUB && (op < MUL || op > SHR)))
+      return -1;
+  }
+  return cfg_pc_value(m, v->label, v->imm, plain);
+}
+
+int cfg_data_code_address(Module* m, Data* data, bool plain) {
+  return cfg_pc_value(m, data->label, data->v, plain);
+}
+
+static void cfg_mark_address(CFG* cfg, int pc, LabelType label) {
+  if (pc < 0)
+    return;
+  cfg->blocks[pc].address_taken = true;
+  if (label == NOT_LABEL && pc > cfg->max_plain_pc)
+    cfg->max_plain_pc = pc;
+}
+
+static void cfg_mark_value(CFG* cfg, Inst* inst, Value* v, bool plain) {
+  cfg_mark_address(cfg, cfg_code_address(cfg->module, inst, v, plain),
+                   v->label);
+}
+
+static void cfg_add_succ(BasicBlock* bb, int to) {
+  for (int i = 0; i < bb->num_succs; i++) {
+    if (bb->succs[i] == to)
+      return;
+  }
+  bb->succs[bb->num_succs++] = to;
+}
+
+static void cfg_add_succs(CFG* cfg, BasicBlock* bb) {
+  int num_pcs = cfg->module->num_pcs;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return;
+    if (!cfg_is_jump(inst->op))
+      continue;
+    if (inst->jmp.type == REG)
+      cfg_add_succ(bb, cfg->indirect);
+    else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs)
+      cfg_add_succ(bb, inst->jmp.imm);
+    if (inst->op == JMP)
+      return;
+  }
+  if (bb->pc + 1 < num_pcs)
+    cfg_add_succ(bb, bb->pc + 1);
+}
+
+static void cfg_build_edges(CFG* cfg) {
+  Module* m = cfg->module;
+  bool plain = cfg_has_reg_jump(m);
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    cfg_mark_value(cfg, inst, &inst->dst, plain);
+    cfg_mark_value(cfg, inst, &inst->src, plain);
+    if (!cfg_is_jump(inst->op))
+      cfg_mark_value(cfg, inst, &inst->jmp, plain);
+  }
+  for (Data* data = m->data; data; data = data->next)
+    cfg_mark_address(cfg, cfg_data_code_address(m, data, plain), data->label);
+
+  int num_address_taken = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    if (bb->address_taken)
+      num_address_taken++;
+    int max_succs = 1;
+    for (int i = 0; i < bb->num_insts; i++) {
+      if (cfg_is_jump(bb->insts[i].op))
+        max_succs++;
+    }
+    bb->succs = arena_alloc(cfg->arena, sizeof(int) * max_succs);
+    cfg_add_succs(cfg, bb);
+  }
+
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  indirect->succs = arena_alloc(cfg->arena, sizeof(int) * num_address_taken);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (cfg->blocks[pc].address_taken)
+      indirect->succs[indirect->num_succs++] = pc;
+  }
+
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++)
+      cfg->blocks[bb->succs[j]].num_preds++;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    bb->preds = arena_alloc(cfg->arena, sizeof(int) * bb->num_preds);
+    bb->num_preds = 0;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++) {
+      BasicBlock* succ = &cfg->blocks[bb->succs[j]];
+      succ->preds[succ->num_preds++] = i;
+    }
+  }
+}
+
+static void cfg_compute_rpo(CFG* cfg) {
+  int n = cfg->num_blocks;
+  cfg->rpo = arena_alloc(cfg->arena, sizeof(int) * n);
+  for (int i = 0; i < n; i++)
+    cfg->blocks[i].rpo = -1;
+  if (!cfg->module->num_pcs)
+    return;
+
+  int* stack = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* next = arena_alloc(cfg->arena, sizeof(int) * n);
+  bool* visited = arena_alloc(cfg->arena, sizeof(bool) * n);
+  int sp = 0;
+  int num_post = 0;
+  stack[sp++] = 0;
+  visited[0] = true;
+  while (sp) {
+    int b = stack[sp - 1];
+    BasicBlock* bb = &cfg->blocks[b];
+    if (next[b] < bb->num_succs) {
+      int s = bb->succs[next[b]++];
+      if (!visited[s]) {
+        visited[s] = true;
+        stack[sp++] = s;
+      }
+    } else {
+      // Blocks are stored in postorder and reversed below.
+      cfg->rpo[num_post++] = b;
+      sp--;
+    }
+  }
+
+  for (int i = 0; i < num_post / 2; i++) {
+    int t = cfg->rpo[i];
+    cfg->rpo[i] = cfg->rpo[num_post - 1 - i];
+    cfg->rpo[num_post - 1 - i] = t;
+  }
+  cfg->num_rpo = num_post;
+  for (int i = 0; i < num_post; i++)
+    cfg->blocks[cfg->rpo[i]].rpo = i;
+}
+
+static int cfg_intersect(CFG* cfg, int a, int b) {
+  BasicBlock* blocks = cfg->blocks;
+  while (a != b) {
+    while (blocks[a].rpo > blocks[b].rpo)
+      a = blocks[a].idom;
+    while (blocks[b].rpo > blocks[a].rpo)
+      b = blocks[b].idom;
+  }
+  return a;
+}
+
+// "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy.
+static void cfg_compute_dominators(CFG* cfg) {
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < cfg->num_blocks; i++)
+    blocks[i].idom = -1;
+  if (!cfg->num_rpo)
+    return;
+
+  int entry = cfg->rpo[0];
+  blocks[entry].idom = entry;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 1; i < cfg->num_rpo; i++) {
+      BasicBlock* bb = &blocks[cfg->rpo[i]];
+      int idom = -1;
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].idom < 0)
+          continue;
+        idom = idom < 0 ? p : cfg_intersect(cfg, p, idom);
+      }
+      if (bb->idom != idom) {
+        bb->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  blocks[entry].idom = -1;
+}
+
+bool cfg_dominates(CFG* cfg, int a, int b) {
+  if (cfg->blocks[a].rpo < 0)
+    return false;
+  for (; b >= 0; b = cfg->blocks[b].idom) {
+    if (b == a)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_compare_ints(const void* a, const void* b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+static void cfg_find_loops(CFG* cfg) {
+  int n = cfg->num_blocks;
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < n; i++)
+    blocks[i].loop = -1;
+  cfg->loops = arena_alloc(cfg->arena, sizeof(Loop) * n);
+  int* body = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* work = arena_alloc(cfg->arena, sizeof(int) * n);
+  // mark[b] == id + 1 once b is in the loop being built.
+  int* mark = arena_alloc(cfg->arena, sizeof(int) * n);
+
+  // A header dominates every block of its loop, so visiting headers in
+  // reverse postorder finds outer loops first.
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int h = cfg->rpo[i];
+    int id = cfg->num_loops;
+    int num_body = 0;
+    int num_work = 0;
+    for (int j = 0; j < blocks[h].num_preds; j++) {
+      int t = blocks[h].preds[j];
+      if (blocks[t].rpo < i || !cfg_dominates(cfg, h, t))
+        continue;
+      if (mark[t] != id + 1) {
+        mark[t] = id + 1;
+        body[num_body++] = t;
+        if (t != h)
+          work[num_work++] = t;
+      }
+    }
+    if (!num_body)
+      continue;
+    if (mark[h] != id + 1) {
+      mark[h] = id + 1;
+      body[num_body++] = h;
+    }
+    while (num_work) {
+      BasicBlock* bb = &blocks[work[--num_work]];
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].rpo < 0 || mark[p] == id + 1)
+          continue;
+        mark[p] = id + 1;
+        body[num_body++] = p;
+        work[num_work++] = p;
+      }
+    }
+
+    Loop* loop = &cfg->loops[cfg->num_loops++];
+    loop->header = h;
+    // Loops are either nested or disjoint, so the last loop found which
+    // contains |h| is the innermost one around this loop.
+    loop->parent = blocks[h].loop;
+    loop->depth = loop->parent < 0 ? 1 : cfg->loops[loop->parent].depth + 1;
+    qsort(body, num_body, sizeof(int), cfg_compare_ints);
+    loop->blocks = arena_alloc(cfg->arena, sizeof(int) * num_body);
+    loop->num_blocks = num_body;
+    for (int j = 0; j < num_body; j++) {
+      loop->blocks[j] = body[j];
+      blocks[body[j]].loop = id;
+      blocks[body[j]].loop_depth = loop->depth;
+    }
+  }
+}
+
+CFG* build_cfg(Module* m) {
+  Arena* arena = arena_new();
+  CFG* cfg = arena_alloc(arena, sizeof(CFG));
+  cfg->arena = arena;
+  cfg->module = m;
+  cfg->num_blocks = m->num_pcs + 1;
+  cfg->indirect = m->num_pcs;
+  cfg->max_plain_pc = -1;
+  cfg->blocks = arena_alloc(arena, sizeof(BasicBlock) * cfg->num_blocks);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    bb->pc = pc;
+    bb->insts = &m->insts[m->pc_start[pc]];
+    bb->num_insts = m->pc_start[pc + 1] - m->pc_start[pc];
+  }
+  cfg->blocks[cfg->indirect].pc = -1;
+
+  cfg_build_edges(cfg);
+  cfg_compute_rpo(cfg);
+  cfg_compute_dominators(cfg);
+  cfg_find_loops(cfg);
+  return cfg;
+}
+
+void free_cfg(CFG* cfg) {
+  arena_free(cfg->arena);
+}
+
+static void cfg_dump_list(FILE* fp, const char* name, int* list, int n) {
+  fprintf(fp, " %s=", name);
+  if (!n)
+    fprintf(fp, "-");
+  for (int i = 0; i < n; i++)
+    fprintf(fp, i ? ",%d" : "%d", list[i]);
+}
+
+void dump_cfg(CFG* cfg, FILE* fp) {
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    if (bb->pc < 0)
+      fprintf(fp, "indirect=%d", i);
+    else
+      fprintf(fp, "pc=%d insts=%d", bb->pc, bb->num_insts);
+    cfg_dump_list(fp, "succs", bb->succs, bb->num_succs);
+    cfg_dump_list(fp, "preds", bb->preds, bb->num_preds);
+    if (bb->rpo < 0)
+      fprintf(fp, " unreachable");
+    else
+      fprintf(fp, " idom=%d", bb->idom);
+    if (bb->loop >= 0)
+      fprintf(fp, " loop=%d depth=%d", bb->loop, bb->loop_depth);
+    if (bb->address_taken)
+      fprintf(fp, " address_taken");
+    fprintf(fp, "\n");
+  }
+  for (int i = 0; i < cfg->num_loops; i++) {
+    Loop* loop = &cfg->loops[i];
+    fprintf(fp, "loop=%d header=%d parent=%d depth=%d",
+            i, loop->header, loop->parent, loop->depth);
+    cfg_dump_list(fp, "blocks", loop->blocks, loop->num_blocks);
+    fprintf(fp, "\n");
+  }
+}
+#include <ir/opt.h>
+
+#include <stdlib.h>
+
+#define OPT_NUM_REGS 6
+#define OPT_ALL_REGS ((1 << OPT_NUM_REGS) - 1)
+#define OPT_MAX_MEM_FACTS 8
+
+// What the forward pass knows at the current instruction. A known
+// register holds either an immediate or the same value as another
+// register, and a memory fact says the word at |addr| equals |val|.
+typedef struct {
+  Value addr;
+  Value val;
+} MemFact;
+
+typedef struct {
+  bool known[OPT_NUM_REGS];
+  Value regs[OPT_NUM_REGS];
+  MemFact mem[OPT_MAX_MEM_FACTS];
+  int num_mem;
+} OptState;
+
+static bool opt_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static bool opt_is_cmp(Op op) {
+  return op >= EQ && op <= GE;
+}
+
+static bool opt_same_value(Value* a, Value* b) {
+  if (a->type != b->type)
+    return false;
+  if (a->type == REG)
+    return a->reg == b->reg;
+  return a->imm == b->imm && a->label == b->label;
+}
+
+static bool opt_is_plain_imm(Value* v) {
+  return v->type == IMM && v->label == NOT_LABEL;
+}
+
+static void opt_set_mov_imm(Inst* inst, int v) {
+  inst->op = MOV;
+  inst->src.type = IMM;
+  inst->src.label = NOT_LABEL;
+  inst->src.imm = MOD24(v);
+}
+
+// Forgets everything which depends on the old value of |r|.
+static void opt_kill_reg(OptState* s, Reg r) {
+  s->known[r] = false;
+  for (int i = 0; i < OPT_NUM_REGS; i++) {
+    if (s->known[i] && s->regs[i].type == REG && s->regs[i].reg == r)
+      s->known[i] = false;
+  }
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if ((f->addr.type == REG && f->addr.reg == r) ||
+        (f->val.type == REG && f->val.reg == r))
+      continue;
+    s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+}
+
+// Replaces a register operand by what it is known to hold.
+static void opt_rewrite_use(OptState* s, Value* v, bool allow_imm) {
+  if (v->type != REG || !s->known[v->reg])
+    return;
+  Value* k = &s->regs[v->reg];
+  if (k->type == REG || allow_imm)
+    *v = *k;
+}
+
+// The value a register will be known to hold after it is set to |v|.
+static void opt_canonical(OptState* s, Value* v, Value* out) {
+  if (v->type == REG && s->known[v->reg])
+    *out = s->regs[v->reg];
+  else
+    *out = *v;
+}
+
+static MemFact* opt_find_mem(OptState* s, Value* addr) {
+  for (int i = 0; i < s->num_mem; i++) {
+    if (opt_same_value(&s->mem[i].addr, addr))
+      return &s->mem[i];
+  }
+  return NULL;
+}
+
+static void opt_add_mem(OptState* s, Value* addr, Value* val) {
+  if (s->num_mem == OPT_MAX_MEM_FACTS) {
+    for (int i = 1; i < s->num_mem; i++)
+      s->mem[i - 1] = s->mem[i];
+    s->num_mem--;
+  }
+  s->mem[s->num_mem].addr = *addr;
+  s->mem[s->num_mem].val = *val;
+  s->num_mem++;
+}
+
+// Two immediates never alias unless they are equal. Anything else may.
+static void opt_store_mem(OptState* s, Value* addr, Value* val) {
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if (f->addr.type == IMM && addr->type == IMM && f->addr.imm != addr->imm)
+      s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+  opt_add_mem(s, addr, val);
+}
+
+static bool opt_compare(Op op, int l, int r) {
+  switch (op) {
+    case JEQ: case EQ: return l == r;
+    case JNE: case NE: return l != r;
+    case JLT: case LT: return l < r;
+    case JGT: case GT: return l > r;
+    case JLE: case LE: return l <= r;
+    case JGE: case GE: return l >= r;
+    default:
+      return false;
+  }
+}
+
+// Whether "op dst, v" leaves dst unchanged.
+static bool opt_is_identity(Op op, Value* v) {
+  if (!opt_is_plain_imm(v))
+    return false;
+  switch (op) {
+    case ADD: case SUB: case OR: case XOR: case SHL: case SHR:
+      return v->imm == 0;
+    case MUL: case DIV:
+      return v->imm == 1;
+    default:
+      return false;
+  }
+}
+
+// Rewrites |inst| using and updating |s|. Returns false if the
+// instruction has no effect and can be dropped.
+static bool opt_forward(OptState* s, Inst* inst) {
+  Op op = inst->op;
+  switch (op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case PUTC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_rewrite_use(s, &inst->src, true);
+      break;
+    case STORE:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      break;
+    case COPY:
+    case FILL:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      opt_rewrite_use(s, &inst->jmp, true);
+      break;
+    default:
+      break;
+  }
+  if (opt_is_jump(op)) {
+    if (op != JMP)
+      opt_rewrite_use(s, &inst->dst, false);
+    opt_rewrite_use(s, &inst->jmp, true);
+  }
+
+  Value* dst = &inst->dst;
+  Value* src = &inst->src;
+  Value* known_dst =
+      dst->type == REG && s->known[dst->reg] ? &s->regs[dst->reg] : NULL;
+  bool folds = (known_dst && opt_is_plain_imm(known_dst) &&
+                opt_is_plain_imm(src));
+
+  if (opt_is_identity(op, src))
+    return false;
+
+  switch (op) {
+    case ADD:
+    case SUB:
+      if (folds) {
+        int v = (op == ADD ? known_dst->imm + src->imm :
+                 known_dst->imm - src->imm);
+        opt_set_mov_imm(inst, v);
+      }
+      break;
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      if (folds)
+        opt_set_mov_imm(inst, opt_compare(op, known_dst->imm, src->imm));
+      break;
+
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      if (folds)
+        opt_set_mov_imm(inst, eval_ext_op(op, known_dst->imm, src->imm));
+      break;
+
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+      if (folds) {
+        if (!opt_compare(op, known_dst->imm, src->imm))
+          return false;
+        inst->op = JMP;
+        inst->dst.type = REG;
+        inst->dst.reg = A;
+        inst->src = inst->dst;
+      }
+      break;
+
+    case LOAD: {
+      MemFact* f = opt_find_mem(s, src);
+      if (f && f->val.type == REG && f->val.reg == dst->reg)
+        return false;
+      if (f) {
+        inst->op = MOV;
+        *src = f->val;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  switch (inst->op) {
+    case MOV: {
+      if (src->type == REG && src->reg == dst->reg)
+        return false;
+      if (known_dst && opt_same_value(known_dst, src))
+        return false;
+      Value v;
+      opt_canonical(s, src, &v);
+      opt_kill_reg(s, dst->reg);
+      s->known[dst->reg] = true;
+      s->regs[dst->reg] = v;
+      break;
+    }
+
+    case ADD:
+    case SUB:
+    case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_kill_reg(s, dst->reg);
+      break;
+
+    case LOAD: {
+      Value addr = *src;
+      opt_kill_reg(s, dst->reg);
+      if (!(addr.type == REG && addr.reg == dst->reg))
+        opt_add_mem(s, &addr, dst);
+      break;
+    }
+
+    case STORE: {
+      Value v;
+      opt_canonical(s, dst, &v);
+      opt_store_mem(s, src, &v);
+      break;
+    }
+
+    case COPY:
+    case FILL:
+      s->num_mem = 0;
+      break;
+
+    default:
+      break;
+  }
+  return true;
+}
+
+static int opt_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+// Registers |inst| reads.
+static int opt_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return opt_reg_bit(&inst->src);
+    case ADD:
+    case SUB:
+    case STORE:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              (opt_is_jump(inst->op) ? opt_reg_bit(&inst->jmp) : 0));
+    case JMP:
+      return opt_reg_bit(&inst->jmp);
+    case COPY:
+    case FILL:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              opt_reg_bit(&inst->jmp));
+    default:
+      return 0;
+  }
+}
+
+// Whether |inst| only writes its dst register.
+static bool opt_is_pure_def(Inst* inst) {
+  return (inst->op == MOV || inst->op == ADD || inst->op == SUB ||
+          inst->op == LOAD || opt_is_cmp(inst->op) || is_ext_op(inst->op));
+}
+
+// Returns the number of instructions of a block that were dropped.
+static int opt_block(Inst* insts, int n, bool* dead) {
+  OptState s = {};
+  int removed = 0;
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    if (!opt_forward(&s, inst)) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (inst->op == EXIT || inst->op == JMP) {
+      // The rest of the block never runs.
+      for (i++; i < n; i++) {
+        dead[i] = true;
+        removed++;
+      }
+    }
+  }
+
+  // Every register may be read by later blocks.
+  int live = OPT_ALL_REGS;
+  for (int i = n - 1; i >= 0; i--) {
+    Inst* inst = &insts[i];
+    if (dead[i])
+      continue;
+    if (inst->op == EXIT) {
+      live = 0;
+      continue;
+    }
+    if (opt_is_jump(inst->op))
+      live = OPT_ALL_REGS;
+    if (opt_is_pure_def(inst) && !(live & (1 << inst->dst.reg))) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (opt_is_pure_def(inst) || inst->op == GETC)
+      live &= ~(1 << inst->dst.reg);
+    live |= opt_uses(inst);
+  }
+
+  // Keep one instruction so the pc stays a valid jump target.
+  if (n && removed == n) {
+    dead[n - 1] = false;
+    removed--;
+  }
+  return removed;
+}
+
+void optimize_module(Module* m) {
+  bool* dead = calloc(m->num_insts + 1, sizeof(bool));
+  int removed = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    int start = m->pc_start[pc];
+    int n = m->pc_start[pc + 1] - start;
+    removed += opt_block(&m->insts[start], n, &dead[start]);
+  }
+
+  if (removed) {
+    Inst root;
+    Inst* prev = &root;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (dead[i])
+        continue;
+      prev->next = &m->insts[i];
+      prev = prev->next;
+    }
+    prev->next = NULL;
+    m->text = root.next;
+    reindex_module(m);
+  }
+  free(dead);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef __eir__
+#include <time.h>
+#endif
+
+#include <ir/opt.h>
+#include <ir/range.h>
+
+static const Pass g_passes[] = {
+  { "opt", optimize_module,
+    "block-local constant/copy propagation and dead write removal" },
+  { "dce", remove_dead_code_and_data,
+    "remove unreachable pcs and unreferenced data" },
+  { "merge", merge_basic_blocks,
+    "thread jumps to jumps and merge fallthrough-only pcs" },
+  { "lower_ext", lower_ext_ops,
+    "replace mul/div/mod/and/or/xor/shl/shr with calls to helpers" },
+  { "lower_block", lower_block_ops,
+    "replace copy/fill with calls to loop helpers" },
+  { "layout", layout_by_profile,
+    "reorder pcs by profile counts so hot loops stay in one chunk" },
+  { "ranges", analyze_ranges,
+    "mark add/sub which never wrap around so backends skip the mask" },
+  { "split_mem", split_basic_block_by_mem,
+    "start a new pc after every load and store" },
+  { NULL, NULL, NULL }
+};
+
+#define MAX_PIPELINE 64
+
+static const Pass* g_pipeline[MAX_PIPELINE];
+static int g_num_pipeline;
+
+const Pass* find_pass(const char* name) {
+  for (const Pass* pass = g_passes; pass->name; pass++) {
+    if (!strcmp(pass->name, name))
+      return pass;
+  }
+  return NULL;
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void pass_error(const char* msg, const char* name) {
+  fprintf(stderr, "%s: %s\navailable passes:\n", msg, name);
+  for (const Pass* pass = g_passes; pass->name; pass++)
+    fprintf(stderr, "  %s: %s\n", pass->name, pass->help);
+  exit(1);
+}
+
+void add_pass(const char* name) {
+  const Pass* pass = find_pass(name);
+  if (!pass)
+    pass_error("unknown pass", name);
+  if (g_num_pipeline == MAX_PIPELINE)
+    pass_error("too many passes", name);
+  g_pipeline[g_num_pipeline++] = pass;
+}
+
+void add_passes(const char* names) {
+  char buf[64];
+  while (*names) {
+    const char* end = strchr(names, ',');
+    int len = end ? end - names : (int)strlen(names);
+    if (len >= (int)sizeof(buf))
+      pass_error("unknown pass", names);
+    if (len) {
+      memcpy(buf, names, len);
+      buf[len] = 0;
+      add_pass(buf);
+    }
+    names += len;
+    if (*names)
+      names++;
+  }
+}
+
+static int pass_count_data(Module* m) {
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    n++;
+  return n;
+}
+
+static void pass_print_count(const char* name, int before, int after) {
+  fprintf(stderr, " %s %d -> %d (%s%d)", name, before, after,
+          after >= before ? "+" : "", after - before);
+}
+
+#ifndef __eir__
+static double pass_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+#endif
+
+void run_passes(Module* m, bool show_stats) {
+  for (int i = 0; i < g_num_pipeline; i++) {
+    const Pass* pass = g_pipeline[i];
+    if (!show_stats) {
+      pass->run(m);
+      continue;
+    }
+
+    int insts = m->num_insts;
+    int pcs = m->num_pcs;
+    int data = pass_count_data(m);
+#ifndef __eir__
+    double start = pass_now_ms();
+#endif
+    pass->run(m);
+    fprintf(stderr, "pass %s:", pass->name);
+#ifndef __eir__
+    fprintf(stderr, " %.3f ms", pass_now_ms() - start);
+#endif
+    pass_print_count("insts", insts, m->num_insts);
+    pass_print_count("pcs", pcs, m->num_pcs);
+    pass_print_count("data", data, pass_count_data(m));
+    fprintf(stderr, "\n");
+  }
+}
+
+static void pass_relocate_value(Value* v, const int* pc_map, int num_pcs) {
+  if (v->type == IMM && v->label == TEXT_LABEL &&
+      v->imm >= 0 && v->imm <= num_pcs)
+    v->imm = pc_map[v->imm];
+}
+
+void relocate_text_labels(Module* m, const int* pc_map) {
+  int num_pcs = m->num_pcs;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    pass_relocate_value(&inst->dst, pc_map, num_pcs);
+    pass_relocate_value(&inst->src, pc_map, num_pcs);
+    // A jump target is a pc even if it was written as a number.
+    if (inst->op >= JEQ && inst->op <= JMP) {
+      Value* v = &inst->jmp;
+      if (v->type == IMM && v->imm >= 0 && v->imm <= num_pcs)
+        v->imm = pc_map[v->imm];
+    } else {
+      pass_relocate_value(&inst->jmp, pc_map, num_pcs);
+    }
+  }
+  for (Data* data = m->data; data; data = data->next) {
+    if (data->label == TEXT_LABEL && data->v >= 0 && data->v <= num_pcs)
+      data->v = pc_map[data->v];
+  }
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (sym->is_text && sym->value >= 0 && sym->value <= num_pcs)
+      sym->value = pc_map[sym->value];
+  }
+}
+
+void split_basic_block_by_mem(Module* m) {
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    for (; pc <= inst->pc; pc++)
+      pc_map[pc] = pc + shift;
+    int old_pc = inst->pc;
+    inst->pc += shift;
+    if ((inst->op == LOAD || inst->op == STORE) &&
+        inst->next && inst->next->pc == old_pc)
+      shift++;
+  }
+  for (; pc <= m->num_pcs; pc++)
+    pc_map[pc] = pc + shift;
+
+  if (shift) {
+    relocate_text_labels(m, pc_map);
+    reindex_module(m);
+  }
+  free(pc_map);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+// lower_ext and lower_block replace each MUL .. SHR and COPY .. FILL
+// with a call to a helper routine made of basic ops. The call site
+// saves A-D, loads the operands into A, B and (for block ops) C, and
+// pushes its return pc:
+//
+//     sub SP, 1; store A, SP       ; ... and B, C, D
+//     <C = len>; <B = src>; <A = dst>
+//     mov D, ret; sub SP, 1; store D, SP; jmp helper
+//   ret:                           ; a new pc
+//     <the saved dst = A>          ; ext ops only
+//     load A, SP; mov D, A; add SP, 1   ; ... and C, B, A
+//
+// Helpers may clobber A-D, leave the result in A, and return by popping
+// the return pc. Each used helper is emitted once after the last pc.
+// Only "load A, X" is used since some backends support nothing else.
+
+#define LOWER_BIT23 0x800000
+#define LOWER_NUM_SAVED 4
+
+// An instruction of a helper routine. |jmp| is a local label for jumps,
+// or LOWER_JMP_D for "jmp D". LOWER_LABEL entries define label |jmp|.
+typedef struct {
+  int op;
+  Reg dst;
+  int src;
+  bool src_is_imm;
+  int jmp;
+} LowerInst;
+
+enum {
+  LOWER_LABEL = -1,
+  LOWER_END = -2,
+  LOWER_JMP_D = -1,
+  LOWER_MAX_LABELS = 16
+};
+
+#define LL(l) { LOWER_LABEL, A, 0, false, l }
+#define RR(op, d, s) { op, d, s, false, 0 }
+#define RI(op, d, i) { op, d, i, true, 0 }
+#define JI(op, l, d, i) { op, d, i, true, l }
+#define JR(op, l, d, s) { op, d, s, false, l }
+#define JL(l) { JMP, A, 0, false, l }
+#define RET                                     \
+  RR(MOV, C, A), RR(LOAD, A, SP), RI(ADD, SP, 1), \
+  RR(MOV, D, A), RR(MOV, A, C),                   \
+  { JMP, D, 0, false, LOWER_JMP_D }
+#define END { LOWER_END, A, 0, false, 0 }
+
+// Shift-and-add over the bits of B from the top, after skipping its
+// leading zeros.
+static const LowerInst lower_mul[] = {
+  RI(MOV, C, 0),
+  RI(MOV, D, 24),
+  JI(JEQ, 3, B, 0),
+  LL(0),
+  JI(JGE, 1, B, LOWER_BIT23),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, C, C),
+  JI(JLT, 2, B, LOWER_BIT23),
+  RR(ADD, C, A),
+  LL(2),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JI(JNE, 1, D, 0),
+  LL(3),
+  RR(MOV, A, C),
+  RET,
+  END
+};
+
+// Restoring division. C is the quotient and D the remainder. C starts as
+// 1 and this bit reaches bit 23 at the 24th and last step. When D has
+// bit 23 set, doubling it overflows but the subtraction is then always
+// needed and wraps back to the right value.
+#define LOWER_DIV_BODY                          \
+  JI(JEQ, 10, B, 0),                            \
+  RI(MOV, C, 1),                                \
+  RI(MOV, D, 0),                                \
+  LL(0),                                        \
+  JI(JGE, 5, C, LOWER_BIT23),                   \
+  JI(JGE, 3, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 1, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JR(JLT, 0, D, B),                             \
+  LL(2),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(0),                                        \
+  LL(3),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 4, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(4),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JL(2),                                        \
+  LL(5),                                        \
+  JI(JGE, 8, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 6, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(6),                                        \
+  RR(ADD, C, C),                                \
+  JR(JLT, 9, D, B),                             \
+  LL(7),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(9),                                        \
+  LL(8),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 11, A, LOWER_BIT23),                  \
+  RI(ADD, D, 1),                                \
+  LL(11),                                       \
+  RR(ADD, C, C),                                \
+  JL(7),                                        \
+  LL(9)
+
+static const LowerInst lower_div[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, C),
+  RET,
+  LL(10),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+static const LowerInst lower_mod[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, D),
+  RET,
+  // The remainder of a division by zero is the dividend, already in A.
+  LL(10),
+  RET,
+  END
+};
+
+// Bitwise ops build C from the top bits of A and B, doubling all three
+// 24 times.
+#define LOWER_BITWISE_HEAD                      \
+  RI(MOV, C, 0),                                \
+  RI(MOV, D, 24),                               \
+  LL(0),                                        \
+  RR(ADD, C, C)
+
+#define LOWER_BITWISE_TAIL                      \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, B, B),                                \
+  RI(SUB, D, 1),                                \
+  JI(JNE, 0, D, 0),                             \
+  RR(MOV, A, C),                                \
+  RET,                                          \
+  END
+
+static const LowerInst lower_and[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JLT, 1, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_or[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 2, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_xor[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 3, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  JL(2),
+  LL(3),
+  JI(JGE, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_shl[] = {
+  JI(JGE, 2, B, 24),
+  LL(0),
+  JI(JEQ, 1, B, 0),
+  RR(ADD, A, A),
+  RI(SUB, B, 1),
+  JL(0),
+  LL(2),
+  RI(MOV, A, 0),
+  LL(1),
+  RET,
+  END
+};
+
+// Takes the top 24 - B bits of A.
+static const LowerInst lower_shr[] = {
+  JI(JGE, 3, B, 24),
+  RI(MOV, C, 24),
+  RR(SUB, C, B),
+  RI(MOV, D, 0),
+  LL(0),
+  JI(JEQ, 2, C, 0),
+  RR(ADD, D, D),
+  JI(JLT, 1, A, LOWER_BIT23),
+  RI(ADD, D, 1),
+  LL(1),
+  RR(ADD, A, A),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(2),
+  RR(MOV, A, D),
+  RET,
+  LL(3),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+// memmove of C words from B to A. Copies backwards if A is above B.
+static const LowerInst lower_copy[] = {
+  RR(MOV, D, A),
+  JR(JGT, 1, D, B),
+  LL(0),
+  JI(JEQ, 3, C, 0),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(ADD, B, 1),
+  RI(ADD, D, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, B, C),
+  RR(ADD, D, C),
+  LL(2),
+  JI(JEQ, 3, C, 0),
+  RI(SUB, B, 1),
+  RI(SUB, D, 1),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(SUB, C, 1),
+  JL(2),
+  LL(3),
+  RET,
+  END
+};
+
+static const LowerInst lower_fill[] = {
+  LL(0),
+  JI(JEQ, 1, C, 0),
+  RR(STORE, B, A),
+  RI(ADD, A, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RET,
+  END
+};
+
+static const LowerInst* lower_helper_code(Op op) {
+  switch (op) {
+    case MUL: return lower_mul;
+    case DIV: return lower_div;
+    case MOD: return lower_mod;
+    case AND: return lower_and;
+    case OR: return lower_or;
+    case XOR: return lower_xor;
+    case SHL: return lower_shl;
+    case SHR: return lower_shr;
+    case COPY: return lower_copy;
+    case FILL: return lower_fill;
+    default: return NULL;
+  }
+}
+
+// Appends instructions to |tail| and numbers pcs the way the parser
+// does: a jump ends its pc and a label after instructions starts one.
+typedef struct {
+  Arena* arena;
+  Inst* tail;
+  int pc;
+  bool at_boundary;
+  // Debug info and profile counts for the emitted instructions.
+  int lineno;
+  int loc;
+  long count;
+} LowerEmitter;
+
+static Inst* lower_emit(LowerEmitter* e, int op) {
+  Inst* inst = arena_alloc(e->arena, sizeof(Inst));
+  inst->op = (Op)op;
+  inst->pc = e->pc;
+  inst->lineno = e->lineno;
+  inst->loc = e->loc;
+  inst->count = e->count;
+  e->tail->next = inst;
+  e->tail = inst;
+  e->at_boundary = false;
+  if (op >= JEQ && op <= JMP) {
+    e->pc++;
+    e->at_boundary = true;
+  }
+  return inst;
+}
+
+static void lower_set_reg(Value* v, Reg r) {
+  v->type = REG;
+  v->reg = r;
+}
+
+static void lower_set_imm(Value* v, int imm, LabelType label) {
+  v->type = IMM;
+  v->imm = imm;
+  v->label = label;
+}
+
+static void lower_emit_rr(LowerEmitter* e, Op op, Reg dst, Reg src) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_reg(&inst->src, src);
+}
+
+static void lower_emit_ri(LowerEmitter* e, Op op, Reg dst, int imm) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_imm(&inst->src, imm, NOT_LABEL);
+}
+
+static void lower_emit_push(LowerEmitter* e, Reg r) {
+  lower_emit_ri(e, SUB, SP, 1);
+  lower_emit_rr(e, STORE, r, SP);
+}
+
+static void lower_emit_pop(LowerEmitter* e, Reg r) {
+  lower_emit_rr(e, LOAD, A, SP);
+  if (r != A)
+    lower_emit_rr(e, MOV, r, A);
+  lower_emit_ri(e, ADD, SP, 1);
+}
+
+// Assigns pcs to the labels of |code| placed at |pc| and returns the
+// first pc after it.
+static int lower_layout_helper(const LowerInst* code, int pc, int* labels) {
+  bool at_boundary = true;
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!at_boundary)
+        pc++;
+      at_boundary = true;
+      labels[li->jmp] = pc;
+    } else if (li->op >= JEQ && li->op <= JMP) {
+      pc++;
+      at_boundary = true;
+    } else {
+      at_boundary = false;
+    }
+  }
+  return at_boundary ? pc : pc + 1;
+}
+
+// Emits |code| starting at a new pc.
+static void lower_emit_helper(LowerEmitter* e, const LowerInst* code) {
+  int labels[LOWER_MAX_LABELS];
+  lower_layout_helper(code, e->pc, labels);
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!e->at_boundary)
+        e->pc++;
+      e->at_boundary = true;
+      continue;
+    }
+    Inst* inst = lower_emit(e, li->op);
+    if (li->op == JMP && li->jmp == LOWER_JMP_D) {
+      lower_set_reg(&inst->jmp, D);
+      continue;
+    }
+    if (li->op != JMP) {
+      lower_set_reg(&inst->dst, li->dst);
+      if (li->src_is_imm)
+        lower_set_imm(&inst->src, li->src, NOT_LABEL);
+      else
+        lower_set_reg(&inst->src, (Reg)li->src);
+    }
+    if (li->op >= JEQ && li->op <= JMP)
+      lower_set_imm(&inst->jmp, labels[li->jmp], TEXT_LABEL);
+  }
+}
+
+// Stack slot of a saved register once the frame is complete.
+static int lower_slot(Reg r) {
+  return LOWER_NUM_SAVED - 1 - r;
+}
+
+// Makes |addr| point to the stack slot of |r|.
+static void lower_emit_slot_addr(LowerEmitter* e, Reg addr, Reg r) {
+  lower_emit_rr(e, MOV, addr, SP);
+  lower_emit_ri(e, ADD, addr, lower_slot(r));
+}
+
+// Loads the value |v| had before the call site into |r|, which is A, B
+// or C. They are loaded in the order C, B, A since A is used to load
+// from memory. D is used as a scratch register.
+static void lower_emit_operand(LowerEmitter* e, Reg r, Value* v) {
+  if (v->type == IMM) {
+    Inst* inst = lower_emit(e, MOV);
+    lower_set_reg(&inst->dst, r);
+    inst->src = *v;
+  } else if (v->reg == BP) {
+    lower_emit_rr(e, MOV, r, BP);
+  } else if (v->reg == SP) {
+    lower_emit_rr(e, MOV, r, SP);
+    lower_emit_ri(e, ADD, r, LOWER_NUM_SAVED);
+  } else {
+    lower_emit_slot_addr(e, D, v->reg);
+    lower_emit_rr(e, LOAD, A, D);
+    if (r != A)
+      lower_emit_rr(e, MOV, r, A);
+  }
+}
+
+// Copies the saved registers from the frame at SP to the one at B.
+static void lower_emit_copy_frame(LowerEmitter* e, bool descending) {
+  for (int i = 0; i < LOWER_NUM_SAVED; i++) {
+    Reg r = (Reg)(descending ? i : D - i);
+    lower_emit_slot_addr(e, C, r);
+    lower_emit_rr(e, LOAD, A, C);
+    lower_emit_rr(e, MOV, C, B);
+    lower_emit_ri(e, ADD, C, lower_slot(r));
+    lower_emit_rr(e, STORE, A, C);
+  }
+}
+
+// Moves the saved registers to just below the new SP in A, so popping
+// them leaves SP at the result. The frames may overlap, so the copy
+// runs in the direction of the move:
+//
+//     mov B, A; sub B, 4; jgt down, B, SP
+//     <copy upwards>; jmp done
+//   down:
+//     <copy downwards>
+//   done:
+//     mov SP, B
+static void lower_emit_move_frame(LowerEmitter* e) {
+  lower_emit_rr(e, MOV, B, A);
+  lower_emit_ri(e, SUB, B, LOWER_NUM_SAVED);
+  Inst* down = lower_emit(e, JGT);
+  lower_set_reg(&down->dst, B);
+  lower_set_reg(&down->src, SP);
+  lower_set_imm(&down->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, false);
+  Inst* done = lower_emit(e, JMP);
+  lower_set_imm(&done->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, true);
+  e->pc++;
+  lower_emit_rr(e, MOV, SP, B);
+}
+
+// The number of pcs a call site adds to the pc of |inst|.
+static int lower_call_pcs(Inst* inst) {
+  return is_ext_op(inst->op) && inst->dst.reg == SP ? 4 : 1;
+}
+
+static void lower_emit_call(LowerEmitter* e, Inst* inst, int helper_pc) {
+  for (int r = A; r <= D; r++)
+    lower_emit_push(e, (Reg)r);
+  if (!is_ext_op(inst->op))
+    lower_emit_operand(e, C, &inst->jmp);
+  lower_emit_operand(e, B, &inst->src);
+  lower_emit_operand(e, A, &inst->dst);
+
+  Inst* ret = lower_emit(e, MOV);
+  lower_set_reg(&ret->dst, D);
+  lower_set_imm(&ret->src, e->pc + 1, TEXT_LABEL);
+  lower_emit_push(e, D);
+  Inst* jmp = lower_emit(e, JMP);
+  lower_set_imm(&jmp->jmp, helper_pc, TEXT_LABEL);
+
+  Reg dst = inst->dst.reg;
+  if (!is_ext_op(inst->op)) {
+    // Block ops have no result.
+  } else if (dst == BP) {
+    lower_emit_rr(e, MOV, BP, A);
+  } else if (dst == SP) {
+    lower_emit_move_frame(e);
+  } else {
+    lower_emit_slot_addr(e, C, dst);
+    lower_emit_rr(e, STORE, A, C);
+  }
+  for (int r = D; r >= A; r--)
+    lower_emit_pop(e, (Reg)r);
+}
+
+// Replaces the ops from |first| to |last| by calls.
+static void lower_ops(Module* m, Op first, Op last) {
+  int num_calls = 0;
+  bool used[LAST_OP] = {};
+  long helper_count[LAST_OP] = {};
+  for (int i = 0; i < m->num_insts; i++) {
+    Op op = m->insts[i].op;
+    if (op >= first && op <= last) {
+      num_calls++;
+      used[op] = true;
+      helper_count[op] += m->insts[i].count;
+    }
+  }
+  if (!num_calls)
+    return;
+
+  // Every call site splits its pc.
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = pc + shift;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      Op op = m->insts[i].op;
+      if (op >= first && op <= last)
+        shift += lower_call_pcs(&m->insts[i]);
+    }
+  }
+  pc_map[m->num_pcs] = m->num_pcs + shift;
+  relocate_text_labels(m, pc_map);
+
+  // Helpers go after the last pc, in Op order.
+  int helper_pc[LAST_OP];
+  int labels[LOWER_MAX_LABELS];
+  int pc = pc_map[m->num_pcs];
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    helper_pc[op] = pc;
+    pc = lower_layout_helper(lower_helper_code((Op)op), pc, labels);
+  }
+
+  Inst root = {};
+  LowerEmitter e = {};
+  e.arena = m->arena;
+  e.tail = &root;
+  for (int old_pc = 0; old_pc < m->num_pcs; old_pc++) {
+    e.pc = pc_map[old_pc];
+    for (int i = m->pc_start[old_pc]; i < m->pc_start[old_pc + 1]; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op >= first && inst->op <= last) {
+        e.lineno = inst->lineno;
+        e.loc = inst->loc;
+        e.count = inst->count;
+        lower_emit_call(&e, inst, helper_pc[inst->op]);
+        continue;
+      }
+      inst->pc = e.pc;
+      e.tail->next = inst;
+      e.tail = inst;
+    }
+  }
+
+  e.pc = pc_map[m->num_pcs];
+  e.at_boundary = true;
+  e.lineno = -1;
+  e.loc = 0;
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    // A helper runs as often as all its call sites together.
+    e.count = helper_count[op];
+    lower_emit_helper(&e, lower_helper_code((Op)op));
+  }
+  e.tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+  free(pc_map);
+}
+
+void lower_ext_ops(Module* m) {
+  lower_ops(m, MUL, SHR);
+}
+
+void lower_block_ops(Module* m) {
+  lower_ops(m, COPY, FILL);
+}
+#include <ir/range.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+#define RANGE_NUM_REGS 6
+#define RANGE_MAX 16777215
+// A bound of an entry state which keeps moving after this many changes
+// is widened to the end of the word, so loops reach a fixpoint quickly.
+#define RANGE_WIDEN_AFTER 2
+// Rounds of recomputing every entry state from the widened ones, which
+// brings back bounds given by loop conditions.
+#define RANGE_NARROW_ROUNDS 2
+
+// An inclusive interval of unsigned 24-bit values. Bounds are compared
+// before any addition or subtraction so nothing leaves [0, RANGE_MAX],
+// which keeps this correct when ints are 24-bit too.
+typedef struct {
+  int lo;
+  int hi;
+} Range;
+
+typedef struct {
+  bool reached;
+  int changes;
+  Range regs[RANGE_NUM_REGS];
+} RangeState;
+
+static void range_set(Range* r, int lo, int hi) {
+  r->lo = lo;
+  r->hi = hi;
+}
+
+static void range_of_value(RangeState* s, Value* v, Range* out) {
+  if (v->type == REG)
+    *out = s->regs[v->reg];
+  else
+    range_set(out, v->imm, v->imm);
+}
+
+static int range_min(int a, int b) {
+  return a < b ? a : b;
+}
+
+static int range_max(int a, int b) {
+  return a > b ? a : b;
+}
+
+// Updates |s| for a non-jump |inst|. Records whether an ADD or SUB can
+// wrap around if |mark| is set.
+static void range_transfer(RangeState* s, Inst* inst, bool mark) {
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  switch (inst->op) {
+    case MOV:
+      range_of_value(s, &inst->src, d);
+      break;
+
+    case ADD:
+    case SUB: {
+      range_of_value(s, &inst->src, &b);
+      bool no_wrap = (inst->op == ADD ?
+                      d->hi <= RANGE_MAX - b.hi : d->lo >= b.hi);
+      if (mark)
+        inst->no_wrap = no_wrap;
+      if (!no_wrap)
+        range_set(d, 0, RANGE_MAX);
+      else if (inst->op == ADD)
+        range_set(d, d->lo + b.lo, d->hi + b.hi);
+      else
+        range_set(d, d->lo - b.hi, d->hi - b.lo);
+      break;
+    }
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      range_set(d, 0, 1);
+      break;
+
+    case AND:
+      range_of_value(s, &inst->src, &b);
+      range_set(d, 0, range_min(d->hi, b.hi));
+      break;
+
+    case DIV:
+    case MOD:
+    case SHR:
+      range_set(d, 0, d->hi);
+      break;
+
+    case LOAD:
+    case GETC:
+    case MUL:
+    case OR:
+    case XOR:
+    case SHL:
+      range_set(d, 0, RANGE_MAX);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static Op range_negate(Op op) {
+  switch (op) {
+    case JEQ: return JNE;
+    case JNE: return JEQ;
+    case JLT: return JGE;
+    case JGT: return JLE;
+    case JLE: return JGT;
+    case JGE: return JLT;
+    default: return op;
+  }
+}
+
+// Narrows the dst of a conditional jump in |s| to the values for which
+// it is taken, or not taken if |taken| is false. Returns false if that
+// never happens.
+static bool range_refine(RangeState* s, Inst* inst, bool taken) {
+  if (inst->op == JMP)
+    return taken;
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  range_of_value(s, &inst->src, &b);
+  int lo = d->lo;
+  int hi = d->hi;
+  switch (taken ? inst->op : range_negate(inst->op)) {
+    case JEQ:
+      lo = range_max(lo, b.lo);
+      hi = range_min(hi, b.hi);
+      break;
+    case JNE:
+      if (b.lo != b.hi)
+        break;
+      if (lo == hi && lo == b.lo)
+        return false;
+      if (lo == b.lo)
+        lo++;
+      if (hi == b.lo)
+        hi--;
+      break;
+    case JLT:
+      if (b.hi == 0)
+        return false;
+      hi = range_min(hi, b.hi - 1);
+      break;
+    case JGT:
+      if (b.lo == RANGE_MAX)
+        return false;
+      lo = range_max(lo, b.lo + 1);
+      break;
+    case JLE:
+      hi = range_min(hi, b.hi);
+      break;
+    case JGE:
+      lo = range_max(lo, b.lo);
+      break;
+    default:
+      break;
+  }
+  if (lo > hi)
+    return false;
+  range_set(d, lo, hi);
+  return true;
+}
+
+// Widens |to| to include |from|. Returns whether |to| changed.
+static bool range_join(RangeState* to, RangeState* from, bool widen) {
+  if (!to->reached) {
+    *to = *from;
+    to->reached = true;
+    to->changes = 1;
+    return true;
+  }
+  widen &= to->changes >= RANGE_WIDEN_AFTER;
+  bool changed = false;
+  for (int i = 0; i < RANGE_NUM_REGS; i++) {
+    Range* t = &to->regs[i];
+    Range* f = &from->regs[i];
+    if (f->lo < t->lo) {
+      t->lo = widen ? 0 : f->lo;
+      changed = true;
+    }
+    if (f->hi > t->hi) {
+      t->hi = widen ? RANGE_MAX : f->hi;
+      changed = true;
+    }
+  }
+  if (changed)
+    to->changes++;
+  return changed;
+}
+
+// Runs the block at |pc| from its entry state in |in| and joins its exit
+// states into the entry states of its successors in |out|. Returns
+// whether any of them changed.
+static bool range_block(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, int pc, bool widen) {
+  BasicBlock* bb = &cfg->blocks[pc];
+  int num_pcs = cfg->module->num_pcs;
+  RangeState s = in[pc];
+  bool changed = false;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return changed;
+    if (inst->op < JEQ || inst->op > JMP) {
+      range_transfer(&s, inst, false);
+      continue;
+    }
+
+    RangeState t = s;
+    if (range_refine(&t, inst, true)) {
+      if (inst->jmp.type == REG) {
+        changed |= range_join(indirect, &t, widen);
+      } else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs) {
+        changed |= range_join(&out[inst->jmp.imm], &t, widen);
+      }
+    }
+    if (!range_refine(&s, inst, false))
+      return changed;
+  }
+  if (pc + 1 < num_pcs)
+    changed |= range_join(&out[pc + 1], &s, widen);
+  return changed;
+}
+
+// Runs every reached block once, joining into |out|, and joins the
+// states of register jumps into the address-taken blocks. Returns
+// whether |out| changed.
+static bool range_sweep(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, bool widen) {
+  bool changed = false;
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int pc = cfg->rpo[i];
+    if (pc != cfg->indirect && in[pc].reached)
+      changed |= range_block(cfg, in, out, indirect, pc, widen);
+  }
+  if (indirect->reached) {
+    for (int pc = 0; pc < cfg->module->num_pcs; pc++) {
+      if (cfg->blocks[pc].address_taken)
+        changed |= range_join(&out[pc], indirect, widen);
+    }
+  }
+  return changed;
+}
+
+static RangeState* range_new_states(int num_pcs) {
+  RangeState* states = calloc(num_pcs, sizeof(RangeState));
+  // Registers start at zero.
+  states[0].reached = true;
+  return states;
+}
+
+void analyze_ranges(Module* m) {
+  for (int i = 0; i < m->num_insts; i++)
+    m->insts[i].no_wrap = false;
+  if (!m->num_pcs)
+    return;
+
+  CFG* cfg = build_cfg(m);
+  RangeState* in = range_new_states(m->num_pcs);
+  RangeState indirect = {};
+  while (range_sweep(cfg, in, in, &indirect, true)) {}
+
+  // A sweep from a fixpoint gives a tighter one, so it is fine to stop
+  // after any round.
+  for (int round = 0; round < RANGE_NARROW_ROUNDS; round++) {
+    RangeState* next = range_new_states(m->num_pcs);
+    RangeState next_indirect = {};
+    range_sweep(cfg, in, next, &next_indirect, false);
+    free(in);
+    in = next;
+  }
+
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (!in[pc].reached)
+      continue;
+    BasicBlock* bb = &cfg->blocks[pc];
+    RangeState s = in[pc];
+    for (int i = 0; i < bb->num_insts; i++) {
+      Inst* inst = &bb->insts[i];
+      if (inst->op == EXIT || (inst->op >= JEQ && inst->op <= JMP))
+        break;
+      range_transfer(&s, inst, true);
+    }
+  }
+  free(in);
+  free_cfg(cfg);
+}
+#include <ir/live.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static int live_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+static bool live_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static int live_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return live_reg_bit(&inst->src);
+    case JMP:
+      return live_reg_bit(&inst->jmp);
+    case GETC:
+    case EXIT:
+    case DUMP:
+      return 0;
+    case COPY:
+    case FILL:
+      // The length is in jmp.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              live_reg_bit(&inst->jmp));
+    default:
+      // STORE keeps its value in dst.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              (live_is_jump(inst->op) ? live_reg_bit(&inst->jmp) : 0));
+  }
+}
+
+static int live_defs(Inst* inst) {
+  switch (inst->op) {
+    case MOV: case ADD: case SUB: case LOAD: case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return live_reg_bit(&inst->dst);
+    default:
+      return 0;
+  }
+}
+
+// Computes the live-in set of the block at |pc| from the live-in sets
+// of blocks in |in|, filling in per-instruction sets if |record|.
+static int live_block(Liveness* lv, CFG* cfg, int* in, int pc,
+                      bool record) {
+  Module* m = lv->module;
+  BasicBlock* bb = &cfg->blocks[pc];
+  int live = pc + 1 < m->num_pcs ? in[pc + 1] : 0;
+  for (int i = bb->num_insts - 1; i >= 0; i--) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT) {
+      live = 0;
+    } else if (live_is_jump(inst->op)) {
+      int target = 0;
+      if (inst->jmp.type == REG)
+        target = in[cfg->indirect];
+      else if (inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs)
+        target = in[inst->jmp.imm];
+      live = inst->op == JMP ? target : live | target;
+    }
+    if (record)
+      lv->live_out[inst - m->insts] = live;
+    live = (live & ~live_defs(inst)) | live_uses(inst);
+    if (record)
+      lv->live_in[inst - m->insts] = live;
+  }
+  return live;
+}
+
+Liveness* build_liveness(Module* m) {
+  Liveness* lv = calloc(1, sizeof(Liveness));
+  lv->module = m;
+  lv->live_in = calloc(m->num_insts + 1, sizeof(int));
+  lv->live_out = calloc(m->num_insts + 1, sizeof(int));
+
+  CFG* cfg = build_cfg(m);
+  int* in = calloc(cfg->num_blocks, sizeof(int));
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int pc = m->num_pcs - 1; pc >= 0; pc--) {
+      int live = live_block(lv, cfg, in, pc, false);
+      if (live != in[pc]) {
+        in[pc] = live;
+        changed = true;
+      }
+    }
+    int live = 0;
+    for (int i = 0; i < indirect->num_succs; i++)
+      live |= in[indirect->succs[i]];
+    if (live != in[cfg->indirect]) {
+      in[cfg->indirect] = live;
+      changed = true;
+    }
+  }
+  for (int pc = 0; pc < m->num_pcs; pc++)
+    live_block(lv, cfg, in, pc, true);
+
+  free(in);
+  free_cfg(cfg);
+  return lv;
+}
+
+void free_liveness(Liveness* lv) {
+  free(lv->live_in);
+  free(lv->live_out);
+  free(lv);
+}
+
+int get_live_in(Liveness* lv, Inst* inst) {
+  return lv->live_in[inst - lv->module->insts];
+}
+
+int get_live_out(Liveness* lv, Inst* inst) {
+  return lv->live_out[inst - lv->module->insts];
+}
+
+bool is_dead_store(Liveness* lv, Inst* inst) {
+  // GETC also consumes input.
+  return (inst->op != GETC && live_defs(inst) &&
+          !(live_defs(inst) & get_live_out(lv, inst)));
+}
+
+static void live_dump_set(const char* name, int regs, FILE* fp) {
+  static const char* names[] = { "A", "B", "C", "D", "BP", "SP" };
+  fprintf(fp, "%s={", name);
+  const char* sep = "";
+  for (int r = 0; r < 6; r++) {
+    if (regs & (1 << r)) {
+      fprintf(fp, "%s%s", sep, names[r]);
+      sep = ",";
+    }
+  }
+  fprintf(fp, "} ");
+}
+
+void dump_liveness(Liveness* lv, FILE* fp) {
+  for (Inst* inst = lv->module->text; inst; inst = inst->next) {
+    live_dump_set("in", get_live_in(lv, inst), fp);
+    live_dump_set("out", get_live_out(lv, inst), fp);
+    dump_inst_fp(inst, fp);
+  }
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static bool merge_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+// Whether |inst| is a jump to an immediate pc of |m|.
+static bool merge_is_direct_jump(Module* m, Inst* inst) {
+  return (merge_is_jump(inst->op) && inst->jmp.type == IMM &&
+          inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs);
+}
+
+// Returns where a jump to |pc| ends up, following blocks which are only
+// a "jmp" to another pc. Loops of such blocks are left alone.
+static int merge_thread(Module* m, int pc) {
+  int to = pc;
+  for (int steps = 0; steps < m->num_pcs; steps++) {
+    int start = m->pc_start[to];
+    if (m->pc_start[to + 1] - start != 1)
+      return to;
+    Inst* inst = &m->insts[start];
+    if (inst->op != JMP || !merge_is_direct_jump(m, inst))
+      return to;
+    to = inst->jmp.imm;
+  }
+  return pc;
+}
+
+// The last instruction of |pc| which was not removed, or NULL.
+static Inst* merge_last_inst(Module* m, bool* removed, int pc) {
+  for (int i = m->pc_start[pc + 1] - 1; i >= m->pc_start[pc]; i--) {
+    if (!removed[i])
+      return &m->insts[i];
+  }
+  return NULL;
+}
+
+void merge_basic_blocks(Module* m) {
+  int num_pcs = m->num_pcs;
+  if (!num_pcs)
+    return;
+
+  // Jumps go straight to the end of jump chains.
+  int* thread = malloc(sizeof(int) * num_pcs);
+  for (int pc = 0; pc < num_pcs; pc++)
+    thread[pc] = merge_thread(m, pc);
+  bool changed = false;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (merge_is_direct_jump(m, inst) && thread[inst->jmp.imm] != inst->jmp.imm) {
+      inst->jmp.imm = thread[inst->jmp.imm];
+      changed = true;
+    }
+  }
+  free(thread);
+
+  // A jump to the next pc does nothing, unless it is all its pc has.
+  bool* removed = calloc(m->num_insts + 1, sizeof(bool));
+  for (int pc = 0; pc + 1 < num_pcs; pc++) {
+    int last = m->pc_start[pc + 1] - 1;
+    if (last <= m->pc_start[pc])
+      continue;
+    Inst* inst = &m->insts[last];
+    if (merge_is_direct_jump(m, inst) && inst->jmp.imm == pc + 1) {
+      removed[last] = true;
+      changed = true;
+    }
+  }
+
+  // A pc which is entered only by falling into it joins the previous
+  // one. Pcs a register jump may reach keep their pcs, and so does every
+  // pc up to the highest one a plain number may name, since plain
+  // numbers are not relocated.
+  CFG* cfg = build_cfg(m);
+  bool* entered = calloc(num_pcs, sizeof(bool));
+  entered[0] = true;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (!removed[i] && merge_is_direct_jump(m, inst))
+      entered[inst->jmp.imm] = true;
+  }
+  for (int pc = 0; pc < num_pcs; pc++)
+    entered[pc] |= cfg->blocks[pc].address_taken || pc <= cfg->max_plain_pc;
+  free_cfg(cfg);
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  pc_map[0] = 0;
+  for (int pc = 1; pc < num_pcs; pc++) {
+    Inst* prev = merge_last_inst(m, removed, pc - 1);
+    bool falls = !prev || (!merge_is_jump(prev->op) && prev->op != EXIT);
+    if (falls && !entered[pc]) {
+      pc_map[pc] = pc_map[pc - 1];
+      changed = true;
+    } else {
+      pc_map[pc] = pc_map[pc - 1] + 1;
+    }
+  }
+  pc_map[num_pcs] = pc_map[num_pcs - 1] + 1;
+  free(entered);
+
+  if (changed) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (removed[i])
+        continue;
+      if (prev)
+        prev->next = &m->insts[i];
+      else
+        m->text = &m->insts[i];
+      prev = &m->insts[i];
+    }
+    if (prev)
+      prev->next = NULL;
+    else
+      m->text = NULL;
+
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next)
+      inst->pc = pc_map[inst->pc];
+    reindex_module(m);
+  }
+  free(pc_map);
+  free(removed);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/cfg.h>
+
+// Keeps the pcs reachable from pc 0 and the data they refer to, then
+// renumbers both. Any text label value in kept code or data is assumed
+// to be jumped to.
+//
+// Plain numbers are never relocated. When kept code jumps through a
+// register, a plain number in kept code or data which cfg_code_address
+// says may be a pc makes every pc up to it keep its place. Likewise, data up to the
+// highest plain address given to a load or store keeps its place.
+//
+// A data object spans from one data label to the next. Objects are
+// dropped only while every kept load and store has a fixed address, as
+// code which computes addresses may step from one label into the
+// objects around it. Otherwise the data segment is kept whole.
+
+typedef struct {
+  Module* m;
+  bool* pc_live;
+  int* pc_stack;
+  int num_pc_stack;
+  // Pcs below this are kept.
+  int pc_pinned;
+  // Whether a kept jump goes through a register, and the highest plain
+  // number in kept code or data which may be a pc, or -1.
+  bool reg_jump;
+  int max_pc_number;
+  Data** words;
+  int num_words;
+  // The object of each word, and where each object starts.
+  int* word_obj;
+  int* obj_start;
+  int num_objs;
+  bool* obj_live;
+  int* obj_stack;
+  int num_obj_stack;
+  // Words below this are kept.
+  int pinned;
+  // Whether every kept load and store has a fixed address.
+  bool data_exact;
+} Dce;
+
+static void dce_mark_pc(Dce* d, int pc) {
+  if (pc < 0 || pc >= d->m->num_pcs || d->pc_live[pc])
+    return;
+  d->pc_live[pc] = true;
+  d->pc_stack[d->num_pc_stack++] = pc;
+}
+
+static void dce_mark_addr(Dce* d, int addr) {
+  if (addr < 0 || addr >= d->num_words)
+    return;
+  int obj = d->word_obj[addr];
+  if (d->obj_live[obj])
+    return;
+  d->obj_live[obj] = true;
+  d->obj_stack[d->num_obj_stack++] = obj;
+}
+
+// Keeps |pc| and every pc before it where they are.
+static void dce_pin_pc(Dce* d, int pc) {
+  if (pc >= d->m->num_pcs)
+    pc = d->m->num_pcs - 1;
+  for (; d->pc_pinned <= pc; d->pc_pinned++)
+    dce_mark_pc(d, d->pc_pinned);
+}
+
+static void dce_note_number(Dce* d, int pc) {
+  if (pc > d->max_pc_number)
+    d->max_pc_number = pc;
+}
+
+// Keeps |addr| where it is. Addresses past the data are the heap's.
+static void dce_pin(Dce* d, int addr) {
+  if (addr >= d->num_words)
+    return;
+  for (; d->pinned <= addr; d->pinned++)
+    dce_mark_addr(d, d->pinned);
+}
+
+static void dce_mark_label(Dce* d, LabelType label, int v) {
+  if (label == TEXT_LABEL)
+    dce_mark_pc(d, v);
+  else if (label == DATA_LABEL)
+    dce_mark_addr(d, v);
+}
+
+static void dce_mark_value(Dce* d, Value* v) {
+  if (v->type == IMM)
+    dce_mark_label(d, v->label, v->imm);
+}
+
+static void dce_scan_pc(Dce* d, int pc) {
+  Module* m = d->m;
+  bool falls = true;
+  for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+    Inst* inst = &m->insts[i];
+    Op op = inst->op;
+    dce_mark_value(d, &inst->dst);
+    dce_mark_value(d, &inst->src);
+    if (op >= JEQ && op <= JMP) {
+      if (inst->jmp.type == IMM)
+        dce_mark_pc(d, inst->jmp.imm);
+      else
+        d->reg_jump = true;
+    } else {
+      dce_mark_value(d, &inst->jmp);
+    }
+    bool plain_src = inst->src.type == IMM && inst->src.label == NOT_LABEL;
+    if (op == LOAD || op == STORE) {
+      if (plain_src)
+        dce_pin(d, inst->src.imm);
+      else if (inst->src.type == REG)
+        d->data_exact = false;
+    } else if (op == COPY || op == FILL) {
+      d->data_exact = false;
+    } else if (plain_src) {
+      dce_note_number(d, cfg_code_address(m, inst, &inst->src, true));
+    }
+    if (inst->op == JMP || inst->op == EXIT)
+      falls = false;
+  }
+  if (falls)
+    dce_mark_pc(d, pc + 1);
+}
+
+static void dce_scan_obj(Dce* d, int obj) {
+  for (int a = d->obj_start[obj]; a < d->obj_start[obj + 1]; a++) {
+    Data* data = d->words[a];
+    if (data->label == NOT_LABEL)
+      dce_note_number(d, cfg_data_code_address(d->m, data, true));
+    else
+      dce_mark_label(d, data->label, data->v);
+  }
+}
+
+static void dce_init_objects(Dce* d) {
+  Module* m = d->m;
+  bool* starts = calloc(d->num_words + 1, sizeof(bool));
+  starts[0] = true;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && sym->value >= 0 && sym->value < d->num_words)
+      starts[sym->value] = true;
+  }
+  d->word_obj = malloc(sizeof(int) * (d->num_words + 1));
+  d->obj_start = malloc(sizeof(int) * (d->num_words + 1));
+  for (int a = 0; a < d->num_words; a++) {
+    if (starts[a])
+      d->obj_start[d->num_objs++] = a;
+    d->word_obj[a] = d->num_objs - 1;
+  }
+  d->obj_start[d->num_objs] = d->num_words;
+  d->obj_live = calloc(d->num_objs + 1, sizeof(bool));
+  d->obj_stack = malloc(sizeof(int) * (d->num_objs + 1));
+  free(starts);
+}
+
+static void dce_relocate_data(Value* v, const int* data_map, int num_words) {
+  if (v->type == IMM && v->label == DATA_LABEL &&
+      v->imm >= 0 && v->imm <= num_words)
+    v->imm = data_map[v->imm];
+}
+
+void remove_dead_code_and_data(Module* m) {
+  if (!m->num_pcs)
+    return;
+
+  Dce d = {};
+  d.m = m;
+  d.max_pc_number = -1;
+  d.data_exact = true;
+  d.pc_live = calloc(m->num_pcs, sizeof(bool));
+  d.pc_stack = malloc(sizeof(int) * m->num_pcs);
+  for (Data* data = m->data; data; data = data->next)
+    d.num_words++;
+  d.words = malloc(sizeof(Data*) * (d.num_words + 1));
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    d.words[n++] = data;
+  dce_init_objects(&d);
+
+  // _edata holds the start of the heap, which malloc reads.
+  Data* edata = NULL;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && !strcmp(sym->name, "_edata") &&
+        sym->value >= 0 && sym->value < d.num_words) {
+      edata = d.words[sym->value];
+      dce_mark_addr(&d, sym->value);
+    }
+  }
+  dce_mark_pc(&d, 0);
+  for (;;) {
+    while (d.num_pc_stack || d.num_obj_stack) {
+      if (d.num_pc_stack)
+        dce_scan_pc(&d, d.pc_stack[--d.num_pc_stack]);
+      else
+        dce_scan_obj(&d, d.obj_stack[--d.num_obj_stack]);
+    }
+    // Both may keep more code, which may find more of either.
+    if (!d.data_exact && d.pinned < d.num_words)
+      dce_pin(&d, d.num_words - 1);
+    else if (d.reg_jump && d.pc_pinned <= d.max_pc_number)
+      dce_pin_pc(&d, d.max_pc_number);
+    else
+      break;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int num_pcs = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = num_pcs;
+    num_pcs += d.pc_live[pc];
+  }
+  pc_map[m->num_pcs] = num_pcs;
+  int* data_map = malloc(sizeof(int) * (d.num_words + 1));
+  int num_words = 0;
+  for (int a = 0; a < d.num_words; a++) {
+    data_map[a] = num_words;
+    num_words += d.obj_live[d.word_obj[a]];
+  }
+  data_map[d.num_words] = num_words;
+
+  if (num_pcs < m->num_pcs || num_words < d.num_words) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      Inst* inst = &m->insts[i];
+      if (!d.pc_live[inst->pc])
+        continue;
+      if (prev)
+        prev->next = inst;
+      else
+        m->text = inst;
+      prev = inst;
+    }
+    prev->next = NULL;
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next) {
+      inst->pc = pc_map[inst->pc];
+      dce_relocate_data(&inst->dst, data_map, d.num_words);
+      dce_relocate_data(&inst->src, data_map, d.num_words);
+      if (inst->op < JEQ || inst->op > JMP)
+        dce_relocate_data(&inst->jmp, data_map, d.num_words);
+    }
+
+    Data* last = NULL;
+    m->data = NULL;
+    for (int a = 0; a < d.num_words; a++) {
+      Data* data = d.words[a];
+      if (!d.obj_live[d.word_obj[a]])
+        continue;
+      if (data->label == DATA_LABEL && data->v >= 0 && data->v <= d.num_words)
+        data->v = data_map[data->v];
+      if (last)
+        last->next = data;
+      else
+        m->data = data;
+      last = data;
+    }
+    if (last)
+      last->next = NULL;
+    if (edata && edata->v >= 0 && edata->v <= d.num_words)
+      edata->v = data_map[edata->v];
+    for (int i = 0; i < m->num_syms; i++) {
+      Symbol* sym = &m->syms[i];
+      if (!sym->is_text && sym->value >= 0 && sym->value <= d.num_words)
+        sym->value = data_map[sym->value];
+    }
+    reindex_module(m);
+  }
+
+  free(pc_map);
+  free(data_map);
+  free(d.pc_live);
+  free(d.pc_stack);
+  free(d.words);
+  free(d.word_obj);
+  free(d.obj_start);
+  free(d.obj_live);
+  free(d.obj_stack);
+}
+#include <ir/cfg.h>
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Backends built on emit_chunked_main_loop put pcs p with the same
+// p / chunk size into one function, and every jump between functions
+// goes through the outer dispatcher. The layout pass moves hot code
+// together so hot loops do not cross a chunk boundary.
+//
+// Pcs linked by fallthrough form a chain, which is moved as a whole so
+// no jump needs to be added. Starting from the hottest chain not yet
+// placed, a group grows by the hottest chain any of its members jumps
+// to, until it would not fit in a chunk. A group which would straddle
+// a boundary starts at the next one instead, leaving unused pcs. The
+// chains with pc 0 and with the pcs a plain number may name keep their
+// place, hot groups follow by heat, and chains which never ran keep
+// their order at the end.
+
+static int g_layout_chunk_size = 512;
+
+void set_layout_chunk_size(int n) {
+  g_layout_chunk_size = n;
+}
+
+// Only the hosted tools take -profile=, and ELVM's libc has no strncmp.
+#ifndef __eir__
+void load_pc_profile(Module* m, const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "cannot open profile: %s\n", filename);
+    exit(1);
+  }
+  char buf[256];
+  while (fgets(buf, sizeof(buf), fp)) {
+    if (strncmp(buf, "pc ", 3))
+      continue;
+    char* p;
+    int pc = strtol(buf + 3, &p, 10);
+    long count = strtol(p, NULL, 10);
+    if (pc < 0 || pc >= m->num_pcs)
+      continue;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++)
+      m->insts[i].count = count;
+  }
+  fclose(fp);
+}
+#endif
+
+typedef struct {
+  int first_pc;
+  int num_pcs;
+  long heat;
+  bool placed;
+} LayoutChain;
+
+static bool layout_falls(Module* m, int pc) {
+  int end = m->pc_start[pc + 1];
+  if (end == m->pc_start[pc])
+    return true;
+  Op op = m->insts[end - 1].op;
+  return op != JMP && op != EXIT;
+}
+
+static int layout_compare_heat(const void* a, const void* b) {
+  const LayoutChain* x = *(LayoutChain* const*)a;
+  const LayoutChain* y = *(LayoutChain* const*)b;
+  if (x->heat != y->heat)
+    return x->heat > y->heat ? -1 : 1;
+  return x->first_pc - y->first_pc;
+}
+
+// Returns the hottest unplaced chain the chains in |group| jump to, or
+// -1 if there is none with a count.
+static int layout_best_succ(Module* m, LayoutChain* chains, int* chain_of,
+                            int* group, int num_group) {
+  int best = -1;
+  for (int g = 0; g < num_group; g++) {
+    LayoutChain* c = &chains[group[g]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op < JEQ || inst->op > JMP || inst->jmp.type != IMM ||
+          inst->jmp.imm < 0 || inst->jmp.imm >= m->num_pcs)
+        continue;
+      int to = chain_of[inst->jmp.imm];
+      if (chains[to].placed || !chains[to].heat)
+        continue;
+      if (best == -1 || chains[to].heat > chains[best].heat)
+        best = to;
+    }
+  }
+  return best;
+}
+
+// Returns the hottest unplaced chain, or -1 if there is none with a
+// count. |by_heat| before |*next_seed| are all placed.
+static int layout_next_seed(LayoutChain* chains, LayoutChain** by_heat,
+                            int num_chains, int* next_seed) {
+  for (; *next_seed < num_chains; (*next_seed)++) {
+    LayoutChain* c = by_heat[*next_seed];
+    if (!c->placed && c->heat)
+      return c - chains;
+  }
+  return -1;
+}
+
+void layout_by_profile(Module* m) {
+  bool has_counts = false;
+  for (int i = 0; i < m->num_insts; i++)
+    has_counts |= m->insts[i].count != 0;
+  if (!has_counts)
+    return;
+
+  int num_pcs = m->num_pcs;
+  int chunk = g_layout_chunk_size;
+  LayoutChain* chains = calloc(num_pcs, sizeof(LayoutChain));
+  int* chain_of = malloc(sizeof(int) * num_pcs);
+  int num_chains = 0;
+  for (int pc = 0; pc < num_pcs; pc++) {
+    if (pc == 0 || !layout_falls(m, pc - 1))
+      chains[num_chains++].first_pc = pc;
+    LayoutChain* c = &chains[num_chains - 1];
+    c->num_pcs++;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (m->insts[i].count > c->heat)
+        c->heat = m->insts[i].count;
+    }
+    chain_of[pc] = num_chains - 1;
+  }
+  // Falling off the last pc must still end the program, so the last
+  // chain stays last if it can.
+  if (layout_falls(m, num_pcs - 1))
+    chains[num_chains - 1].heat = 0;
+
+  LayoutChain** by_heat = malloc(sizeof(LayoutChain*) * num_chains);
+  for (int i = 0; i < num_chains; i++)
+    by_heat[i] = &chains[i];
+  qsort(by_heat, num_chains, sizeof(LayoutChain*), layout_compare_heat);
+
+  // Chains in their new order, and where each goes.
+  int* order = malloc(sizeof(int) * num_chains);
+  int* base = malloc(sizeof(int) * num_chains);
+  int num_order = 0;
+  int next_pc = 0;
+  int next_seed = 0;
+  CFG* cfg = build_cfg(m);
+  int max_fixed_pc = cfg->max_plain_pc;
+  free_cfg(cfg);
+  for (int c = 0; c < num_chains &&
+                  (c == 0 || chains[c].first_pc <= max_fixed_pc); c++) {
+    chains[c].placed = true;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+  for (int seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+       seed >= 0;) {
+    int* group = &order[num_order];
+    int num_group = 0;
+    int size = 0;
+    for (int c = seed; c >= 0;
+         c = layout_best_succ(m, chains, chain_of, group, num_group)) {
+      if (num_group && size + chains[c].num_pcs > chunk)
+        break;
+      chains[c].placed = true;
+      group[num_group++] = c;
+      size += chains[c].num_pcs;
+    }
+    if (size <= chunk && next_pc % chunk + size > chunk)
+      next_pc += chunk - next_pc % chunk;
+    for (int g = 0; g < num_group; g++) {
+      base[group[g]] = next_pc;
+      next_pc += chains[group[g]].num_pcs;
+    }
+    num_order += num_group;
+    seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+  }
+  for (int c = 0; c < num_chains; c++) {
+    if (chains[c].placed)
+      continue;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  for (int c = 0; c < num_chains; c++) {
+    for (int i = 0; i < chains[c].num_pcs; i++)
+      pc_map[chains[c].first_pc + i] = base[c] + i;
+  }
+  pc_map[num_pcs] = next_pc;
+  relocate_text_labels(m, pc_map);
+
+  Inst root = {};
+  Inst* tail = &root;
+  for (int o = 0; o < num_order; o++) {
+    LayoutChain* c = &chains[order[o]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      inst->pc = pc_map[inst->pc];
+      tail->next = inst;
+      tail = inst;
+    }
+  }
+  tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+
+  free(pc_map);
+  free(base);
+  free(order);
+  free(by_heat);
+  free(chain_of);
+  free(chains);
+}
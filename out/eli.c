@@ -0,0 +1,6453 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/elivm.h>
+#include <ir/ir.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+# include <dirent.h>
+# include <pthread.h>
+# include <sys/stat.h>
+# include <time.h>
+# include <unistd.h>
+#endif
+
+bool verbose;
+bool use_jit;
+// Whether to print how much of the run went through fused handlers and
+// how much memory it touched.
+bool show_stats;
+#if !defined(NOFILE) && !defined(__eir__)
+// Where -profile writes its counts, or NULL.
+const char* profile_out;
+// The directory or list of inputs for -batch, or NULL.
+const char* batch_inputs;
+// How many threads -batch runs, or 0 for one per core.
+int batch_threads;
+// Where -checkpoint writes a snapshot at the first GETC or DUMP, and
+// the snapshot -restore resumes from, or NULL.
+const char* checkpoint_file;
+const char* restore_file;
+
+static int compare_edges(const void* a, const void* b) {
+  const EliEdge* x = a;
+  const EliEdge* y = b;
+  if (x->count != y->count)
+    return x->count > y->count ? -1 : 1;
+  return x->from != y->from ? x->from - y->from : x->to - y->to;
+}
+
+// How much ran in one pc or one function.
+typedef struct {
+  int id;
+  long insts;
+  long entries;
+} ProfTotal;
+
+static int compare_totals(const void* a, const void* b) {
+  const ProfTotal* x = a;
+  const ProfTotal* y = b;
+  if (x->insts != y->insts)
+    return x->insts > y->insts ? -1 : 1;
+  return x->id - y->id;
+}
+
+// Returns, for each pc, the index in m->syms of the function it is in,
+// or -1. A function starts at a text label which does not start with
+// a '.', as 8cc names C functions that way and its own labels not.
+static int* find_functions(Module* m) {
+  int* funcs = malloc(sizeof(int) * (m->num_pcs + 1));
+  for (int pc = 0; pc < m->num_pcs; pc++)
+    funcs[pc] = -1;
+  // If several start at one pc, the last one wins.
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (sym->is_text && sym->name[0] != '.' &&
+        sym->value >= 0 && sym->value < m->num_pcs)
+      funcs[sym->value] = i;
+  }
+  for (int pc = 1; pc < m->num_pcs; pc++) {
+    if (funcs[pc] == -1)
+      funcs[pc] = funcs[pc - 1];
+  }
+  return funcs;
+}
+
+#define PROF_REPORT_LINES 20
+
+// Prints the pcs and functions which ran the most instructions.
+static void print_profile_report(Module* m, ProfTotal* pcs, ProfTotal* funcs,
+                                 int num_funcs, int* func_of, long total) {
+  qsort(pcs, m->num_pcs, sizeof(ProfTotal), compare_totals);
+  fprintf(stderr, "eli profile: %ld insts\n", total);
+  fprintf(stderr, "%8s %12s %6s %12s  %s\n",
+          "pc", "insts", "%", "entries", "function");
+  for (int i = 0; i < m->num_pcs && i < PROF_REPORT_LINES; i++) {
+    ProfTotal* t = &pcs[i];
+    if (!t->insts)
+      break;
+    int f = func_of[t->id];
+    const char* file;
+    int line;
+    fprintf(stderr, "%8d %12ld %6.2f %12ld  %s",
+            t->id, t->insts, t->insts * 100.0 / total, t->entries,
+            f >= 0 ? m->syms[f].name : "?");
+    if (get_pc_source_loc(m, t->id, &file, &line))
+      fprintf(stderr, " (%s:%d)", file ? file : "?", line);
+    fprintf(stderr, "\n");
+  }
+
+  qsort(funcs, num_funcs, sizeof(ProfTotal), compare_totals);
+  if (num_funcs && funcs[0].insts) {
+    fprintf(stderr, "%-24s %12s %6s %12s\n",
+            "function", "insts", "%", "calls");
+  }
+  for (int i = 0; i < num_funcs && i < PROF_REPORT_LINES; i++) {
+    ProfTotal* t = &funcs[i];
+    if (!t->insts)
+      break;
+    fprintf(stderr, "%-24s %12ld %6.2f %12ld\n",
+            m->syms[t->id].name, t->insts, t->insts * 100.0 / total,
+            t->entries);
+  }
+}
+
+// Writes the profile of |vm| to profile_out and a report of the hottest
+// code to stderr. The file has "pc <pc> <count>" lines, which
+// load_pc_profile in ir/pass.h reads, for how many times each pc was
+// entered, then "inst <pc> <n> <count>" for the n-th instruction of a
+// pc, "edge <from> <to> <count>" for taken jumps, and "func <name>
+// <insts> <calls>" for functions.
+static void write_profile(EliVM* vm) {
+  Module* m = vm->module;
+  FILE* fp = fopen(profile_out, "w");
+  if (!fp) {
+    fprintf(stderr, "cannot open %s\n", profile_out);
+    return;
+  }
+  long* inst_counts = calloc(m->num_insts + 1, sizeof(long));
+  eli_get_inst_counts(vm, inst_counts);
+
+  int* func_of = find_functions(m);
+  ProfTotal* pcs = calloc(m->num_pcs + 1, sizeof(ProfTotal));
+  ProfTotal* funcs = calloc(m->num_syms + 1, sizeof(ProfTotal));
+  long total = 0;
+  fprintf(fp, "# eli profile\n");
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    ProfTotal* t = &pcs[pc];
+    t->id = pc;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++)
+      t->insts += inst_counts[i];
+    if (m->pc_start[pc] < m->pc_start[pc + 1])
+      t->entries = inst_counts[m->pc_start[pc]];
+    if (t->entries)
+      fprintf(fp, "pc %d %ld\n", pc, t->entries);
+    total += t->insts;
+  }
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (inst_counts[i])
+        fprintf(fp, "inst %d %d %ld\n", pc, i - m->pc_start[pc],
+                inst_counts[i]);
+    }
+  }
+
+  int num_edges;
+  EliEdge* edges = eli_get_edges(vm, &num_edges);
+  qsort(edges, num_edges, sizeof(EliEdge), compare_edges);
+  for (int i = 0; i < num_edges; i++) {
+    fprintf(fp, "edge %d %d %ld\n",
+            edges[i].from, edges[i].to, edges[i].count);
+  }
+
+  // A call is a jump to the first pc of a function from outside it.
+  for (int i = 0; i < m->num_syms; i++)
+    funcs[i].id = i;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (func_of[pc] >= 0)
+      funcs[func_of[pc]].insts += pcs[pc].insts;
+  }
+  for (int i = 0; i < num_edges; i++) {
+    EliEdge* e = &edges[i];
+    if (e->to < 0 || e->to >= m->num_pcs || func_of[e->to] < 0)
+      continue;
+    Symbol* sym = &m->syms[func_of[e->to]];
+    if (sym->value == e->to && func_of[e->from] != func_of[e->to])
+      funcs[func_of[e->to]].entries += e->count;
+  }
+  for (int i = 0; i < m->num_syms; i++) {
+    if (funcs[i].insts) {
+      fprintf(fp, "func %s %ld %ld\n",
+              m->syms[i].name, funcs[i].insts, funcs[i].entries);
+    }
+  }
+  fclose(fp);
+
+  print_profile_report(m, pcs, funcs, m->num_syms, func_of, total);
+  free(edges);
+  free(funcs);
+  free(pcs);
+  free(func_of);
+  free(inst_counts);
+}
+
+
+// -batch runs the program over many inputs on a pool of threads. The
+// module is decoded once, and each input gets its own VM, reads its
+// file from memory, and has its output written to <input>.out.
+
+typedef struct {
+  const char* in;
+  long in_len;
+  long in_pos;
+  char* out;
+  long out_len;
+  long out_cap;
+} BatchIo;
+
+static int batch_getc(void* opaque) {
+  BatchIo* io = opaque;
+  if (io->in_pos >= io->in_len)
+    return EOF;
+  return (unsigned char)io->in[io->in_pos++];
+}
+
+static void batch_putc(int c, void* opaque) {
+  BatchIo* io = opaque;
+  if (io->out_len == io->out_cap) {
+    io->out_cap = io->out_cap ? io->out_cap * 2 : 4096;
+    io->out = realloc(io->out, io->out_cap);
+  }
+  io->out[io->out_len++] = c;
+}
+
+typedef struct {
+  char* input;
+  EliStatus status;
+  const char* error;
+  int pc;
+  long insts;
+  double secs;
+} BatchJob;
+
+typedef struct {
+  EliProgram* prog;
+  BatchJob* jobs;
+  int num_jobs;
+  // The next job to take, which the workers increment atomically.
+  int next_job;
+} Batch;
+
+static double batch_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char* batch_read_file(const char* name, long* len) {
+  FILE* fp = fopen(name, "rb");
+  if (!fp)
+    return NULL;
+  long cap = 4096;
+  char* buf = malloc(cap);
+  *len = 0;
+  size_t n;
+  while ((n = fread(buf + *len, 1, cap - *len, fp)) > 0) {
+    *len += n;
+    if (*len == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  fclose(fp);
+  return buf;
+}
+
+static void run_batch_job(EliProgram* prog, BatchJob* job) {
+  double start = batch_now();
+  BatchIo io = {};
+  io.in = batch_read_file(job->input, &io.in_len);
+  EliVM* vm = io.in ? eli_new_vm(prog) : NULL;
+  if (!vm) {
+    job->status = ELI_ERROR;
+    job->error = io.in ? "cannot map memory" : "cannot read input";
+    free((char*)io.in);
+    return;
+  }
+  eli_set_io(vm, batch_getc, batch_putc, &io);
+  const char* err = NULL;
+  if (restore_file) {
+    err = eli_load_snapshot(vm, restore_file, &io.out, &io.out_len);
+    io.out_cap = io.out_len;
+  }
+  if (err) {
+    job->status = ELI_ERROR;
+    job->error = err;
+  } else {
+    job->status = use_jit ? eli_run_jit(vm) : eli_run(vm, -1);
+    job->error = vm->error;
+  }
+  job->pc = vm->pc;
+  job->insts = vm->executed;
+  eli_free_vm(vm);
+
+  char* out_name = malloc(strlen(job->input) + 5);
+  sprintf(out_name, "%s.out", job->input);
+  FILE* fp = fopen(out_name, "wb");
+  if (fp) {
+    fwrite(io.out, 1, io.out_len, fp);
+    fclose(fp);
+  } else if (job->status != ELI_ERROR) {
+    job->status = ELI_ERROR;
+    job->error = "cannot write output";
+  }
+  free(out_name);
+  free(io.out);
+  free((char*)io.in);
+  job->secs = batch_now() - start;
+}
+
+// Prints as usual and keeps the output for the snapshot.
+static void checkpoint_putc(int c, void* opaque) {
+  putchar(c);
+  batch_putc(c, opaque);
+}
+
+static void* batch_worker(void* arg) {
+  Batch* b = arg;
+  for (;;) {
+    int i = __sync_fetch_and_add(&b->next_job, 1);
+    if (i >= b->num_jobs)
+      return NULL;
+    run_batch_job(b->prog, &b->jobs[i]);
+  }
+}
+
+static int compare_names(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool has_suffix(const char* s, const char* suffix) {
+  size_t n = strlen(s);
+  size_t m = strlen(suffix);
+  return n >= m && !strcmp(s + n - m, suffix);
+}
+
+// Returns the inputs named by |arg|, which is either a directory, whose
+// files but outputs of an earlier run are taken in order, or a file
+// with a name on each line.
+static char** list_batch_inputs(const char* arg, int* num_inputs) {
+  int cap = 64;
+  char** inputs = malloc(sizeof(char*) * cap);
+  *num_inputs = 0;
+  struct stat st;
+  if (stat(arg, &st)) {
+    fprintf(stderr, "cannot open %s\n", arg);
+    exit(1);
+  }
+  if (S_ISDIR(st.st_mode)) {
+    DIR* dir = opendir(arg);
+    if (!dir) {
+      fprintf(stderr, "cannot open %s\n", arg);
+      exit(1);
+    }
+    struct dirent* ent;
+    while ((ent = readdir(dir))) {
+      if (ent->d_name[0] == '.' || has_suffix(ent->d_name, ".out"))
+        continue;
+      char* name = malloc(strlen(arg) + strlen(ent->d_name) + 2);
+      sprintf(name, "%s/%s", arg, ent->d_name);
+      if (stat(name, &st) || !S_ISREG(st.st_mode)) {
+        free(name);
+        continue;
+      }
+      if (*num_inputs == cap) {
+        cap *= 2;
+        inputs = realloc(inputs, sizeof(char*) * cap);
+      }
+      inputs[(*num_inputs)++] = name;
+    }
+    closedir(dir);
+    qsort(inputs, *num_inputs, sizeof(char*), compare_names);
+    return inputs;
+  }
+
+  FILE* fp = fopen(arg, "r");
+  if (!fp) {
+    fprintf(stderr, "cannot open %s\n", arg);
+    exit(1);
+  }
+  char buf[4096];
+  while (fgets(buf, sizeof(buf), fp)) {
+    buf[strcspn(buf, "\r\n")] = 0;
+    if (!buf[0])
+      continue;
+    if (*num_inputs == cap) {
+      cap *= 2;
+      inputs = realloc(inputs, sizeof(char*) * cap);
+    }
+    inputs[(*num_inputs)++] = strdup(buf);
+  }
+  fclose(fp);
+  return inputs;
+}
+
+// Runs |prog| over every input and prints how each went and how long it
+// took. Returns the exit status of eli.
+static int run_batch(EliProgram* prog) {
+  Batch b = {};
+  b.prog = prog;
+  char** inputs = list_batch_inputs(batch_inputs, &b.num_jobs);
+  b.jobs = calloc(b.num_jobs + 1, sizeof(BatchJob));
+  for (int i = 0; i < b.num_jobs; i++)
+    b.jobs[i].input = inputs[i];
+
+  int num_threads = batch_threads;
+  if (num_threads <= 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads > b.num_jobs)
+    num_threads = b.num_jobs;
+  if (num_threads < 1)
+    num_threads = 1;
+  double start = batch_now();
+  pthread_t* threads = malloc(sizeof(pthread_t) * num_threads);
+  for (int i = 0; i < num_threads; i++)
+    pthread_create(&threads[i], NULL, batch_worker, &b);
+  for (int i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+  double wall = batch_now() - start;
+
+  int failed = 0;
+  double total = 0;
+  printf("%-40s %12s %10s  %s\n", "input", "insts", "ms", "status");
+  for (int i = 0; i < b.num_jobs; i++) {
+    BatchJob* job = &b.jobs[i];
+    total += job->secs;
+    printf("%-40s %12ld %10.3f  ", job->input, job->insts, job->secs * 1000);
+    if (job->status == ELI_ERROR) {
+      printf("%s (pc=%d)\n", job->error, job->pc);
+      failed++;
+    } else {
+      printf("ok\n");
+    }
+    free(job->input);
+  }
+  printf("%d inputs, %d failed, %.3f s on %d threads, %.3f s per input\n",
+         b.num_jobs, failed, wall, num_threads,
+         b.num_jobs ? total / b.num_jobs : 0.0);
+  free(threads);
+  free(b.jobs);
+  free(inputs);
+  return failed ? 1 : 0;
+}
+
+#endif
+
+int main(int argc, char* argv[]) {
+#if defined(NOFILE) || defined(__eir__)
+  Module* m = load_eir(stdin);
+  int flags = 0;
+#else
+  for (;;) {
+    if (argc >= 2 && !strcmp(argv[1], "-v")) {
+      verbose = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-profile=", 9)) {
+      profile_out = argv[1] + 9;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-jit")) {
+      use_jit = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strcmp(argv[1], "-stats")) {
+      show_stats = true;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-batch=", 7)) {
+      batch_inputs = argv[1] + 7;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-threads=", 9)) {
+      batch_threads = atoi(argv[1] + 9);
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-checkpoint=", 12)) {
+      checkpoint_file = argv[1] + 12;
+      argc--;
+      argv++;
+    } else if (argc >= 2 && !strncmp(argv[1], "-restore=", 9)) {
+      restore_file = argv[1] + 9;
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+  }
+
+  if (argc < 2) {
+    fprintf(stderr, "no input file\n");
+    return 1;
+  }
+
+  if (verbose && (profile_out || show_stats || use_jit)) {
+    fprintf(stderr, "-v cannot be used with -profile, -stats, or -jit\n");
+    return 1;
+  }
+  if (use_jit && (profile_out || show_stats)) {
+    fprintf(stderr, "-jit cannot be used with -profile or -stats\n");
+    return 1;
+  }
+  if (batch_inputs && (verbose || profile_out || show_stats)) {
+    fprintf(stderr, "-batch cannot be used with -v, -profile, or -stats\n");
+    return 1;
+  }
+  if (checkpoint_file && (restore_file || batch_inputs)) {
+    fprintf(stderr, "-checkpoint cannot be used with -restore or -batch\n");
+    return 1;
+  }
+
+  Module* m = load_eir_from_file(argv[1]);
+  int flags = ((profile_out ? ELI_PROFILE : 0) |
+               (show_stats ? ELI_STATS : 0));
+#endif
+
+  EliProgram* prog = eli_new_program(m, flags);
+#if !defined(NOFILE) && !defined(__eir__)
+  if (batch_inputs)
+    return run_batch(prog);
+#endif
+  EliVM* vm = eli_new_vm(prog);
+  if (!vm) {
+    fprintf(stderr, "cannot map memory\n");
+    return 1;
+  }
+  vm->trace = verbose;
+  EliStatus status = ELI_RUNNING;
+#if !defined(NOFILE) && !defined(__eir__)
+  if (restore_file) {
+    char* out;
+    long out_len;
+    const char* err = eli_load_snapshot(vm, restore_file, &out, &out_len);
+    if (err) {
+      fprintf(stderr, "%s: %s\n", restore_file, err);
+      return 1;
+    }
+    fwrite(out, 1, out_len, stdout);
+    free(out);
+  }
+  if (checkpoint_file) {
+    BatchIo prefix = {};
+    vm->break_on_input = true;
+    eli_set_io(vm, NULL, checkpoint_putc, &prefix);
+    status = eli_run(vm, -1);
+    if (status == ELI_BREAK) {
+      const char* err = eli_save_snapshot(vm, checkpoint_file,
+                                          prefix.out, prefix.out_len);
+      if (err) {
+        fprintf(stderr, "%s: %s\n", checkpoint_file, err);
+        return 1;
+      }
+      vm->break_on_input = false;
+      eli_set_io(vm, NULL, NULL, NULL);
+      status = ELI_RUNNING;
+    } else if (status == ELI_EXITED) {
+      fprintf(stderr, "no GETC or DUMP before exit, no snapshot written\n");
+    }
+    free(prefix.out);
+  }
+#endif
+  if (status == ELI_RUNNING && use_jit)
+    status = eli_run_jit(vm);
+  else if (status == ELI_RUNNING)
+    status = eli_run(vm, -1);
+  if (status == ELI_ERROR) {
+    fprintf(stderr, "%s (pc=%d)\n", vm->error, vm->pc);
+    return 1;
+  }
+
+#if !defined(NOFILE) && !defined(__eir__)
+  if (show_stats)
+    eli_print_stats(vm, stderr);
+  if (profile_out)
+    write_profile(vm);
+#endif
+  return 0;
+}
+#include <ir/elivm.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define MEMSZ 0x100000
+#else
+#define MEMSZ 0x1000000
+#endif
+
+// The fast engine needs computed goto. Without it, or with trace, the
+// switch in slow_run runs the program.
+#if defined(__GNUC__) && !defined(__eir__)
+#define ELI_FAST
+#endif
+
+// Memory is a mapping whose pages are committed as the program
+// touches them, which costs the same for any MEMSZ.
+#if !defined(NOFILE) && !defined(__eir__)
+#define ELI_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// eli_run_jit compiles to x86-64 code instead.
+#if defined(ELI_FAST) && defined(__x86_64__) && !defined(NOFILE)
+#define ELI_JIT
+#endif
+
+#ifdef ELI_FAST
+
+// A predecoded instruction. code[i] is m->insts[i], so pc_start indexes
+// code as well, and jumps into the middle of nothing need no care.
+// Immediates are already within a word and registers never leave one,
+// so the handlers need neither modulo nor address checks.
+typedef struct {
+  const void* op;
+  int d;
+  // A register or an immediate, as the handler expects.
+  int s;
+  // The register a fused load writes or a fused store reads.
+  int t;
+  // The index in code of a direct jump target, or the immediate of the
+  // add in a fused mov/add pair.
+  int j;
+  // The pc of a direct jump target.
+  int jpc;
+  Inst* inst;
+} FastInst;
+
+#endif
+
+struct EliProgram_ {
+  Module* module;
+  int flags;
+#ifdef ELI_FAST
+  FastInst* code;
+  // The handler of each instruction run alone, for fused sequences the
+  // budget does not cover.
+  const void** plain;
+  // The handler COUNT goes on to with ELI_PROFILE or ELI_STATS.
+  const void** real;
+  // The FuseKind of each instruction.
+  char* kinds;
+#endif
+};
+
+static EliStatus vm_error(EliVM* vm, const char* msg) {
+  vm->error = msg;
+  vm->status = ELI_ERROR;
+  return ELI_ERROR;
+}
+
+static int vm_getc(EliVM* vm) {
+  int c = vm->getc_fn ? vm->getc_fn(vm->io) : getchar();
+  return c == EOF ? 0 : c;
+}
+
+static void vm_putc(EliVM* vm, int c) {
+  if (vm->putc_fn)
+    vm->putc_fn(c, vm->io);
+  else
+    putchar(c);
+}
+
+static int vm_value(EliVM* vm, Value* v) {
+  if (v->type == REG)
+    return vm->regs[v->reg];
+  return v->imm;
+}
+
+static int vm_cmp(EliVM* vm, Inst* inst) {
+  int op = inst->op;
+  if (op >= 16)
+    op -= 8;
+  assert(inst->dst.type == REG);
+  int d = vm->regs[inst->dst.reg];
+  int s = vm_value(vm, &inst->src);
+  switch (op) {
+    case JEQ:
+      return d == s;
+    case JNE:
+      return d != s;
+    case JLT:
+      return d < s;
+    case JGT:
+      return d > s;
+    case JLE:
+      return d <= s;
+    case JGE:
+      return d >= s;
+    default:
+      return 1;
+  }
+}
+
+static bool vm_copy(EliVM* vm, Inst* inst) {
+  assert(inst->dst.type == REG);
+  int dst = vm->regs[inst->dst.reg];
+  int s = vm_value(vm, &inst->src);
+  int n = vm_value(vm, &inst->jmp);
+  if (n > MEMSZ - dst || n > MEMSZ - s) {
+    vm_error(vm, "copy out of range");
+    return false;
+  }
+  memmove(vm->mem + dst, vm->mem + s, n * sizeof(int));
+  return true;
+}
+
+static bool vm_fill(EliVM* vm, Inst* inst) {
+  assert(inst->dst.type == REG);
+  int dst = vm->regs[inst->dst.reg];
+  int v = vm_value(vm, &inst->src);
+  int n = vm_value(vm, &inst->jmp);
+  if (n > MEMSZ - dst) {
+    vm_error(vm, "fill out of range");
+    return false;
+  }
+  if (v) {
+    for (int i = 0; i < n; i++)
+      vm->mem[dst + i] = v;
+  } else {
+    memset(vm->mem + dst, 0, n * sizeof(int));
+  }
+  return true;
+}
+
+// Taken jumps by source and target pc, in an open addressing table
+// whose size is a power of two.
+static EliEdge* find_edge(EliEdge* edges, int cap, int from, int to) {
+  unsigned h = (unsigned)from * 2654435761u ^ (unsigned)to * 40503u;
+  for (int i = h & (cap - 1);; i = (i + 1) & (cap - 1)) {
+    EliEdge* e = &edges[i];
+    if (!e->count || (e->from == from && e->to == to))
+      return e;
+  }
+}
+
+static void add_edge(EliEdge** edges, int* num, int* cap,
+                     int from, int to, long n) {
+  if (*num * 2 >= *cap) {
+    int new_cap = *cap ? *cap * 2 : 256;
+    EliEdge* new_edges = calloc(new_cap, sizeof(EliEdge));
+    for (int i = 0; i < *cap; i++) {
+      EliEdge* e = &(*edges)[i];
+      if (e->count)
+        *find_edge(new_edges, new_cap, e->from, e->to) = *e;
+    }
+    free(*edges);
+    *edges = new_edges;
+    *cap = new_cap;
+  }
+  EliEdge* e = find_edge(*edges, *cap, from, to);
+  if (!e->count) {
+    e->from = from;
+    e->to = to;
+    (*num)++;
+  }
+  e->count += n;
+}
+
+#ifdef ELI_FAST
+
+#define FAST_MASK (MEMSZ - 1)
+
+// Every handler is entered through FAST_DISPATCH, which charges it to
+// the budget, except COUNT, which goes on to the real one, and END.
+#define FAST_DISPATCH() do {                    \
+    if (left <= 0)                              \
+      goto OUT;                                 \
+    left--;                                     \
+    goto *ip->op;                               \
+  } while (0)
+
+#define FAST_NEXT() do {                        \
+    ip++;                                       \
+    FAST_DISPATCH();                            \
+  } while (0)
+
+#define FAST_JUMP() do {                        \
+    pc = ip->jpc;                               \
+    ip = code + ip->j;                          \
+    FAST_DISPATCH();                            \
+  } while (0)
+
+#define FAST_SKIP(n) do {                       \
+    ip += n;                                    \
+    FAST_DISPATCH();                            \
+  } while (0)
+
+// Charges the rest of a fused sequence of |n|, or runs its first
+// instruction alone if the budget does not cover them.
+#define FAST_FUSED(n) do {                      \
+    if (left < n - 1)                           \
+      goto *plain[ip - code];                   \
+    left -= n - 1;                              \
+  } while (0)
+
+#define FAST_CMP_HANDLERS(name, cmp_op)                         \
+  name##_R: r[ip->d] = r[ip->d] cmp_op r[ip->s]; FAST_NEXT();   \
+  name##_I: r[ip->d] = r[ip->d] cmp_op ip->s; FAST_NEXT();      \
+  J##name##_R: if (r[ip->d] cmp_op r[ip->s]) FAST_JUMP();       \
+  FAST_NEXT();                                                  \
+  J##name##_I: if (r[ip->d] cmp_op ip->s) FAST_JUMP();          \
+  FAST_NEXT()
+
+// A compare whose result a "jeq/jne label, reg, 0" tests right away.
+#define FAST_CMP_JUMP_HANDLERS(name, cmp_op)                            \
+  name##_JZ_R: FAST_FUSED(2);                                           \
+  if (!(r[ip->d] = r[ip->d] cmp_op r[ip->s])) FAST_JUMP();              \
+  FAST_SKIP(2);                                                         \
+  name##_JZ_I: FAST_FUSED(2);                                           \
+  if (!(r[ip->d] = r[ip->d] cmp_op ip->s)) FAST_JUMP();                 \
+  FAST_SKIP(2);                                                         \
+  name##_JNZ_R: FAST_FUSED(2);                                          \
+  if ((r[ip->d] = r[ip->d] cmp_op r[ip->s])) FAST_JUMP();               \
+  FAST_SKIP(2);                                                         \
+  name##_JNZ_I: FAST_FUSED(2);                                          \
+  if ((r[ip->d] = r[ip->d] cmp_op ip->s)) FAST_JUMP();                  \
+  FAST_SKIP(2)
+
+// Sequences of instructions which run as one handler. The first entry
+// of a sequence gets the fused handler and the others keep their own,
+// so jumps into the middle of one still work.
+typedef enum {
+  FUSE_NONE,
+  // eq .. ge x, y; jeq/jne label, x, 0
+  FUSE_CMP_JZ,
+  FUSE_CMP_JNZ,
+  // mov x, y; load z, x
+  FUSE_MOV_LOAD,
+  // mov x, y; store z, x
+  FUSE_MOV_STORE,
+  // add/sub x, imm; load z, x
+  FUSE_ADD_LOAD,
+  // add/sub x, imm; store z, x, which covers "sub SP, 1; store A, SP"
+  FUSE_ADD_STORE,
+  // mov x, reg; add/sub x, imm; load z, x
+  FUSE_MOV_ADD_LOAD,
+  // mov x, reg; add/sub x, imm; store z, x
+  FUSE_MOV_ADD_STORE,
+  NUM_FUSE
+} FuseKind;
+
+static const char* FUSE_NAMES[NUM_FUSE] = {
+  "none", "cmp+jeq", "cmp+jne", "mov+load", "mov+store",
+  "add+load", "add+store", "mov+add+load", "mov+add+store",
+};
+
+static const int FUSE_LEN[NUM_FUSE] = { 1, 2, 2, 2, 2, 2, 2, 3, 3 };
+
+static bool is_reg(Value* v, Reg reg) {
+  return v->type == REG && v->reg == reg;
+}
+
+// An ADD or SUB of an immediate to a register, as the immediate to add.
+static bool get_add_imm(Inst* inst, int* imm) {
+  if ((inst->op != ADD && inst->op != SUB) || inst->src.type != IMM)
+    return false;
+  *imm = inst->op == ADD ? inst->src.imm : (MEMSZ - inst->src.imm) & FAST_MASK;
+  return true;
+}
+
+static bool is_mem_through(Inst* inst, Reg reg) {
+  return (inst->op == LOAD || inst->op == STORE) && is_reg(&inst->src, reg);
+}
+
+// Returns the sequence which starts at |insts[0]|, with |n| instructions
+// left in the module.
+static FuseKind match_fusion(Inst* insts, int n, int num_pcs) {
+  if (n < 2)
+    return FUSE_NONE;
+  Inst* a = &insts[0];
+  Inst* b = &insts[1];
+  Reg x = a->dst.reg;
+  int imm;
+  if (a->op >= EQ && a->op <= GE &&
+      (b->op == JEQ || b->op == JNE) && is_reg(&b->dst, x) &&
+      b->src.type == IMM && b->src.imm == 0 && b->jmp.type == IMM &&
+      b->jmp.imm >= 0 && b->jmp.imm < num_pcs)
+    return b->op == JEQ ? FUSE_CMP_JZ : FUSE_CMP_JNZ;
+  if (a->op == MOV && a->src.type == REG && n >= 3 &&
+      get_add_imm(b, &imm) && is_reg(&b->dst, x) &&
+      is_mem_through(&insts[2], x))
+    return insts[2].op == LOAD ? FUSE_MOV_ADD_LOAD : FUSE_MOV_ADD_STORE;
+  if (a->op == MOV && is_mem_through(b, x))
+    return b->op == LOAD ? FUSE_MOV_LOAD : FUSE_MOV_STORE;
+  if (get_add_imm(a, &imm) && is_mem_through(b, x))
+    return b->op == LOAD ? FUSE_ADD_LOAD : FUSE_ADD_STORE;
+  return FUSE_NONE;
+}
+
+// Runs |vm| for |budget| instructions, or decodes |decode| if |vm| is
+// NULL. Decoding lives here as the handlers are labels of this function.
+static EliStatus fast_run(EliVM* vm, long budget, EliProgram* decode) {
+  // Handlers by op for a register and an immediate src. Ops without a
+  // specialized handler run through the same helpers as the slow path.
+  static const void* const REG_HANDLERS[LAST_OP] = {
+    [MOV] = &&MOV_R, [ADD] = &&ADD_R, [SUB] = &&SUB_R,
+    [LOAD] = &&LOAD_R, [STORE] = &&STORE_R, [PUTC] = &&PUTC_R,
+    [GETC] = &&GETC_R, [EXIT] = &&EXIT_R,
+    [JEQ] = &&JEQ_R, [JNE] = &&JNE_R, [JLT] = &&JLT_R,
+    [JGT] = &&JGT_R, [JLE] = &&JLE_R, [JGE] = &&JGE_R, [JMP] = &&JMP_R,
+    [EQ] = &&EQ_R, [NE] = &&NE_R, [LT] = &&LT_R,
+    [GT] = &&GT_R, [LE] = &&LE_R, [GE] = &&GE_R, [DUMP] = &&DUMP_OP,
+    [MUL] = &&EXT, [DIV] = &&EXT, [MOD] = &&EXT, [AND] = &&EXT,
+    [OR] = &&EXT, [XOR] = &&EXT, [SHL] = &&EXT, [SHR] = &&EXT,
+    [COPY] = &&COPY, [FILL] = &&FILL,
+  };
+  static const void* const IMM_HANDLERS[LAST_OP] = {
+    [MOV] = &&MOV_I, [ADD] = &&ADD_I, [SUB] = &&SUB_I,
+    [LOAD] = &&LOAD_I, [STORE] = &&STORE_I, [PUTC] = &&PUTC_I,
+    [GETC] = &&GETC_R, [EXIT] = &&EXIT_R,
+    [JEQ] = &&JEQ_I, [JNE] = &&JNE_I, [JLT] = &&JLT_I,
+    [JGT] = &&JGT_I, [JLE] = &&JLE_I, [JGE] = &&JGE_I, [JMP] = &&JMP_R,
+    [EQ] = &&EQ_I, [NE] = &&NE_I, [LT] = &&LT_I,
+    [GT] = &&GT_I, [LE] = &&LE_I, [GE] = &&GE_I, [DUMP] = &&DUMP_OP,
+    [MUL] = &&EXT, [DIV] = &&EXT, [MOD] = &&EXT, [AND] = &&EXT,
+    [OR] = &&EXT, [XOR] = &&EXT, [SHL] = &&EXT, [SHR] = &&EXT,
+    [COPY] = &&COPY, [FILL] = &&FILL,
+  };
+  static const void* const CMP_JZ_R[] = {
+    &&EQ_JZ_R, &&NE_JZ_R, &&LT_JZ_R, &&GT_JZ_R, &&LE_JZ_R, &&GE_JZ_R,
+  };
+  static const void* const CMP_JZ_I[] = {
+    &&EQ_JZ_I, &&NE_JZ_I, &&LT_JZ_I, &&GT_JZ_I, &&LE_JZ_I, &&GE_JZ_I,
+  };
+  static const void* const CMP_JNZ_R[] = {
+    &&EQ_JNZ_R, &&NE_JNZ_R, &&LT_JNZ_R, &&GT_JNZ_R, &&LE_JNZ_R, &&GE_JNZ_R,
+  };
+  static const void* const CMP_JNZ_I[] = {
+    &&EQ_JNZ_I, &&NE_JNZ_I, &&LT_JNZ_I, &&GT_JNZ_I, &&LE_JNZ_I, &&GE_JNZ_I,
+  };
+
+  if (!vm) {
+    Module* m = decode->module;
+    FastInst* code = calloc(m->num_insts + 1, sizeof(FastInst));
+    for (int i = 0; i < m->num_insts; i++) {
+      Inst* inst = &m->insts[i];
+      FastInst* f = &code[i];
+      f->inst = inst;
+      f->d = inst->dst.reg;
+      if (inst->src.type == REG) {
+        f->op = REG_HANDLERS[inst->op];
+        f->s = inst->src.reg;
+      } else {
+        f->op = IMM_HANDLERS[inst->op];
+        f->s = inst->src.imm;
+      }
+      assert(f->op);
+      // Jumps through registers or out of the module take the slow way,
+      // which sets pc and checks it.
+      if (inst->op >= JEQ && inst->op <= JMP) {
+        if (inst->jmp.type == IMM &&
+            inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs) {
+          f->jpc = inst->jmp.imm;
+          f->j = m->pc_start[f->jpc];
+        } else {
+          f->op = &&JUMP_SLOW;
+        }
+      }
+    }
+    // Running off the end starts over from the last jump target, as
+    // slow_run does.
+    code[m->num_insts].op = &&END;
+
+    // A profile counts the entries to each pc and the taken jumps, so
+    // jumps take the slow way, which records them, and a fused sequence
+    // must not run over the start of a pc.
+    bool profile = decode->flags & ELI_PROFILE;
+    bool stats = decode->flags & ELI_STATS;
+    if (profile) {
+      for (int i = 0; i < m->num_insts; i++) {
+        Op op = m->insts[i].op;
+        if (op >= JEQ && op <= JMP) {
+          code[i].op = (code[i].op == &&JUMP_SLOW ?
+                        &&JUMP_PROF : &&JUMP_PROF_DIRECT);
+        }
+      }
+    }
+    const void** plain = malloc(sizeof(void*) * (m->num_insts + 1));
+    for (int i = 0; i <= m->num_insts; i++)
+      plain[i] = code[i].op;
+
+    char* kinds = calloc(m->num_insts + 1, 1);
+    for (int i = 0; i < m->num_insts; i++) {
+      FuseKind kind = match_fusion(&m->insts[i], m->num_insts - i,
+                                   m->num_pcs);
+      if (profile && (kind == FUSE_CMP_JZ || kind == FUSE_CMP_JNZ ||
+                      m->insts[i + FUSE_LEN[kind] - 1].pc != m->insts[i].pc))
+        kind = FUSE_NONE;
+      FastInst* f = &code[i];
+      Inst* next = &m->insts[i + 1];
+      Inst* last = &m->insts[i + FUSE_LEN[kind] - 1];
+      kinds[i] = kind;
+      switch (kind) {
+        case FUSE_NONE:
+          break;
+
+        case FUSE_CMP_JZ:
+        case FUSE_CMP_JNZ: {
+          bool imm = f->inst->src.type == IMM;
+          int k = f->inst->op - EQ;
+          if (kind == FUSE_CMP_JZ)
+            f->op = imm ? CMP_JZ_I[k] : CMP_JZ_R[k];
+          else
+            f->op = imm ? CMP_JNZ_I[k] : CMP_JNZ_R[k];
+          f->j = code[i + 1].j;
+          f->jpc = code[i + 1].jpc;
+          break;
+        }
+
+        case FUSE_MOV_LOAD:
+        case FUSE_MOV_STORE:
+          if (kind == FUSE_MOV_LOAD)
+            f->op = f->inst->src.type == IMM ? &&MOV_LOAD_I : &&MOV_LOAD_R;
+          else
+            f->op = f->inst->src.type == IMM ? &&MOV_STORE_I : &&MOV_STORE_R;
+          f->t = last->dst.reg;
+          break;
+
+        case FUSE_ADD_LOAD:
+        case FUSE_ADD_STORE:
+          f->op = kind == FUSE_ADD_LOAD ? &&ADD_LOAD : &&ADD_STORE;
+          get_add_imm(f->inst, &f->s);
+          // s is what to add now, for a sub as well.
+          plain[i] = &&ADD_I;
+          f->t = last->dst.reg;
+          break;
+
+        case FUSE_MOV_ADD_LOAD:
+        case FUSE_MOV_ADD_STORE:
+          f->op = kind == FUSE_MOV_ADD_LOAD ? &&MOV_ADD_LOAD : &&MOV_ADD_STORE;
+          get_add_imm(next, &f->j);
+          f->t = last->dst.reg;
+          break;
+
+        default:
+          assert(false);
+      }
+    }
+
+    // With ELI_STATS, every handler is entered through COUNT, and with
+    // ELI_PROFILE the first one of each pc is.
+    if (stats || profile) {
+      const void** real = malloc(sizeof(void*) * (m->num_insts + 1));
+      for (int i = 0; i <= m->num_insts; i++) {
+        real[i] = code[i].op;
+        if (stats || (i < m->num_insts &&
+                      m->pc_start[m->insts[i].pc] == i))
+          code[i].op = &&COUNT;
+      }
+      decode->real = real;
+    }
+    decode->code = code;
+    decode->plain = plain;
+    decode->kinds = kinds;
+    return ELI_RUNNING;
+  }
+
+  const EliProgram* prog = vm->prog;
+  Module* m = vm->module;
+  FastInst* code = prog->code;
+  const void* const* plain = prog->plain;
+  const void* const* real = prog->real;
+  long* counts = vm->counts;
+  long* taken = vm->taken;
+  int* r = vm->regs;
+  int* mem = vm->mem;
+  int pc = vm->pc;
+  long start = budget < 0 ? LONG_MAX : budget;
+  long left = start;
+  FastInst* ip = code + vm->next;
+  FAST_DISPATCH();
+
+END:
+  left++;
+ENTER:
+  if (pc < 0 || pc >= m->num_pcs) {
+    vm_error(vm, "pc out of range");
+    goto OUT;
+  }
+  ip = code + m->pc_start[pc];
+  FAST_DISPATCH();
+
+MOV_R: r[ip->d] = r[ip->s]; FAST_NEXT();
+MOV_I: r[ip->d] = ip->s; FAST_NEXT();
+ADD_R: r[ip->d] = (r[ip->d] + r[ip->s]) & FAST_MASK; FAST_NEXT();
+ADD_I: r[ip->d] = (r[ip->d] + ip->s) & FAST_MASK; FAST_NEXT();
+SUB_R: r[ip->d] = (r[ip->d] - r[ip->s]) & FAST_MASK; FAST_NEXT();
+SUB_I: r[ip->d] = (r[ip->d] - ip->s) & FAST_MASK; FAST_NEXT();
+LOAD_R: r[ip->d] = mem[r[ip->s]]; FAST_NEXT();
+LOAD_I: r[ip->d] = mem[ip->s]; FAST_NEXT();
+STORE_R: mem[r[ip->s]] = r[ip->d]; FAST_NEXT();
+STORE_I: mem[ip->s] = r[ip->d]; FAST_NEXT();
+PUTC_R: vm_putc(vm, r[ip->s]); FAST_NEXT();
+PUTC_I: vm_putc(vm, ip->s); FAST_NEXT();
+GETC_R:
+  if (vm->break_on_input)
+    goto BREAK;
+  r[ip->d] = vm_getc(vm);
+  FAST_NEXT();
+EXIT_R:
+  vm->status = ELI_EXITED;
+  goto OUT;
+DUMP_OP:
+  if (vm->break_on_input)
+    goto BREAK;
+  FAST_NEXT();
+BREAK:
+  // The instruction has not run, so it is not charged.
+  left++;
+  vm->status = ELI_BREAK;
+  goto OUT;
+JMP_R: FAST_JUMP();
+FAST_CMP_HANDLERS(EQ, ==);
+FAST_CMP_HANDLERS(NE, !=);
+FAST_CMP_HANDLERS(LT, <);
+FAST_CMP_HANDLERS(GT, >);
+FAST_CMP_HANDLERS(LE, <=);
+FAST_CMP_HANDLERS(GE, >=);
+JUMP_SLOW:
+  if (vm_cmp(vm, ip->inst)) {
+    pc = vm_value(vm, &ip->inst->jmp);
+    goto ENTER;
+  }
+  FAST_NEXT();
+EXT:
+  r[ip->d] = eval_ext_op(ip->inst->op, r[ip->d],
+                         vm_value(vm, &ip->inst->src));
+  FAST_NEXT();
+COPY:
+  if (!vm_copy(vm, ip->inst))
+    goto OUT;
+  FAST_NEXT();
+FILL:
+  if (!vm_fill(vm, ip->inst))
+    goto OUT;
+  FAST_NEXT();
+
+FAST_CMP_JUMP_HANDLERS(EQ, ==);
+FAST_CMP_JUMP_HANDLERS(NE, !=);
+FAST_CMP_JUMP_HANDLERS(LT, <);
+FAST_CMP_JUMP_HANDLERS(GT, >);
+FAST_CMP_JUMP_HANDLERS(LE, <=);
+FAST_CMP_JUMP_HANDLERS(GE, >=);
+MOV_LOAD_R:
+  FAST_FUSED(2);
+  r[ip->d] = r[ip->s];
+  r[ip->t] = mem[r[ip->d]];
+  FAST_SKIP(2);
+MOV_LOAD_I:
+  FAST_FUSED(2);
+  r[ip->d] = ip->s;
+  r[ip->t] = mem[ip->s];
+  FAST_SKIP(2);
+MOV_STORE_R:
+  FAST_FUSED(2);
+  r[ip->d] = r[ip->s];
+  mem[r[ip->d]] = r[ip->t];
+  FAST_SKIP(2);
+MOV_STORE_I:
+  FAST_FUSED(2);
+  r[ip->d] = ip->s;
+  mem[ip->s] = r[ip->t];
+  FAST_SKIP(2);
+ADD_LOAD:
+  FAST_FUSED(2);
+  r[ip->d] = (r[ip->d] + ip->s) & FAST_MASK;
+  r[ip->t] = mem[r[ip->d]];
+  FAST_SKIP(2);
+ADD_STORE:
+  FAST_FUSED(2);
+  r[ip->d] = (r[ip->d] + ip->s) & FAST_MASK;
+  mem[r[ip->d]] = r[ip->t];
+  FAST_SKIP(2);
+MOV_ADD_LOAD:
+  FAST_FUSED(3);
+  r[ip->d] = (r[ip->s] + ip->j) & FAST_MASK;
+  r[ip->t] = mem[r[ip->d]];
+  FAST_SKIP(3);
+MOV_ADD_STORE:
+  FAST_FUSED(3);
+  r[ip->d] = (r[ip->s] + ip->j) & FAST_MASK;
+  mem[r[ip->d]] = r[ip->t];
+  FAST_SKIP(3);
+
+COUNT:
+  counts[ip - code]++;
+  goto *real[ip - code];
+JUMP_PROF:
+  if (vm_cmp(vm, ip->inst)) {
+    taken[ip - code]++;
+    pc = vm_value(vm, &ip->inst->jmp);
+    if (ip->inst->jmp.type == REG) {
+      add_edge(&vm->edges, &vm->num_edges, &vm->cap_edges,
+               ip->inst->pc, pc, 1);
+    }
+    goto ENTER;
+  }
+  FAST_NEXT();
+JUMP_PROF_DIRECT:
+  if (vm_cmp(vm, ip->inst)) {
+    taken[ip - code]++;
+    FAST_JUMP();
+  }
+  FAST_NEXT();
+
+OUT:
+  vm->pc = pc;
+  vm->next = ip - code;
+  vm->executed += start - left;
+  return vm->status;
+}
+
+#endif  // ELI_FAST
+
+// Prints the registers for trace, which finds values gone negative.
+static bool dump_regs(EliVM* vm, Inst* inst) {
+  bool had_negative = false;
+  static const char* REG_NAMES[] = {
+    "A", "B", "C", "D", "BP", "SP"
+  };
+  fprintf(stderr, "PC=%d ", inst->lineno);
+  for (int i = 0; i < 6; i++) {
+    if (vm->regs[i] < 0)
+      had_negative = true;
+    fprintf(stderr, "%s=%d", REG_NAMES[i], vm->regs[i]);
+    fprintf(stderr, i == 5 ? "\n" : " ");
+  }
+  if (had_negative) {
+    vm_error(vm, "had negative!");
+    return false;
+  }
+  return true;
+}
+
+// The portable engine, which also traces.
+static EliStatus slow_run(EliVM* vm, long budget) {
+  Module* m = vm->module;
+  int* regs = vm->regs;
+  int* mem = vm->mem;
+  while (budget) {
+    if (vm->next >= m->num_insts) {
+      // Running off the end starts over from the last jump target.
+      if (vm->pc < 0 || vm->pc >= m->num_pcs)
+        return vm_error(vm, "pc out of range");
+      vm->next = m->pc_start[vm->pc];
+      continue;
+    }
+    Inst* inst = &m->insts[vm->next];
+    if (vm->break_on_input && (inst->op == GETC || inst->op == DUMP)) {
+      vm->status = ELI_BREAK;
+      return ELI_BREAK;
+    }
+    if (vm->trace) {
+      if (!dump_regs(vm, inst))
+        return ELI_ERROR;
+      dump_inst(inst);
+    }
+    if (budget > 0)
+      budget--;
+    vm->executed++;
+    vm->next++;
+    switch (inst->op) {
+      case MOV:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] = vm_value(vm, &inst->src);
+        break;
+
+      case ADD:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] += vm_value(vm, &inst->src);
+        regs[inst->dst.reg] += MEMSZ;
+        regs[inst->dst.reg] %= MEMSZ;
+        break;
+
+      case SUB:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] -= vm_value(vm, &inst->src);
+        regs[inst->dst.reg] += MEMSZ;
+        regs[inst->dst.reg] %= MEMSZ;
+        break;
+
+      case LOAD: {
+        assert(inst->dst.type == REG);
+        int addr = vm_value(vm, &inst->src);
+        if (addr < 0)
+          return vm_error(vm, "zero page load");
+        regs[inst->dst.reg] = mem[addr];
+        break;
+      }
+
+      case STORE: {
+        assert(inst->dst.type == REG);
+        int addr = vm_value(vm, &inst->src);
+        if (addr < 0)
+          return vm_error(vm, "zero page store");
+        mem[addr] = regs[inst->dst.reg];
+        break;
+      }
+
+      case PUTC:
+        vm_putc(vm, vm_value(vm, &inst->src));
+        break;
+
+      case GETC:
+        regs[inst->dst.reg] = vm_getc(vm);
+        regs[inst->dst.reg] += MEMSZ;
+        regs[inst->dst.reg] %= MEMSZ;
+        break;
+
+      case EXIT:
+        vm->next--;
+        vm->status = ELI_EXITED;
+        return ELI_EXITED;
+
+      case DUMP:
+        break;
+
+      case EQ:
+      case NE:
+      case LT:
+      case GT:
+      case LE:
+      case GE:
+        regs[inst->dst.reg] = vm_cmp(vm, inst);
+        break;
+
+      case MUL:
+      case DIV:
+      case MOD:
+      case AND:
+      case OR:
+      case XOR:
+      case SHL:
+      case SHR:
+        assert(inst->dst.type == REG);
+        regs[inst->dst.reg] =
+            eval_ext_op(inst->op, regs[inst->dst.reg],
+                        vm_value(vm, &inst->src));
+        break;
+
+      case COPY:
+        if (!vm_copy(vm, inst))
+          return ELI_ERROR;
+        break;
+
+      case FILL:
+        if (!vm_fill(vm, inst))
+          return ELI_ERROR;
+        break;
+
+      case JEQ:
+      case JNE:
+      case JLT:
+      case JGT:
+      case JLE:
+      case JGE:
+      case JMP:
+        if (vm_cmp(vm, inst)) {
+          vm->pc = vm_value(vm, &inst->jmp);
+          if (vm->pc < 0 || vm->pc >= m->num_pcs)
+            return vm_error(vm, "pc out of range");
+          vm->next = m->pc_start[vm->pc];
+        }
+        break;
+
+      default:
+        return vm_error(vm, "oops");
+    }
+  }
+  return ELI_RUNNING;
+}
+
+#ifdef ELI_JIT
+
+// A JIT which compiles a pc at a time to x86-64 the first time it runs.
+// EIR registers live in callee-saved host registers, so calls to the C
+// helpers below keep them, and r11 holds the base of mem, which is
+// reloaded after each call. Compiled pcs run until they need a pc which
+// is not compiled yet, and then return it to eli_run_jit with the
+// address of the rel32 to point at the new code, which chains the two.
+// The code has the addresses of one VM, which owns it.
+//
+// Running off the end of the last pc is reported as out of range,
+// where the interpreters start over from the last jump target.
+
+enum {
+  JIT_RAX = 0, JIT_RCX = 1, JIT_RDX = 2, JIT_RBX = 3,
+  JIT_RSP = 4, JIT_RBP = 5, JIT_RSI = 6, JIT_RDI = 7,
+  JIT_R11 = 11, JIT_R12 = 12, JIT_R13 = 13, JIT_R14 = 14, JIT_R15 = 15,
+};
+
+static const int JIT_REGS[6] = {
+  JIT_RBX, JIT_R12, JIT_R13, JIT_R14, JIT_R15, JIT_RBP
+};
+
+// Condition codes of jcc and setcc for JEQ .. JGE. Values are never
+// negative, so unsigned ones work.
+static const int JIT_CC[6] = { 0x4, 0x5, 0x2, 0x7, 0x6, 0x3 };
+
+// The most bytes one instruction and the end of a pc can take, with
+// their exit stubs.
+#define JIT_MAX_INST_SIZE 128
+#define JIT_MAX_PC_SIZE 32
+
+// What the code returns when the program exits or a helper fails.
+#define JIT_EXITED -1
+#define JIT_FAILED -2
+
+typedef struct {
+  int pc;
+  unsigned char* rel;
+} JitStub;
+
+typedef struct EliJit_ {
+  EliVM* vm;
+  Module* m;
+  unsigned char* buf;
+  unsigned char* p;
+  unsigned char* end;
+  // Compiled code by pc, or NULL. Register jumps look this up.
+  unsigned char** blocks;
+  unsigned char* (*enter)(unsigned char* code);
+  unsigned char* exit;
+  // Exits to pcs which are not compiled yet, emitted after each pc.
+  JitStub* stubs;
+  int num_stubs;
+  // Where the last return to eli_run_jit came from, or NULL.
+  unsigned char* patch;
+} Jit;
+
+static void jit_byte(Jit* j, int b) {
+  *j->p++ = b;
+}
+
+static void jit_int32(Jit* j, int v) {
+  memcpy(j->p, &v, 4);
+  j->p += 4;
+}
+
+static void jit_ptr(Jit* j, const void* v) {
+  memcpy(j->p, &v, 8);
+  j->p += 8;
+}
+
+static void jit_set_rel(unsigned char* rel, unsigned char* to) {
+  int v = to - (rel + 4);
+  memcpy(rel, &v, 4);
+}
+
+static void jit_rex(Jit* j, bool w, int reg, int index, int base) {
+  int rex = 0x40 | (w << 3) | (reg >= 8) << 2 | (index >= 8) << 1 | (base >= 8);
+  if (rex != 0x40)
+    jit_byte(j, rex);
+}
+
+// An op with a register |reg| and a register operand |rm|.
+static void jit_op_rr(Jit* j, int op, int reg, int rm) {
+  jit_rex(j, false, reg, 0, rm);
+  jit_byte(j, op);
+  jit_byte(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// An op with a register |reg| and the operand mem[index] or mem[imm] if
+// |index| is -1.
+static void jit_op_mem(Jit* j, int op, int reg, int index, int imm) {
+  if (index < 0) {
+    jit_rex(j, false, reg, 0, JIT_R11);
+    jit_byte(j, op);
+    jit_byte(j, 0x80 | (reg & 7) << 3 | (JIT_R11 & 7));
+    jit_int32(j, imm * 4);
+  } else {
+    jit_rex(j, false, reg, index, JIT_R11);
+    jit_byte(j, op);
+    jit_byte(j, (reg & 7) << 3 | 4);
+    jit_byte(j, 0x80 | (index & 7) << 3 | (JIT_R11 & 7));
+  }
+}
+
+static void jit_movabs(Jit* j, int reg, const void* v) {
+  jit_rex(j, true, 0, 0, reg);
+  jit_byte(j, 0xb8 | (reg & 7));
+  jit_ptr(j, v);
+}
+
+static void jit_mov_imm(Jit* j, int reg, int imm) {
+  jit_rex(j, false, 0, 0, reg);
+  jit_byte(j, 0xb8 | (reg & 7));
+  jit_int32(j, imm);
+}
+
+// Sets |reg| to the value of |v|.
+static void jit_mov_value(Jit* j, int reg, Value* v) {
+  if (v->type == REG)
+    jit_op_rr(j, 0x89, JIT_REGS[v->reg], reg);
+  else
+    jit_mov_imm(j, reg, v->imm);
+}
+
+// add, sub, and, or cmp of |v| to |reg|, as the /digit of opcode 0x81.
+static void jit_arith(Jit* j, int digit, int reg, Value* v) {
+  static const int RR_OPS[8] = { 0x01, 0, 0, 0, 0x21, 0x29, 0, 0x39 };
+  if (v->type == REG) {
+    jit_op_rr(j, RR_OPS[digit], JIT_REGS[v->reg], reg);
+  } else {
+    jit_rex(j, false, 0, 0, reg);
+    jit_byte(j, 0x81);
+    jit_byte(j, 0xc0 | digit << 3 | (reg & 7));
+    jit_int32(j, v->imm);
+  }
+}
+
+static void jit_mask(Jit* j, int reg) {
+  Value v = { .type = IMM, .imm = MEMSZ - 1 };
+  jit_arith(j, 4, reg, &v);
+}
+
+// Calls |fn| and restores the base of mem. Arguments are set already.
+static void jit_call(Jit* j, const void* fn) {
+  jit_movabs(j, JIT_RAX, fn);
+  jit_byte(j, 0xff);
+  jit_byte(j, 0xd0);
+  jit_movabs(j, JIT_R11, j->vm->mem);
+}
+
+// Stores every register to regs for helpers which read them.
+static void jit_spill(Jit* j) {
+  jit_movabs(j, JIT_RCX, j->vm->regs);
+  for (int i = 0; i < 6; i++) {
+    jit_rex(j, false, JIT_REGS[i], 0, JIT_RCX);
+    jit_byte(j, 0x89);
+    jit_byte(j, 0x40 | (JIT_REGS[i] & 7) << 3 | JIT_RCX);
+    jit_byte(j, i * 4);
+  }
+}
+
+static void jit_fill(Jit* j) {
+  jit_movabs(j, JIT_RCX, j->vm->regs);
+  for (int i = 0; i < 6; i++) {
+    jit_rex(j, false, JIT_REGS[i], 0, JIT_RCX);
+    jit_byte(j, 0x8b);
+    jit_byte(j, 0x40 | (JIT_REGS[i] & 7) << 3 | JIT_RCX);
+    jit_byte(j, i * 4);
+  }
+}
+
+// Returns to eli_run_jit with pc in eax and the rel32 to patch in rdx.
+static void jit_exit(Jit* j, int npc, unsigned char* rel) {
+  jit_mov_imm(j, JIT_RAX, npc);
+  jit_movabs(j, JIT_RDX, rel);
+  jit_byte(j, 0xe9);
+  jit_set_rel(j->p, j->exit);
+  j->p += 4;
+}
+
+// Ends a jmp (0xe9) or jcc (0x0f 0x8?) to |npc| whose rel32 comes next.
+static void jit_branch_to(Jit* j, int npc) {
+  unsigned char* rel = j->p;
+  j->p += 4;
+  if (npc >= 0 && npc < j->m->num_pcs && j->blocks[npc]) {
+    jit_set_rel(rel, j->blocks[npc]);
+  } else {
+    j->stubs[j->num_stubs].pc = npc;
+    j->stubs[j->num_stubs].rel = rel;
+    j->num_stubs++;
+  }
+}
+
+// Jumps to the pc in eax through blocks, or returns to eli_run_jit if
+// it is not compiled yet.
+static void jit_jump_eax(Jit* j) {
+  // cmp eax, num_pcs; jae exit
+  jit_byte(j, 0x3d);
+  jit_int32(j, j->m->num_pcs);
+  jit_byte(j, 0x0f);
+  jit_byte(j, 0x83);
+  unsigned char* out_of_range = j->p;
+  j->p += 4;
+  // mov rcx, blocks[rax]; test rcx, rcx; jz exit; jmp rcx
+  jit_movabs(j, JIT_RCX, j->blocks);
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x8b);
+  jit_byte(j, 0x0c);
+  jit_byte(j, 0xc1);
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x85);
+  jit_byte(j, 0xc9);
+  jit_byte(j, 0x0f);
+  jit_byte(j, 0x84);
+  unsigned char* not_compiled = j->p;
+  j->p += 4;
+  jit_byte(j, 0xff);
+  jit_byte(j, 0xe1);
+  jit_set_rel(out_of_range, j->p);
+  jit_set_rel(not_compiled, j->p);
+  // xor edx, edx; jmp exit
+  jit_byte(j, 0x31);
+  jit_byte(j, 0xd2);
+  jit_byte(j, 0xe9);
+  jit_set_rel(j->p, j->exit);
+  j->p += 4;
+}
+
+static void jit_putc(EliVM* vm, int c) {
+  vm_putc(vm, c);
+}
+
+static int jit_getc(EliVM* vm) {
+  return vm_getc(vm);
+}
+
+// COPY and FILL, which can fail. The code does not keep pc, so this
+// sets it for the error.
+static bool jit_block_op(EliVM* vm, Inst* inst) {
+  vm->pc = inst->pc;
+  return inst->op == COPY ? vm_copy(vm, inst) : vm_fill(vm, inst);
+}
+
+static void jit_inst(Jit* j, Inst* inst) {
+  int d = JIT_REGS[inst->dst.reg];
+  switch (inst->op) {
+    case MOV:
+      jit_mov_value(j, d, &inst->src);
+      break;
+
+    case ADD:
+    case SUB:
+      jit_arith(j, inst->op == ADD ? 0 : 5, d, &inst->src);
+      jit_mask(j, d);
+      break;
+
+    case LOAD:
+    case STORE: {
+      int op = inst->op == LOAD ? 0x8b : 0x89;
+      if (inst->src.type == REG)
+        jit_op_mem(j, op, d, JIT_REGS[inst->src.reg], 0);
+      else
+        jit_op_mem(j, op, d, -1, inst->src.imm);
+      break;
+    }
+
+    case PUTC:
+      jit_mov_value(j, JIT_RSI, &inst->src);
+      jit_movabs(j, JIT_RDI, j->vm);
+      jit_call(j, jit_putc);
+      break;
+
+    case GETC:
+      jit_movabs(j, JIT_RDI, j->vm);
+      jit_call(j, jit_getc);
+      jit_op_rr(j, 0x89, JIT_RAX, d);
+      break;
+
+    case EXIT:
+      jit_exit(j, JIT_EXITED, NULL);
+      break;
+
+    case DUMP:
+      break;
+
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+      // cmp; setcc al; movzx d, al
+      jit_arith(j, 7, d, &inst->src);
+      jit_byte(j, 0x0f);
+      jit_byte(j, 0x90 | JIT_CC[inst->op - EQ]);
+      jit_byte(j, 0xc0);
+      jit_rex(j, false, d, 0, 0);
+      jit_byte(j, 0x0f);
+      jit_byte(j, 0xb6);
+      jit_byte(j, 0xc0 | (d & 7) << 3);
+      break;
+
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      jit_mov_value(j, JIT_RDX, &inst->src);
+      jit_op_rr(j, 0x89, d, JIT_RSI);
+      jit_mov_imm(j, JIT_RDI, inst->op);
+      jit_call(j, eval_ext_op);
+      jit_op_rr(j, 0x89, JIT_RAX, d);
+      break;
+
+    case COPY:
+    case FILL: {
+      jit_spill(j);
+      jit_movabs(j, JIT_RDI, j->vm);
+      jit_movabs(j, JIT_RSI, inst);
+      jit_call(j, jit_block_op);
+      // test al, al; jnz ok
+      jit_byte(j, 0x84);
+      jit_byte(j, 0xc0);
+      jit_byte(j, 0x0f);
+      jit_byte(j, 0x85);
+      unsigned char* ok = j->p;
+      j->p += 4;
+      jit_exit(j, JIT_FAILED, NULL);
+      jit_set_rel(ok, j->p);
+      break;
+    }
+
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+    case JMP: {
+      bool direct = inst->jmp.type == IMM;
+      unsigned char* skip = NULL;
+      if (inst->op != JMP) {
+        jit_arith(j, 7, d, &inst->src);
+        jit_byte(j, 0x0f);
+        if (direct) {
+          jit_byte(j, 0x80 | JIT_CC[inst->op - JEQ]);
+          jit_branch_to(j, inst->jmp.imm);
+          break;
+        }
+        // The opposite condition skips the register jump.
+        jit_byte(j, 0x80 | (JIT_CC[inst->op - JEQ] ^ 1));
+        skip = j->p;
+        j->p += 4;
+      }
+      if (direct) {
+        jit_byte(j, 0xe9);
+        jit_branch_to(j, inst->jmp.imm);
+      } else {
+        jit_op_rr(j, 0x89, JIT_REGS[inst->jmp.reg], JIT_RAX);
+        jit_jump_eax(j);
+      }
+      if (skip)
+        jit_set_rel(skip, j->p);
+      break;
+    }
+
+    default:
+      assert(false);
+  }
+}
+
+static bool jit_compile(Jit* j, int npc) {
+  Module* m = j->m;
+  int start = m->pc_start[npc];
+  int end = m->pc_start[npc + 1];
+  if (j->end - j->p < (end - start) * JIT_MAX_INST_SIZE + JIT_MAX_PC_SIZE)
+    return false;
+  j->blocks[npc] = j->p;
+  j->num_stubs = 0;
+  for (int i = start; i < end; i++)
+    jit_inst(j, &m->insts[i]);
+  if (end == start || (m->insts[end - 1].op != JMP &&
+                       m->insts[end - 1].op != EXIT)) {
+    jit_byte(j, 0xe9);
+    jit_branch_to(j, npc + 1);
+  }
+  for (int i = 0; i < j->num_stubs; i++) {
+    jit_set_rel(j->stubs[i].rel, j->p);
+    jit_exit(j, j->stubs[i].pc, j->stubs[i].rel);
+  }
+  return true;
+}
+
+static size_t jit_size(Module* m) {
+  return ((size_t)m->num_insts * JIT_MAX_INST_SIZE +
+          (size_t)m->num_pcs * JIT_MAX_PC_SIZE + 4096);
+}
+
+static Jit* jit_new(EliVM* vm) {
+  Module* m = vm->module;
+  unsigned char* buf = mmap(NULL, jit_size(m),
+                            PROT_READ | PROT_WRITE | PROT_EXEC,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    return NULL;
+  Jit* j = calloc(1, sizeof(Jit));
+  j->vm = vm;
+  j->m = m;
+  j->buf = buf;
+  j->p = j->buf;
+  j->end = j->buf + jit_size(m);
+  j->blocks = calloc(m->num_pcs + 1, sizeof(unsigned char*));
+  int max_stubs = 1;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (m->pc_start[pc + 1] - m->pc_start[pc] + 1 > max_stubs)
+      max_stubs = m->pc_start[pc + 1] - m->pc_start[pc] + 1;
+  }
+  j->stubs = malloc(sizeof(JitStub) * max_stubs);
+
+  // enter(code): saves the callee-saved registers, keeping the stack
+  // aligned for calls, loads regs, and jumps to |code|.
+  j->enter = (unsigned char* (*)(unsigned char*))j->p;
+  static const int SAVED[6] = {
+    JIT_RBX, JIT_RBP, JIT_R12, JIT_R13, JIT_R14, JIT_R15
+  };
+  for (int i = 0; i < 6; i++) {
+    jit_rex(j, false, 0, 0, SAVED[i]);
+    jit_byte(j, 0x50 | (SAVED[i] & 7));
+  }
+  // sub rsp, 8
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x83);
+  jit_byte(j, 0xec);
+  jit_byte(j, 8);
+  jit_fill(j);
+  jit_movabs(j, JIT_R11, vm->mem);
+  // jmp rdi
+  jit_byte(j, 0xff);
+  jit_byte(j, 0xe7);
+
+  // The exit: stores regs and patch, and returns pc.
+  j->exit = j->p;
+  jit_spill(j);
+  jit_movabs(j, JIT_RCX, &j->patch);
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x89);
+  jit_byte(j, 0x11);
+  // add rsp, 8
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x83);
+  jit_byte(j, 0xc4);
+  jit_byte(j, 8);
+  for (int i = 5; i >= 0; i--) {
+    jit_rex(j, false, 0, 0, SAVED[i]);
+    jit_byte(j, 0x58 | (SAVED[i] & 7));
+  }
+  jit_byte(j, 0xc3);
+  return j;
+}
+
+static void jit_free(Jit* j) {
+  munmap(j->buf, jit_size(j->m));
+  free(j->blocks);
+  free(j->stubs);
+  free(j);
+}
+
+#endif  // ELI_JIT
+
+EliProgram* eli_new_program(Module* m, int flags) {
+  EliProgram* prog = calloc(1, sizeof(EliProgram));
+  prog->module = m;
+  prog->flags = flags;
+#ifdef ELI_FAST
+  fast_run(NULL, 0, prog);
+#endif
+  return prog;
+}
+
+void eli_free_program(EliProgram* prog) {
+#ifdef ELI_FAST
+  free(prog->code);
+  free(prog->plain);
+  free(prog->real);
+  free(prog->kinds);
+#endif
+  free(prog);
+}
+
+static int* alloc_mem(void) {
+#ifdef ELI_MMAP
+  void* p = mmap(NULL, MEMSZ * sizeof(int), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+#else
+  return calloc(MEMSZ, sizeof(int));
+#endif
+}
+
+static void free_mem(int* mem) {
+#ifdef ELI_MMAP
+  munmap(mem, MEMSZ * sizeof(int));
+#else
+  free(mem);
+#endif
+}
+
+EliVM* eli_new_vm(const EliProgram* prog) {
+  Module* m = prog->module;
+  int* mem = alloc_mem();
+  if (!mem)
+    return NULL;
+  EliVM* vm = calloc(1, sizeof(EliVM));
+  vm->prog = prog;
+  vm->module = m;
+  vm->mem = mem;
+  int i = 0;
+  for (Data* d = m->data; d; d = d->next, i++) {
+    vm->mem[i] = d->v;
+  }
+  if (m->text)
+    vm->pc = m->text->pc;
+  vm->next = vm->pc < m->num_pcs ? m->pc_start[vm->pc] : m->num_insts;
+  if (prog->flags & (ELI_PROFILE | ELI_STATS))
+    vm->counts = calloc(m->num_insts + 1, sizeof(long));
+  if (prog->flags & ELI_PROFILE)
+    vm->taken = calloc(m->num_insts + 1, sizeof(long));
+  return vm;
+}
+
+void eli_free_vm(EliVM* vm) {
+#ifdef ELI_JIT
+  if (vm->jit)
+    jit_free(vm->jit);
+#endif
+  free_mem(vm->mem);
+  free(vm->counts);
+  free(vm->taken);
+  free(vm->edges);
+  free(vm);
+}
+
+void eli_set_io(EliVM* vm, EliGetc getc_fn, EliPutc putc_fn, void* opaque) {
+  vm->getc_fn = getc_fn;
+  vm->putc_fn = putc_fn;
+  vm->io = opaque;
+}
+
+EliStatus eli_run(EliVM* vm, long budget) {
+  if (vm->status == ELI_BREAK)
+    vm->status = ELI_RUNNING;
+  if (vm->status != ELI_RUNNING)
+    return vm->status;
+#ifdef ELI_FAST
+  if (!vm->trace)
+    return fast_run(vm, budget, NULL);
+#endif
+  return slow_run(vm, budget);
+}
+
+EliStatus eli_step(EliVM* vm) {
+  return eli_run(vm, 1);
+}
+
+EliStatus eli_run_jit(EliVM* vm) {
+#ifdef ELI_JIT
+  Module* m = vm->module;
+  if (vm->status == ELI_BREAK)
+    vm->status = ELI_RUNNING;
+  // Compiled code is entered at the start of a pc.
+  while (vm->status == ELI_RUNNING && vm->next < m->num_insts &&
+         m->pc_start[m->insts[vm->next].pc] != vm->next)
+    eli_step(vm);
+  if (vm->status != ELI_RUNNING)
+    return vm->status;
+  if (!vm->jit)
+    vm->jit = jit_new(vm);
+  if (!vm->jit)
+    return vm_error(vm, "cannot map jit buffer");
+
+  Jit* j = vm->jit;
+  int pc = vm->next < m->num_insts ? m->insts[vm->next].pc : vm->pc;
+  for (;;) {
+    vm->pc = pc;
+    if (pc < 0 || pc >= m->num_pcs)
+      return vm_error(vm, "pc out of range");
+    if (!j->blocks[pc] && !jit_compile(j, pc))
+      return vm_error(vm, "jit buffer full");
+    if (j->patch)
+      jit_set_rel(j->patch, j->blocks[pc]);
+    j->patch = NULL;
+    // The returned pointer is the pc, as eax.
+    pc = (int)(long)j->enter(j->blocks[pc]);
+    if (pc == JIT_EXITED) {
+      vm->status = ELI_EXITED;
+      return ELI_EXITED;
+    }
+    if (pc == JIT_FAILED)
+      return ELI_ERROR;
+  }
+#else
+  return eli_run(vm, -1);
+#endif
+}
+
+long eli_resident_pages(EliVM* vm) {
+#ifdef ELI_MMAP
+  long page = sysconf(_SC_PAGESIZE);
+  long num_pages = (MEMSZ * sizeof(int) + page - 1) / page;
+  unsigned char* vec = malloc(num_pages);
+  long n = -1;
+  if (!mincore(vm->mem, MEMSZ * sizeof(int), vec)) {
+    n = 0;
+    for (long i = 0; i < num_pages; i++)
+      n += vec[i] & 1;
+  }
+  free(vec);
+  return n;
+#else
+  (void)vm;
+  return -1;
+#endif
+}
+
+#ifdef ELI_MMAP
+
+// A snapshot file starts with this, followed by the index of each saved
+// page of memory and the output so far. The pages follow at data_offset,
+// which is aligned to a host page so they can be mapped as they are.
+typedef struct {
+  char magic[8];
+  unsigned module_hash;
+  int regs[6];
+  int pc;
+  int next;
+  int page_size;
+  int num_pages;
+  long out_len;
+  long data_offset;
+} EliSnapshot;
+
+static const char SNAPSHOT_MAGIC[8] = "ELISNAP";
+
+static unsigned hash_int(unsigned h, int v) {
+  return (h ^ (unsigned)v) * 16777619u;
+}
+
+static unsigned hash_value(unsigned h, Value* v) {
+  h = hash_int(h, v->type);
+  return hash_int(h, v->type == REG ? (int)v->reg : v->imm);
+}
+
+// The code and data a snapshot belongs to, so it is not resumed with
+// another program.
+static unsigned module_hash(Module* m) {
+  unsigned h = hash_int(2166136261u, m->num_insts);
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    h = hash_int(h, inst->op);
+    h = hash_int(h, inst->pc);
+    h = hash_value(h, &inst->dst);
+    h = hash_value(h, &inst->src);
+    h = hash_value(h, &inst->jmp);
+  }
+  for (Data* d = m->data; d; d = d->next)
+    h = hash_int(h, d->v);
+  return h;
+}
+
+static int num_data_words(Module* m) {
+  int n = 0;
+  for (Data* d = m->data; d; d = d->next)
+    n++;
+  return n;
+}
+
+#endif
+
+const char* eli_save_snapshot(EliVM* vm, const char* filename,
+                              const char* out, long out_len) {
+#ifdef ELI_MMAP
+  if (vm->status != ELI_RUNNING && vm->status != ELI_BREAK)
+    return "the program is not running";
+  Module* m = vm->module;
+  long page = sysconf(_SC_PAGESIZE);
+  long page_words = page / sizeof(int);
+  long max_pages = MEMSZ / page_words;
+  // A new VM has the data and zeros elsewhere, so the snapshot needs
+  // the pages with the data and the pages which are not zero. mincore
+  // would be cheaper, but it misses pages which were swapped out or,
+  // after a restore, dropped from the page cache.
+  int data_words = num_data_words(m);
+  int* pages = malloc(sizeof(int) * max_pages);
+  int num_pages = 0;
+  for (long p = 0; p < max_pages; p++) {
+    int* words = vm->mem + p * page_words;
+    bool zero = p * page_words >= data_words;
+    for (long i = 0; zero && i < page_words; i++)
+      zero = !words[i];
+    if (!zero)
+      pages[num_pages++] = p;
+  }
+
+  EliSnapshot s = {};
+  memcpy(s.magic, SNAPSHOT_MAGIC, sizeof(s.magic));
+  s.module_hash = module_hash(m);
+  memcpy(s.regs, vm->regs, sizeof(s.regs));
+  s.pc = vm->pc;
+  s.next = vm->next;
+  s.page_size = page;
+  s.num_pages = num_pages;
+  s.out_len = out_len;
+  long head = sizeof(s) + sizeof(int) * num_pages + out_len;
+  s.data_offset = (head + page - 1) / page * page;
+
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    free(pages);
+    return "cannot open snapshot";
+  }
+  fwrite(&s, sizeof(s), 1, fp);
+  fwrite(pages, sizeof(int), num_pages, fp);
+  fwrite(out, 1, out_len, fp);
+  for (long i = head; i < s.data_offset; i++)
+    fputc(0, fp);
+  for (int i = 0; i < num_pages; i++)
+    fwrite(vm->mem + pages[i] * page_words, 1, page, fp);
+  free(pages);
+  bool ok = !ferror(fp);
+  if (fclose(fp))
+    ok = false;
+  return ok ? NULL : "cannot write snapshot";
+#else
+  (void)vm;
+  (void)filename;
+  (void)out;
+  (void)out_len;
+  return "snapshots are not supported";
+#endif
+}
+
+#ifdef ELI_MMAP
+
+// Maps the pages of the snapshot |s| in |fd| over the memory of |vm|,
+// copy on write, and restores the rest of its state.
+static const char* load_snapshot(EliVM* vm, EliSnapshot* s, long size,
+                                 int fd, char** out, long* out_len) {
+  long page = sysconf(_SC_PAGESIZE);
+  long page_words = page / sizeof(int);
+  long max_pages = MEMSZ / page_words;
+  if (memcmp(s->magic, SNAPSHOT_MAGIC, sizeof(s->magic)))
+    return "not a snapshot";
+  if (s->module_hash != module_hash(vm->module))
+    return "snapshot of another program";
+  if (s->page_size != page)
+    return "snapshot of another page size";
+  if (s->num_pages < 0 || s->num_pages > max_pages || s->out_len < 0 ||
+      (long)(sizeof(*s) + sizeof(int) * s->num_pages) + s->out_len >
+      s->data_offset ||
+      s->data_offset % page ||
+      s->data_offset + s->num_pages * page > size)
+    return "broken snapshot";
+  int* pages = (int*)(s + 1);
+  for (int i = 0; i < s->num_pages; i++) {
+    if (pages[i] < 0 || pages[i] >= max_pages ||
+        (i && pages[i] <= pages[i - 1]))
+      return "broken snapshot";
+  }
+
+  // Runs of pages are mapped at once.
+  for (int i = 0; i < s->num_pages;) {
+    int j = i + 1;
+    while (j < s->num_pages && pages[j] == pages[j - 1] + 1)
+      j++;
+    void* p = mmap(vm->mem + pages[i] * page_words, (j - i) * page,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                   fd, s->data_offset + i * page);
+    if (p == MAP_FAILED)
+      return "cannot map snapshot";
+    i = j;
+  }
+  memcpy(vm->regs, s->regs, sizeof(vm->regs));
+  vm->pc = s->pc;
+  vm->next = s->next;
+  vm->status = ELI_RUNNING;
+  *out_len = s->out_len;
+  *out = malloc(s->out_len + 1);
+  memcpy(*out, (char*)(pages + s->num_pages), s->out_len);
+  return NULL;
+}
+
+#endif
+
+const char* eli_load_snapshot(EliVM* vm, const char* filename,
+                              char** out, long* out_len) {
+#ifdef ELI_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return "cannot open snapshot";
+  struct stat st;
+  const char* err = "broken snapshot";
+  if (!fstat(fd, &st) && st.st_size >= (long)sizeof(EliSnapshot)) {
+    EliSnapshot* s = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (s == MAP_FAILED) {
+      err = "cannot map snapshot";
+    } else {
+      err = load_snapshot(vm, s, st.st_size, fd, out, out_len);
+      munmap(s, st.st_size);
+    }
+  }
+  close(fd);
+  return err;
+#else
+  (void)vm;
+  (void)filename;
+  (void)out;
+  (void)out_len;
+  return "snapshots are not supported";
+#endif
+}
+
+void eli_get_inst_counts(EliVM* vm, long* counts) {
+  Module* m = vm->module;
+  if (!vm->taken) {
+    memset(counts, 0, sizeof(long) * m->num_insts);
+    return;
+  }
+  // Jumps only go to the start of a pc, so the entries to each pc and
+  // the jumps taken out of it give how many times every instruction ran.
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    long n = 0;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (i == m->pc_start[pc])
+        n = vm->counts[i];
+      counts[i] = n;
+      n -= vm->taken[i];
+    }
+  }
+}
+
+EliEdge* eli_get_edges(EliVM* vm, int* num_edges) {
+  Module* m = vm->module;
+  EliEdge* edges = NULL;
+  int num = 0;
+  int cap = 0;
+  // Register jumps are counted by target as they run, and direct ones
+  // by instruction.
+  for (int i = 0; i < vm->cap_edges; i++) {
+    EliEdge* e = &vm->edges[i];
+    if (e->count)
+      add_edge(&edges, &num, &cap, e->from, e->to, e->count);
+  }
+  for (int i = 0; vm->taken && i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (inst->op >= JEQ && inst->op <= JMP && inst->jmp.type == IMM &&
+        vm->taken[i])
+      add_edge(&edges, &num, &cap, inst->pc, inst->jmp.imm, vm->taken[i]);
+  }
+  EliEdge* r = malloc(sizeof(EliEdge) * (num + 1));
+  *num_edges = 0;
+  for (int i = 0; i < cap; i++) {
+    if (edges[i].count)
+      r[(*num_edges)++] = edges[i];
+  }
+  free(edges);
+  return r;
+}
+
+void eli_print_stats(EliVM* vm, FILE* fp) {
+#ifdef ELI_FAST
+  Module* m = vm->module;
+  char* kinds = vm->prog->kinds;
+  long total = 0;
+  long by_kind[NUM_FUSE] = {};
+  for (int i = 0; vm->counts && i < m->num_insts; i++) {
+    long n = vm->counts[i] * FUSE_LEN[(int)kinds[i]];
+    total += n;
+    by_kind[(int)kinds[i]] += n;
+  }
+  fprintf(fp, "fused: %ld of %ld insts (%.1f%%)\n",
+          total - by_kind[FUSE_NONE], total,
+          total ? (total - by_kind[FUSE_NONE]) * 100.0 / total : 0.0);
+  for (int k = 1; k < NUM_FUSE; k++) {
+    if (by_kind[k])
+      fprintf(fp, "  %s: %ld\n", FUSE_NAMES[k], by_kind[k]);
+  }
+#endif
+  long pages = eli_resident_pages(vm);
+  if (pages >= 0) {
+#ifdef ELI_MMAP
+    long kib = pages * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    long kib = 0;
+#endif
+    fprintf(fp, "memory: %ld pages (%ld KiB) resident of %ld KiB\n",
+            pages, kib, (long)(MEMSZ * sizeof(int) / 1024));
+  }
+}
+#include <ir/ir.h>
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/arena.h>
+#include <ir/table.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+# define IR_USE_MMAP
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+typedef struct DataPrivate_ {
+  int v;
+  struct DataPrivate_* next;
+  LabelType label;
+  Value val;
+  int lineno;
+} DataPrivate;
+
+typedef struct SymbolPrivate_ {
+  Symbol sym;
+  struct SymbolPrivate_* next;
+} SymbolPrivate;
+
+// The entry jump goes to pc 1 if the program has no main.
+static Symbol default_main = { "main", 1, true };
+
+typedef struct LocPrivate_ {
+  SourceLoc loc;
+  struct LocPrivate_* next;
+} LocPrivate;
+
+typedef struct FilePrivate_ {
+  int num;
+  const char* name;
+  struct FilePrivate_* next;
+} FilePrivate;
+
+typedef struct {
+  const char* filename;
+  int lineno;
+  int col;
+  FILE* fp;
+  const char* buf;
+  const char* cur;
+  const char* end;
+  Table* symtab;
+  Table* strtab;
+  Arena* arena;
+  SymbolPrivate sym_root;
+  SymbolPrivate* syms;
+  int num_syms;
+  LocPrivate loc_root;
+  LocPrivate* locs;
+  int num_locs;
+  int loc;
+  FilePrivate file_root;
+  FilePrivate* files;
+  int num_files;
+  int in_text;
+  Inst* text;
+  int pc;
+  int subsection;
+  DataPrivate* data;
+  bool prev_boundary;
+} Parser;
+
+enum {
+  DATA = LAST_OP + 1, TEXT, LONG, STRING, FILENAME, LOC
+};
+
+enum {
+  REF = IMM + 1, LABEL
+};
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void ir_error(Parser* p, const char* msg) {
+  fprintf(stderr, "%s:%d:%d: %s\n", p->filename, p->lineno, p->col, msg);
+  exit(1);
+}
+
+// When the whole input is in memory (|buf| is set), the lexer scans it
+// with a pointer. Otherwise it reads |fp| one character at a time.
+static int ir_getc(Parser* p) {
+  int c;
+  if (p->buf) {
+    c = p->cur < p->end ? (unsigned char)*p->cur++ : EOF;
+  } else {
+    c = fgetc(p->fp);
+  }
+  if (c == '\n') {
+    p->lineno++;
+    p->col = 0;
+  } else {
+    p->col++;
+  }
+  return c;
+}
+
+static void ir_ungetc(Parser* p, int c) {
+  if (c == '\n') {
+    p->lineno--;
+  }
+  if (p->buf) {
+    if (c != EOF)
+      p->cur--;
+  } else {
+    ungetc(c, p->fp);
+  }
+}
+
+static int peek(Parser* p) {
+  if (p->buf)
+    return p->cur < p->end ? (unsigned char)*p->cur : EOF;
+  int c = fgetc(p->fp);
+  ungetc(c, p->fp);
+  return c;
+}
+
+static bool is_ident_char(int c) {
+  return isalnum(c) || c == '_' || c == '.';
+}
+
+static void skip_until_ret(Parser* p) {
+  if (p->buf) {
+    // ELVM's libc has no memchr.
+    const char* e = p->cur;
+    while (e < p->end && *e != '\n')
+      e++;
+    p->col += e - p->cur;
+    p->cur = e;
+    return;
+  }
+
+  int c;
+  for (;;) {
+    c = ir_getc(p);
+    if (c == '\n' || c == EOF)
+      break;
+  }
+  ir_ungetc(p, c);
+}
+
+static void skip_ws(Parser* p) {
+  if (p->buf) {
+    const char* q = p->cur;
+    for (; q < p->end && isspace((unsigned char)*q); q++) {
+      if (*q == '\n') {
+        p->lineno++;
+        p->col = 0;
+      } else {
+        p->col++;
+      }
+    }
+    p->cur = q;
+    return;
+  }
+
+  int c;
+  for (;;) {
+    c = ir_getc(p);
+    if (!isspace(c))
+      break;
+  }
+  ir_ungetc(p, c);
+}
+
+static void read_while_ident(Parser* p, char* buf, int len) {
+  if (p->buf) {
+    const char* q = p->cur;
+    const char* e = p->end - q > len ? q + len : p->end;
+    for (; q < e && is_ident_char((unsigned char)*q); q++) {}
+    int n = q - p->cur;
+    if (n == len)
+      ir_error(p, "too long ident");
+    memcpy(buf, p->cur, n);
+    buf[n] = 0;
+    p->col += n;
+    p->cur = q;
+    return;
+  }
+
+  while (len--) {
+    int c = ir_getc(p);
+    if (!is_ident_char(c)) {
+      ir_ungetc(p, c);
+      *buf = 0;
+      return;
+    }
+    *buf++ = c;
+  }
+  ir_error(p, "too long ident");
+}
+
+static int read_int(Parser* p, int c) {
+  bool is_minus = false;
+  int r = 0;
+  if (c == '-') {
+    is_minus = true;
+    c = ir_getc(p);
+    if (!isdigit(c))
+      ir_error(p, "digit expected");
+  }
+  if (p->buf) {
+    const char* q = p->cur;
+    r = c - '0';
+    for (; q < p->end && '0' <= *q && *q <= '9'; q++) {
+      r *= 10;
+      r += *q - '0';
+    }
+    p->col += q - p->cur;
+    p->cur = q;
+    return is_minus ? -r : r;
+  }
+  while ('0' <= c && c <= '9') {
+    r *= 10;
+    r += c - '0';
+    c = ir_getc(p);
+  }
+  ir_ungetc(p, c);
+  return is_minus ? -r : r;
+}
+
+// Returns a copy of |s| owned by the module. Every occurrence of the
+// same name shares one copy.
+static const char* intern(Parser* p, const char* s) {
+  const void* r;
+  if (table_get(p->strtab, s, &r))
+    return r;
+  char* n = arena_strdup(p->arena, s);
+  p->strtab = table_add(p->strtab, n, n);
+  return n;
+}
+
+static void add_sym(Parser* p, const char* name, int value, bool is_text) {
+  SymbolPrivate* s = arena_alloc(p->arena, sizeof(SymbolPrivate));
+  s->sym.name = name;
+  s->sym.value = value;
+  s->sym.is_text = is_text;
+  p->symtab = table_add(p->symtab, name, &s->sym);
+  p->syms->next = s;
+  p->syms = s;
+  p->num_syms++;
+}
+
+static DataPrivate* add_data(Parser* p) {
+  DataPrivate* n = arena_alloc(p->arena, sizeof(DataPrivate));
+  n->v = p->subsection;
+  n->lineno = p->lineno;
+  p->data->next = n;
+  p->data = n;
+  return n;
+}
+
+static void add_imm_data(Parser* p, int v) {
+  DataPrivate* n = add_data(p);
+  n->val.type = IMM;
+  n->val.imm = v;
+}
+
+typedef struct {
+  int subsection;
+  DataPrivate* head;
+  DataPrivate* tail;
+} DataBucket;
+
+static DataBucket* find_data_bucket(DataBucket* buckets, int cap,
+                                    int subsection) {
+  int mask = cap - 1;
+  for (int i = subsection & mask;; i = (i + 1) & mask) {
+    if (!buckets[i].head || buckets[i].subsection == subsection)
+      return &buckets[i];
+  }
+}
+
+static int compare_data_buckets(const void* a, const void* b) {
+  int x = ((const DataBucket*)a)->subsection;
+  int y = ((const DataBucket*)b)->subsection;
+  return x < y ? -1 : x > y;
+}
+
+// Lays out data by ascending subsection, keeping the order of entries
+// within a subsection. Entries are bucketed in a single pass, so this
+// is linear in the number of data words plus sorting the subsections.
+static void serialize_data(Parser* p, DataPrivate* data_root) {
+  int cap = 16;
+  int num_buckets = 0;
+  DataBucket* buckets = calloc(cap, sizeof(DataBucket));
+  DataBucket* last = NULL;
+  for (DataPrivate* data = data_root->next; data;) {
+    DataPrivate* next = data->next;
+    data->next = 0;
+    if (!last || last->subsection != data->v) {
+      last = find_data_bucket(buckets, cap, data->v);
+      if (!last->head) {
+        if ((num_buckets + 1) * 2 > cap) {
+          DataBucket* old = buckets;
+          buckets = calloc(cap * 2, sizeof(DataBucket));
+          for (int i = 0; i < cap; i++) {
+            if (old[i].head)
+              *find_data_bucket(buckets, cap * 2, old[i].subsection) = old[i];
+          }
+          cap *= 2;
+          free(old);
+          last = find_data_bucket(buckets, cap, data->v);
+        }
+        last->subsection = data->v;
+        last->head = data;
+        last->tail = data;
+        num_buckets++;
+        data = next;
+        continue;
+      }
+    }
+    last->tail->next = data;
+    last->tail = data;
+    data = next;
+  }
+
+  int n = 0;
+  for (int i = 0; i < cap; i++) {
+    if (buckets[i].head)
+      buckets[n++] = buckets[i];
+  }
+  qsort(buckets, n, sizeof(DataBucket), compare_data_buckets);
+
+  DataPrivate serialized_root = {};
+  DataPrivate* serialized = &serialized_root;
+  intptr_t mp = 0;
+  for (int i = 0; i < n; i++) {
+    for (DataPrivate* data = buckets[i].head; data;) {
+      DataPrivate* next = data->next;
+      if (data->val.type == (ValueType)LABEL) {
+        add_sym(p, data->val.tmp, mp, false);
+      } else {
+        serialized->next = data;
+        serialized = data;
+        serialized->next = 0;
+        mp++;
+      }
+      data = next;
+    }
+  }
+  free(buckets);
+
+  add_sym(p, "_edata", mp, false);
+  serialized->next = arena_alloc(p->arena, sizeof(DataPrivate));
+  serialized->next->v = mp + 1;
+  serialized->next->val.type = IMM;
+  serialized->next->val.imm = mp + 1;
+  data_root->next = serialized_root.next;
+}
+
+// Dispatches on the first character so each op name is compared with
+// at most a few candidates.
+static Op get_op(Parser* p, const char* buf) {
+  if (peek(p) == ':')
+    return OP_UNSET;
+  switch (buf[0]) {
+    case 'a':
+      if (!strcmp(buf, "add")) return ADD;
+      if (!strcmp(buf, "and")) return AND;
+      break;
+    case 'c':
+      if (!strcmp(buf, "copy")) return COPY;
+      break;
+    case 'd':
+      if (!strcmp(buf, "dump")) return DUMP;
+      if (!strcmp(buf, "div")) return DIV;
+      break;
+    case 'e':
+      if (!strcmp(buf, "exit")) return EXIT;
+      if (!strcmp(buf, "eq")) return EQ;
+      break;
+    case 'f':
+      if (!strcmp(buf, "fill")) return FILL;
+      break;
+    case 'g':
+      if (buf[1] == 'e' && !buf[2]) return GE;
+      if (buf[1] == 't' && !buf[2]) return GT;
+      if (!strcmp(buf, "getc")) return GETC;
+      break;
+    case 'j':
+      switch (buf[1]) {
+        case 'e':
+          if (buf[2] == 'q' && !buf[3]) return JEQ;
+          break;
+        case 'n':
+          if (buf[2] == 'e' && !buf[3]) return JNE;
+          break;
+        case 'l':
+          if (buf[2] == 't' && !buf[3]) return JLT;
+          if (buf[2] == 'e' && !buf[3]) return JLE;
+          break;
+        case 'g':
+          if (buf[2] == 't' && !buf[3]) return JGT;
+          if (buf[2] == 'e' && !buf[3]) return JGE;
+          break;
+        case 'm':
+          if (buf[2] == 'p' && !buf[3]) return JMP;
+          break;
+      }
+      break;
+    case 'l':
+      if (buf[1] == 't' && !buf[2]) return LT;
+      if (buf[1] == 'e' && !buf[2]) return LE;
+      if (!strcmp(buf, "load")) return LOAD;
+      break;
+    case 'm':
+      if (!strcmp(buf, "mov")) return MOV;
+      if (!strcmp(buf, "mul")) return MUL;
+      if (!strcmp(buf, "mod")) return MOD;
+      break;
+    case 'n':
+      if (!strcmp(buf, "ne")) return NE;
+      break;
+    case 'o':
+      if (!strcmp(buf, "or")) return OR;
+      break;
+    case 'p':
+      if (!strcmp(buf, "putc")) return PUTC;
+      break;
+    case 's':
+      if (!strcmp(buf, "sub")) return SUB;
+      if (!strcmp(buf, "store")) return STORE;
+      if (!strcmp(buf, "shl")) return SHL;
+      if (!strcmp(buf, "shr")) return SHR;
+      break;
+    case 'x':
+      if (!strcmp(buf, "xor")) return XOR;
+      break;
+    case '.':
+      switch (buf[1]) {
+        case 't':
+          if (!strcmp(buf, ".text")) return (Op)TEXT;
+          break;
+        case 'd':
+          if (!strcmp(buf, ".data")) return (Op)DATA;
+          break;
+        case 'l':
+          if (!strcmp(buf, ".long")) return (Op)LONG;
+          if (!strcmp(buf, ".loc")) return (Op)LOC;
+          break;
+        case 's':
+          if (!strcmp(buf, ".string")) return (Op)STRING;
+          break;
+        case 'f':
+          if (!strcmp(buf, ".file")) return (Op)FILENAME;
+          break;
+      }
+      break;
+  }
+  return OP_UNSET;
+}
+
+static bool get_reg(const char* buf, Reg* r) {
+  if (!buf[1]) {
+    if (buf[0] >= 'A' && buf[0] <= 'D') {
+      *r = (Reg)(A + buf[0] - 'A');
+      return true;
+    }
+  } else if (buf[1] == 'P' && !buf[2]) {
+    if (buf[0] == 'S') {
+      *r = SP;
+      return true;
+    } else if (buf[0] == 'B') {
+      *r = BP;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int read_escape(Parser* p) {
+  int c = ir_getc(p);
+  if (c == 'n') {
+    c = '\n';
+  } else if (c == 't') {
+    c = '\t';
+  } else if (c == 'b') {
+    c = '\b';
+  } else if (c == 'f') {
+    c = '\f';
+  } else if (c == 'r') {
+    c = '\r';
+  } else if (c == '\"') {
+    c = '\"';
+  } else if (c == '\\') {
+    c = '\\';
+  } else if (c == 'x') {
+    char b[3];
+    b[0] = ir_getc(p);
+    c = ir_getc(p);
+    if (!((c >= '0' && c <= '9') ||
+          (c >= 'a' && c <= 'f') ||
+          (c >= 'A' && c <= 'F'))) {
+      ir_ungetc(p, c);
+      c = 0;
+    }
+    b[1] = c;
+    b[2] = 0;
+    c = strtoul(b, NULL, 16);
+  } else {
+    ir_error(p, "unknown escape");
+  }
+  return c;
+}
+
+// .file [n] "name"
+static void parse_file(Parser* p) {
+  char buf[1024];
+  int num = 0;
+  skip_ws(p);
+  int c = ir_getc(p);
+  if (isdigit(c)) {
+    num = read_int(p, c);
+    skip_ws(p);
+    c = ir_getc(p);
+  }
+  if (c != '"')
+    ir_error(p, "expected open '\"'");
+  int len = 0;
+  for (c = ir_getc(p); c != '"'; c = ir_getc(p)) {
+    if (c == '\n' || c == EOF)
+      ir_error(p, "unterminated file name");
+    if (c == '\\')
+      c = read_escape(p);
+    if (len == (int)sizeof(buf) - 1)
+      ir_error(p, "too long file name");
+    buf[len++] = c;
+  }
+  buf[len] = 0;
+
+  FilePrivate* f = arena_alloc(p->arena, sizeof(FilePrivate));
+  f->num = num;
+  f->name = intern(p, buf);
+  p->files->next = f;
+  p->files = f;
+  if (p->num_files <= num)
+    p->num_files = num + 1;
+  skip_until_ret(p);
+}
+
+// .loc file line [column]
+static void parse_loc(Parser* p) {
+  int v[2];
+  for (int i = 0; i < 2; i++) {
+    skip_ws(p);
+    int c = ir_getc(p);
+    if (!isdigit(c))
+      ir_error(p, "number expected");
+    v[i] = read_int(p, c);
+  }
+  skip_until_ret(p);
+
+  SourceLoc* cur = &p->locs->loc;
+  if (p->loc && cur->file == v[0] && cur->line == v[1])
+    return;
+  LocPrivate* l = arena_alloc(p->arena, sizeof(LocPrivate));
+  l->loc.file = v[0];
+  l->loc.line = v[1];
+  p->locs->next = l;
+  p->locs = l;
+  p->loc = p->num_locs++;
+}
+
+static void parse_line(Parser* p, int c) {
+  char buf[64];
+  buf[0] = c;
+  read_while_ident(p, buf + 1, 62);
+  Op op = get_op(p, buf);
+  if (op == (Op)TEXT) {
+    p->in_text = 1;
+    return;
+  } else if (op == (Op)STRING) {
+    if (p->in_text)
+      ir_error(p, "in text");
+    skip_ws(p);
+    if (ir_getc(p) != '"')
+      ir_error(p, "expected open '\"'");
+
+    c = ir_getc(p);
+    while (c != '"') {
+      if (c == '\\')
+        c = read_escape(p);
+      add_imm_data(p, c);
+      c = ir_getc(p);
+    }
+    add_imm_data(p, 0);
+    return;
+  } else if (op == (Op)FILENAME) {
+    parse_file(p);
+    return;
+  } else if (op == (Op)LOC) {
+    parse_loc(p);
+    return;
+  } else if (op == OP_UNSET) {
+    c = ir_getc(p);
+    if (c == ':') {
+      intptr_t value = 0;
+      if (p->in_text) {
+        if (!p->prev_boundary)
+          p->pc++;
+        value = p->pc;
+        p->prev_boundary = true;
+        add_sym(p, intern(p, buf), value, true);
+      } else {
+        DataPrivate* d = add_data(p);
+        d->val.type = (ValueType)LABEL;
+        d->val.tmp = (void*)intern(p, buf);
+      }
+      return;
+    }
+    ir_error(p, "unknown op");
+  }
+
+  if (op < 0) {
+    ir_error(p, "oops");
+  }
+  int argc;
+  if (op <= STORE)
+    argc = 2;
+  else if (op <= GETC)
+    argc = 1;
+  else if (op <= EXIT)
+    argc = 0;
+  else if (op <= JGE)
+    argc = 3;
+  else if (op <= JMP)
+    argc = 1;
+  else if (op <= GE)
+    argc = 2;
+  else if (op == DUMP)
+    argc = 0;
+  else if (op <= SHR)
+    argc = 2;
+  else if (op <= FILL)
+    argc = 3;
+  else if (op == (Op)LONG)
+    argc = 1;
+  else if (op == (Op)DATA) {
+    skip_ws(p);
+    c = peek(p);
+    argc = c == '-' || isdigit(c) ? 1 : 0;
+  } else
+    ir_error(p, "oops");
+
+  Value args[3];
+  for (int i = 0; i < argc; i++) {
+    skip_ws(p);
+    if (i) {
+      c = ir_getc(p);
+      if (c != ',')
+        ir_error(p, "comma expected");
+      skip_ws(p);
+    }
+
+    Value a;
+    a.label = NOT_LABEL;
+    c = ir_getc(p);
+    if (isdigit(c) || c == '-') {
+      a.type = IMM;
+      a.imm = MOD24(read_int(p, c));
+    } else {
+      buf[0] = c;
+      read_while_ident(p, buf + 1, 62);
+      a.type = REG;
+      if (!get_reg(buf, &a.reg)) {
+        a.type = (ValueType)REF;
+        a.tmp = (void*)intern(p, buf);
+      }
+    }
+    args[i] = a;
+  }
+
+  if (op == (Op)LONG) {
+    if (args[0].type == IMM) {
+      add_imm_data(p, args[0].imm);
+    } else if (args[0].type == (ValueType)REF) {
+      DataPrivate* d = add_data(p);
+      d->val.type = (ValueType)REF;
+      d->val.tmp = args[0].tmp;
+    } else {
+      ir_error(p, "number expected");
+    }
+    return;
+  } else if (op == (Op)DATA) {
+    if (argc == 1) {
+      if (args[0].type != IMM)
+        ir_error(p, "number expected");
+      p->subsection = args[0].imm;
+    }
+    p->in_text = 0;
+    return;
+  }
+
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = op;
+  p->text->pc = p->pc;
+  p->text->lineno = p->lineno;
+  p->text->loc = p->loc;
+  p->prev_boundary = false;
+  switch (op) {
+    case LOAD:
+    case STORE:
+    case MOV:
+    case ADD:
+    case SUB:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      p->text->src = args[1];
+      FALLTHROUGH;
+    case GETC:
+      p->text->dst = args[0];
+      break;
+    case PUTC:
+      p->text->src = args[0];
+      break;
+    case COPY:
+    case FILL:
+      p->text->dst = args[0];
+      p->text->src = args[1];
+      p->text->jmp = args[2];
+      break;
+    case EXIT:
+    case DUMP:
+      break;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      p->text->dst = args[1];
+      p->text->src = args[2];
+      FALLTHROUGH;
+    case JMP:
+      p->text->jmp = args[0];
+      p->pc++;
+      p->prev_boundary = true;
+      break;
+    default:
+      ir_error(p, "oops");
+  }
+
+#if 0
+  dump_inst(p->text);
+#endif
+}
+
+static void parse_eir(Parser* p) {
+  Inst text_root = {};
+  DataPrivate data_root = {};
+  int c;
+
+  p->in_text = 1;
+  p->lineno = 1;
+  p->text = &text_root;
+  p->data = &data_root;
+  p->syms = &p->sym_root;
+  p->locs = &p->loc_root;
+  p->num_locs = 1;
+  p->files = &p->file_root;
+  p->pc = 0;
+  p->prev_boundary = true;
+
+  p->text->next = arena_alloc(p->arena, sizeof(Inst));
+  p->text = p->text->next;
+  p->text->op = JMP;
+  p->text->pc = p->pc++;
+  p->text->lineno = -1;
+  p->text->jmp.type = (ValueType)REF;
+  p->text->jmp.tmp = "main";
+  p->text->next = 0;
+  p->symtab = table_add(p->symtab, "main", &default_main);
+
+  for (;;) {
+    skip_ws(p);
+    c = ir_getc(p);
+    if (c == EOF)
+      break;
+
+    if (c == '#') {
+      skip_until_ret(p);
+    } else if (c == '_' || c == '.' || isalpha(c)) {
+      parse_line(p, c);
+    } else {
+      ir_error(p, "unexpected char");
+    }
+  }
+
+  serialize_data(p, &data_root);
+  p->text = text_root.next;
+  p->data = data_root.next;
+}
+
+static void resolve(Value* v, Table* symtab) {
+  if (v->type != (ValueType)REF)
+    return;
+  const char* name = (const char*)v->tmp;
+  Symbol* sym;
+  if (!table_get(symtab, name, (void*)&sym)) {
+    fprintf(stderr, "undefined sym: %s\n", name);
+    exit(1);
+  }
+  //fprintf(stderr, "resolved: %s %d\n", name, sym->value);
+  v->type = IMM;
+  v->imm = sym->value;
+  v->label = sym->is_text ? TEXT_LABEL : DATA_LABEL;
+}
+
+static void resolve_syms(Parser* p) {
+  for (DataPrivate* data = p->data; data; data = data->next) {
+    if (data->val.type == (ValueType)REF) {
+      resolve(&data->val, p->symtab);
+    }
+    data->v = MOD24(data->val.imm);
+    data->label = data->val.label;
+  }
+
+  for (Inst* inst = p->text; inst; inst = inst->next) {
+    resolve(&inst->dst, p->symtab);
+    resolve(&inst->src, p->symtab);
+    resolve(&inst->jmp, p->symtab);
+  }
+}
+
+static Module* load_eir_impl(const char* filename, FILE* fp,
+                             const char* buf, size_t size) {
+  Parser parser = {
+    .filename = filename,
+    .fp = fp,
+    .buf = buf,
+    .cur = buf,
+    .end = buf + size,
+    .arena = arena_new()
+  };
+  parse_eir(&parser);
+  resolve_syms(&parser);
+  table_free(parser.symtab);
+  table_free(parser.strtab);
+
+  Module* m = arena_alloc(parser.arena, sizeof(Module));
+  m->text = parser.text;
+  m->data = (Data*)parser.data;
+  m->arena = parser.arena;
+  m->syms = arena_alloc(m->arena, sizeof(Symbol) * parser.num_syms);
+  m->num_syms = parser.num_syms;
+  int i = 0;
+  for (SymbolPrivate* s = parser.sym_root.next; s; s = s->next)
+    m->syms[i++] = s->sym;
+
+  m->files = arena_alloc(m->arena, sizeof(char*) * parser.num_files);
+  m->num_files = parser.num_files;
+  for (FilePrivate* f = parser.file_root.next; f; f = f->next)
+    m->files[f->num] = f->name;
+  m->locs = arena_alloc(m->arena, sizeof(SourceLoc) * parser.num_locs);
+  m->num_locs = parser.num_locs;
+  m->locs[0].file = -1;
+  i = 1;
+  for (LocPrivate* l = parser.loc_root.next; l; l = l->next)
+    m->locs[i++] = l->loc;
+
+  reindex_module(m);
+  return m;
+}
+
+bool get_inst_source_loc(Module* m, Inst* inst,
+                         const char** file, int* line) {
+  if (inst->loc <= 0 || inst->loc >= m->num_locs)
+    return false;
+  SourceLoc* l = &m->locs[inst->loc];
+  *file = l->file < m->num_files ? m->files[l->file] : NULL;
+  *line = l->line;
+  return true;
+}
+
+bool get_pc_source_loc(Module* m, int pc, const char** file, int* line) {
+  if (pc < 0 || pc >= m->num_pcs || m->pc_start[pc] == m->pc_start[pc + 1])
+    return false;
+  return get_inst_source_loc(m, &m->insts[m->pc_start[pc]], file, line);
+}
+
+void reindex_module(Module* m) {
+  int n = 0;
+  int num_pcs = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    n++;
+    num_pcs = inst->pc + 1;
+  }
+
+  Inst* insts = arena_alloc(m->arena, sizeof(Inst) * n);
+  int* pc_start = arena_alloc(m->arena, sizeof(int) * (num_pcs + 1));
+  int i = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next, i++) {
+    insts[i] = *inst;
+    insts[i].next = i + 1 < n ? &insts[i + 1] : NULL;
+    for (; pc <= inst->pc; pc++)
+      pc_start[pc] = i;
+  }
+  for (; pc <= num_pcs; pc++)
+    pc_start[pc] = n;
+
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = num_pcs;
+}
+
+void free_module(Module* m) {
+#ifdef IR_USE_MMAP
+  if (m->map)
+    munmap(m->map, m->map_size);
+#endif
+  // |m| itself lives in the arena.
+  arena_free(m->arena);
+}
+
+Module* load_eir(FILE* fp) {
+  return load_eir_impl("<stdin>", fp, NULL, 0);
+}
+
+#ifdef IR_USE_MMAP
+
+// Maps the whole file so the lexer can scan it without stdio.
+Module* load_eir_from_file(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    // Pipes and devices cannot be mapped.
+    close(fd);
+    FILE* fp = fopen(filename, "r");
+    Module* r = load_eir_impl(filename, fp, NULL, 0);
+    fclose(fp);
+    return r;
+  }
+
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return load_eir_impl(filename, NULL, "", 0);
+  }
+  char* buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  if (is_eir_binary(buf, size))
+    return load_eir_binary(filename, buf, size);
+  Module* r = load_eir_impl(filename, NULL, buf, size);
+  munmap(buf, size);
+  return r;
+}
+
+#else
+
+Module* load_eir_from_file(const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  Module* r = load_eir_impl(filename, fp, NULL, 0);
+  fclose(fp);
+  return r;
+}
+
+#endif
+
+bool is_ext_op(Op op) {
+  return op >= MUL && op <= SHR;
+}
+
+int eval_ext_op(Op op, int dst, int src) {
+  unsigned int d = dst;
+  unsigned int s = src;
+  switch (op) {
+    case MUL:
+      return MOD24(d * s);
+    case DIV:
+      return s ? d / s : 0;
+    case MOD:
+      return s ? d % s : d;
+    case AND:
+      return d & s;
+    case OR:
+      return d | s;
+    case XOR:
+      return d ^ s;
+    case SHL:
+      return s < 24 ? MOD24(d << s) : 0;
+    case SHR:
+      return s < 24 ? d >> s : 0;
+    default:
+      return 0;
+  }
+}
+
+void dump_op(Op op, FILE* fp) {
+  static const char* op_strs[] = {
+    "mov", "add", "sub", "load", "store", "putc", "getc", "exit",
+    "jeq", "jne", "jlt", "jgt", "jle", "jge", "jmp", "xxx",
+    "eq", "ne", "lt", "gt", "le", "ge", "dump",
+    "mul", "div", "mod", "and", "or", "xor", "shl", "shr",
+    "copy", "fill"
+  };
+  fprintf(fp, "%s", op_strs[op]);
+}
+
+void dump_val(Value* val, FILE* fp) {
+  static const char* reg_strs[] = {
+    "A", "B", "C", "D", "BP", "SP"
+  };
+  if (val->type == REG) {
+    fprintf(fp, "%s", reg_strs[val->reg]);
+  } else if (val->type == IMM) {
+    fprintf(fp, "%d", val->imm);
+  } else {
+    fprintf(fp, "%d (type=%d)", val->imm, val->type);
+  }
+}
+
+void dump_inst_fp(Inst* inst, FILE* fp) {
+  dump_op(inst->op, fp);
+  switch (inst->op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case STORE:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case PUTC:
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case GETC:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      break;
+    case EXIT:
+    case DUMP:
+      break;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      break;
+    case JMP:
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
+    case COPY:
+    case FILL:
+      fprintf(fp, " ");
+      dump_val(&inst->dst, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->src, fp);
+      fprintf(fp, " ");
+      dump_val(&inst->jmp, fp);
+      break;
+    default:
+      fprintf(fp, "oops op=%d\n", inst->op);
+      exit(1);
+  }
+  if (inst->no_wrap)
+    fprintf(fp, " nowrap");
+  fprintf(fp, " pc=%d @", inst->pc);
+  int lineno = inst->lineno;
+  // A hack to make the test for dump_ir.c.eir pass.
+#ifndef __eir__
+  lineno &= UINT_MAX;
+#endif
+  fprintf(fp, "%d\n", lineno);
+}
+
+void dump_inst(Inst* inst) {
+  dump_inst_fp(inst, stderr);
+}
+#include <ir/table.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define TABLE_INIT_CAP 64
+#else
+#define TABLE_INIT_CAP 1024
+#endif
+
+TableStats table_stats;
+
+static unsigned int table_hash(const char* key) {
+  // FNV-1a, which spreads similar labels such as .L1 and .L2 well enough
+  // for linear probing.
+  unsigned int h = 2166136261u;
+  for (; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static TableEntry* table_find(Table* tbl, const char* key, unsigned int h) {
+  unsigned int mask = tbl->cap - 1;
+  for (unsigned int i = h & mask;; i = (i + 1) & mask) {
+    TableEntry* e = &tbl->entries[i];
+    table_stats.probes++;
+    if (!e->key)
+      return e;
+    if (e->key == key || (e->hash == h && !strcmp(e->key, key)))
+      return e;
+  }
+}
+
+static void table_grow(Table* tbl) {
+  TableEntry* old = tbl->entries;
+  int old_cap = tbl->cap;
+  tbl->cap = old_cap ? old_cap * 2 : TABLE_INIT_CAP;
+  tbl->entries = calloc(tbl->cap, sizeof(TableEntry));
+  for (int i = 0; i < old_cap; i++) {
+    if (old[i].key)
+      *table_find(tbl, old[i].key, old[i].hash) = old[i];
+  }
+  free(old);
+}
+
+Table* table_add(Table* tbl, const char* key, const void* value) {
+  if (!tbl)
+    tbl = calloc(1, sizeof(Table));
+  // Keep the load factor at most 1/2 so probe sequences stay short.
+  if ((tbl->size + 1) * 2 > tbl->cap)
+    table_grow(tbl);
+  unsigned int h = table_hash(key);
+  TableEntry* e = table_find(tbl, key, h);
+  if (!e->key) {
+    e->key = key;
+    e->hash = h;
+    tbl->size++;
+  }
+  e->value = value;
+  table_stats.adds++;
+  return tbl;
+}
+
+bool table_get(Table* tbl, const char* key, const void** value) {
+  table_stats.lookups++;
+  if (!tbl)
+    return false;
+  TableEntry* e = table_find(tbl, key, table_hash(key));
+  if (!e->key)
+    return false;
+  *value = e->value;
+  return true;
+}
+
+void table_free(Table* tbl) {
+  if (!tbl)
+    return;
+  free(tbl->entries);
+  free(tbl);
+}
+#include <ir/arena.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __eir__
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN(n) (n)
+#else
+#define ARENA_CHUNK_SIZE (256 * 1024)
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#endif
+
+Arena* arena_new(void) {
+  return calloc(1, sizeof(Arena));
+}
+
+static ArenaChunk* arena_add_chunk(Arena* arena, size_t size) {
+  ArenaChunk* chunk = malloc(sizeof(ArenaChunk));
+  chunk->buf = calloc(1, size);
+  chunk->used = 0;
+  chunk->size = size;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  return chunk;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  ArenaChunk* chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size) {
+    if (size > ARENA_CHUNK_SIZE / 4) {
+      // Give big objects their own chunk and keep filling the current one.
+      ArenaChunk* big = arena_add_chunk(arena, size);
+      if (chunk) {
+        arena->chunks = chunk;
+        big->next = chunk->next;
+        chunk->next = big;
+      }
+      big->used = size;
+      return big->buf;
+    }
+    chunk = arena_add_chunk(arena, ARENA_CHUNK_SIZE);
+  }
+  void* r = chunk->buf + chunk->used;
+  chunk->used += size;
+  return r;
+}
+
+char* arena_strdup(Arena* arena, const char* s) {
+  size_t n = strlen(s) + 1;
+  char* r = arena_alloc(arena, n);
+  memcpy(r, s, n);
+  return r;
+}
+
+void arena_free(Arena* arena) {
+  if (!arena)
+    return;
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk* next = chunk->next;
+    free(chunk->buf);
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+#include <ir/ir.h>
+
+#if !defined(NOFILE) && !defined(__eir__)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <ir/arena.h>
+
+// Binary EIR layout. All fields are host-endian 32-bit integers unless
+// noted, and every section starts right after the previous one.
+//
+//   EirbHeader
+//   EirbInst     insts[num_insts]
+//   int32        pc_start[num_pcs + 1]
+//   EirbData     data[num_data]
+//   EirbSymbol   syms[num_syms]
+//   SourceLoc    locs[num_locs]
+//   uint32       files[num_files]     (strtab offsets, or ~0 for none)
+//   char         strtab[strtab_size]  (NUL-terminated names)
+//
+// Operands are already resolved, so the loader does not parse. It still
+// decodes the instruction and data records into new Inst and Data
+// arrays, since their layout differs from the records. Only pc_start,
+// locs and the names are used in place from the mapping. Every index
+// in the file is checked before use, so a broken file is an error
+// rather than a bad read later.
+
+// Text EIR never contains DEL, so the magic cannot be a valid text file.
+#define EIRB_MAGIC "\177EIR"
+#define EIRB_VERSION 3
+#define EIRB_NO_FILE 0xffffffffu
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_insts;
+  uint32_t num_pcs;
+  uint32_t num_data;
+  uint32_t num_syms;
+  uint32_t num_locs;
+  uint32_t num_files;
+  uint32_t strtab_size;
+} EirbHeader;
+
+typedef struct {
+  uint8_t op;
+  // ValueType of dst, src, and jmp in the low nibble and LabelType in
+  // the high nibble.
+  uint8_t types[3];
+  int32_t vals[3];
+  int32_t pc;
+  int32_t lineno;
+  int32_t loc;
+} EirbInst;
+
+typedef struct {
+  int32_t v;
+  uint32_t label;
+} EirbData;
+
+typedef struct {
+  uint32_t name;
+  int32_t value;
+  uint32_t is_text;
+} EirbSymbol;
+
+static void eirb_encode_value(Value* v, uint8_t* type, int32_t* val) {
+  *type = v->type | (v->type == IMM ? v->label << 4 : 0);
+  *val = v->type == REG ? (int32_t)v->reg : v->imm;
+}
+
+static bool eirb_check_value(uint8_t type, int32_t val) {
+  if ((type & 15) == REG)
+    return type >> 4 == 0 && val >= A && val <= SP;
+  // The text parser keeps every number in the word size, and the
+  // engines index memory with them unchecked.
+  return (type & 15) == IMM && type >> 4 <= DATA_LABEL &&
+         val >= 0 && val <= UINT_MAX;
+}
+
+static void eirb_decode_value(uint8_t type, int32_t val, Value* v) {
+  v->type = (ValueType)(type & 15);
+  v->label = (LabelType)(type >> 4);
+  if (v->type == REG)
+    v->reg = (Reg)val;
+  else
+    v->imm = val;
+}
+
+void write_eir_binary(Module* m, FILE* fp) {
+  EirbHeader h = {};
+  memcpy(h.magic, EIRB_MAGIC, 4);
+  h.version = EIRB_VERSION;
+  h.num_insts = m->num_insts;
+  h.num_pcs = m->num_pcs;
+  for (Data* d = m->data; d; d = d->next)
+    h.num_data++;
+  h.num_syms = m->num_syms;
+  h.num_locs = m->num_locs;
+  h.num_files = m->num_files;
+  for (int i = 0; i < m->num_syms; i++)
+    h.strtab_size += strlen(m->syms[i].name) + 1;
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      h.strtab_size += strlen(m->files[i]) + 1;
+  }
+  // Keep the file size a multiple of 4.
+  h.strtab_size = (h.strtab_size + 3) & ~3u;
+  fwrite(&h, sizeof(h), 1, fp);
+
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    EirbInst r = {};
+    r.op = inst->op;
+    eirb_encode_value(&inst->dst, &r.types[0], &r.vals[0]);
+    eirb_encode_value(&inst->src, &r.types[1], &r.vals[1]);
+    eirb_encode_value(&inst->jmp, &r.types[2], &r.vals[2]);
+    r.pc = inst->pc;
+    r.lineno = inst->lineno;
+    r.loc = inst->loc;
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  fwrite(m->pc_start, sizeof(int32_t), m->num_pcs + 1, fp);
+
+  for (Data* d = m->data; d; d = d->next) {
+    EirbData r = { d->v, d->label };
+    fwrite(&r, sizeof(r), 1, fp);
+  }
+
+  uint32_t name = 0;
+  for (int i = 0; i < m->num_syms; i++) {
+    EirbSymbol s = {
+      .name = name,
+      .value = m->syms[i].value,
+      .is_text = m->syms[i].is_text
+    };
+    fwrite(&s, sizeof(s), 1, fp);
+    name += strlen(m->syms[i].name) + 1;
+  }
+  fwrite(m->locs, sizeof(SourceLoc), m->num_locs, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    uint32_t off = EIRB_NO_FILE;
+    if (m->files[i]) {
+      off = name;
+      name += strlen(m->files[i]) + 1;
+    }
+    fwrite(&off, sizeof(off), 1, fp);
+  }
+  for (int i = 0; i < m->num_syms; i++)
+    fwrite(m->syms[i].name, 1, strlen(m->syms[i].name) + 1, fp);
+  for (int i = 0; i < m->num_files; i++) {
+    if (m->files[i])
+      fwrite(m->files[i], 1, strlen(m->files[i]) + 1, fp);
+  }
+  for (; name < h.strtab_size; name++)
+    fputc(0, fp);
+}
+
+bool is_eir_binary(const void* buf, size_t size) {
+  return size >= sizeof(EirbHeader) && !memcmp(buf, EIRB_MAGIC, 4);
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void eirb_error(const char* filename, const char* msg) {
+  fprintf(stderr, "%s: %s\n", filename, msg);
+  exit(1);
+}
+
+Module* load_eir_binary(const char* filename, void* buf, size_t size) {
+  const EirbHeader* h = buf;
+  if (h->version != EIRB_VERSION)
+    eirb_error(filename, "unsupported binary EIR version");
+  size_t need = (sizeof(EirbHeader) +
+                 sizeof(EirbInst) * (size_t)h->num_insts +
+                 sizeof(int32_t) * ((size_t)h->num_pcs + 1) +
+                 sizeof(EirbData) * (size_t)h->num_data +
+                 sizeof(EirbSymbol) * (size_t)h->num_syms +
+                 sizeof(SourceLoc) * (size_t)h->num_locs +
+                 sizeof(uint32_t) * (size_t)h->num_files +
+                 h->strtab_size);
+  if (need != size)
+    eirb_error(filename, "broken binary EIR");
+
+  const EirbInst* rec = (const EirbInst*)(h + 1);
+  int* pc_start = (int*)(rec + h->num_insts);
+  const EirbData* data = (const EirbData*)(pc_start + h->num_pcs + 1);
+  const EirbSymbol* syms = (const EirbSymbol*)(data + h->num_data);
+  SourceLoc* locs = (SourceLoc*)(syms + h->num_syms);
+  const uint32_t* files = (const uint32_t*)(locs + h->num_locs);
+  const char* strtab = (const char*)(files + h->num_files);
+  if (h->strtab_size && strtab[h->strtab_size - 1])
+    eirb_error(filename, "broken binary EIR");
+  if (pc_start[0] != 0 || pc_start[h->num_pcs] != (int)h->num_insts)
+    eirb_error(filename, "broken binary EIR");
+  for (uint32_t pc = 0; pc < h->num_pcs; pc++) {
+    if (pc_start[pc] > pc_start[pc + 1])
+      eirb_error(filename, "broken binary EIR");
+  }
+  // A file number without a .file has no name, but it is never negative
+  // except in locs[0], which no instruction uses.
+  for (uint32_t i = 1; i < h->num_locs; i++) {
+    if (locs[i].file < 0)
+      eirb_error(filename, "broken binary EIR");
+  }
+
+  Arena* arena = arena_new();
+  Module* m = arena_alloc(arena, sizeof(Module));
+  m->arena = arena;
+  m->map = buf;
+  m->map_size = size;
+
+  int n = h->num_insts;
+  Inst* insts = arena_alloc(arena, sizeof(Inst) * n);
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    int op = rec[i].op;
+    int pc = rec[i].pc;
+    int loc = rec[i].loc;
+    if (op >= LAST_OP || (op > JMP && op < EQ) ||
+        !eirb_check_value(rec[i].types[0], rec[i].vals[0]) ||
+        !eirb_check_value(rec[i].types[1], rec[i].vals[1]) ||
+        !eirb_check_value(rec[i].types[2], rec[i].vals[2]) ||
+        pc < 0 || pc >= (int)h->num_pcs ||
+        i < pc_start[pc] || i >= pc_start[pc + 1] ||
+        loc < 0 || (loc >= (int)h->num_locs && loc != 0))
+      eirb_error(filename, "broken binary EIR");
+    inst->op = (Op)op;
+    eirb_decode_value(rec[i].types[0], rec[i].vals[0], &inst->dst);
+    eirb_decode_value(rec[i].types[1], rec[i].vals[1], &inst->src);
+    eirb_decode_value(rec[i].types[2], rec[i].vals[2], &inst->jmp);
+    inst->pc = rec[i].pc;
+    inst->lineno = rec[i].lineno;
+    inst->loc = rec[i].loc;
+    inst->next = i + 1 < n ? &insts[i + 1] : NULL;
+  }
+  m->text = n ? insts : NULL;
+  m->insts = insts;
+  m->num_insts = n;
+  m->pc_start = pc_start;
+  m->num_pcs = h->num_pcs;
+
+  Data* d = arena_alloc(arena, sizeof(Data) * h->num_data);
+  for (uint32_t i = 0; i < h->num_data; i++) {
+    if (data[i].label > DATA_LABEL || data[i].v < 0 || data[i].v > UINT_MAX)
+      eirb_error(filename, "broken binary EIR");
+    d[i].v = data[i].v;
+    d[i].label = (LabelType)data[i].label;
+    d[i].next = i + 1 < h->num_data ? &d[i + 1] : NULL;
+  }
+  m->data = h->num_data ? d : NULL;
+
+  m->syms = arena_alloc(arena, sizeof(Symbol) * h->num_syms);
+  m->num_syms = h->num_syms;
+  for (uint32_t i = 0; i < h->num_syms; i++) {
+    if (syms[i].name >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->syms[i].name = strtab + syms[i].name;
+    m->syms[i].value = syms[i].value;
+    m->syms[i].is_text = syms[i].is_text;
+  }
+
+  m->locs = locs;
+  m->num_locs = h->num_locs;
+  m->files = arena_alloc(arena, sizeof(char*) * h->num_files);
+  m->num_files = h->num_files;
+  for (uint32_t i = 0; i < h->num_files; i++) {
+    if (files[i] == EIRB_NO_FILE)
+      continue;
+    if (files[i] >= h->strtab_size)
+      eirb_error(filename, "broken binary EIR");
+    m->files[i] = strtab + files[i];
+  }
+  return m;
+}
+
+#endif
+#include <ir/cfg.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+static bool cfg_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+bool cfg_has_reg_jump(Module* m) {
+  for (int i = 0; i < m->num_insts; i++) {
+    if (cfg_is_jump(m->insts[i].op) && m->insts[i].jmp.type == REG)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_pc_value(Module* m, LabelType label, int v, bool plain) {
+  if (label == DATA_LABEL || (label == NOT_LABEL && !plain))
+    return -1;
+  return v >= 0 && v < m->num_pcs ? v : -1;
+}
+
+int cfg_code_address(Module* m, Inst* inst, Value* v, bool plain) {
+  if (v->type != IMM)
+    return -1;
+  if (v->label == NOT_LABEL) {
+    Op op = inst->op;
+    if (v != &inst->src ||
+        (op != MOV && op != ADD && op != SUB && (op < MUL || op > SHR)))
+      return -1;
+  }
+  return cfg_pc_value(m, v->label, v->imm, plain);
+}
+
+int cfg_data_code_address(Module* m, Data* data, bool plain) {
+  return cfg_pc_value(m, data->label, data->v, plain);
+}
+
+static void cfg_mark_address(CFG* cfg, int pc, LabelType label) {
+  if (pc < 0)
+    return;
+  cfg->blocks[pc].address_taken = true;
+  if (label == NOT_LABEL && pc > cfg->max_plain_pc)
+    cfg->max_plain_pc = pc;
+}
+
+static void cfg_mark_value(CFG* cfg, Inst* inst, Value* v, bool plain) {
+  cfg_mark_address(cfg, cfg_code_address(cfg->module, inst, v, plain),
+                   v->label);
+}
+
+static void cfg_add_succ(BasicBlock* bb, int to) {
+  for (int i = 0; i < bb->num_succs; i++) {
+    if (bb->succs[i] == to)
+      return;
+  }
+  bb->succs[bb->num_succs++] = to;
+}
+
+static void cfg_add_succs(CFG* cfg, BasicBlock* bb) {
+  int num_pcs = cfg->module->num_pcs;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return;
+    if (!cfg_is_jump(inst->op))
+      continue;
+    if (inst->jmp.type == REG)
+      cfg_add_succ(bb, cfg->indirect);
+    else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs)
+      cfg_add_succ(bb, inst->jmp.imm);
+    if (inst->op == JMP)
+      return;
+  }
+  if (bb->pc + 1 < num_pcs)
+    cfg_add_succ(bb, bb->pc + 1);
+}
+
+static void cfg_build_edges(CFG* cfg) {
+  Module* m = cfg->module;
+  bool plain = cfg_has_reg_jump(m);
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    cfg_mark_value(cfg, inst, &inst->dst, plain);
+    cfg_mark_value(cfg, inst, &inst->src, plain);
+    if (!cfg_is_jump(inst->op))
+      cfg_mark_value(cfg, inst, &inst->jmp, plain);
+  }
+  for (Data* data = m->data; data; data = data->next)
+    cfg_mark_address(cfg, cfg_data_code_address(m, data, plain), data->label);
+
+  int num_address_taken = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    if (bb->address_taken)
+      num_address_taken++;
+    int max_succs = 1;
+    for (int i = 0; i < bb->num_insts; i++) {
+      if (cfg_is_jump(bb->insts[i].op))
+        max_succs++;
+    }
+    bb->succs = arena_alloc(cfg->arena, sizeof(int) * max_succs);
+    cfg_add_succs(cfg, bb);
+  }
+
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  indirect->succs = arena_alloc(cfg->arena, sizeof(int) * num_address_taken);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (cfg->blocks[pc].address_taken)
+      indirect->succs[indirect->num_succs++] = pc;
+  }
+
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++)
+      cfg->blocks[bb->succs[j]].num_preds++;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    bb->preds = arena_alloc(cfg->arena, sizeof(int) * bb->num_preds);
+    bb->num_preds = 0;
+  }
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    for (int j = 0; j < bb->num_succs; j++) {
+      BasicBlock* succ = &cfg->blocks[bb->succs[j]];
+      succ->preds[succ->num_preds++] = i;
+    }
+  }
+}
+
+static void cfg_compute_rpo(CFG* cfg) {
+  int n = cfg->num_blocks;
+  cfg->rpo = arena_alloc(cfg->arena, sizeof(int) * n);
+  for (int i = 0; i < n; i++)
+    cfg->blocks[i].rpo = -1;
+  if (!cfg->module->num_pcs)
+    return;
+
+  int* stack = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* next = arena_alloc(cfg->arena, sizeof(int) * n);
+  bool* visited = arena_alloc(cfg->arena, sizeof(bool) * n);
+  int sp = 0;
+  int num_post = 0;
+  stack[sp++] = 0;
+  visited[0] = true;
+  while (sp) {
+    int b = stack[sp - 1];
+    BasicBlock* bb = &cfg->blocks[b];
+    if (next[b] < bb->num_succs) {
+      int s = bb->succs[next[b]++];
+      if (!visited[s]) {
+        visited[s] = true;
+        stack[sp++] = s;
+      }
+    } else {
+      // Blocks are stored in postorder and reversed below.
+      cfg->rpo[num_post++] = b;
+      sp--;
+    }
+  }
+
+  for (int i = 0; i < num_post / 2; i++) {
+    int t = cfg->rpo[i];
+    cfg->rpo[i] = cfg->rpo[num_post - 1 - i];
+    cfg->rpo[num_post - 1 - i] = t;
+  }
+  cfg->num_rpo = num_post;
+  for (int i = 0; i < num_post; i++)
+    cfg->blocks[cfg->rpo[i]].rpo = i;
+}
+
+static int cfg_intersect(CFG* cfg, int a, int b) {
+  BasicBlock* blocks = cfg->blocks;
+  while (a != b) {
+    while (blocks[a].rpo > blocks[b].rpo)
+      a = blocks[a].idom;
+    while (blocks[b].rpo > blocks[a].rpo)
+      b = blocks[b].idom;
+  }
+  return a;
+}
+
+// "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy.
+static void cfg_compute_dominators(CFG* cfg) {
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < cfg->num_blocks; i++)
+    blocks[i].idom = -1;
+  if (!cfg->num_rpo)
+    return;
+
+  int entry = cfg->rpo[0];
+  blocks[entry].idom = entry;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 1; i < cfg->num_rpo; i++) {
+      BasicBlock* bb = &blocks[cfg->rpo[i]];
+      int idom = -1;
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].idom < 0)
+          continue;
+        idom = idom < 0 ? p : cfg_intersect(cfg, p, idom);
+      }
+      if (bb->idom != idom) {
+        bb->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  blocks[entry].idom = -1;
+}
+
+bool cfg_dominates(CFG* cfg, int a, int b) {
+  if (cfg->blocks[a].rpo < 0)
+    return false;
+  for (; b >= 0; b = cfg->blocks[b].idom) {
+    if (b == a)
+      return true;
+  }
+  return false;
+}
+
+static int cfg_compare_ints(const void* a, const void* b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+static void cfg_find_loops(CFG* cfg) {
+  int n = cfg->num_blocks;
+  BasicBlock* blocks = cfg->blocks;
+  for (int i = 0; i < n; i++)
+    blocks[i].loop = -1;
+  cfg->loops = arena_alloc(cfg->arena, sizeof(Loop) * n);
+  int* body = arena_alloc(cfg->arena, sizeof(int) * n);
+  int* work = arena_alloc(cfg->arena, sizeof(int) * n);
+  // mark[b] == id + 1 once b is in the loop being built.
+  int* mark = arena_alloc(cfg->arena, sizeof(int) * n);
+
+  // A header dominates every block of its loop, so visiting headers in
+  // reverse postorder finds outer loops first.
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int h = cfg->rpo[i];
+    int id = cfg->num_loops;
+    int num_body = 0;
+    int num_work = 0;
+    for (int j = 0; j < blocks[h].num_preds; j++) {
+      int t = blocks[h].preds[j];
+      if (blocks[t].rpo < i || !cfg_dominates(cfg, h, t))
+        continue;
+      if (mark[t] != id + 1) {
+        mark[t] = id + 1;
+        body[num_body++] = t;
+        if (t != h)
+          work[num_work++] = t;
+      }
+    }
+    if (!num_body)
+      continue;
+    if (mark[h] != id + 1) {
+      mark[h] = id + 1;
+      body[num_body++] = h;
+    }
+    while (num_work) {
+      BasicBlock* bb = &blocks[work[--num_work]];
+      for (int j = 0; j < bb->num_preds; j++) {
+        int p = bb->preds[j];
+        if (blocks[p].rpo < 0 || mark[p] == id + 1)
+          continue;
+        mark[p] = id + 1;
+        body[num_body++] = p;
+        work[num_work++] = p;
+      }
+    }
+
+    Loop* loop = &cfg->loops[cfg->num_loops++];
+    loop->header = h;
+    // Loops are either nested or disjoint, so the last loop found which
+    // contains |h| is the innermost one around this loop.
+    loop->parent = blocks[h].loop;
+    loop->depth = loop->parent < 0 ? 1 : cfg->loops[loop->parent].depth + 1;
+    qsort(body, num_body, sizeof(int), cfg_compare_ints);
+    loop->blocks = arena_alloc(cfg->arena, sizeof(int) * num_body);
+    loop->num_blocks = num_body;
+    for (int j = 0; j < num_body; j++) {
+      loop->blocks[j] = body[j];
+      blocks[body[j]].loop = id;
+      blocks[body[j]].loop_depth = loop->depth;
+    }
+  }
+}
+
+CFG* build_cfg(Module* m) {
+  Arena* arena = arena_new();
+  CFG* cfg = arena_alloc(arena, sizeof(CFG));
+  cfg->arena = arena;
+  cfg->module = m;
+  cfg->num_blocks = m->num_pcs + 1;
+  cfg->indirect = m->num_pcs;
+  cfg->max_plain_pc = -1;
+  cfg->blocks = arena_alloc(arena, sizeof(BasicBlock) * cfg->num_blocks);
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    bb->pc = pc;
+    bb->insts = &m->insts[m->pc_start[pc]];
+    bb->num_insts = m->pc_start[pc + 1] - m->pc_start[pc];
+  }
+  cfg->blocks[cfg->indirect].pc = -1;
+
+  cfg_build_edges(cfg);
+  cfg_compute_rpo(cfg);
+  cfg_compute_dominators(cfg);
+  cfg_find_loops(cfg);
+  return cfg;
+}
+
+void free_cfg(CFG* cfg) {
+  arena_free(cfg->arena);
+}
+
+static void cfg_dump_list(FILE* fp, const char* name, int* list, int n) {
+  fprintf(fp, " %s=", name);
+  if (!n)
+    fprintf(fp, "-");
+  for (int i = 0; i < n; i++)
+    fprintf(fp, i ? ",%d" : "%d", list[i]);
+}
+
+void dump_cfg(CFG* cfg, FILE* fp) {
+  for (int i = 0; i < cfg->num_blocks; i++) {
+    BasicBlock* bb = &cfg->blocks[i];
+    if (bb->pc < 0)
+      fprintf(fp, "indirect=%d", i);
+    else
+      fprintf(fp, "pc=%d insts=%d", bb->pc, bb->num_insts);
+    cfg_dump_list(fp, "succs", bb->succs, bb->num_succs);
+    cfg_dump_list(fp, "preds", bb->preds, bb->num_preds);
+    if (bb->rpo < 0)
+      fprintf(fp, " unreachable");
+    else
+      fprintf(fp, " idom=%d", bb->idom);
+    if (bb->loop >= 0)
+      fprintf(fp, " loop=%d depth=%d", bb->loop, bb->loop_depth);
+    if (bb->address_taken)
+      fprintf(fp, " address_taken");
+    fprintf(fp, "\n");
+  }
+  for (int i = 0; i < cfg->num_loops; i++) {
+    Loop* loop = &cfg->loops[i];
+    fprintf(fp, "loop=%d header=%d parent=%d depth=%d",
+            i, loop->header, loop->parent, loop->depth);
+    cfg_dump_list(fp, "blocks", loop->blocks, loop->num_blocks);
+    fprintf(fp, "\n");
+  }
+}
+#include <ir/opt.h>
+
+#include <stdlib.h>
+
+#define OPT_NUM_REGS 6
+#define OPT_ALL_REGS ((1 << OPT_NUM_REGS) - 1)
+#define OPT_MAX_MEM_FACTS 8
+
+// What the forward pass knows at the current instruction. A known
+// register holds either an immediate or the same value as another
+// register, and a memory fact says the word at |addr| equals |val|.
+typedef struct {
+  Value addr;
+  Value val;
+} MemFact;
+
+typedef struct {
+  bool known[OPT_NUM_REGS];
+  Value regs[OPT_NUM_REGS];
+  MemFact mem[OPT_MAX_MEM_FACTS];
+  int num_mem;
+} OptState;
+
+static bool opt_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static bool opt_is_cmp(Op op) {
+  return op >= EQ && op <= GE;
+}
+
+static bool opt_same_value(Value* a, Value* b) {
+  if (a->type != b->type)
+    return false;
+  if (a->type == REG)
+    return a->reg == b->reg;
+  return a->imm == b->imm && a->label == b->label;
+}
+
+static bool opt_is_plain_imm(Value* v) {
+  return v->type == IMM && v->label == NOT_LABEL;
+}
+
+static void opt_set_mov_imm(Inst* inst, int v) {
+  inst->op = MOV;
+  inst->src.type = IMM;
+  inst->src.label = NOT_LABEL;
+  inst->src.imm = MOD24(v);
+}
+
+// Forgets everything which depends on the old value of |r|.
+static void opt_kill_reg(OptState* s, Reg r) {
+  s->known[r] = false;
+  for (int i = 0; i < OPT_NUM_REGS; i++) {
+    if (s->known[i] && s->regs[i].type == REG && s->regs[i].reg == r)
+      s->known[i] = false;
+  }
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if ((f->addr.type == REG && f->addr.reg == r) ||
+        (f->val.type == REG && f->val.reg == r))
+      continue;
+    s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+}
+
+// Replaces a register operand by what it is known to hold.
+static void opt_rewrite_use(OptState* s, Value* v, bool allow_imm) {
+  if (v->type != REG || !s->known[v->reg])
+    return;
+  Value* k = &s->regs[v->reg];
+  if (k->type == REG || allow_imm)
+    *v = *k;
+}
+
+// The value a register will be known to hold after it is set to |v|.
+static void opt_canonical(OptState* s, Value* v, Value* out) {
+  if (v->type == REG && s->known[v->reg])
+    *out = s->regs[v->reg];
+  else
+    *out = *v;
+}
+
+static MemFact* opt_find_mem(OptState* s, Value* addr) {
+  for (int i = 0; i < s->num_mem; i++) {
+    if (opt_same_value(&s->mem[i].addr, addr))
+      return &s->mem[i];
+  }
+  return NULL;
+}
+
+static void opt_add_mem(OptState* s, Value* addr, Value* val) {
+  if (s->num_mem == OPT_MAX_MEM_FACTS) {
+    for (int i = 1; i < s->num_mem; i++)
+      s->mem[i - 1] = s->mem[i];
+    s->num_mem--;
+  }
+  s->mem[s->num_mem].addr = *addr;
+  s->mem[s->num_mem].val = *val;
+  s->num_mem++;
+}
+
+// Two immediates never alias unless they are equal. Anything else may.
+static void opt_store_mem(OptState* s, Value* addr, Value* val) {
+  int n = 0;
+  for (int i = 0; i < s->num_mem; i++) {
+    MemFact* f = &s->mem[i];
+    if (f->addr.type == IMM && addr->type == IMM && f->addr.imm != addr->imm)
+      s->mem[n++] = *f;
+  }
+  s->num_mem = n;
+  opt_add_mem(s, addr, val);
+}
+
+static bool opt_compare(Op op, int l, int r) {
+  switch (op) {
+    case JEQ: case EQ: return l == r;
+    case JNE: case NE: return l != r;
+    case JLT: case LT: return l < r;
+    case JGT: case GT: return l > r;
+    case JLE: case LE: return l <= r;
+    case JGE: case GE: return l >= r;
+    default:
+      return false;
+  }
+}
+
+// Whether "op dst, v" leaves dst unchanged.
+static bool opt_is_identity(Op op, Value* v) {
+  if (!opt_is_plain_imm(v))
+    return false;
+  switch (op) {
+    case ADD: case SUB: case OR: case XOR: case SHL: case SHR:
+      return v->imm == 0;
+    case MUL: case DIV:
+      return v->imm == 1;
+    default:
+      return false;
+  }
+}
+
+// Rewrites |inst| using and updating |s|. Returns false if the
+// instruction has no effect and can be dropped.
+static bool opt_forward(OptState* s, Inst* inst) {
+  Op op = inst->op;
+  switch (op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case PUTC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_rewrite_use(s, &inst->src, true);
+      break;
+    case STORE:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      break;
+    case COPY:
+    case FILL:
+      opt_rewrite_use(s, &inst->src, true);
+      opt_rewrite_use(s, &inst->dst, false);
+      opt_rewrite_use(s, &inst->jmp, true);
+      break;
+    default:
+      break;
+  }
+  if (opt_is_jump(op)) {
+    if (op != JMP)
+      opt_rewrite_use(s, &inst->dst, false);
+    opt_rewrite_use(s, &inst->jmp, true);
+  }
+
+  Value* dst = &inst->dst;
+  Value* src = &inst->src;
+  Value* known_dst =
+      dst->type == REG && s->known[dst->reg] ? &s->regs[dst->reg] : NULL;
+  bool folds = (known_dst && opt_is_plain_imm(known_dst) &&
+                opt_is_plain_imm(src));
+
+  if (opt_is_identity(op, src))
+    return false;
+
+  switch (op) {
+    case ADD:
+    case SUB:
+      if (folds) {
+        int v = (op == ADD ? known_dst->imm + src->imm :
+                 known_dst->imm - src->imm);
+        opt_set_mov_imm(inst, v);
+      }
+      break;
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      if (folds)
+        opt_set_mov_imm(inst, opt_compare(op, known_dst->imm, src->imm));
+      break;
+
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      if (folds)
+        opt_set_mov_imm(inst, eval_ext_op(op, known_dst->imm, src->imm));
+      break;
+
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+      if (folds) {
+        if (!opt_compare(op, known_dst->imm, src->imm))
+          return false;
+        inst->op = JMP;
+        inst->dst.type = REG;
+        inst->dst.reg = A;
+        inst->src = inst->dst;
+      }
+      break;
+
+    case LOAD: {
+      MemFact* f = opt_find_mem(s, src);
+      if (f && f->val.type == REG && f->val.reg == dst->reg)
+        return false;
+      if (f) {
+        inst->op = MOV;
+        *src = f->val;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  switch (inst->op) {
+    case MOV: {
+      if (src->type == REG && src->reg == dst->reg)
+        return false;
+      if (known_dst && opt_same_value(known_dst, src))
+        return false;
+      Value v;
+      opt_canonical(s, src, &v);
+      opt_kill_reg(s, dst->reg);
+      s->known[dst->reg] = true;
+      s->regs[dst->reg] = v;
+      break;
+    }
+
+    case ADD:
+    case SUB:
+    case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      opt_kill_reg(s, dst->reg);
+      break;
+
+    case LOAD: {
+      Value addr = *src;
+      opt_kill_reg(s, dst->reg);
+      if (!(addr.type == REG && addr.reg == dst->reg))
+        opt_add_mem(s, &addr, dst);
+      break;
+    }
+
+    case STORE: {
+      Value v;
+      opt_canonical(s, dst, &v);
+      opt_store_mem(s, src, &v);
+      break;
+    }
+
+    case COPY:
+    case FILL:
+      s->num_mem = 0;
+      break;
+
+    default:
+      break;
+  }
+  return true;
+}
+
+static int opt_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+// Registers |inst| reads.
+static int opt_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return opt_reg_bit(&inst->src);
+    case ADD:
+    case SUB:
+    case STORE:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case JEQ: case JNE: case JLT: case JGT: case JLE: case JGE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              (opt_is_jump(inst->op) ? opt_reg_bit(&inst->jmp) : 0));
+    case JMP:
+      return opt_reg_bit(&inst->jmp);
+    case COPY:
+    case FILL:
+      return (opt_reg_bit(&inst->dst) | opt_reg_bit(&inst->src) |
+              opt_reg_bit(&inst->jmp));
+    default:
+      return 0;
+  }
+}
+
+// Whether |inst| only writes its dst register.
+static bool opt_is_pure_def(Inst* inst) {
+  return (inst->op == MOV || inst->op == ADD || inst->op == SUB ||
+          inst->op == LOAD || opt_is_cmp(inst->op) || is_ext_op(inst->op));
+}
+
+// Returns the number of instructions of a block that were dropped.
+static int opt_block(Inst* insts, int n, bool* dead) {
+  OptState s = {};
+  int removed = 0;
+  for (int i = 0; i < n; i++) {
+    Inst* inst = &insts[i];
+    if (!opt_forward(&s, inst)) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (inst->op == EXIT || inst->op == JMP) {
+      // The rest of the block never runs.
+      for (i++; i < n; i++) {
+        dead[i] = true;
+        removed++;
+      }
+    }
+  }
+
+  // Every register may be read by later blocks.
+  int live = OPT_ALL_REGS;
+  for (int i = n - 1; i >= 0; i--) {
+    Inst* inst = &insts[i];
+    if (dead[i])
+      continue;
+    if (inst->op == EXIT) {
+      live = 0;
+      continue;
+    }
+    if (opt_is_jump(inst->op))
+      live = OPT_ALL_REGS;
+    if (opt_is_pure_def(inst) && !(live & (1 << inst->dst.reg))) {
+      dead[i] = true;
+      removed++;
+      continue;
+    }
+    if (opt_is_pure_def(inst) || inst->op == GETC)
+      live &= ~(1 << inst->dst.reg);
+    live |= opt_uses(inst);
+  }
+
+  // Keep one instruction so the pc stays a valid jump target.
+  if (n && removed == n) {
+    dead[n - 1] = false;
+    removed--;
+  }
+  return removed;
+}
+
+void optimize_module(Module* m) {
+  bool* dead = calloc(m->num_insts + 1, sizeof(bool));
+  int removed = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    int start = m->pc_start[pc];
+    int n = m->pc_start[pc + 1] - start;
+    removed += opt_block(&m->insts[start], n, &dead[start]);
+  }
+
+  if (removed) {
+    Inst root;
+    Inst* prev = &root;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (dead[i])
+        continue;
+      prev->next = &m->insts[i];
+      prev = prev->next;
+    }
+    prev->next = NULL;
+    m->text = root.next;
+    reindex_module(m);
+  }
+  free(dead);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef __eir__
+#include <time.h>
+#endif
+
+#include <ir/opt.h>
+#include <ir/range.h>
+
+static const Pass g_passes[] = {
+  { "opt", optimize_module,
+    "block-local constant/copy propagation and dead write removal" },
+  { "dce", remove_dead_code_and_data,
+    "remove unreachable pcs and unreferenced data" },
+  { "merge", merge_basic_blocks,
+    "thread jumps to jumps and merge fallthrough-only pcs" },
+  { "lower_ext", lower_ext_ops,
+    "replace mul/div/mod/and/or/xor/shl/shr with calls to helpers" },
+  { "lower_block", lower_block_ops,
+    "replace copy/fill with calls to loop helpers" },
+  { "layout", layout_by_profile,
+    "reorder pcs by profile counts so hot loops stay in one chunk" },
+  { "ranges", analyze_ranges,
+    "mark add/sub which never wrap around so backends skip the mask" },
+  { "split_mem", split_basic_block_by_mem,
+    "start a new pc after every load and store" },
+  { NULL, NULL, NULL }
+};
+
+#define MAX_PIPELINE 64
+
+static const Pass* g_pipeline[MAX_PIPELINE];
+static int g_num_pipeline;
+
+const Pass* find_pass(const char* name) {
+  for (const Pass* pass = g_passes; pass->name; pass++) {
+    if (!strcmp(pass->name, name))
+      return pass;
+  }
+  return NULL;
+}
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+static void pass_error(const char* msg, const char* name) {
+  fprintf(stderr, "%s: %s\navailable passes:\n", msg, name);
+  for (const Pass* pass = g_passes; pass->name; pass++)
+    fprintf(stderr, "  %s: %s\n", pass->name, pass->help);
+  exit(1);
+}
+
+void add_pass(const char* name) {
+  const Pass* pass = find_pass(name);
+  if (!pass)
+    pass_error("unknown pass", name);
+  if (g_num_pipeline == MAX_PIPELINE)
+    pass_error("too many passes", name);
+  g_pipeline[g_num_pipeline++] = pass;
+}
+
+void add_passes(const char* names) {
+  char buf[64];
+  while (*names) {
+    const char* end = strchr(names, ',');
+    int len = end ? end - names : (int)strlen(names);
+    if (len >= (int)sizeof(buf))
+      pass_error("unknown pass", names);
+    if (len) {
+      memcpy(buf, names, len);
+      buf[len] = 0;
+      add_pass(buf);
+    }
+    names += len;
+    if (*names)
+      names++;
+  }
+}
+
+static int pass_count_data(Module* m) {
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    n++;
+  return n;
+}
+
+static void pass_print_count(const char* name, int before, int after) {
+  fprintf(stderr, " %s %d -> %d (%s%d)", name, before, after,
+          after >= before ? "+" : "", after - before);
+}
+
+#ifndef __eir__
+static double pass_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+#endif
+
+void run_passes(Module* m, bool show_stats) {
+  for (int i = 0; i < g_num_pipeline; i++) {
+    const Pass* pass = g_pipeline[i];
+    if (!show_stats) {
+      pass->run(m);
+      continue;
+    }
+
+    int insts = m->num_insts;
+    int pcs = m->num_pcs;
+    int data = pass_count_data(m);
+#ifndef __eir__
+    double start = pass_now_ms();
+#endif
+    pass->run(m);
+    fprintf(stderr, "pass %s:", pass->name);
+#ifndef __eir__
+    fprintf(stderr, " %.3f ms", pass_now_ms() - start);
+#endif
+    pass_print_count("insts", insts, m->num_insts);
+    pass_print_count("pcs", pcs, m->num_pcs);
+    pass_print_count("data", data, pass_count_data(m));
+    fprintf(stderr, "\n");
+  }
+}
+
+static void pass_relocate_value(Value* v, const int* pc_map, int num_pcs) {
+  if (v->type == IMM && v->label == TEXT_LABEL &&
+      v->imm >= 0 && v->imm <= num_pcs)
+    v->imm = pc_map[v->imm];
+}
+
+void relocate_text_labels(Module* m, const int* pc_map) {
+  int num_pcs = m->num_pcs;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    pass_relocate_value(&inst->dst, pc_map, num_pcs);
+    pass_relocate_value(&inst->src, pc_map, num_pcs);
+    // A jump target is a pc even if it was written as a number.
+    if (inst->op >= JEQ && inst->op <= JMP) {
+      Value* v = &inst->jmp;
+      if (v->type == IMM && v->imm >= 0 && v->imm <= num_pcs)
+        v->imm = pc_map[v->imm];
+    } else {
+      pass_relocate_value(&inst->jmp, pc_map, num_pcs);
+    }
+  }
+  for (Data* data = m->data; data; data = data->next) {
+    if (data->label == TEXT_LABEL && data->v >= 0 && data->v <= num_pcs)
+      data->v = pc_map[data->v];
+  }
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (sym->is_text && sym->value >= 0 && sym->value <= num_pcs)
+      sym->value = pc_map[sym->value];
+  }
+}
+
+void split_basic_block_by_mem(Module* m) {
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  int pc = 0;
+  for (Inst* inst = m->text; inst; inst = inst->next) {
+    for (; pc <= inst->pc; pc++)
+      pc_map[pc] = pc + shift;
+    int old_pc = inst->pc;
+    inst->pc += shift;
+    if ((inst->op == LOAD || inst->op == STORE) &&
+        inst->next && inst->next->pc == old_pc)
+      shift++;
+  }
+  for (; pc <= m->num_pcs; pc++)
+    pc_map[pc] = pc + shift;
+
+  if (shift) {
+    relocate_text_labels(m, pc_map);
+    reindex_module(m);
+  }
+  free(pc_map);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/arena.h>
+
+// lower_ext and lower_block replace each MUL .. SHR and COPY .. FILL
+// with a call to a helper routine made of basic ops. The call site
+// saves A-D, loads the operands into A, B and (for block ops) C, and
+// pushes its return pc:
+//
+//     sub SP, 1; store A, SP       ; ... and B, C, D
+//     <C = len>; <B = src>; <A = dst>
+//     mov D, ret; sub SP, 1; store D, SP; jmp helper
+//   ret:                           ; a new pc
+//     <the saved dst = A>          ; ext ops only
+//     load A, SP; mov D, A; add SP, 1   ; ... and C, B, A
+//
+// Helpers may clobber A-D, leave the result in A, and return by popping
+// the return pc. Each used helper is emitted once after the last pc.
+// Only "load A, X" is used since some backends support nothing else.
+
+#define LOWER_BIT23 0x800000
+#define LOWER_NUM_SAVED 4
+
+// An instruction of a helper routine. |jmp| is a local label for jumps,
+// or LOWER_JMP_D for "jmp D". LOWER_LABEL entries define label |jmp|.
+typedef struct {
+  int op;
+  Reg dst;
+  int src;
+  bool src_is_imm;
+  int jmp;
+} LowerInst;
+
+enum {
+  LOWER_LABEL = -1,
+  LOWER_END = -2,
+  LOWER_JMP_D = -1,
+  LOWER_MAX_LABELS = 16
+};
+
+#define LL(l) { LOWER_LABEL, A, 0, false, l }
+#define RR(op, d, s) { op, d, s, false, 0 }
+#define RI(op, d, i) { op, d, i, true, 0 }
+#define JI(op, l, d, i) { op, d, i, true, l }
+#define JR(op, l, d, s) { op, d, s, false, l }
+#define JL(l) { JMP, A, 0, false, l }
+#define RET                                     \
+  RR(MOV, C, A), RR(LOAD, A, SP), RI(ADD, SP, 1), \
+  RR(MOV, D, A), RR(MOV, A, C),                   \
+  { JMP, D, 0, false, LOWER_JMP_D }
+#define END { LOWER_END, A, 0, false, 0 }
+
+// Shift-and-add over the bits of B from the top, after skipping its
+// leading zeros.
+static const LowerInst lower_mul[] = {
+  RI(MOV, C, 0),
+  RI(MOV, D, 24),
+  JI(JEQ, 3, B, 0),
+  LL(0),
+  JI(JGE, 1, B, LOWER_BIT23),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, C, C),
+  JI(JLT, 2, B, LOWER_BIT23),
+  RR(ADD, C, A),
+  LL(2),
+  RR(ADD, B, B),
+  RI(SUB, D, 1),
+  JI(JNE, 1, D, 0),
+  LL(3),
+  RR(MOV, A, C),
+  RET,
+  END
+};
+
+// Restoring division. C is the quotient and D the remainder. C starts as
+// 1 and this bit reaches bit 23 at the 24th and last step. When D has
+// bit 23 set, doubling it overflows but the subtraction is then always
+// needed and wraps back to the right value.
+#define LOWER_DIV_BODY                          \
+  JI(JEQ, 10, B, 0),                            \
+  RI(MOV, C, 1),                                \
+  RI(MOV, D, 0),                                \
+  LL(0),                                        \
+  JI(JGE, 5, C, LOWER_BIT23),                   \
+  JI(JGE, 3, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 1, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JR(JLT, 0, D, B),                             \
+  LL(2),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(0),                                        \
+  LL(3),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 4, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(4),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, C, C),                                \
+  JL(2),                                        \
+  LL(5),                                        \
+  JI(JGE, 8, D, LOWER_BIT23),                   \
+  RR(ADD, D, D),                                \
+  JI(JLT, 6, A, LOWER_BIT23),                   \
+  RI(ADD, D, 1),                                \
+  LL(6),                                        \
+  RR(ADD, C, C),                                \
+  JR(JLT, 9, D, B),                             \
+  LL(7),                                        \
+  RR(SUB, D, B),                                \
+  RI(ADD, C, 1),                                \
+  JL(9),                                        \
+  LL(8),                                        \
+  RR(ADD, D, D),                                \
+  JI(JLT, 11, A, LOWER_BIT23),                  \
+  RI(ADD, D, 1),                                \
+  LL(11),                                       \
+  RR(ADD, C, C),                                \
+  JL(7),                                        \
+  LL(9)
+
+static const LowerInst lower_div[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, C),
+  RET,
+  LL(10),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+static const LowerInst lower_mod[] = {
+  LOWER_DIV_BODY,
+  RR(MOV, A, D),
+  RET,
+  // The remainder of a division by zero is the dividend, already in A.
+  LL(10),
+  RET,
+  END
+};
+
+// Bitwise ops build C from the top bits of A and B, doubling all three
+// 24 times.
+#define LOWER_BITWISE_HEAD                      \
+  RI(MOV, C, 0),                                \
+  RI(MOV, D, 24),                               \
+  LL(0),                                        \
+  RR(ADD, C, C)
+
+#define LOWER_BITWISE_TAIL                      \
+  LL(1),                                        \
+  RR(ADD, A, A),                                \
+  RR(ADD, B, B),                                \
+  RI(SUB, D, 1),                                \
+  JI(JNE, 0, D, 0),                             \
+  RR(MOV, A, C),                                \
+  RET,                                          \
+  END
+
+static const LowerInst lower_and[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JLT, 1, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_or[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 2, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_xor[] = {
+  LOWER_BITWISE_HEAD,
+  JI(JGE, 3, A, LOWER_BIT23),
+  JI(JLT, 1, B, LOWER_BIT23),
+  JL(2),
+  LL(3),
+  JI(JGE, 1, B, LOWER_BIT23),
+  LL(2),
+  RI(ADD, C, 1),
+  LOWER_BITWISE_TAIL
+};
+
+static const LowerInst lower_shl[] = {
+  JI(JGE, 2, B, 24),
+  LL(0),
+  JI(JEQ, 1, B, 0),
+  RR(ADD, A, A),
+  RI(SUB, B, 1),
+  JL(0),
+  LL(2),
+  RI(MOV, A, 0),
+  LL(1),
+  RET,
+  END
+};
+
+// Takes the top 24 - B bits of A.
+static const LowerInst lower_shr[] = {
+  JI(JGE, 3, B, 24),
+  RI(MOV, C, 24),
+  RR(SUB, C, B),
+  RI(MOV, D, 0),
+  LL(0),
+  JI(JEQ, 2, C, 0),
+  RR(ADD, D, D),
+  JI(JLT, 1, A, LOWER_BIT23),
+  RI(ADD, D, 1),
+  LL(1),
+  RR(ADD, A, A),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(2),
+  RR(MOV, A, D),
+  RET,
+  LL(3),
+  RI(MOV, A, 0),
+  RET,
+  END
+};
+
+// memmove of C words from B to A. Copies backwards if A is above B.
+static const LowerInst lower_copy[] = {
+  RR(MOV, D, A),
+  JR(JGT, 1, D, B),
+  LL(0),
+  JI(JEQ, 3, C, 0),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(ADD, B, 1),
+  RI(ADD, D, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RR(ADD, B, C),
+  RR(ADD, D, C),
+  LL(2),
+  JI(JEQ, 3, C, 0),
+  RI(SUB, B, 1),
+  RI(SUB, D, 1),
+  RR(LOAD, A, B),
+  RR(STORE, A, D),
+  RI(SUB, C, 1),
+  JL(2),
+  LL(3),
+  RET,
+  END
+};
+
+static const LowerInst lower_fill[] = {
+  LL(0),
+  JI(JEQ, 1, C, 0),
+  RR(STORE, B, A),
+  RI(ADD, A, 1),
+  RI(SUB, C, 1),
+  JL(0),
+  LL(1),
+  RET,
+  END
+};
+
+static const LowerInst* lower_helper_code(Op op) {
+  switch (op) {
+    case MUL: return lower_mul;
+    case DIV: return lower_div;
+    case MOD: return lower_mod;
+    case AND: return lower_and;
+    case OR: return lower_or;
+    case XOR: return lower_xor;
+    case SHL: return lower_shl;
+    case SHR: return lower_shr;
+    case COPY: return lower_copy;
+    case FILL: return lower_fill;
+    default: return NULL;
+  }
+}
+
+// Appends instructions to |tail| and numbers pcs the way the parser
+// does: a jump ends its pc and a label after instructions starts one.
+typedef struct {
+  Arena* arena;
+  Inst* tail;
+  int pc;
+  bool at_boundary;
+  // Debug info and profile counts for the emitted instructions.
+  int lineno;
+  int loc;
+  long count;
+} LowerEmitter;
+
+static Inst* lower_emit(LowerEmitter* e, int op) {
+  Inst* inst = arena_alloc(e->arena, sizeof(Inst));
+  inst->op = (Op)op;
+  inst->pc = e->pc;
+  inst->lineno = e->lineno;
+  inst->loc = e->loc;
+  inst->count = e->count;
+  e->tail->next = inst;
+  e->tail = inst;
+  e->at_boundary = false;
+  if (op >= JEQ && op <= JMP) {
+    e->pc++;
+    e->at_boundary = true;
+  }
+  return inst;
+}
+
+static void lower_set_reg(Value* v, Reg r) {
+  v->type = REG;
+  v->reg = r;
+}
+
+static void lower_set_imm(Value* v, int imm, LabelType label) {
+  v->type = IMM;
+  v->imm = imm;
+  v->label = label;
+}
+
+static void lower_emit_rr(LowerEmitter* e, Op op, Reg dst, Reg src) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_reg(&inst->src, src);
+}
+
+static void lower_emit_ri(LowerEmitter* e, Op op, Reg dst, int imm) {
+  Inst* inst = lower_emit(e, op);
+  lower_set_reg(&inst->dst, dst);
+  lower_set_imm(&inst->src, imm, NOT_LABEL);
+}
+
+static void lower_emit_push(LowerEmitter* e, Reg r) {
+  lower_emit_ri(e, SUB, SP, 1);
+  lower_emit_rr(e, STORE, r, SP);
+}
+
+static void lower_emit_pop(LowerEmitter* e, Reg r) {
+  lower_emit_rr(e, LOAD, A, SP);
+  if (r != A)
+    lower_emit_rr(e, MOV, r, A);
+  lower_emit_ri(e, ADD, SP, 1);
+}
+
+// Assigns pcs to the labels of |code| placed at |pc| and returns the
+// first pc after it.
+static int lower_layout_helper(const LowerInst* code, int pc, int* labels) {
+  bool at_boundary = true;
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!at_boundary)
+        pc++;
+      at_boundary = true;
+      labels[li->jmp] = pc;
+    } else if (li->op >= JEQ && li->op <= JMP) {
+      pc++;
+      at_boundary = true;
+    } else {
+      at_boundary = false;
+    }
+  }
+  return at_boundary ? pc : pc + 1;
+}
+
+// Emits |code| starting at a new pc.
+static void lower_emit_helper(LowerEmitter* e, const LowerInst* code) {
+  int labels[LOWER_MAX_LABELS];
+  lower_layout_helper(code, e->pc, labels);
+  for (const LowerInst* li = code; li->op != LOWER_END; li++) {
+    if (li->op == LOWER_LABEL) {
+      if (!e->at_boundary)
+        e->pc++;
+      e->at_boundary = true;
+      continue;
+    }
+    Inst* inst = lower_emit(e, li->op);
+    if (li->op == JMP && li->jmp == LOWER_JMP_D) {
+      lower_set_reg(&inst->jmp, D);
+      continue;
+    }
+    if (li->op != JMP) {
+      lower_set_reg(&inst->dst, li->dst);
+      if (li->src_is_imm)
+        lower_set_imm(&inst->src, li->src, NOT_LABEL);
+      else
+        lower_set_reg(&inst->src, (Reg)li->src);
+    }
+    if (li->op >= JEQ && li->op <= JMP)
+      lower_set_imm(&inst->jmp, labels[li->jmp], TEXT_LABEL);
+  }
+}
+
+// Stack slot of a saved register once the frame is complete.
+static int lower_slot(Reg r) {
+  return LOWER_NUM_SAVED - 1 - r;
+}
+
+// Makes |addr| point to the stack slot of |r|.
+static void lower_emit_slot_addr(LowerEmitter* e, Reg addr, Reg r) {
+  lower_emit_rr(e, MOV, addr, SP);
+  lower_emit_ri(e, ADD, addr, lower_slot(r));
+}
+
+// Loads the value |v| had before the call site into |r|, which is A, B
+// or C. They are loaded in the order C, B, A since A is used to load
+// from memory. D is used as a scratch register.
+static void lower_emit_operand(LowerEmitter* e, Reg r, Value* v) {
+  if (v->type == IMM) {
+    Inst* inst = lower_emit(e, MOV);
+    lower_set_reg(&inst->dst, r);
+    inst->src = *v;
+  } else if (v->reg == BP) {
+    lower_emit_rr(e, MOV, r, BP);
+  } else if (v->reg == SP) {
+    lower_emit_rr(e, MOV, r, SP);
+    lower_emit_ri(e, ADD, r, LOWER_NUM_SAVED);
+  } else {
+    lower_emit_slot_addr(e, D, v->reg);
+    lower_emit_rr(e, LOAD, A, D);
+    if (r != A)
+      lower_emit_rr(e, MOV, r, A);
+  }
+}
+
+// Copies the saved registers from the frame at SP to the one at B.
+static void lower_emit_copy_frame(LowerEmitter* e, bool descending) {
+  for (int i = 0; i < LOWER_NUM_SAVED; i++) {
+    Reg r = (Reg)(descending ? i : D - i);
+    lower_emit_slot_addr(e, C, r);
+    lower_emit_rr(e, LOAD, A, C);
+    lower_emit_rr(e, MOV, C, B);
+    lower_emit_ri(e, ADD, C, lower_slot(r));
+    lower_emit_rr(e, STORE, A, C);
+  }
+}
+
+// Moves the saved registers to just below the new SP in A, so popping
+// them leaves SP at the result. The frames may overlap, so the copy
+// runs in the direction of the move:
+//
+//     mov B, A; sub B, 4; jgt down, B, SP
+//     <copy upwards>; jmp done
+//   down:
+//     <copy downwards>
+//   done:
+//     mov SP, B
+static void lower_emit_move_frame(LowerEmitter* e) {
+  lower_emit_rr(e, MOV, B, A);
+  lower_emit_ri(e, SUB, B, LOWER_NUM_SAVED);
+  Inst* down = lower_emit(e, JGT);
+  lower_set_reg(&down->dst, B);
+  lower_set_reg(&down->src, SP);
+  lower_set_imm(&down->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, false);
+  Inst* done = lower_emit(e, JMP);
+  lower_set_imm(&done->jmp, e->pc + 1, TEXT_LABEL);
+  lower_emit_copy_frame(e, true);
+  e->pc++;
+  lower_emit_rr(e, MOV, SP, B);
+}
+
+// The number of pcs a call site adds to the pc of |inst|.
+static int lower_call_pcs(Inst* inst) {
+  return is_ext_op(inst->op) && inst->dst.reg == SP ? 4 : 1;
+}
+
+static void lower_emit_call(LowerEmitter* e, Inst* inst, int helper_pc) {
+  for (int r = A; r <= D; r++)
+    lower_emit_push(e, (Reg)r);
+  if (!is_ext_op(inst->op))
+    lower_emit_operand(e, C, &inst->jmp);
+  lower_emit_operand(e, B, &inst->src);
+  lower_emit_operand(e, A, &inst->dst);
+
+  Inst* ret = lower_emit(e, MOV);
+  lower_set_reg(&ret->dst, D);
+  lower_set_imm(&ret->src, e->pc + 1, TEXT_LABEL);
+  lower_emit_push(e, D);
+  Inst* jmp = lower_emit(e, JMP);
+  lower_set_imm(&jmp->jmp, helper_pc, TEXT_LABEL);
+
+  Reg dst = inst->dst.reg;
+  if (!is_ext_op(inst->op)) {
+    // Block ops have no result.
+  } else if (dst == BP) {
+    lower_emit_rr(e, MOV, BP, A);
+  } else if (dst == SP) {
+    lower_emit_move_frame(e);
+  } else {
+    lower_emit_slot_addr(e, C, dst);
+    lower_emit_rr(e, STORE, A, C);
+  }
+  for (int r = D; r >= A; r--)
+    lower_emit_pop(e, (Reg)r);
+}
+
+// Replaces the ops from |first| to |last| by calls.
+static void lower_ops(Module* m, Op first, Op last) {
+  int num_calls = 0;
+  bool used[LAST_OP] = {};
+  long helper_count[LAST_OP] = {};
+  for (int i = 0; i < m->num_insts; i++) {
+    Op op = m->insts[i].op;
+    if (op >= first && op <= last) {
+      num_calls++;
+      used[op] = true;
+      helper_count[op] += m->insts[i].count;
+    }
+  }
+  if (!num_calls)
+    return;
+
+  // Every call site splits its pc.
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int shift = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = pc + shift;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      Op op = m->insts[i].op;
+      if (op >= first && op <= last)
+        shift += lower_call_pcs(&m->insts[i]);
+    }
+  }
+  pc_map[m->num_pcs] = m->num_pcs + shift;
+  relocate_text_labels(m, pc_map);
+
+  // Helpers go after the last pc, in Op order.
+  int helper_pc[LAST_OP];
+  int labels[LOWER_MAX_LABELS];
+  int pc = pc_map[m->num_pcs];
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    helper_pc[op] = pc;
+    pc = lower_layout_helper(lower_helper_code((Op)op), pc, labels);
+  }
+
+  Inst root = {};
+  LowerEmitter e = {};
+  e.arena = m->arena;
+  e.tail = &root;
+  for (int old_pc = 0; old_pc < m->num_pcs; old_pc++) {
+    e.pc = pc_map[old_pc];
+    for (int i = m->pc_start[old_pc]; i < m->pc_start[old_pc + 1]; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op >= first && inst->op <= last) {
+        e.lineno = inst->lineno;
+        e.loc = inst->loc;
+        e.count = inst->count;
+        lower_emit_call(&e, inst, helper_pc[inst->op]);
+        continue;
+      }
+      inst->pc = e.pc;
+      e.tail->next = inst;
+      e.tail = inst;
+    }
+  }
+
+  e.pc = pc_map[m->num_pcs];
+  e.at_boundary = true;
+  e.lineno = -1;
+  e.loc = 0;
+  for (int op = first; op <= last; op++) {
+    if (!used[op])
+      continue;
+    // A helper runs as often as all its call sites together.
+    e.count = helper_count[op];
+    lower_emit_helper(&e, lower_helper_code((Op)op));
+  }
+  e.tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+  free(pc_map);
+}
+
+void lower_ext_ops(Module* m) {
+  lower_ops(m, MUL, SHR);
+}
+
+void lower_block_ops(Module* m) {
+  lower_ops(m, COPY, FILL);
+}
+#include <ir/range.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+#define RANGE_NUM_REGS 6
+#define RANGE_MAX 16777215
+// A bound of an entry state which keeps moving after this many changes
+// is widened to the end of the word, so loops reach a fixpoint quickly.
+#define RANGE_WIDEN_AFTER 2
+// Rounds of recomputing every entry state from the widened ones, which
+// brings back bounds given by loop conditions.
+#define RANGE_NARROW_ROUNDS 2
+
+// An inclusive interval of unsigned 24-bit values. Bounds are compared
+// before any addition or subtraction so nothing leaves [0, RANGE_MAX],
+// which keeps this correct when ints are 24-bit too.
+typedef struct {
+  int lo;
+  int hi;
+} Range;
+
+typedef struct {
+  bool reached;
+  int changes;
+  Range regs[RANGE_NUM_REGS];
+} RangeState;
+
+static void range_set(Range* r, int lo, int hi) {
+  r->lo = lo;
+  r->hi = hi;
+}
+
+static void range_of_value(RangeState* s, Value* v, Range* out) {
+  if (v->type == REG)
+    *out = s->regs[v->reg];
+  else
+    range_set(out, v->imm, v->imm);
+}
+
+static int range_min(int a, int b) {
+  return a < b ? a : b;
+}
+
+static int range_max(int a, int b) {
+  return a > b ? a : b;
+}
+
+// Updates |s| for a non-jump |inst|. Records whether an ADD or SUB can
+// wrap around if |mark| is set.
+static void range_transfer(RangeState* s, Inst* inst, bool mark) {
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  switch (inst->op) {
+    case MOV:
+      range_of_value(s, &inst->src, d);
+      break;
+
+    case ADD:
+    case SUB: {
+      range_of_value(s, &inst->src, &b);
+      bool no_wrap = (inst->op == ADD ?
+                      d->hi <= RANGE_MAX - b.hi : d->lo >= b.hi);
+      if (mark)
+        inst->no_wrap = no_wrap;
+      if (!no_wrap)
+        range_set(d, 0, RANGE_MAX);
+      else if (inst->op == ADD)
+        range_set(d, d->lo + b.lo, d->hi + b.hi);
+      else
+        range_set(d, d->lo - b.hi, d->hi - b.lo);
+      break;
+    }
+
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+      range_set(d, 0, 1);
+      break;
+
+    case AND:
+      range_of_value(s, &inst->src, &b);
+      range_set(d, 0, range_min(d->hi, b.hi));
+      break;
+
+    case DIV:
+    case MOD:
+    case SHR:
+      range_set(d, 0, d->hi);
+      break;
+
+    case LOAD:
+    case GETC:
+    case MUL:
+    case OR:
+    case XOR:
+    case SHL:
+      range_set(d, 0, RANGE_MAX);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static Op range_negate(Op op) {
+  switch (op) {
+    case JEQ: return JNE;
+    case JNE: return JEQ;
+    case JLT: return JGE;
+    case JGT: return JLE;
+    case JLE: return JGT;
+    case JGE: return JLT;
+    default: return op;
+  }
+}
+
+// Narrows the dst of a conditional jump in |s| to the values for which
+// it is taken, or not taken if |taken| is false. Returns false if that
+// never happens.
+static bool range_refine(RangeState* s, Inst* inst, bool taken) {
+  if (inst->op == JMP)
+    return taken;
+  Range* d = &s->regs[inst->dst.reg];
+  Range b;
+  range_of_value(s, &inst->src, &b);
+  int lo = d->lo;
+  int hi = d->hi;
+  switch (taken ? inst->op : range_negate(inst->op)) {
+    case JEQ:
+      lo = range_max(lo, b.lo);
+      hi = range_min(hi, b.hi);
+      break;
+    case JNE:
+      if (b.lo != b.hi)
+        break;
+      if (lo == hi && lo == b.lo)
+        return false;
+      if (lo == b.lo)
+        lo++;
+      if (hi == b.lo)
+        hi--;
+      break;
+    case JLT:
+      if (b.hi == 0)
+        return false;
+      hi = range_min(hi, b.hi - 1);
+      break;
+    case JGT:
+      if (b.lo == RANGE_MAX)
+        return false;
+      lo = range_max(lo, b.lo + 1);
+      break;
+    case JLE:
+      hi = range_min(hi, b.hi);
+      break;
+    case JGE:
+      lo = range_max(lo, b.lo);
+      break;
+    default:
+      break;
+  }
+  if (lo > hi)
+    return false;
+  range_set(d, lo, hi);
+  return true;
+}
+
+// Widens |to| to include |from|. Returns whether |to| changed.
+static bool range_join(RangeState* to, RangeState* from, bool widen) {
+  if (!to->reached) {
+    *to = *from;
+    to->reached = true;
+    to->changes = 1;
+    return true;
+  }
+  widen &= to->changes >= RANGE_WIDEN_AFTER;
+  bool changed = false;
+  for (int i = 0; i < RANGE_NUM_REGS; i++) {
+    Range* t = &to->regs[i];
+    Range* f = &from->regs[i];
+    if (f->lo < t->lo) {
+      t->lo = widen ? 0 : f->lo;
+      changed = true;
+    }
+    if (f->hi > t->hi) {
+      t->hi = widen ? RANGE_MAX : f->hi;
+      changed = true;
+    }
+  }
+  if (changed)
+    to->changes++;
+  return changed;
+}
+
+// Runs the block at |pc| from its entry state in |in| and joins its exit
+// states into the entry states of its successors in |out|. Returns
+// whether any of them changed.
+static bool range_block(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, int pc, bool widen) {
+  BasicBlock* bb = &cfg->blocks[pc];
+  int num_pcs = cfg->module->num_pcs;
+  RangeState s = in[pc];
+  bool changed = false;
+  for (int i = 0; i < bb->num_insts; i++) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT)
+      return changed;
+    if (inst->op < JEQ || inst->op > JMP) {
+      range_transfer(&s, inst, false);
+      continue;
+    }
+
+    RangeState t = s;
+    if (range_refine(&t, inst, true)) {
+      if (inst->jmp.type == REG) {
+        changed |= range_join(indirect, &t, widen);
+      } else if (inst->jmp.imm >= 0 && inst->jmp.imm < num_pcs) {
+        changed |= range_join(&out[inst->jmp.imm], &t, widen);
+      }
+    }
+    if (!range_refine(&s, inst, false))
+      return changed;
+  }
+  if (pc + 1 < num_pcs)
+    changed |= range_join(&out[pc + 1], &s, widen);
+  return changed;
+}
+
+// Runs every reached block once, joining into |out|, and joins the
+// states of register jumps into the address-taken blocks. Returns
+// whether |out| changed.
+static bool range_sweep(CFG* cfg, RangeState* in, RangeState* out,
+                        RangeState* indirect, bool widen) {
+  bool changed = false;
+  for (int i = 0; i < cfg->num_rpo; i++) {
+    int pc = cfg->rpo[i];
+    if (pc != cfg->indirect && in[pc].reached)
+      changed |= range_block(cfg, in, out, indirect, pc, widen);
+  }
+  if (indirect->reached) {
+    for (int pc = 0; pc < cfg->module->num_pcs; pc++) {
+      if (cfg->blocks[pc].address_taken)
+        changed |= range_join(&out[pc], indirect, widen);
+    }
+  }
+  return changed;
+}
+
+static RangeState* range_new_states(int num_pcs) {
+  RangeState* states = calloc(num_pcs, sizeof(RangeState));
+  // Registers start at zero.
+  states[0].reached = true;
+  return states;
+}
+
+void analyze_ranges(Module* m) {
+  for (int i = 0; i < m->num_insts; i++)
+    m->insts[i].no_wrap = false;
+  if (!m->num_pcs)
+    return;
+
+  CFG* cfg = build_cfg(m);
+  RangeState* in = range_new_states(m->num_pcs);
+  RangeState indirect = {};
+  while (range_sweep(cfg, in, in, &indirect, true)) {}
+
+  // A sweep from a fixpoint gives a tighter one, so it is fine to stop
+  // after any round.
+  for (int round = 0; round < RANGE_NARROW_ROUNDS; round++) {
+    RangeState* next = range_new_states(m->num_pcs);
+    RangeState next_indirect = {};
+    range_sweep(cfg, in, next, &next_indirect, false);
+    free(in);
+    in = next;
+  }
+
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    if (!in[pc].reached)
+      continue;
+    BasicBlock* bb = &cfg->blocks[pc];
+    RangeState s = in[pc];
+    for (int i = 0; i < bb->num_insts; i++) {
+      Inst* inst = &bb->insts[i];
+      if (inst->op == EXIT || (inst->op >= JEQ && inst->op <= JMP))
+        break;
+      range_transfer(&s, inst, true);
+    }
+  }
+  free(in);
+  free_cfg(cfg);
+}
+#include <ir/live.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static int live_reg_bit(Value* v) {
+  return v->type == REG ? 1 << v->reg : 0;
+}
+
+static bool live_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static int live_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return live_reg_bit(&inst->src);
+    case JMP:
+      return live_reg_bit(&inst->jmp);
+    case GETC:
+    case EXIT:
+    case DUMP:
+      return 0;
+    case COPY:
+    case FILL:
+      // The length is in jmp.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              live_reg_bit(&inst->jmp));
+    default:
+      // STORE keeps its value in dst.
+      return (live_reg_bit(&inst->dst) | live_reg_bit(&inst->src) |
+              (live_is_jump(inst->op) ? live_reg_bit(&inst->jmp) : 0));
+  }
+}
+
+static int live_defs(Inst* inst) {
+  switch (inst->op) {
+    case MOV: case ADD: case SUB: case LOAD: case GETC:
+    case EQ: case NE: case LT: case GT: case LE: case GE:
+    case MUL: case DIV: case MOD: case AND: case OR: case XOR: case SHL:
+    case SHR:
+      return live_reg_bit(&inst->dst);
+    default:
+      return 0;
+  }
+}
+
+// Computes the live-in set of the block at |pc| from the live-in sets
+// of blocks in |in|, filling in per-instruction sets if |record|.
+static int live_block(Liveness* lv, CFG* cfg, int* in, int pc,
+                      bool record) {
+  Module* m = lv->module;
+  BasicBlock* bb = &cfg->blocks[pc];
+  int live = pc + 1 < m->num_pcs ? in[pc + 1] : 0;
+  for (int i = bb->num_insts - 1; i >= 0; i--) {
+    Inst* inst = &bb->insts[i];
+    if (inst->op == EXIT) {
+      live = 0;
+    } else if (live_is_jump(inst->op)) {
+      int target = 0;
+      if (inst->jmp.type == REG)
+        target = in[cfg->indirect];
+      else if (inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs)
+        target = in[inst->jmp.imm];
+      live = inst->op == JMP ? target : live | target;
+    }
+    if (record)
+      lv->live_out[inst - m->insts] = live;
+    live = (live & ~live_defs(inst)) | live_uses(inst);
+    if (record)
+      lv->live_in[inst - m->insts] = live;
+  }
+  return live;
+}
+
+Liveness* build_liveness(Module* m) {
+  Liveness* lv = calloc(1, sizeof(Liveness));
+  lv->module = m;
+  lv->live_in = calloc(m->num_insts + 1, sizeof(int));
+  lv->live_out = calloc(m->num_insts + 1, sizeof(int));
+
+  CFG* cfg = build_cfg(m);
+  int* in = calloc(cfg->num_blocks, sizeof(int));
+  BasicBlock* indirect = &cfg->blocks[cfg->indirect];
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int pc = m->num_pcs - 1; pc >= 0; pc--) {
+      int live = live_block(lv, cfg, in, pc, false);
+      if (live != in[pc]) {
+        in[pc] = live;
+        changed = true;
+      }
+    }
+    int live = 0;
+    for (int i = 0; i < indirect->num_succs; i++)
+      live |= in[indirect->succs[i]];
+    if (live != in[cfg->indirect]) {
+      in[cfg->indirect] = live;
+      changed = true;
+    }
+  }
+  for (int pc = 0; pc < m->num_pcs; pc++)
+    live_block(lv, cfg, in, pc, true);
+
+  free(in);
+  free_cfg(cfg);
+  return lv;
+}
+
+void free_liveness(Liveness* lv) {
+  free(lv->live_in);
+  free(lv->live_out);
+  free(lv);
+}
+
+int get_live_in(Liveness* lv, Inst* inst) {
+  return lv->live_in[inst - lv->module->insts];
+}
+
+int get_live_out(Liveness* lv, Inst* inst) {
+  return lv->live_out[inst - lv->module->insts];
+}
+
+bool is_dead_store(Liveness* lv, Inst* inst) {
+  // GETC also consumes input.
+  return (inst->op != GETC && live_defs(inst) &&
+          !(live_defs(inst) & get_live_out(lv, inst)));
+}
+
+static void live_dump_set(const char* name, int regs, FILE* fp) {
+  static const char* names[] = { "A", "B", "C", "D", "BP", "SP" };
+  fprintf(fp, "%s={", name);
+  const char* sep = "";
+  for (int r = 0; r < 6; r++) {
+    if (regs & (1 << r)) {
+      fprintf(fp, "%s%s", sep, names[r]);
+      sep = ",";
+    }
+  }
+  fprintf(fp, "} ");
+}
+
+void dump_liveness(Liveness* lv, FILE* fp) {
+  for (Inst* inst = lv->module->text; inst; inst = inst->next) {
+    live_dump_set("in", get_live_in(lv, inst), fp);
+    live_dump_set("out", get_live_out(lv, inst), fp);
+    dump_inst_fp(inst, fp);
+  }
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+
+#include <ir/cfg.h>
+
+static bool merge_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+// Whether |inst| is a jump to an immediate pc of |m|.
+static bool merge_is_direct_jump(Module* m, Inst* inst) {
+  return (merge_is_jump(inst->op) && inst->jmp.type == IMM &&
+          inst->jmp.imm >= 0 && inst->jmp.imm < m->num_pcs);
+}
+
+// Returns where a jump to |pc| ends up, following blocks which are only
+// a "jmp" to another pc. Loops of such blocks are left alone.
+static int merge_thread(Module* m, int pc) {
+  int to = pc;
+  for (int steps = 0; steps < m->num_pcs; steps++) {
+    int start = m->pc_start[to];
+    if (m->pc_start[to + 1] - start != 1)
+      return to;
+    Inst* inst = &m->insts[start];
+    if (inst->op != JMP || !merge_is_direct_jump(m, inst))
+      return to;
+    to = inst->jmp.imm;
+  }
+  return pc;
+}
+
+// The last instruction of |pc| which was not removed, or NULL.
+static Inst* merge_last_inst(Module* m, bool* removed, int pc) {
+  for (int i = m->pc_start[pc + 1] - 1; i >= m->pc_start[pc]; i--) {
+    if (!removed[i])
+      return &m->insts[i];
+  }
+  return NULL;
+}
+
+void merge_basic_blocks(Module* m) {
+  int num_pcs = m->num_pcs;
+  if (!num_pcs)
+    return;
+
+  // Jumps go straight to the end of jump chains.
+  int* thread = malloc(sizeof(int) * num_pcs);
+  for (int pc = 0; pc < num_pcs; pc++)
+    thread[pc] = merge_thread(m, pc);
+  bool changed = false;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (merge_is_direct_jump(m, inst) && thread[inst->jmp.imm] != inst->jmp.imm) {
+      inst->jmp.imm = thread[inst->jmp.imm];
+      changed = true;
+    }
+  }
+  free(thread);
+
+  // A jump to the next pc does nothing, unless it is all its pc has.
+  bool* removed = calloc(m->num_insts + 1, sizeof(bool));
+  for (int pc = 0; pc + 1 < num_pcs; pc++) {
+    int last = m->pc_start[pc + 1] - 1;
+    if (last <= m->pc_start[pc])
+      continue;
+    Inst* inst = &m->insts[last];
+    if (merge_is_direct_jump(m, inst) && inst->jmp.imm == pc + 1) {
+      removed[last] = true;
+      changed = true;
+    }
+  }
+
+  // A pc which is entered only by falling into it joins the previous
+  // one. Pcs a register jump may reach keep their pcs, and so does every
+  // pc up to the highest one a plain number may name, since plain
+  // numbers are not relocated.
+  CFG* cfg = build_cfg(m);
+  bool* entered = calloc(num_pcs, sizeof(bool));
+  entered[0] = true;
+  for (int i = 0; i < m->num_insts; i++) {
+    Inst* inst = &m->insts[i];
+    if (!removed[i] && merge_is_direct_jump(m, inst))
+      entered[inst->jmp.imm] = true;
+  }
+  for (int pc = 0; pc < num_pcs; pc++)
+    entered[pc] |= cfg->blocks[pc].address_taken || pc <= cfg->max_plain_pc;
+  free_cfg(cfg);
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  pc_map[0] = 0;
+  for (int pc = 1; pc < num_pcs; pc++) {
+    Inst* prev = merge_last_inst(m, removed, pc - 1);
+    bool falls = !prev || (!merge_is_jump(prev->op) && prev->op != EXIT);
+    if (falls && !entered[pc]) {
+      pc_map[pc] = pc_map[pc - 1];
+      changed = true;
+    } else {
+      pc_map[pc] = pc_map[pc - 1] + 1;
+    }
+  }
+  pc_map[num_pcs] = pc_map[num_pcs - 1] + 1;
+  free(entered);
+
+  if (changed) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      if (removed[i])
+        continue;
+      if (prev)
+        prev->next = &m->insts[i];
+      else
+        m->text = &m->insts[i];
+      prev = &m->insts[i];
+    }
+    if (prev)
+      prev->next = NULL;
+    else
+      m->text = NULL;
+
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next)
+      inst->pc = pc_map[inst->pc];
+    reindex_module(m);
+  }
+  free(pc_map);
+  free(removed);
+}
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ir/cfg.h>
+
+// Keeps the pcs reachable from pc 0 and the data they refer to, then
+// renumbers both. Any text label value in kept code or data is assumed
+// to be jumped to.
+//
+// Plain numbers are never relocated. When kept code jumps through a
+// register, a plain number in kept code or data which cfg_code_address
+// says may be a pc makes every pc up to it keep its place. Likewise, data up to the
+// highest plain address given to a load or store keeps its place.
+//
+// A data object spans from one data label to the next. Objects are
+// dropped only while every kept load and store has a fixed address, as
+// code which computes addresses may step from one label into the
+// objects around it. Otherwise the data segment is kept whole.
+
+typedef struct {
+  Module* m;
+  bool* pc_live;
+  int* pc_stack;
+  int num_pc_stack;
+  // Pcs below this are kept.
+  int pc_pinned;
+  // Whether a kept jump goes through a register, and the highest plain
+  // number in kept code or data which may be a pc, or -1.
+  bool reg_jump;
+  int max_pc_number;
+  Data** words;
+  int num_words;
+  // The object of each word, and where each object starts.
+  int* word_obj;
+  int* obj_start;
+  int num_objs;
+  bool* obj_live;
+  int* obj_stack;
+  int num_obj_stack;
+  // Words below this are kept.
+  int pinned;
+  // Whether every kept load and store has a fixed address.
+  bool data_exact;
+} Dce;
+
+static void dce_mark_pc(Dce* d, int pc) {
+  if (pc < 0 || pc >= d->m->num_pcs || d->pc_live[pc])
+    return;
+  d->pc_live[pc] = true;
+  d->pc_stack[d->num_pc_stack++] = pc;
+}
+
+static void dce_mark_addr(Dce* d, int addr) {
+  if (addr < 0 || addr >= d->num_words)
+    return;
+  int obj = d->word_obj[addr];
+  if (d->obj_live[obj])
+    return;
+  d->obj_live[obj] = true;
+  d->obj_stack[d->num_obj_stack++] = obj;
+}
+
+// Keeps |pc| and every pc before it where they are.
+static void dce_pin_pc(Dce* d, int pc) {
+  if (pc >= d->m->num_pcs)
+    pc = d->m->num_pcs - 1;
+  for (; d->pc_pinned <= pc; d->pc_pinned++)
+    dce_mark_pc(d, d->pc_pinned);
+}
+
+static void dce_note_number(Dce* d, int pc) {
+  if (pc > d->max_pc_number)
+    d->max_pc_number = pc;
+}
+
+// Keeps |addr| where it is. Addresses past the data are the heap's.
+static void dce_pin(Dce* d, int addr) {
+  if (addr >= d->num_words)
+    return;
+  for (; d->pinned <= addr; d->pinned++)
+    dce_mark_addr(d, d->pinned);
+}
+
+static void dce_mark_label(Dce* d, LabelType label, int v) {
+  if (label == TEXT_LABEL)
+    dce_mark_pc(d, v);
+  else if (label == DATA_LABEL)
+    dce_mark_addr(d, v);
+}
+
+static void dce_mark_value(Dce* d, Value* v) {
+  if (v->type == IMM)
+    dce_mark_label(d, v->label, v->imm);
+}
+
+static void dce_scan_pc(Dce* d, int pc) {
+  Module* m = d->m;
+  bool falls = true;
+  for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+    Inst* inst = &m->insts[i];
+    Op op = inst->op;
+    dce_mark_value(d, &inst->dst);
+    dce_mark_value(d, &inst->src);
+    if (op >= JEQ && op <= JMP) {
+      if (inst->jmp.type == IMM)
+        dce_mark_pc(d, inst->jmp.imm);
+      else
+        d->reg_jump = true;
+    } else {
+      dce_mark_value(d, &inst->jmp);
+    }
+    bool plain_src = inst->src.type == IMM && inst->src.label == NOT_LABEL;
+    if (op == LOAD || op == STORE) {
+      if (plain_src)
+        dce_pin(d, inst->src.imm);
+      else if (inst->src.type == REG)
+        d->data_exact = false;
+    } else if (op == COPY || op == FILL) {
+      d->data_exact = false;
+    } else if (plain_src) {
+      dce_note_number(d, cfg_code_address(m, inst, &inst->src, true));
+    }
+    if (inst->op == JMP || inst->op == EXIT)
+      falls = false;
+  }
+  if (falls)
+    dce_mark_pc(d, pc + 1);
+}
+
+static void dce_scan_obj(Dce* d, int obj) {
+  for (int a = d->obj_start[obj]; a < d->obj_start[obj + 1]; a++) {
+    Data* data = d->words[a];
+    if (data->label == NOT_LABEL)
+      dce_note_number(d, cfg_data_code_address(d->m, data, true));
+    else
+      dce_mark_label(d, data->label, data->v);
+  }
+}
+
+static void dce_init_objects(Dce* d) {
+  Module* m = d->m;
+  bool* starts = calloc(d->num_words + 1, sizeof(bool));
+  starts[0] = true;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && sym->value >= 0 && sym->value < d->num_words)
+      starts[sym->value] = true;
+  }
+  d->word_obj = malloc(sizeof(int) * (d->num_words + 1));
+  d->obj_start = malloc(sizeof(int) * (d->num_words + 1));
+  for (int a = 0; a < d->num_words; a++) {
+    if (starts[a])
+      d->obj_start[d->num_objs++] = a;
+    d->word_obj[a] = d->num_objs - 1;
+  }
+  d->obj_start[d->num_objs] = d->num_words;
+  d->obj_live = calloc(d->num_objs + 1, sizeof(bool));
+  d->obj_stack = malloc(sizeof(int) * (d->num_objs + 1));
+  free(starts);
+}
+
+static void dce_relocate_data(Value* v, const int* data_map, int num_words) {
+  if (v->type == IMM && v->label == DATA_LABEL &&
+      v->imm >= 0 && v->imm <= num_words)
+    v->imm = data_map[v->imm];
+}
+
+void remove_dead_code_and_data(Module* m) {
+  if (!m->num_pcs)
+    return;
+
+  Dce d = {};
+  d.m = m;
+  d.max_pc_number = -1;
+  d.data_exact = true;
+  d.pc_live = calloc(m->num_pcs, sizeof(bool));
+  d.pc_stack = malloc(sizeof(int) * m->num_pcs);
+  for (Data* data = m->data; data; data = data->next)
+    d.num_words++;
+  d.words = malloc(sizeof(Data*) * (d.num_words + 1));
+  int n = 0;
+  for (Data* data = m->data; data; data = data->next)
+    d.words[n++] = data;
+  dce_init_objects(&d);
+
+  // _edata holds the start of the heap, which malloc reads.
+  Data* edata = NULL;
+  for (int i = 0; i < m->num_syms; i++) {
+    Symbol* sym = &m->syms[i];
+    if (!sym->is_text && !strcmp(sym->name, "_edata") &&
+        sym->value >= 0 && sym->value < d.num_words) {
+      edata = d.words[sym->value];
+      dce_mark_addr(&d, sym->value);
+    }
+  }
+  dce_mark_pc(&d, 0);
+  for (;;) {
+    while (d.num_pc_stack || d.num_obj_stack) {
+      if (d.num_pc_stack)
+        dce_scan_pc(&d, d.pc_stack[--d.num_pc_stack]);
+      else
+        dce_scan_obj(&d, d.obj_stack[--d.num_obj_stack]);
+    }
+    // Both may keep more code, which may find more of either.
+    if (!d.data_exact && d.pinned < d.num_words)
+      dce_pin(&d, d.num_words - 1);
+    else if (d.reg_jump && d.pc_pinned <= d.max_pc_number)
+      dce_pin_pc(&d, d.max_pc_number);
+    else
+      break;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (m->num_pcs + 1));
+  int num_pcs = 0;
+  for (int pc = 0; pc < m->num_pcs; pc++) {
+    pc_map[pc] = num_pcs;
+    num_pcs += d.pc_live[pc];
+  }
+  pc_map[m->num_pcs] = num_pcs;
+  int* data_map = malloc(sizeof(int) * (d.num_words + 1));
+  int num_words = 0;
+  for (int a = 0; a < d.num_words; a++) {
+    data_map[a] = num_words;
+    num_words += d.obj_live[d.word_obj[a]];
+  }
+  data_map[d.num_words] = num_words;
+
+  if (num_pcs < m->num_pcs || num_words < d.num_words) {
+    Inst* prev = NULL;
+    for (int i = 0; i < m->num_insts; i++) {
+      Inst* inst = &m->insts[i];
+      if (!d.pc_live[inst->pc])
+        continue;
+      if (prev)
+        prev->next = inst;
+      else
+        m->text = inst;
+      prev = inst;
+    }
+    prev->next = NULL;
+    relocate_text_labels(m, pc_map);
+    for (Inst* inst = m->text; inst; inst = inst->next) {
+      inst->pc = pc_map[inst->pc];
+      dce_relocate_data(&inst->dst, data_map, d.num_words);
+      dce_relocate_data(&inst->src, data_map, d.num_words);
+      if (inst->op < JEQ || inst->op > JMP)
+        dce_relocate_data(&inst->jmp, data_map, d.num_words);
+    }
+
+    Data* last = NULL;
+    m->data = NULL;
+    for (int a = 0; a < d.num_words; a++) {
+      Data* data = d.words[a];
+      if (!d.obj_live[d.word_obj[a]])
+        continue;
+      if (data->label == DATA_LABEL && data->v >= 0 && data->v <= d.num_words)
+        data->v = data_map[data->v];
+      if (last)
+        last->next = data;
+      else
+        m->data = data;
+      last = data;
+    }
+    if (last)
+      last->next = NULL;
+    if (edata && edata->v >= 0 && edata->v <= d.num_words)
+      edata->v = data_map[edata->v];
+    for (int i = 0; i < m->num_syms; i++) {
+      Symbol* sym = &m->syms[i];
+      if (!sym->is_text && sym->value >= 0 && sym->value <= d.num_words)
+        sym->value = data_map[sym->value];
+    }
+    reindex_module(m);
+  }
+
+  free(pc_map);
+  free(data_map);
+  free(d.pc_live);
+  free(d.pc_stack);
+  free(d.words);
+  free(d.word_obj);
+  free(d.obj_start);
+  free(d.obj_live);
+  free(d.obj_stack);
+}
+#include <ir/cfg.h>
+#include <ir/pass.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Backends built on emit_chunked_main_loop put pcs p with the same
+// p / chunk size into one function, and every jump between functions
+// goes through the outer dispatcher. The layout pass moves hot code
+// together so hot loops do not cross a chunk boundary.
+//
+// Pcs linked by fallthrough form a chain, which is moved as a whole so
+// no jump needs to be added. Starting from the hottest chain not yet
+// placed, a group grows by the hottest chain any of its members jumps
+// to, until it would not fit in a chunk. A group which would straddle
+// a boundary starts at the next one instead, leaving unused pcs. The
+// chains with pc 0 and with the pcs a plain number may name keep their
+// place, hot groups follow by heat, and chains which never ran keep
+// their order at the end.
+
+static int g_layout_chunk_size = 512;
+
+void set_layout_chunk_size(int n) {
+  g_layout_chunk_size = n;
+}
+
+// Only the hosted tools take -profile=, and ELVM's libc has no strncmp.
+#ifndef __eir__
+void load_pc_profile(Module* m, const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "cannot open profile: %s\n", filename);
+    exit(1);
+  }
+  char buf[256];
+  while (fgets(buf, sizeof(buf), fp)) {
+    if (strncmp(buf, "pc ", 3))
+      continue;
+    char* p;
+    int pc = strtol(buf + 3, &p, 10);
+    long count = strtol(p, NULL, 10);
+    if (pc < 0 || pc >= m->num_pcs)
+      continue;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++)
+      m->insts[i].count = count;
+  }
+  fclose(fp);
+}
+#endif
+
+typedef struct {
+  int first_pc;
+  int num_pcs;
+  long heat;
+  bool placed;
+} LayoutChain;
+
+static bool layout_falls(Module* m, int pc) {
+  int end = m->pc_start[pc + 1];
+  if (end == m->pc_start[pc])
+    return true;
+  Op op = m->insts[end - 1].op;
+  return op != JMP && op != EXIT;
+}
+
+static int layout_compare_heat(const void* a, const void* b) {
+  const LayoutChain* x = *(LayoutChain* const*)a;
+  const LayoutChain* y = *(LayoutChain* const*)b;
+  if (x->heat != y->heat)
+    return x->heat > y->heat ? -1 : 1;
+  return x->first_pc - y->first_pc;
+}
+
+// Returns the hottest unplaced chain the chains in |group| jump to, or
+// -1 if there is none with a count.
+static int layout_best_succ(Module* m, LayoutChain* chains, int* chain_of,
+                            int* group, int num_group) {
+  int best = -1;
+  for (int g = 0; g < num_group; g++) {
+    LayoutChain* c = &chains[group[g]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      if (inst->op < JEQ || inst->op > JMP || inst->jmp.type != IMM ||
+          inst->jmp.imm < 0 || inst->jmp.imm >= m->num_pcs)
+        continue;
+      int to = chain_of[inst->jmp.imm];
+      if (chains[to].placed || !chains[to].heat)
+        continue;
+      if (best == -1 || chains[to].heat > chains[best].heat)
+        best = to;
+    }
+  }
+  return best;
+}
+
+// Returns the hottest unplaced chain, or -1 if there is none with a
+// count. |by_heat| before |*next_seed| are all placed.
+static int layout_next_seed(LayoutChain* chains, LayoutChain** by_heat,
+                            int num_chains, int* next_seed) {
+  for (; *next_seed < num_chains; (*next_seed)++) {
+    LayoutChain* c = by_heat[*next_seed];
+    if (!c->placed && c->heat)
+      return c - chains;
+  }
+  return -1;
+}
+
+void layout_by_profile(Module* m) {
+  bool has_counts = false;
+  for (int i = 0; i < m->num_insts; i++)
+    has_counts |= m->insts[i].count != 0;
+  if (!has_counts)
+    return;
+
+  int num_pcs = m->num_pcs;
+  int chunk = g_layout_chunk_size;
+  LayoutChain* chains = calloc(num_pcs, sizeof(LayoutChain));
+  int* chain_of = malloc(sizeof(int) * num_pcs);
+  int num_chains = 0;
+  for (int pc = 0; pc < num_pcs; pc++) {
+    if (pc == 0 || !layout_falls(m, pc - 1))
+      chains[num_chains++].first_pc = pc;
+    LayoutChain* c = &chains[num_chains - 1];
+    c->num_pcs++;
+    for (int i = m->pc_start[pc]; i < m->pc_start[pc + 1]; i++) {
+      if (m->insts[i].count > c->heat)
+        c->heat = m->insts[i].count;
+    }
+    chain_of[pc] = num_chains - 1;
+  }
+  // Falling off the last pc must still end the program, so the last
+  // chain stays last if it can.
+  if (layout_falls(m, num_pcs - 1))
+    chains[num_chains - 1].heat = 0;
+
+  LayoutChain** by_heat = malloc(sizeof(LayoutChain*) * num_chains);
+  for (int i = 0; i < num_chains; i++)
+    by_heat[i] = &chains[i];
+  qsort(by_heat, num_chains, sizeof(LayoutChain*), layout_compare_heat);
+
+  // Chains in their new order, and where each goes.
+  int* order = malloc(sizeof(int) * num_chains);
+  int* base = malloc(sizeof(int) * num_chains);
+  int num_order = 0;
+  int next_pc = 0;
+  int next_seed = 0;
+  CFG* cfg = build_cfg(m);
+  int max_fixed_pc = cfg->max_plain_pc;
+  free_cfg(cfg);
+  for (int c = 0; c < num_chains &&
+                  (c == 0 || chains[c].first_pc <= max_fixed_pc); c++) {
+    chains[c].placed = true;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+  for (int seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+       seed >= 0;) {
+    int* group = &order[num_order];
+    int num_group = 0;
+    int size = 0;
+    for (int c = seed; c >= 0;
+         c = layout_best_succ(m, chains, chain_of, group, num_group)) {
+      if (num_group && size + chains[c].num_pcs > chunk)
+        break;
+      chains[c].placed = true;
+      group[num_group++] = c;
+      size += chains[c].num_pcs;
+    }
+    if (size <= chunk && next_pc % chunk + size > chunk)
+      next_pc += chunk - next_pc % chunk;
+    for (int g = 0; g < num_group; g++) {
+      base[group[g]] = next_pc;
+      next_pc += chains[group[g]].num_pcs;
+    }
+    num_order += num_group;
+    seed = layout_next_seed(chains, by_heat, num_chains, &next_seed);
+  }
+  for (int c = 0; c < num_chains; c++) {
+    if (chains[c].placed)
+      continue;
+    order[num_order++] = c;
+    base[c] = next_pc;
+    next_pc += chains[c].num_pcs;
+  }
+
+  int* pc_map = malloc(sizeof(int) * (num_pcs + 1));
+  for (int c = 0; c < num_chains; c++) {
+    for (int i = 0; i < chains[c].num_pcs; i++)
+      pc_map[chains[c].first_pc + i] = base[c] + i;
+  }
+  pc_map[num_pcs] = next_pc;
+  relocate_text_labels(m, pc_map);
+
+  Inst root = {};
+  Inst* tail = &root;
+  for (int o = 0; o < num_order; o++) {
+    LayoutChain* c = &chains[order[o]];
+    int start = m->pc_start[c->first_pc];
+    int end = m->pc_start[c->first_pc + c->num_pcs];
+    for (int i = start; i < end; i++) {
+      Inst* inst = &m->insts[i];
+      inst->pc = pc_map[inst->pc];
+      tail->next = inst;
+      tail = inst;
+    }
+  }
+  tail->next = NULL;
+  m->text = root.next;
+  reindex_module(m);
+
+  free(pc_map);
+  free(base);
+  free(order);
+  free(by_heat);
+  free(chain_of);
+  free(chains);
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+unsigned int a;
+unsigned int b;
+unsigned int c;
+unsigned int d;
+unsigned int bp;
+unsigned int sp;
+unsigned int pc;
+unsigned int mem[1<<24];
+
+void func0() {
+ while (0 <= pc && pc < 512) {
+  switch (pc) {
+  case -1:  /* dummy */
+   break;
+
+  case 0:
+   if (1) pc = 1 - 1;
+   break;
+
+  case 1:
+   putchar(106);
+   putchar(101);
+   putchar(113);
+   putchar(58);
+   putchar(32);
+   a = 999;
+   a = 70;
+   putchar(70);
+   if (1) pc = 3 - 1;
+   break;
+
+  case 2:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 3:
+   a = 1000;
+   if (1) pc = 5 - 1;
+   break;
+
+  case 4:
+   a = 70;
+   putchar(70);
+   if (1) pc = 6 - 1;
+   break;
+
+  case 5:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 6:
+   a = 1001;
+   a = 70;
+   putchar(70);
+   if (1) pc = 8 - 1;
+   break;
+
+  case 7:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 8:
+   putchar(10);
+   putchar(106);
+   putchar(110);
+   putchar(101);
+   putchar(58);
+   putchar(32);
+   a = 999;
+   if (1) pc = 10 - 1;
+   break;
+
+  case 9:
+   a = 70;
+   putchar(70);
+   if (1) pc = 11 - 1;
+   break;
+
+  case 10:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 11:
+   a = 1000;
+   a = 70;
+   putchar(70);
+   if (1) pc = 13 - 1;
+   break;
+
+  case 12:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 13:
+   a = 1001;
+   if (1) pc = 15 - 1;
+   break;
+
+  case 14:
+   a = 70;
+   putchar(70);
+   if (1) pc = 16 - 1;
+   break;
+
+  case 15:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 16:
+   putchar(10);
+   putchar(106);
+   putchar(108);
+   putchar(116);
+   putchar(58);
+   putchar(32);
+   a = 999;
+   if (1) pc = 18 - 1;
+   break;
+
+  case 17:
+   a = 70;
+   putchar(70);
+   if (1) pc = 19 - 1;
+   break;
+
+  case 18:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 19:
+   a = 1000;
+   a = 70;
+   putchar(70);
+   if (1) pc = 21 - 1;
+   break;
+
+  case 20:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 21:
+   a = 1001;
+   a = 70;
+   putchar(70);
+   if (1) pc = 23 - 1;
+   break;
+
+  case 22:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 23:
+   putchar(10);
+   putchar(106);
+   putchar(103);
+   putchar(116);
+   putchar(58);
+   putchar(32);
+   a = 999;
+   a = 70;
+   putchar(70);
+   if (1) pc = 25 - 1;
+   break;
+
+  case 24:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 25:
+   a = 1000;
+   a = 70;
+   putchar(70);
+   if (1) pc = 27 - 1;
+   break;
+
+  case 26:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 27:
+   a = 1001;
+   if (1) pc = 29 - 1;
+   break;
+
+  case 28:
+   a = 70;
+   putchar(70);
+   if (1) pc = 30 - 1;
+   break;
+
+  case 29:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 30:
+   putchar(10);
+   putchar(106);
+   putchar(108);
+   putchar(101);
+   putchar(58);
+   putchar(32);
+   a = 999;
+   if (1) pc = 32 - 1;
+   break;
+
+  case 31:
+   a = 70;
+   putchar(70);
+   if (1) pc = 33 - 1;
+   break;
+
+  case 32:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 33:
+   a = 1000;
+   if (1) pc = 35 - 1;
+   break;
+
+  case 34:
+   a = 70;
+   putchar(70);
+   if (1) pc = 36 - 1;
+   break;
+
+  case 35:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 36:
+   a = 1001;
+   a = 70;
+   putchar(70);
+   if (1) pc = 38 - 1;
+   break;
+
+  case 37:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 38:
+   putchar(10);
+   putchar(106);
+   putchar(103);
+   putchar(101);
+   putchar(58);
+   putchar(32);
+   a = 999;
+   a = 70;
+   putchar(70);
+   if (1) pc = 40 - 1;
+   break;
+
+  case 39:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 40:
+   a = 1000;
+   if (1) pc = 42 - 1;
+   break;
+
+  case 41:
+   a = 70;
+   putchar(70);
+   if (1) pc = 43 - 1;
+   break;
+
+  case 42:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 43:
+   a = 1001;
+   if (1) pc = 45 - 1;
+   break;
+
+  case 44:
+   a = 70;
+   putchar(70);
+   if (1) pc = 46 - 1;
+   break;
+
+  case 45:
+   a = 84;
+   putchar(84);
+   break;
+
+  case 46:
+   putchar(10);
+   exit(0);
+  }
+  pc++;
+ }
+}
+int main() {
+ mem[0] = 1;
+
+ while (1) {
+  switch (pc / 512 | 0) {
+  case 0:
+   func0();
+   break;
+  }
+ }
+ return 1;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+unsigned int a;
+unsigned int b;
+unsigned int c;
+unsigned int d;
+unsigned int bp;
+unsigned int sp;
+unsigned int pc;
+unsigned int mem[1<<24];
+
+void func0() {
+ while (0 <= pc && pc < 512) {
+  switch (pc) {
+  case -1:  /* dummy */
+   break;
+
+  case 0:
+   if (1) pc = 1 - 1;
+   break;
+
+  case 1:
+   c = 67;
+   d = 68;
+   bp = 69;
+   putchar(10);
+   putchar(65);
+   putchar(66);
+   putchar(67);
+   putchar(68);
+   putchar(69);
+   putchar(70);
+   putchar(10);
+   { int _ = getchar(); sp = _ != EOF ? _ : 0; }
+   sp = (sp + 88) & 16777215;
+   putchar(sp);
+   putchar(65);
+   { int _ = getchar(); a = _ != EOF ? _ : 0; }
+   a = (a + 87) & 16777215;
+   putchar(a);
+   putchar(66);
+   { int _ = getchar(); b = _ != EOF ? _ : 0; }
+   putchar(86);
+   putchar(67);
+   putchar(68);
+   putchar(10);
+   b = 66;
+   a = 3;
+   putchar(65);
+   if (1) pc = 3 - 1;
+   break;
+
+  case 2:
+   putchar(78);
+   exit(0);
+   break;
+
+  case 3:
+   putchar(b);
+   putchar(10);
+   exit(0);
+  }
+  pc++;
+ }
+}
+int main() {
+ mem[0] = 1;
+
+ while (1) {
+  switch (pc / 512 | 0) {
+  case 0:
+   func0();
+   break;
+  }
+ }
+ return 1;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+unsigned int a;
+unsigned int b;
+unsigned int c;
+unsigned int d;
+unsigned int bp;
+unsigned int sp;
+unsigned int pc;
+unsigned int mem[1<<24];
+
+void func0() {
+ while (0 <= pc && pc < 512) {
+  switch (pc) {
+  case -1:  /* dummy */
+   break;
+
+  case 0:
+   if (1) pc = 1 - 1;
+   break;
+
+  case 1:
+   a = 0;
+   if (1) pc = 7 - 1;
+   break;
+
+  case 2:
+   putchar(66);
+   break;
+
+  case 3:
+   putchar(67);
+   break;
+
+  case 4:
+   putchar(68);
+   b = 11;
+   if (a == 0) pc = 10 - 1;
+   break;
+
+  case 5:
+   if (1) pc = b - 1;
+   break;
+
+  case 6:
+   if (1) pc = 7 - 1;
+   break;
+
+  case 7:
+   putchar(65);
+   if (1) pc = 2 - 1;
+   break;
+
+  case 8:
+   if (1) pc = 10 - 1;
+   break;
+
+  case 9:
+   if (1) pc = 10 - 1;
+   break;
+
+  case 10:
+   a = 1;
+   if (1) pc = 4 - 1;
+   break;
+
+  case 11:
+   putchar(10);
+   if (1) pc = 14 - 1;
+   break;
+
+  case 12:
+   if (1) pc = 13 - 1;
+   break;
+
+  case 13:
+   if (1) pc = 12 - 1;
+   break;
+
+  case 14:
+   { int _ = getchar(); c = _ != EOF ? _ : 0; }
+   b = 17;
+   if (c == 1) pc = 16 - 1;
+   break;
+
+  case 15:
+   if (1) pc = b - 1;
+   break;
+
+  case 16:
+   putchar(65);
+   break;
+
+  case 17:
+   putchar(66);
+   putchar(10);
+   exit(0);
+  }
+  pc++;
+ }
+}
+int main() {
+ mem[0] = 1;
+
+ while (1) {
+  switch (pc / 512 | 0) {
+  case 0:
+   func0();
+   break;
+  }
+ }
+ return 1;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+unsigned int a;
+unsigned int b;
+unsigned int c;
+unsigned int d;
+unsigned int bp;
+unsigned int sp;
+unsigned int pc;
+unsigned int mem[1<<24];
+
+void func0() {
+ while (0 <= pc && pc < 512) {
+  switch (pc) {
+  case -1:  /* dummy */
+   break;
+
+  case 0:
+   if (1) pc = 1 - 1;
+   break;
+
+  case 1:
+   c = 68;
+   mem[100] = c;
+   d = 68;
+   putchar(68);
+   putchar(66);
+   a = 70;
+   mem[sp] = a;
+   b = 70;
+   putchar(70);
+   if (1) pc = 3 - 1;
+   break;
+
+  case 2:
+   putchar(88);
+   break;
+
+  case 3:
+   a = 16777215;
+   if (1) pc = 5 - 1;
+   break;
+
+  case 4:
+   putchar(88);
+   break;
+
+  case 5:
+   putchar(10);
+   exit(0);
+  }
+  pc++;
+ }
+}
+int main() {
+ mem[0] = 1;
+
+ while (1) {
+  switch (pc / 512 | 0) {
+  case 0:
+   func0();
+   break;
+  }
+ }
+ return 1;
+}
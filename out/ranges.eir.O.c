@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+unsigned int a;
+unsigned int b;
+unsigned int c;
+unsigned int d;
+unsigned int bp;
+unsigned int sp;
+unsigned int pc;
+unsigned int mem[1<<24];
+
+void func0() {
+ while (0 <= pc && pc < 512) {
+  switch (pc) {
+  case -1:  /* dummy */
+   break;
+
+  case 0:
+   if (1) pc = 1 - 1;
+   break;
+
+  case 1:
+   a = 0;
+   b = 65;
+   break;
+
+  case 2:
+   putchar(b);
+   b = (b + 1) & 16777215;
+   a = a + 1;
+   if (a < 5) pc = 2 - 1;
+   break;
+
+  case 3:
+   putchar(10);
+   c = 5;
+   break;
+
+  case 4:
+   c = c - 1;
+   d = c;
+   d = (d + 48) & 16777215;
+   putchar(d);
+   if (c != 0) pc = 4 - 1;
+   break;
+
+  case 5:
+   putchar(10);
+   a = 16777215;
+   if (1) pc = 7 - 1;
+   break;
+
+  case 6:
+   putchar(78);
+   break;
+
+  case 7:
+   putchar(48);
+   { int _ = getchar(); c = _ != EOF ? _ : 0; }
+   c = (c + 16777215) & 16777215;
+   c = (c - 16777146) & 16777215;
+   putchar(c);
+   putchar(10);
+   a = 16777215;
+   b = 9;
+   if (1) pc = 9 - 1;
+   break;
+
+  case 8:
+   putchar(78);
+   break;
+
+  case 9:
+   a = (a + 90) & 16777215;
+   putchar(a);
+   d = 16777215;
+   d = d - a;
+   d = (d - 16777050) & 16777215;
+   putchar(d);
+   putchar(10);
+   a = 16777215;
+   b = 12;
+   { int _ = getchar(); c = _ != EOF ? _ : 0; }
+   if (c == 1) pc = 11 - 1;
+   break;
+
+  case 10:
+   if (1) pc = b - 1;
+   break;
+
+  case 11:
+   a = 0;
+   break;
+
+  case 12:
+   a = (a + 1) & 16777215;
+   if (a == 0) pc = 14 - 1;
+   break;
+
+  case 13:
+   putchar(78);
+   putchar(10);
+   exit(0);
+   break;
+
+  case 14:
+   putchar(90);
+   putchar(10);
+   exit(0);
+  }
+  pc++;
+ }
+}
+int main() {
+ mem[0] = 1;
+
+ while (1) {
+  switch (pc / 512 | 0) {
+  case 0:
+   func0();
+   break;
+  }
+ }
+ return 1;
+}
@@ -0,0 +1,27 @@
+# Runs every test through dump_ir -passes=$(PASS) and checks that eli
+# prints the same as without it. PASS_FLAGS, if any, are more flags
+# for dump_ir.
+
+include clear_vars.mk
+SRCS := $(OUT.eir)
+EXT := $(PASS).eirb
+$(eval CMD = out/dump_ir -passes=$(PASS) $(PASS_FLAGS) -b $$1.tmp $$2 && mv $$1.tmp $$1)
+OUT.eir.$(PASS).eirb := $(SRCS:%=%.$(EXT))
+include build.mk
+
+include clear_vars.mk
+SRCS := $(OUT.eir.$(PASS).eirb)
+EXT := out
+DEPS := $(TEST_INS) runtest.sh
+CMD = ./runtest.sh $1 $(ELI) $2
+OUT.eir.$(PASS).eirb.out := $(SRCS:%=%.$(EXT))
+include build.mk
+
+include clear_vars.mk
+EXPECT := eir.out
+ACTUAL := eir.$(PASS).eirb.out
+include diff.mk
+
+test-$(PASS): $(DIFFS)
+
+PASS_FLAGS :=
@@ -213,6 +213,65 @@ static void init_state_arm(Data* data, int rodata_addr) {
   emit_arm_mov_imm8(SP, 0, Shl0);
 }
 
+// Computes "R0 = R0 op R1" for an extended op. R2 and R3 are scratch.
+static void emit_arm_ext_op(Op op) {
+  switch (op) {
+  case MUL:
+    emit_4le(0xe0, 0x00, 0x00, 0x91);  // mul r0, r1, r0
+    emit_reg2op(ARM_AND, R0, FFFFFF);
+    break;
+
+  case AND:
+    emit_reg2op(ARM_AND, R0, R1);
+    break;
+
+  case OR:
+    emit_4le(0xe1, 0x80, 0x00, 0x01);  // orr r0, r0, r1
+    break;
+
+  case XOR:
+    emit_4le(0xe0, 0x20, 0x00, 0x01);  // eor r0, r0, r1
+    break;
+
+  case SHL:
+  case SHR:
+    emit_4le(0xe3, 0x51, 0x00, 0x18);  // cmp r1, #24
+    emit_4le(0x23, 0xa0, 0x00, 0x00);  // movhs r0, #0
+    // lsllo/lsrlo r0, r0, r1
+    emit_4le(0x31, 0xa0, 0x01, op == SHL ? 0x10 : 0x30);
+    emit_reg2op(ARM_AND, R0, FFFFFF);
+    break;
+
+  case DIV:
+  case MOD:
+    // Restoring division. R2 collects the quotient above a sentinel
+    // bit which reaches bit 24 after 24 rounds, R3 is the remainder.
+    // A zero divisor leaves the dividend in R3.
+    emit_arm_mov_imm8(R2, 1, Shl0);
+    emit_arm_mov_imm8(R3, 0, Shl0);
+    emit_4le(0xe1, 0xa0, 0x00, 0x80);  // lsl r0, r0, #1
+    emit_4le(0xe1, 0xa0, 0x30, 0x83);  // lsl r3, r3, #1
+    emit_4le(0xe1, 0x83, 0x3c, 0x20);  // orr r3, r3, r0, lsr #24
+    emit_reg2op(ARM_AND, R0, FFFFFF);
+    emit_4le(0xe1, 0x53, 0x00, 0x01);  // cmp r3, r1
+    emit_4le(0x20, 0x43, 0x30, 0x01);  // subhs r3, r3, r1
+    emit_4le(0xe0, 0xa2, 0x20, 0x02);  // adc r2, r2, r2
+    emit_4le(0xe3, 0x12, 0x04, 0x01);  // tst r2, #1<<24
+    emit_4le(0x0a, 0xff, 0xff, 0xf6);  // beq (8 insts back)
+    if (op == DIV) {
+      emit_4le(0xe0, 0x02, 0x00, 0x0c);  // and r0, r2, r12
+      emit_4le(0xe3, 0x51, 0x00, 0x00);  // cmp r1, #0
+      emit_4le(0x03, 0xa0, 0x00, 0x00);  // moveq r0, #0
+    } else {
+      emit_arm_mov_reg(R0, R3);
+    }
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
 static void arm_emit_inst(Inst* inst, int* pc2addr) {
   Reg reg;
 
@@ -231,7 +290,10 @@ static void arm_emit_inst(Inst* inst, int* pc2addr) {
     } else {
       emit_arm_add_imm(inst->dst.reg, inst->src.imm);
     }
-    emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
+    // emit_arm_add_imm subtracts for big immediates, which needs the mask
+    // even if the sum fits.
+    if (!inst->no_wrap || (inst->src.type == IMM && inst->src.imm > 0xffff00))
+      emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
     break;
 
   case SUB:
@@ -240,7 +302,8 @@ static void arm_emit_inst(Inst* inst, int* pc2addr) {
     } else {
       emit_arm_sub_imm(inst->dst.reg, inst->src.imm);
     }
-    emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
+    if (!inst->no_wrap)
+      emit_reg2op(ARM_AND, inst->dst.reg, FFFFFF);
     break;
 
   case LOAD:
@@ -290,6 +353,24 @@ static void arm_emit_inst(Inst* inst, int* pc2addr) {
   case DUMP:
     break;
 
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+  case SHL:
+  case SHR:
+    if (inst->src.type == REG) {
+      emit_arm_mov_reg(R1, inst->src.reg);
+    } else {
+      emit_arm_mov_imm(R1, inst->src.imm);
+    }
+    emit_arm_mov_reg(R0, inst->dst.reg);
+    emit_arm_ext_op(inst->op);
+    emit_arm_mov_reg(inst->dst.reg, R0);
+    break;
+
   case EQ:
     emit_arm_setcc(inst, 0x03);
     break;
@@ -351,19 +432,14 @@ void target_arm(Module* module) {
   emit_reset();
   init_state_arm(module->data, 0);
 
-  int pc_cnt = 0;
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    pc_cnt++;
-  }
-
+  int pc_cnt = module->num_pcs;
   int* pc2addr = calloc(pc_cnt, sizeof(int));
-  int prev_pc = -1;
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    if (prev_pc != inst->pc) {
-      pc2addr[inst->pc] = emit_cnt();
+  for (int pc = 0; pc < pc_cnt; pc++) {
+    pc2addr[pc] = emit_cnt();
+    for (int i = module->pc_start[pc]; i < module->pc_start[pc + 1]; i++) {
+      Inst* inst = &module->insts[i];
+      arm_emit_inst(inst, pc2addr);
     }
-    prev_pc = inst->pc;
-    arm_emit_inst(inst, pc2addr);
   }
 
   int rodata_addr = ELF_TEXT_START + emit_cnt() + ELF_HEADER_SIZE;
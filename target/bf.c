@@ -2,6 +2,7 @@
 #include <stdbool.h>
 
 #include <ir/ir.h>
+#include <ir/live.h>
 #include <target/util.h>
 
 typedef struct {
@@ -13,6 +14,7 @@ typedef struct {
 } BFGen;
 
 static BFGen bf;
+static Liveness* bf_live;
 
 static const int BF_RUNNING = 0;
 static const int BF_PC = 2;
@@ -597,7 +599,10 @@ void bf_emit_code(Inst* inst) {
           bf_dbg(format("%d pc=%d\n", inst->op, pc));
         }
 
-        bf_emit_op(inst);
+        // Every op moves a lot of cells, so skip ones whose
+        // result is never read.
+        if (!is_dead_store(bf_live, inst))
+          bf_emit_op(inst);
       }
 
       bf_move_ptr(BF_OP+3);
@@ -722,6 +727,7 @@ static void bf_emit_mem_store(void) {
 }
 
 void target_bf(Module* module) {
+  bf_live = build_liveness(module);
   bf_init_state(module->data);
 
   bf_comment("prologue");
@@ -741,4 +747,5 @@ void target_bf(Module* module) {
   emit_line("]");
   // EOL at EOF
   emit_line("[...THE END...]");
+  free_liveness(bf_live);
 }
@@ -4,6 +4,7 @@
 static void c_init_state(void) {
   emit_line("#include <stdio.h>");
   emit_line("#include <stdlib.h>");
+  emit_line("#include <string.h>");
 
   for (int i = 0; i < 7; i++) {
     emit_line("unsigned int %s;", reg_names[i]);
@@ -48,15 +49,25 @@ static void c_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
-              reg_names[inst->dst.reg],
-              reg_names[inst->dst.reg], src_str(inst));
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
-              reg_names[inst->dst.reg],
-              reg_names[inst->dst.reg], src_str(inst));
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
     break;
 
   case LOAD:
@@ -93,6 +104,56 @@ static void c_emit_inst(Inst* inst) {
               reg_names[inst->dst.reg], cmp_str(inst, "1"));
     break;
 
+  case MUL:
+    emit_line("%s = (%s * %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case DIV:
+  case MOD: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s ? %s %s %s : %s;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == DIV ? "/" : "%", src,
+              inst->op == DIV ? "0" : reg_names[inst->dst.reg]);
+    break;
+  }
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s %s= %s;", reg_names[inst->dst.reg],
+              inst->op == AND ? "&" : inst->op == OR ? "|" : "^",
+              src_str(inst));
+    break;
+
+  case SHL:
+  case SHR: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s < 24 ? (%s %s %s) & " UINT_MAX_STR " : 0;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == SHL ? "<<" : ">>", src);
+    break;
+  }
+
+  case COPY:
+    emit_line("memmove(mem + %s, mem + %s, %s * sizeof(*mem));",
+              reg_names[inst->dst.reg], src_str(inst),
+              value_str(&inst->jmp));
+    break;
+
+  case FILL:
+    if (inst->src.type == IMM && inst->src.imm == 0) {
+      emit_line("memset(mem + %s, 0, %s * sizeof(*mem));",
+                reg_names[inst->dst.reg], value_str(&inst->jmp));
+    } else {
+      emit_line("for (unsigned int i = 0; i < %s; i++) mem[%s + i] = %s;",
+                value_str(&inst->jmp), reg_names[inst->dst.reg],
+                src_str(inst));
+    }
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include <ir/ir.h>
+#include <ir/pass.h>
 #include <target/util.h>
 
 void target_arm(Module* module);
@@ -46,14 +47,75 @@ void target_x86(Module* module);
 
 typedef void (*target_func_t)(Module*);
 
+// Passes the chosen backend relies on. They run after the ones given by
+// flags.
+static char target_passes[64];
+
+static void add_target_pass(const char* name) {
+  if (*target_passes)
+    strcat(target_passes, ",");
+  strcat(target_passes, name);
+}
+
+// Backends which implement MUL .. SHR themselves.
+static bool has_ext_ops(const char* ext) {
+  return (!strcmp(ext, "arm") || !strcmp(ext, "c") || !strcmp(ext, "js") ||
+          !strcmp(ext, "ll") || !strcmp(ext, "x86"));
+}
+
+// Backends which implement COPY and FILL themselves.
+static bool has_block_ops(const char* ext) {
+  return !strcmp(ext, "c") || !strcmp(ext, "js") || !strcmp(ext, "x86");
+}
+
+// Backends which skip wrapping ADD and SUB marked as no_wrap.
+static bool uses_ranges(const char* ext) {
+  return (!strcmp(ext, "arm") || !strcmp(ext, "c") || !strcmp(ext, "cpp") ||
+          !strcmp(ext, "go") || !strcmp(ext, "java") || !strcmp(ext, "js") ||
+          !strcmp(ext, "ll") || !strcmp(ext, "x86"));
+}
+
+// Profile counts given by -profile=FILE, which the layout pass uses.
+static const char* profile_file = NULL;
+
+// The number of pcs in each function emit_chunked_main_loop emits for
+// the backend, or 0 if the backend does not use it.
+static int chunk_size(const char* ext) {
+  static const char* CHUNKED[] = {
+    "asmjs", "c", "cl", "cr", "el", "forth", "fs", "js", "ll", "lua", "php",
+    "py", "rb", "vim", NULL
+  };
+  if (!strcmp(ext, "cs") || !strcmp(ext, "java") || !strcmp(ext, "swift"))
+    return 256;
+  for (int i = 0; CHUNKED[i]; i++) {
+    if (!strcmp(ext, CHUNKED[i]))
+      return 512;
+  }
+  return 0;
+}
+
+static void add_target_passes(const char* ext) {
+  if (!has_ext_ops(ext))
+    add_target_pass("lower_ext");
+  if (!has_block_ops(ext))
+    add_target_pass("lower_block");
+  // Helpers from lowering are placed by their call counts too.
+  if (profile_file && chunk_size(ext)) {
+    set_layout_chunk_size(chunk_size(ext));
+    add_target_pass("layout");
+  }
+  // Lowering adds ADD and SUB, so the ranges pass runs last.
+  if (uses_ranges(ext))
+    add_target_pass("ranges");
+  if (!strcmp(ext, "bf"))
+    add_target_pass("split_mem");
+}
+
 static target_func_t get_target_func(const char* ext) {
   if (!strcmp(ext, "arm")) return target_arm;
   if (!strcmp(ext, "asmjs")) return target_asmjs;
   if (!strcmp(ext, "bef")) return target_bef;
-  if (!strcmp(ext, "bf")) {
-    split_basic_block_by_mem();
-    return target_bf;
-  }
+  if (!strcmp(ext, "bf")) return target_bf;
   if (!strcmp(ext, "c")) return target_c;
   if (!strcmp(ext, "cl")) return target_cl;
   if (!strcmp(ext, "cpp")) return target_cpp;
@@ -91,26 +153,71 @@ static target_func_t get_target_func(const char* ext) {
   error("unknown flag: %s", ext);
 }
 
+static bool show_pass_stats = false;
+
+// ELVM's libc has no strncmp, and this runs when elc is self-hosted.
+static bool has_prefix(const char* s, const char* prefix) {
+  for (; *prefix; s++, prefix++) {
+    if (*s != *prefix)
+      return false;
+  }
+  return true;
+}
+
+static bool handle_pass_flag(const char* arg) {
+  if (!strcmp(arg, "-O")) {
+    add_passes("opt,merge");
+  } else if (has_prefix(arg, "-passes=")) {
+    add_passes(arg + 8);
+  } else if (!strcmp(arg, "-stats")) {
+    show_pass_stats = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char* argv[]) {
 #if defined(NOFILE) || defined(__eir__)
-  char buf[32];
+  // The first line is the target, optionally followed by flags such as
+  // "-O" separated by spaces.
+  char buf[256];
   for (int i = 0;; i++) {
     int c = getchar();
-    if (c == '\n' || c == EOF) {
+    if (c == '\n' || c == EOF || i == 255) {
       buf[i] = 0;
       break;
     }
     buf[i] = c;
   }
-  target_func_t target_func = get_target_func(buf);
+  char* flags = strchr(buf, ' ');
+  while (flags) {
+    *flags++ = 0;
+    char* next = strchr(flags, ' ');
+    if (next)
+      *next = 0;
+    if (*flags && !handle_pass_flag(flags))
+      error("unknown flag: %s", flags);
+    if (next)
+      *next = ' ';
+    flags = next;
+  }
+  const char* ext = buf;
+  target_func_t target_func = get_target_func(ext);
   Module* module = load_eir(stdin);
 #else
   target_func_t target_func = NULL;
+  const char* ext = NULL;
   const char* filename = NULL;
   for (int i = 1; i < argc; i++) {
     const char* arg = argv[i];
-    if (arg[0] == '-') {
-      target_func = get_target_func(arg + 1);
+    if (handle_pass_flag(arg)) {
+      continue;
+    } else if (!strncmp(arg, "-profile=", 9)) {
+      profile_file = arg + 9;
+    } else if (arg[0] == '-') {
+      ext = arg + 1;
+      target_func = get_target_func(ext);
     } else {
       filename = arg;
     }
@@ -124,6 +231,11 @@ int main(int argc, char* argv[]) {
   }
 
   Module* module = load_eir_from_file(filename);
+  if (profile_file)
+    load_pc_profile(module, profile_file);
 #endif
+  add_target_passes(ext);
+  add_passes(target_passes);
+  run_passes(module, show_pass_stats);
   target_func(module);
 }
@@ -38,15 +38,25 @@ static void java_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
-              reg_names[inst->dst.reg],
-              reg_names[inst->dst.reg], src_str(inst));
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
-              reg_names[inst->dst.reg],
-              reg_names[inst->dst.reg], src_str(inst));
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
     break;
 
   case LOAD:
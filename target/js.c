@@ -52,15 +52,25 @@ static void js_emit_inst(Inst* inst) {
     break;
 
   case ADD:
-    emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
-              reg_names[inst->dst.reg],
-              reg_names[inst->dst.reg], src_str(inst));
+    if (inst->no_wrap) {
+      emit_line("%s = %s + %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s + %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
     break;
 
   case SUB:
-    emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
-              reg_names[inst->dst.reg],
-              reg_names[inst->dst.reg], src_str(inst));
+    if (inst->no_wrap) {
+      emit_line("%s = %s - %s;", reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    } else {
+      emit_line("%s = (%s - %s) & " UINT_MAX_STR ";",
+                reg_names[inst->dst.reg],
+                reg_names[inst->dst.reg], src_str(inst));
+    }
     break;
 
   case LOAD:
@@ -97,6 +107,51 @@ static void js_emit_inst(Inst* inst) {
               reg_names[inst->dst.reg], cmp_str(inst, "true"));
     break;
 
+  case MUL:
+    emit_line("%s = Math.imul(%s, %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case DIV:
+  case MOD: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s ? (%s %s %s) | 0 : %s;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == DIV ? "/" : "%", src,
+              inst->op == DIV ? "0" : reg_names[inst->dst.reg]);
+    break;
+  }
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s %s= %s;", reg_names[inst->dst.reg],
+              inst->op == AND ? "&" : inst->op == OR ? "|" : "^",
+              src_str(inst));
+    break;
+
+  case SHL:
+  case SHR: {
+    const char* src = src_str(inst);
+    emit_line("%s = %s < 24 ? (%s %s %s) & " UINT_MAX_STR " : 0;",
+              reg_names[inst->dst.reg], src, reg_names[inst->dst.reg],
+              inst->op == SHL ? "<<" : ">>", src);
+    break;
+  }
+
+  case COPY:
+    emit_line("mem.copyWithin(%s, %s, %s + %s);",
+              reg_names[inst->dst.reg], src_str(inst),
+              src_str(inst), value_str(&inst->jmp));
+    break;
+
+  case FILL:
+    emit_line("mem.fill(%s, %s, %s + %s);",
+              src_str(inst), reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], value_str(&inst->jmp));
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
@@ -127,6 +127,73 @@ static void ll_emit_cmp(Inst* inst) {
   }
 }
 
+// Leaves the 24-bit result of an extended op in %(func_idx-1).
+static void ll_emit_ext_op(Inst* inst) {
+  int d = func_idx;
+  emit_line("%%%d = load i32, i32* @%s, align 4", d, reg_names[inst->dst.reg]);
+  func_idx += 1;
+  const char* s;
+  if (inst->src.type == REG) {
+    emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, src_str(inst));
+    s = format("%%%d", func_idx);
+    func_idx += 1;
+  } else if (inst->src.type == IMM) {
+    s = src_str(inst);
+  } else {
+    error("invalid value");
+  }
+
+  switch (inst->op) {
+  case MUL:
+    emit_line("%%%d = mul i32 %%%d, %s", func_idx, d, s);
+    emit_line("%%%d = and i32 %%%d, 16777215", func_idx+1, func_idx);
+    func_idx += 2;
+    break;
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%%%d = %s i32 %%%d, %s", func_idx,
+              inst->op == AND ? "and" : inst->op == OR ? "or" : "xor", d, s);
+    func_idx += 1;
+    break;
+
+  case DIV:
+  case MOD:
+    // Division by zero gives 0 for div and leaves dst as is for mod.
+    emit_line("%%%d = icmp eq i32 %s, 0", func_idx, s);
+    emit_line("%%%d = select i1 %%%d, i32 1, i32 %s",
+              func_idx+1, func_idx, s);
+    emit_line("%%%d = %s i32 %%%d, %%%d", func_idx+2,
+              inst->op == DIV ? "udiv" : "urem", d, func_idx+1);
+    if (inst->op == DIV) {
+      emit_line("%%%d = select i1 %%%d, i32 0, i32 %%%d",
+                func_idx+3, func_idx, func_idx+2);
+    } else {
+      emit_line("%%%d = select i1 %%%d, i32 %%%d, i32 %%%d",
+                func_idx+3, func_idx, d, func_idx+2);
+    }
+    func_idx += 4;
+    break;
+
+  case SHL:
+  case SHR:
+    emit_line("%%%d = icmp ult i32 %s, 24", func_idx, s);
+    emit_line("%%%d = select i1 %%%d, i32 %s, i32 0",
+              func_idx+1, func_idx, s);
+    emit_line("%%%d = %s i32 %%%d, %%%d", func_idx+2,
+              inst->op == SHL ? "shl" : "lshr", d, func_idx+1);
+    emit_line("%%%d = and i32 %%%d, 16777215", func_idx+3, func_idx+2);
+    emit_line("%%%d = select i1 %%%d, i32 %%%d, i32 0",
+              func_idx+4, func_idx, func_idx+3);
+    func_idx += 5;
+    break;
+
+  default:
+    error("oops");
+  }
+}
+
 const char* ll_emit_load(Inst* inst) {
   if (inst->src.type == REG) {
     emit_line("%%%d = load i32, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
@@ -167,6 +234,10 @@ static void ll_emit_inst(Inst* inst) {
     } else {
       error("invalid value");
     }
+    if (inst->no_wrap) {
+      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx-1, reg_names[inst->dst.reg]);
+      break;
+    }
     emit_line("%%%d = and i32 %%%d, 16777215", func_idx, func_idx-1);
     emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
     func_idx += 1;
@@ -185,6 +256,10 @@ static void ll_emit_inst(Inst* inst) {
     } else {
       error("invalid value");
     }
+    if (inst->no_wrap) {
+      emit_line("store i32 %%%d, i32* @%s, align 4", func_idx-1, reg_names[inst->dst.reg]);
+      break;
+    }
     emit_line("%%%d = and i32 %%%d, 16777215", func_idx, func_idx-1);
     emit_line("store i32 %%%d, i32* @%s, align 4", func_idx, reg_names[inst->dst.reg]);
     func_idx += 1;
@@ -282,6 +357,18 @@ static void ll_emit_inst(Inst* inst) {
     func_idx += 1;
     break;
 
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+  case SHL:
+  case SHR:
+    ll_emit_ext_op(inst);
+    emit_line("store i32 %%%d, i32* @%s, align 4", func_idx-1, reg_names[inst->dst.reg]);
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
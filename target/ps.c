@@ -152,19 +152,8 @@ static void ps_emit_inst(Inst* inst) {
     }
 }
 
-static int ps_max_pc(Inst* inst){
-    int n=0;
-    while(inst){
-        if(inst->pc>n){
-            n=inst->pc;
-        }
-        inst=inst->next;
-    }
-    return n;
-}
-
 void target_ps(Module *module) {
-    ps_init_state(ps_max_pc(module->text));
+    ps_init_state(module->num_pcs - 1);
     emit_chunked_main_loop(
             module->text,
             ps_emit_func_prologue,
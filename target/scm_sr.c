@@ -172,14 +172,6 @@ static void scm_sr_emit_func_impl(Inst* inst) {
   scm_sr_emit_func_epilogue();
 }
 
-static int scm_sc_count_pc(Inst* inst) {
-  int max_pc = 0;
-  for (; inst; inst = inst->next) {
-    max_pc = (max_pc > inst->pc)?max_pc:inst->pc;
-  }
-  return max_pc;
-}
-
 static void scm_sr_emit_inst_mem_rec(int max_pc, int from, int to) {
   if (max_pc < from) {
     emit_line("'()");
@@ -256,7 +248,7 @@ void target_scm_sr(Module* module) {
   scm_sr_emit_func_impl(module->text);
   emit_line("");
 
-  scm_sr_emit_inst_mem(scm_sc_count_pc(module->text));
+  scm_sr_emit_inst_mem(module->num_pcs - 1);
   emit_line("");
 
   scm_sr_emit_data_mem(module->data);
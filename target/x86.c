@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 #include <ir/ir.h>
+#include <ir/live.h>
 #include <target/util.h>
 
 static int REGNO[] = {
@@ -19,6 +20,12 @@ static int REGNO[] = {
 #define ESI ((Reg)6)
 #define ESP ((Reg)7)
 
+static Liveness* x86_live;
+
+// Registers int 0x80 uses for the syscall number and arguments, in the
+// order they are pushed.
+static const Reg SYSCALL_REGS[] = { A, C, D, B };
+
 static void emit_int80() {
   emit_2(0xcd, 0x80);
 }
@@ -83,6 +90,101 @@ static void emit_jcc(Inst* inst, int op, int* pc2addr, int rodata_addr) {
   }
 }
 
+// Computes "EAX = EAX op ECX" for an extended op. EDX is scratch.
+static void emit_x86_ext_op(Op op) {
+  switch (op) {
+    case MUL:
+      // imul EAX, ECX; and EAX, 0xffffff
+      emit_3(0x0f, 0xaf, 0xc1);
+      emit_1(0x25);
+      emit_le(0xffffff);
+      break;
+
+    case AND:
+      emit_2(0x21, 0xc8);
+      break;
+
+    case OR:
+      emit_2(0x09, 0xc8);
+      break;
+
+    case XOR:
+      emit_2(0x31, 0xc8);
+      break;
+
+    case DIV:
+    case MOD:
+      emit_zero_reg(D);
+      // test ECX, ECX
+      emit_2(0x85, 0xc9);
+      if (op == DIV) {
+        // jz zero; div ECX; jmp done; zero: xor EAX, EAX
+        emit_2(0x74, 0x04);
+        emit_2(0xf7, 0xf1);
+        emit_2(0xeb, 0x02);
+        emit_zero_reg(A);
+      } else {
+        // jz done; div ECX; mov EAX, EDX
+        emit_2(0x74, 0x04);
+        emit_2(0xf7, 0xf1);
+        emit_mov_reg(A, D);
+      }
+      break;
+
+    case SHL:
+    case SHR:
+      // cmp ECX, 24; jae zero; shl/shr EAX, CL; and EAX, 0xffffff;
+      // jmp done; zero: xor EAX, EAX
+      emit_3(0x83, 0xf9, 0x18);
+      emit_2(0x73, 0x09);
+      emit_2(0xd3, op == SHL ? 0xe0 : 0xe8);
+      emit_1(0x25);
+      emit_le(0xffffff);
+      emit_2(0xeb, 0x02);
+      emit_zero_reg(A);
+      break;
+
+    default:
+      error("oops");
+  }
+}
+
+static void emit_push_value(Value* v) {
+  if (v->type == REG) {
+    emit_1(0x50 + REGNO[v->reg]);
+  } else {
+    emit_1(0x68);
+    emit_le(v->imm);
+  }
+}
+
+// Sets EDI to the address of dst, EAX to src and ECX to the length of
+// a block op.
+static void emit_push_operands(Inst* inst) {
+  emit_push_value(&inst->dst);
+  emit_push_value(&inst->src);
+  emit_push_value(&inst->jmp);
+  // pop ECX, EAX, EDI
+  emit_3(0x59, 0x58, 0x5f);
+  // lea EDI, [ESI+EDI*4]
+  emit_3(0x8d, 0x3c, 0xbe);
+}
+
+// Saves the registers in |regs| which a syscall clobbers.
+static void emit_save_regs(int regs) {
+  for (int i = 0; i < 4; i++) {
+    if (regs & (1 << SYSCALL_REGS[i]))
+      emit_1(0x50 + REGNO[SYSCALL_REGS[i]]);
+  }
+}
+
+static void emit_restore_regs(int regs) {
+  for (int i = 3; i >= 0; i--) {
+    if (regs & (1 << SYSCALL_REGS[i]))
+      emit_1(0x58 + REGNO[SYSCALL_REGS[i]]);
+  }
+}
+
 static void init_state_x86(Data* data) {
   emit_mov_imm(B, 0);
   // mov ECX, 1<<26
@@ -106,13 +208,14 @@ static void init_state_x86(Data* data) {
     }
   }
 
-  // mov ESP, 1<<24
-  emit_5(0xb8 + REGNO[SP], 0, 0, 0, 1);
   emit_zero_reg(A);
   emit_zero_reg(B);
   emit_zero_reg(C);
   emit_zero_reg(D);
   emit_zero_reg(BP);
+  // SP starts at 0 like the other registers. elc -O drops "add SP, 0",
+  // so it must already be a 24-bit value.
+  emit_zero_reg(SP);
 }
 
 static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
@@ -129,8 +232,10 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
         emit_2(0x81, 0xc0 + REGNO[inst->dst.reg]);
         emit_le(inst->src.imm);
       }
-      emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
-      emit_le(0xffffff);
+      if (!inst->no_wrap) {
+        emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
+        emit_le(0xffffff);
+      }
       break;
 
     case SUB:
@@ -141,8 +246,10 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
         emit_2(0x81, 0xe8 + REGNO[inst->dst.reg]);
         emit_le(inst->src.imm);
       }
-      emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
-      emit_le(0xffffff);
+      if (!inst->no_wrap) {
+        emit_2(0x81, 0xe0 + REGNO[inst->dst.reg]);
+        emit_le(0xffffff);
+      }
       break;
 
     case LOAD:
@@ -161,28 +268,30 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
       }
       break;
 
-    case PUTC:
-      // push EDI
-      emit_1(0x57);
-      emit_mov(EDI, &inst->src);
-      // push EAX, ECX, EDX, EBX, EDI
-      emit_5(0x50, 0x51, 0x52, 0x53, 0x57);
+    case PUTC: {
+      // Only registers read later need to survive the syscall.
+      int live = get_live_out(x86_live, inst);
+      emit_save_regs(live);
+      emit_push_value(&inst->src);
       emit_mov_imm(B, 1);  // stdout
       emit_mov_reg(C, ESP);
       emit_mov_imm(D, 1);
       emit_mov_imm(A, 4);  // write
       emit_int80();
-      // pop EDI, EBX, EDX, ECX, EAX
-      emit_5(0x5f, 0x5b, 0x5a, 0x59, 0x58);
-      // pop EDI
-      emit_1(0x5f);
+      // add ESP, 4
+      emit_3(0x83, 0xc4, 0x04);
+      emit_restore_regs(live);
       break;
+    }
 
-    case GETC:
-      // push EDI
-      emit_1(0x57);
-      // push EAX, ECX, EDX, EBX
-      emit_4(0x50, 0x51, 0x52, 0x53);
+    case GETC: {
+      // EDI receives the character, and dst is overwritten anyway.
+      int live = get_live_out(x86_live, inst) & ~(1 << inst->dst.reg);
+      if (live & (1 << EDI)) {
+        // push EDI
+        emit_1(0x57);
+      }
+      emit_save_regs(live);
       // push 0
       emit_2(0x6a, 0x00);
       emit_mov_imm(B, 0);  // stdin
@@ -199,12 +308,14 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
       // cmovnz EDI, EBX
       emit_3(0x0f, 0x45, 0xfb);
 
-      // pop EBX, EDX, ECX, EAX
-      emit_4(0x5b, 0x5a, 0x59, 0x58);
+      emit_restore_regs(live);
       emit_mov_reg(inst->dst.reg, EDI);
-      // pop EDI
-      emit_1(0x5f);
+      if (live & (1 << EDI)) {
+        // pop EDI
+        emit_1(0x5f);
+      }
       break;
+    }
 
     case EXIT:
       emit_mov_imm(B, 0);
@@ -215,6 +326,65 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
     case DUMP:
       break;
 
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      // push EAX, ECX, EDX
+      emit_3(0x50, 0x51, 0x52);
+      emit_push_value(&inst->src);
+      emit_push_value(&inst->dst);
+      // pop EAX, ECX
+      emit_2(0x58, 0x59);
+      emit_x86_ext_op(inst->op);
+      // Put the result where the pops below restore dst from, if any.
+      if (inst->dst.reg == A) {
+        emit_4(0x89, 0x44, 0x24, 0x08);
+      } else if (inst->dst.reg == C) {
+        emit_4(0x89, 0x44, 0x24, 0x04);
+      } else if (inst->dst.reg == D) {
+        emit_3(0x89, 0x04, 0x24);
+      } else {
+        emit_mov_reg(inst->dst.reg, A);
+      }
+      // pop EDX, ECX, EAX
+      emit_3(0x5a, 0x59, 0x58);
+      break;
+
+    case COPY:
+      // push EAX, ECX, ESI, EDI
+      emit_4(0x50, 0x51, 0x56, 0x57);
+      emit_push_operands(inst);
+      // lea ESI, [ESI+EAX*4]
+      emit_3(0x8d, 0x34, 0x86);
+      // cmp EDI, ESI; jbe forward
+      emit_4(0x39, 0xf7, 0x76, 0x0e);
+      // Copy backwards when the destination is above the source.
+      // lea ESI, [ESI+ECX*4-4]; lea EDI, [EDI+ECX*4-4]
+      emit_4(0x8d, 0x74, 0x8e, 0xfc);
+      emit_4(0x8d, 0x7c, 0x8f, 0xfc);
+      // std; rep movsd; cld; jmp done
+      emit_6(0xfd, 0xf3, 0xa5, 0xfc, 0xeb, 0x02);
+      // forward: rep movsd
+      emit_2(0xf3, 0xa5);
+      // done: pop EDI, ESI, ECX, EAX
+      emit_4(0x5f, 0x5e, 0x59, 0x58);
+      break;
+
+    case FILL:
+      // push EAX, ECX, EDI
+      emit_3(0x50, 0x51, 0x57);
+      emit_push_operands(inst);
+      // rep stosd
+      emit_2(0xf3, 0xab);
+      // pop EDI, ECX, EAX
+      emit_3(0x5f, 0x59, 0x58);
+      break;
+
     case EQ:
       emit_setcc(inst, 0x94);
       break;
@@ -275,20 +445,16 @@ static void x86_emit_inst(Inst* inst, int* pc2addr, int rodata_addr) {
 void target_x86(Module* module) {
   emit_reset();
   init_state_x86(module->data);
+  x86_live = build_liveness(module);
 
-  int pc_cnt = 0;
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    pc_cnt++;
-  }
-
+  int pc_cnt = module->num_pcs;
   int* pc2addr = calloc(pc_cnt, sizeof(int));
-  int prev_pc = -1;
-  for (Inst* inst = module->text; inst; inst = inst->next) {
-    if (prev_pc != inst->pc) {
-      pc2addr[inst->pc] = emit_cnt();
+  for (int pc = 0; pc < pc_cnt; pc++) {
+    pc2addr[pc] = emit_cnt();
+    for (int i = module->pc_start[pc]; i < module->pc_start[pc + 1]; i++) {
+      Inst* inst = &module->insts[i];
+      x86_emit_inst(inst, pc2addr, 0);
     }
-    prev_pc = inst->pc;
-    x86_emit_inst(inst, pc2addr, 0);
   }
 
   int rodata_addr = ELF_TEXT_START + emit_cnt() + ELF_HEADER_SIZE;
@@ -306,4 +472,5 @@ void target_x86(Module* module) {
   for (int i = 0; i < pc_cnt; i++) {
     emit_le(ELF_TEXT_START + pc2addr[i] + ELF_HEADER_SIZE);
   }
+  free_liveness(x86_live);
 }
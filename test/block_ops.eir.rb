@@ -0,0 +1,49 @@
+BASE = 100
+LEN = 26
+
+def emit_init
+  LEN.times{|i|
+    puts "mov A, #{97 + i}"
+    puts "store A, #{BASE + i}"
+  }
+end
+
+def emit_dump
+  LEN.times{|i|
+    puts "load A, #{BASE + i}"
+    puts "putc A"
+  }
+  puts "putc 10"
+end
+
+$label = 0
+
+# Each case sets up registers and runs one block op on a fresh copy of
+# "a".."z".
+[
+  # Disjoint, overlapping in both directions, and empty copies.
+  ['mov B, 100', 'mov C, 110', 'copy B, C, 5'],
+  ['mov B, 102', 'copy B, 100, 10'],
+  ['mov B, 100', 'mov C, 103', 'mov D, 10', 'copy B, C, D'],
+  ['mov B, 105', 'copy B, 100, 0'],
+  ['mov A, 100', 'copy A, A, 26'],
+  ['mov BP, 101', 'mov SP, 100', 'copy BP, SP, 24'],
+  # Fills with immediates and registers.
+  ['mov B, 104', 'fill B, 90, 3'],
+  ['mov B, 110', 'fill B, 0, 5', 'mov C, 110', 'fill C, 65, 2'],
+  ['mov SP, 100', 'mov C, 48', 'mov D, 6', 'fill SP, C, D'],
+  ['mov D, 100', 'fill D, 33, 0'],
+].each do |insts|
+  emit_init
+  puts insts
+  # The operands are left untouched.
+  insts.each do |inst|
+    next if inst !~ /^mov (\w+), (\d+)/
+    $label += 1
+    puts "jeq ok#{$label}, #{$1}, #{$2}"
+    puts "putc 88"
+    puts "ok#{$label}:"
+  end
+  emit_dump
+end
+puts "exit"
@@ -0,0 +1,37 @@
+# Many interleaved .data subsections. Each subsection is emitted in two
+# halves in a shuffled order, and the program reads words back relative
+# to the first subsection to check they are laid out in ascending order.
+# Pass a bigger N (e.g. 20000) to use it as a loader benchmark.
+
+N = (ARGV[0] || 300).to_i
+W = 16
+
+def word(s, i)
+  (s * 3 + i * 5) % 26 + 65
+end
+
+order = (0...N).map { |s| (s * 7919) % N }
+
+2.times do |half|
+  order.each do |s|
+    puts ".data #{s}"
+    puts "s#{s}:" if half == 0
+    (W / 2).times do |i|
+      puts ".long #{word(s, half * W / 2 + i)}"
+    end
+  end
+end
+
+puts '.text'
+puts 'main:'
+(0...N).step(13) do |s|
+  i = (s * 5) % W
+  puts 'mov B, s0'
+  puts "add B, #{s * W + i}"
+  puts 'load A, B'
+  puts 'putc A'
+  puts "load A, s#{s}"
+  puts 'putc A'
+end
+puts 'putc 10'
+puts 'exit'
@@ -0,0 +1,76 @@
+def emit_print(m)
+  m.each_byte{|b|
+    puts "mov A, #{b}"
+    puts "putc A"
+  }
+end
+
+M = 16777215
+
+EXT_OPS = {
+  'mul' => lambda{|a, b| (a * b) & M },
+  'div' => lambda{|a, b| b == 0 ? 0 : a / b },
+  'mod' => lambda{|a, b| b == 0 ? a : a % b },
+  'and' => lambda{|a, b| a & b },
+  'or' => lambda{|a, b| a | b },
+  'xor' => lambda{|a, b| a ^ b },
+  'shl' => lambda{|a, b| b < 24 ? (a << b) & M : 0 },
+  'shr' => lambda{|a, b| b < 24 ? a >> b : 0 },
+}
+
+PAIRS = [[0, 0], [7, 3], [M, M], [123456, 0], [9999999, 7], [1, 23],
+         [1, 24], [M, 100], [0x800000, 1], [255, 0xffff00], [5, 16777214]]
+
+$label = 0
+
+# Prints '.' if |reg| is |expected| and 'X' otherwise.
+def emit_check(reg, expected)
+  $label += 1
+  puts "mov A, #{reg}" if reg != 'A'
+  puts "jeq ok#{$label}, A, #{expected}"
+  puts "putc 88"
+  puts "jmp done#{$label}"
+  puts "ok#{$label}:"
+  puts "putc 46"
+  puts "done#{$label}:"
+end
+
+EXT_OPS.each do |op, f|
+  emit_print(op + ": ")
+  PAIRS.each do |a, b|
+    expected = f[a, b]
+
+    puts "mov A, #{a}"
+    puts "#{op} A, #{b}"
+    emit_check('A', expected)
+
+    puts "mov C, #{a}"
+    puts "mov D, #{b}"
+    puts "#{op} C, D"
+    emit_check('C', expected)
+
+    puts "mov BP, #{a}"
+    puts "mov SP, #{b}"
+    puts "#{op} BP, SP"
+    emit_check('BP', expected)
+
+    puts "mov B, #{a}"
+    puts "#{op} B, B"
+    emit_check('B', f[a, a])
+  end
+  emit_print "\n"
+end
+
+# Other registers survive, even when the op moves SP.
+emit_print("keep: ")
+[['A', 'mul', 1000, 7], ['SP', 'or', 1000, 3], ['SP', 'and', 1003, 1000],
+ ['SP', 'xor', 1000, 1], ['SP', 'div', 1000, 2], ['SP', 'shl', 1000, 1],
+ ['SP', 'shr', 1000, 1], ['SP', 'mod', 1002, 1003]].each do |dst, op, a, b|
+  regs = {'A' => 11, 'B' => 22, 'C' => 33, 'D' => 44, 'BP' => 55, 'SP' => 66}
+  regs[dst] = EXT_OPS[op][a, b]
+  regs.each{|r, v| puts "mov #{r}, #{r == dst ? a : v}" }
+  puts "#{op} #{dst}, #{b}"
+  %w(A B C D BP SP).each{|r| emit_check(r, regs[r]) }
+end
+emit_print "\n"
+puts "exit"